@@ -0,0 +1,727 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "FreeAge/common/free_age.hpp"
+#include "FreeAge/common/logging.hpp"
+#include "FreeAge/common/messages.hpp"
+#include "FreeAge/common/stats_database.hpp"
+#include "FreeAge/common/util.hpp"
+#include "FreeAge/server/building.hpp"
+#include "FreeAge/server/game.hpp"
+#include "FreeAge/server/map.hpp"
+#include "FreeAge/server/pathfinding.hpp"
+#include "FreeAge/server/unit.hpp"
+
+/// Number of calls to the global operator new, to determine the allocations per game step.
+static std::atomic<u64> allocationCount(0);
+
+void* operator new(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t /*size*/) noexcept {
+  std::free(ptr);
+}
+
+
+/// The maximum number of players that the benchmark supports.
+constexpr int kMaxPlayers = 8;
+
+struct BenchmarkConfig {
+  int mapSize = 100;
+  int numPlayers = 2;
+  int villagersPerPlayer = 50;
+  int militaryPerPlayer = 100;
+  int idleUnitsPerPlayer = 1000;
+  int numSteps = 900;
+  int numPathQueries = 1000;
+  int seed = 0;
+  bool useCrowdSteering = true;
+  bool useActiveSetScheduling = true;
+  bool useAnyAnglePathPlanning = true;
+};
+
+/// A headless game with the map, players, and state that is shared by the scenarios.
+struct Benchmark {
+  /// Places units on a spiral around a center point, continuing where the last unit was placed.
+  struct UnitSpawner {
+    QPointF center;
+    float radius = 0;
+    int angleIndex = 0;
+  };
+  
+  Benchmark(const BenchmarkConfig& config)
+      : config(config) {
+    settings.serverStartTime = Clock::now();
+    settings.mapSize = config.mapSize;
+    settings.useCrowdSteering = config.useCrowdSteering;
+    settings.useActiveSetScheduling = config.useActiveSetScheduling;
+    settings.useAnyAnglePathPlanning = config.useAnyAnglePathPlanning;
+    
+    map.reset(new ServerMap(config.mapSize, config.mapSize));
+    map->GenerateRandomMap(config.numPlayers, config.seed);
+    
+    spawners.resize(config.numPlayers);
+    for (const auto& item : map->GetObjects()) {
+      if (item.second->isBuilding() &&
+          AsBuilding(item.second)->GetType() == BuildingType::TownCenter) {
+        ServerBuilding* townCenter = AsBuilding(item.second);
+        QSize size = GetBuildingSize(BuildingType::TownCenter);
+        spawners[townCenter->GetPlayerIndex()].center = QPointF(
+            townCenter->GetBaseTile().x() + 0.5f * size.width(),
+            townCenter->GetBaseTile().y() + 0.5f * size.height());
+      }
+    }
+    
+    for (int playerIndex = 0; playerIndex < config.numPlayers; ++ playerIndex) {
+      std::shared_ptr<PlayerInGame> player(new PlayerInGame());
+      player->index = playerIndex;
+      player->socket = nullptr;
+      player->name = QStringLiteral("Player %1").arg(playerIndex + 1);
+      player->playerColorIndex = playerIndex;
+      player->lastPingTime = Clock::now();
+      player->finishedLoading = true;
+      
+      // Give the players plenty of resources, such that they can be spent freely in the scenarios.
+      player->resources = ResourceAmount(100000, 100000, 100000, 100000);
+      player->lastResources = player->resources;
+      
+      players.push_back(player);
+    }
+    
+    game.reset(new Game(&settings));
+  }
+  
+  /// Adds a unit close to the spawner's center. Returns its ID, or kInvalidObjectId if no free space was found.
+  u32 SpawnUnit(int playerIndex, UnitType type, UnitSpawner* spawner) {
+    ServerUnit* unit = new ServerUnit(playerIndex, type, QPointF(-1, -1));
+    float spacing = 2 * GetUnitRadius(type) + 0.05f;
+    
+    while (spawner->radius < map->GetWidth()) {
+      int numAngles = std::max(1, static_cast<int>(2 * M_PI * spawner->radius / spacing));
+      while (spawner->angleIndex < numAngles) {
+        float angle = 2 * M_PI * spawner->angleIndex / numAngles;
+        ++ spawner->angleIndex;
+        
+        QPointF mapCoord(
+            spawner->center.x() + spawner->radius * cos(angle),
+            spawner->center.y() + spawner->radius * sin(angle));
+        if (!map->DoesUnitCollide(unit, mapCoord)) {
+          unit->SetMapCoord(mapCoord);
+          return map->AddUnit(unit);
+        }
+      }
+      
+      spawner->radius += spacing;
+      spawner->angleIndex = 0;
+    }
+    
+    delete unit;
+    LOG(ERROR) << "Failed to find space for a unit";
+    return kInvalidObjectId;
+  }
+  
+  void SpawnUnits(int playerIndex, UnitType type, int count, UnitSpawner* spawner, std::vector<u32>* unitIds) {
+    for (int i = 0; i < count; ++ i) {
+      u32 unitId = SpawnUnit(playerIndex, type, spawner);
+      if (unitId != kInvalidObjectId) {
+        unitIds->push_back(unitId);
+      }
+    }
+  }
+  
+  /// Sends a message from the given player to the server, as a client would.
+  inline void SendMessage(int playerIndex, const QByteArray& msg) {
+    players[playerIndex]->unparsedBuffer += msg;
+  }
+  
+  /// Returns the unit with the given ID, or nullptr if it does not exist (anymore).
+  ServerUnit* GetUnit(u32 unitId) {
+    auto it = map->GetObjects().find(unitId);
+    return (it != map->GetObjects().end() && it->second->isUnit()) ? AsUnit(it->second) : nullptr;
+  }
+  
+  inline bool IsIdle(ServerUnit* unit) {
+    return unit->GetTargetObjectId() == kInvalidObjectId && !unit->HasMoveToTarget();
+  }
+  
+  
+  BenchmarkConfig config;
+  ServerSettings settings;
+  std::shared_ptr<ServerMap> map;
+  std::vector<std::shared_ptr<PlayerInGame>> players;
+  std::shared_ptr<Game> game;
+  
+  /// One unit spawner per player, centered on the player's town center.
+  std::vector<UnitSpawner> spawners;
+  
+  /// The units of each player that the scenario gives commands to.
+  std::vector<std::vector<u32>> playerUnitIds;
+  
+  /// For scenarios that send the units of player 0 to individual goals: the goal of each unit in playerUnitIds[0].
+  std::vector<QPointF> unitGoals;
+};
+
+/// A benchmark scenario. Setup() spawns the units, and IssueCommands() is called before each game step
+/// to send commands from the players, like clients would do. If given, AddResults() adds scenario-specific
+/// results after the last step.
+struct Scenario {
+  const char* name;
+  std::function<void(Benchmark*)> Setup;
+  std::function<void(Benchmark*, int step)> IssueCommands;
+  std::function<void(Benchmark*, QJsonObject* result)> AddResults;
+};
+
+/// Villagers of each player gather from the closest trees, forage bushes, gold, and stone mines.
+static void SetupGatherScenario(Benchmark* bench) {
+  bench->playerUnitIds.resize(bench->config.numPlayers);
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    bench->SpawnUnits(playerIndex, UnitType::FemaleVillager, bench->config.villagersPerPlayer, &bench->spawners[playerIndex], &bench->playerUnitIds[playerIndex]);
+  }
+}
+
+static void IssueGatherCommands(Benchmark* bench, int step) {
+  if (step != 0) {
+    return;
+  }
+  
+  constexpr int kNumResourceKinds = 4;
+  auto getResourceKind = [](BuildingType type) {
+    if (IsTree(type)) {
+      return 0;
+    } else if (type == BuildingType::ForageBush) {
+      return 1;
+    } else if (type == BuildingType::GoldMine) {
+      return 2;
+    } else if (type == BuildingType::StoneMine) {
+      return 3;
+    }
+    return -1;
+  };
+  
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    const std::vector<u32>& unitIds = bench->playerUnitIds[playerIndex];
+    for (usize i = 0; i < unitIds.size(); ++ i) {
+      ServerUnit* villager = bench->GetUnit(unitIds[i]);
+      int resourceKind = i % kNumResourceKinds;
+      
+      u32 closestId = kInvalidObjectId;
+      float closestSquaredDistance = std::numeric_limits<float>::infinity();
+      for (const auto& item : bench->map->GetObjects()) {
+        if (!item.second->isBuilding() ||
+            getResourceKind(AsBuilding(item.second)->GetType()) != resourceKind) {
+          continue;
+        }
+        float squaredDistance = SquaredDistance(villager->GetMapCoord(), QPointF(AsBuilding(item.second)->GetBaseTile()));
+        if (squaredDistance < closestSquaredDistance) {
+          closestSquaredDistance = squaredDistance;
+          closestId = item.first;
+        }
+      }
+      
+      if (closestId != kInvalidObjectId) {
+        bench->SendMessage(playerIndex, CreateSetTargetMessage({unitIds[i]}, closestId));
+      }
+    }
+  }
+}
+
+/// Military units of each player repeatedly move as a group to random locations on the map.
+static void SetupMovementScenario(Benchmark* bench) {
+  bench->playerUnitIds.resize(bench->config.numPlayers);
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    bench->SpawnUnits(playerIndex, UnitType::Militia, bench->config.militaryPerPlayer, &bench->spawners[playerIndex], &bench->playerUnitIds[playerIndex]);
+  }
+}
+
+static void IssueMovementCommands(Benchmark* bench, int step) {
+  constexpr int kStepsBetweenCommands = 150;
+  if (step % kStepsBetweenCommands != 0) {
+    return;
+  }
+  
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    QPointF targetMapCoord(
+        1 + rand() % (bench->config.mapSize - 2),
+        1 + rand() % (bench->config.mapSize - 2));
+    bench->SendMessage(playerIndex, CreateMoveToMapCoordMessage(bench->playerUnitIds[playerIndex], targetMapCoord));
+  }
+}
+
+/// Military units of all players meet in the map center and fight each other.
+/// For example, a battle of 500 vs. 500 units is run with: --scenario melee --military 500
+static void SetupMeleeScenario(Benchmark* bench) {
+  bench->playerUnitIds.resize(bench->config.numPlayers);
+  QPointF mapCenter(0.5f * bench->config.mapSize, 0.5f * bench->config.mapSize);
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    // Place the armies around the map center, such that the front ranks are within each other's line of sight
+    // and start fighting by automatic attacks.
+    float armyRadius = sqrtf(bench->config.militaryPerPlayer / M_PI) * (2 * GetUnitRadius(UnitType::Militia) + 0.05f);
+    float distanceToCenter = armyRadius + 1;
+    float angle = 2 * M_PI * playerIndex / bench->config.numPlayers;
+    Benchmark::UnitSpawner spawner;
+    spawner.center = mapCenter + distanceToCenter * QPointF(cos(angle), sin(angle));
+    bench->SpawnUnits(playerIndex, UnitType::Militia, bench->config.militaryPerPlayer, &spawner, &bench->playerUnitIds[playerIndex]);
+  }
+}
+
+static void IssueMeleeCommands(Benchmark* bench, int step) {
+  // Units which see an enemy attack it automatically. In addition, let the remaining idle units
+  // attack the closest enemy once in a while, like the players would do by selecting their
+  // idle units and right-clicking the enemy army.
+  constexpr int kStepsBetweenCommands = 90;
+  if (step % kStepsBetweenCommands != 0) {
+    return;
+  }
+  
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    for (u32 unitId : bench->playerUnitIds[playerIndex]) {
+      ServerUnit* unit = bench->GetUnit(unitId);
+      if (!unit || !bench->IsIdle(unit)) {
+        continue;
+      }
+      
+      u32 closestEnemyId = kInvalidObjectId;
+      float closestSquaredDistance = std::numeric_limits<float>::infinity();
+      for (int enemyIndex = 0; enemyIndex < bench->config.numPlayers; ++ enemyIndex) {
+        if (enemyIndex == playerIndex) {
+          continue;
+        }
+        for (u32 enemyId : bench->playerUnitIds[enemyIndex]) {
+          ServerUnit* enemy = bench->GetUnit(enemyId);
+          if (!enemy) {
+            continue;
+          }
+          float squaredDistance = SquaredDistance(unit->GetMapCoord(), enemy->GetMapCoord());
+          if (squaredDistance < closestSquaredDistance) {
+            closestSquaredDistance = squaredDistance;
+            closestEnemyId = enemyId;
+          }
+        }
+      }
+      
+      if (closestEnemyId != kInvalidObjectId) {
+        bench->SendMessage(playerIndex, CreateSetTargetMessage({unitId}, closestEnemyId));
+      }
+    }
+  }
+}
+
+/// Two groups of military units of player 0 swap their places, such that they have to pass through each other.
+/// Each group is a block of units in rows of five. The number of units that arrived at their goals is reported.
+/// For example, the crowd steering is compared to the side-stepping of single units with:
+/// --scenario crowdSwap --military 40 --steps 3000 [--no-crowd-steering]
+static void SetupCrowdSwapScenario(Benchmark* bench) {
+  constexpr float kGroupDistance = 30;
+  constexpr int kUnitsPerRow = 5;
+  
+  bench->playerUnitIds.resize(bench->config.numPlayers);
+  bench->unitGoals.clear();
+  
+  // Remove the trees and mines from a strip at the map center, such that the units only have to avoid each other.
+  float spacing = std::max(0.5f, 2 * GetUnitRadius(UnitType::Militia) + 0.05f);
+  int numRows = (bench->config.militaryPerPlayer + kUnitsPerRow - 1) / kUnitsPerRow;
+  int centerX = bench->config.mapSize / 2;
+  int centerY = bench->config.mapSize / 2;
+  int halfWidth = static_cast<int>(0.5f * kGroupDistance + kUnitsPerRow * spacing) + 1;
+  int halfHeight = static_cast<int>(0.5f * numRows * spacing) + 1;
+  std::vector<u32> removedIds;
+  for (const auto& item : bench->map->GetObjects()) {
+    if (item.second->isBuilding() && item.second->GetPlayerIndex() == kGaiaPlayerIndex) {
+      ServerBuilding* building = AsBuilding(item.second);
+      const QPoint& baseTile = building->GetBaseTile();
+      QSize size = GetBuildingSize(building->GetType());
+      if (baseTile.x() <= centerX + halfWidth && baseTile.x() + size.width() > centerX - halfWidth &&
+          baseTile.y() <= centerY + halfHeight && baseTile.y() + size.height() > centerY - halfHeight) {
+        bench->map->RemoveBuildingOccupancy(building);
+        removedIds.push_back(item.first);
+      }
+    }
+  }
+  for (u32 id : removedIds) {
+    bench->map->DeleteObject(id);
+  }
+  
+  // Place the groups. Every second row is shifted by half the spacing.
+  for (int group = 0; group < 2; ++ group) {
+    float direction = (group == 0) ? 1 : -1;
+    QPointF groupOrigin(centerX - direction * 0.5f * kGroupDistance, centerY - 0.5f * numRows * spacing);
+    for (int i = 0; i < bench->config.militaryPerPlayer; ++ i) {
+      int row = i / kUnitsPerRow;
+      QPointF mapCoord = groupOrigin + QPointF((i % kUnitsPerRow + 0.5f * (row % 2)) * spacing, row * spacing);
+      u32 unitId;
+      bench->map->AddUnit(0, UnitType::Militia, mapCoord, &unitId);
+      bench->playerUnitIds[0].push_back(unitId);
+      bench->unitGoals.push_back(mapCoord + QPointF(direction * kGroupDistance, 0));
+    }
+  }
+}
+
+static void IssueCrowdSwapCommands(Benchmark* bench, int step) {
+  if (step != 0) {
+    return;
+  }
+  
+  for (usize i = 0; i < bench->playerUnitIds[0].size(); ++ i) {
+    bench->SendMessage(0, CreateMoveToMapCoordMessage({bench->playerUnitIds[0][i]}, bench->unitGoals[i]));
+  }
+}
+
+static void AddCrowdSwapResults(Benchmark* bench, QJsonObject* result) {
+  constexpr float kArrivalDistance = 0.5f;
+  
+  int numArrivedUnits = 0;
+  for (usize i = 0; i < bench->playerUnitIds[0].size(); ++ i) {
+    ServerUnit* unit = bench->GetUnit(bench->playerUnitIds[0][i]);
+    if (unit && SquaredDistance(unit->GetMapCoord(), bench->unitGoals[i]) < kArrivalDistance * kArrivalDistance) {
+      ++ numArrivedUnits;
+    }
+  }
+  (*result)["units"] = static_cast<int>(bench->playerUnitIds[0].size());
+  (*result)["arrivedUnits"] = numArrivedUnits;
+}
+
+/// Many idle villagers stand around the town center of each player, while the military units of each player move
+/// as in the movement scenario. Since the idle units are neither simulated nor visited by the crowd steering, the
+/// target search, or the collision tests, the step time should not depend on their number, for example, with:
+/// --scenario idle --idle 0, --idle 1000, and --idle 4000
+static void SetupIdleScenario(Benchmark* bench) {
+  bench->playerUnitIds.resize(bench->config.numPlayers);
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    std::vector<u32> idleUnitIds;
+    bench->SpawnUnits(playerIndex, UnitType::FemaleVillager, bench->config.idleUnitsPerPlayer, &bench->spawners[playerIndex], &idleUnitIds);
+    bench->SpawnUnits(playerIndex, UnitType::Militia, bench->config.militaryPerPlayer, &bench->spawners[playerIndex], &bench->playerUnitIds[playerIndex]);
+  }
+}
+
+/// Villagers of each player repeatedly place and construct houses around their town center.
+static void SetupBuildingScenario(Benchmark* bench) {
+  SetupGatherScenario(bench);
+}
+
+static void IssueBuildingCommands(Benchmark* bench, int step) {
+  constexpr int kStepsBetweenCommands = 30;
+  constexpr int kVillagersPerHouse = 4;
+  if (step % kStepsBetweenCommands != 0) {
+    return;
+  }
+  
+  // Base tiles of foundations that were placed by this scenario. Since foundations do not occupy
+  // the map tiles before they are constructed, this avoids placing overlapping foundations.
+  static std::unordered_set<int> usedTiles;
+  if (step == 0) {
+    usedTiles.clear();
+  }
+  
+  ServerMap* map = bench->map.get();
+  QSize houseSize = GetBuildingSize(BuildingType::House);
+  auto canPlaceHouse = [&](const QPoint& baseTile) {
+    if (baseTile.x() < 0 || baseTile.y() < 0 ||
+        baseTile.x() + houseSize.width() >= map->GetWidth() ||
+        baseTile.y() + houseSize.height() >= map->GetHeight()) {
+      return false;
+    }
+    int minElevation = std::numeric_limits<int>::max();
+    int maxElevation = std::numeric_limits<int>::min();
+    for (int y = baseTile.y(); y <= baseTile.y() + houseSize.height(); ++ y) {
+      for (int x = baseTile.x(); x <= baseTile.x() + houseSize.width(); ++ x) {
+        if (usedTiles.count(x + map->GetWidth() * y) ||
+            (x < baseTile.x() + houseSize.width() && y < baseTile.y() + houseSize.height() && map->occupiedForBuildingsAt(x, y))) {
+          return false;
+        }
+        minElevation = std::min(minElevation, map->elevationAt(x, y));
+        maxElevation = std::max(maxElevation, map->elevationAt(x, y));
+      }
+    }
+    return maxElevation - minElevation <= 2;
+  };
+  
+  for (int playerIndex = 0; playerIndex < bench->config.numPlayers; ++ playerIndex) {
+    std::vector<u32> idleVillagerIds;
+    for (u32 unitId : bench->playerUnitIds[playerIndex]) {
+      ServerUnit* villager = bench->GetUnit(unitId);
+      if (villager && bench->IsIdle(villager)) {
+        idleVillagerIds.push_back(unitId);
+      }
+    }
+    
+    // Search for free space on growing squares around the town center.
+    const QPointF& center = bench->spawners[playerIndex].center;
+    usize villagerIndex = 0;
+    for (int radius = 4; radius < bench->config.mapSize && villagerIndex < idleVillagerIds.size(); radius += 1) {
+      for (int offset = -radius; offset <= radius && villagerIndex < idleVillagerIds.size(); offset += houseSize.width() + 1) {
+        for (const QPoint& baseTile : {
+            QPoint(center.x() + offset, center.y() - radius), QPoint(center.x() + offset, center.y() + radius),
+            QPoint(center.x() - radius, center.y() + offset), QPoint(center.x() + radius, center.y() + offset)}) {
+          if (villagerIndex >= idleVillagerIds.size() || !canPlaceHouse(baseTile)) {
+            continue;
+          }
+          
+          for (int y = baseTile.y(); y <= baseTile.y() + houseSize.height(); ++ y) {
+            for (int x = baseTile.x(); x <= baseTile.x() + houseSize.width(); ++ x) {
+              usedTiles.insert(x + map->GetWidth() * y);
+            }
+          }
+          
+          usize endIndex = std::min(idleVillagerIds.size(), villagerIndex + kVillagersPerHouse);
+          std::vector<u32> builderIds(idleVillagerIds.begin() + villagerIndex, idleVillagerIds.begin() + endIndex);
+          bench->SendMessage(playerIndex, CreatePlaceBuildingFoundationMessage(BuildingType::House, baseTile, builderIds));
+          villagerIndex = endIndex;
+        }
+      }
+    }
+  }
+}
+
+static QJsonObject RunScenario(const Scenario& scenario, const BenchmarkConfig& config) {
+  Benchmark bench(config);
+  srand(config.seed);
+  scenario.Setup(&bench);
+  bench.game->StartHeadlessGame(&bench.players, bench.map);
+  
+  u64 numAllocations = 0;
+  double simulationSeconds = 0;
+  for (int step = 0; step < config.numSteps; ++ step) {
+    scenario.IssueCommands(&bench, step);
+    
+    u64 allocationCountBefore = allocationCount.load(std::memory_order_relaxed);
+    TimePoint stepStartTime = Clock::now();
+    bench.game->SimulateHeadlessStep();
+    simulationSeconds += SecondsDuration(Clock::now() - stepStartTime).count();
+    numAllocations += allocationCount.load(std::memory_order_relaxed) - allocationCountBefore;
+  }
+  
+  QJsonObject result;
+  result["scenario"] = scenario.name;
+  result["mapSize"] = config.mapSize;
+  result["players"] = config.numPlayers;
+  result["villagersPerPlayer"] = config.villagersPerPlayer;
+  result["militaryPerPlayer"] = config.militaryPerPlayer;
+  result["idleUnitsPerPlayer"] = config.idleUnitsPerPlayer;
+  result["seed"] = config.seed;
+  result["steps"] = config.numSteps;
+  result["crowdSteering"] = config.useCrowdSteering;
+  result["activeSetScheduling"] = config.useActiveSetScheduling;
+  result["anyAnglePathPlanning"] = config.useAnyAnglePathPlanning;
+  result["finalObjectCount"] = static_cast<int>(bench.map->GetObjects().size());
+  result["stepsPerSecond"] = config.numSteps / simulationSeconds;
+  result["allocationsPerStep"] = numAllocations / static_cast<double>(config.numSteps);
+  result["profile"] = bench.game->GetProfiler()->ToJSONObject();
+  result["pathCache"] = bench.game->GetPathCache()->ToJSONObject();
+  result["movement"] = bench.game->GetMovementStatistics().ToJSONObject();
+  result["scheduling"] = bench.game->GetScheduler()->ToJSONObject();
+  if (scenario.AddResults) {
+    scenario.AddResults(&bench, &result);
+  }
+  return result;
+}
+
+/// Compares the path planners (see PathPlanner) by planning paths between random pairs of
+/// free tiles on a randomly generated map, whose forests the paths have to lead around.
+/// This does not simulate any game steps.
+static QJsonObject RunPathfindingComparison(const BenchmarkConfig& config) {
+  ServerMap map(config.mapSize, config.mapSize);
+  map.GenerateRandomMap(config.numPlayers, config.seed);
+  srand(config.seed);
+  
+  auto randomFreeTile = [&]() {
+    while (true) {
+      int x = rand() % config.mapSize;
+      int y = rand() % config.mapSize;
+      if (!map.occupiedForUnitsAt(x, y)) {
+        return QPointF(x + 0.5f, y + 0.5f);
+      }
+    }
+  };
+  std::vector<std::pair<QPointF, QPointF>> queries(config.numPathQueries);
+  for (auto& query : queries) {
+    query = std::make_pair(randomFreeTile(), randomFreeTile());
+  }
+  
+  float unitRadius = GetUnitRadius(UnitType::FemaleVillager);
+  
+  QJsonObject planners;
+  for (PathPlanner planner : {PathPlanner::Grid, PathPlanner::AnyAngle}) {
+    double totalPathLength = 0;
+    double totalExpandedNodes = 0;
+    int numPathsFound = 0;
+    double planningSeconds = 0;
+    
+    std::vector<QPointF> reversePath;
+    for (const auto& query : queries) {
+      QRect goalRect(static_cast<int>(query.second.x()), static_cast<int>(query.second.y()), 1, 1);
+      PathSearchStats stats;
+      
+      TimePoint startTime = Clock::now();
+      bool found = FindPath(planner, unitRadius, query.first, goalRect, query.second, &map, &reversePath, &stats);
+      planningSeconds += SecondsDuration(Clock::now() - startTime).count();
+      
+      totalExpandedNodes += stats.expandedNodes;
+      if (found) {
+        ++ numPathsFound;
+        QPointF previousPoint = query.first;
+        for (auto it = reversePath.rbegin(); it != reversePath.rend(); ++ it) {
+          totalPathLength += Distance(previousPoint, *it);
+          previousPoint = *it;
+        }
+      }
+    }
+    
+    QJsonObject result;
+    result["pathsFound"] = numPathsFound;
+    result["meanPathLength"] = totalPathLength / std::max(1, numPathsFound);
+    result["meanExpandedNodes"] = totalExpandedNodes / queries.size();
+    result["queriesPerSecond"] = queries.size() / planningSeconds;
+    planners[(planner == PathPlanner::Grid) ? "grid" : "anyAngle"] = result;
+  }
+  
+  QJsonObject result;
+  result["scenario"] = "pathfinding";
+  result["mapSize"] = config.mapSize;
+  result["players"] = config.numPlayers;
+  result["seed"] = config.seed;
+  result["queries"] = config.numPathQueries;
+  result["planners"] = planners;
+  return result;
+}
+
+int main(int argc, char** argv) {
+  loguru::g_preamble_date = false;
+  loguru::g_preamble_thread = false;
+  loguru::g_preamble_uptime = false;
+  loguru::g_stderr_verbosity = 0;
+  if (argc > 0) {
+    loguru::init(argc, argv, /*verbosity_flag*/ nullptr);
+  }
+  
+  QCoreApplication qapp(argc, argv);
+  
+  const std::vector<Scenario> scenarios = {
+      {"gather", SetupGatherScenario, IssueGatherCommands},
+      {"movement", SetupMovementScenario, IssueMovementCommands},
+      {"melee", SetupMeleeScenario, IssueMeleeCommands},
+      {"buildings", SetupBuildingScenario, IssueBuildingCommands},
+      {"crowdSwap", SetupCrowdSwapScenario, IssueCrowdSwapCommands, AddCrowdSwapResults},
+      {"idle", SetupIdleScenario, IssueMovementCommands}};
+  
+  // Parse command line options.
+  BenchmarkConfig config;
+  QCommandLineParser parser;
+  parser.setApplicationDescription(QObject::tr(
+      "Runs game simulation scenarios on the server without network connections, and prints one line of JSON per scenario "
+      "with the simulated steps per second, the allocations per step, and the time spent in each phase of the game steps. "
+      "The pathfinding scenario compares the path planners instead of simulating game steps."));
+  parser.addHelpOption();
+  
+  QCommandLineOption scenarioOption("scenario", QObject::tr("The scenario to run (gather, movement, melee, buildings, crowdSwap, idle, pathfinding, or all)."), QObject::tr("name"), "all");
+  QCommandLineOption mapSizeOption("map-size", QObject::tr("The map size in tiles."), QObject::tr("size"), QString::number(config.mapSize));
+  QCommandLineOption playersOption("players", QObject::tr("The number of players."), QObject::tr("count"), QString::number(config.numPlayers));
+  QCommandLineOption villagersOption("villagers", QObject::tr("The number of villagers per player."), QObject::tr("count"), QString::number(config.villagersPerPlayer));
+  QCommandLineOption militaryOption("military", QObject::tr("The number of military units per player."), QObject::tr("count"), QString::number(config.militaryPerPlayer));
+  QCommandLineOption idleOption("idle", QObject::tr("The number of idle villagers per player in the idle scenario."), QObject::tr("count"), QString::number(config.idleUnitsPerPlayer));
+  QCommandLineOption stepsOption("steps", QObject::tr("The number of game steps to simulate per scenario."), QObject::tr("count"), QString::number(config.numSteps));
+  QCommandLineOption queriesOption("queries", QObject::tr("The number of paths to plan with each planner in the pathfinding scenario."), QObject::tr("count"), QString::number(config.numPathQueries));
+  QCommandLineOption seedOption("seed", QObject::tr("The seed for the map generation and the scenarios."), QObject::tr("seed"), QString::number(config.seed));
+  QCommandLineOption noCrowdSteeringOption("no-crowd-steering", QObject::tr("Disables the crowd steering of moving units, for comparison."));
+  QCommandLineOption fullSweepOption("full-sweep", QObject::tr("Simulates all objects in each game step instead of only the active ones, for comparison."));
+  QCommandLineOption gridPathPlanningOption("grid-path-planning", QObject::tr("Lets the units plan their paths with A* and smoothing instead of Lazy Theta*, for comparison."));
+  QCommandLineOption statsOption("stats", QObject::tr("Loads unit and building stats from the given YAML file."), QObject::tr("path"));
+  QCommandLineOption outputOption("output", QObject::tr("Appends the results to the given file instead of printing them."), QObject::tr("path"));
+  parser.addOptions({scenarioOption, mapSizeOption, playersOption, villagersOption, militaryOption, idleOption, stepsOption, queriesOption, seedOption, noCrowdSteeringOption, fullSweepOption, gridPathPlanningOption, statsOption, outputOption});
+  parser.process(qapp);
+  
+  config.mapSize = parser.value(mapSizeOption).toInt();
+  config.numPlayers = parser.value(playersOption).toInt();
+  config.villagersPerPlayer = parser.value(villagersOption).toInt();
+  config.militaryPerPlayer = parser.value(militaryOption).toInt();
+  config.idleUnitsPerPlayer = parser.value(idleOption).toInt();
+  config.numSteps = parser.value(stepsOption).toInt();
+  config.numPathQueries = parser.value(queriesOption).toInt();
+  config.seed = parser.value(seedOption).toInt();
+  config.useCrowdSteering = !parser.isSet(noCrowdSteeringOption);
+  config.useActiveSetScheduling = !parser.isSet(fullSweepOption);
+  config.useAnyAnglePathPlanning = !parser.isSet(gridPathPlanningOption);
+  if (config.mapSize < 50 || config.numPlayers < 1 || config.numPlayers > kMaxPlayers || config.numSteps < 1 || config.numPathQueries < 1) {
+    LOG(ERROR) << "Invalid map size, player count, step count, or query count";
+    return 1;
+  }
+  
+  if (parser.isSet(statsOption) && !LoadStatsDatabase(parser.value(statsOption).toStdString())) {
+    return 1;
+  }
+  
+  std::ofstream outputFile;
+  if (parser.isSet(outputOption)) {
+    outputFile.open(parser.value(outputOption).toStdString(), std::ios::out | std::ios::app);
+    if (!outputFile) {
+      LOG(ERROR) << "Failed to open the output file: " << parser.value(outputOption).toStdString();
+      return 1;
+    }
+  }
+  std::ostream& output = outputFile.is_open() ? static_cast<std::ostream&>(outputFile) : std::cout;
+  
+  QString scenarioName = parser.value(scenarioOption);
+  bool foundScenario = false;
+  for (const Scenario& scenario : scenarios) {
+    if (scenarioName != "all" && scenarioName != scenario.name) {
+      continue;
+    }
+    foundScenario = true;
+    
+    QJsonObject result = RunScenario(scenario, config);
+    output << QJsonDocument(result).toJson(QJsonDocument::Compact).toStdString() << std::endl;
+    LOG(INFO) << scenario.name << ": " << result["stepsPerSecond"].toDouble() << " steps/s, "
+              << result["allocationsPerStep"].toDouble() << " allocations/step, "
+              << result["movement"].toObject()["blockedMoves"].toDouble() << " blocked moves, "
+              << result["scheduling"].toObject()["simulatedObjectsPerStep"].toDouble() << " simulated objects/step";
+    if (result.contains("arrivedUnits")) {
+      LOG(INFO) << scenario.name << ": " << result["arrivedUnits"].toInt() << " of " << result["units"].toInt() << " units arrived";
+    }
+  }
+  if (scenarioName == "all" || scenarioName == "pathfinding") {
+    foundScenario = true;
+    
+    QJsonObject result = RunPathfindingComparison(config);
+    output << QJsonDocument(result).toJson(QJsonDocument::Compact).toStdString() << std::endl;
+    for (const char* planner : {"grid", "anyAngle"}) {
+      QJsonObject plannerResult = result["planners"].toObject()[planner].toObject();
+      LOG(INFO) << "pathfinding (" << planner << "): " << plannerResult["queriesPerSecond"].toDouble() << " queries/s, "
+                << plannerResult["meanExpandedNodes"].toDouble() << " expanded nodes, "
+                << plannerResult["meanPathLength"].toDouble() << " mean path length";
+    }
+  }
+  if (!foundScenario) {
+    LOG(ERROR) << "Unknown scenario: " << scenarioName.toStdString();
+    return 1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "FreeAge/common/logging.hpp"
+#include "FreeAge/client/asset_bundle.hpp"
+
+/// The subdirectories of the game's data directory from which the client loads graphics.
+static const char* kBundledSubPaths[] = {
+    "resources/_common/drs/graphics",
+    "resources/_common/terrain/textures/2x",
+    "resources/_common/wpfg/resources/campaign",
+    "widgetui/textures/ingame",
+    "widgetui/textures/menu"};
+
+static bool IsBundledExtension(std::string extension) {
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return extension == ".smx" ||
+         extension == ".smp" ||
+         extension == ".png" ||
+         extension == ".dds" ||
+         extension == ".cur";
+}
+
+int main(int argc, char** argv) {
+  loguru::g_preamble_date = false;
+  loguru::g_preamble_thread = false;
+  loguru::g_preamble_uptime = false;
+  loguru::g_stderr_verbosity = 2;
+  if (argc > 0) {
+    loguru::init(argc, argv, /*verbosity_flag*/ nullptr);
+  }
+  
+  if (argc < 3) {
+    LOG(INFO) << "Usage: FreeAgeBundle <data_dir> <output_bundle> [--compress]";
+    LOG(INFO) << "  Packs the graphics files used by FreeAge into a single asset bundle file.";
+    LOG(INFO) << "  Place it next to the FreeAge executable as assets.fabundle to use it.";
+    LOG(INFO) << "  The bundle needs to be re-created if the game data changes.";
+    return 1;
+  }
+  std::filesystem::path dataDirPath = argv[1];
+  std::filesystem::path bundlePath = argv[2];
+  bool allowCompression = (argc >= 4 && argv[3] == std::string("--compress"));
+  
+  // Collect the files to bundle.
+  std::vector<std::filesystem::path> relativePaths;
+  for (const char* subPath : kBundledSubPaths) {
+    std::filesystem::path directory = dataDirPath / subPath;
+    if (!std::filesystem::is_directory(directory)) {
+      LOG(WARNING) << "Directory does not exist, skipping: " << directory;
+      continue;
+    }
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+      if (entry.is_regular_file() && IsBundledExtension(entry.path().extension().string())) {
+        relativePaths.push_back(entry.path().lexically_relative(dataDirPath));
+      }
+    }
+  }
+  if (relativePaths.empty()) {
+    LOG(ERROR) << "Did not find any files to bundle in: " << dataDirPath;
+    return 1;
+  }
+  
+  // Sort the files such that files in the same directory are close to each other in the bundle.
+  std::sort(relativePaths.begin(), relativePaths.end());
+  
+  return WriteAssetBundle(bundlePath, dataDirPath, relativePaths, allowCompression) ? 0 : 1;
+}
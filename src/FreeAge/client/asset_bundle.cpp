@@ -0,0 +1,238 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/asset_bundle.hpp"
+
+#include <cstring>
+#include <limits>
+
+#include <QFile>
+
+#include "FreeAge/common/logging.hpp"
+
+static constexpr char kAssetBundleMagic[8] = {'F', 'A', 'B', 'U', 'N', 'D', 'L', 'E'};
+static constexpr u32 kAssetBundleVersion = 1;
+
+/// Files are only stored compressed if this reduces their size to at most this fraction.
+static constexpr double kMaxCompressedSizeRatio = 0.9;
+
+static u64 ComputeFNV1aHash(const char* data, usize size) {
+  u64 hash = 14695981039346656037ull;
+  for (usize i = 0; i < size; ++ i) {
+    hash ^= static_cast<u8>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool AssetBundle::Open(const std::filesystem::path& path) {
+  Close();
+  
+  if (!file.Open(QString::fromStdString(path.string()))) {
+    return false;
+  }
+  
+  ByteReader reader(file.data(), file.size());
+  AssetBundleHeader header;
+  if (!reader.Read(&header) ||
+      memcmp(header.magic, kAssetBundleMagic, sizeof(kAssetBundleMagic)) != 0) {
+    LOG(ERROR) << "Not an asset bundle: " << path;
+    Close();
+    return false;
+  }
+  if (header.version != kAssetBundleVersion) {
+    LOG(ERROR) << "Unsupported asset bundle version (" << header.version << "): " << path;
+    Close();
+    return false;
+  }
+  
+  // Read the blob table.
+  if (!reader.Seek(header.indexOffset) ||
+      header.numBlobs > reader.Remaining() / sizeof(AssetBundleBlob)) {
+    LOG(ERROR) << "Unexpected EOF while trying to read the asset bundle's blob table: " << path;
+    Close();
+    return false;
+  }
+  blobs.resize(header.numBlobs);
+  reader.ReadArray(blobs.data(), blobs.size());
+  for (const AssetBundleBlob& blob : blobs) {
+    if (blob.offset > file.size() || blob.storedSize > file.size() - blob.offset) {
+      LOG(ERROR) << "Asset bundle blob exceeds the file size: " << path;
+      Close();
+      return false;
+    }
+  }
+  
+  // Read the path table.
+  pathToBlob.reserve(header.numPaths);
+  for (u32 i = 0; i < header.numPaths; ++ i) {
+    u32 blobIndex;
+    u16 pathLength;
+    const u8* pathData;
+    if (!reader.Read(&blobIndex) ||
+        !reader.Read(&pathLength) ||
+        (pathData = reader.Take(pathLength)) == nullptr ||
+        blobIndex >= blobs.size()) {
+      LOG(ERROR) << "Invalid path table in asset bundle: " << path;
+      Close();
+      return false;
+    }
+    pathToBlob.emplace(std::string(reinterpret_cast<const char*>(pathData), pathLength), blobIndex);
+  }
+  
+  LOG(INFO) << "Opened asset bundle with " << pathToBlob.size() << " files (" << blobs.size() << " distinct): " << path;
+  return true;
+}
+
+void AssetBundle::Close() {
+  file.Close();
+  blobs.clear();
+  pathToBlob.clear();
+}
+
+bool AssetBundle::GetFile(const std::string& relativePath, QByteArray* data) const {
+  auto it = pathToBlob.find(relativePath);
+  if (it == pathToBlob.end()) {
+    return false;
+  }
+  
+  const AssetBundleBlob& blob = blobs[it->second];
+  const u8* storedData = file.data() + blob.offset;
+  if (blob.IsCompressed()) {
+    *data = qUncompress(storedData, blob.storedSize);
+    if (static_cast<u64>(data->size()) != blob.size) {
+      LOG(ERROR) << "Failed to decompress the asset bundle entry: " << relativePath;
+      return false;
+    }
+  } else {
+    *data = QByteArray::fromRawData(reinterpret_cast<const char*>(storedData), blob.storedSize);
+  }
+  return true;
+}
+
+
+/// Writes zero bytes to the given file until its size is a multiple of kAssetBundleAlignment.
+static bool PadToAlignment(QFile* file) {
+  static const QByteArray zeros(kAssetBundleAlignment, '\0');
+  qint64 padding = (kAssetBundleAlignment - (file->pos() % kAssetBundleAlignment)) % kAssetBundleAlignment;
+  return file->write(zeros.constData(), padding) == padding;
+}
+
+bool WriteAssetBundle(
+    const std::filesystem::path& bundlePath,
+    const std::filesystem::path& dataDirPath,
+    const std::vector<std::filesystem::path>& relativePaths,
+    bool allowCompression) {
+  QFile bundleFile(QString::fromStdString(bundlePath.string()));
+  if (!bundleFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    LOG(ERROR) << "Cannot write file: " << bundlePath;
+    return false;
+  }
+  
+  // Leave space for the header, which is written at the end once the index offset is known.
+  AssetBundleHeader header;
+  memset(&header, 0, sizeof(header));
+  if (bundleFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header) ||
+      !PadToAlignment(&bundleFile)) {
+    LOG(ERROR) << "Failed to write to: " << bundlePath;
+    return false;
+  }
+  
+  // Write the blobs. Files with identical contents (as determined by the content hash and size) share a blob.
+  std::vector<AssetBundleBlob> blobs;
+  std::unordered_multimap<u64, u32> hashToBlob;
+  std::vector<std::pair<std::string, u32>> paths;
+  paths.reserve(relativePaths.size());
+  u64 totalSize = 0;
+  usize numCompressed = 0;
+  
+  for (const std::filesystem::path& relativePath : relativePaths) {
+    QFile inputFile(QString::fromStdString((dataDirPath / relativePath).string()));
+    if (!inputFile.open(QIODevice::ReadOnly)) {
+      LOG(ERROR) << "Cannot read file: " << (dataDirPath / relativePath);
+      return false;
+    }
+    QByteArray contents = inputFile.readAll();
+    u64 contentHash = ComputeFNV1aHash(contents.constData(), contents.size());
+    totalSize += contents.size();
+    
+    int blobIndex = -1;
+    auto range = hashToBlob.equal_range(contentHash);
+    for (auto it = range.first; it != range.second; ++ it) {
+      if (blobs[it->second].size == static_cast<u64>(contents.size())) {
+        blobIndex = it->second;
+        break;
+      }
+    }
+    
+    if (blobIndex < 0) {
+      AssetBundleBlob blob;
+      memset(&blob, 0, sizeof(blob));
+      blob.offset = bundleFile.pos();
+      blob.size = contents.size();
+      blob.contentHash = contentHash;
+      
+      QByteArray storedData = contents;
+      if (allowCompression) {
+        QByteArray compressedData = qCompress(contents);
+        if (compressedData.size() <= kMaxCompressedSizeRatio * contents.size()) {
+          storedData = compressedData;
+          blob.flags |= static_cast<u32>(AssetBundleBlob::Flag::Compressed);
+          ++ numCompressed;
+        }
+      }
+      blob.storedSize = storedData.size();
+      
+      if (bundleFile.write(storedData) != storedData.size() ||
+          !PadToAlignment(&bundleFile)) {
+        LOG(ERROR) << "Failed to write to: " << bundlePath;
+        return false;
+      }
+      
+      blobIndex = blobs.size();
+      blobs.push_back(blob);
+      hashToBlob.emplace(contentHash, blobIndex);
+    }
+    
+    std::string pathString = relativePath.generic_string();
+    if (pathString.size() > std::numeric_limits<u16>::max()) {
+      LOG(ERROR) << "Path is too long: " << pathString;
+      return false;
+    }
+    paths.emplace_back(pathString, blobIndex);
+  }
+  
+  // Write the index.
+  header.indexOffset = bundleFile.pos();
+  QByteArray index;
+  index.append(reinterpret_cast<const char*>(blobs.data()), blobs.size() * sizeof(AssetBundleBlob));
+  for (const auto& item : paths) {
+    u32 blobIndex = item.second;
+    u16 pathLength = item.first.size();
+    index.append(reinterpret_cast<const char*>(&blobIndex), sizeof(blobIndex));
+    index.append(reinterpret_cast<const char*>(&pathLength), sizeof(pathLength));
+    index.append(item.first.data(), pathLength);
+  }
+  if (bundleFile.write(index) != index.size()) {
+    LOG(ERROR) << "Failed to write to: " << bundlePath;
+    return false;
+  }
+  
+  // Write the header.
+  memcpy(header.magic, kAssetBundleMagic, sizeof(kAssetBundleMagic));
+  header.version = kAssetBundleVersion;
+  header.numBlobs = blobs.size();
+  header.numPaths = paths.size();
+  header.indexSize = index.size();
+  if (!bundleFile.seek(0) ||
+      bundleFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)) {
+    LOG(ERROR) << "Failed to write to: " << bundlePath;
+    return false;
+  }
+  
+  LOG(INFO) << "Wrote asset bundle with " << paths.size() << " files (" << blobs.size() << " distinct, "
+            << numCompressed << " compressed): " << (totalSize / (1024.0 * 1024.0)) << " MiB of files -> "
+            << (header.indexOffset + header.indexSize) / (1024.0 * 1024.0) << " MiB bundle";
+  return true;
+}
@@ -0,0 +1,108 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QByteArray>
+
+#include "FreeAge/common/free_age.hpp"
+#include "FreeAge/client/mapped_file.hpp"
+
+#pragma pack(push, 1)
+struct AssetBundleHeader {
+  char magic[8];
+  u32 version;
+  u32 numBlobs;
+  u32 numPaths;
+  u32 reserved;
+  u64 indexOffset;
+  u64 indexSize;
+};
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+struct AssetBundleBlob {
+  enum class Flag {
+    /// The blob is compressed with qCompress().
+    Compressed = 1 << 0
+  };
+  
+  inline bool IsCompressed() const {
+    return flags & static_cast<u32>(Flag::Compressed);
+  }
+  
+  /// Offset of the blob within the bundle file.
+  u64 offset;
+  
+  /// Size of the blob within the bundle file.
+  u64 storedSize;
+  
+  /// Size of the blob's contents after decompression.
+  u64 size;
+  
+  /// FNV-1a hash of the blob's (uncompressed) contents.
+  u64 contentHash;
+  
+  u32 flags;
+  u32 reserved;
+};
+#pragma pack(pop)
+
+/// Alignment of the blobs within the bundle file.
+constexpr u64 kAssetBundleAlignment = 4096;
+
+/// A single file that contains many game data files (graphics, icons, UI textures, cursors),
+/// which allows to load these files without opening each of them individually.
+///
+/// File layout (all values are little-endian):
+/// * AssetBundleHeader
+/// * The file contents ("blobs"). Each blob starts at an offset that is a multiple of
+///   kAssetBundleAlignment, such that it can be used directly from a memory mapping.
+///   Blobs are content-addressed: files with identical contents share the same blob.
+/// * The index, starting at AssetBundleHeader::indexOffset:
+///   * AssetBundleHeader::numBlobs times AssetBundleBlob
+///   * AssetBundleHeader::numPaths times: u32 blobIndex, u16 pathLength, char path[pathLength]
+///     The paths are relative to the game's data directory and use '/' as separator.
+class AssetBundle {
+ public:
+  AssetBundle() = default;
+  
+  /// Opens and memory-maps the bundle file at the given path. Returns true on success.
+  bool Open(const std::filesystem::path& path);
+  
+  /// Closes the bundle file (if it is open).
+  void Close();
+  
+  /// Returns the contents of the file with the given path (relative to the data directory,
+  /// using '/' as separator), or returns false if the bundle does not contain this file.
+  /// For uncompressed files, the returned QByteArray references the mapped bundle memory
+  /// without copying it; it must thus not be used after the bundle is closed.
+  bool GetFile(const std::string& relativePath, QByteArray* data) const;
+  
+  inline bool IsOpen() const { return file.data() != nullptr; }
+  inline usize GetNumFiles() const { return pathToBlob.size(); }
+  
+ private:
+  MappedFile file;
+  
+  /// The blob table of the bundle's index.
+  std::vector<AssetBundleBlob> blobs;
+  
+  /// Maps each contained file path to its index in blobs.
+  std::unordered_map<std::string, u32> pathToBlob;
+};
+
+/// Writes an asset bundle that contains the given files. The paths are given relative to
+/// dataDirPath. If allowCompression is true, each file is compressed if this saves a significant
+/// amount of space (this is usually not the case for already-compressed formats such as PNG).
+bool WriteAssetBundle(
+    const std::filesystem::path& bundlePath,
+    const std::filesystem::path& dataDirPath,
+    const std::vector<std::filesystem::path>& relativePaths,
+    bool allowCompression);
@@ -45,6 +45,13 @@ bool ClientBuildingType::Load(BuildingType type, const std::filesystem::path& gr
     maxCenterY = std::max(maxCenterY, buildingSprite.frame(frame).graphic.centerY);
   }
   
+  maxSpriteExtent = 0;
+  for (BuildingSprite spriteType : {BuildingSprite::Foundation, BuildingSprite::Building}) {
+    if (sprites[static_cast<int>(spriteType)]) {
+      maxSpriteExtent = std::max(maxSpriteExtent, sprites[static_cast<int>(spriteType)]->sprite.ComputeMaxExtent());
+    }
+  }
+  
   std::filesystem::path ingameTexturesSubPath = std::filesystem::path("widgetui") / "textures" / "ingame";
   std::filesystem::path iconFilename = GetIconFilename();
   if (!iconFilename.empty()) {
@@ -288,6 +295,7 @@ ClientBuilding::ClientBuilding(int playerIndex, BuildingType type, int baseTileX
     : ClientObject(ObjectType::Building, playerIndex, hp),
       type(type),
       fixedFrameIndex(-1),
+      randomFrameSeed(rand()),
       baseTileX(baseTileX),
       baseTileY(baseTileY),
       buildPercentage(buildPercentage) {}
@@ -320,99 +328,109 @@ void ClientBuilding::Render(
     Map* map,
     QRgb outlineOrModulationColor,
     SpriteShader* spriteShader,
-    float* viewMatrix,
-    float zoom,
-    int widgetWidth,
-    int widgetHeight,
     double elapsedSeconds,
     bool shadow,
     bool outline) {
-  const ClientBuildingType& buildingType = GetClientBuildingType(type);
-  
-  BuildingSprite spriteType = (buildPercentage < 100) ? BuildingSprite::Foundation : BuildingSprite::Building;
-  const auto& sprite = buildingType.GetSprites()[static_cast<int>(spriteType)];
-  Texture& texture = (shadow ? sprite->shadowTexture : sprite->graphicTexture);
+  Render(
+      map->MapCoordToProjectedCoord(GetCenterMapCoord()),
+      GetFrameIndex(elapsedSeconds),
+      outlineOrModulationColor,
+      spriteShader,
+      shadow,
+      outline);
+}
+
+void ClientBuilding::Render(
+    const QPointF& centerProjectedCoord,
+    int frameIndex,
+    QRgb outlineOrModulationColor,
+    SpriteShader* spriteShader,
+    bool shadow,
+    bool outline,
+    SpriteVertexArena* arena) {
+  SpriteAndTextures* sprites[kMaxSpritesToRender];
+  int numSprites = GetSpritesToRender(shadow, sprites);
   
-  int frameIndex = GetFrameIndex(elapsedSeconds);
-  QPointF centerProjectedCoord = map->MapCoordToProjectedCoord(GetCenterMapCoord());
+  if (!shadow && !outline) {
+    outlineOrModulationColor = GetModulationColor(outlineOrModulationColor);
+  }
   
-  if (type == BuildingType::TownCenter && spriteType == BuildingSprite::Building) {
-    // Special case for town centers: Render all of their separate parts.
-    // Main
-    const ClientBuildingType& helperType1 = GetClientBuildingType(BuildingType::TownCenterMain);
-    const auto& helperSprite1 = helperType1.GetSprites()[static_cast<int>(BuildingSprite::Building)];
+  for (int i = 0; i < numSprites; ++ i) {
     DrawSprite(
-        helperSprite1->sprite,
-        shadow ? helperSprite1->shadowTexture : helperSprite1->graphicTexture,
-        spriteShader, centerProjectedCoord,
-        viewMatrix, zoom, widgetWidth, widgetHeight, frameIndex, shadow, outline,
-        outlineOrModulationColor, playerIndex, 1.f);
-    
-    // Back
-    const ClientBuildingType& helperType2 = GetClientBuildingType(BuildingType::TownCenterBack);
-    const auto& helperSprite2 = helperType2.GetSprites()[static_cast<int>(BuildingSprite::Building)];
-    DrawSprite(
-        helperSprite2->sprite,
-        shadow ? helperSprite2->shadowTexture : helperSprite2->graphicTexture,
-        spriteShader, centerProjectedCoord,
-        viewMatrix, zoom, widgetWidth, widgetHeight, frameIndex, shadow, outline,
-        outlineOrModulationColor, playerIndex, 1.f);
-    
-    // Center
-    const ClientBuildingType& helperType3 = GetClientBuildingType(BuildingType::TownCenterCenter);
-    const auto& helperSprite3 = helperType3.GetSprites()[static_cast<int>(BuildingSprite::Building)];
-    DrawSprite(
-        helperSprite3->sprite,
-        shadow ? helperSprite3->shadowTexture : helperSprite3->graphicTexture,
-        spriteShader, centerProjectedCoord,
-        viewMatrix, zoom, widgetWidth, widgetHeight, frameIndex, shadow, outline,
-        outlineOrModulationColor, playerIndex, 1.f);
+        sprites[i]->sprite,
+        shadow ? sprites[i]->shadowTexture() : sprites[i]->graphicTexture(),
+        spriteShader,
+        centerProjectedCoord,
+        frameIndex,
+        shadow,
+        outline,
+        outlineOrModulationColor,
+        playerIndex,
+        1.f,
+        arena);
+  }
+}
+
+int ClientBuilding::GetSpritesToRender(bool shadow, SpriteAndTextures** sprites) {
+  int numSprites = 0;
+  auto addSprite = [&](SpriteAndTextures* sprite) {
+    if (!shadow || sprite->sprite.HasShadow()) {
+      sprites[numSprites] = sprite;
+      ++ numSprites;
+    }
+  };
+  
+  BuildingSprite spriteType = (buildPercentage < 100) ? BuildingSprite::Foundation : BuildingSprite::Building;
+  bool isTownCenter = type == BuildingType::TownCenter && spriteType == BuildingSprite::Building;
+  
+  // Special case for town centers: Render all of their separate parts.
+  if (isTownCenter) {
+    addSprite(GetClientBuildingType(BuildingType::TownCenterMain).GetSprites()[static_cast<int>(BuildingSprite::Building)]);
+    addSprite(GetClientBuildingType(BuildingType::TownCenterBack).GetSprites()[static_cast<int>(BuildingSprite::Building)]);
+    addSprite(GetClientBuildingType(BuildingType::TownCenterCenter).GetSprites()[static_cast<int>(BuildingSprite::Building)]);
   }
   
-  bool useDarkModulation = spriteType == BuildingSprite::Foundation && buildPercentage == 0 && !shadow && !outline;
-  if (useDarkModulation) {
-    outlineOrModulationColor = qRgb(127, 127, 127);
+  addSprite(GetClientBuildingType(type).GetSprites()[static_cast<int>(spriteType)]);
+  
+  if (isTownCenter) {
+    addSprite(GetClientBuildingType(BuildingType::TownCenterFront).GetSprites()[static_cast<int>(BuildingSprite::Building)]);
   }
-  DrawSprite(
-      sprite->sprite,
-      texture,
-      spriteShader,
-      centerProjectedCoord,
-      viewMatrix,
-      zoom,
-      widgetWidth,
-      widgetHeight,
-      frameIndex,
-      shadow,
-      outline,
-      outlineOrModulationColor,
-      playerIndex,
-      1.f);
   
-  if (type == BuildingType::TownCenter && spriteType == BuildingSprite::Building) {
-    // Front
-    const ClientBuildingType& helperType4 = GetClientBuildingType(BuildingType::TownCenterFront);
-    const auto& helperSprite4 = helperType4.GetSprites()[static_cast<int>(BuildingSprite::Building)];
-    DrawSprite(
-        helperSprite4->sprite,
-        shadow ? helperSprite4->shadowTexture : helperSprite4->graphicTexture,
-        spriteShader, centerProjectedCoord,
-        viewMatrix, zoom, widgetWidth, widgetHeight, frameIndex, shadow, outline,
-        outlineOrModulationColor, playerIndex, 1.f);
+  return numSprites;
+}
+
+QRgb ClientBuilding::GetModulationColor(QRgb modulationColor) const {
+  // Foundations on which the construction has not started yet are rendered darker.
+  if (buildPercentage == 0) {
+    return qRgb(127, 127, 127);
+  }
+  return modulationColor;
+}
+
+bool ClientBuilding::HasStaticAppearance() {
+  if (buildPercentage < 100) {
+    // The foundation frame only changes with the build percentage.
+    return true;
   }
+  
+  const ClientBuildingType& buildingType = GetClientBuildingType(type);
+  return buildingType.UsesRandomSpriteFrame() ||
+         buildingType.GetSprites()[static_cast<int>(BuildingSprite::Building)]->sprite.NumFrames() <= 1;
 }
 
 const Sprite& ClientBuilding::GetSprite() {
+  return GetSpriteAndTextures().sprite;
+}
+
+SpriteAndTextures& ClientBuilding::GetSpriteAndTextures() {
   BuildingSprite spriteType = (buildPercentage < 100) ? BuildingSprite::Foundation : BuildingSprite::Building;
-  const auto& sprite = GetClientBuildingType(type).GetSprites()[static_cast<int>(spriteType)];
-  
-  return sprite->sprite;
+  return *GetClientBuildingType(type).GetSprites()[static_cast<int>(spriteType)];
 }
 
 Texture& ClientBuilding::GetTexture(bool shadow) {
   BuildingSprite spriteType = (buildPercentage < 100) ? BuildingSprite::Foundation : BuildingSprite::Building;
   const auto& sprite = GetClientBuildingType(type).GetSprites()[static_cast<int>(spriteType)];
-  return (shadow ? sprite->shadowTexture : sprite->graphicTexture);
+  return (shadow ? sprite->shadowTexture() : sprite->graphicTexture());
 }
 
 int ClientBuilding::GetFrameIndex(double elapsedSeconds) {
@@ -428,10 +446,7 @@ int ClientBuilding::GetFrameIndex(double elapsedSeconds) {
   
   const auto& buildingSprite = buildingType.GetSprites()[static_cast<int>(BuildingSprite::Building)]->sprite;
   if (buildingType.UsesRandomSpriteFrame()) {
-    if (fixedFrameIndex < 0) {
-      fixedFrameIndex = rand() % buildingSprite.NumFrames();
-    }
-    return fixedFrameIndex;
+    return (fixedFrameIndex >= 0) ? fixedFrameIndex : static_cast<int>(randomFrameSeed % buildingSprite.NumFrames());
   } else {
     return static_cast<int>(animationFramesPerSecond * elapsedSeconds + 0.5f) % buildingSprite.NumFrames();
   }
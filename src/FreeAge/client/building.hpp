@@ -39,6 +39,10 @@ class ClientBuildingType {
   /// Returns the height (in projected coordinates) above the building's center at which the health bar should be displayed.
   float GetHealthBarHeightAboveCenter(int frameIndex) const;
   
+  /// Returns the maximum extent of the foundation and building sprites of this building type,
+  /// see Sprite::ComputeMaxExtent().
+  inline int GetMaxSpriteExtent() const { return maxSpriteExtent; }
+  
   /// Sets up the command buttons for the actions that can be performed when this building type (only) is selected.
   void SetCommandButtons(CommandButton commandButtons[3][5]);
   
@@ -72,6 +76,9 @@ class ClientBuildingType {
   /// height for the building's health bar.
   int maxCenterY;
   
+  /// The maximum extent of the foundation and building sprites of this building type.
+  int maxSpriteExtent;
+  
   Texture iconTexture;
   
   bool doesCauseOutlines;
@@ -101,6 +108,7 @@ class ClientBuilding : public ClientObject {
   
   /// Returns the current sprite for this building. This can differ (e.g., it could be the foundation or main sprite).
   const Sprite& GetSprite();
+  SpriteAndTextures& GetSpriteAndTextures();
   
   Texture& GetTexture(bool shadow);
   int GetFrameIndex(double elapsedSeconds);
@@ -109,14 +117,37 @@ class ClientBuilding : public ClientObject {
       Map* map,
       QRgb outlineOrModulationColor,
       SpriteShader* spriteShader,
-      float* viewMatrix,
-      float zoom,
-      int widgetWidth,
-      int widgetHeight,
       double elapsedSeconds,
       bool shadow,
       bool outline);
   
+  /// Variant of Render() for which the center point (in projected coordinates)
+  /// and the frame index (see GetFrameIndex()) have already been computed.
+  void Render(
+      const QPointF& centerProjectedCoord,
+      int frameIndex,
+      QRgb outlineOrModulationColor,
+      SpriteShader* spriteShader,
+      bool shadow,
+      bool outline,
+      SpriteVertexArena* arena = nullptr);
+  
+  /// Maximum number of sprites that GetSpritesToRender() returns.
+  static constexpr int kMaxSpritesToRender = 5;
+  
+  /// Returns the sprites that are rendered for this building in rendering order, and returns their number.
+  /// Usually, this is only the building's current sprite, but town centers consist of several parts.
+  /// If shadow is true, only the sprites that have a shadow are returned.
+  int GetSpritesToRender(bool shadow, SpriteAndTextures** sprites);
+  
+  /// Returns the modulation color to render the building's graphic with, given the modulation color
+  /// that results from the fog of war.
+  QRgb GetModulationColor(QRgb modulationColor) const;
+  
+  /// Returns whether the building's appearance only changes with its state (e.g., with its build percentage),
+  /// but not over time. Such buildings are rendered with the map's StaticSpriteBuffer.
+  bool HasStaticAppearance();
+  
   inline void SetFixedFrameIndex(int index) { fixedFrameIndex = index; }
   
   inline BuildingType GetType() const { return type; }
@@ -164,9 +195,15 @@ class ClientBuilding : public ClientObject {
   
   BuildingType type;
   
-  /// In case the building uses a random but fixed frame index, it is stored here.
+  /// In case the building uses a random but fixed frame index, it may be set here.
+  /// Otherwise, the frame index is derived from randomFrameSeed.
   int fixedFrameIndex;
   
+  /// Random number chosen on construction, used to determine the frame index of buildings that
+  /// use a random but fixed frame. GetFrameIndex() is called for many buildings in parallel, so
+  /// it must not call rand() itself.
+  u32 randomFrameSeed;
+  
   /// The "base tile" is the minimum map tile coordinate on which the building
   /// stands on.
   int baseTileX;
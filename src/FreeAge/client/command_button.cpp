@@ -5,28 +5,9 @@
 #include "FreeAge/client/command_button.hpp"
 
 #include "FreeAge/client/game_controller.hpp"
+#include "FreeAge/client/ui_renderer.hpp"
 #include "FreeAge/client/unit.hpp"
 
-void CommandButton::InitializePointBuffers() {
-  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-  
-  int elementSizeInBytes = 3 * sizeof(float);
-  
-  f->glGenBuffers(1, &iconPointBuffer);
-  f->glBindBuffer(GL_ARRAY_BUFFER, iconPointBuffer);
-  f->glBufferData(GL_ARRAY_BUFFER, 1 * elementSizeInBytes, nullptr, GL_STREAM_DRAW);
-  
-  f->glGenBuffers(1, &overlayPointBuffer);
-  f->glBindBuffer(GL_ARRAY_BUFFER, overlayPointBuffer);
-  f->glBufferData(GL_ARRAY_BUFFER, 1 * elementSizeInBytes, nullptr, GL_STREAM_DRAW);
-}
-
-void CommandButton::UnloadPointBuffers() {
-  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-  f->glDeleteBuffers(1, &iconPointBuffer);
-  f->glDeleteBuffers(1, &overlayPointBuffer);
-}
-
 void CommandButton::SetInvisible() {
   type = Type::Invisible;
   this->hotkey = Qt::Key_unknown;
@@ -91,7 +72,7 @@ CommandButton::State CommandButton::GetState(GameController* gameController) con
 void CommandButton::Render(
     float x, float y, float size, float iconInset,
     const Texture& iconOverlayNormalTexture,
-    UIShader* uiShader, int widgetWidth, int widgetHeight, QOpenGLFunctions_3_2_Core* f) {
+    UIRenderer* uiRenderer) {
   if (type == Type::Invisible) {
     return;
   } else if (type == Type::ConstructBuilding ||
@@ -106,22 +87,20 @@ void CommandButton::Render(
       texture = this->texture;
     }
     
-    RenderUIGraphic(
+    uiRenderer->AddQuad(
         x + iconInset,
         y + iconInset,
         size - 2 * iconInset,
         size - 2 * iconInset,
-        qRgba(255, 255, 255, 255), iconPointBuffer,
         *texture,
-        uiShader, widgetWidth, widgetHeight, f);
-    RenderUIGraphic(
+        qRgba(255, 255, 255, 255));
+    uiRenderer->AddQuad(
         x,
         y,
         size,
         size,
-        qRgba(255, 255, 255, 255), overlayPointBuffer,
         iconOverlayNormalTexture,
-        uiShader, widgetWidth, widgetHeight, f);
+        qRgba(255, 255, 255, 255));
   }
   
   buttonRect = QRectF(x, y, size, size);
@@ -4,13 +4,15 @@
 
 #pragma once
 
+#include <QRectF>
+
 #include "FreeAge/common/building_types.hpp"
 #include "FreeAge/common/free_age.hpp"
 #include "FreeAge/common/unit_types.hpp"
-#include "FreeAge/client/shader_ui.hpp"
 #include "FreeAge/client/texture.hpp"
 
 class GameController;
+class UIRenderer;
 
 constexpr int kCommandButtonRows = 3;
 constexpr int kCommandButtonCols = 5;
@@ -50,9 +52,6 @@ class CommandButton {
     Locked
   };
   
-  void InitializePointBuffers();
-  void UnloadPointBuffers();
-  
   /// Hides this button.
   void SetInvisible();
   
@@ -71,7 +70,7 @@ class CommandButton {
   void Render(
       float x, float y, float size, float iconInset,
       const Texture& iconOverlayNormalTexture,
-      UIShader* uiShader, int widgetWidth, int widgetHeight, QOpenGLFunctions_3_2_Core* f);
+      UIRenderer* uiRenderer);
   
   void Pressed(const std::vector<u32>& selection, GameController* gameController, bool shift);
   
@@ -85,9 +84,6 @@ class CommandButton {
   inline BuildingType GetBuildingConstructionType() const { return buildingConstructionType; }
   inline UnitType GetUnitProductionType() const { return unitProductionType; }
   
-  inline GLuint GetIconPointBuffer() const { return iconPointBuffer; }
-  inline GLuint GetOverlayPointBuffer() const { return overlayPointBuffer; }
-  
  private:
   Type type = Type::Invisible;
   Qt::Key hotkey;
@@ -97,7 +93,4 @@ class CommandButton {
   UnitType unitProductionType;
   const Texture* texture = nullptr;
   QRectF buttonRect;
-  
-  GLuint iconPointBuffer;
-  GLuint overlayPointBuffer;
 };
@@ -78,17 +78,13 @@ QRectF Decal::GetRectInProjectedCoords(bool shadow, bool outline) {
       layer.imageHeight + (isGraphic ? -2 : 0));
 }
 
-void Decal::Render(QRgb outlineColor, SpriteShader* spriteShader, float* viewMatrix, float zoom, int widgetWidth, int widgetHeight, bool shadow, bool outline, Texture** texture) {
-  *texture = shadow ? &currentSprite->shadowTexture : &currentSprite->graphicTexture;
+void Decal::Render(QRgb outlineColor, SpriteShader* spriteShader, bool shadow, bool outline, Texture** texture) {
+  *texture = shadow ? &currentSprite->shadowTexture() : &currentSprite->graphicTexture();
   DrawSprite(
       currentSprite->sprite,
       **texture,
       spriteShader,
       projectedCoord,
-      viewMatrix,
-      zoom,
-      widgetWidth,
-      widgetHeight,
       currentFrame,
       shadow,
       outline,
@@ -39,14 +39,13 @@ class Decal {
   void Render(
       QRgb outlineColor,
       SpriteShader* spriteShader,
-      float* viewMatrix,
-      float zoom,
-      int widgetWidth,
-      int widgetHeight,
       bool shadow,
       bool outline,
       Texture** texture);
   
+  /// Returns whether the decal's current sprite has a shadow layer.
+  inline bool HasShadow() const { return currentSprite->sprite.HasShadow(); }
+  
   inline bool MayOccludeSprites() const {
     return type == DecalType::UnitDeath || type == DecalType::BuildingDestruction;
   }
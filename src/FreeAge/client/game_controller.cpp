@@ -230,17 +230,24 @@ void GameController::HandleMapUncoverMessage(const QByteArray& data) {
     return;
   }
   
+  // Only the parts of the terrain whose elevation changed need to be re-built.
+  QRect changedCorners;
   for (int y = 0; y <= map->GetHeight(); ++ y) {
     for (int x = 0; x <= map->GetWidth(); ++ x) {
       int elevation = data[x + y * (map->GetWidth() + 1)];
       if (elevation < 0 || elevation > map->GetMaxElevation()) {
         LOG(WARNING) << "Received invalid map elevation: " << elevation << " (should be from 0 to " << map->GetMaxElevation() << ")";
       }
-      map->elevationAt(x, y) = elevation;
+      if (map->elevationAt(x, y) != elevation) {
+        map->elevationAt(x, y) = elevation;
+        changedCorners |= QRect(x, y, 1, 1);
+      }
     }
   }
   
-  map->SetNeedsRenderResourcesUpdate(true);
+  if (!changedCorners.isEmpty()) {
+    map->ElevationChanged(changedCorners);
+  }
 }
 
 void GameController::HandleAddObjectMessage(const QByteArray& data) {
@@ -356,8 +363,7 @@ void GameController::HandleObjectDeathMessage(const QByteArray& data) {
     }
   }
   
-  delete object;
-  map->GetObjects().erase(it);
+  map->DeleteObject(objectId);
 }
 
 void GameController::HandleUnitMovementMessage(const QByteArray& data) {
@@ -0,0 +1,174 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/glyph_atlas.hpp"
+
+#include <QGlyphRun>
+#include <QOpenGLContext>
+#include <QPainter>
+
+#include "FreeAge/common/logging.hpp"
+#include "FreeAge/client/opengl.hpp"
+
+/// Free space that is left between the glyphs in the atlas.
+constexpr int kGlyphPadding = 1;
+
+GlyphAtlas::GlyphAtlas(int size)
+    : image(size, size, QImage::Format_Alpha8) {
+  Clear();
+}
+
+GlyphAtlas::~GlyphAtlas() {
+  if (textureId != 0) {
+    LOG(ERROR) << "GlyphAtlas object was destroyed without Destroy() being called first.";
+  }
+}
+
+const GlyphAtlas::Glyph* GlyphAtlas::GetGlyph(const QRawFont& font, quint32 glyphIndex) {
+  std::unordered_map<quint32, Glyph>* fontGlyphs = nullptr;
+  for (auto& item : fonts) {
+    if (item.first == font) {
+      fontGlyphs = &item.second;
+      break;
+    }
+  }
+  if (!fontGlyphs) {
+    fonts.emplace_back(font, std::unordered_map<quint32, Glyph>());
+    fontGlyphs = &fonts.back().second;
+  }
+  
+  auto it = fontGlyphs->find(glyphIndex);
+  if (it != fontGlyphs->end()) {
+    return &it->second;
+  }
+  
+  // Determine the pixels that the glyph covers. Since the glyph is anti-aliased, add a pixel at each side.
+  QRect glyphRect = font.boundingRect(glyphIndex).toAlignedRect();
+  Glyph glyph;
+  if (glyphRect.isEmpty()) {
+    glyph.atlasRect = QRect();
+    glyph.offset = QPoint(0, 0);
+    return &fontGlyphs->emplace(glyphIndex, glyph).first->second;
+  }
+  glyphRect.adjust(-1, -1, 1, 1);
+  
+  if (!Allocate(glyphRect.width(), glyphRect.height(), &glyph.atlasRect)) {
+    return nullptr;
+  }
+  glyph.offset = glyphRect.topLeft();
+  
+  // Rasterize the glyph into the atlas.
+  QGlyphRun glyphRun;
+  glyphRun.setRawFont(font);
+  glyphRun.setGlyphIndexes({glyphIndex});
+  glyphRun.setPositions({QPointF(0, 0)});
+  
+  QPainter painter(&image);
+  painter.setClipRect(glyph.atlasRect);
+  painter.setPen(QColor(255, 255, 255, 255));
+  painter.drawGlyphRun(glyph.atlasRect.topLeft() - glyph.offset, glyphRun);
+  painter.end();
+  
+  dirtyRect |= glyph.atlasRect;
+  ++ numGlyphs;
+  return &fontGlyphs->emplace(glyphIndex, glyph).first->second;
+}
+
+void GlyphAtlas::Clear() {
+  fonts.clear();
+  numGlyphs = 0;
+  shelves.clear();
+  image.fill(0);
+  AddSolidRect();
+  dirtyRect = image.rect();
+  ++ generation;
+}
+
+void GlyphAtlas::Upload(QOpenGLFunctions_3_2_Core* f) {
+  if (textureId == 0) {
+    f->glGenTextures(1, &textureId);
+    f->glBindTexture(GL_TEXTURE_2D, textureId);
+    
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    
+    f->glTexImage2D(
+        GL_TEXTURE_2D,
+        0, GL_RED,
+        image.width(), image.height(),
+        0, GL_RED, GL_UNSIGNED_BYTE,
+        nullptr);
+    
+    dirtyRect = image.rect();
+  } else if (dirtyRect.isEmpty()) {
+    return;
+  } else {
+    f->glBindTexture(GL_TEXTURE_2D, textureId);
+  }
+  
+  f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  f->glPixelStorei(GL_UNPACK_ROW_LENGTH, image.bytesPerLine());
+  f->glTexSubImage2D(
+      GL_TEXTURE_2D,
+      0,
+      dirtyRect.x(), dirtyRect.y(),
+      dirtyRect.width(), dirtyRect.height(),
+      GL_RED, GL_UNSIGNED_BYTE,
+      image.constScanLine(dirtyRect.y()) + dirtyRect.x());
+  f->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  CHECK_OPENGL_NO_ERROR();
+  
+  dirtyRect = QRect();
+}
+
+void GlyphAtlas::Destroy() {
+  if (textureId == 0) {
+    return;
+  }
+  
+  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+  f->glDeleteTextures(1, &textureId);
+  textureId = 0;
+}
+
+bool GlyphAtlas::Allocate(int width, int height, QRect* rect) {
+  int paddedWidth = width + kGlyphPadding;
+  int paddedHeight = height + kGlyphPadding;
+  
+  // Use the first shelf that the rectangle fits into, unless this would waste much of the shelf's height.
+  for (Shelf& shelf : shelves) {
+    if (paddedHeight <= shelf.height &&
+        2 * paddedHeight >= shelf.height &&
+        shelf.usedWidth + paddedWidth <= image.width()) {
+      *rect = QRect(shelf.usedWidth, shelf.y, width, height);
+      shelf.usedWidth += paddedWidth;
+      return true;
+    }
+  }
+  
+  // Start a new shelf.
+  int shelfY = shelves.empty() ? 0 : (shelves.back().y + shelves.back().height);
+  if (shelfY + paddedHeight > image.height() ||
+      paddedWidth > image.width()) {
+    return false;
+  }
+  shelves.push_back(Shelf{shelfY, paddedHeight, paddedWidth});
+  *rect = QRect(0, shelfY, width, height);
+  return true;
+}
+
+void GlyphAtlas::AddSolidRect() {
+  constexpr int kSolidRectSize = 4;
+  Allocate(kSolidRectSize, kSolidRectSize, &solidRect);
+  for (int y = solidRect.top(); y <= solidRect.bottom(); ++ y) {
+    u8* row = image.scanLine(y);
+    for (int x = solidRect.left(); x <= solidRect.right(); ++ x) {
+      row[x] = 255;
+    }
+  }
+  // Only use the inner pixels of the rect, such that sampling at its border does not include uncovered pixels.
+  solidRect.adjust(1, 1, -1, -1);
+}
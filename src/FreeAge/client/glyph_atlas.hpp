@@ -0,0 +1,94 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <QImage>
+#include <QOpenGLFunctions_3_2_Core>
+#include <QRawFont>
+#include <QRect>
+
+#include "FreeAge/common/free_age.hpp"
+
+/// A texture that contains the glyphs of all fonts that are used for UI text rendering.
+/// The glyphs are rasterized with Qt when they are requested for the first time and then stay
+/// in the atlas, such that text only needs to be rasterized once per font and glyph.
+///
+/// The atlas is a single-channel (coverage) texture. Its glyphs are packed into shelves
+/// (rows with the height of the first glyph that was put into them).
+class GlyphAtlas {
+ public:
+  struct Glyph {
+    /// Rectangle of the glyph image in the atlas (in pixels). Empty for glyphs without visible pixels (e.g., spaces).
+    QRect atlasRect;
+    
+    /// Offset from the glyph's origin (on the baseline) to the top-left corner of its image (in pixels).
+    QPoint offset;
+  };
+  
+  /// Creates an atlas with size x size pixels.
+  explicit GlyphAtlas(int size = 1024);
+  ~GlyphAtlas();
+  
+  GlyphAtlas(const GlyphAtlas& other) = delete;
+  GlyphAtlas& operator= (const GlyphAtlas& other) = delete;
+  
+  /// Returns the glyph with the given index in the given font, rasterizing it into the atlas if it is not in it yet.
+  /// Returns nullptr if the atlas is full.
+  const Glyph* GetGlyph(const QRawFont& font, quint32 glyphIndex);
+  
+  /// Removes all glyphs from the atlas. This increments the generation, which allows users of the atlas
+  /// to detect that glyphs which they obtained previously are no longer valid.
+  void Clear();
+  
+  /// Uploads the glyphs that were added since the last call to the texture (creating it if necessary).
+  void Upload(QOpenGLFunctions_3_2_Core* f);
+  
+  /// Deletes the texture. Must be called with the OpenGL context current if Upload() was called before.
+  void Destroy();
+  
+  /// Returns a rectangle in the atlas whose pixels are fully covered. This may be used to draw solid
+  /// rectangles (such as strike-out lines) with the same texture as the glyphs.
+  inline const QRect& GetSolidRect() const { return solidRect; }
+  
+  inline u32 GetGeneration() const { return generation; }
+  inline int GetSize() const { return image.width(); }
+  inline GLuint GetTextureId() const { return textureId; }
+  inline const QImage& GetImage() const { return image; }
+  inline usize GetNumGlyphs() const { return numGlyphs; }
+  
+ private:
+  struct Shelf {
+    int y;
+    int height;
+    int usedWidth;
+  };
+  
+  /// Reserves a rectangle of the given size in the atlas. Returns false if there is no space left.
+  bool Allocate(int width, int height, QRect* rect);
+  
+  /// Adds a fully covered rectangle (see GetSolidRect()).
+  void AddSolidRect();
+  
+  /// The glyphs, per font. Since only few fonts are used, these are searched linearly.
+  std::vector<std::pair<QRawFont, std::unordered_map<quint32, Glyph>>> fonts;
+  usize numGlyphs = 0;
+  
+  /// CPU copy of the atlas (QImage::Format_Alpha8).
+  QImage image;
+  
+  std::vector<Shelf> shelves;
+  QRect solidRect;
+  
+  /// Area of the image that changed since the last upload.
+  QRect dirtyRect;
+  
+  u32 generation = 0;
+  
+  GLuint textureId = 0;
+};
@@ -12,6 +12,7 @@
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QDir>
+#include <QFileInfo>
 #include <QFontDatabase>
 #include <QImage>
 #include <QLabel>
@@ -29,6 +30,8 @@
 #include "FreeAge/client/map.hpp"
 #include "FreeAge/client/match.hpp"
 #include "FreeAge/common/messages.hpp"
+#include "FreeAge/common/stats_database.hpp"
+#include "FreeAge/common/timing.hpp"
 #include "FreeAge/client/mod_manager.hpp"
 #include "FreeAge/client/render_window.hpp"
 #include "FreeAge/client/server_connection.hpp"
@@ -90,10 +93,26 @@ int main(int argc, char** argv) {
   QCommandLineOption playerOption("player", QObject::tr("Sets the initial player name"), QObject::tr("Player name"));
   parser.addOption(playerOption);
   
+  QCommandLineOption traceOption("trace", QObject::tr("Records the timers and writes them to the given file on exit, in the Chrome trace format (viewable with chrome://tracing or ui.perfetto.dev)."), QObject::tr("JSON path"));
+  parser.addOption(traceOption);
+  
+  QCommandLineOption statsOption("stats", QObject::tr("Loads unit and building stats from the given YAML file, overriding the built-in values. The file is also passed to the server when hosting. All players must use the same file."), QObject::tr("YAML path"));
+  parser.addOption(statsOption);
+  
   parser.process(qapp);
   
   bool noServer = parser.isSet(noServerOption);
   QString initialPlayerName = parser.value(playerOption);
+  QString tracePath = parser.value(traceOption);
+  if (!tracePath.isEmpty()) {
+    Timing::setThreadName("GUI thread");
+    Timing::setTraceEnabled(true);
+  }
+  QString statsPath = parser.value(statsOption);
+  if (!statsPath.isEmpty() && !LoadStatsDatabase(statsPath.toStdString())) {
+    QMessageBox::warning(nullptr, QObject::tr("Error"), QObject::tr("Failed to load the stats file (path: %1).").arg(statsPath));
+    return 1;
+  }
   
   // Load settings.
   Settings settings;
@@ -145,6 +164,13 @@ int main(int argc, char** argv) {
       ModManager::Instance().Clear(settingsDialog.GetDataPath().toStdString());
     }
     
+    // Use the asset bundle (created with FreeAgeBundle) if it exists. It contains the
+    // original game files, which then do not need to be opened individually.
+    std::filesystem::path assetBundlePath = std::filesystem::path(argv[0]).parent_path() / "assets.fabundle";
+    if (std::filesystem::exists(assetBundlePath)) {
+      ModManager::Instance().OpenAssetBundle(assetBundlePath);
+    }
+    
     // Load some initial basic game resources that are required for the game dialog.
     // Load palettes (to get the player colors).
     if (!ReadPalettesConf(GetModdedPath(commonResourcesSubPath / "palettes" / "palettes.conf").string().c_str(), &palettes)) {
@@ -180,7 +206,11 @@ int main(int argc, char** argv) {
         }
         
         QString serverPath = QDir(qapp.applicationDirPath()).filePath("FreeAgeServer");
-        serverProcess.start(serverPath, QStringList() << hostToken);
+        QStringList serverArguments = QStringList() << hostToken;
+        if (!statsPath.isEmpty()) {
+          serverArguments << "--stats" << QFileInfo(statsPath).absoluteFilePath();
+        }
+        serverProcess.start(serverPath, serverArguments);
         if (!serverProcess.waitForStarted(10000)) {
           QMessageBox::warning(nullptr, QObject::tr("Error"), QObject::tr("Failed to start the server (path: %1).").arg(serverPath));
           QFontDatabase::removeApplicationFont(georgiaFontID);
@@ -331,5 +361,10 @@ int main(int argc, char** argv) {
   renderWindow->SetGameController(nullptr);
   renderWindow.reset();
   
+  if (!tracePath.isEmpty()) {
+    Timing::setTraceEnabled(false);
+    Timing::writeChromeTrace(tracePath.toStdString());
+  }
+  
   return 0;
 }
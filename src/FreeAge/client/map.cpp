@@ -4,6 +4,9 @@
 
 #include "FreeAge/client/map.hpp"
 
+#include <cmath>
+#include <limits>
+
 #include <mango/image/image.hpp>
 
 #include "FreeAge/common/free_age.hpp"
@@ -37,10 +40,38 @@ Map::Map(int width, int height)
     }
   }
   
-  viewCountChangeMinX = 0;
-  viewCountChangeMinY = 0;
-  viewCountChangeMaxX = width - 1;
-  viewCountChangeMaxY = height - 1;
+  viewCountChunksX = (width + kViewCountChunkSize - 1) / kViewCountChunkSize;
+  viewCountChunksY = (height + kViewCountChunkSize - 1) / kViewCountChunkSize;
+  viewCountChunkDirty.resize(viewCountChunksX * viewCountChunksY, 1);
+  haveViewCountChanges = true;
+  minimapViewCountChange = QRect(0, 0, width, height);
+  
+  // Initialize the spatial index to cover the projected coordinates of all tile corners at any elevation.
+  spatialIndex.Initialize(QRectF(
+      0,
+      -height * kTileProjectedHeight / 2 - maxElevation * kTileProjectedElevationDifference,
+      (width + height) * kTileProjectedWidth / 2,
+      (width + height) * kTileProjectedHeight / 2 + maxElevation * kTileProjectedElevationDifference));
+  
+  // Split the terrain into chunks.
+  for (int chunkY = 0; chunkY < height; chunkY += kTerrainChunkSize) {
+    for (int chunkX = 0; chunkX < width; chunkX += kTerrainChunkSize) {
+      TerrainChunk chunk;
+      chunk.tiles = QRect(chunkX, chunkY, std::min(kTerrainChunkSize, width - chunkX), std::min(kTerrainChunkSize, height - chunkY));
+      
+      // The lowest possible elevation is -1 (for unknown elevation), the highest is maxElevation.
+      int minCornerX = chunk.tiles.left();
+      int minCornerY = chunk.tiles.top();
+      int maxCornerX = chunk.tiles.right() + 1;
+      int maxCornerY = chunk.tiles.bottom() + 1;
+      chunk.maxProjectedRect = QRectF(
+          QPointF((minCornerX + minCornerY) * kTileProjectedWidth / 2,
+                  (minCornerX - maxCornerY) * kTileProjectedHeight / 2 - maxElevation * kTileProjectedElevationDifference),
+          QPointF((maxCornerX + maxCornerY) * kTileProjectedWidth / 2,
+                  (maxCornerX - minCornerY) * kTileProjectedHeight / 2 + kTileProjectedElevationDifference));
+      terrainChunks.push_back(chunk);
+    }
+  }
 }
 
 Map::~Map() {
@@ -239,48 +270,169 @@ bool Map::ProjectedCoordToMapCoord(const QPointF& projectedCoord, QPointF* mapCo
   return converged;
 }
 
-void Map::UpdateFieldOfView(float centerMapCoordX, float centerMapCoordY, float radius, int change) {
-  // TODO: We could cache the patterns for small discrete radius values to potentially speed this up.
+const Map::FieldOfViewStamp& Map::GetFieldOfViewStamp(float centerMapCoordX, float centerMapCoordY, float radius, int* tileX, int* tileY) {
+  *tileX = static_cast<int>(std::floor(centerMapCoordX));
+  *tileY = static_cast<int>(std::floor(centerMapCoordY));
+  float offsetX = centerMapCoordX - *tileX;
+  float offsetY = centerMapCoordY - *tileY;
+  
+  auto key = std::make_tuple(radius, offsetX, offsetY);
+  auto it = fieldOfViewStamps.find(key);
+  if (it != fieldOfViewStamps.end()) {
+    return it->second;
+  }
   
   float effectiveRadius = radius + 0.7f;  // TODO: Find out what gives equal results as in the original game
   float effectiveRadiusSquared = effectiveRadius * effectiveRadius;
   
-  int minX = std::max<int>(0, centerMapCoordX - effectiveRadius);
-  int minY = std::max<int>(0, centerMapCoordY - effectiveRadius);
-  int maxX = std::min<int>(width - 1, centerMapCoordX + effectiveRadius);
-  int maxY = std::min<int>(height - 1, centerMapCoordY + effectiveRadius);
+  float offsetXMinusHalf = offsetX - 0.5f;
+  float offsetYMinusHalf = offsetY - 0.5f;
+  int maxOffset = static_cast<int>(std::ceil(effectiveRadius)) + 1;
+  
+  FieldOfViewStamp stamp;
+  stamp.minOffsetY = 0;
+  for (int y = -maxOffset; y <= maxOffset; ++ y) {
+    float dy = y - offsetYMinusHalf;
+    int rowMinX = std::numeric_limits<int>::max();
+    int rowMaxX = std::numeric_limits<int>::min();
+    for (int x = -maxOffset; x <= maxOffset; ++ x) {
+      float dx = x - offsetXMinusHalf;
+      if (dx * dx + dy * dy <= effectiveRadiusSquared) {
+        rowMinX = std::min(rowMinX, x);
+        rowMaxX = std::max(rowMaxX, x);
+      }
+    }
+    
+    if (rowMinX > rowMaxX) {
+      continue;
+    }
+    if (stamp.rows.empty()) {
+      stamp.minOffsetY = y;
+    }
+    stamp.rows.emplace_back(rowMinX, rowMaxX);
+  }
   
-  float centerMapCoordXMinusHalf = centerMapCoordX - 0.5f;
-  float centerMapCoordYMinusHalf = centerMapCoordY - 0.5f;
+  return fieldOfViewStamps.emplace(key, std::move(stamp)).first->second;
+}
+
+/// Adds change to the view counts in the range [minX, maxX] of the given row, uncovering tiles that
+/// have not been seen yet. This is written without branches such that the compiler can vectorize it.
+static inline void ApplyFieldOfViewToRow(int* row, int minX, int maxX, int change) {
+  for (int x = minX; x <= maxX; ++ x) {
+    // Tiles that have not been uncovered yet have the value -1 and are set to zero before applying the change.
+    row[x] += (row[x] == -1) + change;
+  }
+}
+
+void Map::UpdateFieldOfView(float centerMapCoordX, float centerMapCoordY, float radius, int change) {
+  int tileX, tileY;
+  const FieldOfViewStamp& stamp = GetFieldOfViewStamp(centerMapCoordX, centerMapCoordY, radius, &tileX, &tileY);
+  
+  int minX = std::numeric_limits<int>::max();
+  int minY = std::numeric_limits<int>::max();
+  int maxX = -1;
+  int maxY = -1;
+  
+  for (usize i = 0; i < stamp.rows.size(); ++ i) {
+    int y = tileY + stamp.minOffsetY + i;
+    if (y < 0 || y >= height) {
+      continue;
+    }
+    int rowMinX = std::max(0, tileX + stamp.rows[i].first);
+    int rowMaxX = std::min(width - 1, tileX + stamp.rows[i].second);
+    if (rowMinX > rowMaxX) {
+      continue;
+    }
+    
+    ApplyFieldOfViewToRow(viewCount + width * y, rowMinX, rowMaxX, change);
+    
+    minX = std::min(minX, rowMinX);
+    minY = std::min(minY, y);
+    maxX = std::max(maxX, rowMaxX);
+    maxY = std::max(maxY, y);
+  }
   
+  if (maxX >= 0) {
+    ViewCountChanged(minX, minY, maxX, maxY);
+  }
+}
+
+void Map::MoveFieldOfView(float oldCenterMapCoordX, float oldCenterMapCoordY, float newCenterMapCoordX, float newCenterMapCoordY, float radius) {
+  int oldTileX, oldTileY;
+  const FieldOfViewStamp& oldStamp = GetFieldOfViewStamp(oldCenterMapCoordX, oldCenterMapCoordY, radius, &oldTileX, &oldTileY);
+  int newTileX, newTileY;
+  const FieldOfViewStamp& newStamp = GetFieldOfViewStamp(newCenterMapCoordX, newCenterMapCoordY, radius, &newTileX, &newTileY);
+  
+  int oldMinY = oldTileY + oldStamp.minOffsetY;
+  int oldMaxY = oldMinY + static_cast<int>(oldStamp.rows.size()) - 1;
+  int newMinY = newTileY + newStamp.minOffsetY;
+  int newMaxY = newMinY + static_cast<int>(newStamp.rows.size()) - 1;
+  
+  int changeMinX = std::numeric_limits<int>::max();
+  int changeMinY = std::numeric_limits<int>::max();
+  int changeMaxX = -1;
+  int changeMaxY = -1;
+  auto apply = [&](int* row, int y, int minX, int maxX, int change) {
+    minX = std::max(0, minX);
+    maxX = std::min(width - 1, maxX);
+    if (minX > maxX) {
+      return;
+    }
+    ApplyFieldOfViewToRow(row, minX, maxX, change);
+    changeMinX = std::min(changeMinX, minX);
+    changeMinY = std::min(changeMinY, y);
+    changeMaxX = std::max(changeMaxX, maxX);
+    changeMaxY = std::max(changeMaxY, y);
+  };
+  
+  int minY = std::max(0, std::min(oldMinY, newMinY));
+  int maxY = std::min(height - 1, std::max(oldMaxY, newMaxY));
   for (int y = minY; y <= maxY; ++ y) {
     int* row = viewCount + width * y;
-    for (int x = minX; x <= maxX; ++ x) {
-      float dx = x - centerMapCoordXMinusHalf;
-      float dy = y - centerMapCoordYMinusHalf;
-      
-      float squaredDistance = dx * dx + dy * dy;
-      if (squaredDistance <= effectiveRadiusSquared) {
-        if (row[x] == -1) {
-          // Uncover a newly seen map tile
-          row[x] = 0;
-        }
-        
-        row[x] += change;
-      }
+    
+    // Get the ranges of the old and new field-of-view in this row (empty ranges have first > second).
+    std::pair<int, int> oldRange(0, -1);
+    if (y >= oldMinY && y <= oldMaxY) {
+      oldRange = oldStamp.rows[y - oldMinY];
+      oldRange.first += oldTileX;
+      oldRange.second += oldTileX;
+    }
+    std::pair<int, int> newRange(0, -1);
+    if (y >= newMinY && y <= newMaxY) {
+      newRange = newStamp.rows[y - newMinY];
+      newRange.first += newTileX;
+      newRange.second += newTileX;
     }
+    
+    bool overlap = oldRange.first <= oldRange.second &&
+                   newRange.first <= newRange.second &&
+                   oldRange.first <= newRange.second &&
+                   newRange.first <= oldRange.second;
+    if (!overlap) {
+      apply(row, y, oldRange.first, oldRange.second, -1);
+      apply(row, y, newRange.first, newRange.second, 1);
+      continue;
+    }
+    
+    // The view counts of the tiles in the intersection of both ranges do not change.
+    // Only the parts of the ranges to the left and to the right of the intersection are updated.
+    apply(row, y, oldRange.first, std::min(oldRange.second, newRange.first - 1), -1);
+    apply(row, y, std::max(oldRange.first, newRange.second + 1), oldRange.second, -1);
+    apply(row, y, newRange.first, std::min(newRange.second, oldRange.first - 1), 1);
+    apply(row, y, std::max(newRange.first, oldRange.second + 1), newRange.second, 1);
   }
   
-  ViewCountChanged(minX, minY, maxX, maxY);
+  if (changeMaxX >= 0) {
+    ViewCountChanged(changeMinX, changeMinY, changeMaxX, changeMaxY);
+  }
 }
 
-void Map::Render(float* viewMatrix, const std::filesystem::path& graphicsSubPath, QOpenGLFunctions_3_2_Core* f) {
+void Map::Render(float* viewMatrix, const QRectF& projectedCoordsViewRect, const std::filesystem::path& graphicsSubPath, QOpenGLFunctions_3_2_Core* f) {
   if (needsRenderResourcesUpdate) {
     UpdateRenderResources(graphicsSubPath, f);
     needsRenderResourcesUpdate = false;
   }
-  if (viewCountChangeMaxX >= viewCountChangeMinX &&
-      viewCountChangeMaxY >= viewCountChangeMinY) {
+  if (haveViewCountChanges) {
     UpdateViewCountTexture(f);
   }
   
@@ -297,23 +449,36 @@ void Map::Render(float* viewMatrix, const std::filesystem::path& graphicsSubPath
   terrainProgram->SetUniformMatrix2fv(terrainShader->GetViewMatrixLocation(), viewMatrix, true, f);
   f->glUniform2f(terrainShader->GetTexcoordToMapScalingLocation(), 10.f / width, 10.f / height);
   
-  f->glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-  f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-  
-  terrainProgram->SetPositionAttribute(
-      2,
-      GetGLType<float>::value,
-      5 * sizeof(float),
-      0,
-      f);
-  terrainProgram->SetTexCoordAttribute(
-      3,
-      GetGLType<float>::value,
-      5 * sizeof(float),
-      2 * sizeof(float),
-      f);
-  
-  f->glDrawElements(GL_TRIANGLES, width * height * 6, GL_UNSIGNED_INT, 0);
+  for (TerrainChunk& chunk : terrainChunks) {
+    // Chunks that cannot be in view do not need to be built (yet).
+    if (!chunk.maxProjectedRect.intersects(projectedCoordsViewRect)) {
+      continue;
+    }
+    if (chunk.needsRebuild) {
+      BuildTerrainChunk(&chunk, f);
+    }
+    if (!chunk.projectedRect.intersects(projectedCoordsViewRect)) {
+      continue;
+    }
+    
+    f->glBindBuffer(GL_ARRAY_BUFFER, chunk.vertexBuffer);
+    f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk.indexBuffer);
+    
+    terrainProgram->SetPositionAttribute(
+        2,
+        GetGLType<float>::value,
+        5 * sizeof(float),
+        0,
+        f);
+    terrainProgram->SetTexCoordAttribute(
+        3,
+        GetGLType<float>::value,
+        5 * sizeof(float),
+        2 * sizeof(float),
+        f);
+    
+    f->glDrawElements(GL_TRIANGLES, chunk.numIndices, GL_UNSIGNED_SHORT, 0);
+  }
   CHECK_OPENGL_NO_ERROR();
 }
 
@@ -323,16 +488,25 @@ void Map::UnloadRenderResources() {
     f->glDeleteTextures(1, &textureId);
     hasTextureBeenLoaded = false;
   }
-  if (haveGeometryBuffersBeenInitialized) {
-    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-    f->glDeleteBuffers(1, &vertexBuffer);
-    f->glDeleteBuffers(1, &indexBuffer);
-    haveGeometryBuffersBeenInitialized = false;
+  for (TerrainChunk& chunk : terrainChunks) {
+    if (chunk.haveBuffers) {
+      QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+      f->glDeleteBuffers(1, &chunk.vertexBuffer);
+      f->glDeleteBuffers(1, &chunk.indexBuffer);
+      chunk.haveBuffers = false;
+      chunk.needsRebuild = true;
+    }
   }
+  staticSprites.Destroy();
 }
 
 void Map::AddObject(u32 objectId, ClientObject* object) {
   objects.insert(std::make_pair(objectId, object));
+  
+  QPointF anchor;
+  float extent;
+  GetSpatialIndexAnchor(object, &anchor, &extent);
+  spatialIndex.Insert(objectId, object, anchor, extent);
 }
 
 void Map::DeleteObject(u32 objectId) {
@@ -341,10 +515,41 @@ void Map::DeleteObject(u32 objectId) {
     LOG(ERROR) << "Cannot find to erase object id: " << objectId;
     return;
   }
+  spatialIndex.Remove(objectId);
+  staticSprites.RemoveObject(objectId);
   delete it->second;
   objects.erase(it);
 }
 
+void Map::ObjectMoved(u32 objectId, ClientObject* object) {
+  QPointF anchor;
+  float extent;
+  GetSpatialIndexAnchor(object, &anchor, &extent);
+  spatialIndex.Move(objectId, anchor, extent);
+}
+
+void Map::ElevationChanged(const QRect& cornerRect) {
+  // The objects' positions in projected coordinates depend on the elevation.
+  spatialIndex.Clear();
+  for (const auto& item : objects) {
+    QPointF anchor;
+    float extent;
+    GetSpatialIndexAnchor(item.second, &anchor, &extent);
+    spatialIndex.Insert(item.first, item.second, anchor, extent);
+  }
+  
+  // A chunk's geometry depends on the elevation at its tile corners, and its vertex normals
+  // additionally on the elevation at the adjacent corners.
+  for (TerrainChunk& chunk : terrainChunks) {
+    QRect affectingCorners(chunk.tiles.topLeft() - QPoint(1, 1), chunk.tiles.bottomRight() + QPoint(2, 2));
+    if (affectingCorners.intersects(cornerRect)) {
+      chunk.needsRebuild = true;
+    }
+  }
+  
+  ++ elevationVersion;
+}
+
 bool Map::IsUnitInFogOfWar(ClientUnit* unit) {
   int tileX = std::max<int>(0, std::min<int>(width - 1, unit->GetMapCoord().x()));
   int tileY = std::max<int>(0, std::min<int>(height - 1, unit->GetMapCoord().y()));
@@ -370,8 +575,8 @@ int Map::ComputeMaxViewCountForBuilding(ClientBuilding* building) {
 void Map::UpdateRenderResources(const std::filesystem::path& graphicsSubPath, QOpenGLFunctions_3_2_Core* f) {
   // Load texture
   if (!hasTextureBeenLoaded) {
-    mango::Bitmap textureBitmap(
-        GetModdedPath(graphicsSubPath.parent_path().parent_path() / "terrain" / "textures" / "2x" / "g_gr2.dds").string(),
+    mango::Bitmap textureBitmap = LoadBitmapFile(
+        GetModdedPath(graphicsSubPath.parent_path().parent_path() / "terrain" / "textures" / "2x" / "g_gr2.dds"),
         mango::Format(32, mango::Format::UNORM, mango::Format::BGRA, 8, 8, 8, 8));
     
     f->glGenTextures(1, &textureId);
@@ -394,18 +599,32 @@ void Map::UpdateRenderResources(const std::filesystem::path& graphicsSubPath, QO
     hasTextureBeenLoaded = true;
   }
   
-  // Build geometry buffer
-  if (haveGeometryBuffersBeenInitialized) {
-    f->glDeleteBuffers(1, &vertexBuffer);
-    f->glDeleteBuffers(1, &indexBuffer);
-  }
+  terrainShader.reset(new TerrainShader());
   
+  // TODO: Un-load the render resources again on destruction
+}
+
+void Map::BuildTerrainChunk(TerrainChunk* chunk, QOpenGLFunctions_3_2_Core* f) {
+  int minCornerX = chunk->tiles.left();
+  int minCornerY = chunk->tiles.top();
+  int numCornersX = chunk->tiles.width() + 1;
+  int numCornersY = chunk->tiles.height() + 1;
+  
+  // Build the vertex buffer
   int elementSizeInBytes = 5 * sizeof(float);
-  u8* data = new u8[(width + 1) * (height + 1) * elementSizeInBytes];
-  u8* ptr = data;
-  for (int y = 0; y <= height; ++ y) {
-    for (int x = 0; x <= width; ++ x) {
+  std::vector<float> vertexData(numCornersX * numCornersY * 5);
+  float* ptr = vertexData.data();
+  float minProjectedX = std::numeric_limits<float>::infinity();
+  float minProjectedY = std::numeric_limits<float>::infinity();
+  float maxProjectedX = -std::numeric_limits<float>::infinity();
+  float maxProjectedY = -std::numeric_limits<float>::infinity();
+  for (int y = minCornerY; y < minCornerY + numCornersY; ++ y) {
+    for (int x = minCornerX; x < minCornerX + numCornersX; ++ x) {
       QPointF projectedCoord = TileCornerToProjectedCoord(x, y);
+      minProjectedX = std::min<float>(minProjectedX, projectedCoord.x());
+      minProjectedY = std::min<float>(minProjectedY, projectedCoord.y());
+      maxProjectedX = std::max<float>(maxProjectedX, projectedCoord.x());
+      maxProjectedY = std::max<float>(maxProjectedY, projectedCoord.y());
       
       // Estimate the vertex normal
       // TODO: This is quite messy, it would be nice to have a proper 3D vector class for this.
@@ -433,34 +652,30 @@ void Map::UpdateRenderResources(const std::filesystem::path& graphicsSubPath, QO
       float lightingFactor = dot / lightingDirectionZ;
       
       // Position
-      *reinterpret_cast<float*>(ptr) = projectedCoord.x();
-      ptr += sizeof(float);
-      *reinterpret_cast<float*>(ptr) = projectedCoord.y();
-      ptr += sizeof(float);
+      *ptr++ = projectedCoord.x();
+      *ptr++ = projectedCoord.y();
       
       // Texture coordinate
-      *reinterpret_cast<float*>(ptr) = 0.1f * x;
-      ptr += sizeof(float);
-      *reinterpret_cast<float*>(ptr) = 0.1f * y;
-      ptr += sizeof(float);
+      *ptr++ = 0.1f * x;
+      *ptr++ = 0.1f * y;
       
       // Darkening factor for map lighting
       // NOTE: This is passed on as part of the texture coordinates (for convenience)
-      *reinterpret_cast<float*>(ptr) = lightingFactor;
-      ptr += sizeof(float);
+      *ptr++ = lightingFactor;
     }
   }
-  f->glGenBuffers(1, &vertexBuffer);
-  f->glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-  f->glBufferData(GL_ARRAY_BUFFER, (width + 1) * (height + 1) * elementSizeInBytes, data, GL_STATIC_DRAW);
-  delete[] data;
-  CHECK_OPENGL_NO_ERROR();
-  
-  // Build index buffer
-  u32* indexData = new u32[width * height * 6];
-  u32* indexPtr = indexData;
-  for (int y = 0; y < height; ++ y) {
-    for (int x = 0; x < width; ++ x) {
+  chunk->projectedRect = QRectF(QPointF(minProjectedX, minProjectedY), QPointF(maxProjectedX, maxProjectedY));
+  
+  // Build the index buffer. The indices are relative to the chunk's vertices; since the chunks are small,
+  // 16-bit indices suffice.
+  static_assert((kTerrainChunkSize + 1) * (kTerrainChunkSize + 1) <= 65536, "16-bit indices do not suffice for this chunk size");
+  std::vector<u16> indexData(chunk->tiles.width() * chunk->tiles.height() * 6);
+  u16* indexPtr = indexData.data();
+  auto index = [&](int cornerX, int cornerY) {
+    return static_cast<u16>((cornerX - minCornerX) + numCornersX * (cornerY - minCornerY));
+  };
+  for (int y = chunk->tiles.top(); y <= chunk->tiles.bottom(); ++ y) {
+    for (int x = chunk->tiles.left(); x <= chunk->tiles.right(); ++ x) {
       int horizontalDiff = std::abs(elevationAt(x, y) - elevationAt(x + 1, y + 1));
       int verticalDiff = std::abs(elevationAt(x + 1, y) - elevationAt(x, y + 1));
       
@@ -468,35 +683,54 @@ void Map::UpdateRenderResources(const std::filesystem::path& graphicsSubPath, QO
       // the left, upper, and right vertex are all at the same y-coordinate in projected coordinates.
       bool specialCase = (horizontalDiff == 0) && ((elevationAt(x + 1, y) - elevationAt(x, y + 1)) == 1);
       if (horizontalDiff < verticalDiff && !specialCase) {
-        *indexPtr++ = (x + 0) + (width + 1) * (y + 0);
-        *indexPtr++ = (x + 1) + (width + 1) * (y + 1);
-        *indexPtr++ = (x + 0) + (width + 1) * (y + 1);
+        *indexPtr++ = index(x + 0, y + 0);
+        *indexPtr++ = index(x + 1, y + 1);
+        *indexPtr++ = index(x + 0, y + 1);
         
-        *indexPtr++ = (x + 0) + (width + 1) * (y + 0);
-        *indexPtr++ = (x + 1) + (width + 1) * (y + 0);
-        *indexPtr++ = (x + 1) + (width + 1) * (y + 1);
+        *indexPtr++ = index(x + 0, y + 0);
+        *indexPtr++ = index(x + 1, y + 0);
+        *indexPtr++ = index(x + 1, y + 1);
       } else {
-        *indexPtr++ = (x + 0) + (width + 1) * (y + 0);
-        *indexPtr++ = (x + 1) + (width + 1) * (y + 0);
-        *indexPtr++ = (x + 0) + (width + 1) * (y + 1);
+        *indexPtr++ = index(x + 0, y + 0);
+        *indexPtr++ = index(x + 1, y + 0);
+        *indexPtr++ = index(x + 0, y + 1);
         
-        *indexPtr++ = (x + 1) + (width + 1) * (y + 0);
-        *indexPtr++ = (x + 1) + (width + 1) * (y + 1);
-        *indexPtr++ = (x + 0) + (width + 1) * (y + 1);
+        *indexPtr++ = index(x + 1, y + 0);
+        *indexPtr++ = index(x + 1, y + 1);
+        *indexPtr++ = index(x + 0, y + 1);
       }
     }
   }
-  f->glGenBuffers(1, &indexBuffer);
-  f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-  f->glBufferData(GL_ELEMENT_ARRAY_BUFFER, width * height * 6 * sizeof(u32), indexData, GL_STATIC_DRAW);
-  delete[] indexData;
-  CHECK_OPENGL_NO_ERROR();
-  
-  haveGeometryBuffersBeenInitialized = true;
+  chunk->numIndices = indexData.size();
   
-  terrainShader.reset(new TerrainShader());
+  // Upload the data. The buffers are re-used if the chunk was built before, since their size does not change.
+  if (!chunk->haveBuffers) {
+    f->glGenBuffers(1, &chunk->vertexBuffer);
+    f->glGenBuffers(1, &chunk->indexBuffer);
+    chunk->haveBuffers = true;
+  }
+  f->glBindBuffer(GL_ARRAY_BUFFER, chunk->vertexBuffer);
+  f->glBufferData(GL_ARRAY_BUFFER, numCornersX * numCornersY * elementSizeInBytes, vertexData.data(), GL_STATIC_DRAW);
+  f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk->indexBuffer);
+  f->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size() * sizeof(u16), indexData.data(), GL_STATIC_DRAW);
+  CHECK_OPENGL_NO_ERROR();
   
-  // TODO: Un-load the render resources again on destruction
+  chunk->needsRebuild = false;
+}
+
+void Map::GetSpatialIndexAnchor(ClientObject* object, QPointF* anchor, float* extent) const {
+  if (object->isBuilding()) {
+    ClientBuilding* building = AsBuilding(object);
+    QSize size = GetBuildingSize(building->GetType());
+    *anchor = MapCoordToProjectedCoord(QPointF(
+        building->GetBaseTile().x() + 0.5f * size.width(),
+        building->GetBaseTile().y() + 0.5f * size.height()));
+    *extent = GetClientBuildingType(building->GetType()).GetMaxSpriteExtent();
+  } else {
+    ClientUnit* unit = AsUnit(object);
+    *anchor = MapCoordToProjectedCoord(unit->GetMapCoord());
+    *extent = GetClientUnitType(unit->GetType()).GetMaxSpriteExtent();
+  }
 }
 
 void Map::UpdateViewCountTexture(QOpenGLFunctions_3_2_Core* f) {
@@ -520,38 +754,58 @@ void Map::UpdateViewCountTexture(QOpenGLFunctions_3_2_Core* f) {
     haveViewTexture = true;
   }
   
-  int changeWidth = viewCountChangeMaxX - viewCountChangeMinX + 1;
-  int changeHeight = viewCountChangeMaxY - viewCountChangeMinY + 1;
+  // Upload the dirty chunks, merging horizontally adjacent dirty chunks into a single upload. This way, changes in
+  // distant parts of the map (for example, units at opposite corners) do not require uploading everything in between.
+  f->glBindTexture(GL_TEXTURE_2D, viewTextureId);
+  f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   
-  u8* textureData = new u8[changeWidth * changeHeight];
-  for (int y = 0; y < changeHeight; ++ y) {
-    const int* viewCountRow = viewCount + (viewCountChangeMinY + y) * width;
-    u8* textureDataRow = textureData + y * changeWidth;
-    for (int x = 0; x < changeWidth; ++ x) {
-      int viewCountValue = viewCountRow[viewCountChangeMinX + x];
+  for (int chunkY = 0; chunkY < viewCountChunksY; ++ chunkY) {
+    u8* dirtyRow = viewCountChunkDirty.data() + chunkY * viewCountChunksX;
+    int chunkX = 0;
+    while (chunkX < viewCountChunksX) {
+      if (!dirtyRow[chunkX]) {
+        ++ chunkX;
+        continue;
+      }
+      int runEndChunkX = chunkX + 1;
+      while (runEndChunkX < viewCountChunksX && dirtyRow[runEndChunkX]) {
+        ++ runEndChunkX;
+      }
+      
+      int minX = chunkX * kViewCountChunkSize;
+      int minY = chunkY * kViewCountChunkSize;
+      int changeWidth = std::min(width, runEndChunkX * kViewCountChunkSize) - minX;
+      int changeHeight = std::min(height, (chunkY + 1) * kViewCountChunkSize) - minY;
+      
+      viewTextureUploadBuffer.resize(changeWidth * changeHeight);
+      for (int y = 0; y < changeHeight; ++ y) {
+        const int* viewCountRow = viewCount + (minY + y) * width + minX;
+        u8* textureDataRow = viewTextureUploadBuffer.data() + y * changeWidth;
+        for (int x = 0; x < changeWidth; ++ x) {
+          int viewCountValue = viewCountRow[x];
+          
+          textureDataRow[x] = (viewCountValue == 0) ? 168 : ((viewCountValue > 0) ? 255 : 0);
+        }
+      }
+      
+      f->glTexSubImage2D(
+          GL_TEXTURE_2D,
+          0,
+          minX,
+          minY,
+          changeWidth,
+          changeHeight,
+          GL_RED,
+          GL_UNSIGNED_BYTE,
+          viewTextureUploadBuffer.data());
       
-      textureDataRow[x] = (viewCountValue == 0) ? 168 : ((viewCountValue > 0) ? 255 : 0);
+      for (int i = chunkX; i < runEndChunkX; ++ i) {
+        dirtyRow[i] = 0;
+      }
+      chunkX = runEndChunkX;
     }
   }
-  
-  f->glBindTexture(GL_TEXTURE_2D, viewTextureId);
-  f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  f->glTexSubImage2D(
-      GL_TEXTURE_2D,
-    	0,
-    	viewCountChangeMinX,
-    	viewCountChangeMinY,
-    	changeWidth,
-    	changeHeight,
-    	GL_RED,
-    	GL_UNSIGNED_BYTE,
-    	textureData);
   CHECK_OPENGL_NO_ERROR();
   
-  delete[] textureData;
-  
-  viewCountChangeMinX = std::numeric_limits<int>::max();
-  viewCountChangeMinY = std::numeric_limits<int>::max();
-  viewCountChangeMaxX = -1;
-  viewCountChangeMaxY = -1;
+  haveViewCountChanges = false;
 }
@@ -4,19 +4,24 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
+#include <tuple>
+#include <vector>
 
 #include <QOpenGLFunctions_3_2_Core>
 #include <QPointF>
+#include <QRect>
 
 #include "FreeAge/client/building.hpp"
 #include "FreeAge/client/unit.hpp"
 #include "FreeAge/client/shader_program.hpp"
 #include "FreeAge/client/shader_terrain.hpp"
+#include "FreeAge/client/spatial_index.hpp"
 #include "FreeAge/client/sprite.hpp"
+#include "FreeAge/client/static_sprite_buffer.hpp"
 #include "FreeAge/client/texture.hpp"
 
-class HealthBarShader;
 class SpriteShader;
 
 /// Stores the map (terrain type, elevation, ...).
@@ -74,20 +79,39 @@ class Map {
   inline int& viewCountAt(int tileX, int tileY) { return viewCount[tileY * width + tileX]; }
   inline const int& viewCountAt(int tileX, int tileY) const { return viewCount[tileY * width + tileX]; }
   inline void ViewCountChanged(int minX, int minY, int maxX, int maxY) {
-    viewCountChangeMinX = std::min(viewCountChangeMinX, minX);
-    viewCountChangeMinY = std::min(viewCountChangeMinY, minY);
-    viewCountChangeMaxX = std::max(viewCountChangeMaxX, maxX);
-    viewCountChangeMaxY = std::max(viewCountChangeMaxY, maxY);
+    for (int chunkY = minY / kViewCountChunkSize; chunkY <= maxY / kViewCountChunkSize; ++ chunkY) {
+      for (int chunkX = minX / kViewCountChunkSize; chunkX <= maxX / kViewCountChunkSize; ++ chunkX) {
+        viewCountChunkDirty[chunkY * viewCountChunksX + chunkX] = 1;
+      }
+    }
+    haveViewCountChanges = true;
+    minimapViewCountChange |= QRect(QPoint(minX, minY), QPoint(maxX, maxY));
+  }
+  
+  /// Returns the area (in tiles) in which the view counts changed since the last call, and resets it.
+  /// Returns an empty rect if there was no change. This is used by the minimap, which is updated
+  /// independently of the map rendering.
+  inline QRect TakeMinimapViewCountChange() {
+    QRect result = minimapViewCountChange;
+    minimapViewCountChange = QRect();
+    return result;
   }
   
   /// Writes the field-of-view of a unit or building into the viewCount.
   /// If change is 1, adds a view count, if it is -1, removes one.
   void UpdateFieldOfView(float centerMapCoordX, float centerMapCoordY, float radius, int change);
   
+  /// Moves a field-of-view with the given radius from the old to the new center. This is equivalent to
+  /// removing the old field-of-view and adding the new one with UpdateFieldOfView(), but only touches
+  /// the tiles whose view count actually changes.
+  void MoveFieldOfView(float oldCenterMapCoordX, float oldCenterMapCoordY, float newCenterMapCoordX, float newCenterMapCoordY, float radius);
+  
   
   // TODO: Should this functionality be moved into its own class?
   inline void SetNeedsRenderResourcesUpdate(bool needsUpdate) { needsRenderResourcesUpdate = needsUpdate; }
-  void Render(float* viewMatrix, const std::filesystem::path& graphicsSubPath, QOpenGLFunctions_3_2_Core* f);
+  /// Renders the terrain. Only the terrain chunks that intersect the given view rect (in projected coordinates)
+  /// are rendered, and only these are re-built if their elevation changed.
+  void Render(float* viewMatrix, const QRectF& projectedCoordsViewRect, const std::filesystem::path& graphicsSubPath, QOpenGLFunctions_3_2_Core* f);
   void UnloadRenderResources();
   
   
@@ -97,6 +121,29 @@ class Map {
   void AddObject(u32 objectId, ClientObject* object);
   void DeleteObject(u32 objectId);
   
+  /// Must be called after the position of a unit changed, to update it in the spatial index.
+  void ObjectMoved(u32 objectId, ClientObject* object);
+  
+  /// Must be called after the elevation changed at the tile corners within the given rect (in corner
+  /// coordinates). Re-inserts all objects into the spatial index (since their projected coordinates
+  /// depend on the elevation) and marks the terrain chunks that are affected by the change for re-building.
+  void ElevationChanged(const QRect& cornerRect);
+  
+  /// Returns a counter that is incremented by ElevationChanged(). This allows to detect whether
+  /// data that was derived from the elevation is outdated.
+  inline u32 GetElevationVersion() const { return elevationVersion; }
+  
+  /// Appends all objects to result whose sprites may intersect the given rectangle in projected coordinates.
+  /// This is much faster than iterating over all objects for small rectangles. The result is
+  /// conservative, so the objects' rectangles must still be tested against the given rectangle.
+  inline void QueryObjects(const QRectF& projectedRect, std::vector<SpatialIndex::Entry>* result) const {
+    spatialIndex.Query(projectedRect, result);
+  }
+  
+  /// Returns the buffer with the sprite vertices of the objects that have a static appearance
+  /// (see ClientBuilding::HasStaticAppearance()). Objects are removed from it by DeleteObject().
+  inline StaticSpriteBuffer& GetStaticSprites() { return staticSprites; }
+  
   bool IsUnitInFogOfWar(ClientUnit* unit);
   bool IsBuildingInFogOfWar(ClientBuilding* building);
   int ComputeMaxViewCountForBuilding(ClientBuilding* building);
@@ -107,9 +154,52 @@ class Map {
   inline int GetMaxElevation() const { return maxElevation; }
   
  private:
+  /// The terrain geometry is split into chunks of (at most) kTerrainChunkSize x kTerrainChunkSize tiles,
+  /// each with its own vertex and index buffer.
+  struct TerrainChunk {
+    /// The tiles covered by the chunk.
+    QRect tiles;
+    
+    /// Bounding rect of the chunk's geometry in projected coordinates for any possible elevation.
+    /// Used to decide whether the chunk needs to be built at all.
+    QRectF maxProjectedRect;
+    
+    /// Bounding rect of the chunk's geometry in projected coordinates, valid once the chunk is built.
+    QRectF projectedRect;
+    
+    bool needsRebuild = true;
+    bool haveBuffers = false;
+    GLuint vertexBuffer;
+    GLuint indexBuffer;
+    int numIndices;
+  };
+  
+  static constexpr int kTerrainChunkSize = 32;
+  
+  /// The shape of a field-of-view for a given radius and position of the center within its tile.
+  /// Each row of a field-of-view circle is a contiguous range of tiles, so it is stored as one range per row.
+  struct FieldOfViewStamp {
+    /// Offset of the first row relative to the tile that contains the center.
+    int minOffsetY;
+    
+    /// For each row, the range [first, second] of tile offsets in x-direction relative to the tile that contains the center.
+    std::vector<std::pair<int, int>> rows;
+  };
+  
+  /// Returns the (cached) field-of-view stamp for the given center and radius. tileX and tileY are set to the
+  /// tile that contains the center.
+  const FieldOfViewStamp& GetFieldOfViewStamp(float centerMapCoordX, float centerMapCoordY, float radius, int* tileX, int* tileY);
+  
+  /// Size of the chunks in which changes to the view counts are tracked for uploading them to the view texture.
+  static constexpr int kViewCountChunkSize = 32;
+  
   void UpdateRenderResources(const std::filesystem::path& graphicsSubPath, QOpenGLFunctions_3_2_Core* f);
+  void BuildTerrainChunk(TerrainChunk* chunk, QOpenGLFunctions_3_2_Core* f);
   void UpdateViewCountTexture(QOpenGLFunctions_3_2_Core* f);
   
+  /// Returns the anchor point and the extent of the given object for the spatial index.
+  void GetSpatialIndexAnchor(ClientObject* object, QPointF* anchor, float* extent) const;
+  
   /// The maximum possible elevation level (the lowest is zero).
   /// This may be higher than the maximum actually existing
   /// elevation level (but never lower).
@@ -131,19 +221,39 @@ class Map {
   /// Map of object ID -> ClientObject.
   std::unordered_map<u32, ClientObject*> objects;
   
+  /// Spatial index of the objects in projected coordinates, used for culling and picking.
+  SpatialIndex spatialIndex;
+  
+  /// Sprite vertices of the objects that are rendered from static buffers.
+  StaticSpriteBuffer staticSprites;
+  
   /// Stores how many units or buildings view each map tile.
   /// As a special case, map tiles that have not been uncovered yet have the value -1.
   /// The array size is thus: width times height.
   /// An element (x, y) has index: [y * width + x].
   int* viewCount;
   
-  /// The area where the view counts changed since the last rendering call
-  /// (and thus must be updated before the next rendering call).
-  /// If set to an invalid area, no update has been done.
-  int viewCountChangeMinX;
-  int viewCountChangeMinY;
-  int viewCountChangeMaxX;
-  int viewCountChangeMaxY;
+  /// Field-of-view stamps, indexed by: (radius, x offset of the center within its tile, y offset of the center within its tile).
+  /// Since there are only few distinct line-of-sight values and the centers are usually at tile centers or
+  /// corners, this remains small.
+  std::map<std::tuple<float, float, float>, FieldOfViewStamp> fieldOfViewStamps;
+  
+  /// For each chunk of kViewCountChunkSize x kViewCountChunkSize tiles, whether its view counts changed
+  /// since the last rendering call (and thus must be updated in the view texture before the next rendering call).
+  /// An element (x, y) has index: [y * viewCountChunksX + x].
+  std::vector<u8> viewCountChunkDirty;
+  int viewCountChunksX;
+  int viewCountChunksY;
+  bool haveViewCountChanges;
+  
+  /// Buffer for the view texture data that is uploaded in UpdateViewCountTexture(). Kept to avoid re-allocations.
+  std::vector<u8> viewTextureUploadBuffer;
+  
+  /// The area where the view counts changed since the last call to TakeMinimapViewCountChange().
+  QRect minimapViewCountChange;
+  
+  /// See GetElevationVersion().
+  u32 elevationVersion = 0;
   
   bool haveViewTexture = false;
   GLuint viewTextureId;
@@ -154,8 +264,6 @@ class Map {
   
   bool hasTextureBeenLoaded = false;
   GLuint textureId;
-  bool haveGeometryBuffersBeenInitialized = false;
-  GLuint vertexBuffer;
-  GLuint indexBuffer;
+  std::vector<TerrainChunk> terrainChunks;
   std::shared_ptr<TerrainShader> terrainShader;
 };
@@ -0,0 +1,52 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/mapped_file.hpp"
+
+#include "FreeAge/common/logging.hpp"
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const QString& path) {
+  Close();
+  
+  file.setFileName(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  
+  qint64 fileSize = file.size();
+  if (fileSize > 0) {
+    mapping = file.map(0, fileSize);
+  }
+  if (mapping) {
+    mappedData = mapping;
+  } else {
+    // Mapping is not supported for this file (or the file is empty). Read it with a single call instead.
+    buffer = file.readAll();
+    if (buffer.size() != fileSize) {
+      LOG(ERROR) << "Failed to read file: " << path.toStdString();
+      Close();
+      return false;
+    }
+    mappedData = reinterpret_cast<const u8*>(buffer.constData());
+  }
+  mappedSize = fileSize;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (mapping) {
+    file.unmap(mapping);
+    mapping = nullptr;
+  }
+  if (file.isOpen()) {
+    file.close();
+  }
+  buffer = QByteArray();
+  mappedData = nullptr;
+  mappedSize = 0;
+}
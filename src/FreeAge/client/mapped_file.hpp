@@ -0,0 +1,106 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <cstring>
+
+#include <QByteArray>
+#include <QFile>
+
+#include "FreeAge/common/free_age.hpp"
+
+/// Read-only access to the complete contents of a file. The file is memory-mapped if possible;
+/// otherwise, it is read into memory with a single read call. This avoids the overhead of
+/// many small read calls when parsing files that consist of many small parts.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  
+  MappedFile(const MappedFile& other) = delete;
+  MappedFile& operator= (const MappedFile& other) = delete;
+  
+  /// Opens and maps the given file. Returns true on success.
+  bool Open(const QString& path);
+  
+  /// Unmaps and closes the file (if it is open).
+  void Close();
+  
+  inline const u8* data() const { return mappedData; }
+  inline usize size() const { return mappedSize; }
+  
+ private:
+  QFile file;
+  
+  /// The memory mapping of the file, or nullptr if the file was read into buffer instead.
+  uchar* mapping = nullptr;
+  
+  /// Contains the file contents if mapping the file was not possible.
+  QByteArray buffer;
+  
+  const u8* mappedData = nullptr;
+  usize mappedSize = 0;
+};
+
+
+/// Bounds-checked sequential reader for data in memory, for example a MappedFile.
+/// All functions return false (respectively nullptr) if the requested data would exceed
+/// the end of the memory range, and leave the read position unchanged in this case.
+class ByteReader {
+ public:
+  inline ByteReader(const u8* data, usize size, usize offset = 0)
+      : data(data),
+        size(size),
+        offset(offset) {}
+  
+  /// Reads a trivially copyable value (for example, a file header struct).
+  template <typename T>
+  inline bool Read(T* value) {
+    return ReadArray(value, 1);
+  }
+  
+  /// Reads @p count consecutive trivially copyable values.
+  template <typename T>
+  inline bool ReadArray(T* values, usize count) {
+    if (count > Remaining() / sizeof(T)) {
+      return false;
+    }
+    memcpy(values, data + offset, count * sizeof(T));
+    offset += count * sizeof(T);
+    return true;
+  }
+  
+  /// Returns a pointer to the next @p length bytes (without copying them) and advances past them.
+  inline const u8* Take(usize length) {
+    if (length > Remaining()) {
+      return nullptr;
+    }
+    const u8* result = data + offset;
+    offset += length;
+    return result;
+  }
+  
+  /// Advances the read position by @p length bytes.
+  inline bool Skip(usize length) {
+    return Take(length) != nullptr;
+  }
+  
+  /// Sets the absolute read position.
+  inline bool Seek(usize newOffset) {
+    if (newOffset > size) {
+      return false;
+    }
+    offset = newOffset;
+    return true;
+  }
+  
+  inline usize Offset() const { return offset; }
+  inline usize Remaining() const { return size - offset; }
+  
+ private:
+  const u8* data;
+  usize size;
+  usize offset;
+};
@@ -4,6 +4,8 @@
 
 #include "FreeAge/client/minimap.hpp"
 
+#include <cstring>
+
 #include "FreeAge/client/map.hpp"
 #include "FreeAge/common/util.hpp"
 
@@ -39,94 +41,237 @@ void Minimap::Update(Map* map, const std::vector<QRgb>& playerColors, QOpenGLFun
     
     CHECK_OPENGL_NO_ERROR();
     haveTexture = true;
+    
+    // Make sure that the whole texture gets initialized.
+    mapWidth = -1;
   }
   
-  // TODO: Restrict updates to the parts of the texture that actually changed?
   // TODO: Use a color palette to reduce the amount of data transferred to the GPU on updates?
-  // TODO: Updates could be written to one texture in a background thread while another texture is used for rendering
   
-  // Render terrain
-  QRgb* data = new QRgb[map->GetWidth() * map->GetHeight()];
-  for (int y = 0; y < map->GetHeight(); ++ y) {
-    const int* viewCountRow = &map->viewCountAt(0, 0) + y * map->GetWidth();
-    QRgb* dataRow = data + y * map->GetWidth();
-    for (int x = 0; x < map->GetWidth(); ++ x) {
-      int viewCountValue = viewCountRow[x];
-      int differences =
-          std::abs(map->elevationAt(x, y) - map->elevationAt(x + 1, y)) +
-          std::abs(map->elevationAt(x, y) - map->elevationAt(x, y + 1)) +
-          std::abs(map->elevationAt(x, y) - map->elevationAt(x + 1, y + 1));
-      
-      // TODO: How should slopes be colored? Use some kind of lighting simulation, as on the actual terrain?
-      dataRow[x] = (viewCountValue < 0) ? qRgb(0, 0, 0) : ((differences > 0) ? qRgb(25, 135, 14) : qRgb(51, 151, 39));
+  std::vector<QRect> changedRects;
+  UpdateImage(map, playerColors, &changedRects);
+  if (changedRects.empty()) {
+    return;
+  }
+  
+  // Upload the changed parts of the image. If there are many of them, upload their bounding rect
+  // instead to limit the number of calls.
+  constexpr usize kMaxUploadRects = 32;
+  if (changedRects.size() > kMaxUploadRects) {
+    QRect boundingRect;
+    for (const QRect& rect : changedRects) {
+      boundingRect |= rect;
     }
+    changedRects = {boundingRect};
+  }
+  
+  f->glBindTexture(GL_TEXTURE_2D, textureId);
+  f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  f->glPixelStorei(GL_UNPACK_ROW_LENGTH, mapWidth);
+  for (const QRect& rect : changedRects) {
+    f->glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        rect.x(), rect.y(),
+        rect.width(), rect.height(),
+        GL_BGRA, GL_UNSIGNED_BYTE,
+        image.data() + rect.x() + mapWidth * rect.y());
+  }
+  f->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  CHECK_OPENGL_NO_ERROR();
+}
+
+void Minimap::UpdateImage(Map* map, const std::vector<QRgb>& playerColors, std::vector<QRect>* changedRects) {
+  QRect viewCountChange = map->TakeMinimapViewCountChange();
+  
+  if (map->GetWidth() != mapWidth ||
+      map->GetHeight() != mapHeight ||
+      map->GetElevationVersion() != terrainElevationVersion) {
+    // Re-compute everything.
+    ComputeTerrainColors(map);
+    image.resize(mapWidth * mapHeight);
+    dirtyTiles.assign(mapWidth * mapHeight, 0);
+    dirtyRects.clear();
+    drawnObjects.clear();
+    AddDirtyRect(QRect(0, 0, mapWidth, mapHeight));
+  } else if (!viewCountChange.isEmpty()) {
+    AddDirtyRect(viewCountChange);
   }
   
-  // Render buildings and units
+  // Determine the objects whose appearance on the minimap changed.
+  ++ updateCounter;
   for (const auto& item : map->GetObjects()) {
-    if (item.second->isBuilding()) {
-      ClientBuilding* building = AsBuilding(item.second);
-      if (map->ComputeMaxViewCountForBuilding(building) < 0) {
-        continue;
+    QRect tiles;
+    QRgb color;
+    bool isShown = GetObjectAppearance(map, item.second, playerColors, &tiles, &color);
+    
+    auto it = drawnObjects.find(item.first);
+    if (it == drawnObjects.end()) {
+      if (isShown) {
+        drawnObjects.emplace(item.first, DrawnObject{tiles, color, updateCounter});
+        AddDirtyRect(tiles);
       }
-      
-      const QPoint& baseTile = building->GetBaseTile();
-      
-      if (IsTree(building->GetType())) {
-        data[baseTile.x() + map->GetWidth() * baseTile.y()] = qRgb(21, 118, 21);
-      } else if (building->GetType() == BuildingType::ForageBush) {
-        data[baseTile.x() + map->GetWidth() * baseTile.y()] = qRgb(176, 217, 139);  // TODO: Check actual color; enlarge drawing?
-      } else if (building->GetType() == BuildingType::GoldMine) {
-        data[baseTile.x() + map->GetWidth() * baseTile.y()] = qRgb(255, 255, 0);  // TODO: Check actual color; enlarge drawing?
-      } else if (building->GetType() == BuildingType::StoneMine) {
-        data[baseTile.x() + map->GetWidth() * baseTile.y()] = qRgb(127, 127, 127);  // TODO: Check actual color; enlarge drawing?
-      } else if (building->GetPlayerIndex() != kGaiaPlayerIndex) {
-        constexpr int growSize = 0;
-        
-        QSize buildingSize = GetBuildingSize(building->GetType());
-        
-        int minX = std::max(0, baseTile.x() - growSize);
-        int minY = std::max(0, baseTile.y() - growSize);
-        int maxX = std::min(map->GetWidth() - 1, baseTile.x() + buildingSize.width() - 1 + growSize);
-        int maxY = std::min(map->GetHeight() - 1, baseTile.y() + buildingSize.height() - 1 + growSize);
-        
-        for (int y = minY; y <= maxY; ++ y) {
-          for (int x = minX; x <= maxX; ++ x) {
-            data[x + map->GetWidth() * y] = playerColors[building->GetPlayerIndex()];
-          }
+    } else if (!isShown) {
+      AddDirtyRect(it->second.tiles);
+      drawnObjects.erase(it);
+    } else {
+      if (it->second.tiles != tiles || it->second.color != color) {
+        AddDirtyRect(it->second.tiles);
+        AddDirtyRect(tiles);
+        it->second.tiles = tiles;
+        it->second.color = color;
+      }
+      it->second.lastUpdate = updateCounter;
+    }
+  }
+  
+  // Remove the objects that were deleted from the map.
+  for (auto it = drawnObjects.begin(); it != drawnObjects.end(); ) {
+    if (it->second.lastUpdate != updateCounter) {
+      AddDirtyRect(it->second.tiles);
+      it = drawnObjects.erase(it);
+    } else {
+      ++ it;
+    }
+  }
+  
+  if (dirtyRects.empty()) {
+    return;
+  }
+  
+  // Re-compose the dirty tiles: first the terrain (with the fog of war), then the objects on top.
+  for (const QRect& rect : dirtyRects) {
+    for (int y = rect.top(); y <= rect.bottom(); ++ y) {
+      const int* viewCountRow = &map->viewCountAt(0, y);
+      const QRgb* terrainRow = terrainColors.data() + y * mapWidth;
+      QRgb* imageRow = image.data() + y * mapWidth;
+      for (int x = rect.left(); x <= rect.right(); ++ x) {
+        imageRow[x] = (viewCountRow[x] < 0) ? qRgb(0, 0, 0) : terrainRow[x];
+      }
+    }
+  }
+  
+  for (const auto& item : drawnObjects) {
+    const DrawnObject& object = item.second;
+    
+    bool isDirty = false;
+    for (int y = object.tiles.top(); y <= object.tiles.bottom() && !isDirty; ++ y) {
+      for (int x = object.tiles.left(); x <= object.tiles.right(); ++ x) {
+        if (dirtyTiles[x + mapWidth * y]) {
+          isDirty = true;
+          break;
         }
       }
-    } else if (item.second->isUnit()) {
-      ClientUnit* unit = AsUnit(item.second);
-      if (map->IsUnitInFogOfWar(unit)) {
-        continue;
+    }
+    if (!isDirty) {
+      continue;
+    }
+    
+    for (int y = object.tiles.top(); y <= object.tiles.bottom(); ++ y) {
+      for (int x = object.tiles.left(); x <= object.tiles.right(); ++ x) {
+        image[x + mapWidth * y] = object.color;
       }
-      
+    }
+    
+    // The object may extend beyond the dirty tiles, so its whole rect needs to be uploaded.
+    changedRects->push_back(object.tiles);
+  }
+  
+  // Reset the dirty state.
+  for (const QRect& rect : dirtyRects) {
+    for (int y = rect.top(); y <= rect.bottom(); ++ y) {
+      memset(dirtyTiles.data() + rect.left() + mapWidth * y, 0, rect.width());
+    }
+    changedRects->push_back(rect);
+  }
+  dirtyRects.clear();
+}
+
+bool Minimap::GetObjectAppearance(Map* map, ClientObject* object, const std::vector<QRgb>& playerColors, QRect* tiles, QRgb* color) {
+  if (object->isBuilding()) {
+    ClientBuilding* building = AsBuilding(object);
+    if (map->ComputeMaxViewCountForBuilding(building) < 0) {
+      return false;
+    }
+    
+    const QPoint& baseTile = building->GetBaseTile();
+    *tiles = QRect(baseTile, QSize(1, 1));
+    
+    if (IsTree(building->GetType())) {
+      *color = qRgb(21, 118, 21);
+    } else if (building->GetType() == BuildingType::ForageBush) {
+      *color = qRgb(176, 217, 139);  // TODO: Check actual color; enlarge drawing?
+    } else if (building->GetType() == BuildingType::GoldMine) {
+      *color = qRgb(255, 255, 0);  // TODO: Check actual color; enlarge drawing?
+    } else if (building->GetType() == BuildingType::StoneMine) {
+      *color = qRgb(127, 127, 127);  // TODO: Check actual color; enlarge drawing?
+    } else if (building->GetPlayerIndex() != kGaiaPlayerIndex) {
       constexpr int growSize = 0;
       
-      int minX = std::max<int>(0, unit->GetMapCoord().x() - growSize);
-      int minY = std::max<int>(0, unit->GetMapCoord().y() - growSize);
-      int maxX = std::min<int>(map->GetWidth() - 1, unit->GetMapCoord().x() + growSize);
-      int maxY = std::min<int>(map->GetHeight() - 1, unit->GetMapCoord().y() + growSize);
+      QSize buildingSize = GetBuildingSize(building->GetType());
       
-      for (int y = minY; y <= maxY; ++ y) {
-        for (int x = minX; x <= maxX; ++ x) {
-          data[x + map->GetWidth() * y] = playerColors[unit->GetPlayerIndex()];
-        }
-      }
+      int minX = std::max(0, baseTile.x() - growSize);
+      int minY = std::max(0, baseTile.y() - growSize);
+      int maxX = std::min(map->GetWidth() - 1, baseTile.x() + buildingSize.width() - 1 + growSize);
+      int maxY = std::min(map->GetHeight() - 1, baseTile.y() + buildingSize.height() - 1 + growSize);
+      
+      *tiles = QRect(QPoint(minX, minY), QPoint(maxX, maxY));
+      *color = playerColors[building->GetPlayerIndex()];
+    } else {
+      return false;
     }
+  } else if (object->isUnit()) {
+    ClientUnit* unit = AsUnit(object);
+    if (map->IsUnitInFogOfWar(unit)) {
+      return false;
+    }
+    
+    constexpr int growSize = 0;
+    
+    int minX = std::max<int>(0, unit->GetMapCoord().x() - growSize);
+    int minY = std::max<int>(0, unit->GetMapCoord().y() - growSize);
+    int maxX = std::min<int>(map->GetWidth() - 1, unit->GetMapCoord().x() + growSize);
+    int maxY = std::min<int>(map->GetHeight() - 1, unit->GetMapCoord().y() + growSize);
+    
+    *tiles = QRect(QPoint(minX, minY), QPoint(maxX, maxY));
+    *color = playerColors[unit->GetPlayerIndex()];
+  } else {
+    return false;
   }
   
-  f->glBindTexture(GL_TEXTURE_2D, textureId);
-  f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  f->glTexImage2D(
-        GL_TEXTURE_2D,
-        0, GL_RGBA,
-        map->GetWidth(), map->GetHeight(),
-        0, GL_BGRA, GL_UNSIGNED_BYTE,
-        data);
+  return true;
+}
+
+void Minimap::ComputeTerrainColors(Map* map) {
+  mapWidth = map->GetWidth();
+  mapHeight = map->GetHeight();
+  terrainElevationVersion = map->GetElevationVersion();
+  
+  terrainColors.resize(mapWidth * mapHeight);
+  for (int y = 0; y < mapHeight; ++ y) {
+    QRgb* terrainRow = terrainColors.data() + y * mapWidth;
+    for (int x = 0; x < mapWidth; ++ x) {
+      int differences =
+          std::abs(map->elevationAt(x, y) - map->elevationAt(x + 1, y)) +
+          std::abs(map->elevationAt(x, y) - map->elevationAt(x, y + 1)) +
+          std::abs(map->elevationAt(x, y) - map->elevationAt(x + 1, y + 1));
+      
+      // TODO: How should slopes be colored? Use some kind of lighting simulation, as on the actual terrain?
+      terrainRow[x] = (differences > 0) ? qRgb(25, 135, 14) : qRgb(51, 151, 39);
+    }
+  }
+}
+
+void Minimap::AddDirtyRect(const QRect& rect) {
+  QRect clippedRect = rect & QRect(0, 0, mapWidth, mapHeight);
+  if (clippedRect.isEmpty()) {
+    return;
+  }
   
-  delete[] data;
+  dirtyRects.push_back(clippedRect);
+  for (int y = clippedRect.top(); y <= clippedRect.bottom(); ++ y) {
+    memset(dirtyTiles.data() + clippedRect.left() + mapWidth * y, 1, clippedRect.width());
+  }
 }
 
 void Minimap::Render(const QPointF& topLeft, float uiScale, const std::shared_ptr<MinimapShader>& shader, QOpenGLFunctions_3_2_Core* f) {
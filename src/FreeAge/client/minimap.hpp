@@ -5,22 +5,37 @@
 #pragma once
 
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <QOpenGLFunctions_3_2_Core>
+#include <QRect>
 #include <QRgb>
 
+#include "FreeAge/common/free_age.hpp"
 #include "FreeAge/client/opengl.hpp"
 #include "FreeAge/client/shader_minimap.hpp"
 
+class ClientObject;
 class Map;
 
 /// Handles the minimap creation and display.
+///
+/// The minimap image is updated incrementally: the terrain colors are only computed when the
+/// elevation changes, and in each update, only the tiles whose fog-of-war state changed (see
+/// Map::TakeMinimapViewCountChange()) or that are covered by objects which were added, removed,
+/// moved, or changed their appearance are re-composed and uploaded to the texture.
 class Minimap {
  public:
   ~Minimap();
   
+  /// Updates the minimap image and uploads its changed parts to the texture.
   void Update(Map* map, const std::vector<QRgb>& playerColors, QOpenGLFunctions_3_2_Core* f);
   
+  /// CPU part of Update(): updates the minimap image and returns the areas (in tiles) that
+  /// changed in @p changedRects.
+  void UpdateImage(Map* map, const std::vector<QRgb>& playerColors, std::vector<QRect>* changedRects);
+  
   void Render(const QPointF& topLeft, float uiScale, const std::shared_ptr<MinimapShader>& shader, QOpenGLFunctions_3_2_Core* f);
   
   /// Converts a screen coordinate (e.g., the cursor position) to the corresponding map coordinate.
@@ -40,6 +55,39 @@ class Minimap {
   void GetMinimapCorners(const QPointF& topLeft, float uiScale, QPointF* corners);
   
  private:
+  /// The tiles covered by an object on the minimap, and its color.
+  struct DrawnObject {
+    QRect tiles;
+    QRgb color;
+    
+    /// The value of updateCounter in the last update in which the object was visible.
+    u32 lastUpdate;
+  };
+  
+  /// Returns false if the object is not shown on the minimap (e.g., since it is hidden by the fog of war).
+  /// Otherwise, returns the tiles covered by the object and its color.
+  bool GetObjectAppearance(Map* map, ClientObject* object, const std::vector<QRgb>& playerColors, QRect* tiles, QRgb* color);
+  
+  void ComputeTerrainColors(Map* map);
+  void AddDirtyRect(const QRect& rect);
+  
+  /// Terrain colors, ignoring the fog of war. Computed once per elevation change.
+  std::vector<QRgb> terrainColors;
+  u32 terrainElevationVersion = 0;
+  int mapWidth = -1;
+  int mapHeight = -1;
+  
+  /// The current minimap image (in the texture's layout).
+  std::vector<QRgb> image;
+  
+  /// The objects that are currently drawn into the image, indexed by object ID.
+  std::unordered_map<u32, DrawnObject> drawnObjects;
+  u32 updateCounter = 0;
+  
+  /// The tiles that need to be re-composed in the current update, as rects and as a per-tile mask.
+  std::vector<QRect> dirtyRects;
+  std::vector<u8> dirtyTiles;
+  
   bool haveTexture = false;
   GLuint textureId;
   
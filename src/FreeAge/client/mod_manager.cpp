@@ -4,6 +4,7 @@
 
 #include "FreeAge/client/mod_manager.hpp"
 
+#include <mango/image/image.hpp>
 #include <yaml-cpp/yaml.h>
 
 #include "FreeAge/common/free_age.hpp"
@@ -11,6 +12,7 @@
 
 void ModManager::Clear(const std::filesystem::path& dataDirPath) {
   mods.clear();
+  assetBundle.Close();
   
   this->dataDirPath = dataDirPath;
 }
@@ -85,3 +87,49 @@ std::filesystem::path ModManager::GetPath(const std::filesystem::path& subPath)
   // Did not find a file among the loaded mods, return the path into the standard data directory.
   return dataDirPath / subPath;
 }
+
+bool ModManager::OpenAssetBundle(const std::filesystem::path& bundlePath) {
+  return assetBundle.Open(bundlePath);
+}
+
+bool ModManager::GetBundledFile(const std::filesystem::path& path, QByteArray* data) const {
+  if (!assetBundle.IsOpen()) {
+    return false;
+  }
+  
+  // Only files within the data directory may be contained in the bundle.
+  std::filesystem::path relativePath = path.lexically_normal().lexically_relative(dataDirPath.lexically_normal());
+  if (relativePath.empty() || *relativePath.begin() == "..") {
+    return false;
+  }
+  
+  return assetBundle.GetFile(relativePath.generic_string(), data);
+}
+
+
+QImage LoadImageFile(const std::filesystem::path& path) {
+  QByteArray data;
+  if (ModManager::Instance().GetBundledFile(path, &data)) {
+    // Pass the format explicitly since it cannot be auto-detected for all formats (e.g., cursors).
+    std::string format = path.extension().string();
+    return QImage::fromData(data, format.empty() ? nullptr : format.c_str() + 1);
+  }
+  return QImage(QString::fromStdString(path.string()));
+}
+
+mango::Bitmap LoadBitmapFile(const std::filesystem::path& path, const mango::Format& format) {
+  QByteArray data;
+  if (ModManager::Instance().GetBundledFile(path, &data)) {
+    return mango::Bitmap(
+        mango::ConstMemory(reinterpret_cast<const u8*>(data.constData()), data.size()),
+        path.extension().string(),
+        format);
+  }
+  return mango::Bitmap(path.string(), format);
+}
+
+bool GameFileExists(const std::filesystem::path& path) {
+  QByteArray data;
+  return ModManager::Instance().GetBundledFile(path, &data) ||
+         std::filesystem::exists(path);
+}
@@ -6,12 +6,23 @@
 
 #include <filesystem>
 
+#include <QByteArray>
+#include <QImage>
 #include <QString>
 
+#include "FreeAge/client/asset_bundle.hpp"
+
+namespace mango {
+  class Bitmap;
+  class Format;
+}
+
 /// Reads mod-status.json to determine the list of loaded mods.
 /// All paths to game data files must be acquired via GetPath() of this ModManger, which will either
 /// return a path pointing to the first mod directory containing that file, or to the
 /// game's original file in case no mod overrides it.
+/// Optionally, the original game files may be read from an asset bundle instead
+/// (see OpenAssetBundle()); use LoadImageFile() etc. to make use of it.
 class ModManager {
  public:
   static inline ModManager& Instance() {
@@ -29,6 +40,18 @@ class ModManager {
   /// Returns the absolute path to the file given by the subPath.
   std::filesystem::path GetPath(const std::filesystem::path& subPath) const;
   
+  /// Opens the asset bundle at the given path. Afterwards, the original game files contained in the
+  /// bundle are read from it instead of from the data directory. Files of mods still take precedence.
+  /// The bundle is closed by Clear().
+  bool OpenAssetBundle(const std::filesystem::path& bundlePath);
+  
+  /// If the file at the given path (as returned by GetPath()) is contained in the asset bundle,
+  /// returns true and the file's contents in data. Otherwise, returns false. Note that for
+  /// uncompressed files, data references the bundle's memory, see AssetBundle::GetFile().
+  bool GetBundledFile(const std::filesystem::path& path, QByteArray* data) const;
+  
+  inline bool HasAssetBundle() const { return assetBundle.IsOpen(); }
+  
  private:
   struct Mod {
     std::filesystem::path path;
@@ -47,6 +70,9 @@ class ModManager {
   std::vector<Mod> mods;
   
   std::filesystem::path dataDirPath;
+  
+  /// Optional bundle of the original game files.
+  AssetBundle assetBundle;
 };
 
 inline std::filesystem::path GetModdedPath(const std::filesystem::path& subPath) {
@@ -56,3 +82,18 @@ inline std::filesystem::path GetModdedPath(const std::filesystem::path& subPath)
 inline QString GetModdedPathAsQString(const std::filesystem::path& subPath) {
   return QString::fromStdString(ModManager::Instance().GetPath(subPath).string());
 }
+
+/// Loads the image file at the given path (usually obtained from GetModdedPath()),
+/// from the asset bundle if it contains the file.
+QImage LoadImageFile(const std::filesystem::path& path);
+
+/// Loads the image file at the given path with mango (for example, for the DDS format),
+/// from the asset bundle if it contains the file.
+mango::Bitmap LoadBitmapFile(const std::filesystem::path& path, const mango::Format& format);
+
+/// Returns whether the file at the given path exists, either on disk or in the asset bundle.
+bool GameFileExists(const std::filesystem::path& path);
+
+inline QImage LoadModdedImage(const std::filesystem::path& subPath) {
+  return LoadImageFile(GetModdedPath(subPath));
+}
@@ -5,26 +5,24 @@
 #include "FreeAge/client/render_utils.hpp"
 
 #include "FreeAge/client/mod_manager.hpp"
-#include "FreeAge/client/render_window.hpp"
+#include "FreeAge/client/ui_renderer.hpp"
 
-TextureAndPointBuffer::~TextureAndPointBuffer() {
+UITexture::~UITexture() {
   if (texture != nullptr) {
-    LOG(ERROR) << "TextureAndPointBuffer object was destroyed without Unload() being called first.";
+    LOG(ERROR) << "UITexture object was destroyed without Unload() being called first.";
   }
 }
 
-bool TextureAndPointBuffer::Load(const std::filesystem::path& path, QImage* qimage, TextureManager::Loader loader) {
+bool UITexture::Load(const std::filesystem::path& path, QImage* qimage, TextureManager::Loader loader) {
   if (texture != nullptr) {
-    LOG(ERROR) << "Load() called on already initialized TextureAndPointBuffer";
+    LOG(ERROR) << "Load() called on already initialized UITexture";
     return false;
   }
   
-  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-  
   // Load the texture.
   texture.reset(new Texture());
   if (loader == TextureManager::Loader::QImage) {
-    QImage image(path.string().c_str());
+    QImage image = LoadImageFile(path);
     if (image.isNull()) {
       LOG(ERROR) << "Failed to load image: " << path.string();
       return false;
@@ -38,126 +36,46 @@ bool TextureAndPointBuffer::Load(const std::filesystem::path& path, QImage* qima
     texture->Load(path, GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   }
   
-  // Initialize the point buffer.
-  f->glGenBuffers(1, &pointBuffer);
-  f->glBindBuffer(GL_ARRAY_BUFFER, pointBuffer);
-  int elementSizeInBytes = 3 * sizeof(float);
-  f->glBufferData(GL_ARRAY_BUFFER, 1 * elementSizeInBytes, nullptr, GL_STREAM_DRAW);
-  
   return true;
 }
 
-void TextureAndPointBuffer::Unload() {
-  if (texture) {
-    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-    
-    f->glDeleteBuffers(1, &pointBuffer);
-    texture.reset();
-  }
-}
-
-
-TextDisplayAndPointBuffer::~TextDisplayAndPointBuffer() {
-  if (textDisplay) {
-    LOG(ERROR) << "TextDisplayAndPointBuffer object was destroyed without Destroy() being called first.";
-  }
-}
-
-void TextDisplayAndPointBuffer::Initialize() {
-  if (textDisplay) {
-    LOG(ERROR) << "Initialize() called on already initialized TextDisplayAndPointBuffer";
-    return;
-  }
-  
-  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-  
-  f->glGenBuffers(1, &pointBuffer);
-  f->glBindBuffer(GL_ARRAY_BUFFER, pointBuffer);
-  int elementSizeInBytes = 3 * sizeof(float);
-  f->glBufferData(GL_ARRAY_BUFFER, 1 * elementSizeInBytes, nullptr, GL_STREAM_DRAW);
-  
-  textDisplay.reset(new TextDisplay());
-}
-
-void TextDisplayAndPointBuffer::Destroy() {
-  if (textDisplay) {
-    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-    
-    f->glDeleteBuffers(1, &pointBuffer);
-    
-    textDisplay.reset();
-  }
-}
-
-
-PointBuffer::~PointBuffer() {
-  if (initialized) {
-    LOG(ERROR) << "PointBuffer object was destroyed without Destroy() being called first.";
-  }
-}
-
-void PointBuffer::Initialize() {
-  if (initialized) {
-    LOG(ERROR) << "Initialize() called on already initialized PointBuffer";
-    return;
-  }
-  
-  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-  
-  f->glGenBuffers(1, &buffer);
-  f->glBindBuffer(GL_ARRAY_BUFFER, buffer);
-  int elementSizeInBytes = 3 * sizeof(float);
-  f->glBufferData(GL_ARRAY_BUFFER, 1 * elementSizeInBytes, nullptr, GL_STREAM_DRAW);
-  
-  initialized = true;
-}
-
-void PointBuffer::Destroy() {
-  if (initialized) {
-    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-    
-    f->glDeleteBuffers(1, &buffer);
-    
-    initialized = false;
-  }
+void UITexture::Unload() {
+  texture.reset();
 }
 
 
 void Button::Load(const std::filesystem::path& defaultSubPath, const std::filesystem::path& hoverSubPath, const std::filesystem::path& activeSubPath, const std::filesystem::path& disabledSubPath) {
-  pointBuffer.Initialize();
-  
   defaultTexture.reset(new Texture());
-  QImage image(GetModdedPathAsQString(defaultSubPath));
+  QImage image = LoadModdedImage(defaultSubPath);
   opaquenessMap.Create(image);
   defaultTexture->Load(image, GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   
   hoverTexture.reset(new Texture());
-  hoverTexture->Load(QImage(GetModdedPathAsQString(hoverSubPath)), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  hoverTexture->Load(LoadModdedImage(hoverSubPath), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   
   activeTexture.reset(new Texture());
-  activeTexture->Load(QImage(GetModdedPathAsQString(activeSubPath)), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  activeTexture->Load(LoadModdedImage(activeSubPath), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   
   if (!disabledSubPath.empty()) {
     disabledTexture.reset(new Texture());
-    disabledTexture->Load(QImage(GetModdedPathAsQString(disabledSubPath)), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+    disabledTexture->Load(LoadModdedImage(disabledSubPath), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   }
 }
 
-void Button::Render(float x, float y, float width, float height, RenderWindow* renderWindow, QOpenGLFunctions_3_2_Core* f) {
+void Button::Render(float x, float y, float width, float height, UIRenderer* uiRenderer) {
   lastX = x;
   lastY = y;
   lastWidth = width;
   lastHeight = height;
   
   Texture* menuButtonTex = (state == 3) ? disabledTexture.get() : ((state == 2) ? activeTexture.get() : ((state == 1) ? hoverTexture.get() : defaultTexture.get()));
-  RenderUIGraphic(
+  uiRenderer->AddQuad(
       x,
       y,
       width,
       height,
-      qRgba(255, 255, 255, 255), pointBuffer.buffer,
       *menuButtonTex,
-      renderWindow->uiShader.get(), renderWindow->widgetWidth, renderWindow->widgetHeight, f);
+      qRgba(255, 255, 255, 255));
 }
 
 void Button::MouseMove(const QPoint& pos) {
@@ -223,7 +141,6 @@ bool Button::IsInButton(const QPoint& pos) {
 }
 
 void Button::Destroy() {
-  pointBuffer.Destroy();
   defaultTexture.reset();
   hoverTexture.reset();
   activeTexture.reset();
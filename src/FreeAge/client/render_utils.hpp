@@ -5,47 +5,27 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 
 #include "FreeAge/client/opaqueness_map.hpp"
 #include "FreeAge/client/opengl.hpp"
-#include "FreeAge/client/text_display.hpp"
 #include "FreeAge/client/texture.hpp"
 
-class RenderWindow;
+class UIRenderer;
 
-struct TextureAndPointBuffer {
-  ~TextureAndPointBuffer();
+/// A texture for a UI element.
+struct UITexture {
+  ~UITexture();
   
   bool Load(const std::filesystem::path& path, QImage* qimage = nullptr, TextureManager::Loader loader = TextureManager::Loader::QImage);
   void Unload();
   
-  GLuint pointBuffer;
   std::shared_ptr<Texture> texture;
 };
 
-struct TextDisplayAndPointBuffer {
-  ~TextDisplayAndPointBuffer();
-  
-  void Initialize();
-  void Destroy();
-  
-  GLuint pointBuffer;
-  std::shared_ptr<TextDisplay> textDisplay;
-};
-
-struct PointBuffer {
-  ~PointBuffer();
-  
-  void Initialize();
-  void Destroy();
-  
-  GLuint buffer;
-  bool initialized = false;
-};
-
 struct Button {
   void Load(const std::filesystem::path& defaultSubPath, const std::filesystem::path& hoverSubPath, const std::filesystem::path& activeSubPath, const std::filesystem::path& disabledSubPath);
-  void Render(float x, float y, float width, float height, RenderWindow* renderWindow, QOpenGLFunctions_3_2_Core* f);
+  void Render(float x, float y, float width, float height, UIRenderer* uiRenderer);
   void MouseMove(const QPoint& pos);
   void MousePress(const QPoint& pos);
   /// Returns true if the button was clicked.
@@ -54,7 +34,6 @@ struct Button {
   bool IsInButton(const QPoint& pos);
   void Destroy();
   
-  PointBuffer pointBuffer;
   OpaquenessMap opaquenessMap;
   std::shared_ptr<Texture> defaultTexture;
   std::shared_ptr<Texture> hoverTexture;
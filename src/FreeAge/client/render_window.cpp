@@ -4,6 +4,7 @@
 
 #include "FreeAge/client/render_window.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <math.h>
 
@@ -27,7 +28,6 @@
 #endif
 
 #include "FreeAge/client/game_controller.hpp"
-#include "FreeAge/client/health_bar.hpp"
 #include "FreeAge/common/logging.hpp"
 #include "FreeAge/client/mod_manager.hpp"
 #include "FreeAge/client/opengl.hpp"
@@ -108,8 +108,8 @@ RenderWindow::RenderWindow(
   connect(this, &RenderWindow::LoadingError, this, &RenderWindow::LoadingErrorHandler, Qt::QueuedConnection);
   
   // Set the default cursor
-  defaultCursor = QCursor(QPixmap::fromImage(QImage(
-      GetModdedPathAsQString(std::filesystem::path("widgetui") / "textures" / "ingame" / "cursor" / "default32x32.cur"))),
+  defaultCursor = QCursor(QPixmap::fromImage(
+      LoadModdedImage(std::filesystem::path("widgetui") / "textures" / "ingame" / "cursor" / "default32x32.cur")),
       0, 0);
   setCursor(defaultCursor);
   
@@ -142,71 +142,33 @@ RenderWindow::~RenderWindow() {
   makeCurrent();
   QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
   
-  // Initialize command buttons.
-  for (int row = 0; row < kCommandButtonRows; ++ row) {
-    for (int col = 0; col < kCommandButtonCols; ++ col) {
-      commandButtons[row][col].UnloadPointBuffers();
-    }
-  }
-  
   for (auto& item : bufferObjects) {
     f->glDeleteBuffers(1, &item.name);
   }
+  spriteVertexBuffer.Destroy();
   
   loadingIcon.Unload();
-  for (usize i = 0; i < playerNames.size(); ++ i) {
-    playerNames[i].Destroy();
-    playerNameShadowPointBuffers[i].Destroy();
-  }
   
   menuDialog.Unload();
-  menuTextDisplay.Destroy();
   menuButtonExit.Destroy();
-  menuButtonExitText.Destroy();
   menuButtonResign.Destroy();
-  menuButtonResignText.Destroy();
   menuButtonCancel.Destroy();
-  menuButtonCancelText.Destroy();
-  
-  gameEndTextDisplay.Destroy();
-  gameEndTextDisplayShadowPointBuffer.Destroy();
   
   menuPanel.Unload();
   menuButton.Destroy();
-  objectivesButtonPointBuffer.Destroy();
   objectivesButtonDisabledTexture.reset();
-  chatButtonPointBuffer.Destroy();
   chatButtonDisabledTexture.reset();
-  diplomacyButtonPointBuffer.Destroy();
   diplomacyButtonDisabledTexture.reset();
-  settingsButtonPointBuffer.Destroy();
   settingsButtonDisabledTexture.reset();
   
   resourcePanel.Unload();
   resourceWood.Unload();
-  woodTextDisplay.Destroy();
-  woodVillagersTextDisplay.Destroy();
   resourceFood.Unload();
-  foodTextDisplay.Destroy();
-  foodVillagersTextDisplay.Destroy();
   resourceGold.Unload();
-  goldTextDisplay.Destroy();
-  goldVillagersTextDisplay.Destroy();
   resourceStone.Unload();
-  stoneTextDisplay.Destroy();
-  stoneVillagersTextDisplay.Destroy();
   pop.Unload();
-  popTextDisplay.Destroy();
-  popVillagersTextDisplay.Destroy();
-  popWhiteBackgroundPointBuffer.Destroy();
   idleVillagerDisabled.Unload();
   currentAgeShield.Unload();
-  currentAgeTextDisplay.Destroy();
-  
-  gameTimeDisplay.Destroy();
-  gameTimeDisplayShadowPointBuffer.Destroy();
-  fpsAndPingDisplay.Destroy();
-  fpsAndPingDisplayShadowPointBuffer.Destroy();
   
   commandPanel.Unload();
   buildEconomyBuildings.Unload();
@@ -218,24 +180,16 @@ RenderWindow::~RenderWindow() {
   minimap.reset();
   
   selectionPanel.Unload();
-  singleObjectNameDisplay.Destroy();
-  hpDisplay.Destroy();
-  carriedResourcesDisplay.Destroy();
-  selectionPanelIconPointBuffer.Destroy();
-  selectionPanelIconOverlayPointBuffer.Destroy();
-  for (int i = 0; i < kMaxProductionQueueSize; ++ i) {
-    productionQueuePointBuffers[i].Destroy();
-    productionQueueOverlayPointBuffers[i].Destroy();
-  }
-  productionProgressText.Destroy();
   productionProgressBar.Unload();
-  productionProgressBarBackgroundPointBuffer.Destroy();
   
   iconOverlayNormalTexture.reset();
   iconOverlayNormalExpensiveTexture.reset();
   iconOverlayHoverTexture.reset();
   iconOverlayActiveTexture.reset();
   
+  textRenderer.Destroy();
+  uiRenderer.Destroy();
+  
   uiShader.reset();
   uiSingleColorShader.reset();
   uiSingleColorFullscreenShader.reset();
@@ -244,6 +198,7 @@ RenderWindow::~RenderWindow() {
   outlineShader.reset();
   healthBarShader.reset();
   minimapShader.reset();
+  textShader.reset();
   colorDilationShader.reset();
   
   if (map) {
@@ -264,6 +219,9 @@ RenderWindow::~RenderWindow() {
   playerColorsTexture.reset();
   moveToSprite.reset();
   
+  // The sprite textures would otherwise be deleted on program exit, without an OpenGL context.
+  SpriteAtlasManager::Instance().Shutdown();
+  
   doneCurrent();
 }
 
@@ -281,7 +239,7 @@ bool RenderWindow::LoadResources() {
   
   Timer loadResourcesTimer("LoadResources()");
   LOG(1) << "LoadResource() start";
-
+  
   const GLubyte* glVendor = f->glGetString(GL_VENDOR);
   if (glVendor) {
     LOG(1) << "GL_VENDOR: " << glVendor;
@@ -297,12 +255,12 @@ bool RenderWindow::LoadResources() {
   
   // Load cursors.
   std::filesystem::path cursorsSubPath = std::filesystem::path("widgetui") / "textures" / "ingame" / "cursor";
-  attackCursor = QCursor(QPixmap::fromImage(QImage(GetModdedPathAsQString(cursorsSubPath / "attack32x32.cur"))), 0, 0);
-  buildCursor = QCursor(QPixmap::fromImage(QImage(GetModdedPathAsQString(cursorsSubPath / "build32x32.cur"))), 0, 0);
-  chopCursor = QCursor(QPixmap::fromImage(QImage(GetModdedPathAsQString(cursorsSubPath / "chop32x32.cur"))), 0, 0);
-  gatherCursor = QCursor(QPixmap::fromImage(QImage(GetModdedPathAsQString(cursorsSubPath / "gather32x32.cur"))), 0, 0);
-  mineGoldCursor = QCursor(QPixmap::fromImage(QImage(GetModdedPathAsQString(cursorsSubPath / "mine_gold32x32.cur"))), 0, 0);
-  mineStoneCursor = QCursor(QPixmap::fromImage(QImage(GetModdedPathAsQString(cursorsSubPath / "mine_stone32x32.cur"))), 0, 0);
+  attackCursor = QCursor(QPixmap::fromImage(LoadModdedImage(cursorsSubPath / "attack32x32.cur")), 0, 0);
+  buildCursor = QCursor(QPixmap::fromImage(LoadModdedImage(cursorsSubPath / "build32x32.cur")), 0, 0);
+  chopCursor = QCursor(QPixmap::fromImage(LoadModdedImage(cursorsSubPath / "chop32x32.cur")), 0, 0);
+  gatherCursor = QCursor(QPixmap::fromImage(LoadModdedImage(cursorsSubPath / "gather32x32.cur")), 0, 0);
+  mineGoldCursor = QCursor(QPixmap::fromImage(LoadModdedImage(cursorsSubPath / "mine_gold32x32.cur")), 0, 0);
+  mineStoneCursor = QCursor(QPixmap::fromImage(LoadModdedImage(cursorsSubPath / "mine_stone32x32.cur")), 0, 0);
   didLoadingStep();
   
   LOG(1) << "LoadResource(): Cursors loaded";
@@ -311,24 +269,27 @@ bool RenderWindow::LoadResources() {
   colorDilationShader.reset(new ColorDilationShader());
   
   spriteShader.reset(new SpriteShader(false, false));
+  spriteShader->SetVertexBuffer(&spriteVertexBuffer);
   spriteShader->GetProgram()->UseProgram(f);
   f->glUniform1i(spriteShader->GetTextureLocation(), 0);  // use GL_TEXTURE0
   didLoadingStep();
   LOG(1) << "LoadResource(): SpriteShader(false, false) loaded";
   
   shadowShader.reset(new SpriteShader(true, false));
+  shadowShader->SetVertexBuffer(&spriteVertexBuffer);
   shadowShader->GetProgram()->UseProgram(f);
   f->glUniform1i(shadowShader->GetTextureLocation(), 0);  // use GL_TEXTURE0
   didLoadingStep();
   LOG(1) << "LoadResource(): SpriteShader(true, false) loaded";
   
   outlineShader.reset(new SpriteShader(false, true));
+  outlineShader->SetVertexBuffer(&spriteVertexBuffer);
   outlineShader->GetProgram()->UseProgram(f);
   f->glUniform1i(outlineShader->GetTextureLocation(), 0);  // use GL_TEXTURE0
   didLoadingStep();
   LOG(1) << "LoadResource(): SpriteShader(false, true) loaded";
   
-  healthBarShader.reset(new HealthBarShader());
+  healthBarShader.reset(new UIShader());
   
   didLoadingStep();
   LOG(1) << "LoadResource(): Shaders loaded";
@@ -342,34 +303,6 @@ bool RenderWindow::LoadResources() {
   f->glActiveTexture(GL_TEXTURE0);
   didLoadingStep();
   
-  // Initialize command buttons.
-  for (int row = 0; row < kCommandButtonRows; ++ row) {
-    for (int col = 0; col < kCommandButtonCols; ++ col) {
-      commandButtons[row][col].InitializePointBuffers();
-    }
-  }
-  
-  // Initialize text displays.
-  woodTextDisplay.Initialize();
-  foodTextDisplay.Initialize();
-  goldTextDisplay.Initialize();
-  stoneTextDisplay.Initialize();
-  woodVillagersTextDisplay.Initialize();
-  foodVillagersTextDisplay.Initialize();
-  goldVillagersTextDisplay.Initialize();
-  stoneVillagersTextDisplay.Initialize();
-  popTextDisplay.Initialize();
-  popVillagersTextDisplay.Initialize();
-  popWhiteBackgroundPointBuffer.Initialize();
-  currentAgeTextDisplay.Initialize();
-  gameTimeDisplay.Initialize();
-  gameTimeDisplayShadowPointBuffer.Initialize();
-  fpsAndPingDisplay.Initialize();
-  fpsAndPingDisplayShadowPointBuffer.Initialize();
-  singleObjectNameDisplay.Initialize();
-  hpDisplay.Initialize();
-  carriedResourcesDisplay.Initialize();
-  
   // Load unit resources.
   LOG(1) << "LoadResource(): Starting to load units";
   
@@ -409,11 +342,8 @@ bool RenderWindow::LoadResources() {
   LoadSpriteAndTexture(
       GetModdedPath(graphicsSubPath.parent_path().parent_path() / "particles" / "textures" / "test_move" / "p_all_move_%04i.png").string().c_str(),
       (cachePath / "p_all_move_0000.png").string().c_str(),
-      GL_CLAMP_TO_EDGE,
       colorDilationShader.get(),
-      &moveToSprite->sprite,
-      &moveToSprite->graphicTexture,
-      &moveToSprite->shadowTexture,
+      moveToSprite.get(),
       palettes);
   didLoadingStep();
   
@@ -435,32 +365,25 @@ bool RenderWindow::LoadResources() {
   //   0.286818,  0.285423
   
   menuDialog.Load(GetModdedPath(widgetuiTexturesSubPath / "ingame" / "panels" / "menu_bg.png"));
-  menuTextDisplay.Initialize();
   menuButtonExit.Load(
       menuButtonsSubPath / "button_wide_normal.png",
       menuButtonsSubPath / "button_wide_hover.png",
       menuButtonsSubPath / "button_wide_active.png",
       menuButtonsSubPath / "button_wide_disabled.png");
-  menuButtonExitText.Initialize();
   // TODO: Do not load these button textures multiple times!
   menuButtonResign.Load(
       menuButtonsSubPath / "button_wide_normal.png",
       menuButtonsSubPath / "button_wide_hover.png",
       menuButtonsSubPath / "button_wide_active.png",
       menuButtonsSubPath / "button_wide_disabled.png");
-  menuButtonResignText.Initialize();
   // TODO: Do not load these button textures multiple times!
   menuButtonCancel.Load(
       menuButtonsSubPath / "button_wide_normal.png",
       menuButtonsSubPath / "button_wide_hover.png",
       menuButtonsSubPath / "button_wide_active.png",
       menuButtonsSubPath / "button_wide_disabled.png");
-  menuButtonCancelText.Initialize();
   didLoadingStep();
   
-  gameEndTextDisplay.Initialize();
-  gameEndTextDisplayShadowPointBuffer.Initialize();
-  
   QImage menuPanelImage;
   menuPanel.Load(GetModdedPath(architecturePanelsSubPath / "menu-panel.png"), &menuPanelImage);
   menuPanelOpaquenessMap.Create(menuPanelImage);
@@ -473,21 +396,17 @@ bool RenderWindow::LoadResources() {
       "");
   didLoadingStep();
   
-  objectivesButtonPointBuffer.Initialize();
   objectivesButtonDisabledTexture.reset(new Texture());
-  objectivesButtonDisabledTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "menu_objectives_disabled.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  objectivesButtonDisabledTexture->Load(LoadModdedImage(ingameIconsSubPath / "menu_objectives_disabled.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   
-  chatButtonPointBuffer.Initialize();
   chatButtonDisabledTexture.reset(new Texture());
-  chatButtonDisabledTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "menu_chat_disabled.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  chatButtonDisabledTexture->Load(LoadModdedImage(ingameIconsSubPath / "menu_chat_disabled.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   
-  diplomacyButtonPointBuffer.Initialize();
   diplomacyButtonDisabledTexture.reset(new Texture());
-  diplomacyButtonDisabledTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "menu_diplomacy_disabled.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  diplomacyButtonDisabledTexture->Load(LoadModdedImage(ingameIconsSubPath / "menu_diplomacy_disabled.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   
-  settingsButtonPointBuffer.Initialize();
   settingsButtonDisabledTexture.reset(new Texture());
-  settingsButtonDisabledTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "menu_settings_disabled.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  settingsButtonDisabledTexture->Load(LoadModdedImage(ingameIconsSubPath / "menu_settings_disabled.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   didLoadingStep();
   
   QImage resourcePanelImage;
@@ -545,33 +464,27 @@ bool RenderWindow::LoadResources() {
   selectionPanelOpaquenessMap.Create(selectionPanelImage);
   didLoadingStep();
   
-  selectionPanelIconPointBuffer.Initialize();
-  selectionPanelIconOverlayPointBuffer.Initialize();
-  for (int i = 0; i < kMaxProductionQueueSize; ++ i) {
-    productionQueuePointBuffers[i].Initialize();
-    productionQueueOverlayPointBuffers[i].Initialize();
-  }
-  productionProgressText.Initialize();
   productionProgressBar.Load(GetModdedPath(widgetuiTexturesSubPath / "ingame" / "panels" / "loadingbar_full.png"));
-  productionProgressBarBackgroundPointBuffer.Initialize();
   
   iconOverlayNormalTexture.reset(new Texture());
-  iconOverlayNormalTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "icon_overlay_normal.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  iconOverlayNormalTexture->Load(LoadModdedImage(ingameIconsSubPath / "icon_overlay_normal.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   didLoadingStep();
   
   iconOverlayNormalExpensiveTexture.reset(new Texture());
-  iconOverlayNormalExpensiveTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "icon_overlay_normal_expensive.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  iconOverlayNormalExpensiveTexture->Load(LoadModdedImage(ingameIconsSubPath / "icon_overlay_normal_expensive.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   didLoadingStep();
   
   iconOverlayHoverTexture.reset(new Texture());
-  iconOverlayHoverTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "icon_overlay_hover.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  iconOverlayHoverTexture->Load(LoadModdedImage(ingameIconsSubPath / "icon_overlay_hover.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   didLoadingStep();
   
   iconOverlayActiveTexture.reset(new Texture());
-  iconOverlayActiveTexture->Load(QImage(GetModdedPathAsQString(ingameIconsSubPath / "icon_overlay_active.png")), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  iconOverlayActiveTexture->Load(LoadModdedImage(ingameIconsSubPath / "icon_overlay_active.png"), GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
   didLoadingStep();
   
-  loadResourcesTimer.Stop();
+  double loadResourcesSeconds = loadResourcesTimer.Stop();
+  LOG(INFO) << "Loaded resources in " << loadResourcesSeconds << " s ("
+            << (ModManager::Instance().HasAssetBundle() ? "using the asset bundle" : "without asset bundle") << ")";
   // Output timings of the resource loading processes and clear those statistics from further timing prints.
   LOG(INFO) << "Loading timings:";
   Timing::print(std::cout, kSortByTotal);
@@ -675,7 +588,7 @@ void RenderWindow::LoadingFinished() {
 #ifndef WIN32
   delete loadingSurface;
 #endif
-
+  
   if (loadingThread->Succeeded()) {
     // Notify the server about the loading being finished
     connection->Write(CreateLoadingFinishedMessage());
@@ -717,20 +630,20 @@ void RenderWindow::GrabMouse() {
       POINT ul;
       ul.x = windowRect.left;
       ul.y = windowRect.top;
-
+      
       POINT lr;
       lr.x = windowRect.right;
       lr.y = windowRect.bottom;
-
+      
       MapWindowPoints(reinterpret_cast<HWND>(winId()), nullptr, &ul, 1);
       MapWindowPoints(reinterpret_cast<HWND>(winId()), nullptr, &lr, 1);
-
+      
       windowRect.left = ul.x;
       windowRect.top = ul.y;
-
+      
       windowRect.right = lr.x;
       windowRect.bottom = lr.y;
-
+      
       ClipCursor(&windowRect);
     }
   #endif
@@ -832,6 +745,9 @@ void RenderWindow::ComputePixelToOpenGLMatrix(QOpenGLFunctions_3_2_Core* f) {
   
   minimapShader->GetProgram()->UseProgram(f);
   minimapShader->GetProgram()->SetUniformMatrix2fv(minimapShader->GetViewMatrixLocation(), pixelToOpenGLMatrix, true, f);
+  
+  textShader->GetProgram()->UseProgram(f);
+  textShader->GetProgram()->SetUniformMatrix2fv(textShader->GetViewMatrixLocation(), pixelToOpenGLMatrix, true, f);
 }
 
 void RenderWindow::UpdateViewMatrix() {
@@ -887,12 +803,15 @@ void RenderWindow::UpdateView(const TimePoint& now, QOpenGLFunctions_3_2_Core* f
     // TODO: Use a uniform buffer object for that.
     spriteShader->GetProgram()->UseProgram(f);
     spriteShader->GetProgram()->SetUniformMatrix2fv(spriteShader->GetViewMatrixLocation(), viewMatrix, true, f);
+    f->glUniform1f(spriteShader->GetWidgetHeightLocation(), widgetHeight);
     
     shadowShader->GetProgram()->UseProgram(f);
     shadowShader->GetProgram()->SetUniformMatrix2fv(shadowShader->GetViewMatrixLocation(), viewMatrix, true, f);
+    f->glUniform1f(shadowShader->GetWidgetHeightLocation(), widgetHeight);
     
     outlineShader->GetProgram()->UseProgram(f);
     outlineShader->GetProgram()->SetUniformMatrix2fv(outlineShader->GetViewMatrixLocation(), viewMatrix, true, f);
+    f->glUniform1f(outlineShader->GetWidgetHeightLocation(), widgetHeight);
     
     healthBarShader->GetProgram()->UseProgram(f);
     healthBarShader->GetProgram()->SetUniformMatrix2fv(healthBarShader->GetViewMatrixLocation(), viewMatrix, true, f);
@@ -994,7 +913,7 @@ void RenderWindow::RenderPath(float halfLineWidth, const QRgb& color, const std:
   uiSingleColorShader->GetProgram()->UseProgram(f);
   f->glUniform4f(uiSingleColorShader->GetColorLocation(), qRed(color) / 255.f, qGreen(color) / 255.f, qBlue(color) / 255.f, qAlpha(color) / 255.f);
   
-  void* data = f->glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  void* data = f->glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
   memcpy(data, vertexData.data(), bufferSize);
   f->glUnmapBuffer(GL_ARRAY_BUFFER);
   CHECK_OPENGL_NO_ERROR();
@@ -1013,115 +932,231 @@ void RenderWindow::RenderPath(float halfLineWidth, const QRgb& color, const std:
 void RenderWindow::RenderSprites(std::vector<Texture*>* textures, const std::shared_ptr<SpriteShader>& shader, QOpenGLFunctions_3_2_Core* f) {
   shader->GetProgram()->UseProgram(f);
   
+  // Make the vertices that were written since the last call available for rendering.
+  spriteVertexBuffer.Unmap();
+  f->glBindBuffer(GL_ARRAY_BUFFER, spriteVertexBuffer.GetBuffer());
+  
   for (Texture* texture : *textures) {
-    // Bind the texture
-    f->glBindTexture(GL_TEXTURE_2D, texture->GetId());
+    // Bind the texture. Since sprites share their textures (see SpriteAtlasManager),
+    // there is usually only a single texture to render with per pass.
+    f->glBindTexture(texture->GetTarget(), texture->GetId());
     f->glUniform2f(shader->GetTextureSizeLocation(), texture->GetWidth(), texture->GetHeight());
     
-    // Issue the render call
-    int vertexSize = shader->GetVertexSize();
-    if (texture->DrawCallBuffer().size() % vertexSize != 0) {
-      LOG(ERROR) << "Unexpected vertex data size in draw call buffer: " << texture->DrawCallBuffer().size() << " % " << vertexSize << " = " << (texture->DrawCallBuffer().size() % vertexSize) << " != 0";
-    } else {
-      usize bufferSize = texture->DrawCallBuffer().size();
-      PrepareBufferObject(bufferSize, f);
-      
-      void* data = f->glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
-      memcpy(data, texture->DrawCallBuffer().data(), bufferSize);
-      f->glUnmapBuffer(GL_ARRAY_BUFFER);
-      
-      shader->UseProgramAndSetAttribPointers(f);  // TODO: We only need to set up the vertex attributes again after changing the GL_ARRAY_BUFFER buffer; we would not need to "use" the program again
-      
-      f->glDrawArrays(GL_POINTS, 0, bufferSize / vertexSize);
+    // Issue the render calls. The vertices were written directly into the streaming vertex buffer by DrawSprite(),
+    // so we only need to point the vertex attributes to the start of each range.
+    for (const Texture::DrawCall& drawCall : texture->DrawCalls()) {
+      shader->UseProgramAndSetAttribPointers(drawCall.offset, f);
+      f->glDrawArrays(GL_POINTS, 0, drawCall.vertexCount);
     }
     
-    texture->DrawCallBuffer().clear();
+    texture->DrawCalls().clear();
   }
 }
 
-void RenderWindow::RenderShadows(double displayedServerTime, QOpenGLFunctions_3_2_Core* f) {
-  auto& unitTypes = ClientUnitType::GetUnitTypes();
+/// Returns the rectangle of the given sprite layer in projected coordinates, analogous
+/// to ClientUnit::GetRectInProjectedCoords() and ClientBuilding::GetRectInProjectedCoords().
+static QRectF GetLayerRectInProjectedCoords(const QPointF& centerProjectedCoord, const Sprite::Frame::Layer& layer, bool isGraphic) {
+  return QRectF(
+      centerProjectedCoord.x() - layer.centerX + (isGraphic ? 1 : 0),
+      centerProjectedCoord.y() - layer.centerY + (isGraphic ? 1 : 0),
+      layer.imageWidth + (isGraphic ? -2 : 0),
+      layer.imageHeight + (isGraphic ? -2 : 0));
+}
+
+void RenderWindow::PrepareVisibleObjects(double displayedServerTime, QOpenGLFunctions_3_2_Core* f) {
+  visibleObjects.clear();
+  objectsInViewBuffer.clear();
+  map->QueryObjects(projectedCoordsViewRect, &objectsInViewBuffer);
+  
+  std::vector<u32> sortedSelection = selection;
+  std::sort(sortedSelection.begin(), sortedSelection.end());
+  
+  // Compute the render data of the objects in parallel. This only reads the map, and each object
+  // is only modified by the task that prepares it (see ClientUnit::UpdateAnimationFrame()).
+  preparedObjects.resize(objectsInViewBuffer.size());
+  preparedObjectIsHidden.resize(objectsInViewBuffer.size());
+  ParallelForChunks(objectsInViewBuffer.size(), [&](int /*chunkIndex*/, usize begin, usize end) {
+    for (usize i = begin; i < end; ++ i) {
+      preparedObjectIsHidden[i] = !PrepareVisibleObject(objectsInViewBuffer[i], displayedServerTime, sortedSelection, &preparedObjects[i]);
+    }
+  });
   
-  std::vector<Texture*> textures;
-  textures.reserve(64);
+  // Update the static sprites (which are shared by all objects) and collect the visible objects.
+  for (usize i = 0; i < preparedObjects.size(); ++ i) {
+    const VisibleObject& item = preparedObjects[i];
+    
+    if (item.object->isBuilding()) {
+      if (preparedObjectIsHidden[i] || !item.isStatic) {
+        map->GetStaticSprites().RemoveObject(item.objectId);
+      } else {
+        // Objects that leave the view keep the vertices that were last written for them; since the
+        // static sprites are rendered as a whole, these vertices are simply clipped by the GPU.
+        UpdateStaticSprites(item);
+      }
+    }
+    
+    if (!preparedObjectIsHidden[i] &&
+        (item.graphicInView || item.outlineInView || item.shadowInView || item.isSelected)) {
+      visibleObjects.push_back(item);
+    }
+  }
   
-  float effectiveZoom = ComputeEffectiveZoom();
+  map->GetStaticSprites().Upload(f);
+}
+
+bool RenderWindow::PrepareVisibleObject(const SpatialIndex::Entry& object, double displayedServerTime, const std::vector<u32>& sortedSelection, VisibleObject* item) {
+  item->objectId = object.first;
+  item->object = object.second;
   
-  for (auto& object : map->GetObjects()) {
-    // TODO: Use virtual functions here to reduce duplicated code among buildings and units?
+  if (object.second->isBuilding()) {
+    ClientBuilding& building = *AsBuilding(object.second);
+    int maxViewCount = map->ComputeMaxViewCountForBuilding(&building);
+    if (maxViewCount < 0) {
+      return false;
+    }
+    item->intensity = (maxViewCount > 0) ? 255 : 168;
+    item->sprite = &building.GetSpriteAndTextures();
+    item->frameIndex = building.GetFrameIndex(displayedServerTime);
+    item->centerProjectedCoord = map->MapCoordToProjectedCoord(building.GetCenterMapCoord());
+    item->causesOutlines = ClientBuildingType::GetBuildingTypes()[static_cast<int>(building.GetType())].DoesCauseOutlines();
+    item->isStatic = building.HasStaticAppearance();
+  } else {  // if (object.second->isUnit()) {
+    ClientUnit& unit = *AsUnit(object.second);
+    if (map->IsUnitInFogOfWar(&unit)) {
+      return false;
+    }
+    item->intensity = 255;
+    item->frameIndex = unit.UpdateAnimationFrame(displayedServerTime);
+    item->sprite = &unit.GetCurrentSpriteAndTextures();
+    item->centerProjectedCoord = unit.GetCenterProjectedCoord(map.get());
+    item->causesOutlines = false;
+    item->isStatic = false;
+  }
+  
+  const Sprite& sprite = item->sprite->sprite;
+  const Sprite::Frame& frame = sprite.frame(item->frameIndex);
+  item->graphicRect = GetLayerRectInProjectedCoords(item->centerProjectedCoord, frame.graphic, /*isGraphic*/ true);
+  item->graphicInView = item->graphicRect.intersects(projectedCoordsViewRect);
+  item->outlineInView =
+      sprite.HasOutline() &&
+      GetLayerRectInProjectedCoords(item->centerProjectedCoord, frame.graphic, /*isGraphic*/ false).intersects(projectedCoordsViewRect);
+  item->shadowInView =
+      sprite.HasShadow() &&
+      GetLayerRectInProjectedCoords(item->centerProjectedCoord, frame.shadow, /*isGraphic*/ false).intersects(projectedCoordsViewRect);
+  item->isSelected = std::binary_search(sortedSelection.begin(), sortedSelection.end(), item->objectId);
+  return true;
+}
+
+void RenderWindow::UpdateStaticSprites(const VisibleObject& item) {
+  StaticSpriteBuffer& staticSprites = map->GetStaticSprites();
+  ClientBuilding& building = *AsBuilding(item.object);
+  QRgb modulationColor = building.GetModulationColor(qRgb(item.intensity, item.intensity, item.intensity));
+  
+  StaticSpriteBuffer::ObjectState state;
+  state.sprite = item.sprite;
+  state.frameIndex = item.frameIndex;
+  state.modulationColor = modulationColor;
+  state.centerProjectedX = item.centerProjectedCoord.x();
+  state.centerProjectedY = item.centerProjectedCoord.y();
+  if (!staticSprites.NeedsUpdate(item.objectId, state)) {
+    return;
+  }
+  
+  staticSprites.SetObject(item.objectId, state);
+  
+  SpriteAndTextures* sprites[ClientBuilding::kMaxSpritesToRender];
+  for (int shadow = 1; shadow >= 0; -- shadow) {
+    SpriteShader* shader = shadow ? shadowShader.get() : spriteShader.get();
+    StaticSpriteBuffer::Pass pass =
+        shadow ? StaticSpriteBuffer::Pass::Shadow :
+        (item.causesOutlines ? StaticSpriteBuffer::Pass::GraphicCausingOutlines : StaticSpriteBuffer::Pass::Graphic);
     
-    if (object.second->isBuilding()) {
-      ClientBuilding& building = *AsBuilding(object.second);
-      if (!building.GetSprite().HasShadow()) {
-        continue;
-      }
-      int maxViewCount = map->ComputeMaxViewCountForBuilding(&building);
-      if (maxViewCount < 0) {
-        continue;
-      }
-      
-      QRectF projectedCoordsRect = building.GetRectInProjectedCoords(
-          map.get(),
-          displayedServerTime,
-          true,
-          false);
-      if (projectedCoordsRect.intersects(projectedCoordsViewRect)) {
-        Texture* texture = &building.GetTexture(/*shadow*/ true);
-        if (texture->DrawCallBuffer().isEmpty()) {
-          textures.push_back(texture);
-        }
-        
-        building.Render(
-            map.get(),
-            qRgb(255, 255, 255),
-            shadowShader.get(),
-            viewMatrix,
-            effectiveZoom,
-            widgetWidth,
-            widgetHeight,
-            displayedServerTime,
-            true,
-            false);
-      }
-    } else {  // if (object.second->isUnit()) {
-      ClientUnit& unit = *AsUnit(object.second);
-      if (!unitTypes[static_cast<int>(unit.GetType())].GetAnimations(unit.GetCurrentAnimation()).front()->sprite.HasShadow()) {
-        continue;
-      }
-      if (map->IsUnitInFogOfWar(&unit)) {
-        continue;
-      }
-      
-      QRectF projectedCoordsRect = unit.GetRectInProjectedCoords(
-          map.get(),
-          displayedServerTime,
-          true,
-          false);
-      if (projectedCoordsRect.intersects(projectedCoordsViewRect)) {
-        Texture* texture = &unit.GetTexture(/*shadow*/ true);
-        if (texture->DrawCallBuffer().isEmpty()) {
-          textures.push_back(texture);
-        }
-        
-        unit.Render(
-            map.get(),
-            qRgb(255, 255, 255),
-            shadowShader.get(),
-            viewMatrix,
-            effectiveZoom,
-            widgetWidth,
-            widgetHeight,
-            displayedServerTime,
-            true,
-            false);
-      }
+    int numSprites = building.GetSpritesToRender(shadow, sprites);
+    for (int i = 0; i < numSprites; ++ i) {
+      Texture* texture = shadow ? &sprites[i]->shadowTexture() : &sprites[i]->graphicTexture();
+      u8* vertex = staticSprites.AddVertex(item.objectId, pass, texture, shader->GetVertexSize());
+      WriteSpriteVertex(
+          sprites[i]->sprite,
+          item.centerProjectedCoord,
+          item.frameIndex,
+          shadow,
+          /*outline*/ false,
+          shadow ? qRgb(255, 255, 255) : modulationColor,
+          building.GetPlayerIndex(),
+          1.f,
+          vertex);
     }
   }
+}
+
+void RenderWindow::RenderVisibleObject(const VisibleObject& item, QRgb outlineOrModulationColor, SpriteShader* shader, bool shadow, bool outline, SpriteVertexArena* arena) {
+  if (item.object->isBuilding()) {
+    AsBuilding(item.object)->Render(
+        item.centerProjectedCoord,
+        item.frameIndex,
+        outlineOrModulationColor,
+        shader,
+        shadow,
+        outline,
+        arena);
+  } else {
+    AsUnit(item.object)->Render(
+        item.centerProjectedCoord,
+        item.frameIndex,
+        outlineOrModulationColor,
+        shader,
+        shadow,
+        outline,
+        arena);
+  }
+}
+
+int RenderWindow::ParallelForChunks(usize count, const std::function<void(int, usize, usize)>& func) {
+  // Chunks should be large enough for the work to outweigh the cost of distributing it. Using a few chunks per
+  // thread balances the load if the objects differ in cost (e.g., since only some of them are in view).
+  constexpr usize kMinObjectsPerChunk = 128;
+  usize maxNumChunks = kMaxParallelChunksPerThread * workerPool.GetNumThreads();
+  int numChunks = std::max<usize>(1, std::min(maxNumChunks, count / kMinObjectsPerChunk));
+  
+  workerPool.ParallelFor(numChunks, [&](int chunkIndex) {
+    usize begin = (count * chunkIndex) / numChunks;
+    usize end = (count * (chunkIndex + 1)) / numChunks;
+    func(chunkIndex, begin, end);
+  });
+  return numChunks;
+}
+
+void RenderWindow::DrawVisibleObjects(const std::function<void(const VisibleObject&, SpriteVertexArena*)>& drawObject, std::vector<Texture*>* textures) {
+  spriteVertexArenas.resize(kMaxParallelChunksPerThread * workerPool.GetNumThreads());
+  
+  int numChunks = ParallelForChunks(visibleObjects.size(), [&](int chunkIndex, usize begin, usize end) {
+    SpriteVertexArena* arena = &spriteVertexArenas[chunkIndex];
+    arena->Clear();
+    for (usize i = begin; i < end; ++ i) {
+      drawObject(visibleObjects[i], arena);
+    }
+  });
+  
+  for (int chunkIndex = 0; chunkIndex < numChunks; ++ chunkIndex) {
+    spriteVertexArenas[chunkIndex].Commit(&spriteVertexBuffer, textures);
+  }
+}
+
+void RenderWindow::RenderShadows(QOpenGLFunctions_3_2_Core* f) {
+  std::vector<Texture*> textures;
+  textures.reserve(64);
+  
+  DrawVisibleObjects([&](const VisibleObject& item, SpriteVertexArena* arena) {
+    if (item.shadowInView && !item.isStatic) {
+      RenderVisibleObject(item, qRgb(255, 255, 255), shadowShader.get(), true, false, arena);
+    }
+  }, &textures);
   
   RenderSprites(&textures, shadowShader, f);
+  map->GetStaticSprites().Render(StaticSpriteBuffer::Pass::Shadow, shadowShader.get(), f);
 }
 
-void RenderWindow::RenderBuildings(double displayedServerTime, bool buildingsThatCauseOutlines, QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderBuildings(bool buildingsThatCauseOutlines, QOpenGLFunctions_3_2_Core* f) {
   spriteShader->GetProgram()->UseProgram(f);
   
   Timer preparationTimer("RenderBuildings() preparation");
@@ -1129,53 +1164,25 @@ void RenderWindow::RenderBuildings(double displayedServerTime, bool buildingsTha
   std::vector<Texture*> textures;
   textures.reserve(64);
   
-  float effectiveZoom = ComputeEffectiveZoom();
-  
-  for (auto& object : map->GetObjects()) {
-    if (!object.second->isBuilding()) {
-      continue;
-    }
-    ClientBuilding& building = *AsBuilding(object.second);
-    if (buildingsThatCauseOutlines != ClientBuildingType::GetBuildingTypes()[static_cast<int>(building.GetType())].DoesCauseOutlines()) {
-      continue;
-    }
-    
-    int maxViewCount = map->ComputeMaxViewCountForBuilding(&building);
-    if (maxViewCount < 0) {
-      continue;
+  DrawVisibleObjects([&](const VisibleObject& item, SpriteVertexArena* arena) {
+    if (!item.object->isBuilding() ||
+        !item.graphicInView ||
+        item.isStatic ||
+        buildingsThatCauseOutlines != item.causesOutlines) {
+      return;
     }
-    u8 intensity = (maxViewCount > 0) ? 255 : 168;
     
-    QRectF projectedCoordsRect = building.GetRectInProjectedCoords(
-        map.get(),
-        displayedServerTime,
-        false,
-        false);
-    if (projectedCoordsRect.intersects(projectedCoordsViewRect)) {
-      Texture* texture = &building.GetTexture(/*shadow*/ false);
-      if (texture->DrawCallBuffer().isEmpty()) {
-        textures.push_back(texture);
-      }
-      
-      // TODO: Multiple sprites may have nearly the same y-coordinate, as a result there can be flickering currently. Avoid this.
-      building.Render(
-          map.get(),
-          qRgb(intensity, intensity, intensity),
-          spriteShader.get(),
-          viewMatrix,
-          effectiveZoom,
-          widgetWidth,
-          widgetHeight,
-          displayedServerTime,
-          false,
-          false);
-    }
-  }
+    // TODO: Multiple sprites may have nearly the same y-coordinate, as a result there can be flickering currently. Avoid this.
+    RenderVisibleObject(item, qRgb(item.intensity, item.intensity, item.intensity), spriteShader.get(), false, false, arena);
+  }, &textures);
   
   preparationTimer.Stop();
   Timer drawCallTimer("RenderBuildings() drawing");
   
   RenderSprites(&textures, spriteShader, f);
+  map->GetStaticSprites().Render(
+      buildingsThatCauseOutlines ? StaticSpriteBuffer::Pass::GraphicCausingOutlines : StaticSpriteBuffer::Pass::Graphic,
+      spriteShader.get(), f);
   
   drawCallTimer.Stop();
 }
@@ -1186,8 +1193,6 @@ void RenderWindow::RenderBuildingFoundation(double displayedServerTime, QOpenGLF
   QPoint foundationBaseTile(-1, -1);
   bool canBePlacedHere = CanBuildingFoundationBePlacedHere(constructBuildingType, lastCursorPos, &foundationBaseTile);
   
-  float effectiveZoom = ComputeEffectiveZoom();
-  
   if (foundationBaseTile.x() >= 0 && foundationBaseTile.y() >= 0) {
     // Check whether any tile below the foundation is not in the black fog-of-war.
     // Only display the foundation in this case.
@@ -1213,10 +1218,6 @@ void RenderWindow::RenderBuildingFoundation(double displayedServerTime, QOpenGLF
           map.get(),
           modulationColor,
           spriteShader.get(),
-          viewMatrix,
-          effectiveZoom,
-          widgetWidth,
-          widgetHeight,
           displayedServerTime,
           false,
           false);
@@ -1299,152 +1300,58 @@ void RenderWindow::RenderSelectionGroundOutline(QRgb color, ClientObject* object
   }
 }
 
-void RenderWindow::RenderOutlines(double displayedServerTime, QOpenGLFunctions_3_2_Core* f) {
-  auto& unitTypes = ClientUnitType::GetUnitTypes();
-  
+void RenderWindow::RenderOutlines(QOpenGLFunctions_3_2_Core* f) {
   outlineShader->GetProgram()->UseProgram(f);
   
   std::vector<Texture*> textures;
   textures.reserve(64);
   
-  float effectiveZoom = ComputeEffectiveZoom();
+  bool isObjectFlashActive = IsObjectFlashActive();
   
-  for (auto& object : map->GetObjects()) {
-    // TODO: Use virtual functions here to reduce duplicated code among buildings and units?
+  DrawVisibleObjects([&](const VisibleObject& item, SpriteVertexArena* arena) {
+    if (!item.outlineInView) {
+      return;
+    }
     
     QRgb outlineColor;
-    if (object.second->GetPlayerIndex() == kGaiaPlayerIndex) {
+    if (item.object->GetPlayerIndex() == kGaiaPlayerIndex) {
       // Hard-code white as the outline color for "Gaia" objects
       outlineColor = qRgb(255, 255, 255);
     } else {
-      outlineColor = playerColors[object.second->GetPlayerIndex()];
+      outlineColor = playerColors[item.object->GetPlayerIndex()];
     }
     
-    if (object.first == flashingObjectId &&
-        IsObjectFlashActive()) {
+    if (item.objectId == flashingObjectId &&
+        isObjectFlashActive) {
       outlineColor = qRgb(255 - qRed(outlineColor),
                           255 - qGreen(outlineColor),
                           255 - qBlue(outlineColor));
     }
     
-    if (object.second->isBuilding()) {
-      ClientBuilding& building = *AsBuilding(object.second);
-      if (!building.GetSprite().HasOutline()) {
-        continue;
-      }
-      
-      int maxViewCount = map->ComputeMaxViewCountForBuilding(&building);
-      if (maxViewCount < 0) {
-        continue;
-      } else if (maxViewCount == 0) {
-        float intensity = 168 / 255.f;
-        outlineColor = qRgb(intensity * qRed(outlineColor),
-                            intensity * qGreen(outlineColor),
-                            intensity * qBlue(outlineColor));
-      }
-      
-      QRectF projectedCoordsRect = building.GetRectInProjectedCoords(
-          map.get(),
-          displayedServerTime,
-          false,
-          true);
-      if (projectedCoordsRect.intersects(projectedCoordsViewRect)) {
-        Texture* texture = &building.GetTexture(/*shadow*/ false);
-        if (texture->DrawCallBuffer().isEmpty()) {
-          textures.push_back(texture);
-        }
-        
-        building.Render(
-            map.get(),
-            outlineColor,
-            outlineShader.get(),
-            viewMatrix,
-            effectiveZoom,
-            widgetWidth,
-            widgetHeight,
-            displayedServerTime,
-            false,
-            true);
-      }
-    } else {  // if (object.second->isUnit()) {
-      ClientUnit& unit = *AsUnit(object.second);
-      if (!unitTypes[static_cast<int>(unit.GetType())].GetAnimations(unit.GetCurrentAnimation()).front()->sprite.HasOutline()) {
-        continue;
-      }
-      if (map->IsUnitInFogOfWar(&unit)) {
-        continue;
-      }
-      
-      QRectF projectedCoordsRect = unit.GetRectInProjectedCoords(
-          map.get(),
-          displayedServerTime,
-          false,
-          true);
-      if (projectedCoordsRect.intersects(projectedCoordsViewRect)) {
-        Texture* texture = &unit.GetTexture(/*shadow*/ false);
-        if (texture->DrawCallBuffer().isEmpty()) {
-          textures.push_back(texture);
-        }
-        
-        unit.Render(
-            map.get(),
-            outlineColor,
-            outlineShader.get(),
-            viewMatrix,
-            effectiveZoom,
-            widgetWidth,
-            widgetHeight,
-            displayedServerTime,
-            false,
-            true);
-      }
+    if (item.intensity < 255) {
+      float intensity = item.intensity / 255.f;
+      outlineColor = qRgb(intensity * qRed(outlineColor),
+                          intensity * qGreen(outlineColor),
+                          intensity * qBlue(outlineColor));
     }
-  }
+    
+    RenderVisibleObject(item, outlineColor, outlineShader.get(), false, true, arena);
+  }, &textures);
   
   RenderSprites(&textures, outlineShader, f);
 }
 
-void RenderWindow::RenderUnits(double displayedServerTime, QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderUnits(QOpenGLFunctions_3_2_Core* f) {
   spriteShader->GetProgram()->UseProgram(f);
   
   std::vector<Texture*> textures;
   textures.reserve(64);
   
-  float effectiveZoom = ComputeEffectiveZoom();
-  
-  for (auto& object : map->GetObjects()) {
-    if (!object.second->isUnit()) {
-      continue;
+  DrawVisibleObjects([&](const VisibleObject& item, SpriteVertexArena* arena) {
+    if (item.object->isUnit() && item.graphicInView) {
+      RenderVisibleObject(item, qRgb(255, 255, 255), spriteShader.get(), false, false, arena);
     }
-    ClientUnit& unit = *AsUnit(object.second);
-    if (map->IsUnitInFogOfWar(&unit)) {
-      continue;
-    }
-    
-    QRectF projectedCoordsRect = unit.GetRectInProjectedCoords(
-        map.get(),
-        displayedServerTime,
-        false,
-        false);
-    if (projectedCoordsRect.intersects(projectedCoordsViewRect)) {
-      Texture* texture = &unit.GetTexture(/*shadow*/ false);
-      if (texture->DrawCallBuffer().isEmpty()) {
-        textures.push_back(texture);
-      }
-      
-      unit.Render(
-          map.get(),
-          qRgb(255, 255, 255),
-          spriteShader.get(),
-          viewMatrix,
-          effectiveZoom,
-          widgetWidth,
-          widgetHeight,
-          displayedServerTime,
-          false,
-          false);
-    }
-  }
+  }, &textures);
   
   RenderSprites(&textures, spriteShader, f);
 }
@@ -1452,8 +1359,6 @@ void RenderWindow::RenderUnits(double displayedServerTime, QOpenGLFunctions_3_2_
 void RenderWindow::RenderMoveToMarker(const TimePoint& now, QOpenGLFunctions_3_2_Core* f) {
   spriteShader->GetProgram()->UseProgram(f);
   
-  float effectiveZoom = ComputeEffectiveZoom();
-  
   // Update move-to sprite.
   int moveToFrameIndex = -1;
   if (haveMoveTo) {
@@ -1470,13 +1375,9 @@ void RenderWindow::RenderMoveToMarker(const TimePoint& now, QOpenGLFunctions_3_2
     QPointF projectedCoord = map->MapCoordToProjectedCoord(moveToMapCoord);
     DrawSprite(
         moveToSprite->sprite,
-        moveToSprite->graphicTexture,
+        moveToSprite->graphicTexture(),
         spriteShader.get(),
         projectedCoord,
-        viewMatrix,
-        effectiveZoom,
-        widgetWidth,
-        widgetHeight,
         moveToFrameIndex,
         /*shadow*/ false,
         /*outline*/ false,
@@ -1485,24 +1386,32 @@ void RenderWindow::RenderMoveToMarker(const TimePoint& now, QOpenGLFunctions_3_2
         /*scaling*/ 0.5f);
     
     std::vector<Texture*> textures(1);
-    textures[0] = &moveToSprite->graphicTexture;
+    textures[0] = &moveToSprite->graphicTexture();
     RenderSprites(&textures, spriteShader, f);
   }
 }
 
-void RenderWindow::RenderHealthBars(double displayedServerTime, QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderHealthBars(QOpenGLFunctions_3_2_Core* f) {
   auto& buildingTypes = ClientBuildingType::GetBuildingTypes();
   auto& unitTypes = ClientUnitType::GetUnitTypes();
   QRgb gaiaColor = qRgb(255, 255, 255);
   
-  float effectiveZoom = ComputeEffectiveZoom();
+  // Adds the quads for a health bar. The bar consists of a black background and the part
+  // that is filled in the player color, with a black border of a third of its height at the bottom.
+  // The bars are sorted with the depth buffer by the y coordinate of their object's center.
+  auto addHealthBar = [&](const QRectF& barRect, float objectCenterProjectedCoordY, float fillAmount, QRgb color) {
+    constexpr float kOffScreenDepthBufferExtent = 1000;
+    float depth = 1.f - 2.f * (kOffScreenDepthBufferExtent + viewMatrix[0] * objectCenterProjectedCoordY + viewMatrix[2]) / (2.f * kOffScreenDepthBufferExtent + widgetHeight);
+    
+    uiRenderer.AddSolidQuad(barRect.x(), barRect.y(), barRect.width(), barRect.height(), qRgba(0, 0, 0, 255), depth);
+    uiRenderer.AddSolidQuad(barRect.x(), barRect.y(), fillAmount * barRect.width(), (2 / 3.f) * barRect.height(), color, depth);
+  };
   
-  for (u32 id : selection) {
-    auto it = map->GetObjects().find(id);
-    if (it == map->GetObjects().end()) {
+  for (const VisibleObject& item : visibleObjects) {
+    if (!item.isSelected) {
       continue;
     }
-    ClientObject* object = it->second;
+    ClientObject* object = item.object;
     
     // TODO: Use virtual functions here to reduce duplicated code among buildings and units?
     
@@ -1510,10 +1419,10 @@ void RenderWindow::RenderHealthBars(double displayedServerTime, QOpenGLFunctions
       ClientBuilding& building = *AsBuilding(object);
       const ClientBuildingType& buildingType = buildingTypes[static_cast<int>(building.GetType())];
       
-      QPointF centerProjectedCoord = map->MapCoordToProjectedCoord(building.GetCenterMapCoord());
+      const QPointF& centerProjectedCoord = item.centerProjectedCoord;
       QPointF healthBarCenter =
           centerProjectedCoord +
-          QPointF(0, -1 * buildingType.GetHealthBarHeightAboveCenter(building.GetFrameIndex(displayedServerTime)));
+          QPointF(0, -1 * buildingType.GetHealthBarHeightAboveCenter(item.frameIndex));
       
       constexpr float kHealthBarWidth = 60;  // TODO: Smaller bar for trees
       constexpr float kHealthBarHeight = 4;
@@ -1523,24 +1432,17 @@ void RenderWindow::RenderHealthBars(double displayedServerTime, QOpenGLFunctions
           kHealthBarWidth,
           kHealthBarHeight);
       if (barRect.intersects(projectedCoordsViewRect)) {
-        PrepareBufferObject(3 * sizeof(float), f);
-        RenderHealthBar(
+        addHealthBar(
             barRect,
             centerProjectedCoord.y(),
             building.GetHP() / (1.f * GetBuildingMaxHP(building.GetType())),
-            (building.GetPlayerIndex() == kGaiaPlayerIndex) ? gaiaColor : playerColors[building.GetPlayerIndex()],
-            healthBarShader.get(),
-            viewMatrix,
-            effectiveZoom,
-            widgetWidth,
-            widgetHeight,
-            f);
+            (building.GetPlayerIndex() == kGaiaPlayerIndex) ? gaiaColor : playerColors[building.GetPlayerIndex()]);
       }
     } else if (object->isUnit()) {
       ClientUnit& unit = *AsUnit(object);
       const ClientUnitType& unitType = unitTypes[static_cast<int>(unit.GetType())];
       
-      QPointF centerProjectedCoord = unit.GetCenterProjectedCoord(map.get());
+      const QPointF& centerProjectedCoord = item.centerProjectedCoord;
       QPointF healthBarCenter =
           centerProjectedCoord +
           QPointF(0, -1 * unitType.GetHealthBarHeightAboveCenter());
@@ -1553,21 +1455,16 @@ void RenderWindow::RenderHealthBars(double displayedServerTime, QOpenGLFunctions
           kHealthBarWidth,
           kHealthBarHeight);
       if (barRect.intersects(projectedCoordsViewRect)) {
-        PrepareBufferObject(3 * sizeof(float), f);
-        RenderHealthBar(
+        addHealthBar(
             barRect,
             centerProjectedCoord.y(),
             unit.GetHP() / (1.f * GetUnitMaxHP(unit.GetType())),
-            (unit.GetPlayerIndex() == kGaiaPlayerIndex) ? gaiaColor : playerColors[unit.GetPlayerIndex()],
-            healthBarShader.get(),
-            viewMatrix,
-            effectiveZoom,
-            widgetWidth,
-            widgetHeight,
-            f);
+            (unit.GetPlayerIndex() == kGaiaPlayerIndex) ? gaiaColor : playerColors[unit.GetPlayerIndex()]);
       }
     }
   }
+  
+  uiRenderer.Render(healthBarShader.get(), f);
 }
 
 void RenderWindow::RenderGroundDecals(QOpenGLFunctions_3_2_Core* f) {
@@ -1584,8 +1481,6 @@ void RenderWindow::RenderDecals(std::vector<Decal*>& decals, QOpenGLFunctions_3_
   std::vector<Texture*> textures;
   textures.reserve(64);
   
-  float effectiveZoom = ComputeEffectiveZoom();
-  
   for (auto& decal : decals) {
     int maxViewCount = -1;
     for (int y = decal->GetMinTileY(); y <= decal->GetMaxTileY(); ++ y) {
@@ -1609,14 +1504,10 @@ void RenderWindow::RenderDecals(std::vector<Decal*>& decals, QOpenGLFunctions_3_
       decal->Render(
           qRgb(255, 255, 255),
           spriteShader.get(),
-          viewMatrix,
-          effectiveZoom,
-          widgetWidth,
-          widgetHeight,
           false,
           false,
           &texture);
-      if (texture->DrawCallBuffer().size() == spriteShader->GetVertexSize()) {
+      if (std::find(textures.begin(), textures.end(), texture) == textures.end()) {
         textures.push_back(texture);
       }
     }
@@ -1631,9 +1522,11 @@ void RenderWindow::RenderOccludingDecalShadows(QOpenGLFunctions_3_2_Core* f) {
   std::vector<Texture*> textures;
   textures.reserve(64);
   
-  float effectiveZoom = ComputeEffectiveZoom();
-  
   for (auto& decal : occludingDecals) {
+    if (!decal->HasShadow()) {
+      continue;
+    }
+    
     int maxViewCount = -1;
     for (int y = decal->GetMinTileY(); y <= decal->GetMaxTileY(); ++ y) {
       for (int x = decal->GetMinTileX(); x <= decal->GetMaxTileX(); ++ x) {
@@ -1656,14 +1549,10 @@ void RenderWindow::RenderOccludingDecalShadows(QOpenGLFunctions_3_2_Core* f) {
       decal->Render(
           qRgb(255, 255, 255),
           shadowShader.get(),
-          viewMatrix,
-          effectiveZoom,
-          widgetWidth,
-          widgetHeight,
           true,
           false,
           &texture);
-      if (texture->DrawCallBuffer().size() == shadowShader->GetVertexSize()) {
+      if (std::find(textures.begin(), textures.end(), texture) == textures.end()) {
         textures.push_back(texture);
       }
     }
@@ -1678,8 +1567,6 @@ void RenderWindow::RenderOccludingDecalOutlines(QOpenGLFunctions_3_2_Core* f) {
   std::vector<Texture*> textures;
   textures.reserve(64);
   
-  float effectiveZoom = ComputeEffectiveZoom();
-  
   for (auto& decal : occludingDecals) {
     int maxViewCount = -1;
     for (int y = decal->GetMinTileY(); y <= decal->GetMaxTileY(); ++ y) {
@@ -1708,14 +1595,10 @@ void RenderWindow::RenderOccludingDecalOutlines(QOpenGLFunctions_3_2_Core* f) {
       decal->Render(
           outlineColor,
           outlineShader.get(),
-          viewMatrix,
-          effectiveZoom,
-          widgetWidth,
-          widgetHeight,
           false,
           true,
           &texture);
-      if (texture->DrawCallBuffer().size() == outlineShader->GetVertexSize()) {
+      if (std::find(textures.begin(), textures.end(), texture) == textures.end()) {
         textures.push_back(texture);
       }
     }
@@ -1725,15 +1608,20 @@ void RenderWindow::RenderOccludingDecalOutlines(QOpenGLFunctions_3_2_Core* f) {
 }
 
 void RenderWindow::RenderGameUI(double displayedServerTime, double secondsSinceLastFrame, QOpenGLFunctions_3_2_Core* f) {
-  RenderMenuPanel(f);
+  RenderMenuPanel();
   
-  RenderResourcePanel(f);
+  RenderResourcePanel();
   
-  RenderMinimap(secondsSinceLastFrame, f);
+  RenderMinimapPanel();
   
-  RenderSelectionPanel(f);
+  RenderSelectionPanel();
   
-  RenderCommandPanel(f);
+  RenderCommandPanel();
+  
+  // Draw the UI graphics that were added above. The minimap is drawn on top of its panel.
+  uiRenderer.Render(uiShader.get(), f);
+  
+  RenderMinimap(secondsSinceLastFrame, f);
   
   // Render the current game time
   double timeSinceGameStart = displayedServerTime - gameController->GetGameStartServerTimeSeconds();
@@ -1743,7 +1631,7 @@ void RenderWindow::RenderGameUI(double displayedServerTime, double secondsSinceL
   QString timeString = QObject::tr("%1:%2:%3").arg(hours, 2, 10, QChar('0')).arg(minutes, 2, 10, QChar('0')).arg(seconds, 2, 10, QChar('0'));
   
   for (int i = 0; i < 2; ++ i) {
-    gameTimeDisplay.textDisplay->Render(
+    gameTimeDisplay.Render(
       georgiaFontSmaller,
       (i == 0) ? qRgba(0, 0, 0, 255) : qRgba(255, 255, 255, 255),
       timeString,
@@ -1752,8 +1640,7 @@ void RenderWindow::RenderGameUI(double displayedServerTime, double secondsSinceL
             0,
             0),
       Qt::AlignTop | Qt::AlignLeft,
-      (i == 0) ? gameTimeDisplayShadowPointBuffer.buffer : gameTimeDisplay.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
   }
   
   // Render the current FPS and ping
@@ -1767,7 +1654,7 @@ void RenderWindow::RenderGameUI(double displayedServerTime, double secondsSinceL
   }
   
   for (int i = 0; i < 2; ++ i) {
-    fpsAndPingDisplay.textDisplay->Render(
+    fpsAndPingDisplay.Render(
       georgiaFontSmaller,
       (i == 0) ? qRgba(0, 0, 0, 255) : qRgba(255, 255, 255, 255),
       fpsAndPingString,
@@ -1776,8 +1663,7 @@ void RenderWindow::RenderGameUI(double displayedServerTime, double secondsSinceL
             0,
             0),
       Qt::AlignTop | Qt::AlignLeft,
-      (i == 0) ? fpsAndPingDisplayShadowPointBuffer.buffer : fpsAndPingDisplay.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
   }
   
   // Render the player names in the bottom-right
@@ -1789,34 +1675,39 @@ void RenderWindow::RenderGameUI(double displayedServerTime, double secondsSinceL
         (match->GetPlayers()[i].state == Match::PlayerState::Won);
     
     for (int shadow = 0; shadow < 2; ++ shadow) {
-      playerNames[i].textDisplay->Render(
+      playerNames[i].Render(
           isPlayingOrHasWon ? georgiaFontLarger : georgiaFontLargerStrikeOut,
           (shadow == 0) ? qRgba(0, 0, 0, 255) : playerColors[i],
           players[i].name,
           QRect(0, 0, widgetWidth - uiScale * 10 - ((shadow == 0) ? 0 : (uiScale * 2)), currentY - ((shadow == 0) ? 0 : (uiScale * 2))),
           Qt::AlignRight | Qt::AlignBottom,
-          (shadow == 0) ? playerNameShadowPointBuffers[i].buffer : playerNames[i].pointBuffer,
-          uiShader.get(), widgetWidth, widgetHeight, f);
+          &textRenderer);
     }
-    currentY = playerNames[i].textDisplay->GetBounds().y();
+    currentY = playerNames[i].GetBounds().y();
   }
   
+  // Draw all text of the game UI. This must be done before rendering the menu, which is on top of it.
+  textRenderer.Render(textShader.get(), f);
+  
   if (menuShown) {
-    RenderMenu(f);
+    RenderMenu();
+    uiRenderer.Render(uiShader.get(), f);
   } else if (match->GetThisPlayer().state != Match::PlayerState::Playing) {
     // Render the game end text display ("Victory!" or "Defeat!")
     for (int shadow = 0; shadow < 2; ++ shadow) {
       int offset = (shadow == 0) ? (uiScale * 8) : 0;
-      gameEndTextDisplay.textDisplay->Render(
+      gameEndTextDisplay.Render(
           georgiaFontHuge,
           (shadow == 0) ? qRgba(0, 0, 0, 255) : qRgba(255, 255, 255, 255),
           (match->GetThisPlayer().state == Match::PlayerState::Won) ? tr("Victory!") : tr("Defeat!"),
           QRect(offset, offset, widgetWidth, widgetHeight),
           Qt::AlignHCenter | Qt::AlignVCenter,
-          (shadow == 0) ? gameEndTextDisplayShadowPointBuffer.buffer : gameEndTextDisplay.pointBuffer,
-          uiShader.get(), widgetWidth, widgetHeight, f);
+          &textRenderer);
     }
   }
+  
+  // Draw the text of the menu or the game end text.
+  textRenderer.Render(textShader.get(), f);
 }
 
 QPointF RenderWindow::GetMenuPanelTopLeft() {
@@ -1825,97 +1716,90 @@ QPointF RenderWindow::GetMenuPanelTopLeft() {
       0);
 }
 
-void RenderWindow::RenderMenuPanel(QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderMenuPanel() {
   QPointF topLeft = GetMenuPanelTopLeft();
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x(),
       topLeft.y(),
       uiScale * menuPanel.texture->GetWidth(),
       uiScale * menuPanel.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), menuPanel.pointBuffer,
       *menuPanel.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
   constexpr int kButtonSize = 70;
   constexpr int kButtonLeftRightMargin = 22;
   constexpr int kNumButtons = 5;
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x() + uiScale * (270 + kButtonLeftRightMargin + (0 / (kNumButtons - 1.f)) * (454 - 2 * kButtonLeftRightMargin - kButtonSize)),
       topLeft.y() + uiScale * (23),
       uiScale * kButtonSize,
       uiScale * kButtonSize,
-      qRgba(255, 255, 255, 255), objectivesButtonPointBuffer.buffer,
       *objectivesButtonDisabledTexture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x() + uiScale * (270 + kButtonLeftRightMargin + (1 / (kNumButtons - 1.f)) * (454 - 2 * kButtonLeftRightMargin - kButtonSize)),
       topLeft.y() + uiScale * (23),
       uiScale * kButtonSize,
       uiScale * kButtonSize,
-      qRgba(255, 255, 255, 255), chatButtonPointBuffer.buffer,
       *chatButtonDisabledTexture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x() + uiScale * (270 + kButtonLeftRightMargin + (2 / (kNumButtons - 1.f)) * (454 - 2 * kButtonLeftRightMargin - kButtonSize)),
       topLeft.y() + uiScale * (23),
       uiScale * kButtonSize,
       uiScale * kButtonSize,
-      qRgba(255, 255, 255, 255), diplomacyButtonPointBuffer.buffer,
       *diplomacyButtonDisabledTexture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x() + uiScale * (270 + kButtonLeftRightMargin + (3 / (kNumButtons - 1.f)) * (454 - 2 * kButtonLeftRightMargin - kButtonSize)),
       topLeft.y() + uiScale * (23),
       uiScale * kButtonSize,
       uiScale * kButtonSize,
-      qRgba(255, 255, 255, 255), settingsButtonPointBuffer.buffer,
       *settingsButtonDisabledTexture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
   menuButton.Render(
       topLeft.x() + uiScale * (270 + kButtonLeftRightMargin + (4 / (kNumButtons - 1.f)) * (454 - 2 * kButtonLeftRightMargin - kButtonSize)),
       topLeft.y() + uiScale * (23),
       uiScale * kButtonSize,
       uiScale * kButtonSize,
-      this, f);
+      &uiRenderer);
 }
 
 QPointF RenderWindow::GetResourcePanelTopLeft() {
   return QPointF(0, 0);
 }
 
-void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderResourcePanel() {
   const ResourceAmount& resources = gameController->GetCurrentResourceAmount();
   
   QPointF topLeft = GetResourcePanelTopLeft();
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x(),
       topLeft.y(),
       uiScale * resourcePanel.texture->GetWidth(),
       uiScale * resourcePanel.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), resourcePanel.pointBuffer,
       *resourcePanel.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
-  auto renderSingleResource = [&](int index, TextureAndPointBuffer& resourceDisplay,
-      TextDisplayAndPointBuffer& resourceTextDisplay, TextDisplayAndPointBuffer& villagersTextDisplay,
+  auto renderSingleResource = [&](int index, UITexture& resourceDisplay,
+      TextDisplay& resourceTextDisplay, TextDisplay& villagersTextDisplay,
       int resourceCount, int villagerCount) {
     // Render one of the four resources
-    RenderUIGraphic(
+    uiRenderer.AddQuad(
         topLeft.x() + uiScale * (17 + index * 200),
         topLeft.y() + uiScale * 16,
         uiScale * 83,
         uiScale * 83,
-        qRgba(255, 255, 255, 255), resourceDisplay.pointBuffer,
         *resourceDisplay.texture,
-        uiShader.get(), widgetWidth, widgetHeight, f);
-    resourceTextDisplay.textDisplay->Render(
+        qRgba(255, 255, 255, 255));
+    resourceTextDisplay.Render(
         georgiaFontSmaller,
         qRgba(255, 255, 255, 255),
         QString::number(resourceCount),
@@ -1924,9 +1808,8 @@ void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
               uiScale * 82,
               uiScale * 83),
         Qt::AlignLeft | Qt::AlignVCenter,
-        resourceTextDisplay.pointBuffer,
-        uiShader.get(), widgetWidth, widgetHeight, f);
-    villagersTextDisplay.textDisplay->Render(
+        &textRenderer);
+    villagersTextDisplay.Render(
         georgiaFontTiny,
         qRgba(255, 255, 255, 255),
         QString::number(villagerCount),
@@ -1935,8 +1818,7 @@ void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
               uiScale * 79,
               uiScale * 83),
         Qt::AlignRight | Qt::AlignBottom,
-        villagersTextDisplay.pointBuffer,
-        uiShader.get(), widgetWidth, widgetHeight, f);
+        &textRenderer);
   };
   
   renderSingleResource(0, resourceWood, woodTextDisplay, woodVillagersTextDisplay, resources.wood(),
@@ -1948,14 +1830,13 @@ void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
   renderSingleResource(3, resourceStone, stoneTextDisplay, stoneVillagersTextDisplay, resources.stone(),
       gameController->GetUnitTypeCount(UnitType::MaleVillagerStoneMiner) + gameController->GetUnitTypeCount(UnitType::FemaleVillagerStoneMiner));
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x() + uiScale * (17 + 4 * 200),
       topLeft.y() + uiScale * 16,
       uiScale * 83,
       uiScale * 83,
-      qRgba(255, 255, 255, 255), pop.pointBuffer,
       *pop.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   bool populationBlinking = false;
   if (gameController->IsPlayerHoused()) {
     if (housedStartTime < 0) {
@@ -1967,43 +1848,17 @@ void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
       populationBlinking = true;
       
       // Draw a white background for the population display.
-      QRectF rect(
+      uiRenderer.AddSolidQuad(
           topLeft.x() + uiScale * (17 + 4 * 200 + 83 + 16),
           topLeft.y() + uiScale * 2*18,
           uiScale * 2*60,
-          uiScale * 2*22);
-      
-      f->glBindBuffer(GL_ARRAY_BUFFER, popWhiteBackgroundPointBuffer.buffer);
-      f->glBufferData(GL_ARRAY_BUFFER, 8 * sizeof(float), nullptr, GL_STREAM_DRAW);
-      
-      uiSingleColorShader->GetProgram()->UseProgram(f);
-      f->glUniform4f(uiSingleColorShader->GetColorLocation(), 1.f, 1.f, 1.f, 1.f);
-      
-      float* data = static_cast<float*>(f->glMapBufferRange(GL_ARRAY_BUFFER, 0, 8 * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
-      data[0] = rect.x();
-      data[1] = rect.y();
-      data[2] = rect.right();
-      data[3] = rect.y();
-      data[4] = rect.x();
-      data[5] = rect.bottom();
-      data[6] = rect.right();
-      data[7] = rect.bottom();
-      f->glUnmapBuffer(GL_ARRAY_BUFFER);
-      CHECK_OPENGL_NO_ERROR();
-      uiSingleColorShader->GetProgram()->SetPositionAttribute(
-          2,
-          GetGLType<float>::value,
-          2 * sizeof(float),
-          0,
-          f);
-      
-      f->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-      CHECK_OPENGL_NO_ERROR();
+          uiScale * 2*22,
+          qRgba(255, 255, 255, 255));
     }
   } else {
     housedStartTime = -1;
   }
-  popTextDisplay.textDisplay->Render(
+  popTextDisplay.Render(
       georgiaFontSmaller,
       populationBlinking ? qRgba(0, 0, 0, 255) : qRgba(255, 255, 255, 255),
       tr("%1 / %2").arg(gameController->GetPopulationCount()).arg(gameController->GetAvailablePopulationSpace()),
@@ -2012,9 +1867,8 @@ void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
             uiScale * 82,
             uiScale * 83),
       Qt::AlignLeft | Qt::AlignVCenter,
-      popTextDisplay.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
-  popVillagersTextDisplay.textDisplay->Render(
+      &textRenderer);
+  popVillagersTextDisplay.Render(
       georgiaFontTiny,
       qRgba(255, 255, 255, 255),
       QString::number(gameController->GetVillagerCount()),
@@ -2023,27 +1877,24 @@ void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
             uiScale * 79,
             uiScale * 83),
       Qt::AlignRight | Qt::AlignBottom,
-      popVillagersTextDisplay.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x() + uiScale * (17 + 4 * 200 + 234),
       topLeft.y() + uiScale * 24,
       uiScale * 2 * 34,
       uiScale * 2 * 34,
-      qRgba(255, 255, 255, 255), idleVillagerDisabled.pointBuffer,
       *idleVillagerDisabled.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
-  RenderUIGraphic(
+      qRgba(255, 255, 255, 255));
+  uiRenderer.AddQuad(
       topLeft.x() + uiScale * (17 + 4 * 200 + 234 + 154 - currentAgeShield.texture->GetWidth() / 2),
       topLeft.y() + uiScale * 0,
       uiScale * currentAgeShield.texture->GetWidth(),
       uiScale * currentAgeShield.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), currentAgeShield.pointBuffer,
       *currentAgeShield.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   float currentAgeTextLeft = topLeft.x() + uiScale * (17 + 4 * 200 + 234 + 154 + currentAgeShield.texture->GetWidth() / 2);
-  currentAgeTextDisplay.textDisplay->Render(
+  currentAgeTextDisplay.Render(
       georgiaFontLarger,
       qRgba(255, 255, 255, 255),
       tr("Dark Age"),
@@ -2052,8 +1903,7 @@ void RenderWindow::RenderResourcePanel(QOpenGLFunctions_3_2_Core* f) {
             uiScale * (1623 - 8) - currentAgeTextLeft,
             uiScale * 83),
       Qt::AlignHCenter | Qt::AlignVCenter,
-      currentAgeTextDisplay.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
 }
 
 QPointF RenderWindow::GetMinimapPanelTopLeft() {
@@ -2062,17 +1912,20 @@ QPointF RenderWindow::GetMinimapPanelTopLeft() {
       widgetHeight - uiScale * minimapPanel.texture->GetHeight());
 }
 
-void RenderWindow::RenderMinimap(double secondsSinceLastFrame, QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderMinimapPanel() {
   QPointF topLeft = GetMinimapPanelTopLeft();
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x(),
       topLeft.y(),
       uiScale * minimapPanel.texture->GetWidth(),
       uiScale * minimapPanel.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), minimapPanel.pointBuffer,
       *minimapPanel.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
+}
+
+void RenderWindow::RenderMinimap(double secondsSinceLastFrame, QOpenGLFunctions_3_2_Core* f) {
+  QPointF topLeft = GetMinimapPanelTopLeft();
   
   // Update the minimap?
   timeSinceLastMinimapUpdate += secondsSinceLastFrame;
@@ -2212,50 +2065,45 @@ QPointF RenderWindow::GetSelectionPanelTopLeft() {
       widgetHeight - uiScale * selectionPanel.texture->GetHeight());
 }
 
-void RenderWindow::RenderObjectIcon(const Texture* iconTexture, float x, float y, float size, int state, GLuint iconPointBuffer, GLuint overlayPointBuffer, QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderObjectIcon(const Texture* iconTexture, float x, float y, float size, int state) {
   float iconInset = uiScale * 4;
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       x + iconInset,
       y + iconInset,
       size - (size / (uiScale * 2 * 60.f)) * 2 * iconInset,
       size - (size / (uiScale * 2 * 60.f)) * 2 * iconInset,
-      qRgba(255, 255, 255, 255),
-      iconPointBuffer,
       *iconTexture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
-  RenderUIGraphic(
+      qRgba(255, 255, 255, 255));
+  uiRenderer.AddQuad(
       x,
       y,
       size,
       size,
-      qRgba(255, 255, 255, 255),
-      overlayPointBuffer,
       (state == 2) ? *iconOverlayActiveTexture : ((state == 1) ? *iconOverlayHoverTexture : *iconOverlayNormalTexture),
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
 }
 
-void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderSelectionPanel() {
   QPointF topLeft = GetSelectionPanelTopLeft();
   
   for (int i = 0; i < kMaxProductionQueueSize; ++ i) {
     productionQueueIconsSize[i] = -1;
   }
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x(),
       topLeft.y(),
       uiScale * selectionPanel.texture->GetWidth(),
       uiScale * selectionPanel.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), selectionPanel.pointBuffer,
       *selectionPanel.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
   // Is only a single object selected?
   if (selection.size() == 1) {
     ClientObject* singleSelectedObject = map->GetObjects().at(selection.front());
     
     // Display the object name
-    singleObjectNameDisplay.textDisplay->Render(
+    singleObjectNameDisplay.Render(
         georgiaFontLarger,
         qRgba(58, 29, 21, 255),
         singleSelectedObject->GetObjectName(),
@@ -2264,8 +2112,7 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
               uiScale * 2*172,
               uiScale * 2*16),
         Qt::AlignLeft | Qt::AlignTop,
-        singleObjectNameDisplay.pointBuffer,
-        uiShader.get(), widgetWidth, widgetHeight, f);
+        &textRenderer);
     
     // Display the object's HP
     if (singleSelectedObject->GetHP() > 0) {
@@ -2277,7 +2124,7 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
         maxHP = GetBuildingMaxHP(AsBuilding(singleSelectedObject)->GetType());
       }
       
-      hpDisplay.textDisplay->Render(
+      hpDisplay.Render(
           georgiaFontSmaller,
           qRgba(58, 29, 21, 255),
           QStringLiteral("%1 / %2").arg(singleSelectedObject->GetHP()).arg(maxHP),
@@ -2286,8 +2133,7 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
                 uiScale * 2*172,
                 uiScale * 2*16),
           Qt::AlignLeft | Qt::AlignTop,
-          hpDisplay.pointBuffer,
-          uiShader.get(), widgetWidth, widgetHeight, f);
+          &textRenderer);
     }
     
     // Display unit / building details?
@@ -2297,7 +2143,7 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
       if (IsVillager(singleSelectedUnit->GetType())) {
         // Display the villager's carried resources?
         if (singleSelectedUnit->GetCarriedResourceAmount() > 0) {
-          carriedResourcesDisplay.textDisplay->Render(
+          carriedResourcesDisplay.Render(
               georgiaFontSmaller,
               qRgba(58, 29, 21, 255),
               QObject::tr("Carries %1 %2")
@@ -2308,8 +2154,7 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
                     uiScale * 2*172,
                     uiScale * 2*16),
               Qt::AlignLeft | Qt::AlignTop,
-              carriedResourcesDisplay.pointBuffer,
-              uiShader.get(), widgetWidth, widgetHeight, f);
+              &textRenderer);
         }
       }
     } else if (singleSelectedObject->isBuilding()) {
@@ -2336,16 +2181,13 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
               productionQueueIconsTopLeft[0].x(),
               productionQueueIconsTopLeft[0].y(),
               productionQueueIconsSize[0],
-              (pressedProductionQueueItem == 0) ? 2 : state,
-              productionQueuePointBuffers[0].buffer,
-              productionQueueOverlayPointBuffers[0].buffer,
-              f);
+              (pressedProductionQueueItem == 0) ? 2 : state);
         }
         
         // Render progress text
         float floatProgress = singleSelectedBuilding->GetProductionProgress(lastDisplayedServerTime);
         int progress = static_cast<int>(floatProgress + 0.5f);
-        productionProgressText.textDisplay->Render(
+        productionProgressText.Render(
               georgiaFontLarger,
               qRgba(58, 29, 21, 255),
               QObject::tr("Creating (%1%)").arg(progress),
@@ -2354,30 +2196,35 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
                     uiScale * 2*200,
                     uiScale * 2*35),
               Qt::AlignLeft | Qt::AlignVCenter,
-              productionProgressText.pointBuffer,
-              uiShader.get(), widgetWidth, widgetHeight, f);
+              &textRenderer);
         
-        // Render progress bar
+        // Render progress bar. The filled part is drawn by clipping the full bar.
         int progressBarMaxWidth = uiScale * 2 * 140;
-        RenderUIGraphic(
+        QRectF progressBarRect(
             topLeft.x() + uiScale * (2*32 + 2*155),
             topLeft.y() + uiScale * (50 + 2*46 + 2*35 + 2*2),
             progressBarMaxWidth,
-            uiScale * 2*10,
-            qRgba(20, 20, 20, 255),
-            productionProgressBarBackgroundPointBuffer.buffer,
+            uiScale * 2*10);
+        uiRenderer.AddQuad(
+            progressBarRect.x(),
+            progressBarRect.y(),
+            progressBarRect.width(),
+            progressBarRect.height(),
             *productionProgressBar.texture,
-            uiShader.get(), widgetWidth, widgetHeight, f);
-        RenderUIGraphic(
-            topLeft.x() + uiScale * (2*32 + 2*155),
-            topLeft.y() + uiScale * (50 + 2*46 + 2*35 + 2*2),
+            qRgba(20, 20, 20, 255));
+        uiRenderer.SetClipRect(QRectF(
+            progressBarRect.x(),
+            progressBarRect.y(),
             floatProgress / 100.f * progressBarMaxWidth,
-            uiScale * 2*10,
-            qRgba(255, 255, 255, 255),
-            productionProgressBar.pointBuffer,
+            progressBarRect.height()));
+        uiRenderer.AddQuad(
+            progressBarRect.x(),
+            progressBarRect.y(),
+            progressBarRect.width(),
+            progressBarRect.height(),
             *productionProgressBar.texture,
-            uiShader.get(), widgetWidth, widgetHeight, f,
-            floatProgress / 100.f, 1.f);
+            qRgba(255, 255, 255, 255));
+        uiRenderer.ResetClipRect();
       }
       
       // Render the units that are queued behind the currently produced one.
@@ -2401,10 +2248,7 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
               productionQueueIconsTopLeft[queueIndex].x(),
               productionQueueIconsTopLeft[queueIndex].y(),
               productionQueueIconsSize[queueIndex],
-              (pressedProductionQueueItem == static_cast<int>(queueIndex)) ? 2 : state,
-              productionQueuePointBuffers[queueIndex].buffer,
-              productionQueueOverlayPointBuffers[queueIndex].buffer,
-              f);
+              (pressedProductionQueueItem == static_cast<int>(queueIndex)) ? 2 : state);
         }
       }
     }
@@ -2417,10 +2261,7 @@ void RenderWindow::RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f) {
           topLeft.x() + uiScale * (2*32),
           topLeft.y() + uiScale * (50 + 2*46),
           uiScale * 2*60,
-          0,
-          selectionPanelIconPointBuffer.buffer,
-          selectionPanelIconOverlayPointBuffer.buffer,
-          f);
+          0);
     }
   }
 }
@@ -2431,17 +2272,16 @@ QPointF RenderWindow::GetCommandPanelTopLeft() {
       widgetHeight - uiScale * commandPanel.texture->GetHeight());
 }
 
-void RenderWindow::RenderCommandPanel(QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderCommandPanel() {
   QPointF topLeft = GetCommandPanelTopLeft();
   
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x(),
       topLeft.y(),
       uiScale * commandPanel.texture->GetWidth(),
       uiScale * commandPanel.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), commandPanel.pointBuffer,
       *commandPanel.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
   
   float commandButtonsLeft = topLeft.x() + uiScale * 49;
   float commandButtonsTop = topLeft.y() + uiScale * 93;
@@ -2458,7 +2298,7 @@ void RenderWindow::RenderCommandPanel(QOpenGLFunctions_3_2_Core* f) {
       if (commandButtons[row][col].GetType() == CommandButton::Type::Invisible) {
         continue; // skip invisible buttons
       }
-
+      
       bool pressed =
           pressedCommandButtonRow == row &&
           pressedCommandButtonCol == col;
@@ -2485,12 +2325,12 @@ void RenderWindow::RenderCommandPanel(QOpenGLFunctions_3_2_Core* f) {
           disabled ? *iconOverlayNormalExpensiveTexture :
               (pressed || active ? *iconOverlayActiveTexture :
                   (mouseOver ? *iconOverlayHoverTexture : *iconOverlayNormalTexture)),
-          uiShader.get(), widgetWidth, widgetHeight, f);
+          &uiRenderer);
     }
   }
 }
 
-void RenderWindow::RenderMenu(QOpenGLFunctions_3_2_Core* f) {
+void RenderWindow::RenderMenu() {
   // Update the enabled state of the resign button
   menuButtonResign.SetEnabled(match->GetThisPlayer().state == Match::PlayerState::Playing);
   
@@ -2500,15 +2340,14 @@ void RenderWindow::RenderMenu(QOpenGLFunctions_3_2_Core* f) {
       0.5f * widgetHeight - uiScale * 0.5f * menuDialog.texture->GetHeight());
   
   // Dialog background and "Menu" text in its title bar
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       topLeft.x(),
       topLeft.y(),
       uiScale * menuDialog.texture->GetWidth(),
       uiScale * menuDialog.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), menuDialog.pointBuffer,
       *menuDialog.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
-  menuTextDisplay.textDisplay->Render(
+      qRgba(255, 255, 255, 255));
+  menuTextDisplay.Render(
       georgiaFontLarger,
       qRgba(54, 18, 18, 255),
       QObject::tr("Menu"),
@@ -2517,8 +2356,7 @@ void RenderWindow::RenderMenu(QOpenGLFunctions_3_2_Core* f) {
             uiScale * (655 - 228),
             uiScale * (164 - 101)),
       Qt::AlignHCenter | Qt::AlignVCenter,
-      menuTextDisplay.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
   
   // Exit button
   QRect menuButtonExitRect(
@@ -2529,15 +2367,14 @@ void RenderWindow::RenderMenu(QOpenGLFunctions_3_2_Core* f) {
   menuButtonExit.Render(
       menuButtonExitRect.x(), menuButtonExitRect.y(),
       menuButtonExitRect.width(), menuButtonExitRect.height(),
-      this, f);
-  menuButtonExitText.textDisplay->Render(
+      &uiRenderer);
+  menuButtonExitText.Render(
       georgiaFontLarger,
       qRgba(252, 201, 172, 255),
       QObject::tr("Exit"),
       menuButtonExitRect,
       Qt::AlignHCenter | Qt::AlignVCenter,
-      menuButtonExitText.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
   
   // Resign button
   QRect menuButtonResignRect(
@@ -2548,15 +2385,14 @@ void RenderWindow::RenderMenu(QOpenGLFunctions_3_2_Core* f) {
   menuButtonResign.Render(
       menuButtonResignRect.x(), menuButtonResignRect.y(),
       menuButtonResignRect.width(), menuButtonResignRect.height(),
-      this, f);
-  menuButtonResignText.textDisplay->Render(
+      &uiRenderer);
+  menuButtonResignText.Render(
       georgiaFontLarger,
       qRgba(252, 201, 172, 255),
       QObject::tr("Resign"),
       menuButtonResignRect,
       Qt::AlignHCenter | Qt::AlignVCenter,
-      menuButtonResignText.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
   
   // Cancel button
   QRect menuButtonCancelRect(
@@ -2567,15 +2403,14 @@ void RenderWindow::RenderMenu(QOpenGLFunctions_3_2_Core* f) {
   menuButtonCancel.Render(
       menuButtonCancelRect.x(), menuButtonCancelRect.y(),
       menuButtonCancelRect.width(), menuButtonCancelRect.height(),
-      this, f);
-  menuButtonCancelText.textDisplay->Render(
+      &uiRenderer);
+  menuButtonCancelText.Render(
       georgiaFontLarger,
       qRgba(252, 201, 172, 255),
       QObject::tr("Cancel"),
       menuButtonCancelRect,
       Qt::AlignHCenter | Qt::AlignVCenter,
-      menuButtonCancelText.pointBuffer,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      &textRenderer);
 }
 
 bool RenderWindow::IsUIAt(int x, int y) {
@@ -2667,7 +2502,15 @@ bool RenderWindow::GetObjectToSelectAt(float x, float y, u32* objectId, std::vec
     return area * std::min<float>(1.f, offsetLength / (0.5f * std::max(rect.width(), rect.height())));
   };
   
-  for (auto& object : map->GetObjects()) {
+  // Only consider the objects close to the given position. The units' rects get enlarged by up to
+  // kExtendSize below, so the query rect must be enlarged by (at least) the same amount.
+  constexpr float kQueryExtendSize = 8;
+  std::vector<SpatialIndex::Entry> objectsNearPosition;
+  map->QueryObjects(
+      QRectF(projectedCoord.x() - kQueryExtendSize, projectedCoord.y() - kQueryExtendSize, 2 * kQueryExtendSize, 2 * kQueryExtendSize),
+      &objectsNearPosition);
+  
+  for (auto& object : objectsNearPosition) {
     // TODO: Use virtual functions here to reduce duplicated code among buildings and units?
     bool addToList = false;
     QRectF projectedCoordsRect;
@@ -2784,7 +2627,9 @@ void RenderWindow::BoxSelection(const QPoint& p0, const QPoint& p1) {
   std::vector<std::pair<u32, ClientObject*>> objects;
   bool haveOwnObject = false;
   
-  for (auto& object : map->GetObjects()) {
+  std::vector<SpatialIndex::Entry> objectsInSelectionRect;
+  map->QueryObjects(selectionRect, &objectsInSelectionRect);
+  for (auto& object : objectsInSelectionRect) {
     if (object.second->isUnit()) {
       ClientUnit& unit = *AsUnit(object.second);
       
@@ -2902,7 +2747,7 @@ void RenderWindow::RenderLoadingScreen(QOpenGLFunctions_3_2_Core* f) {
     
     QRgb shadowColor = ((qRed(playerColors[i]) + qGreen(playerColors[i]) + qBlue(playerColors[i])) / 3.f > 127) ? qRgb(0, 0, 0) : qRgb(255, 255, 255);
     for (int shadow = 0; shadow < 2; ++ shadow) {
-      playerNames[i].textDisplay->Render(
+      playerNames[i].Render(
           georgiaFont,
           (shadow == 0) ? shadowColor : playerColors[i],
           text,
@@ -2911,20 +2756,20 @@ void RenderWindow::RenderLoadingScreen(QOpenGLFunctions_3_2_Core* f) {
                 widgetWidth,
                 lineHeight),
           Qt::AlignHCenter | Qt::AlignVCenter,
-          (shadow == 0) ? playerNameShadowPointBuffers[i].buffer : playerNames[i].pointBuffer,
-          uiShader.get(), widgetWidth, widgetHeight, f);
+          &textRenderer);
     }
   }
+  textRenderer.Render(textShader.get(), f);
   
   // Render the loading icon.
-  RenderUIGraphic(
+  uiRenderer.AddQuad(
       widgetWidth / 2 - loadingIcon.texture->GetWidth() / 2,
       0.5f * widgetHeight - 0.5f * totalHeight - loadingIcon.texture->GetHeight(),
       loadingIcon.texture->GetWidth(),
       loadingIcon.texture->GetHeight(),
-      qRgba(255, 255, 255, 255), loadingIcon.pointBuffer,
       *loadingIcon.texture,
-      uiShader.get(), widgetWidth, widgetHeight, f);
+      qRgba(255, 255, 255, 255));
+  uiRenderer.Render(uiShader.get(), f);
   
   // Blend towards black before the game start.
   if (gameController->GetGameStartServerTimeSeconds() - connection->GetServerTimeToDisplayNow() < gameStartBlendToBlackTime) {
@@ -2950,7 +2795,9 @@ void RenderWindow::UpdateGameState(double displayedServerTime) {
   for (const auto& item : map->GetObjects()) {
     if (item.second->isUnit()) {
       ClientUnit* unit = AsUnit(item.second);
-      unit->UpdateGameState(displayedServerTime, map.get(), match.get());
+      if (unit->UpdateGameState(displayedServerTime, map.get(), match.get())) {
+        map->ObjectMoved(item.first, unit);
+      }
     } else if (item.second->isBuilding()) {
       // TODO: Is this needed?
       // ClientBuilding* building = AsBuilding(item.second);
@@ -3081,7 +2928,7 @@ QPointF projectedCoord = ScreenCoordToProjectedCoord(cursorPos.x(), cursorPos.y(
 }
 
 void RenderWindow::PressCommandButton(CommandButton* button, bool shift) {
-
+  
   CommandButton::State state = button->GetState(gameController.get());
   if (state != CommandButton::State::Valid) {
     
@@ -3101,13 +2948,13 @@ void RenderWindow::PressCommandButton(CommandButton* button, bool shift) {
   
   // "Action" buttons are handled here.
   if (button->GetType() == CommandButton::Type::Action) {
-
+    
     if (constructBuildingType != BuildingType::NumBuildings) {
       // exit construction mode
       activeCommandButton = nullptr;
       constructBuildingType = BuildingType::NumBuildings;
     }
-
+    
     switch (button->GetActionType()) {
     case CommandButton::ActionType::BuildEconomyBuilding:
       ShowEconomyBuildingCommandButtons();
@@ -3130,7 +2977,7 @@ void RenderWindow::PressCommandButton(CommandButton* button, bool shift) {
 }
 
 void RenderWindow::ReportNonValidCommandButton(CommandButton* button, CommandButton::State state) {
-
+  
   if (state == CommandButton::State::CannotAfford) {
     QString name;
     ResourceAmount cost;
@@ -3143,7 +2990,7 @@ void RenderWindow::ReportNonValidCommandButton(CommandButton* button, CommandBut
     } else {
       assert(false); // TODO: implement all CommandButton::Type which can have State::CannotAfford
     }
-
+    
     // TODO: move from the log to the gui message system
     LOG(INFO) << name.toStdString() << " is not affordable, missing: ";
     // TODO: extract to function 
@@ -3161,7 +3008,7 @@ void RenderWindow::ReportNonValidCommandButton(CommandButton* button, CommandBut
     } else {
       assert(false); // TODO: implement all CommandButton::Type which can have State::MaxLimitReached
     }
-
+    
     // TODO: move from the log to the gui message system
     LOG(INFO) << "Max limit reached for " << name.toStdString();
   }
@@ -3245,7 +3092,7 @@ void RenderWindow::ShowEconomyBuildingCommandButtons() {
   commandButtons[0][2].SetBuilding(BuildingType::MiningCamp, Qt::Key_E);
   commandButtons[0][3].SetBuilding(BuildingType::LumberCamp, Qt::Key_R);
   commandButtons[0][4].SetBuilding(BuildingType::Dock, Qt::Key_T);
-
+  
   commandButtons[2][0].SetBuilding(BuildingType::TownCenter, Qt::Key_Z);
   
   commandButtons[2][3].SetAction(CommandButton::ActionType::ToggleBuildingsCategory, toggleBuildingsCategory.texture.get());
@@ -3419,6 +3266,10 @@ void RenderWindow::initializeGL() {
   f->glBindVertexArray(vao);
   CHECK_OPENGL_NO_ERROR();
   
+  // Create the buffer for streaming the sprite vertices.
+  constexpr usize kInitialSpriteVertexBufferSize = 2 * 1024 * 1024;
+  spriteVertexBuffer.Initialize(kInitialSpriteVertexBufferSize, f);
+  
   // Create a second OpenGL context that shares names with the rendering context.
   // This can then be used to load resources in the background.
   QOpenGLContext* loadingContext = new QOpenGLContext();
@@ -3460,17 +3311,13 @@ void RenderWindow::initializeGL() {
   uiSingleColorShader.reset(new UISingleColorShader());
   uiSingleColorFullscreenShader.reset(new UISingleColorFullscreenShader());
   minimapShader.reset(new MinimapShader());
+  textShader.reset(new TextShader());
   
   // Load the loading icon.
   loadingIcon.Load(GetModdedPath(graphicsSubPath.parent_path().parent_path() / "wpfg" / "resources" / "campaign" / "campaign_icon_2swords.png"));
   
   // Create the loading text display.
   playerNames.resize(match->GetPlayers().size());
-  playerNameShadowPointBuffers.resize(playerNames.size());
-  for (usize i = 0; i < playerNames.size(); ++ i) {
-    playerNames[i].Initialize();
-    playerNameShadowPointBuffers[i].Initialize();
-  }
   
   // Remember the render start time.
   renderStartTime = Clock::now();
@@ -3488,19 +3335,9 @@ void RenderWindow::paintGL() {
     // Timing::reset();
   }
   
-  // Wait for the previous frame to finish rendering.
-  // This allows us to map OpenGL buffer objects while disabling synchronization, avoiding CPU stalls due to impclicit synchronization.
-  // This should also prevent the GPU driver from queuing up multiple future frames. On the one hand this reduces rendering lag,
-  // on the other hand, it reduces the robustness against individual frames taking a long time to render.
-  if (haveSyncObject) {
-    GLenum result = f->glClientWaitSync(syncObject, 0, std::numeric_limits<GLuint64>::max());
-    if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED) {
-      LOG(ERROR) << "glClientWaitSync() failed; result code: " << result;
-    }
-    
-    f->glDeleteSync(syncObject);
-    haveSyncObject = false;
-  }
+  // Start writing the sprite vertices for this frame. This only waits for the GPU if it is
+  // more than StreamingVertexBuffer::kNumFramesInFlight - 1 frames behind.
+  spriteVertexBuffer.BeginFrame();
   
   // Render loading screen?
   if (isLoading) {
@@ -3636,12 +3473,21 @@ void RenderWindow::paintGL() {
   }
   
   gameStateUpdateTimer.Stop();
-  Timer initialStatesAndClearTimer("paintGL() - initial state setting & clear");
+  Timer viewUpdateTimer("paintGL() - view update");
   
   // Update scrolling and compute the view transformation.
   UpdateView(now, f);
   CHECK_OPENGL_NO_ERROR();
   
+  viewUpdateTimer.Stop();
+  Timer visibleObjectsTimer("paintGL() - visible objects preparation");
+  
+  // Determine the visible objects and their render data once for all render passes.
+  PrepareVisibleObjects(displayedServerTime, f);
+  
+  visibleObjectsTimer.Stop();
+  Timer initialStatesAndClearTimer("paintGL() - initial state setting & clear");
+  
   // Set states for rendering.
   f->glDisable(GL_CULL_FACE);
   
@@ -3661,7 +3507,7 @@ void RenderWindow::paintGL() {
   f->glBlendEquationSeparate(GL_FUNC_ADD, GL_MAX);
   
   CHECK_OPENGL_NO_ERROR();
-  RenderShadows(displayedServerTime, f);
+  RenderShadows(f);
   RenderOccludingDecalShadows(f);
   CHECK_OPENGL_NO_ERROR();
   
@@ -3675,7 +3521,7 @@ void RenderWindow::paintGL() {
   f->glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);  // reset to default
   
   CHECK_OPENGL_NO_ERROR();
-  map->Render(viewMatrix, graphicsSubPath, f);
+  map->Render(viewMatrix, projectedCoordsViewRect, graphicsSubPath, f);
   mapTimer.Stop();
   
   Timer groundDecalTimer("paintGL() - ground decal rendering");
@@ -3708,7 +3554,7 @@ void RenderWindow::paintGL() {
   
   // Render buildings that cause outlines.
   CHECK_OPENGL_NO_ERROR();
-  RenderBuildings(displayedServerTime, true, f);
+  RenderBuildings(true, f);
   CHECK_OPENGL_NO_ERROR();
   
   // Render the building foundation under the cursor.
@@ -3729,7 +3575,7 @@ void RenderWindow::paintGL() {
   f->glDepthFunc(GL_GREATER);
   
   CHECK_OPENGL_NO_ERROR();
-  RenderOutlines(displayedServerTime, f);
+  RenderOutlines(f);
   RenderOccludingDecalOutlines(f);
   CHECK_OPENGL_NO_ERROR();
   
@@ -3741,8 +3587,8 @@ void RenderWindow::paintGL() {
   f->glDepthFunc(GL_LEQUAL);
   
   CHECK_OPENGL_NO_ERROR();
-  RenderBuildings(displayedServerTime, false, f);
-  RenderUnits(displayedServerTime, f);
+  RenderBuildings(false, f);
+  RenderUnits(f);
   RenderOccludingDecals(f);
   CHECK_OPENGL_NO_ERROR();
   
@@ -3761,7 +3607,7 @@ void RenderWindow::paintGL() {
   f->glDisable(GL_BLEND);
   
   CHECK_OPENGL_NO_ERROR();
-  RenderHealthBars(displayedServerTime, f);
+  RenderHealthBars(f);
   CHECK_OPENGL_NO_ERROR();
   
   healthBarsTimer.Stop();
@@ -3815,8 +3661,7 @@ void RenderWindow::paintGL() {
   f->glClear(GL_COLOR_BUFFER_BIT);
   f->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
   
-  syncObject = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-  haveSyncObject = true;
+  spriteVertexBuffer.EndFrame();
   
   nextBufferObject = 0;
 }
@@ -3895,7 +3740,7 @@ void RenderWindow::mousePressEvent(QMouseEvent* event) {
       CommandButton::State state = activeCommandButton->GetState(gameController.get());
       if (state != CommandButton::State::Valid) {
         ReportNonValidCommandButton(activeCommandButton, state);
-      
+        
         if (state == CommandButton::State::CannotAfford) {
           // remain in construction mode, player may want to wait until the construction is affordable
         } else {
@@ -3905,7 +3750,7 @@ void RenderWindow::mousePressEvent(QMouseEvent* event) {
         }
         return;
       }
-
+      
       QPoint foundationBaseTile;
       bool canBePlacedHere = CanBuildingFoundationBePlacedHere(constructBuildingType, lastCursorPos, &foundationBaseTile);
       if (canBePlacedHere) {
@@ -3943,7 +3788,7 @@ void RenderWindow::mousePressEvent(QMouseEvent* event) {
     dragging = false;
   } else if (event->button() == Qt::RightButton &&
              !isUIClick) {
-
+    
     if (constructBuildingType != BuildingType::NumBuildings) {
       // exit construction mode
       activeCommandButton = nullptr;
@@ -3951,7 +3796,7 @@ void RenderWindow::mousePressEvent(QMouseEvent* event) {
       // return in order to not process the right click as a unit command
       return;
     }
-
+    
     QPointF projectedCoord = ScreenCoordToProjectedCoord(event->x(), event->y());
     QPointF mapCoord;
     bool haveMapCoord = map->ProjectedCoordToMapCoord(projectedCoord, &mapCoord);
@@ -4183,7 +4028,7 @@ void RenderWindow::mouseReleaseEvent(QMouseEvent* event) {
     if (pressedCommandButtonRow >= 0 &&
         pressedCommandButtonCol >= 0 &&
         match->IsPlayerStillInGame()) {
-
+      
       bool shift = event->modifiers() & Qt::ShiftModifier;
       PressCommandButton(&commandButtons[pressedCommandButtonRow][pressedCommandButtonCol], shift);
       
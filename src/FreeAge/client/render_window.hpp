@@ -5,12 +5,14 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
 #include <memory>
 
 #include <QOffscreenSurface>
 #include <QOpenGLWindow>
 
 #include "FreeAge/common/free_age.hpp"
+#include "FreeAge/common/worker_pool.hpp"
 #include "FreeAge/client/command_button.hpp"
 #include "FreeAge/client/decal.hpp"
 #include "FreeAge/client/map.hpp"
@@ -18,25 +20,65 @@
 #include "FreeAge/client/minimap.hpp"
 #include "FreeAge/client/opaqueness_map.hpp"
 #include "FreeAge/client/render_utils.hpp"
-#include "FreeAge/client/shader_health_bar.hpp"
 #include "FreeAge/client/shader_sprite.hpp"
 #include "FreeAge/client/shader_ui.hpp"
 #include "FreeAge/client/shader_ui_single_color.hpp"
 #include "FreeAge/client/shader_ui_single_color_fullscreen.hpp"
 #include "FreeAge/client/server_connection.hpp"
 #include "FreeAge/client/sprite.hpp"
+#include "FreeAge/client/sprite_vertex_arena.hpp"
+#include "FreeAge/client/streaming_vertex_buffer.hpp"
 #include "FreeAge/client/text_display.hpp"
 #include "FreeAge/client/texture.hpp"
+#include "FreeAge/client/ui_renderer.hpp"
 #include "FreeAge/client/unit.hpp"
 
 class GameController;
 class LoadingThread;
 
+/// Render data of an object that is (at least partly) within the view and not hidden
+/// by the fog of war. These are computed once per frame by RenderWindow::PrepareVisibleObjects()
+/// and used by all render passes for objects, such that these do not need to re-derive the
+/// visibility, fog-of-war state, animation frame, and screen rects for each pass.
+struct VisibleObject {
+  u32 objectId;
+  ClientObject* object;
+  
+  /// The object's current sprite.
+  SpriteAndTextures* sprite;
+  
+  /// The frame index within the sprite.
+  int frameIndex;
+  
+  /// The projected coordinates of the sprite center.
+  QPointF centerProjectedCoord;
+  
+  /// The sprite rectangle of the graphic layer in projected coordinates.
+  QRectF graphicRect;
+  
+  /// 255 if the object is currently in view, smaller for buildings in the explored but not visible area.
+  u8 intensity;
+  
+  /// Whether the shadow / graphic / outline layer intersects the view.
+  bool shadowInView;
+  bool graphicInView;
+  bool outlineInView;
+  
+  /// For buildings, whether the building type causes outlines (see ClientBuildingType::DoesCauseOutlines()).
+  bool causesOutlines;
+  
+  /// Whether the object's shadow and graphic are rendered from the map's StaticSpriteBuffer
+  /// instead of being streamed in each frame (see ClientBuilding::HasStaticAppearance()).
+  bool isStatic;
+  
+  bool isSelected;
+};
+
 class RenderWindow : public QOpenGLWindow {
  Q_OBJECT
  public:
  friend struct Button;
- 
+  
   RenderWindow(
       const std::shared_ptr<Match>& match,
       const std::shared_ptr<GameController>& gameController,
@@ -68,14 +110,14 @@ class RenderWindow : public QOpenGLWindow {
   inline void EnableBorderScrolling(bool enable) { borderScrollingEnabled = enable; }
   
   void AddDecal(Decal* decal);
-
+  
   void GrabMouse();
   void UngrabMouse();
-  
+ 
  signals:
   void LoadingProgressUpdated(int progress);
   void LoadingError(QString message);
-  
+ 
  private slots:
   void SendLoadingProgress(int progress);
   void LoadingErrorHandler(QString message);
@@ -89,7 +131,8 @@ class RenderWindow : public QOpenGLWindow {
   void CreatePlayerColorPaletteTexture();
   
   /// Helper to prepare a buffer in the GL_ARRAY_BUFFER target with *at least* the given size in bytes,
-  /// which has not been used before in rendering the current frame (meaning that it can be mapped without synchronization).
+  /// which has not been used before in rendering the current frame. Since previous frames may still be using
+  /// the buffer, map it with GL_MAP_INVALIDATE_BUFFER_BIT to avoid waiting for them.
   ///
   /// IMPORTANT: The returned buffer may be larger than requested, and it must not be shrunk!
   /// Otherwise, PrepareBufferObject() will assume that the buffer is larger than it actually is,
@@ -108,15 +151,41 @@ class RenderWindow : public QOpenGLWindow {
   void RenderPath(float halfLineWidth, const QRgb& color, const std::vector<QPointF>& vertices, const QPointF& offset, bool closed, QOpenGLFunctions_3_2_Core* f);
   
   void RenderSprites(std::vector<Texture*>* textures, const std::shared_ptr<SpriteShader>& shader, QOpenGLFunctions_3_2_Core* f);
-  void RenderShadows(double displayedServerTime, QOpenGLFunctions_3_2_Core* f);
-  void RenderBuildings(double displayedServerTime, bool buildingsThatCauseOutlines, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Determines the objects that are visible in the current view and computes their render data,
+  /// which is then used by the render passes below. Must be called once per frame after
+  /// UpdateGameState() and UpdateView().
+  void PrepareVisibleObjects(double displayedServerTime, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Computes the render data of a single object for PrepareVisibleObjects(). Returns false if the
+  /// object is hidden by the fog of war. May be called from worker threads for different objects.
+  bool PrepareVisibleObject(const SpatialIndex::Entry& object, double displayedServerTime, const std::vector<u32>& sortedSelection, VisibleObject* item);
+  
+  void UpdateStaticSprites(const VisibleObject& item);
+  void RenderVisibleObject(const VisibleObject& item, QRgb outlineOrModulationColor, SpriteShader* shader, bool shadow, bool outline, SpriteVertexArena* arena = nullptr);
+  
+  static constexpr int kMaxParallelChunksPerThread = 4;
+  
+  /// Partitions the range [0, count) into consecutive chunks and calls func(chunkIndex, begin, end)
+  /// for each chunk, using the worker pool. Returns the number of chunks, which is at most
+  /// kMaxParallelChunksPerThread times the number of threads.
+  int ParallelForChunks(usize count, const std::function<void(int, usize, usize)>& func);
+  
+  /// Calls drawObject() for all visible objects in parallel, with each chunk of objects writing its sprite
+  /// vertices into its own SpriteVertexArena. The arenas are then committed in the order of the chunks, such
+  /// that the resulting draw order is the same as for drawing the objects serially. The textures that were
+  /// used are added to @p textures, which can then be passed to RenderSprites().
+  void DrawVisibleObjects(const std::function<void(const VisibleObject&, SpriteVertexArena*)>& drawObject, std::vector<Texture*>* textures);
+  
+  void RenderShadows(QOpenGLFunctions_3_2_Core* f);
+  void RenderBuildings(bool buildingsThatCauseOutlines, QOpenGLFunctions_3_2_Core* f);
   void RenderBuildingFoundation(double displayedServerTime, QOpenGLFunctions_3_2_Core* f);
   void RenderSelectionGroundOutlines(QOpenGLFunctions_3_2_Core* f);
   void RenderSelectionGroundOutline(QRgb color, ClientObject* object, QOpenGLFunctions_3_2_Core* f);
-  void RenderOutlines(double displayedServerTime, QOpenGLFunctions_3_2_Core* f);
-  void RenderUnits(double displayedServerTime, QOpenGLFunctions_3_2_Core* f);
+  void RenderOutlines(QOpenGLFunctions_3_2_Core* f);
+  void RenderUnits(QOpenGLFunctions_3_2_Core* f);
   void RenderMoveToMarker(const TimePoint& now, QOpenGLFunctions_3_2_Core* f);
-  void RenderHealthBars(double displayedServerTime, QOpenGLFunctions_3_2_Core* f);
+  void RenderHealthBars(QOpenGLFunctions_3_2_Core* f);
   void RenderGroundDecals(QOpenGLFunctions_3_2_Core* f);
   void RenderOccludingDecals(QOpenGLFunctions_3_2_Core* f);
   void RenderDecals(std::vector<Decal*>& decals, QOpenGLFunctions_3_2_Core* f);
@@ -126,17 +195,18 @@ class RenderWindow : public QOpenGLWindow {
   
   void RenderGameUI(double displayedServerTime, double secondsSinceLastFrame, QOpenGLFunctions_3_2_Core* f);
   QPointF GetMenuPanelTopLeft();
-  void RenderMenuPanel(QOpenGLFunctions_3_2_Core* f);
+  void RenderMenuPanel();
   QPointF GetResourcePanelTopLeft();
-  void RenderResourcePanel(QOpenGLFunctions_3_2_Core* f);
+  void RenderResourcePanel();
   QPointF GetMinimapPanelTopLeft();
+  void RenderMinimapPanel();
   void RenderMinimap(double secondsSinceLastFrame, QOpenGLFunctions_3_2_Core* f);
   QPointF GetSelectionPanelTopLeft();
-  void RenderObjectIcon(const Texture* iconTexture, float x, float y, float size, int state, GLuint iconPointBuffer, GLuint overlayPointBuffer, QOpenGLFunctions_3_2_Core* f);
-  void RenderSelectionPanel(QOpenGLFunctions_3_2_Core* f);
+  void RenderObjectIcon(const Texture* iconTexture, float x, float y, float size, int state);
+  void RenderSelectionPanel();
   QPointF GetCommandPanelTopLeft();
-  void RenderCommandPanel(QOpenGLFunctions_3_2_Core* f);
-  void RenderMenu(QOpenGLFunctions_3_2_Core* f);
+  void RenderCommandPanel();
+  void RenderMenu();
   bool IsUIAt(int x, int y);
   
   void ShowMenu(bool show);
@@ -300,6 +370,28 @@ class RenderWindow : public QOpenGLWindow {
   float viewMatrix[4];  // column-major
   QRectF projectedCoordsViewRect;
   
+  /// The objects that are visible in the current frame, see PrepareVisibleObjects().
+  std::vector<VisibleObject> visibleObjects;
+  
+  /// Buffer for the spatial index query in PrepareVisibleObjects(), kept to avoid re-allocations.
+  std::vector<SpatialIndex::Entry> objectsInViewBuffer;
+  
+  /// Buffers for the results of PrepareVisibleObject() for all entries of objectsInViewBuffer.
+  std::vector<VisibleObject> preparedObjects;
+  std::vector<u8> preparedObjectIsHidden;
+  
+  /// Threads for preparing the per-frame render data (see ParallelForChunks()).
+  WorkerPool workerPool;
+  
+  /// One arena per chunk for DrawVisibleObjects().
+  std::vector<SpriteVertexArena> spriteVertexArenas;
+  
+  /// Batched renderer for all UI text (see TextDisplay).
+  TextRenderer textRenderer;
+  
+  /// Batched renderer for the UI graphics and the health bars.
+  UIRenderer uiRenderer;
+  
   // Shaders.
   std::shared_ptr<ColorDilationShader> colorDilationShader;
   std::shared_ptr<UIShader> uiShader;
@@ -308,8 +400,10 @@ class RenderWindow : public QOpenGLWindow {
   std::shared_ptr<SpriteShader> spriteShader;
   std::shared_ptr<SpriteShader> shadowShader;
   std::shared_ptr<SpriteShader> outlineShader;
-  std::shared_ptr<HealthBarShader> healthBarShader;
+  /// Uses the same shader as uiShader, but with the view matrix for projected coordinates.
+  std::shared_ptr<UIShader> healthBarShader;
   std::shared_ptr<MinimapShader> minimapShader;
+  std::shared_ptr<TextShader> textShader;
   
   // FPS computation.
   TimePoint fpsMeasuringFrameStartTime;
@@ -326,94 +420,80 @@ class RenderWindow : public QOpenGLWindow {
   // Loading screen.
   bool isLoading;
   
-  TextureAndPointBuffer loadingIcon;
-  std::vector<TextDisplayAndPointBuffer> playerNames;
-  std::vector<PointBuffer> playerNameShadowPointBuffers;
+  UITexture loadingIcon;
+  std::vector<TextDisplay> playerNames;
   
   float gameStartBlendToBlackTime = 0.2f;
   
   // Menu.
   bool menuShown = false;
-  TextureAndPointBuffer menuDialog;
-  TextDisplayAndPointBuffer menuTextDisplay;
+  UITexture menuDialog;
+  TextDisplay menuTextDisplay;
   Button menuButtonExit;
-  TextDisplayAndPointBuffer menuButtonExitText;
+  TextDisplay menuButtonExitText;
   Button menuButtonResign;
-  TextDisplayAndPointBuffer menuButtonResignText;
+  TextDisplay menuButtonResignText;
   Button menuButtonCancel;
-  TextDisplayAndPointBuffer menuButtonCancelText;
+  TextDisplay menuButtonCancelText;
   
   // Game UI.
   float uiScale;
   
-  TextDisplayAndPointBuffer gameEndTextDisplay;
-  PointBuffer gameEndTextDisplayShadowPointBuffer;
+  TextDisplay gameEndTextDisplay;
   
-  TextureAndPointBuffer menuPanel;
+  UITexture menuPanel;
   OpaquenessMap menuPanelOpaquenessMap;
   Button menuButton;
-  PointBuffer objectivesButtonPointBuffer;
   std::shared_ptr<Texture> objectivesButtonDisabledTexture;
-  PointBuffer chatButtonPointBuffer;
   std::shared_ptr<Texture> chatButtonDisabledTexture;
-  PointBuffer diplomacyButtonPointBuffer;
   std::shared_ptr<Texture> diplomacyButtonDisabledTexture;
-  PointBuffer settingsButtonPointBuffer;
   std::shared_ptr<Texture> settingsButtonDisabledTexture;
   
-  TextureAndPointBuffer resourcePanel;
+  UITexture resourcePanel;
   OpaquenessMap resourcePanelOpaquenessMap;
-  TextureAndPointBuffer resourceWood;
-  TextDisplayAndPointBuffer woodTextDisplay;
-  TextDisplayAndPointBuffer woodVillagersTextDisplay;
-  TextureAndPointBuffer resourceFood;
-  TextDisplayAndPointBuffer foodTextDisplay;
-  TextDisplayAndPointBuffer foodVillagersTextDisplay;
-  TextureAndPointBuffer resourceGold;
-  TextDisplayAndPointBuffer goldTextDisplay;
-  TextDisplayAndPointBuffer goldVillagersTextDisplay;
-  TextureAndPointBuffer resourceStone;
-  TextDisplayAndPointBuffer stoneTextDisplay;
-  TextDisplayAndPointBuffer stoneVillagersTextDisplay;
-  TextureAndPointBuffer pop;
-  TextDisplayAndPointBuffer popTextDisplay;
-  TextDisplayAndPointBuffer popVillagersTextDisplay;
+  UITexture resourceWood;
+  TextDisplay woodTextDisplay;
+  TextDisplay woodVillagersTextDisplay;
+  UITexture resourceFood;
+  TextDisplay foodTextDisplay;
+  TextDisplay foodVillagersTextDisplay;
+  UITexture resourceGold;
+  TextDisplay goldTextDisplay;
+  TextDisplay goldVillagersTextDisplay;
+  UITexture resourceStone;
+  TextDisplay stoneTextDisplay;
+  TextDisplay stoneVillagersTextDisplay;
+  UITexture pop;
+  TextDisplay popTextDisplay;
+  TextDisplay popVillagersTextDisplay;
   double housedStartTime = -1;
-  PointBuffer popWhiteBackgroundPointBuffer;
-  TextureAndPointBuffer idleVillagerDisabled;
-  TextureAndPointBuffer currentAgeShield;
-  TextDisplayAndPointBuffer currentAgeTextDisplay;
+  UITexture idleVillagerDisabled;
+  UITexture currentAgeShield;
+  TextDisplay currentAgeTextDisplay;
   
-  TextDisplayAndPointBuffer gameTimeDisplay;
-  PointBuffer gameTimeDisplayShadowPointBuffer;
-  TextDisplayAndPointBuffer fpsAndPingDisplay;
-  PointBuffer fpsAndPingDisplayShadowPointBuffer;
+  TextDisplay gameTimeDisplay;
+  TextDisplay fpsAndPingDisplay;
   
-  TextureAndPointBuffer commandPanel;
+  UITexture commandPanel;
   OpaquenessMap commandPanelOpaquenessMap;
-  TextureAndPointBuffer buildEconomyBuildings;
-  TextureAndPointBuffer buildMilitaryBuildings;
-  TextureAndPointBuffer toggleBuildingsCategory;
-  TextureAndPointBuffer quit;
+  UITexture buildEconomyBuildings;
+  UITexture buildMilitaryBuildings;
+  UITexture toggleBuildingsCategory;
+  UITexture quit;
   
-  TextureAndPointBuffer minimapPanel;
+  UITexture minimapPanel;
   OpaquenessMap minimapPanelOpaquenessMap;
   std::shared_ptr<Minimap> minimap;
-  static constexpr float minimapUpdateInterval = 0.5f;
+  static constexpr float minimapUpdateInterval = 0.1f;
   float timeSinceLastMinimapUpdate = minimapUpdateInterval + 999;
   
-  TextureAndPointBuffer selectionPanel;
+  UITexture selectionPanel;
   OpaquenessMap selectionPanelOpaquenessMap;
-  TextDisplayAndPointBuffer singleObjectNameDisplay;
-  TextDisplayAndPointBuffer hpDisplay;
-  TextDisplayAndPointBuffer carriedResourcesDisplay;
-  PointBuffer selectionPanelIconPointBuffer;
-  PointBuffer selectionPanelIconOverlayPointBuffer;
-  PointBuffer productionQueuePointBuffers[kMaxProductionQueueSize];
-  PointBuffer productionQueueOverlayPointBuffers[kMaxProductionQueueSize];
-  TextDisplayAndPointBuffer productionProgressText;
-  TextureAndPointBuffer productionProgressBar;
-  PointBuffer productionProgressBarBackgroundPointBuffer;
+  TextDisplay singleObjectNameDisplay;
+  TextDisplay hpDisplay;
+  TextDisplay carriedResourcesDisplay;
+  TextDisplay productionProgressText;
+  UITexture productionProgressBar;
   QPointF productionQueueIconsTopLeft[kMaxProductionQueueSize];
   float productionQueueIconsSize[kMaxProductionQueueSize];
   int pressedProductionQueueItem = -1;
@@ -430,19 +510,19 @@ class RenderWindow : public QOpenGLWindow {
   bool commandButtonPressedByHotkey = false;
   
   bool showingEconomyBuildingCommandButtons = false;
-
+  
   // TODO: Somehow group constructBuildingType and activeCommandButton to avoid
   // setting the one and not the other. Could also be generalized for other types of commands
   // that need more input than a press of the button (eg. attack move, set gather point,
   // garrison)
-
+  
   /// The type of building that the user is about to place a foundation for.
   /// If not constructing a building, this is set to BuildingType::NumBuildings.
   BuildingType constructBuildingType = BuildingType::NumBuildings;
   
   /// The command button which action is under way. Currently only of Type::ConstructBuilding.
   CommandButton* activeCommandButton = nullptr;
-
+  
   // Control groups.
   static constexpr int kNumControlGroups = 10;
   std::vector<u32> controlGroups[kNumControlGroups];
@@ -450,8 +530,8 @@ class RenderWindow : public QOpenGLWindow {
   bool spaceHeld = false;
   
   // Resources.
-  bool haveSyncObject = false;
-  GLsync syncObject;
+  /// Buffer that the sprite vertices are streamed into each frame (see DrawSprite()).
+  StreamingVertexBuffer spriteVertexBuffer;
   
   // Generic list of vertex buffer objects
   struct BufferObject {
@@ -1,83 +0,0 @@
-// Copyright 2020 The FreeAge authors
-// This file is part of FreeAge, licensed under the new BSD license.
-// See the COPYING file in the project root for the license text.
-
-#include "FreeAge/client/shader_health_bar.hpp"
-
-#include "FreeAge/common/logging.hpp"
-
-HealthBarShader::HealthBarShader() {
-  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
-  
-  program.reset(new ShaderProgram());
-  
-  CHECK(program->AttachShader(
-      "#version 330 core\n"
-      "in vec3 in_position;\n"
-      "uniform mat2 u_viewMatrix;\n"
-      "void main() {\n"
-      "  gl_Position = vec4(u_viewMatrix[0][0] * in_position.x + u_viewMatrix[1][0], u_viewMatrix[0][1] * in_position.y + u_viewMatrix[1][1], in_position.z, 1);\n"
-      "}\n",
-      ShaderProgram::ShaderType::kVertexShader, f));
-  
-  CHECK(program->AttachShader(
-      "#version 330 core\n"
-      "#extension GL_EXT_geometry_shader : enable\n"
-      "layout(points) in;\n"
-      "layout(triangle_strip, max_vertices = 4) out;\n"
-      "\n"
-      "uniform vec2 u_size;\n"
-      "\n"
-      "out vec2 texcoord;\n"
-      "\n"
-      "void main() {\n"
-      "  gl_Position = vec4(gl_in[0].gl_Position.x, gl_in[0].gl_Position.y, gl_in[0].gl_Position.z, 1.0);\n"
-      "  texcoord = vec2(0, 0);\n"
-      "  EmitVertex();\n"
-      "  gl_Position = vec4(gl_in[0].gl_Position.x + u_size.x, gl_in[0].gl_Position.y, gl_in[0].gl_Position.z, 1.0);\n"
-      "  texcoord = vec2(1, 0);\n"
-      "  EmitVertex();\n"
-      "  gl_Position = vec4(gl_in[0].gl_Position.x, gl_in[0].gl_Position.y - u_size.y, gl_in[0].gl_Position.z, 1.0);\n"
-      "  texcoord = vec2(0, 1);\n"
-      "  EmitVertex();\n"
-      "  gl_Position = vec4(gl_in[0].gl_Position.x + u_size.x, gl_in[0].gl_Position.y - u_size.y, gl_in[0].gl_Position.z, 1.0);\n"
-      "  texcoord = vec2(1, 1);\n"
-      "  EmitVertex();\n"
-      "  \n"
-      "  EndPrimitive();\n"
-      "}\n",
-      ShaderProgram::ShaderType::kGeometryShader, f));
-  
-  CHECK(program->AttachShader(
-      "#version 330 core\n"
-      "layout(location = 0) out vec4 out_color;\n"
-      "\n"
-      "in vec2 texcoord;\n"
-      "\n"
-      "uniform vec3 u_playerColor;\n"
-      "uniform float u_fillAmount;\n"
-      "\n"
-      "void main() {\n"
-      "  const float borderY = 1.0 / 3.0;\n"
-      "  bool bottomBorder = texcoord.y > 1.0 - borderY;\n"
-      "  if (bottomBorder) {\n"
-      "    out_color = vec4(0, 0, 0, 0);\n"
-      "  } else {\n"
-      "    out_color = vec4((texcoord.x < u_fillAmount) ? u_playerColor : vec3(0, 0, 0), 1);\n"
-      "  }\n"
-      "}\n",
-      ShaderProgram::ShaderType::kFragmentShader, f));
-  
-  CHECK(program->LinkProgram(f));
-  
-  program->UseProgram(f);
-  
-  viewMatrix_location = program->GetUniformLocationOrAbort("u_viewMatrix", f);
-  size_location = program->GetUniformLocationOrAbort("u_size", f);
-  playerColor_location = program->GetUniformLocationOrAbort("u_playerColor", f);
-  fillAmount_location = program->GetUniformLocationOrAbort("u_fillAmount", f);
-}
-
-HealthBarShader::~HealthBarShader() {
-  program.reset();
-}
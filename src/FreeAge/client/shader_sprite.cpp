@@ -22,7 +22,8 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
       "in vec3 in_position;\n"
       "in vec2 in_size;\n"
       "in uvec2 in_tex_topleft;\n"
-      "in uvec2 in_tex_bottomright;\n";
+      "in uvec2 in_tex_bottomright;\n"
+      "in uint in_layer;\n";
   if (outline) {
     vertexShaderSrc +=
         "in vec3 in_playerColor;\n"
@@ -40,12 +41,15 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
       "out vec2 var_size;\n"
       "out vec2 var_tex_topleft;\n"
       "out vec2 var_tex_bottomright;\n"
+      "flat out int var_layer;\n"
       "\n"
       "uniform mat2 u_viewMatrix;\n"
+      "uniform float u_widgetHeight;\n"
       "void main() {\n"
-      "  var_size = in_size;\n"
+      "  var_size = vec2(u_viewMatrix[0][0] * in_size.x, -u_viewMatrix[0][1] * in_size.y);\n"
       "  var_tex_topleft = vec2(float(in_tex_topleft.x) / u_textureSize.x, float(in_tex_topleft.y) / u_textureSize.y);\n"
-      "  var_tex_bottomright = vec2(float(in_tex_bottomright.x) / u_textureSize.x, float(in_tex_bottomright.y) / u_textureSize.y);\n";
+      "  var_tex_bottomright = vec2(float(in_tex_bottomright.x) / u_textureSize.x, float(in_tex_bottomright.y) / u_textureSize.y);\n"
+      "  var_layer = int(in_layer);\n";
   if (outline) {
     vertexShaderSrc +=
         "var_playerColor = in_playerColor;\n";
@@ -55,7 +59,10 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
         "var_modulationColor = in_modulationColor;\n";
   }
   vertexShaderSrc +=
-      "  gl_Position = vec4(u_viewMatrix[0][0] * in_position.x + u_viewMatrix[1][0], u_viewMatrix[0][1] * in_position.y + u_viewMatrix[1][1], in_position.z, 1);\n"
+      "  // The depth is computed from the y-coordinate of the sprite center in the same way as for the health bars.\n"
+      "  const float kOffScreenDepthBufferExtent = 1000.0;\n"
+      "  float depth = 1.0 - 2.0 * (kOffScreenDepthBufferExtent + u_viewMatrix[0][0] * in_position.z + u_viewMatrix[1][0]) / (2.0 * kOffScreenDepthBufferExtent + u_widgetHeight);\n"
+      "  gl_Position = vec4(u_viewMatrix[0][0] * in_position.x + u_viewMatrix[1][0], u_viewMatrix[0][1] * in_position.y + u_viewMatrix[1][1], depth, 1);\n"
       "}\n";
   CHECK(program->AttachShader(vertexShaderSrc.c_str(), ShaderProgram::ShaderType::kVertexShader, f));
   
@@ -67,7 +74,8 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
       "\n"
       "in vec2 var_size[];\n"
       "in vec2 var_tex_topleft[];\n"
-      "in vec2 var_tex_bottomright[];\n";
+      "in vec2 var_tex_bottomright[];\n"
+      "flat in int var_layer[];\n";
   if (outline) {
     geometryShaderSrc +=
         "in vec3 var_playerColor[];\n"
@@ -83,8 +91,10 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
   }
   geometryShaderSrc +=
       "out vec2 texcoord;\n"
+      "flat out int layer;\n"
       "\n"
       "void main() {\n"
+      "  layer = var_layer[0];\n"
       "  gl_Position = vec4(gl_in[0].gl_Position.x, gl_in[0].gl_Position.y, gl_in[0].gl_Position.z, 1.0);\n"
       "  texcoord = vec2(var_tex_topleft[0].x, var_tex_topleft[0].y);\n";
   if (outline) {
@@ -97,12 +107,15 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
   }
   geometryShaderSrc +=
       "  EmitVertex();\n"
+      "  layer = var_layer[0];\n"
       "  gl_Position = vec4(gl_in[0].gl_Position.x + var_size[0].x, gl_in[0].gl_Position.y, gl_in[0].gl_Position.z, 1.0);\n"
       "  texcoord = vec2(var_tex_bottomright[0].x, var_tex_topleft[0].y);\n"
       "  EmitVertex();\n"
+      "  layer = var_layer[0];\n"
       "  gl_Position = vec4(gl_in[0].gl_Position.x, gl_in[0].gl_Position.y - var_size[0].y, gl_in[0].gl_Position.z, 1.0);\n"
       "  texcoord = vec2(var_tex_topleft[0].x, var_tex_bottomright[0].y);\n"
       "  EmitVertex();\n"
+      "  layer = var_layer[0];\n"
       "  gl_Position = vec4(gl_in[0].gl_Position.x + var_size[0].x, gl_in[0].gl_Position.y - var_size[0].y, gl_in[0].gl_Position.z, 1.0);\n"
       "  texcoord = vec2(var_tex_bottomright[0].x, var_tex_bottomright[0].y);\n"
       "  EmitVertex();\n"
@@ -117,11 +130,12 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
         "layout(location = 0) out vec4 out_color;\n"
         "\n"
         "in vec2 texcoord;\n"
+        "flat in int layer;\n"
         "\n"
-        "uniform sampler2D u_texture;\n"
+        "uniform sampler2DArray u_texture;\n"
         "\n"
         "void main() {\n"
-        "  out_color = vec4(0, 0, 0, 1.5 * texture(u_texture, texcoord.xy).r);\n"  // TODO: Magic factor 1.5 makes it look nicer (darker shadows)
+        "  out_color = vec4(0, 0, 0, 1.5 * texture(u_texture, vec3(texcoord.xy, layer)).r);\n"  // TODO: Magic factor 1.5 makes it look nicer (darker shadows)
         "}\n",
         ShaderProgram::ShaderType::kFragmentShader, f));
   } else if (outline) {
@@ -130,9 +144,10 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
         "layout(location = 0) out vec4 out_color;\n"
         "\n"
         "in vec2 texcoord;\n"
+        "flat in int layer;\n"
         "in vec3 playerColor;\n"
         "\n"
-        "uniform sampler2D u_texture;\n"
+        "uniform sampler2DArray u_texture;\n"
         "uniform vec2 u_textureSize;\n"
         "\n"
         "float GetOutlineAlpha(vec4 value) {\n"
@@ -153,13 +168,13 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
         "  float fx = pixelTexcoord.x - 0.5 - ix;\n"
         "  float fy = pixelTexcoord.y - 0.5 - iy;\n"
         "  \n"
-        "  vec4 value = texture(u_texture, vec2((ix + 0.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y));\n"
+        "  vec4 value = texture(u_texture, vec3((ix + 0.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y, layer));\n"
         "  float topLeftAlpha = GetOutlineAlpha(value);\n"
-        "  value = texture(u_texture, vec2((ix + 1.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y));\n"
+        "  value = texture(u_texture, vec3((ix + 1.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y, layer));\n"
         "  float topRightAlpha = GetOutlineAlpha(value);\n"
-        "  value = texture(u_texture, vec2((ix + 0.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y));\n"
+        "  value = texture(u_texture, vec3((ix + 0.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y, layer));\n"
         "  float bottomLeftAlpha = GetOutlineAlpha(value);\n"
-        "  value = texture(u_texture, vec2((ix + 1.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y));\n"
+        "  value = texture(u_texture, vec3((ix + 1.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y, layer));\n"
         "  float bottomRightAlpha = GetOutlineAlpha(value);\n"
         "  \n"
         "  float outAlpha =\n"
@@ -180,10 +195,11 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
         "layout(location = 0) out vec4 out_color;\n"
         "\n"
         "in vec2 texcoord;\n"
+        "flat in int layer;\n"
         "flat in int playerIndex;\n"
         "in vec3 modulationColor;\n"
         "\n"
-        "uniform sampler2D u_texture;\n"
+        "uniform sampler2DArray u_texture;\n"
         "uniform vec2 u_textureSize;\n"
         "uniform sampler2D u_playerColorsTexture;\n"
         "uniform vec2 u_playerColorsTextureSize;\n"
@@ -206,13 +222,13 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
         "  float fx = pixelTexcoord.x - 0.5 - ix;\n"
         "  float fy = pixelTexcoord.y - 0.5 - iy;\n"
         "  \n"
-        "  vec4 topLeft = texture(u_texture, vec2((ix + 0.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y));\n"
+        "  vec4 topLeft = texture(u_texture, vec3((ix + 0.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y, layer));\n"
         "  topLeft = AdjustPlayerColor(topLeft);\n"
-        "  vec4 topRight = texture(u_texture, vec2((ix + 1.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y));\n"
+        "  vec4 topRight = texture(u_texture, vec3((ix + 1.5) / u_textureSize.x, (iy + 0.5) / u_textureSize.y, layer));\n"
         "  topRight = AdjustPlayerColor(topRight);\n"
-        "  vec4 bottomLeft = texture(u_texture, vec2((ix + 0.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y));\n"
+        "  vec4 bottomLeft = texture(u_texture, vec3((ix + 0.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y, layer));\n"
         "  bottomLeft = AdjustPlayerColor(bottomLeft);\n"
-        "  vec4 bottomRight = texture(u_texture, vec2((ix + 1.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y));\n"
+        "  vec4 bottomRight = texture(u_texture, vec3((ix + 1.5) / u_textureSize.x, (iy + 1.5) / u_textureSize.y, layer));\n"
         "  bottomRight = AdjustPlayerColor(bottomRight);\n"
         "  \n"
         "  out_color =\n"
@@ -235,6 +251,7 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
   
   texture_location = program->GetUniformLocationOrAbort("u_texture", f);
   viewMatrix_location = program->GetUniformLocationOrAbort("u_viewMatrix", f);
+  widgetHeight_location = program->GetUniformLocationOrAbort("u_widgetHeight", f);
   size_location = f->glGetAttribLocation(program->program_name(), "in_size");
   CHECK_GE(size_location, 0);
   textureSize_location = program->GetUniformLocationOrAbort("u_textureSize", f);
@@ -254,13 +271,15 @@ SpriteShader::SpriteShader(bool shadow, bool outline)
   CHECK_GE(tex_topleft_location, 0);
   tex_bottomright_location = f->glGetAttribLocation(program->program_name(), "in_tex_bottomright");
   CHECK_GE(tex_bottomright_location, 0);
+  layer_location = f->glGetAttribLocation(program->program_name(), "in_layer");
+  CHECK_GE(layer_location, 0);
   
   if (outline) {
-    vertexSize = (3 + 2 + 1 + 1 + 1) * sizeof(float);
+    vertexSize = (3 + 2 + 1 + 1 + 1 + 1) * sizeof(float);
   } else if (shadow) {
-    vertexSize = (3 + 2 + 1 + 1) * sizeof(float);
-  } else {
     vertexSize = (3 + 2 + 1 + 1 + 1) * sizeof(float);
+  } else {
+    vertexSize = (3 + 2 + 1 + 1 + 1 + 1) * sizeof(float);
   }
 }
 
@@ -268,10 +287,10 @@ SpriteShader::~SpriteShader() {
   program.reset();
 }
 
-void SpriteShader::UseProgramAndSetAttribPointers(QOpenGLFunctions_3_2_Core* f) {
+void SpriteShader::UseProgramAndSetAttribPointers(usize baseOffset, QOpenGLFunctions_3_2_Core* f) {
   program->UseProgram(f);
   
-  usize offset = 0;
+  usize offset = baseOffset;
   
   program->SetPositionAttribute(3, GetGLType<float>::value, vertexSize, offset, f);
   offset += 3 * sizeof(float);
@@ -288,6 +307,10 @@ void SpriteShader::UseProgramAndSetAttribPointers(QOpenGLFunctions_3_2_Core* f)
   f->glVertexAttribIPointer(tex_bottomright_location, 2, GetGLType<u16>::value, vertexSize, reinterpret_cast<void*>(offset));
   offset += 4;
   
+  f->glEnableVertexAttribArray(layer_location);
+  f->glVertexAttribIPointer(layer_location, 1, GetGLType<u16>::value, vertexSize, reinterpret_cast<void*>(offset));
+  offset += 4;  // u16 layer index plus two bytes of padding
+  
   if (outline) {
     f->glEnableVertexAttribArray(playerColor_location);
     f->glVertexAttribPointer(playerColor_location, 4, GetGLType<u8>::value, GL_TRUE, vertexSize, reinterpret_cast<void*>(offset));
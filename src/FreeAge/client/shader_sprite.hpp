@@ -8,8 +8,11 @@
 
 #include <QOpenGLFunctions_3_2_Core>
 
+#include "FreeAge/common/free_age.hpp"
 #include "FreeAge/client/shader_program.hpp"
 
+class StreamingVertexBuffer;
+
 /// Shader for rendering sprites.
 class SpriteShader {
  public:
@@ -18,11 +21,18 @@ class SpriteShader {
   
   inline ShaderProgram* GetProgram() { return program.get(); }
   
-  void UseProgramAndSetAttribPointers(QOpenGLFunctions_3_2_Core* f);
+  /// Uses the program and sets up the vertex attributes for vertices starting at the given
+  /// byte offset in the currently bound GL_ARRAY_BUFFER.
+  void UseProgramAndSetAttribPointers(usize baseOffset, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Sets the buffer that DrawSprite() writes the vertices for this shader to.
+  inline void SetVertexBuffer(StreamingVertexBuffer* buffer) { vertexBuffer = buffer; }
+  inline StreamingVertexBuffer* GetVertexBuffer() const { return vertexBuffer; }
   
   inline GLint GetTextureLocation() const { return texture_location; }
   inline GLint GetPlayerColorsTextureLocation() const { return playerColorsTexture_location; }
   inline GLint GetViewMatrixLocation() const { return viewMatrix_location; }
+  inline GLint GetWidgetHeightLocation() const { return widgetHeight_location; }
   inline GLint GetTextureSizeLocation() const { return textureSize_location; }
   inline GLint GetPlayerColorsTextureSizeLocation() const { return playerColorsTextureSize_location; }
   
@@ -33,16 +43,20 @@ class SpriteShader {
   GLint texture_location;
   GLint playerColorsTexture_location;
   GLint viewMatrix_location;
+  GLint widgetHeight_location;
   GLint size_location;
   GLint textureSize_location;
   GLint playerColorsTextureSize_location;
   GLint playerIndex_location;
   GLint tex_topleft_location;
   GLint tex_bottomright_location;
+  GLint layer_location;
   GLint playerColor_location;
   GLint modulationColor_location;
   
   bool shadow;
   bool outline;
   int vertexSize;
+  
+  StreamingVertexBuffer* vertexBuffer = nullptr;
 };
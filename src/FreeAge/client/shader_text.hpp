@@ -10,23 +10,22 @@
 
 #include "FreeAge/client/shader_program.hpp"
 
-/// Shader for rendering health bars.
-class HealthBarShader {
+/// Shader for rendering text with a glyph atlas (see TextRenderer).
+/// Each vertex has a position (in pixels), a texture coordinate within the atlas, and a color.
+/// The atlas texture contains the glyph coverage in its red channel, which is applied to the color's alpha.
+class TextShader {
  public:
-  HealthBarShader();
-  ~HealthBarShader();
+  TextShader();
+  ~TextShader();
   
   inline ShaderProgram* GetProgram() { return program.get(); }
   
+  inline GLint GetTextureLocation() const { return texture_location; }
   inline GLint GetViewMatrixLocation() const { return viewMatrix_location; }
-  inline GLint GetSizeLocation() const { return size_location; }
-  inline GLint GetPlayerColorLocation() const { return playerColor_location; }
-  inline GLint GetFillAmountLocation() const { return fillAmount_location; }
   
  private:
   std::shared_ptr<ShaderProgram> program;
+  
+  GLint texture_location;
   GLint viewMatrix_location;
-  GLint size_location;
-  GLint playerColor_location;
-  GLint fillAmount_location;
 };
@@ -0,0 +1,107 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/spatial_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FreeAge/common/logging.hpp"
+
+void SpatialIndex::Initialize(const QRectF& projectedBounds) {
+  origin = projectedBounds.topLeft();
+  cellsX = std::max(1, static_cast<int>(std::ceil(projectedBounds.width() / kCellSize)));
+  cellsY = std::max(1, static_cast<int>(std::ceil(projectedBounds.height() / kCellSize)));
+  
+  cells.clear();
+  cells.resize(cellsX * cellsY);
+  objectCells.clear();
+  maxExtent = 0;
+}
+
+void SpatialIndex::Clear() {
+  for (auto& cell : cells) {
+    cell.clear();
+  }
+  objectCells.clear();
+  maxExtent = 0;
+}
+
+void SpatialIndex::Insert(u32 objectId, ClientObject* object, const QPointF& anchor, float extent) {
+  int cellIndex = GetCellIndex(anchor);
+  if (!objectCells.emplace(objectId, cellIndex).second) {
+    LOG(ERROR) << "Object is already in the spatial index: " << objectId;
+    return;
+  }
+  cells[cellIndex].emplace_back(objectId, object);
+  maxExtent = std::max(maxExtent, extent);
+}
+
+void SpatialIndex::Move(u32 objectId, const QPointF& anchor, float extent) {
+  maxExtent = std::max(maxExtent, extent);
+  
+  auto it = objectCells.find(objectId);
+  if (it == objectCells.end()) {
+    LOG(ERROR) << "Object is not in the spatial index: " << objectId;
+    return;
+  }
+  
+  int newCellIndex = GetCellIndex(anchor);
+  if (newCellIndex == it->second) {
+    return;
+  }
+  
+  std::vector<Entry>& oldCell = cells[it->second];
+  for (usize i = 0; i < oldCell.size(); ++ i) {
+    if (oldCell[i].first == objectId) {
+      cells[newCellIndex].push_back(oldCell[i]);
+      oldCell[i] = oldCell.back();
+      oldCell.pop_back();
+      break;
+    }
+  }
+  it->second = newCellIndex;
+}
+
+void SpatialIndex::Remove(u32 objectId) {
+  auto it = objectCells.find(objectId);
+  if (it == objectCells.end()) {
+    return;
+  }
+  
+  std::vector<Entry>& cell = cells[it->second];
+  for (usize i = 0; i < cell.size(); ++ i) {
+    if (cell[i].first == objectId) {
+      cell[i] = cell.back();
+      cell.pop_back();
+      break;
+    }
+  }
+  objectCells.erase(it);
+}
+
+void SpatialIndex::Query(const QRectF& projectedRect, std::vector<Entry>* result) const {
+  if (cells.empty()) {
+    return;
+  }
+  
+  // An object's anchor may be up to maxExtent away from the parts of its sprite that intersect the rect.
+  int minCellX = std::max<int>(0, std::floor((projectedRect.left() - maxExtent - origin.x()) / kCellSize));
+  int minCellY = std::max<int>(0, std::floor((projectedRect.top() - maxExtent - origin.y()) / kCellSize));
+  int maxCellX = std::min<int>(cellsX - 1, std::floor((projectedRect.right() + maxExtent - origin.x()) / kCellSize));
+  int maxCellY = std::min<int>(cellsY - 1, std::floor((projectedRect.bottom() + maxExtent - origin.y()) / kCellSize));
+  
+  for (int cellY = minCellY; cellY <= maxCellY; ++ cellY) {
+    for (int cellX = minCellX; cellX <= maxCellX; ++ cellX) {
+      const std::vector<Entry>& cell = cells[cellY * cellsX + cellX];
+      result->insert(result->end(), cell.begin(), cell.end());
+    }
+  }
+}
+
+int SpatialIndex::GetCellIndex(const QPointF& anchor) const {
+  int cellX = std::max(0, std::min(cellsX - 1, static_cast<int>(std::floor((anchor.x() - origin.x()) / kCellSize))));
+  int cellY = std::max(0, std::min(cellsY - 1, static_cast<int>(std::floor((anchor.y() - origin.y()) / kCellSize))));
+  return cellY * cellsX + cellX;
+}
@@ -0,0 +1,72 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <QPointF>
+#include <QRectF>
+
+#include "FreeAge/common/free_age.hpp"
+
+class ClientObject;
+
+/// Loose grid of the map objects in projected coordinates, used to quickly determine
+/// which objects may be visible within a given rectangle (for example, the view rectangle),
+/// without iterating over all objects.
+///
+/// Each object is stored in the grid cell that contains its anchor point (the projected
+/// coordinate of its center on the ground), together with its extent: the maximum distance
+/// of any of its sprites' pixels from the anchor along either axis. Queries therefore enlarge
+/// the query rectangle by the largest extent of any object in the index.
+/// Query results are conservative: they may contain objects that do not actually intersect
+/// the rectangle, so the caller still needs to do an exact test.
+class SpatialIndex {
+ public:
+  typedef std::pair<u32, ClientObject*> Entry;
+  
+  /// Initializes an empty index for the given range of projected coordinates.
+  /// Anchor points outside of this range are clamped to it.
+  void Initialize(const QRectF& projectedBounds);
+  
+  /// Removes all objects from the index.
+  void Clear();
+  
+  /// Inserts the object with the given ID.
+  void Insert(u32 objectId, ClientObject* object, const QPointF& anchor, float extent);
+  
+  /// Updates the anchor point and extent of the object with the given ID, which must have been inserted before.
+  /// This is cheap if the object stays within the same grid cell.
+  void Move(u32 objectId, const QPointF& anchor, float extent);
+  
+  /// Removes the object with the given ID from the index, if it is contained.
+  void Remove(u32 objectId);
+  
+  /// Appends all objects to result whose sprites may intersect the given rectangle.
+  void Query(const QRectF& projectedRect, std::vector<Entry>* result) const;
+  
+  inline usize GetNumObjects() const { return objectCells.size(); }
+  
+ private:
+  int GetCellIndex(const QPointF& anchor) const;
+  
+  /// Size of a grid cell in projected coordinates.
+  static constexpr float kCellSize = 256;
+  
+  QPointF origin;
+  int cellsX = 0;
+  int cellsY = 0;
+  
+  /// Indexed by: [cellY * cellsX + cellX].
+  std::vector<std::vector<Entry>> cells;
+  
+  /// Maps object ID -> index of the cell that contains the object.
+  std::unordered_map<u32, int> objectCells;
+  
+  /// The largest extent of any object that was inserted into the index.
+  float maxExtent = 0;
+};
@@ -4,17 +4,27 @@
 
 #include "FreeAge/client/sprite.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <functional>
+#include <mutex>
 
 #include <mango/image/image.hpp>
 
 #include "FreeAge/common/logging.hpp"
 #include "FreeAge/common/timing.hpp"
+#include "FreeAge/common/worker_pool.hpp"
+#include "FreeAge/client/mapped_file.hpp"
+#include "FreeAge/client/mod_manager.hpp"
 #include "FreeAge/client/opengl.hpp"
 #include "FreeAge/client/shader_color_dilation.hpp"
 #include "FreeAge/client/shader_program.hpp"
 #include "FreeAge/client/shader_sprite.hpp"
 #include "FreeAge/client/sprite_atlas.hpp"
+#include "FreeAge/client/sprite_decode.hpp"
+#include "FreeAge/client/sprite_vertex_arena.hpp"
+#include "FreeAge/client/streaming_vertex_buffer.hpp"
 #include "FreeAge/client/texture.hpp"
 
 bool LoadSMXGraphicLayer(
@@ -23,33 +33,33 @@ bool LoadSMXGraphicLayer(
     bool usesEightToFiveCompression,
     int pixelBorder,
     const Palette& standardPalette,
-    FILE* file,
+    ByteReader* reader,
     QImage* result) {
   // Read the command and pixel array length
   u32 commandArrayLen;
-  if (fread(&commandArrayLen, sizeof(u32), 1, file) != 1) {
+  if (!reader->Read(&commandArrayLen)) {
     LOG(ERROR) << "Unexpected EOF while trying to read commandArrayLen";
     *result = QImage();
     return false;
   }
   
   u32 pixelArrayLen;
-  if (fread(&pixelArrayLen, sizeof(u32), 1, file) != 1) {
+  if (!reader->Read(&pixelArrayLen)) {
     LOG(ERROR) << "Unexpected EOF while trying to read pixelArrayLen";
     *result = QImage();
     return false;
   }
   
-  // Read the command and pixel array data
-  std::vector<u8> commandArray(commandArrayLen);
-  if (fread(commandArray.data(), sizeof(u8), commandArrayLen, file) != commandArrayLen) {
+  // Get the command and pixel array data (without copying it)
+  const u8* commandArray = reader->Take(commandArrayLen);
+  if (!commandArray) {
     LOG(ERROR) << "Unexpected EOF while trying to read commandArray";
     *result = QImage();
     return false;
   }
   
-  std::vector<u8> pixelArray(pixelArrayLen);
-  if (fread(pixelArray.data(), sizeof(u8), pixelArrayLen, file) != pixelArrayLen) {
+  const u8* pixelArray = reader->Take(pixelArrayLen);
+  if (!pixelArray) {
     LOG(ERROR) << "Unexpected EOF while trying to read pixelArray";
     *result = QImage();
     return false;
@@ -57,71 +67,20 @@ bool LoadSMXGraphicLayer(
   
   // Build the image.
   QImage graphic(layerHeader.width, layerHeader.height, QImage::Format_ARGB32);
-  
-  const u8* commandPtr = commandArray.data();
-  const u8* pixelPtr = pixelArray.data();
-  int decompressionState = 0;
-  for (int row = 0; row < layerHeader.height; ++ row) {
-    QRgb* out = reinterpret_cast<QRgb*>(graphic.scanLine(row));
-    
-    // Check for skipped rows
-    const SMPLayerRowEdge& edge = rowEdges[row];
-    if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
-      // Row is completely transparent
-      for (int col = 0; col < layerHeader.width; ++ col) {
-        *out++ = qRgba(0, 0, 0, 0);
-      }
-      continue;
-    }
-    
-    // Left edge skip
-    for (int col = 0; col < edge.leftSpace + pixelBorder; ++ col) {
-      *out++ = qRgba(0, 0, 0, 0);
-    }
-    int col = edge.leftSpace + pixelBorder;
-    
-    while (true) {
-      // Check the next command.
-      u8 command = *commandPtr;
-      ++ commandPtr;
-      
-      u8 commandCode = command & 0b11;
-      if (commandCode == 0b00) {
-        // Draw *count* transparent pixels.
-        u8 count = (command >> 2) + 1;
-        for (int i = 0; i < count; ++ i) {
-          *out++ = qRgba(0, 0, 0, 0);
-        }
-        col += count;
-      } else if (commandCode == 0b01 || commandCode == 0b10) {
-        // Choose the normal or player-color palette depending on the command.
-        const Palette* palette = (commandCode == 0b01) ? &standardPalette : nullptr;
-        
-        // Draw *count* pixels from that palette.
-        u8 count = (command >> 2) + 1;
-        bool ignoreAlpha = true;  /*layerType == SMXLayerType::Graphic*/
-        for (int i = 0; i < count; ++ i) {
-          if (usesEightToFiveCompression) {
-            *out = DecompressNextPixel8To5(pixelPtr, decompressionState, palette, ignoreAlpha);
-          } else {
-            *out = DecompressNextPixel4Plus1(pixelPtr, decompressionState, palette, ignoreAlpha);
-          }
-          
-          ++ out;
-        }
-        col += count;
-      } else if (commandCode == 0b11) {
-        // End of row.
-        if (col + edge.rightSpace + pixelBorder != layerHeader.width) {
-          LOG(WARNING) << "Row " << row << ": Pixel count does not match expectation (col: " << col
-                       << ", edge.rightSpace: " << edge.rightSpace << ", layerHeader.width: " << layerHeader.width << ")";
-        }
-        for (; col < layerHeader.width; ++ col) {
-          *out++ = qRgba(0, 0, 0, 0);
-        }
-        break;
-      }
-    }
+  if (!DecodeSMXGraphicLayer(
+      layerHeader,
+      rowEdges,
+      usesEightToFiveCompression,
+      pixelBorder,
+      standardPalette,
+      commandArray,
+      commandArrayLen,
+      pixelArray,
+      pixelArrayLen,
+      reinterpret_cast<QRgb*>(graphic.bits()),
+      graphic.bytesPerLine() / sizeof(QRgb))) {
+    *result = QImage();
+    return false;
   }
   
   *result = graphic;
@@ -131,18 +90,18 @@ bool LoadSMXGraphicLayer(
 bool LoadSMXShadowLayer(
     const SMXLayerHeader& layerHeader,
     const std::vector<SMPLayerRowEdge>& rowEdges,
-    FILE* file,
+    ByteReader* reader,
     QImage* result) {
-  // Read the combined command and data array
+  // Get the combined command and data array
   u32 dataLen;
-  if (fread(&dataLen, sizeof(u32), 1, file) != 1) {
+  if (!reader->Read(&dataLen)) {
     LOG(ERROR) << "Unexpected EOF while trying to read dataLen";
     *result = QImage();
     return false;
   }
   
-  std::vector<u8> data(dataLen);
-  if (fread(data.data(), sizeof(u8), dataLen, file) != dataLen) {
+  const u8* data = reader->Take(dataLen);
+  if (!data) {
     LOG(ERROR) << "Unexpected EOF while trying to read data";
     *result = QImage();
     return false;
@@ -150,65 +109,9 @@ bool LoadSMXShadowLayer(
   
   // Build the image.
   QImage graphic(layerHeader.width, layerHeader.height, QImage::Format_Grayscale8);
-  
-  const u8* dataPtr = data.data();
-  for (int row = 0; row < layerHeader.height; ++ row) {
-    u8* out = graphic.scanLine(row);
-    
-    // Check for skipped rows
-    const SMPLayerRowEdge& edge = rowEdges[row];
-    if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
-      // Row is completely transparent
-      for (int col = 0; col < layerHeader.width; ++ col) {
-        *out++ = 0;
-      }
-      continue;
-    }
-    
-    // Left edge skip
-    for (int col = 0; col < edge.leftSpace; ++ col) {
-      *out++ = 0;
-    }
-    int col = edge.leftSpace;
-    
-    while (true) {
-      // Check the next command.
-      u8 command = *dataPtr;
-      ++ dataPtr;
-      
-      u8 commandCode = command & 0b11;
-      if (commandCode == 0b00) {
-        // Draw *count* transparent pixels.
-        u8 count = (command >> 2) + 1;
-        for (int i = 0; i < count; ++ i) {
-          *out++ = 0;
-        }
-        col += count;
-      } else if (commandCode == 0b01) {
-        // Draw *count* pixels.
-        u8 count = (command >> 2) + 1;
-        for (int i = 0; i < count; ++ i) {
-          *out++ = *dataPtr++;
-        }
-        col += count;
-      } else if (commandCode == 0b11) {
-        // End of row.
-        // NOTE: We account for what seems like a bug here, where there is one pixel of data missing.
-        if ((col + edge.rightSpace != layerHeader.width) &&
-            (col + edge.rightSpace + 1 != layerHeader.width)) {
-          LOG(WARNING) << "Row " << row << ": Pixel count does not match expectation (col: " << col
-                       << ", edge.rightSpace: " << edge.rightSpace << ", layerHeader.width: " << layerHeader.width << ")";
-        }
-        for (; col < layerHeader.width; ++ col) {
-          *out++ = 0;
-        }
-        break;
-      } else {
-        LOG(ERROR) << "Unexpected drawing code 0b10";
-        *result = QImage();
-        return false;
-      }
-    }
+  if (!DecodeSMXShadowLayer(layerHeader, rowEdges, data, dataLen, graphic.bits(), graphic.bytesPerLine())) {
+    *result = QImage();
+    return false;
   }
   
   *result = graphic;
@@ -218,18 +121,18 @@ bool LoadSMXShadowLayer(
 bool LoadSMXOutlineLayer(
     const SMXLayerHeader& layerHeader,
     const std::vector<SMPLayerRowEdge>& rowEdges,
-    FILE* file,
+    ByteReader* reader,
     QImage* result) {
-  // Read the combined command and data array
+  // Get the combined command and data array
   u32 dataLen;
-  if (fread(&dataLen, sizeof(u32), 1, file) != 1) {
+  if (!reader->Read(&dataLen)) {
     LOG(ERROR) << "Unexpected EOF while trying to read dataLen";
     *result = QImage();
     return false;
   }
   
-  std::vector<u8> data(dataLen);
-  if (fread(data.data(), sizeof(u8), dataLen, file) != dataLen) {
+  const u8* data = reader->Take(dataLen);
+  if (!data) {
     LOG(ERROR) << "Unexpected EOF while trying to read data";
     *result = QImage();
     return false;
@@ -237,63 +140,9 @@ bool LoadSMXOutlineLayer(
   
   // Build the image.
   QImage graphic(layerHeader.width, layerHeader.height, QImage::Format_Grayscale8);
-  
-  const u8* dataPtr = data.data();
-  for (int row = 0; row < layerHeader.height; ++ row) {
-    u8* out = graphic.scanLine(row);
-    
-    // Check for skipped rows
-    const SMPLayerRowEdge& edge = rowEdges[row];
-    if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
-      // Row is completely transparent
-      for (int col = 0; col < layerHeader.width; ++ col) {
-        *out++ = 0;
-      }
-      continue;
-    }
-    
-    // Left edge skip
-    for (int col = 0; col < edge.leftSpace; ++ col) {
-      *out++ = 0;
-    }
-    int col = edge.leftSpace;
-    
-    while (true) {
-      // Check the next command.
-      u8 command = *dataPtr;
-      ++ dataPtr;
-      
-      u8 commandCode = command & 0b11;
-      if (commandCode == 0b00) {
-        // Draw *count* transparent pixels.
-        u8 count = (command >> 2) + 1;
-        for (int i = 0; i < count; ++ i) {
-          *out++ = 0;
-        }
-        col += count;
-      } else if (commandCode == 0b01) {
-        // Draw *count* pixels.
-        u8 count = (command >> 2) + 1;
-        for (int i = 0; i < count; ++ i) {
-          *out++ = 255;
-        }
-        col += count;
-      } else if (commandCode == 0b11) {
-        // End of row.
-        if (col + edge.rightSpace != layerHeader.width) {
-          LOG(WARNING) << "Row " << row << ": Pixel count does not match expectation (col: " << col
-                       << ", edge.rightSpace: " << edge.rightSpace << ", layerHeader.width: " << layerHeader.width << ")";
-        }
-        for (; col < layerHeader.width; ++ col) {
-          *out++ = 0;
-        }
-        break;
-      } else {
-        LOG(ERROR) << "Unexpected drawing code 0b10";
-        *result = QImage();
-        return false;
-      }
-    }
+  if (!DecodeSMXOutlineLayer(layerHeader, rowEdges, data, dataLen, graphic.bits(), graphic.bytesPerLine())) {
+    *result = QImage();
+    return false;
   }
   
   *result = graphic;
@@ -306,10 +155,10 @@ bool LoadSMXLayer(
     SMXLayerType layerType,
     Sprite::Frame::Layer* layer,
     std::vector<SMPLayerRowEdge>* rowEdges,
-    FILE* file) {
+    ByteReader* reader) {
   // Read the layer header.
   SMXLayerHeader layerHeader;
-  if (fread(&layerHeader, sizeof(SMXLayerHeader), 1, file) != 1) {
+  if (!reader->Read(&layerHeader)) {
     LOG(ERROR) << "Unexpected EOF while trying to read SMXLayerHeader";
     return false;
   }
@@ -338,12 +187,9 @@ bool LoadSMXLayer(
     (*rowEdges)[rowEdges->size() - 1 - i].leftSpace = 0xFFFF;
     (*rowEdges)[rowEdges->size() - 1 - i].rightSpace = 0xFFFF;
   }
-  for (int row = 0; row < layerHeader.height - 2 * pixelBorder; ++ row) {
-    if (fread(&(*rowEdges)[row + pixelBorder], sizeof(SMPLayerRowEdge), 1, file) != 1) {
-      LOG(ERROR) << "Unexpected EOF while trying to read SMPLayerRowEdge for row " << row;
-      return false;
-    }
-    // LOG(INFO) << "Row edge: L: " << rowEdges[row].leftSpace << " R: " << rowEdges[row].rightSpace;
+  if (!reader->ReadArray(rowEdges->data() + pixelBorder, layerHeader.height - 2 * pixelBorder)) {
+    LOG(ERROR) << "Unexpected EOF while trying to read the SMPLayerRowEdges";
+    return false;
   }
   
   if (layerType == SMXLayerType::Graphic) {
@@ -353,7 +199,7 @@ bool LoadSMXLayer(
         usesEightToFiveCompression,
         pixelBorder,
         standardPalette,
-        file,
+        reader,
         &layer->image)) {
       return false;
     }
@@ -361,7 +207,7 @@ bool LoadSMXLayer(
     if (!LoadSMXShadowLayer(
         layerHeader,
         *rowEdges,
-        file,
+        reader,
         &layer->image)) {
       return false;
     }
@@ -369,7 +215,7 @@ bool LoadSMXLayer(
     if (!LoadSMXOutlineLayer(
         layerHeader,
         *rowEdges,
-        file,
+        reader,
         &layer->image)) {
       return false;
     }
@@ -383,6 +229,64 @@ bool LoadSMXLayer(
   return true;
 }
 
+/// Advances the reader past an SMX layer without decoding it.
+static bool SkipSMXLayer(SMXLayerType layerType, ByteReader* reader) {
+  SMXLayerHeader layerHeader;
+  if (!reader->Read(&layerHeader) ||
+      !reader->Skip(layerHeader.height * sizeof(SMPLayerRowEdge))) {
+    return false;
+  }
+  
+  if (layerType == SMXLayerType::Graphic) {
+    u32 commandArrayLen;
+    u32 pixelArrayLen;
+    return reader->Read(&commandArrayLen) &&
+           reader->Read(&pixelArrayLen) &&
+           reader->Skip(static_cast<usize>(commandArrayLen) + pixelArrayLen);
+  } else {
+    u32 dataLen;
+    return reader->Read(&dataLen) &&
+           reader->Skip(dataLen);
+  }
+}
+
+/// Calls decodeFrame(frameIdx) for all frames. For sprites with many frames, the frames are
+/// distributed over the threads of a worker pool that is shared by all sprite loads.
+/// Returns false if decoding any of the frames failed.
+static bool DecodeFramesInParallel(int numFrames, const std::function<bool(int)>& decodeFrame) {
+  constexpr int kMinFramesPerTask = 8;
+  static WorkerPool decodePool;
+  static std::mutex decodePoolMutex;
+  
+  // The pool can only run one job at a time. If sprites are loaded by multiple
+  // threads concurrently, the ones that do not get the pool decode serially.
+  std::unique_lock<std::mutex> lock(decodePoolMutex, std::defer_lock);
+  int numTasks = std::min(decodePool.GetNumThreads(), numFrames / kMinFramesPerTask);
+  if (numTasks <= 1 || !lock.try_lock()) {
+    for (int frameIdx = 0; frameIdx < numFrames; ++ frameIdx) {
+      if (!decodeFrame(frameIdx)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  
+  std::atomic<int> nextFrameIdx(0);
+  std::atomic<bool> success(true);
+  decodePool.ParallelFor(numTasks, [&](int /*taskIndex*/) {
+    while (success) {
+      int frameIdx = nextFrameIdx++;
+      if (frameIdx >= numFrames) {
+        break;
+      }
+      if (!decodeFrame(frameIdx)) {
+        success = false;
+      }
+    }
+  });
+  
+  return success;
+}
 
 Palette LoadPalette(const std::filesystem::path& path) {
   Palette result;
@@ -647,16 +551,27 @@ bool Sprite::LoadFromFile(const char* path, const Palettes& palettes) {
     return LoadFromPNGFiles(path);
   }
   
-  FILE* file = fopen(path, "rb");
-  if (!file) {
+  // Get the file from the asset bundle if possible. Otherwise, map the whole file into memory,
+  // such that it can be parsed without further read calls.
+  QByteArray bundledData;
+  MappedFile file;
+  const u8* data;
+  usize size;
+  if (ModManager::Instance().GetBundledFile(path, &bundledData)) {
+    data = reinterpret_cast<const u8*>(bundledData.constData());
+    size = bundledData.size();
+  } else if (file.Open(QString::fromUtf8(path))) {
+    data = file.data();
+    size = file.size();
+  } else {
     LOG(ERROR) << "Cannot open file: " << path;
     return false;
   }
-  std::shared_ptr<FILE> fileCloser(file, [&](FILE* file) { fclose(file); });
   
   // Read the file descriptor.
+  ByteReader reader(data, size);
   char fileDescriptor[4];
-  if (fread(fileDescriptor, sizeof(char), 4, file) != 4) {
+  if (!reader.ReadArray(fileDescriptor, 4)) {
     LOG(ERROR) << "Unexpected EOF while trying to read file descriptor";
     return false;
   }
@@ -665,12 +580,12 @@ bool Sprite::LoadFromFile(const char* path, const Palettes& palettes) {
       fileDescriptor[1] == 'M' &&
       fileDescriptor[2] == 'P' &&
       fileDescriptor[3] == 'X') {
-    return LoadFromSMXFile(file, palettes);
+    return LoadFromSMXFile(data, size, palettes);
   } else if (fileDescriptor[0] == 'S' &&
              fileDescriptor[1] == 'M' &&
              fileDescriptor[2] == 'P' &&
              fileDescriptor[3] == '$') {
-    return LoadFromSMPFile(file, palettes);
+    return LoadFromSMPFile(data, size, palettes);
   } else {
     LOG(ERROR) << "Header file descriptor is not SMPX or SMP$\nActual data: "
                << fileDescriptor[0] << fileDescriptor[1] << fileDescriptor[2] << fileDescriptor[3];
@@ -678,279 +593,352 @@ bool Sprite::LoadFromFile(const char* path, const Palettes& palettes) {
   }
 }
 
-bool Sprite::LoadFromSMXFile(FILE* file, const Palettes& palettes) {
-  // Read the header.
+int Sprite::ComputeMaxExtent() const {
+  int maxExtent = 0;
+  for (const Frame& frame : frames) {
+    for (const Frame::Layer* layer : {&frame.graphic, &frame.shadow}) {
+      if (layer->centerX < 0) {
+        continue;
+      }
+      maxExtent = std::max({maxExtent,
+                            layer->centerX, layer->imageWidth - layer->centerX,
+                            layer->centerY, layer->imageHeight - layer->centerY});
+    }
+  }
+  return maxExtent;
+}
+
+bool Sprite::IndexSMXFrames(const u8* data, usize size, std::vector<SMXFrameIndex>* frameIndex) {
+  // Skip the file descriptor and read the header.
+  ByteReader reader(data, size, 4);
   SMXHeader smxHeader;
-  if (fread(&smxHeader, sizeof(SMXHeader), 1, file) != 1) {
+  if (!reader.Read(&smxHeader)) {
     LOG(ERROR) << "Unexpected EOF while trying to read SMXHeader";
     return false;
   }
   
-  frames.resize(smxHeader.numFrames);
+  frameIndex->resize(std::max<int>(0, smxHeader.numFrames));
   for (int frameIdx = 0; frameIdx < smxHeader.numFrames; ++ frameIdx) {
-    Frame& frame = frames[frameIdx];
+    SMXFrameIndex& index = (*frameIndex)[frameIdx];
     
     // Read the frame header.
-    SMXFrameHeader frameHeader;
-    if (fread(&frameHeader, sizeof(SMXFrameHeader), 1, file) != 1) {
+    if (!reader.Read(&index.header)) {
       LOG(ERROR) << "Unexpected EOF while trying to read SMXFrameHeader";
       return false;
     }
     
-    // LOG(INFO) << "Frame has graphic layer: " << frameHeader.HasGraphicLayer();
-    // LOG(INFO) << "Frame has shadow layer: " << frameHeader.HasShadowLayer();
-    // LOG(INFO) << "Frame has outline layer: " << frameHeader.HasOutlineLayer();
-    // LOG(INFO) << "Frame uses 8to5 compression: " << frameHeader.UsesEightToFiveCompression();
-    // LOG(INFO) << "Frame has unknown bridge flag: " << frameHeader.HasUnknownBridgeFlag();
+    // LOG(INFO) << "Frame has graphic layer: " << index.header.HasGraphicLayer();
+    // LOG(INFO) << "Frame has shadow layer: " << index.header.HasShadowLayer();
+    // LOG(INFO) << "Frame has outline layer: " << index.header.HasOutlineLayer();
+    // LOG(INFO) << "Frame uses 8to5 compression: " << index.header.UsesEightToFiveCompression();
+    // LOG(INFO) << "Frame has unknown bridge flag: " << index.header.HasUnknownBridgeFlag();
     
-    // Get the palette for the frame.
-    auto paletteIt = palettes.find(frameHeader.paletteNumber);
-    if (paletteIt == palettes.end()) {
-      LOG(ERROR) << "File references an invalid palette (number: " << frameHeader.paletteNumber << ")";
-      return false;
-    }
-    const Palette& standardPalette = paletteIt->second;
-    
-    // Read graphic layer
-    if (frameHeader.HasGraphicLayer()) {
-      if (!LoadSMXLayer(
-          frameHeader.UsesEightToFiveCompression(),
-          standardPalette,
-          SMXLayerType::Graphic,
-          &frame.graphic,
-          &frame.rowEdges,
-          file)) {
-        LOG(ERROR) << "Reading the graphic layer of frame " << frameIdx << " failed";
-        return false;
-      }
-    }
-    
-    // Read shadow layer
-    if (frameHeader.HasShadowLayer()) {
-      std::vector<SMPLayerRowEdge> rowEdges;
-      if (!LoadSMXLayer(
-          frameHeader.UsesEightToFiveCompression(),
-          standardPalette,
-          SMXLayerType::Shadow,
-          &frame.shadow,
-          &rowEdges,
-          file)) {
-        LOG(ERROR) << "Reading the shadow layer of frame " << frameIdx << " failed";
-        return false;
+    // Record the layer offsets. The layers are stored in this order.
+    const bool hasLayer[3] = {index.header.HasGraphicLayer(), index.header.HasShadowLayer(), index.header.HasOutlineLayer()};
+    for (int layerType = 0; layerType < 3; ++ layerType) {
+      if (!hasLayer[layerType]) {
+        index.layerOffsets[layerType] = 0;
+        continue;
       }
       
-      InpaintShadowBehindGraphic(&frame.shadow, frame.graphic);
-    }
-    
-    // Read outline layer
-    if (frameHeader.HasOutlineLayer()) {
-      std::vector<SMPLayerRowEdge> rowEdges;
-      if (!LoadSMXLayer(
-          frameHeader.UsesEightToFiveCompression(),
-          standardPalette,
-          SMXLayerType::Outline,
-          &frame.outline,
-          &rowEdges,
-          file)) {
-        LOG(ERROR) << "Reading the outline layer of frame " << frameIdx << " failed";
+      index.layerOffsets[layerType] = reader.Offset();
+      if (!SkipSMXLayer(static_cast<SMXLayerType>(layerType), &reader)) {
+        LOG(ERROR) << "Unexpected EOF in layer " << layerType << " of frame " << frameIdx;
         return false;
       }
-      
-      PaintOutlineIntoGraphic(&frame.graphic, frame.outline);
-      frame.outline.image = QImage();  // unload outline image data
     }
   }
   
   return true;
 }
 
-bool Sprite::LoadFromSMPFile(FILE* file, const Palettes& palettes) {
-  SMPHeader smpHeader;
-  if (fread(&smpHeader, sizeof(SMPHeader), 1, file) != 1) {
-    LOG(ERROR) << "Unexpected EOF while trying to read SMPHeader";
+bool Sprite::DecodeSMXFrame(const u8* data, usize size, const SMXFrameIndex& frameIndex, const Palettes& palettes, Frame* frame) {
+  const SMXFrameHeader& frameHeader = frameIndex.header;
+  
+  // Get the palette for the frame.
+  auto paletteIt = palettes.find(frameHeader.paletteNumber);
+  if (paletteIt == palettes.end()) {
+    LOG(ERROR) << "File references an invalid palette (number: " << frameHeader.paletteNumber << ")";
     return false;
   }
+  const Palette& standardPalette = paletteIt->second;
   
-  // Read frame offsets.
-  std::vector<u32> frameOffsets(smpHeader.numFrames);
-  if (fread(frameOffsets.data(), sizeof(u32), smpHeader.numFrames, file) != smpHeader.numFrames) {
-    LOG(ERROR) << "Unexpected EOF while trying to read SMP frame offsets";
-    return false;
+  // Read graphic layer
+  if (frameHeader.HasGraphicLayer()) {
+    ByteReader reader(data, size, frameIndex.layerOffsets[static_cast<int>(SMXLayerType::Graphic)]);
+    if (!LoadSMXLayer(
+        frameHeader.UsesEightToFiveCompression(),
+        standardPalette,
+        SMXLayerType::Graphic,
+        &frame->graphic,
+        &frame->rowEdges,
+        &reader)) {
+      LOG(ERROR) << "Reading the graphic layer failed";
+      return false;
+    }
   }
   
-  frames.resize(smpHeader.numFrames);
-  for (usize frameIdx = 0; frameIdx < smpHeader.numFrames; ++ frameIdx) {
-    Frame& frame = frames[frameIdx];
-    fseek(file, frameOffsets[frameIdx], SEEK_SET);
+  // Read shadow layer
+  if (frameHeader.HasShadowLayer()) {
+    ByteReader reader(data, size, frameIndex.layerOffsets[static_cast<int>(SMXLayerType::Shadow)]);
+    std::vector<SMPLayerRowEdge> rowEdges;
+    if (!LoadSMXLayer(
+        frameHeader.UsesEightToFiveCompression(),
+        standardPalette,
+        SMXLayerType::Shadow,
+        &frame->shadow,
+        &rowEdges,
+        &reader)) {
+      LOG(ERROR) << "Reading the shadow layer failed";
+      return false;
+    }
     
-    // Read frame header
-    u32 unused[7];
-    if (fread(unused, sizeof(u32), 7, file) != 7) {
-      LOG(ERROR) << "Unexpected EOF while trying to read unused data in SMP";
+    InpaintShadowBehindGraphic(&frame->shadow, frame->graphic);
+  }
+  
+  // Read outline layer
+  if (frameHeader.HasOutlineLayer()) {
+    ByteReader reader(data, size, frameIndex.layerOffsets[static_cast<int>(SMXLayerType::Outline)]);
+    std::vector<SMPLayerRowEdge> rowEdges;
+    if (!LoadSMXLayer(
+        frameHeader.UsesEightToFiveCompression(),
+        standardPalette,
+        SMXLayerType::Outline,
+        &frame->outline,
+        &rowEdges,
+        &reader)) {
+      LOG(ERROR) << "Reading the outline layer failed";
       return false;
     }
     
-    u32 numLayers;
-    if (fread(&numLayers, sizeof(u32), 1, file) != 1) {
-      LOG(ERROR) << "Unexpected EOF while trying to read SMP frameHeader";
+    PaintOutlineIntoGraphic(&frame->graphic, frame->outline);
+    frame->outline.image = QImage();  // unload outline image data
+  }
+  
+  return true;
+}
+
+bool Sprite::LoadFromSMXFile(const u8* data, usize size, const Palettes& palettes) {
+  std::vector<SMXFrameIndex> frameIndex;
+  if (!IndexSMXFrames(data, size, &frameIndex)) {
+    return false;
+  }
+  
+  frames.resize(frameIndex.size());
+  return DecodeFramesInParallel(frames.size(), [&](int frameIdx) {
+    if (!DecodeSMXFrame(data, size, frameIndex[frameIdx], palettes, &frames[frameIdx])) {
+      LOG(ERROR) << "Decoding frame " << frameIdx << " failed";
       return false;
     }
+    return true;
+  });
+}
+
+/// Decodes the SMP frame starting at the given offset within the file data.
+static bool DecodeSMPFrame(const u8* data, usize size, u32 frameOffset, const Palettes& palettes, Sprite::Frame* frame) {
+  ByteReader reader(data, size);
+  
+  // Read frame header
+  u32 unused[7];
+  if (!reader.Seek(frameOffset) || !reader.ReadArray(unused, 7)) {
+    LOG(ERROR) << "Unexpected EOF while trying to read unused data in SMP";
+    return false;
+  }
+  
+  u32 numLayers;
+  if (!reader.Read(&numLayers)) {
+    LOG(ERROR) << "Unexpected EOF while trying to read SMP frameHeader";
+    return false;
+  }
+  
+  // Read layer headers
+  if (numLayers > reader.Remaining() / sizeof(SMPLayerHeader)) {
+    LOG(ERROR) << "Unexpected EOF while trying to read SMPLayerHeaders";
+    return false;
+  }
+  std::vector<SMPLayerHeader> layerHeaders(numLayers);
+  reader.ReadArray(layerHeaders.data(), numLayers);
+  
+  for (usize layer = 0; layer < numLayers; ++ layer) {
+    const SMPLayerHeader& layerHeader = layerHeaders[layer];
     
-    // Read layer headers
-    std::vector<SMPLayerHeader> layerHeaders(numLayers);
-    if (fread(layerHeaders.data(), sizeof(SMPLayerHeader), numLayers, file) != numLayers) {
-      LOG(ERROR) << "Unexpected EOF while trying to read SMPLayerHeaders";
+    // LOG(WARNING) << "Layer width: " << layerHeader.width;
+    // LOG(WARNING) << "Layer height: " << layerHeader.height;
+    // LOG(WARNING) << "Layer hotspot x: " << layerHeader.hotspotX;
+    // LOG(WARNING) << "Layer hotspot y: " << layerHeader.hotspotY;
+    
+    // Read the row edge data.
+    constexpr int pixelBorder = 0;
+    if (!reader.Seek(static_cast<usize>(frameOffset) + layerHeader.outlineTableOffset) ||
+        layerHeader.height > reader.Remaining() / sizeof(SMPLayerRowEdge)) {
+      LOG(ERROR) << "Unexpected EOF while trying to read the SMPLayerRowEdges";
       return false;
     }
+    std::vector<SMPLayerRowEdge> rowEdges(layerHeader.height);
+    reader.ReadArray(rowEdges.data(), layerHeader.height);
     
-    for (usize layer = 0; layer < numLayers; ++ layer) {
-      const SMPLayerHeader& layerHeader = layerHeaders[layer];
-      fseek(file, frameOffsets[frameIdx] + layerHeader.outlineTableOffset, SEEK_SET);
+    if (layerHeader.layerType == 0x02) {
+      // Graphic layer.
+      Sprite::Frame::Layer* layer = &frame->graphic;
       
-      // LOG(WARNING) << "Layer width: " << layerHeader.width;
-      // LOG(WARNING) << "Layer height: " << layerHeader.height;
-      // LOG(WARNING) << "Layer hotspot x: " << layerHeader.hotspotX;
-      // LOG(WARNING) << "Layer hotspot y: " << layerHeader.hotspotY;
+      layer->centerX = layerHeader.hotspotX;
+      layer->centerY = layerHeader.hotspotY;
       
-      // Read the row edge data.
-      constexpr int pixelBorder = 0;
-      std::vector<SMPLayerRowEdge> rowEdges(layerHeader.height);
-      for (int i = 0; i < pixelBorder; ++ i) {
-        rowEdges[i].leftSpace = 0xFFFF;
-        rowEdges[i].rightSpace = 0xFFFF;
-        rowEdges[rowEdges.size() - 1 - i].leftSpace = 0xFFFF;
-        rowEdges[rowEdges.size() - 1 - i].rightSpace = 0xFFFF;
+      // LOG(WARNING) << "Gfx layer sized " << layerHeader.width << " x " << layerHeader.height;
+      
+      u32 firstCommandOffset;
+      if (!reader.Seek(static_cast<usize>(frameOffset) + layerHeader.cmdTableOffset) ||
+          !reader.Read(&firstCommandOffset)) {
+        LOG(ERROR) << "Unexpected EOF while trying to read smpCommandOffsets";
+        return false;
       }
-      for (usize row = 0; row < layerHeader.height - 2 * pixelBorder; ++ row) {
-        if (fread(&rowEdges[row + pixelBorder], sizeof(SMPLayerRowEdge), 1, file) != 1) {
-          LOG(ERROR) << "Unexpected EOF while trying to read SMPLayerRowEdge for row " << row;
-          return false;
-        }
-        // LOG(INFO) << "Row edge: L: " << rowEdges[row].leftSpace << " R: " << rowEdges[row].rightSpace;
+      
+      // NOTE: We only seek to the first offset and then assume that the following rows are stored sequentially.
+      if (!reader.Seek(static_cast<usize>(frameOffset) + firstCommandOffset)) {
+        LOG(ERROR) << "Invalid SMP command offset";
+        return false;
       }
       
-      if (layerHeader.layerType == 0x02) {
-        // Graphic layer.
-        Sprite::Frame::Layer* layer = &frame.graphic;
-        
-        layer->centerX = layerHeader.hotspotX;
-        layer->centerY = layerHeader.hotspotY;
-        
-        // LOG(WARNING) << "Gfx layer sized " << layerHeader.width << " x " << layerHeader.height;
+      constexpr bool ignoreAlpha = true;  /*layerType == SMXLayerType::Graphic*/
+      
+      // The palette of the last pixel, which is very likely to be re-used for the next pixel.
+      int lastPaletteIndex = -1;
+      const Palette* lastPalette = nullptr;
+      
+      // Build the image.
+      QImage graphic(layerHeader.width, layerHeader.height, QImage::Format_ARGB32);
+      
+      for (usize row = 0; row < layerHeader.height; ++ row) {
+        QRgb* out = reinterpret_cast<QRgb*>(graphic.scanLine(row));
         
-        fseek(file, frameOffsets[frameIdx] + layerHeader.cmdTableOffset, SEEK_SET);
+        // Check for skipped rows
+        const SMPLayerRowEdge& edge = rowEdges[row];
+        if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
+          // Row is completely transparent
+          memset(out, 0, layerHeader.width * sizeof(QRgb));
+          continue;
+        }
         
-        std::vector<u32> smpCommandOffsets(layerHeader.height);
-        if (fread(smpCommandOffsets.data(), sizeof(u32), layerHeader.height, file) != layerHeader.height) {
-          LOG(ERROR) << "Unexpected EOF while trying to read smpCommandOffsets";
+        // Left edge skip
+        u32 col = edge.leftSpace + pixelBorder;
+        if (col > layerHeader.width) {
+          LOG(ERROR) << "Row " << row << ": Left edge (" << edge.leftSpace << ") exceeds the layer width (" << layerHeader.width << ")";
           return false;
         }
+        memset(out, 0, col * sizeof(QRgb));
         
-        // NOTE: We only seek to the first offset and then assume that the following rows are stored sequentially.
-        fseek(file, frameOffsets[frameIdx] + smpCommandOffsets[0], SEEK_SET);
-        
-        constexpr bool ignoreAlpha = true;  /*layerType == SMXLayerType::Graphic*/
-        
-        // Build the image.
-        QImage graphic(layerHeader.width, layerHeader.height, QImage::Format_ARGB32);
-        
-        for (usize row = 0; row < layerHeader.height; ++ row) {
-          QRgb* out = reinterpret_cast<QRgb*>(graphic.scanLine(row));
+        while (true) {
+          // Read the next command.
+          u8 command;
+          if (!reader.Read(&command)) {
+            LOG(ERROR) << "Unexpected EOF while trying to read SMP drawing command";
+            return false;
+          }
           
-          // Check for skipped rows
-          const SMPLayerRowEdge& edge = rowEdges[row];
-          if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
-            // Row is completely transparent
-            for (usize col = 0; col < layerHeader.width; ++ col) {
-              *out++ = qRgba(0, 0, 0, 0);
+          u8 commandCode = command & 0b11;
+          if (commandCode == 0b11) {
+            // End of row.
+            if (col + edge.rightSpace + pixelBorder != layerHeader.width) {
+              LOG(WARNING) << "Row " << row << ": Pixel count does not match expectation (col: " << col
+                            << ", edge.rightSpace: " << edge.rightSpace << ", layerHeader.width: " << layerHeader.width << ")";
             }
-            continue;
+            memset(out + col, 0, (layerHeader.width - col) * sizeof(QRgb));
+            break;
           }
           
-          // Left edge skip
-          for (int col = 0; col < edge.leftSpace + pixelBorder; ++ col) {
-            *out++ = qRgba(0, 0, 0, 0);
+          u8 count = (command >> 2) + 1;
+          if (col + count > layerHeader.width) {
+            LOG(ERROR) << "Row " << row << ": Pixels exceed the layer width (" << layerHeader.width << ")";
+            return false;
           }
-          u32 col = edge.leftSpace + pixelBorder;
           
-          while (true) {
-            // Read the next command.
-            u8 command;
-            if (fread(&command, sizeof(u8), 1, file) != 1) {
-              LOG(ERROR) << "Unexpected EOF while trying to read SMP drawing command";
+          if (commandCode == 0b00) {
+            // Draw *count* transparent pixels.
+            memset(out + col, 0, count * sizeof(QRgb));
+          } else {  // if (commandCode == 0b01 || commandCode == 0b10)
+            const SMPPixel* pixels = reinterpret_cast<const SMPPixel*>(reader.Take(count * sizeof(SMPPixel)));
+            if (!pixels) {
+              LOG(ERROR) << "Unexpected EOF while trying to read an SMPPixel";
               return false;
             }
             
-            u8 commandCode = command & 0b11;
-            if (commandCode == 0b00) {
-              // Draw *count* transparent pixels.
-              u8 count = (command >> 2) + 1;
-              for (int i = 0; i < count; ++ i) {
-                *out++ = qRgba(0, 0, 0, 0);
-              }
-              col += count;
-            } else if (commandCode == 0b01 || commandCode == 0b10) {
-              u8 count = (command >> 2) + 1;
+            for (int i = 0; i < count; ++ i) {
+              const SMPPixel& pixel = pixels[i];
+              int paletteIndex = pixel.palette >> 2;
+              int paletteSection = pixel.palette & 0b11;
               
-              for (int i = 0; i < count; ++ i) {
-                SMPPixel pixel;
-                if (fread(&pixel, sizeof(SMPPixel), 1, file) != 1) {
-                  LOG(ERROR) << "Unexpected EOF while trying to read an SMPPixel";
-                  return false;
+              const Palette* palette = nullptr;
+              if (commandCode == 0b01) {
+                if (paletteIndex != lastPaletteIndex) {
+                  auto paletteIt = palettes.find(paletteIndex);
+                  if (paletteIt == palettes.end()) {
+                    LOG(ERROR) << "File references an invalid palette (number: " << paletteIndex << ")";
+                    return false;
+                  }
+                  lastPaletteIndex = paletteIndex;
+                  lastPalette = &paletteIt->second;
                 }
-                
-                int paletteIndex = pixel.palette >> 2;
-                int paletteSection = pixel.palette & 0b11;
-                
-                // TODO: If we load a lot of SMPs, we might want to optimize the unordered_map access here (cache the last used palette and re-use it if it is the same for the next pixel)
-                *out = GetPalettedPixel((commandCode == 0b01) ? &palettes.at(paletteIndex) : nullptr, paletteSection, pixel.index, ignoreAlpha);
-                ++ out;
-              }
-              col += count;
-            } else if (commandCode == 0b11) {
-              // End of row.
-              if (col + edge.rightSpace + pixelBorder != layerHeader.width) {
-                LOG(WARNING) << "Row " << row << ": Pixel count does not match expectation (col: " << col
-                              << ", edge.rightSpace: " << edge.rightSpace << ", layerHeader.width: " << layerHeader.width << ")";
+                palette = lastPalette;
               }
-              for (; col < layerHeader.width; ++ col) {
-                *out++ = qRgba(0, 0, 0, 0);
-              }
-              break;
+              out[col + i] = GetPalettedPixel(palette, paletteSection, pixel.index, ignoreAlpha);
             }
           }
+          col += count;
         }
-        
-        layer->image = graphic;
-        layer->imageWidth = layer->image.width();
-        layer->imageHeight = layer->image.height();
-      } else if (layerHeader.layerType == 0x04) {
-        // Shadow layer.
-        // TODO: Not implemented yet.
-      } else if (layerHeader.layerType == 0x08 || layerHeader.layerType == 0x10) {
-        // Outline layer.
-        // TODO: Not implemented yet.
-      } else {
-        LOG(ERROR) << "Unknown layer type in SMP file: " << layerHeader.layerType;
       }
+      
+      layer->image = graphic;
+      layer->imageWidth = layer->image.width();
+      layer->imageHeight = layer->image.height();
+    } else if (layerHeader.layerType == 0x04) {
+      // Shadow layer.
+      // TODO: Not implemented yet.
+    } else if (layerHeader.layerType == 0x08 || layerHeader.layerType == 0x10) {
+      // Outline layer.
+      // TODO: Not implemented yet.
+    } else {
+      LOG(ERROR) << "Unknown layer type in SMP file: " << layerHeader.layerType;
     }
   }
   
   return true;
 }
 
+bool Sprite::LoadFromSMPFile(const u8* data, usize size, const Palettes& palettes) {
+  // Skip the file descriptor and read the header.
+  ByteReader reader(data, size, 4);
+  SMPHeader smpHeader;
+  if (!reader.Read(&smpHeader)) {
+    LOG(ERROR) << "Unexpected EOF while trying to read SMPHeader";
+    return false;
+  }
+  
+  // Read frame offsets. These form the frame index.
+  if (smpHeader.numFrames > reader.Remaining() / sizeof(u32)) {
+    LOG(ERROR) << "Unexpected EOF while trying to read SMP frame offsets";
+    return false;
+  }
+  std::vector<u32> frameOffsets(smpHeader.numFrames);
+  reader.ReadArray(frameOffsets.data(), smpHeader.numFrames);
+  
+  frames.resize(smpHeader.numFrames);
+  return DecodeFramesInParallel(frames.size(), [&](int frameIdx) {
+    return DecodeSMPFrame(data, size, frameOffsets[frameIdx], palettes, &frames[frameIdx]);
+  });
+}
+
 bool Sprite::LoadFromPNGFiles(const char* path) {
   int frameIdx = 0;
   while (true) {
     char pathBuffer[512];
     sprintf(pathBuffer, path, frameIdx);
-    if (!std::filesystem::exists(pathBuffer)) {
+    if (!GameFileExists(pathBuffer)) {
       break;
     }
     
     // Load the frame from the PNG image.
     // We assume that the sprite center is in the center of the image.
-    mango::Bitmap bitmap(pathBuffer, mango::Format(32, mango::Format::UNORM, mango::Format::BGRA, 8, 8, 8, 8));
+    mango::Bitmap bitmap = LoadBitmapFile(pathBuffer, mango::Format(32, mango::Format::UNORM, mango::Format::BGRA, 8, 8, 8, 8));
     
     // Get the bounding rect of pixels having alpha > 0
     int minX = std::numeric_limits<int>::max();
@@ -1009,6 +997,12 @@ bool Sprite::LoadFromPNGFiles(const char* path) {
 }
 
 
+SpriteAndTextures::~SpriteAndTextures() {
+  SpriteAtlasManager::Instance().Release(SpriteAtlas::Mode::Graphic, &graphicAllocation);
+  SpriteAtlasManager::Instance().Release(SpriteAtlas::Mode::Shadow, &shadowAllocation);
+}
+
+
 SpriteAndTextures* SpriteManager::GetOrLoad(const char* path, const char* cachePath, ColorDilationShader* colorDilationShader, const Palettes& palettes) {
   auto it = loadedSprites.find(path);
   if (it != loadedSprites.end()) {
@@ -1019,8 +1013,9 @@ SpriteAndTextures* SpriteManager::GetOrLoad(const char* path, const char* cacheP
   // Load the sprite.
   SpriteAndTextures* newSprite = new SpriteAndTextures();
   newSprite->referenceCount = 1;
-  if (!LoadSpriteAndTexture(path, cachePath, GL_CLAMP_TO_EDGE, colorDilationShader, &newSprite->sprite, &newSprite->graphicTexture, &newSprite->shadowTexture, palettes)) {
+  if (!LoadSpriteAndTexture(path, cachePath, colorDilationShader, newSprite, palettes)) {
     LOG(ERROR) << "Failed to load sprite: " << path;
+    delete newSprite;
     return nullptr;
   }
   
@@ -1071,7 +1066,7 @@ bool DilateColorsIntoTransparentRegions(const Texture& srcTexture, int wrapMode,
   
   // Set destTexture as our colour attachement #0
   f->glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, destTexture->GetId(), 0);
-
+  
   // Set the list of draw buffers.
   GLenum drawBuffers[1] = {GL_COLOR_ATTACHMENT0};
   f->glDrawBuffers(1, drawBuffers);
@@ -1116,9 +1111,8 @@ bool DilateColorsIntoTransparentRegions(const Texture& srcTexture, int wrapMode,
 }
 
 
-bool LoadSpriteAndTexture(const char* path, const char* cachePath, int wrapMode, ColorDilationShader* colorDilationShader, Sprite* sprite, Texture* graphicTexture, Texture* shadowTexture, const Palettes& palettes) {
-  // TODO magFilter and minFilter are unused here
-  
+bool LoadSpriteAndTexture(const char* path, const char* cachePath, ColorDilationShader* colorDilationShader, SpriteAndTextures* spriteAndTextures, const Palettes& palettes) {
+  Sprite* sprite = &spriteAndTextures->sprite;
   if (!sprite->LoadFromFile(path, palettes)) {
     LOG(ERROR) << "Failed to load sprite from " << path;
     return false;
@@ -1132,7 +1126,7 @@ bool LoadSpriteAndTexture(const char* path, const char* cachePath, int wrapMode,
       continue;
     }
     SpriteAtlas::Mode mode = (graphicOrShadow == 0) ? SpriteAtlas::Mode::Graphic : SpriteAtlas::Mode::Shadow;
-    Texture* texture = (graphicOrShadow == 0) ? graphicTexture : shadowTexture;
+    SpriteAtlasAllocation* allocation = (graphicOrShadow == 0) ? &spriteAndTextures->graphicAllocation : &spriteAndTextures->shadowAllocation;
     
     SpriteAtlas atlas(mode);
     atlas.AddSprite(sprite);
@@ -1156,51 +1150,22 @@ bool LoadSpriteAndTexture(const char* path, const char* cachePath, int wrapMode,
     }
     
     if (!loaded) {
-      int chosenWidth = -1;
-      int chosenHeight = -1;
+      int maxTextureSize = SpriteAtlasManager::Instance().GetMaxTextureSize();
+      bool built;
       if (sprite->NumFrames() == 1) {
         // Special case for a single frame: Use the sprite size (plus the border) directly as texture size.
         Sprite::Frame::Layer& layer = ((graphicOrShadow == 0) ? sprite->frame(0).graphic : sprite->frame(0).shadow);
-        chosenWidth = layer.image.width() + 2 * pixelBorder;
-        chosenHeight = layer.image.height() + 2 * pixelBorder;
+        built = atlas.BuildAtlas(layer.image.width() + 2 * pixelBorder, layer.image.height() + 2 * pixelBorder, pixelBorder);
       } else {
-        int textureSize = 2048;
-        int largestTooSmallSize = -1;
-        int smallestAcceptableSize = -1;
-        for (int attempt = 0; attempt < 8; ++ attempt) {
-          if (!atlas.BuildAtlas(textureSize, textureSize, pixelBorder)) {
-            // The size is too small.
-            // LOG(INFO) << "Size " << textureSize << " is too small.";
-            largestTooSmallSize = textureSize;
-            if (smallestAcceptableSize >= 0) {
-              textureSize = (largestTooSmallSize + smallestAcceptableSize) / 2;
-            } else {
-              textureSize = 2 * largestTooSmallSize;
-            }
-          } else {
-            // The size is large enough.
-            // LOG(INFO) << "Size " << textureSize << " is okay.";
-            smallestAcceptableSize = textureSize;
-            if (smallestAcceptableSize >= 0) {
-              textureSize = (largestTooSmallSize + smallestAcceptableSize) / 2;
-            } else {
-              textureSize = smallestAcceptableSize / 2;
-            }
-          }
-        }
-        chosenWidth = smallestAcceptableSize;
-        chosenHeight = smallestAcceptableSize;
+        // The skyline packing determines the size with a single pass, and MaxRects is only
+        // used once at this size to pack the frames more densely.
+        built = atlas.BuildAtlasWithAutomaticSize(pixelBorder, maxTextureSize, /*finalPackWithMaxRects*/ true);
       }
-      if (chosenWidth <= 0 || chosenHeight <= 0) {
-        LOG(ERROR) << "Unable to find a texture size which all animation frames can be packed into.";
-        return false;
-      }
-      LOG(INFO) << "Atlas for " << path << " uses size: " << chosenWidth << " x " << chosenHeight;
-      
-      if (!atlas.BuildAtlas(chosenWidth, chosenHeight, pixelBorder)) {
-        LOG(ERROR) << "Unexpected error while building an atlas image (1).";
+      if (!built) {
+        LOG(ERROR) << "Unable to pack the animation frames of " << path << " into a texture of at most " << maxTextureSize << " x " << maxTextureSize << " pixels (GL_MAX_TEXTURE_SIZE).";
         return false;
       }
+      LOG(INFO) << "Atlas for " << path << " uses size: " << atlas.GetWidth() << " x " << atlas.GetHeight();
     }
     
     QImage atlasImage = atlas.RenderAtlas();
@@ -1214,37 +1179,49 @@ bool LoadSpriteAndTexture(const char* path, const char* cachePath, int wrapMode,
       }
     }
     
+    // Reserve space for the atlasImage in the shared sprite textures.
+    if (!SpriteAtlasManager::Instance().Allocate(mode, atlasImage.width(), atlasImage.height(), allocation)) {
+      LOG(ERROR) << "Failed to allocate texture space for the sprite atlas of " << path;
+      return false;
+    }
+    
+    // Make the layer positions relative to the shared texture.
+    for (int frameIdx = 0; frameIdx < sprite->NumFrames(); ++ frameIdx) {
+      Sprite::Frame::Layer& layer = (graphicOrShadow == 0) ? sprite->frame(frameIdx).graphic : sprite->frame(frameIdx).shadow;
+      layer.atlasX += allocation->x;
+      layer.atlasY += allocation->y;
+      layer.atlasLayer = allocation->layer;
+    }
+    
     // Transfer the atlasImage to the GPU.
     if (graphicOrShadow == 0) {
       // For graphic sprites, dilate the colors by one pixel into transparent areas
       // to prevent the rendering interpolating the colors towards black at the sprite boundary.
       Texture temporaryTexture;
-      temporaryTexture.Load(atlasImage, wrapMode, GL_NEAREST, GL_NEAREST);
+      temporaryTexture.Load(atlasImage, GL_CLAMP_TO_EDGE, GL_NEAREST, GL_NEAREST);
+      
+      Texture dilatedTexture;
+      DilateColorsIntoTransparentRegions(temporaryTexture, GL_CLAMP_TO_EDGE, GL_NEAREST, GL_NEAREST, colorDilationShader, &dilatedTexture);
       
-      DilateColorsIntoTransparentRegions(temporaryTexture, wrapMode, GL_NEAREST, GL_NEAREST, colorDilationShader, texture);
+      allocation->texture->CopyToArrayLayerRegion(dilatedTexture, allocation->x, allocation->y, allocation->layer);
     } else {
-      texture->Load(atlasImage, wrapMode, GL_LINEAR, GL_LINEAR);
+      allocation->texture->LoadArrayLayerRegion(atlasImage, allocation->x, allocation->y, allocation->layer);
     }
   }
   
   return true;
 }
 
-void DrawSprite(
+void WriteSpriteVertex(
     const Sprite& sprite,
-    Texture& texture,
-    SpriteShader* spriteShader,
     const QPointF& centerProjectedCoord,
-    float* viewMatrix,
-    float zoom,
-    int widgetWidth,
-    int widgetHeight,
     int frameNumber,
     bool shadow,
     bool outline,
     QRgb outlineOrModulationColor,
     int playerIndex,
-    float scaling) {
+    float scaling,
+    u8* vertex) {
   const Sprite::Frame::Layer& layer = shadow ? sprite.frame(frameNumber).shadow : sprite.frame(frameNumber).graphic;
   
   bool isGraphic = !shadow && !outline;
@@ -1255,17 +1232,15 @@ void DrawSprite(
   //   // TODO: Is this worth implementing? It will complicate the shader a little.
   // }
   
-  texture.DrawCallBuffer().resize(texture.DrawCallBuffer().size() + spriteShader->GetVertexSize());
-  float* data = reinterpret_cast<float*>(texture.DrawCallBuffer().data() + texture.DrawCallBuffer().size() - spriteShader->GetVertexSize());
+  float* data = reinterpret_cast<float*>(vertex);
   
-  // in_position
-  constexpr float kOffScreenDepthBufferExtent = 1000;
+  // in_position (the top-left corner in projected coordinates, and the y-coordinate that determines the depth)
   data[0] = static_cast<float>(centerProjectedCoord.x() + scaling * (-layer.centerX + positiveOffset));
   data[1] = static_cast<float>(centerProjectedCoord.y() + scaling * (-layer.centerY + positiveOffset));
-  data[2] = static_cast<float>(1.f - 2.f * (kOffScreenDepthBufferExtent + viewMatrix[0] * centerProjectedCoord.y() + viewMatrix[2]) / (2.f * kOffScreenDepthBufferExtent + widgetHeight));
-  // in_size
-  data[3] = scaling * zoom * 2.f * (layer.imageWidth + 2 * negativeOffset) / static_cast<float>(widgetWidth);
-  data[4] = scaling * zoom * 2.f * (layer.imageHeight + 2 * negativeOffset) / static_cast<float>(widgetHeight);
+  data[2] = static_cast<float>(centerProjectedCoord.y());
+  // in_size (in projected coordinates)
+  data[3] = scaling * (layer.imageWidth + 2 * negativeOffset);
+  data[4] = scaling * (layer.imageHeight + 2 * negativeOffset);
   // in_tex_topleft
   u16* u16Data = reinterpret_cast<u16*>(data + 5);
   *u16Data++ = layer.atlasX + positiveOffset;
@@ -1273,9 +1248,12 @@ void DrawSprite(
   // in_tex_bottomright
   *u16Data++ = layer.atlasX + layer.imageWidth + negativeOffset;
   *u16Data++ = layer.atlasY + layer.imageHeight + negativeOffset;
+  // in_layer (followed by two bytes of padding)
+  *u16Data++ = layer.atlasLayer;
+  *u16Data++ = 0;
   // outline: in_playerColor; !outline && !shadow: in_modulationColor; shadow: unused
   if (!shadow) {
-    u8* u8Data = reinterpret_cast<u8*>(data + 7);
+    u8* u8Data = reinterpret_cast<u8*>(data + 8);
     *u8Data++ = qRed(outlineOrModulationColor);
     *u8Data++ = qGreen(outlineOrModulationColor);
     *u8Data++ = qBlue(outlineOrModulationColor);
@@ -1284,3 +1262,32 @@ void DrawSprite(
     }
   }
 }
+
+void DrawSprite(
+    const Sprite& sprite,
+    Texture& texture,
+    SpriteShader* spriteShader,
+    const QPointF& centerProjectedCoord,
+    int frameNumber,
+    bool shadow,
+    bool outline,
+    QRgb outlineOrModulationColor,
+    int playerIndex,
+    float scaling,
+    SpriteVertexArena* arena) {
+  u8* vertex;
+  if (arena) {
+    vertex = arena->Allocate(&texture, spriteShader->GetVertexSize());
+  } else {
+    // Write the vertex directly into the streaming vertex buffer.
+    usize vertexOffset;
+    vertex = spriteShader->GetVertexBuffer()->Allocate(spriteShader->GetVertexSize(), &vertexOffset);
+    if (!vertex) {
+      // The buffer is full for this frame. It will be enlarged at the end of the frame.
+      return;
+    }
+    texture.AddDrawCallVertex(vertexOffset, spriteShader->GetVertexSize());
+  }
+  
+  WriteSpriteVertex(sprite, centerProjectedCoord, frameNumber, shadow, outline, outlineOrModulationColor, playerIndex, scaling, vertex);
+}
@@ -14,10 +14,13 @@
 
 #include "FreeAge/common/free_age.hpp"
 #include "FreeAge/common/logging.hpp"
+#include "FreeAge/client/sprite_atlas.hpp"
 #include "FreeAge/client/texture.hpp"
 
 class ColorDilationShader;
 class SpriteShader;
+class SpriteVertexArena;
+struct SMXFrameIndex;
 class Texture;
 
 
@@ -50,6 +53,7 @@ class Sprite {
       // The layer's position in the texture atlas.
       int atlasX;
       int atlasY;
+      int atlasLayer = 0;
       bool rotated;
     };
     
@@ -66,6 +70,19 @@ class Sprite {
   
   bool LoadFromFile(const char* path, const Palettes& palettes);
   
+  /// Creates an index of the frames in the given SMX file data, which must include the
+  /// file descriptor. This only parses the headers and does not decode any layer data.
+  static bool IndexSMXFrames(const u8* data, usize size, std::vector<SMXFrameIndex>* frameIndex);
+  
+  /// Decodes a single frame of the given SMX file data, using the frame's entry in the index
+  /// created by IndexSMXFrames(). This allows to decode frames on demand. Different frames
+  /// may be decoded in parallel.
+  static bool DecodeSMXFrame(const u8* data, usize size, const SMXFrameIndex& frameIndex, const Palettes& palettes, Frame* frame);
+  
+  /// Returns the maximum distance of any pixel of any frame's graphic or shadow layer from
+  /// the sprite center, along either axis (in projected coordinates).
+  int ComputeMaxExtent() const;
+  
   inline bool HasShadow() const { return frames.front().shadow.centerX >= 0; }
   inline bool HasOutline() const { return frames.front().outline.centerX >= 0; }
   
@@ -79,9 +96,12 @@ class Sprite {
     return frames[index];
   }
   
+  /// Replaces the sprite's frames, for example to create synthetic sprites for testing.
+  inline void SetFrames(std::vector<Frame>&& newFrames) { frames = std::move(newFrames); }
+  
  private:
-  bool LoadFromSMXFile(FILE* file, const Palettes& palettes);
-  bool LoadFromSMPFile(FILE* file, const Palettes& palettes);
+  bool LoadFromSMXFile(const u8* data, usize size, const Palettes& palettes);
+  bool LoadFromSMPFile(const u8* data, usize size, const Palettes& palettes);
   bool LoadFromPNGFiles(const char* path);
   
   std::vector<Frame> frames;
@@ -89,9 +109,21 @@ class Sprite {
 
 
 struct SpriteAndTextures {
+  /// Releases the sprite's texture allocations.
+  ~SpriteAndTextures();
+  
+  /// Returns the texture containing the sprite's graphic (and outline) frames.
+  /// This texture is usually shared with many other sprites.
+  inline Texture& graphicTexture() { return *graphicAllocation.texture; }
+  
+  /// Returns the texture containing the sprite's shadow frames.
+  /// This texture is usually shared with many other sprites.
+  /// Must only be called if the sprite has a shadow.
+  inline Texture& shadowTexture() { return *shadowAllocation.texture; }
+  
   Sprite sprite;
-  Texture graphicTexture;
-  Texture shadowTexture;
+  SpriteAtlasAllocation graphicAllocation;
+  SpriteAtlasAllocation shadowAllocation;
   
   int referenceCount;
 };
@@ -122,25 +154,41 @@ class SpriteManager {
 };
 
 
-/// Convenience function which loads a sprite and creates a texture atlas (just) for it.
-/// Attempts to find a good texture size automatically.
-bool LoadSpriteAndTexture(const char* path, const char* cachePath, int wrapMode, ColorDilationShader* colorDilationShader, Sprite* sprite, Texture* graphicTexture, Texture* shadowTexture, const Palettes& palettes);
+/// Convenience function which loads a sprite, creates a texture atlas for it,
+/// and places this atlas into the textures managed by the SpriteAtlasManager.
+/// Attempts to find a good atlas size automatically.
+bool LoadSpriteAndTexture(const char* path, const char* cachePath, ColorDilationShader* colorDilationShader, SpriteAndTextures* spriteAndTextures, const Palettes& palettes);
+
+/// Writes the SpriteShader vertex (of SpriteShader::GetVertexSize() bytes) for rendering the given
+/// sprite frame to @p vertex. The vertex does not depend on the view, so it remains valid as long
+/// as the sprite is rendered in the same way (see StaticSpriteBuffer).
+void WriteSpriteVertex(
+    const Sprite& sprite,
+    const QPointF& centerProjectedCoord,
+    int frameNumber,
+    bool shadow,
+    bool outline,
+    QRgb outlineOrModulationColor,
+    int playerIndex,
+    float scaling,
+    u8* vertex);
 
+/// Writes the vertex for rendering the given sprite frame into the shader's vertex buffer
+/// and adds it to the texture's draw calls (see RenderWindow::RenderSprites()).
+/// If an arena is given, the vertex is written into the arena instead; this does not access
+/// any shared state, so it may be done from worker threads.
 void DrawSprite(
     const Sprite& sprite,
     Texture& texture,
     SpriteShader* spriteShader,
     const QPointF& centerProjectedCoord,
-    float* viewMatrix,
-    float zoom,
-    int widgetWidth,
-    int widgetHeight,
     int frameNumber,
     bool shadow,
     bool outline,
     QRgb outlineOrModulationColor,
     int playerIndex,
-    float scaling);
+    float scaling,
+    SpriteVertexArena* arena = nullptr);
 
 
 // Note: SMX / SMP parsing implemented according to:
@@ -235,6 +283,15 @@ enum class SMXLayerType {
   Outline
 };
 
+/// Locates a frame's data within an SMX file (see Sprite::IndexSMXFrames()).
+struct SMXFrameIndex {
+  SMXFrameHeader header;
+  
+  /// Offsets of the frame's layers within the file, indexed by SMXLayerType.
+  /// The offset is 0 if the frame does not have the corresponding layer.
+  usize layerOffsets[3];
+};
+
 #pragma pack(push, 1)
 struct SMPPixel {
   u8  index;
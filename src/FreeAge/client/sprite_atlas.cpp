@@ -4,10 +4,17 @@
 
 #include "FreeAge/client/sprite_atlas.hpp"
 
+#include <algorithm>
+#include <cmath>
+
+#include <QOpenGLFunctions_3_2_Core>
+
 #include "FreeAge/common/logging.hpp"
 #include "FreeAge/client/sprite.hpp"
+#include "FreeAge/client/texture.hpp"
 #include "FreeAge/common/timing.hpp"
 #include "RectangleBinPack/MaxRectsBinPack.h"
+#include "RectangleBinPack/SkylineBinPack.h"
 
 using namespace rbp;
 
@@ -30,26 +37,7 @@ bool SpriteAtlas::BuildAtlas(int width, int height, int borderPixels) {
   // TODO: Should we allow flipping? It is currently not implemented for texture coordinate setting in rendering.
   MaxRectsBinPack packer(width, height, /*allowFlip*/ false);
   
-  // TODO: Right now, we only pack the sprites' main graphics.
-  //       We should pack the shadows too (into another texture, since they are only 8 bit per pixel).
-  
-  int numRects = 0;
-  for (Sprite* sprite : sprites) {
-    numRects += sprite->NumFrames();
-  }
-  
-  std::vector<RectSize> rects(numRects);
-  int index = 0;
-  for (Sprite* sprite : sprites) {
-    for (int frameIdx = 0; frameIdx < sprite->NumFrames(); ++ frameIdx) {
-      const QImage& image =
-          (mode == Mode::Graphic) ?
-          sprite->frame(frameIdx).graphic.image :
-          sprite->frame(frameIdx).shadow.image;
-      rects[index] = RectSize{image.width() + 2 * borderPixels, image.height() + 2 * borderPixels};
-      ++ index;
-    }
-  }
+  std::vector<RectSize> rects = GetFrameRectSizes(borderPixels);
   
   packedRects.clear();
   packedRectIndices.clear();
@@ -60,6 +48,20 @@ bool SpriteAtlas::BuildAtlas(int width, int height, int borderPixels) {
   return rects.empty();
 }
 
+bool SpriteAtlas::BuildAtlasWithAutomaticSize(int borderPixels, int maxExtent, bool finalPackWithMaxRects) {
+  Timer packTimer("SpriteAtlas::BuildAtlasWithAutomaticSize packing");
+  
+  atlasBorderPixels = borderPixels;
+  return PackRectsWithAutomaticSize(
+      GetFrameRectSizes(borderPixels),
+      maxExtent,
+      finalPackWithMaxRects,
+      &atlasWidth,
+      &atlasHeight,
+      &packedRects,
+      &packedRectIndices);
+}
+
 bool SpriteAtlas::Save(const char* path) {
   FILE* file = fopen(path, "wb");
   if (!file) {
@@ -228,3 +230,292 @@ QImage SpriteAtlas::RenderAtlas() {
   
   return atlas;
 }
+
+std::vector<RectSize> SpriteAtlas::GetFrameRectSizes(int borderPixels) {
+  int numRects = 0;
+  for (Sprite* sprite : sprites) {
+    numRects += sprite->NumFrames();
+  }
+  
+  std::vector<RectSize> rects(numRects);
+  int index = 0;
+  for (Sprite* sprite : sprites) {
+    for (int frameIdx = 0; frameIdx < sprite->NumFrames(); ++ frameIdx) {
+      const QImage& image =
+          (mode == Mode::Graphic) ?
+          sprite->frame(frameIdx).graphic.image :
+          sprite->frame(frameIdx).shadow.image;
+      rects[index] = RectSize{image.width() + 2 * borderPixels, image.height() + 2 * borderPixels};
+      ++ index;
+    }
+  }
+  return rects;
+}
+
+
+bool PackRectsWithAutomaticSize(
+    const std::vector<RectSize>& rects,
+    int maxExtent,
+    bool finalPackWithMaxRects,
+    int* width,
+    int* height,
+    std::vector<Rect>* packedRects,
+    std::vector<int>* packedRectIndices) {
+  // The atlases are used as textures with 16-bit texture coordinates.
+  constexpr int kMaxTextureCoordinateExtent = 65535;
+  maxExtent = std::min(maxExtent, kMaxTextureCoordinateExtent);
+  // Factor on the summed area of all rects to account for the space that
+  // will be wasted by the packing.
+  constexpr double kAreaSlackFactor = 1.08;
+  
+  if (rects.empty()) {
+    return false;
+  }
+  
+  double totalArea = 0;
+  int maxRectWidth = 0;
+  int maxRectHeight = 0;
+  for (const RectSize& rect : rects) {
+    totalArea += rect.width * static_cast<double>(rect.height);
+    maxRectWidth = std::max(maxRectWidth, rect.width);
+    maxRectHeight = std::max(maxRectHeight, rect.height);
+  }
+  
+  if (maxRectWidth > maxExtent || maxRectHeight > maxExtent) {
+    return false;
+  }
+  
+  // Estimate the width of a square area that all rects fit into.
+  int estimatedWidth = std::max(maxRectWidth, static_cast<int>(std::ceil(std::sqrt(kAreaSlackFactor * totalArea))));
+  estimatedWidth = std::min(estimatedWidth, maxExtent);
+  
+  // Pack with the skyline packer. Its height is only limited by the maximum extent,
+  // so the used height gives the required height for this width. If the rects do
+  // not fit into this height, retry with a wider area until the maximum extent is reached.
+  constexpr double kWidthGrowthFactor = 1.25;
+  std::vector<RectSize> remainingRects;
+  int usedHeight;
+  while (true) {
+    remainingRects = rects;
+    SkylineBinPack skylinePacker(estimatedWidth, maxExtent);
+    skylinePacker.Insert(remainingRects, *packedRects, *packedRectIndices);
+    if (remainingRects.empty()) {
+      usedHeight = skylinePacker.UsedHeight();
+      break;
+    } else if (estimatedWidth == maxExtent) {
+      return false;
+    }
+    estimatedWidth = std::min(maxExtent, static_cast<int>(std::ceil(kWidthGrowthFactor * estimatedWidth)));
+  }
+  *width = estimatedWidth;
+  *height = std::max(maxRectHeight, usedHeight);
+  
+  if (finalPackWithMaxRects) {
+    // Re-pack with MaxRects with the same size. With the bottom-left rule,
+    // this tends to use less height, which is then cropped off. If MaxRects
+    // fails to pack all rects into this size, the skyline result is kept.
+    std::vector<Rect> maxRectsPackedRects;
+    std::vector<int> maxRectsPackedRectIndices;
+    remainingRects = rects;
+    MaxRectsBinPack maxRectsPacker(*width, *height, /*allowFlip*/ false);
+    maxRectsPacker.Insert(remainingRects, maxRectsPackedRects, maxRectsPackedRectIndices, MaxRectsBinPack::RectBottomLeftRule);
+    if (remainingRects.empty()) {
+      int maxRectsUsedHeight = 0;
+      for (const Rect& rect : maxRectsPackedRects) {
+        maxRectsUsedHeight = std::max(maxRectsUsedHeight, rect.y + rect.height);
+      }
+      *height = maxRectsUsedHeight;
+      *packedRects = std::move(maxRectsPackedRects);
+      *packedRectIndices = std::move(maxRectsPackedRectIndices);
+    }
+  }
+  
+  return true;
+}
+
+bool ReadSpriteAtlasCacheRectSizes(const char* path, std::vector<RectSize>* rectSizes) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  
+  int header[4];  // atlasWidth, atlasHeight, atlasBorderPixels, numRects
+  if (fread(header, sizeof(int), 4, file) != 4 || header[3] < 0) {
+    fclose(file);
+    return false;
+  }
+  
+  rectSizes->resize(header[3]);
+  for (int i = 0; i < header[3]; ++ i) {
+    int rectData[5];  // x, y, width, height, index
+    if (fread(rectData, sizeof(int), 5, file) != 5) {
+      fclose(file);
+      return false;
+    }
+    (*rectSizes)[i] = RectSize{rectData[2], rectData[3]};
+  }
+  
+  fclose(file);
+  return true;
+}
+
+
+SpriteAtlasManager::~SpriteAtlasManager() {
+  // NOTE: The textures cannot be deleted here since there is no OpenGL context anymore
+  //       on program exit (deleting them would call glDeleteTextures()). They are deleted
+  //       in Release() once they become unused, or in Shutdown(). Remaining textures are
+  //       thus leaked on purpose.
+  for (int mode = 0; mode < 2; ++ mode) {
+    if (sharedTextures[mode].texture) {
+      LOG(ERROR) << "Shared sprite texture still allocated on SpriteAtlasManager destruction (mode: " << mode << ")";
+      sharedTextures[mode].texture.release();
+    }
+  }
+  if (!separateTextures.empty()) {
+    LOG(ERROR) << "Separate sprite textures still allocated on SpriteAtlasManager destruction: " << separateTextures.size();
+    for (auto& texture : separateTextures) {
+      texture.release();
+    }
+  }
+}
+
+bool SpriteAtlasManager::Allocate(SpriteAtlas::Mode mode, int width, int height, SpriteAtlasAllocation* allocation) {
+  // Leave one pixel of free space between the sprites such that texture filtering
+  // at the sprite boundaries does not pick up pixels of other sprites.
+  constexpr int kPadding = 1;
+  
+  bool singleChannel = (mode == SpriteAtlas::Mode::Shadow);
+  int wrapMode = GL_CLAMP_TO_EDGE;
+  int filter = (mode == SpriteAtlas::Mode::Graphic) ? GL_NEAREST : GL_LINEAR;
+  
+  allocation->width = width;
+  allocation->height = height;
+  
+  int size = GetLayerSize();
+  if (width + kPadding > size || height + kPadding > size) {
+    // The sprite atlas does not fit into a layer of the shared texture.
+    // Create a separate texture for it.
+    Texture* texture = new Texture();
+    texture->CreateEmptyArray(width, height, 1, singleChannel, wrapMode, filter, filter);
+    separateTextures.emplace_back(texture);
+    
+    allocation->texture = texture;
+    allocation->layer = 0;
+    allocation->x = 0;
+    allocation->y = 0;
+    return true;
+  }
+  
+  SharedTexture& shared = sharedTextures[static_cast<int>(mode)];
+  
+  // Try to fit the sprite atlas into one of the existing layers.
+  for (usize layerIndex = 0; layerIndex < shared.layers.size(); ++ layerIndex) {
+    Layer& layer = shared.layers[layerIndex];
+    rbp::Rect rect = layer.packer->Insert(width + kPadding, height + kPadding, rbp::MaxRectsBinPack::RectBestShortSideFit);
+    if (rect.height > 0) {
+      ++ layer.allocationCount;
+      allocation->texture = shared.texture.get();
+      allocation->layer = layerIndex;
+      allocation->x = rect.x;
+      allocation->y = rect.y;
+      return true;
+    }
+  }
+  
+  // Add a new layer.
+  GLint maxLayers = 0;
+  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+  f->glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+  if (static_cast<int>(shared.layers.size()) >= maxLayers) {
+    LOG(ERROR) << "Exceeded the maximum number of array texture layers (" << maxLayers << ")";
+    return false;
+  }
+  
+  if (!shared.texture) {
+    shared.texture.reset(new Texture());
+    shared.texture->CreateEmptyArray(size, size, 1, singleChannel, wrapMode, filter, filter);
+  } else {
+    shared.texture->GrowArray(shared.layers.size() + 1);
+  }
+  
+  shared.layers.emplace_back();
+  Layer& newLayer = shared.layers.back();
+  newLayer.packer.reset(new rbp::MaxRectsBinPack(size, size, /*allowFlip*/ false));
+  newLayer.allocationCount = 1;
+  rbp::Rect rect = newLayer.packer->Insert(width + kPadding, height + kPadding, rbp::MaxRectsBinPack::RectBestShortSideFit);
+  if (rect.height <= 0) {
+    LOG(ERROR) << "Internal error: Failed to insert a sprite atlas into an empty texture layer.";
+    return false;
+  }
+  
+  allocation->texture = shared.texture.get();
+  allocation->layer = shared.layers.size() - 1;
+  allocation->x = rect.x;
+  allocation->y = rect.y;
+  return true;
+}
+
+void SpriteAtlasManager::Release(SpriteAtlas::Mode mode, SpriteAtlasAllocation* allocation) {
+  if (allocation->texture == nullptr) {
+    return;
+  }
+  
+  SharedTexture& shared = sharedTextures[static_cast<int>(mode)];
+  if (allocation->texture == shared.texture.get()) {
+    Layer& layer = shared.layers[allocation->layer];
+    -- layer.allocationCount;
+    if (layer.allocationCount == 0) {
+      // Make the complete layer available again.
+      int size = GetLayerSize();
+      layer.packer.reset(new rbp::MaxRectsBinPack(size, size, /*allowFlip*/ false));
+    }
+    
+    bool allLayersUnused = std::all_of(shared.layers.begin(), shared.layers.end(), [](const Layer& l) { return l.allocationCount == 0; });
+    if (allLayersUnused) {
+      shared.texture.reset();
+      shared.layers.clear();
+    }
+  } else {
+    bool found = false;
+    for (auto it = separateTextures.begin(); it != separateTextures.end(); ++ it) {
+      if (it->get() == allocation->texture) {
+        separateTextures.erase(it);
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      LOG(ERROR) << "SpriteAtlasManager::Release() called for an allocation that could not be found.";
+    }
+  }
+  
+  allocation->texture = nullptr;
+}
+
+void SpriteAtlasManager::Shutdown() {
+  for (SharedTexture& shared : sharedTextures) {
+    shared.texture.reset();
+    shared.layers.clear();
+  }
+  separateTextures.clear();
+}
+
+int SpriteAtlasManager::GetMaxTextureSize() {
+  if (maxTextureSize < 0) {
+    GLint value = 0;
+    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+    f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &value);
+    maxTextureSize = value;
+  }
+  return maxTextureSize;
+}
+
+int SpriteAtlasManager::GetLayerSize() {
+  if (layerSize < 0) {
+    // Use large layers to be able to fit many sprites into each of them,
+    // but not too large ones, since each new layer uses the full layer size in GPU memory.
+    constexpr int kPreferredLayerSize = 4096;
+    layerSize = std::min<int>(kPreferredLayerSize, GetMaxTextureSize());
+  }
+  return layerSize;
+}
@@ -4,14 +4,18 @@
 
 #pragma once
 
-#include <QImage>
-
+#include <memory>
 #include <vector>
 
+#include <QImage>
+
 namespace rbp {
+  class MaxRectsBinPack;
   struct Rect;
+  struct RectSize;
 }
 class Sprite;
+class Texture;
 
 /// Packs one or multiple sprites into an atlas texture, where all sprite
 /// frames are stored next to each other.
@@ -34,6 +38,12 @@ class SpriteAtlas {
   /// false.
   bool BuildAtlas(int width, int height, int borderPixels = 1);
   
+  /// Packs all added sprites into a texture whose size is chosen automatically
+  /// (see PackRectsWithAutomaticSize()), while leaving @p borderPixels of free border
+  /// around each sprite. Neither the width nor the height of the texture will exceed
+  /// @p maxExtent. Returns true on success, false otherwise.
+  bool BuildAtlasWithAutomaticSize(int borderPixels, int maxExtent, bool finalPackWithMaxRects);
+  
   /// Saves the information computed by BuildAtlas() to the given file.
   /// Returns true on success, false otherwise.
   bool Save(const char* path);
@@ -51,7 +61,14 @@ class SpriteAtlas {
   /// unloads the QImages in the sprite layers that were used to create the atlas.
   QImage RenderAtlas();
   
+  inline int GetWidth() const { return atlasWidth; }
+  inline int GetHeight() const { return atlasHeight; }
+  
  private:
+  /// Returns the sizes of the rects (including the border) for all frames of the added sprites.
+  std::vector<rbp::RectSize> GetFrameRectSizes(int borderPixels);
+  
+  
   int atlasWidth;
   int atlasHeight;
   int atlasBorderPixels;
@@ -61,3 +78,107 @@ class SpriteAtlas {
   std::vector<Sprite*> sprites;
   Mode mode;
 };
+
+
+/// Packs the given rects into an area whose size is chosen automatically:
+/// The width is estimated from the total area of the rects, then all rects are
+/// packed in a single pass with a skyline packer, which determines the required height.
+/// Thus, the result only becomes non-square if needed. The width and height are
+/// limited to @p maxExtent (which should be the maximum texture size supported by
+/// the GPU). If the required height exceeds this limit, the width is increased
+/// towards @p maxExtent and the rects are packed again. Optionally, the final
+/// packing is done with the (slower, but denser) MaxRects packer at the found size,
+/// which may reduce the height. Returns false if the rects do not fit into the
+/// limit, true otherwise.
+bool PackRectsWithAutomaticSize(
+    const std::vector<rbp::RectSize>& rects,
+    int maxExtent,
+    bool finalPackWithMaxRects,
+    int* width,
+    int* height,
+    std::vector<rbp::Rect>* packedRects,
+    std::vector<int>* packedRectIndices);
+
+/// Reads the sizes of the packed rects from a sprite atlas cache file that was
+/// written by SpriteAtlas::Save(). Returns true on success, false otherwise.
+bool ReadSpriteAtlasCacheRectSizes(const char* path, std::vector<rbp::RectSize>* rectSizes);
+
+
+/// A region in one of the textures managed by the SpriteAtlasManager.
+struct SpriteAtlasAllocation {
+  /// The (array) texture that the region is in. This is nullptr for invalid allocations.
+  Texture* texture = nullptr;
+  
+  /// The texture array layer that the region is in.
+  int layer = 0;
+  
+  /// The region's position and size within the layer.
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+/// Singleton class which packs the atlases of many sprites into a few large
+/// GL_TEXTURE_2D_ARRAY textures (one for graphics and one for shadows). Since
+/// sprites using the same texture can be drawn with a single draw call, this
+/// allows to render each of the shadow, outline, and graphic passes with one
+/// (or a few) draw calls, instead of one draw call per sprite.
+///
+/// Sprite atlases which are larger than a texture layer get a separate
+/// single-layer array texture. Freed space in a layer is only re-used once
+/// all allocations in the layer have been released.
+///
+/// All functions must be called with an OpenGL context being current. Since the
+/// singleton is only destroyed on program exit, when there is no OpenGL context
+/// anymore, Shutdown() must be called before the context is destroyed.
+class SpriteAtlasManager {
+ public:
+  static SpriteAtlasManager& Instance() {
+    static SpriteAtlasManager instance;
+    return instance;
+  }
+  
+  /// Allocates a region of the given size in a texture for the given mode.
+  /// The region is initialized to zero. Returns true on success, false otherwise.
+  bool Allocate(SpriteAtlas::Mode mode, int width, int height, SpriteAtlasAllocation* allocation);
+  
+  /// Releases an allocation that was returned by Allocate(). Textures which do
+  /// not contain any allocations anymore are deleted.
+  void Release(SpriteAtlas::Mode mode, SpriteAtlasAllocation* allocation);
+  
+  /// Deletes all textures. Allocations which were not released yet become invalid.
+  void Shutdown();
+  
+  /// Returns the maximum width and height of textures (GL_MAX_TEXTURE_SIZE).
+  int GetMaxTextureSize();
+  
+ private:
+  struct Layer {
+    std::shared_ptr<rbp::MaxRectsBinPack> packer;
+    int allocationCount;
+  };
+  
+  struct SharedTexture {
+    std::unique_ptr<Texture> texture;
+    std::vector<Layer> layers;
+  };
+  
+  SpriteAtlasManager() = default;
+  ~SpriteAtlasManager();
+  
+  /// Returns the size of the (square) texture array layers.
+  int GetLayerSize();
+  
+  /// Shared array textures, indexed by static_cast<int>(SpriteAtlas::Mode).
+  SharedTexture sharedTextures[2];
+  
+  /// Single-layer textures for sprite atlases that are too large for the shared textures.
+  std::vector<std::unique_ptr<Texture>> separateTextures;
+  
+  /// Cached result of GetLayerSize().
+  int layerSize = -1;
+  
+  /// Cached result of GetMaxTextureSize().
+  int maxTextureSize = -1;
+};
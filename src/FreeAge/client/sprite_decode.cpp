@@ -0,0 +1,462 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/sprite_decode.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define FREEAGE_SMX_DECODER_X86
+  #include <immintrin.h>
+#endif
+
+#include "FreeAge/common/logging.hpp"
+
+/// Number of pixels that are decoded per iteration of the vectorized decoders.
+/// This corresponds to two 4plus1 blocks or four 8to5 blocks, such that each
+/// iteration starts and ends at a block boundary.
+static constexpr int kPixelsPerGroup = 8;
+
+/// The largest possible palette index is 256 * 3 + 255.
+static constexpr int kMaxPaletteIndices = 1024;
+
+/// Decodes a single pixel with the reference implementation after checking that it lies within the pixel array.
+static inline bool DecompressNextPixelChecked(
+    bool usesEightToFiveCompression,
+    const u8*& pixelPtr,
+    const u8* pixelEnd,
+    int& decompressionState,
+    const Palette* palette,
+    bool ignoreAlpha,
+    QRgb* out) {
+  if (usesEightToFiveCompression) {
+    if (pixelEnd - pixelPtr < ((decompressionState == 0) ? 2 : 3)) {
+      return false;
+    }
+    *out = DecompressNextPixel8To5(pixelPtr, decompressionState, palette, ignoreAlpha);
+  } else {
+    if (pixelEnd - pixelPtr < 5) {
+      return false;
+    }
+    *out = DecompressNextPixel4Plus1(pixelPtr, decompressionState, palette, ignoreAlpha);
+  }
+  return true;
+}
+
+#ifdef FREEAGE_SMX_DECODER_X86
+
+/// Expands two 4plus1 blocks (8 pixels) into eight 16-bit palette indices (256 * paletteSection + colorIndex).
+/// Reads 13 bytes starting at p.
+__attribute__((target("ssse3")))
+static inline __m128i ExpandIndices4Plus1(const u8* p) {
+  // The first block ends up in bytes 0 to 4, the second block in bytes 8 to 12.
+  __m128i data = _mm_unpacklo_epi64(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 5)));
+  
+  __m128i colorIndices = _mm_shuffle_epi8(data, _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 8, -1, 9, -1, 10, -1, 11, -1));
+  
+  // Shift the two palette section bits of each pixel into bits 8 and 9 of its 16-bit lane
+  // by multiplying the section byte with 2^(8 - 2 * pixelInBlock).
+  __m128i sectionBytes = _mm_shuffle_epi8(data, _mm_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1, 12, -1, 12, -1, 12, -1, 12, -1));
+  __m128i sections = _mm_mullo_epi16(sectionBytes, _mm_setr_epi16(256, 64, 16, 4, 256, 64, 16, 4));
+  
+  return _mm_or_si128(colorIndices, _mm_and_si128(sections, _mm_set1_epi16(0x300)));
+}
+
+/// Expands four 8to5 blocks (8 pixels) into eight 16-bit palette indices (256 * paletteSection + colorIndex).
+/// Reads 18 bytes starting at p.
+__attribute__((target("ssse3")))
+static inline __m128i ExpandIndices8To5(const u8* p) {
+  // Blocks 0 and 1 end up in bytes 0 to 7 (only the first three bytes of each block are relevant),
+  // blocks 2 and 3 in bytes 8 to 15.
+  __m128i data = _mm_unpacklo_epi64(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 10)));
+  
+  // For each block (b0, b1, b2), the first pixel's index is given by the lowest 10 bits of (b0 | b1 << 8),
+  // and the second pixel's index is given by bits 2 to 11 of (b1 | b2 << 8).
+  __m128i words = _mm_shuffle_epi8(data, _mm_setr_epi8(0, 1, 1, 2, 5, 6, 6, 7, 8, 9, 9, 10, 13, 14, 14, 15));
+  __m128i shifted = _mm_srli_epi16(_mm_mullo_epi16(words, _mm_setr_epi16(4, 1, 4, 1, 4, 1, 4, 1)), 2);
+  
+  return _mm_and_si128(shifted, _mm_set1_epi16(0x3ff));
+}
+
+/// Stores the player color marker pixels for eight palette indices,
+/// matching the output of GetPalettedPixel() for a null palette.
+__attribute__((target("ssse3")))
+static inline void StorePlayerColorPixels(__m128i indices, QRgb* out) {
+  // The index's low byte goes into the red channel, the high byte into the green channel, and the alpha is 254.
+  const __m128i alpha = _mm_set1_epi32(0xfe000000);
+  __m128i low = _mm_shuffle_epi8(indices, _mm_setr_epi8(-1, 1, 0, -1, -1, 3, 2, -1, -1, 5, 4, -1, -1, 7, 6, -1));
+  __m128i high = _mm_shuffle_epi8(indices, _mm_setr_epi8(-1, 9, 8, -1, -1, 11, 10, -1, -1, 13, 12, -1, -1, 15, 14, -1));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_or_si128(low, alpha));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_or_si128(high, alpha));
+}
+
+/// Returns true if all eight indices are smaller than paletteLimit (which must be at most kMaxPaletteIndices).
+__attribute__((target("ssse3")))
+static inline bool AreIndicesInPalette(__m128i indices, int paletteLimit) {
+  return _mm_movemask_epi8(_mm_cmpgt_epi16(indices, _mm_set1_epi16(paletteLimit - 1))) == 0;
+}
+
+/// Decodes eight pixels starting at a block boundary with the reference implementation.
+/// This is used for pixel groups which contain out-of-range palette indices, such that these are reported
+/// and handled in exactly the same way as in the reference implementation.
+static inline void DecompressPixelGroupScalar(bool usesEightToFiveCompression, const u8* pixelPtr, const Palette* palette, bool ignoreAlpha, QRgb* out) {
+  int decompressionState = 0;
+  for (int i = 0; i < kPixelsPerGroup; ++ i) {
+    out[i] = usesEightToFiveCompression ?
+             DecompressNextPixel8To5(pixelPtr, decompressionState, palette, ignoreAlpha) :
+             DecompressNextPixel4Plus1(pixelPtr, decompressionState, palette, ignoreAlpha);
+  }
+}
+
+/// Decodes as many groups of kPixelsPerGroup pixels as possible (limited by count and pixelEnd),
+/// starting at a block boundary. Returns the number of decoded pixels.
+__attribute__((target("ssse3")))
+static int DecompressPixelGroupsSSSE3(bool usesEightToFiveCompression, const u8*& pixelPtr, const u8* pixelEnd, int count, const Palette* palette, bool ignoreAlpha, QRgb* out) {
+  const int groupStride = usesEightToFiveCompression ? 20 : 10;
+  const int groupReadSize = usesEightToFiveCompression ? 18 : 13;
+  const int paletteLimit = palette ? static_cast<int>(std::min<usize>(palette->size(), kMaxPaletteIndices)) : 0;
+  const QRgb alphaMask = ignoreAlpha ? 0xff000000 : 0;
+  
+  alignas(16) u16 indices[kPixelsPerGroup];
+  
+  int decoded = 0;
+  while (count - decoded >= kPixelsPerGroup && pixelEnd - pixelPtr >= groupReadSize) {
+    __m128i groupIndices = usesEightToFiveCompression ? ExpandIndices8To5(pixelPtr) : ExpandIndices4Plus1(pixelPtr);
+    
+    if (palette == nullptr) {
+      StorePlayerColorPixels(groupIndices, out + decoded);
+    } else if (AreIndicesInPalette(groupIndices, paletteLimit)) {
+      // SSSE3 does not have a gather instruction, so do the palette lookups individually.
+      _mm_store_si128(reinterpret_cast<__m128i*>(indices), groupIndices);
+      const QRgb* colors = palette->data();
+      for (int i = 0; i < kPixelsPerGroup; ++ i) {
+        out[decoded + i] = colors[indices[i]] | alphaMask;
+      }
+    } else {
+      DecompressPixelGroupScalar(usesEightToFiveCompression, pixelPtr, palette, ignoreAlpha, out + decoded);
+    }
+    
+    pixelPtr += groupStride;
+    decoded += kPixelsPerGroup;
+  }
+  return decoded;
+}
+
+/// AVX2 variant of DecompressPixelGroupsSSSE3(), using gathers for the palette lookups.
+__attribute__((target("avx2")))
+static int DecompressPixelGroupsAVX2(bool usesEightToFiveCompression, const u8*& pixelPtr, const u8* pixelEnd, int count, const Palette* palette, bool ignoreAlpha, QRgb* out) {
+  const int groupStride = usesEightToFiveCompression ? 20 : 10;
+  const int groupReadSize = usesEightToFiveCompression ? 18 : 13;
+  const int paletteLimit = palette ? static_cast<int>(std::min<usize>(palette->size(), kMaxPaletteIndices)) : 0;
+  const __m256i alphaMask = _mm256_set1_epi32(ignoreAlpha ? 0xff000000 : 0);
+  
+  int decoded = 0;
+  while (count - decoded >= kPixelsPerGroup && pixelEnd - pixelPtr >= groupReadSize) {
+    __m128i groupIndices = usesEightToFiveCompression ? ExpandIndices8To5(pixelPtr) : ExpandIndices4Plus1(pixelPtr);
+    
+    if (palette == nullptr) {
+      StorePlayerColorPixels(groupIndices, out + decoded);
+    } else if (AreIndicesInPalette(groupIndices, paletteLimit)) {
+      __m256i colors = _mm256_i32gather_epi32(
+          reinterpret_cast<const int*>(palette->data()),
+          _mm256_cvtepu16_epi32(groupIndices),
+          sizeof(QRgb));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + decoded), _mm256_or_si256(colors, alphaMask));
+    } else {
+      DecompressPixelGroupScalar(usesEightToFiveCompression, pixelPtr, palette, ignoreAlpha, out + decoded);
+    }
+    
+    pixelPtr += groupStride;
+    decoded += kPixelsPerGroup;
+  }
+  return decoded;
+}
+
+#endif  // FREEAGE_SMX_DECODER_X86
+
+
+SMXDecoderISA GetBestSMXDecoderISA() {
+#ifdef FREEAGE_SMX_DECODER_X86
+  static const SMXDecoderISA bestISA = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return SMXDecoderISA::AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+      return SMXDecoderISA::SSSE3;
+    }
+    return SMXDecoderISA::Scalar;
+  }();
+  return bestISA;
+#else
+  return SMXDecoderISA::Scalar;
+#endif
+}
+
+/// The instruction set selected with SetSMXDecoderISA(), or -1 to use GetBestSMXDecoderISA().
+static std::atomic<int> selectedSMXDecoderISA(-1);
+
+SMXDecoderISA GetSMXDecoderISA() {
+  int isa = selectedSMXDecoderISA.load(std::memory_order_relaxed);
+  return (isa < 0) ? GetBestSMXDecoderISA() : static_cast<SMXDecoderISA>(isa);
+}
+
+void SetSMXDecoderISA(SMXDecoderISA isa) {
+  // Each instruction set in the enum implies support for the previous ones.
+  if (static_cast<int>(isa) > static_cast<int>(GetBestSMXDecoderISA())) {
+    LOG(WARNING) << "SMX decoder instruction set " << GetSMXDecoderISAName(isa) << " is not supported by the CPU, using "
+                 << GetSMXDecoderISAName(GetBestSMXDecoderISA()) << " instead";
+    isa = GetBestSMXDecoderISA();
+  }
+  selectedSMXDecoderISA.store(static_cast<int>(isa), std::memory_order_relaxed);
+}
+
+const char* GetSMXDecoderISAName(SMXDecoderISA isa) {
+  switch (isa) {
+  case SMXDecoderISA::Scalar: return "Scalar";
+  case SMXDecoderISA::SSSE3:  return "SSSE3";
+  case SMXDecoderISA::AVX2:   return "AVX2";
+  }
+  return "Unknown";
+}
+
+bool DecompressSMXPixels(
+    bool usesEightToFiveCompression,
+    const u8*& pixelPtr,
+    const u8* pixelEnd,
+    int& decompressionState,
+    int count,
+    const Palette* palette,
+    bool ignoreAlpha,
+    QRgb* out) {
+  // Decode single pixels until reaching the start of a block.
+  while (count > 0 && decompressionState != 0) {
+    if (!DecompressNextPixelChecked(usesEightToFiveCompression, pixelPtr, pixelEnd, decompressionState, palette, ignoreAlpha, out)) {
+      return false;
+    }
+    ++ out;
+    -- count;
+  }
+
+#ifdef FREEAGE_SMX_DECODER_X86
+  // Decode whole blocks with SIMD instructions.
+  if (count >= kPixelsPerGroup) {
+    SMXDecoderISA isa = GetSMXDecoderISA();
+    int decoded = 0;
+    if (isa == SMXDecoderISA::AVX2) {
+      decoded = DecompressPixelGroupsAVX2(usesEightToFiveCompression, pixelPtr, pixelEnd, count, palette, ignoreAlpha, out);
+    } else if (isa == SMXDecoderISA::SSSE3) {
+      decoded = DecompressPixelGroupsSSSE3(usesEightToFiveCompression, pixelPtr, pixelEnd, count, palette, ignoreAlpha, out);
+    }
+    out += decoded;
+    count -= decoded;
+  }
+#endif
+  
+  // Decode the remaining pixels one by one.
+  for (; count > 0; -- count) {
+    if (!DecompressNextPixelChecked(usesEightToFiveCompression, pixelPtr, pixelEnd, decompressionState, palette, ignoreAlpha, out)) {
+      return false;
+    }
+    ++ out;
+  }
+  
+  return true;
+}
+
+bool DecodeSMXGraphicLayer(
+    const SMXLayerHeader& layerHeader,
+    const std::vector<SMPLayerRowEdge>& rowEdges,
+    bool usesEightToFiveCompression,
+    int pixelBorder,
+    const Palette& standardPalette,
+    const u8* commandArray,
+    usize commandArrayLen,
+    const u8* pixelArray,
+    usize pixelArrayLen,
+    QRgb* dest,
+    int destStride) {
+  const int width = layerHeader.width;
+  
+  const u8* commandPtr = commandArray;
+  const u8* commandEnd = commandArray + commandArrayLen;
+  const u8* pixelPtr = pixelArray;
+  const u8* pixelEnd = pixelArray + pixelArrayLen;
+  int decompressionState = 0;
+  for (int row = 0; row < layerHeader.height; ++ row) {
+    QRgb* out = dest + row * static_cast<usize>(destStride);
+    
+    // Check for skipped rows
+    const SMPLayerRowEdge& edge = rowEdges[row];
+    if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
+      // Row is completely transparent
+      memset(out, 0, width * sizeof(QRgb));
+      continue;
+    }
+    
+    // Left edge skip
+    int col = edge.leftSpace + pixelBorder;
+    if (col > width) {
+      LOG(ERROR) << "Row " << row << ": Left edge (" << edge.leftSpace << ") exceeds the layer width (" << layerHeader.width << ")";
+      return false;
+    }
+    memset(out, 0, col * sizeof(QRgb));
+    
+    while (true) {
+      // Check the next command.
+      if (commandPtr >= commandEnd) {
+        LOG(ERROR) << "Row " << row << ": Unexpected end of the command array";
+        return false;
+      }
+      u8 command = *commandPtr;
+      ++ commandPtr;
+      
+      u8 commandCode = command & 0b11;
+      if (commandCode == 0b11) {
+        // End of row.
+        if (col + edge.rightSpace + pixelBorder != width) {
+          LOG(WARNING) << "Row " << row << ": Pixel count does not match expectation (col: " << col
+                       << ", edge.rightSpace: " << edge.rightSpace << ", layerHeader.width: " << layerHeader.width << ")";
+        }
+        memset(out + col, 0, (width - col) * sizeof(QRgb));
+        break;
+      }
+      
+      u8 count = (command >> 2) + 1;
+      if (col + count > width) {
+        LOG(ERROR) << "Row " << row << ": Pixels exceed the layer width (" << layerHeader.width << ")";
+        return false;
+      }
+      
+      if (commandCode == 0b00) {
+        // Draw *count* transparent pixels.
+        memset(out + col, 0, count * sizeof(QRgb));
+      } else {  // if (commandCode == 0b01 || commandCode == 0b10)
+        // Choose the normal or player-color palette depending on the command.
+        const Palette* palette = (commandCode == 0b01) ? &standardPalette : nullptr;
+        
+        // Draw *count* pixels from that palette.
+        bool ignoreAlpha = true;  /*layerType == SMXLayerType::Graphic*/
+        if (!DecompressSMXPixels(usesEightToFiveCompression, pixelPtr, pixelEnd, decompressionState, count, palette, ignoreAlpha, out + col)) {
+          LOG(ERROR) << "Row " << row << ": Unexpected end of the pixel array";
+          return false;
+        }
+      }
+      col += count;
+    }
+  }
+  
+  return true;
+}
+
+/// Shared implementation of DecodeSMXShadowLayer() and DecodeSMXOutlineLayer(). For shadows, the
+/// pixel values follow the drawing commands in the data array. For outlines, the pixels are set to 255.
+static bool DecodeSMXSingleChannelLayer(
+    bool isShadow,
+    const SMXLayerHeader& layerHeader,
+    const std::vector<SMPLayerRowEdge>& rowEdges,
+    const u8* data,
+    usize dataLen,
+    u8* dest,
+    int destStride) {
+  const int width = layerHeader.width;
+  
+  const u8* dataPtr = data;
+  const u8* dataEnd = data + dataLen;
+  for (int row = 0; row < layerHeader.height; ++ row) {
+    u8* out = dest + row * static_cast<usize>(destStride);
+    
+    // Check for skipped rows
+    const SMPLayerRowEdge& edge = rowEdges[row];
+    if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
+      // Row is completely transparent
+      memset(out, 0, width);
+      continue;
+    }
+    
+    // Left edge skip
+    int col = edge.leftSpace;
+    if (col > width) {
+      LOG(ERROR) << "Row " << row << ": Left edge (" << edge.leftSpace << ") exceeds the layer width (" << layerHeader.width << ")";
+      return false;
+    }
+    memset(out, 0, col);
+    
+    while (true) {
+      // Check the next command.
+      if (dataPtr >= dataEnd) {
+        LOG(ERROR) << "Row " << row << ": Unexpected end of the data array";
+        return false;
+      }
+      u8 command = *dataPtr;
+      ++ dataPtr;
+      
+      u8 commandCode = command & 0b11;
+      if (commandCode == 0b11) {
+        // End of row.
+        // NOTE: For shadows, we account for what seems like a bug here, where there is one pixel of data missing.
+        if ((col + edge.rightSpace != width) &&
+            !(isShadow && col + edge.rightSpace + 1 == width)) {
+          LOG(WARNING) << "Row " << row << ": Pixel count does not match expectation (col: " << col
+                       << ", edge.rightSpace: " << edge.rightSpace << ", layerHeader.width: " << layerHeader.width << ")";
+        }
+        memset(out + col, 0, width - col);
+        break;
+      } else if (commandCode == 0b10) {
+        LOG(ERROR) << "Unexpected drawing code 0b10";
+        return false;
+      }
+      
+      u8 count = (command >> 2) + 1;
+      if (col + count > width) {
+        LOG(ERROR) << "Row " << row << ": Pixels exceed the layer width (" << layerHeader.width << ")";
+        return false;
+      }
+      
+      if (commandCode == 0b00) {
+        // Draw *count* transparent pixels.
+        memset(out + col, 0, count);
+      } else if (isShadow) {  // if (commandCode == 0b01)
+        // Draw *count* pixels.
+        if (dataEnd - dataPtr < count) {
+          LOG(ERROR) << "Row " << row << ": Unexpected end of the data array";
+          return false;
+        }
+        memcpy(out + col, dataPtr, count);
+        dataPtr += count;
+      } else {  // if (commandCode == 0b01)
+        // Draw *count* outline pixels.
+        memset(out + col, 255, count);
+      }
+      col += count;
+    }
+  }
+  
+  return true;
+}
+
+bool DecodeSMXShadowLayer(
+    const SMXLayerHeader& layerHeader,
+    const std::vector<SMPLayerRowEdge>& rowEdges,
+    const u8* data,
+    usize dataLen,
+    u8* dest,
+    int destStride) {
+  return DecodeSMXSingleChannelLayer(/*isShadow*/ true, layerHeader, rowEdges, data, dataLen, dest, destStride);
+}
+
+bool DecodeSMXOutlineLayer(
+    const SMXLayerHeader& layerHeader,
+    const std::vector<SMPLayerRowEdge>& rowEdges,
+    const u8* data,
+    usize dataLen,
+    u8* dest,
+    int destStride) {
+  return DecodeSMXSingleChannelLayer(/*isShadow*/ false, layerHeader, rowEdges, data, dataLen, dest, destStride);
+}
@@ -0,0 +1,85 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <vector>
+
+#include <QRgb>
+
+#include "FreeAge/common/free_age.hpp"
+#include "FreeAge/client/sprite.hpp"
+
+/// Instruction sets that the SMX layer decoder can use.
+enum class SMXDecoderISA {
+  Scalar = 0,
+  SSSE3,
+  AVX2
+};
+
+/// Returns the best instruction set for SMX decoding that is supported by the CPU.
+SMXDecoderISA GetBestSMXDecoderISA();
+
+/// Returns the instruction set that is currently used for SMX decoding.
+/// This defaults to GetBestSMXDecoderISA().
+SMXDecoderISA GetSMXDecoderISA();
+
+/// Sets the instruction set to use for SMX decoding (intended for testing and benchmarking).
+/// If the given instruction set is not supported by the CPU, GetBestSMXDecoderISA() is used instead.
+void SetSMXDecoderISA(SMXDecoderISA isa);
+
+/// Returns a human-readable name for the given instruction set.
+const char* GetSMXDecoderISAName(SMXDecoderISA isa);
+
+/// Decodes @p count consecutive pixels of an SMX graphic layer's pixel array into @p out.
+/// The result is identical to calling DecompressNextPixel8To5() (if usesEightToFiveCompression is true)
+/// or DecompressNextPixel4Plus1() (otherwise) @p count times, and pixelPtr and decompressionState
+/// are advanced in the same way. Whole compressed blocks are decoded with SIMD instructions if available.
+/// Returns false if decoding would read beyond @p pixelEnd.
+bool DecompressSMXPixels(
+    bool usesEightToFiveCompression,
+    const u8*& pixelPtr,
+    const u8* pixelEnd,
+    int& decompressionState,
+    int count,
+    const Palette* palette,
+    bool ignoreAlpha,
+    QRgb* out);
+
+/// Decodes an SMX graphic layer from its command and pixel arrays into the given destination memory,
+/// which may for example directly be a region within a texture atlas. @p destStride is the distance
+/// between the starts of consecutive rows in @p dest, in pixels. The layer header's size
+/// and the row edges must already include the @p pixelBorder.
+bool DecodeSMXGraphicLayer(
+    const SMXLayerHeader& layerHeader,
+    const std::vector<SMPLayerRowEdge>& rowEdges,
+    bool usesEightToFiveCompression,
+    int pixelBorder,
+    const Palette& standardPalette,
+    const u8* commandArray,
+    usize commandArrayLen,
+    const u8* pixelArray,
+    usize pixelArrayLen,
+    QRgb* dest,
+    int destStride);
+
+/// Decodes an SMX shadow layer from its combined command and data array into the given
+/// 8-bit destination memory. @p destStride is given in bytes.
+bool DecodeSMXShadowLayer(
+    const SMXLayerHeader& layerHeader,
+    const std::vector<SMPLayerRowEdge>& rowEdges,
+    const u8* data,
+    usize dataLen,
+    u8* dest,
+    int destStride);
+
+/// Decodes an SMX outline layer from its combined command and data array into the given
+/// 8-bit destination memory. @p destStride is given in bytes.
+bool DecodeSMXOutlineLayer(
+    const SMXLayerHeader& layerHeader,
+    const std::vector<SMPLayerRowEdge>& rowEdges,
+    const u8* data,
+    usize dataLen,
+    u8* dest,
+    int destStride);
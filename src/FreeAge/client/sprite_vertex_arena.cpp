@@ -0,0 +1,66 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/sprite_vertex_arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "FreeAge/client/streaming_vertex_buffer.hpp"
+#include "FreeAge/client/texture.hpp"
+
+void SpriteVertexArena::Clear() {
+  numEntries = 0;
+  lastEntry = 0;
+}
+
+void SpriteVertexArena::Commit(StreamingVertexBuffer* buffer, std::vector<Texture*>* textures) {
+  for (usize i = 0; i < numEntries; ++ i) {
+    const TextureVertices& entry = entries[i];
+    if (entry.size == 0) {
+      continue;
+    }
+    
+    usize offset;
+    u8* data = buffer->Allocate(entry.size, &offset);
+    if (!data) {
+      // The buffer is full. It will be enlarged for the following frames (see StreamingVertexBuffer::EndFrame()).
+      continue;
+    }
+    memcpy(data, entry.vertices.data(), entry.size);
+    
+    if (std::find(textures->begin(), textures->end(), entry.texture) == textures->end()) {
+      textures->push_back(entry.texture);
+    }
+    entry.texture->AddDrawCallVertices(offset, entry.vertexSize, entry.size / entry.vertexSize);
+  }
+}
+
+usize SpriteVertexArena::GetNumVertices() const {
+  usize result = 0;
+  for (usize i = 0; i < numEntries; ++ i) {
+    result += entries[i].size / entries[i].vertexSize;
+  }
+  return result;
+}
+
+SpriteVertexArena::TextureVertices* SpriteVertexArena::FindOrAddEntry(Texture* texture, int vertexSize) {
+  for (usize i = 0; i < numEntries; ++ i) {
+    if (entries[i].texture == texture) {
+      lastEntry = i;
+      return &entries[i];
+    }
+  }
+  
+  if (numEntries == entries.size()) {
+    entries.emplace_back();
+  }
+  TextureVertices* entry = &entries[numEntries];
+  entry->texture = texture;
+  entry->vertexSize = vertexSize;
+  entry->size = 0;
+  lastEntry = numEntries;
+  ++ numEntries;
+  return entry;
+}
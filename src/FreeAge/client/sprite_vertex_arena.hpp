@@ -0,0 +1,74 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "FreeAge/common/free_age.hpp"
+
+class StreamingVertexBuffer;
+class Texture;
+
+/// CPU-side storage for sprite vertices, grouped by texture. This allows worker threads to
+/// write sprite vertices (see DrawSprite()) without touching the OpenGL buffers or the
+/// textures' draw call lists, which are shared by all threads. Once all threads are done,
+/// the arenas are committed one after another on the thread that owns the OpenGL context.
+///
+/// Within each texture, the vertices keep the order in which they were allocated. Thus, if the
+/// objects are partitioned into consecutive chunks with one arena per chunk, and the arenas are
+/// committed in the order of the chunks, the result is the same as if all objects had been drawn
+/// serially, regardless of which thread processed which chunk.
+class SpriteVertexArena {
+ public:
+  /// Returns a pointer to vertexSize bytes for a vertex that will be rendered with the given texture.
+  /// The pointer is only valid until the next call to Allocate() or Clear().
+  inline u8* Allocate(Texture* texture, int vertexSize) {
+    TextureVertices* entry = nullptr;
+    if (lastEntry < numEntries && entries[lastEntry].texture == texture) {
+      // Fast path: consecutive sprites usually use the same texture (since sprites share their textures).
+      entry = &entries[lastEntry];
+    } else {
+      entry = FindOrAddEntry(texture, vertexSize);
+    }
+    
+    if (entry->vertices.size() < entry->size + vertexSize) {
+      entry->vertices.resize(std::max<usize>(2 * entry->vertices.size(), entry->size + vertexSize));
+    }
+    u8* result = entry->vertices.data() + entry->size;
+    entry->size += vertexSize;
+    return result;
+  }
+  
+  /// Removes all vertices, keeping the allocated memory for re-use.
+  void Clear();
+  
+  /// Copies all vertices into the given buffer and adds the corresponding draw calls to the textures.
+  /// Textures that are not in @p textures yet are appended to it. Must be called on the thread that owns
+  /// the OpenGL context.
+  void Commit(StreamingVertexBuffer* buffer, std::vector<Texture*>* textures);
+  
+  /// Returns the total number of vertices in the arena.
+  usize GetNumVertices() const;
+  
+ private:
+  struct TextureVertices {
+    Texture* texture;
+    int vertexSize;
+    
+    /// Vertex data. Only the first size bytes are in use; the remainder is kept for re-use.
+    std::vector<u8> vertices;
+    usize size;
+  };
+  
+  TextureVertices* FindOrAddEntry(Texture* texture, int vertexSize);
+  
+  /// The entries [0, numEntries) are in use. The remaining ones are kept to re-use their memory.
+  std::vector<TextureVertices> entries;
+  usize numEntries = 0;
+  
+  /// Index of the entry that was used by the last call to Allocate().
+  usize lastEntry = 0;
+};
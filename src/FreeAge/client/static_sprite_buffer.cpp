@@ -0,0 +1,197 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/static_sprite_buffer.hpp"
+
+#include <cstring>
+
+#include <QOpenGLContext>
+
+#include "FreeAge/common/logging.hpp"
+#include "FreeAge/client/opengl.hpp"
+#include "FreeAge/client/shader_sprite.hpp"
+#include "FreeAge/client/texture.hpp"
+
+StaticSpriteBuffer::~StaticSpriteBuffer() {
+  for (const Batch& batch : batches) {
+    if (batch.buffer != 0) {
+      LOG(ERROR) << "StaticSpriteBuffer object was destroyed without Destroy() being called first.";
+      break;
+    }
+  }
+}
+
+void StaticSpriteBuffer::SetObject(u32 objectId, const ObjectState& state) {
+  Object& object = objects[objectId];
+  RemoveVertices(&object.vertices);
+  object.state = state;
+}
+
+u8* StaticSpriteBuffer::AddVertex(u32 objectId, Pass pass, Texture* texture, int vertexSize) {
+  auto it = objects.find(objectId);
+  if (it == objects.end()) {
+    LOG(ERROR) << "AddVertex() called for an object that was not passed to SetObject() before: " << objectId;
+    return nullptr;
+  }
+  
+  u32 batchIndex = GetBatchIndex(pass, texture, vertexSize);
+  Batch& batch = batches[batchIndex];
+  
+  u32 vertexIndex = batch.GetNumVertices();
+  batch.vertices.resize(batch.vertices.size() + vertexSize);
+  batch.vertexObjectIds.push_back(objectId);
+  batch.MarkDirty(vertexIndex);
+  
+  it->second.vertices.push_back({batchIndex, vertexIndex});
+  return batch.vertices.data() + vertexIndex * vertexSize;
+}
+
+void StaticSpriteBuffer::RemoveObject(u32 objectId) {
+  auto it = objects.find(objectId);
+  if (it == objects.end()) {
+    return;
+  }
+  
+  RemoveVertices(&it->second.vertices);
+  objects.erase(it);
+}
+
+void StaticSpriteBuffer::Clear() {
+  for (Batch& batch : batches) {
+    batch.vertices.clear();
+    batch.vertexObjectIds.clear();
+    batch.dirtyBegin = 0;
+    batch.dirtyEnd = 0;
+  }
+  objects.clear();
+}
+
+usize StaticSpriteBuffer::Upload(QOpenGLFunctions_3_2_Core* f) {
+  usize uploadedBytes = 0;
+  
+  for (Batch& batch : batches) {
+    usize numVertices = batch.GetNumVertices();
+    usize dirtyEnd = std::min(batch.dirtyEnd, numVertices);
+    if (numVertices == 0 ||
+        (batch.dirtyBegin >= dirtyEnd && batch.bufferSize >= batch.vertices.size())) {
+      batch.dirtyBegin = 0;
+      batch.dirtyEnd = 0;
+      continue;
+    }
+    
+    if (batch.buffer == 0) {
+      f->glGenBuffers(1, &batch.buffer);
+    }
+    f->glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+    
+    if (batch.bufferSize < batch.vertices.size()) {
+      // Enlarge the buffer (with some reserve to avoid frequent re-allocations) and upload all vertices.
+      batch.bufferSize = std::max(batch.vertices.size(), 2 * batch.bufferSize);
+      f->glBufferData(GL_ARRAY_BUFFER, batch.bufferSize, nullptr, GL_DYNAMIC_DRAW);
+      f->glBufferSubData(GL_ARRAY_BUFFER, 0, batch.vertices.size(), batch.vertices.data());
+      uploadedBytes += batch.vertices.size();
+    } else {
+      usize offset = batch.dirtyBegin * batch.vertexSize;
+      usize size = (dirtyEnd - batch.dirtyBegin) * batch.vertexSize;
+      f->glBufferSubData(GL_ARRAY_BUFFER, offset, size, batch.vertices.data() + offset);
+      uploadedBytes += size;
+    }
+    CHECK_OPENGL_NO_ERROR();
+    
+    batch.dirtyBegin = 0;
+    batch.dirtyEnd = 0;
+  }
+  
+  return uploadedBytes;
+}
+
+void StaticSpriteBuffer::Render(Pass pass, SpriteShader* shader, QOpenGLFunctions_3_2_Core* f) {
+  shader->GetProgram()->UseProgram(f);
+  
+  for (const Batch& batch : batches) {
+    if (batch.pass != pass || batch.GetNumVertices() == 0) {
+      continue;
+    }
+    
+    f->glBindTexture(batch.texture->GetTarget(), batch.texture->GetId());
+    f->glUniform2f(shader->GetTextureSizeLocation(), batch.texture->GetWidth(), batch.texture->GetHeight());
+    
+    f->glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+    shader->UseProgramAndSetAttribPointers(0, f);
+    f->glDrawArrays(GL_POINTS, 0, batch.GetNumVertices());
+  }
+  CHECK_OPENGL_NO_ERROR();
+}
+
+void StaticSpriteBuffer::Destroy() {
+  for (Batch& batch : batches) {
+    if (batch.buffer != 0) {
+      QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+      f->glDeleteBuffers(1, &batch.buffer);
+      batch.buffer = 0;
+      batch.bufferSize = 0;
+    }
+  }
+}
+
+usize StaticSpriteBuffer::GetNumVertices(Pass pass) const {
+  usize result = 0;
+  for (const Batch& batch : batches) {
+    if (batch.pass == pass) {
+      result += batch.GetNumVertices();
+    }
+  }
+  return result;
+}
+
+void StaticSpriteBuffer::RemoveVertices(std::vector<VertexRef>* vertices) {
+  // Remove the vertices in descending order of their indices within each batch. This way,
+  // the last vertex of a batch, which is moved into the place of the removed vertex, never
+  // belongs to the object itself (unless it is the removed vertex).
+  std::sort(vertices->begin(), vertices->end(), [](const VertexRef& a, const VertexRef& b) {
+    return (a.batchIndex != b.batchIndex) ? (a.batchIndex < b.batchIndex) : (a.vertexIndex > b.vertexIndex);
+  });
+  
+  for (const VertexRef& ref : *vertices) {
+    Batch& batch = batches[ref.batchIndex];
+    u32 lastIndex = batch.GetNumVertices() - 1;
+    
+    if (ref.vertexIndex != lastIndex) {
+      // Move the last vertex into the place of the removed one.
+      memcpy(batch.vertices.data() + ref.vertexIndex * batch.vertexSize,
+             batch.vertices.data() + lastIndex * batch.vertexSize,
+             batch.vertexSize);
+      u32 movedObjectId = batch.vertexObjectIds[lastIndex];
+      batch.vertexObjectIds[ref.vertexIndex] = movedObjectId;
+      batch.MarkDirty(ref.vertexIndex);
+      
+      for (VertexRef& movedRef : objects.find(movedObjectId)->second.vertices) {
+        if (movedRef.batchIndex == ref.batchIndex && movedRef.vertexIndex == lastIndex) {
+          movedRef.vertexIndex = ref.vertexIndex;
+          break;
+        }
+      }
+    }
+    
+    batch.vertices.resize(batch.vertices.size() - batch.vertexSize);
+    batch.vertexObjectIds.pop_back();
+  }
+  
+  vertices->clear();
+}
+
+u32 StaticSpriteBuffer::GetBatchIndex(Pass pass, Texture* texture, int vertexSize) {
+  for (usize i = 0; i < batches.size(); ++ i) {
+    if (batches[i].pass == pass && batches[i].texture == texture) {
+      return i;
+    }
+  }
+  
+  batches.emplace_back();
+  Batch& batch = batches.back();
+  batch.pass = pass;
+  batch.texture = texture;
+  batch.vertexSize = vertexSize;
+  return batches.size() - 1;
+}
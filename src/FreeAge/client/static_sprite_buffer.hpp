@@ -0,0 +1,153 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <QOpenGLFunctions_3_2_Core>
+
+#include "FreeAge/common/free_age.hpp"
+
+class SpriteShader;
+class Texture;
+
+/// Keeps the sprite vertices of objects whose appearance usually does not change from frame to frame
+/// (for example, completed buildings and resources such as trees, mines, and forage bushes) in GPU buffers.
+/// In contrast to the vertices that are streamed anew in each frame (see DrawSprite()), these vertices only
+/// need to be written when an object is added, removed, or changes its appearance. All vertices for a pass
+/// and texture are then rendered with a single draw call, regardless of whether they are in view.
+///
+/// The vertices use the (view-independent) vertex format of SpriteShader, see WriteSpriteVertex().
+/// Within each batch, the vertices are kept densely packed: removing a vertex moves the last vertex
+/// of the batch into its place.
+class StaticSpriteBuffer {
+ public:
+  /// The render passes for which static sprites are kept.
+  enum class Pass {
+    Shadow = 0,
+    /// Graphics of objects that cause outlines for the units behind them.
+    GraphicCausingOutlines,
+    /// Graphics of all other objects.
+    Graphic,
+    NumPasses
+  };
+  
+  /// The properties of an object that determine its vertices. As long as these do not change,
+  /// the object's vertices do not need to be re-written.
+  struct ObjectState {
+    inline bool operator== (const ObjectState& other) const {
+      return sprite == other.sprite &&
+             frameIndex == other.frameIndex &&
+             modulationColor == other.modulationColor &&
+             centerProjectedX == other.centerProjectedX &&
+             centerProjectedY == other.centerProjectedY;
+    }
+    inline bool operator!= (const ObjectState& other) const { return !(*this == other); }
+    
+    const void* sprite;
+    int frameIndex;
+    u32 modulationColor;
+    float centerProjectedX;
+    float centerProjectedY;
+  };
+  
+  StaticSpriteBuffer() = default;
+  ~StaticSpriteBuffer();
+  
+  StaticSpriteBuffer(const StaticSpriteBuffer& other) = delete;
+  StaticSpriteBuffer& operator= (const StaticSpriteBuffer& other) = delete;
+  
+  /// Returns true if the object is not in the buffer yet, or if its vertices were written for a different state.
+  inline bool NeedsUpdate(u32 objectId, const ObjectState& state) const {
+    auto it = objects.find(objectId);
+    return it == objects.end() || it->second.state != state;
+  }
+  
+  /// Starts (re-)writing the vertices of the given object: removes its previous vertices (if any)
+  /// and remembers the given state. The new vertices must then be added with AddVertex().
+  void SetObject(u32 objectId, const ObjectState& state);
+  
+  /// Adds a vertex to the given object (which must have been passed to SetObject() before), which is
+  /// to be rendered in the given pass with the given texture. Returns a pointer to the vertexSize bytes
+  /// that the vertex data must be written to. The pointer is only valid until the next call to a
+  /// non-const function of this class.
+  u8* AddVertex(u32 objectId, Pass pass, Texture* texture, int vertexSize);
+  
+  /// Removes all vertices of the given object. Does nothing if the object is not in the buffer.
+  void RemoveObject(u32 objectId);
+  
+  /// Removes all objects.
+  void Clear();
+  
+  /// Uploads the changes since the last call to the GPU. Returns the number of bytes that were uploaded.
+  usize Upload(QOpenGLFunctions_3_2_Core* f);
+  
+  /// Renders all vertices of the given pass. Upload() must have been called after the last change.
+  void Render(Pass pass, SpriteShader* shader, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Deletes the OpenGL buffers. Must be called with the OpenGL context current if Upload() was called before.
+  void Destroy();
+  
+  inline usize GetNumObjects() const { return objects.size(); }
+  
+  /// Returns the total number of vertices in the given pass.
+  usize GetNumVertices(Pass pass) const;
+  
+ private:
+  /// All vertices that are rendered in a given pass with a given texture.
+  struct Batch {
+    Pass pass;
+    Texture* texture;
+    int vertexSize;
+    
+    /// Vertex data (on the CPU). Its size is a multiple of vertexSize.
+    std::vector<u8> vertices;
+    
+    /// The ID of the object that each vertex belongs to.
+    std::vector<u32> vertexObjectIds;
+    
+    /// Range of vertex indices [dirtyBegin, dirtyEnd) that has been changed since the last upload.
+    usize dirtyBegin = 0;
+    usize dirtyEnd = 0;
+    
+    /// OpenGL buffer (0 if not created yet) and its size in bytes.
+    GLuint buffer = 0;
+    usize bufferSize = 0;
+    
+    inline usize GetNumVertices() const { return vertexObjectIds.size(); }
+    
+    inline void MarkDirty(usize vertexIndex) {
+      if (dirtyBegin == dirtyEnd) {
+        dirtyBegin = vertexIndex;
+        dirtyEnd = vertexIndex + 1;
+      } else {
+        dirtyBegin = std::min(dirtyBegin, vertexIndex);
+        dirtyEnd = std::max(dirtyEnd, vertexIndex + 1);
+      }
+    }
+  };
+  
+  /// Reference to a vertex: index of the batch in batches, and index of the vertex within the batch.
+  struct VertexRef {
+    u32 batchIndex;
+    u32 vertexIndex;
+  };
+  
+  struct Object {
+    ObjectState state;
+    std::vector<VertexRef> vertices;
+  };
+  
+  /// Removes the given vertices (which must all belong to the same object) from their batches and clears the vector.
+  void RemoveVertices(std::vector<VertexRef>* vertices);
+  
+  /// Returns the index of the batch for the given pass and texture, creating it if necessary.
+  u32 GetBatchIndex(Pass pass, Texture* texture, int vertexSize);
+  
+  std::vector<Batch> batches;
+  std::unordered_map<u32, Object> objects;
+};
@@ -0,0 +1,162 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/streaming_vertex_buffer.hpp"
+
+#include <limits>
+
+#include <QOpenGLContext>
+
+#include "FreeAge/client/opengl.hpp"
+
+// GL_ARB_buffer_storage (core in OpenGL 4.4)
+#ifndef GL_MAP_PERSISTENT_BIT
+  #define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+  #define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+StreamingVertexBuffer::~StreamingVertexBuffer() {
+  if (buffer != 0) {
+    LOG(ERROR) << "StreamingVertexBuffer object was destroyed without Destroy() being called first.";
+  }
+}
+
+void StreamingVertexBuffer::Initialize(usize segmentSize, QOpenGLFunctions_3_2_Core* f) {
+  this->f = f;
+  
+  QOpenGLContext* context = QOpenGLContext::currentContext();
+  if (context->hasExtension("GL_ARB_buffer_storage")) {
+    glBufferStorage = reinterpret_cast<BufferStorageFunction>(context->getProcAddress("glBufferStorage"));
+  }
+  persistent = (glBufferStorage != nullptr);
+  LOG(1) << "StreamingVertexBuffer: Using " << (persistent ? "persistent" : "unsynchronized") << " mapping";
+  
+  CreateBuffer(segmentSize);
+  currentSegment = 0;
+}
+
+void StreamingVertexBuffer::Destroy() {
+  if (buffer == 0) {
+    return;
+  }
+  
+  DeleteBuffer();
+  f = nullptr;
+}
+
+void StreamingVertexBuffer::BeginFrame() {
+  if (mapping && !persistent) {
+    // EndFrame() was not called for the previous frame.
+    Unmap();
+  }
+  
+  // Wait for the GPU to finish the frame that last used this segment.
+  if (fences[currentSegment]) {
+    GLenum result = f->glClientWaitSync(fences[currentSegment], GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+    if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED) {
+      LOG(ERROR) << "glClientWaitSync() failed; result code: " << result;
+    }
+    
+    f->glDeleteSync(fences[currentSegment]);
+    fences[currentSegment] = nullptr;
+  }
+  
+  writeOffset = currentSegment * segmentSize;
+  segmentEnd = writeOffset + segmentSize;
+  requestedSize = 0;
+}
+
+void StreamingVertexBuffer::EndFrame() {
+  if (!persistent) {
+    Unmap();
+  }
+  
+  if (requestedSize > segmentSize) {
+    // Enlarge the buffer for the following frames. The old buffer is only released by the driver once
+    // the GPU is done with it, so it is not necessary to wait for the pending frames here.
+    usize newSegmentSize = segmentSize;
+    while (newSegmentSize < requestedSize) {
+      newSegmentSize *= 2;
+    }
+    LOG(WARNING) << "StreamingVertexBuffer: Frame required " << requestedSize << " bytes, but the segment size is " << segmentSize
+                 << ". Some sprites were not rendered. Enlarging the segment size to " << newSegmentSize << " bytes.";
+    
+    DeleteBuffer();
+    CreateBuffer(newSegmentSize);
+    currentSegment = 0;
+    return;
+  }
+  
+  fences[currentSegment] = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  currentSegment = (currentSegment + 1) % kNumFramesInFlight;
+}
+
+void StreamingVertexBuffer::Unmap() {
+  if (!mapping || persistent) {
+    // For persistent mappings, GL_MAP_COHERENT_BIT makes the writes visible to subsequent commands.
+    return;
+  }
+  
+  f->glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  f->glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, writeOffset - mappingOffset);
+  f->glUnmapBuffer(GL_ARRAY_BUFFER);
+  CHECK_OPENGL_NO_ERROR();
+  
+  mapping = nullptr;
+}
+
+void StreamingVertexBuffer::CreateBuffer(usize newSegmentSize) {
+  segmentSize = newSegmentSize;
+  usize bufferSize = kNumFramesInFlight * segmentSize;
+  
+  f->glGenBuffers(1, &buffer);
+  f->glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  if (persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, bufferSize, nullptr, flags);
+    mapping = static_cast<u8*>(f->glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, flags));
+    mappingOffset = 0;
+    if (!mapping) {
+      LOG(ERROR) << "Failed to map the streaming vertex buffer persistently; falling back to unsynchronized mapping";
+      persistent = false;
+      f->glDeleteBuffers(1, &buffer);
+      CreateBuffer(newSegmentSize);
+      return;
+    }
+  } else {
+    f->glBufferData(GL_ARRAY_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+  }
+  CHECK_OPENGL_NO_ERROR();
+}
+
+void StreamingVertexBuffer::DeleteBuffer() {
+  if (mapping) {
+    f->glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    f->glUnmapBuffer(GL_ARRAY_BUFFER);
+    mapping = nullptr;
+  }
+  
+  for (int i = 0; i < kNumFramesInFlight; ++ i) {
+    if (fences[i]) {
+      f->glDeleteSync(fences[i]);
+      fences[i] = nullptr;
+    }
+  }
+  
+  f->glDeleteBuffers(1, &buffer);
+  buffer = 0;
+}
+
+void StreamingVertexBuffer::Map() {
+  f->glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  mapping = static_cast<u8*>(f->glMapBufferRange(
+      GL_ARRAY_BUFFER,
+      writeOffset,
+      segmentEnd - writeOffset,
+      GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
+  mappingOffset = writeOffset;
+  CHECK_OPENGL_NO_ERROR();
+}
@@ -0,0 +1,106 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <QOpenGLFunctions>
+#include <QOpenGLFunctions_3_2_Core>
+
+#include "FreeAge/common/free_age.hpp"
+
+/// A vertex buffer for vertex data that is generated anew in every frame (such as the sprite vertices).
+///
+/// The buffer is split into kNumFramesInFlight segments, which are used as a ring: each frame writes
+/// into the next segment, and a fence is inserted after the frame's commands. Before a segment is
+/// written to again, its fence is waited on; since this fence belongs to a frame that was submitted
+/// kNumFramesInFlight - 1 frames earlier, this usually returns immediately. Thus, the CPU does not
+/// need to wait for the GPU to finish each frame before starting with the next one, while the vertex
+/// data can still be written without any implicit synchronization by the driver.
+///
+/// If GL_ARB_buffer_storage is available, the buffer is mapped persistently once. Otherwise, the
+/// remaining part of the current segment is mapped (unsynchronized) on the first Allocate() call after
+/// creation or after Unmap(), which must be called before drawing from the buffer.
+class StreamingVertexBuffer {
+ public:
+  static constexpr int kNumFramesInFlight = 3;
+  
+  StreamingVertexBuffer() = default;
+  ~StreamingVertexBuffer();
+  
+  StreamingVertexBuffer(const StreamingVertexBuffer& other) = delete;
+  StreamingVertexBuffer& operator= (const StreamingVertexBuffer& other) = delete;
+  
+  /// Creates the buffer with the given size per frame (in bytes). Must be called with the OpenGL context current.
+  void Initialize(usize segmentSize, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Deletes the buffer and all fences. Must be called with the OpenGL context current.
+  void Destroy();
+  
+  /// Starts writing to the next segment. This waits until the GPU has finished reading this segment
+  /// if it is still in use by a previous frame.
+  void BeginFrame();
+  
+  /// Inserts a fence after the commands of the current frame. If the current frame required more
+  /// space than the segment size, the buffer is enlarged for the following frames.
+  void EndFrame();
+  
+  /// Returns a pointer to @p size bytes within the current segment that may be written to, and returns
+  /// their offset in the buffer in @p offset. Returns nullptr if the current segment is full.
+  inline u8* Allocate(usize size, usize* offset) {
+    requestedSize += size;
+    if (writeOffset + size > segmentEnd) {
+      return nullptr;
+    }
+    if (!mapping) {
+      Map();
+      if (!mapping) {
+        return nullptr;
+      }
+    }
+    *offset = writeOffset;
+    u8* result = mapping + (writeOffset - mappingOffset);
+    writeOffset += size;
+    return result;
+  }
+  
+  /// Makes the data that was written since the last call available to the GPU. Must be called
+  /// before rendering from the buffer.
+  void Unmap();
+  
+  inline GLuint GetBuffer() const { return buffer; }
+  inline bool IsPersistentlyMapped() const { return persistent; }
+  
+ private:
+  void CreateBuffer(usize newSegmentSize);
+  void DeleteBuffer();
+  void Map();
+  
+  typedef void (QOPENGLF_APIENTRYP BufferStorageFunction)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+  
+  /// glBufferStorage() from GL_ARB_buffer_storage, or nullptr if it is not available.
+  BufferStorageFunction glBufferStorage = nullptr;
+  
+  /// Whether the buffer is mapped persistently (requires GL_ARB_buffer_storage).
+  bool persistent = false;
+  
+  GLuint buffer = 0;
+  usize segmentSize = 0;
+  
+  /// Fences for the frames that last wrote to each segment, or nullptr if there is no pending frame.
+  GLsync fences[kNumFramesInFlight] = {nullptr};
+  int currentSegment = 0;
+  
+  usize writeOffset = 0;
+  usize segmentEnd = 0;
+  
+  /// Number of bytes that were requested in the current frame (including those that did not fit).
+  usize requestedSize = 0;
+  
+  /// Pointer to the mapped memory, or nullptr if the buffer is not mapped currently.
+  /// mapping[0] corresponds to the buffer offset mappingOffset.
+  u8* mapping = nullptr;
+  usize mappingOffset = 0;
+  
+  QOpenGLFunctions_3_2_Core* f = nullptr;
+};
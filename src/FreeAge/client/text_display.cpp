@@ -4,54 +4,160 @@
 
 #include "FreeAge/client/text_display.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 
-#include <QImage>
+#include <QFontMetricsF>
+#include <QGlyphRun>
+#include <QOpenGLContext>
 #include <QOpenGLFunctions_3_2_Core>
-#include <QPainter>
+#include <QTextLayout>
 
-TextDisplay::~TextDisplay() {
-  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+TextRenderer::~TextRenderer() {
+  if (vertexBuffer != 0) {
+    LOG(ERROR) << "TextRenderer object was destroyed without Destroy() being called first.";
+  }
+}
+
+void TextRenderer::AddQuad(const QRectF& rect, const QRect& atlasRect, QRgb color) {
+  float atlasFactor = 1.f / atlas.GetSize();
+  float left = rect.x();
+  float top = rect.y();
+  float right = rect.x() + rect.width();
+  float bottom = rect.y() + rect.height();
+  float texLeft = atlasFactor * atlasRect.x();
+  float texTop = atlasFactor * atlasRect.y();
+  float texRight = atlasFactor * (atlasRect.x() + atlasRect.width());
+  float texBottom = atlasFactor * (atlasRect.y() + atlasRect.height());
+  
+  Vertex vertex;
+  vertex.color[0] = qRed(color);
+  vertex.color[1] = qGreen(color);
+  vertex.color[2] = qBlue(color);
+  vertex.color[3] = qAlpha(color);
+  auto addVertex = [&](float x, float y, float texX, float texY) {
+    vertex.x = x;
+    vertex.y = y;
+    vertex.texX = texX;
+    vertex.texY = texY;
+    vertices.push_back(vertex);
+  };
+  
+  addVertex(left, top, texLeft, texTop);
+  addVertex(right, top, texRight, texTop);
+  addVertex(left, bottom, texLeft, texBottom);
+  
+  addVertex(right, top, texRight, texTop);
+  addVertex(right, bottom, texRight, texBottom);
+  addVertex(left, bottom, texLeft, texBottom);
+}
+
+void TextRenderer::Render(TextShader* shader, QOpenGLFunctions_3_2_Core* f) {
+  if (vertices.empty()) {
+    ClearAtlasIfRequested();
+    return;
+  }
+  
+  atlas.Upload(f);
+  
+  ShaderProgram* program = shader->GetProgram();
+  program->UseProgram(f);
+  f->glUniform1i(shader->GetTextureLocation(), 0);  // use GL_TEXTURE0
+  f->glBindTexture(GL_TEXTURE_2D, atlas.GetTextureId());
+  
+  if (vertexBuffer == 0) {
+    f->glGenBuffers(1, &vertexBuffer);
+  }
+  f->glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  usize size = vertices.size() * sizeof(Vertex);
+  if (size > vertexBufferSize) {
+    vertexBufferSize = 2 * size;
+  }
+  // Re-specifying the buffer orphans its previous contents, which may still be in use by the GPU.
+  f->glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, nullptr, GL_STREAM_DRAW);
+  f->glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices.data());
+  
+  program->SetPositionAttribute(
+      2,
+      GetGLType<float>::value,
+      sizeof(Vertex),
+      offsetof(Vertex, x),
+      f);
+  program->SetTexCoordAttribute(
+      2,
+      GetGLType<float>::value,
+      sizeof(Vertex),
+      offsetof(Vertex, texX),
+      f);
+  program->SetColorAttribute(
+      4,
+      GetGLType<u8>::value,
+      sizeof(Vertex),
+      offsetof(Vertex, color),
+      f);
+  
+  f->glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+  CHECK_OPENGL_NO_ERROR();
+  
+  vertices.clear();
+  ClearAtlasIfRequested();
+}
+
+void TextRenderer::ClearAtlasIfRequested() {
+  if (atlasClearRequested) {
+    atlas.Clear();
+    atlasClearRequested = false;
+  }
+}
+
+void TextRenderer::Destroy() {
+  atlas.Destroy();
   
-  if (textureInitialized) {
-    f->glDeleteTextures(1, &textureId);
+  if (vertexBuffer != 0) {
+    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+    f->glDeleteBuffers(1, &vertexBuffer);
+    vertexBuffer = 0;
+    vertexBufferSize = 0;
   }
 }
 
-void TextDisplay::Render(const QFont& font, const QRgb& color, const QString& text, const QRect& rect, int alignmentFlags, GLuint bufferObject, UIShader* uiShader, int widgetWidth, int widgetHeight, QOpenGLFunctions_3_2_Core* f) {
+
+void TextDisplay::Render(const QFont& font, const QRgb& color, const QString& text, const QRect& rect, int alignmentFlags, TextRenderer* renderer) {
+  GlyphAtlas* atlas = renderer->GetAtlas();
   if (font != this->font ||
       text != this->text ||
-      alignmentFlags != this->alignmentFlags) {
+      alignmentFlags != this->alignmentFlags ||
+      atlasGeneration != atlas->GetGeneration()) {
     this->font = font;
     this->text = text;
     this->alignmentFlags = alignmentFlags;
     
-    UpdateTexture(f);
+    bool retriedAfterAtlasClear = requestedAtlasClear;
+    requestedAtlasClear = false;
+    if (!UpdateLayout(atlas)) {
+      // The atlas is full. Other text displays may already have queued quads that refer to the
+      // atlas' current contents, so it cannot be cleared right away. Instead, the text renderer
+      // clears it after drawing the queued quads. This text (and all others, since they notice the
+      // change of the atlas generation) will then be re-added the next time it is rendered.
+      glyphQuads.clear();
+      if (retriedAfterAtlasClear) {
+        LOG(ERROR) << "The glyphs of the text do not fit into the glyph atlas: " << text.toStdString();
+      } else {
+        LOG(WARNING) << "The glyph atlas is full, clearing it.";
+        renderer->RequestAtlasClear();
+        requestedAtlasClear = true;
+      }
+    }
   }
   
-  // Render the texture.
-  ShaderProgram* program = uiShader->GetProgram();
-  program->UseProgram(f);
-  f->glUniform1i(uiShader->GetTextureLocation(), 0);  // use GL_TEXTURE0
-  f->glBindTexture(GL_TEXTURE_2D, textureId);
-  
-  f->glUniform2f(uiShader->GetTexTopLeftLocation(), 0, 0);
-  f->glUniform2f(uiShader->GetTexBottomRightLocation(), 1, 1);
-  
-  f->glUniform2f(
-      uiShader->GetSizeLocation(),
-      2.f * textureWidth / static_cast<float>(widgetWidth),
-      2.f * textureHeight / static_cast<float>(widgetHeight));
-  
-  f->glUniform4f(uiShader->GetModulationColorLocation(), qRed(color) / 255.f, qGreen(color) / 255.f, qBlue(color) / 255.f, qAlpha(color) / 255.f);
-  
   float leftX;
   if (alignmentFlags & Qt::AlignLeft) {
     leftX = rect.x();
   } else if (alignmentFlags & Qt::AlignHCenter) {
-    leftX = rect.x() + 0.5f * rect.width() - 0.5f * textureWidth;
+    leftX = rect.x() + 0.5f * rect.width() - 0.5f * textWidth;
   } else if (alignmentFlags & Qt::AlignRight) {
-    leftX = rect.x() + rect.width() - textureWidth;
+    leftX = rect.x() + rect.width() - textWidth;
   } else {
     LOG(ERROR) << "Missing horizontal alignment for text rendering.";
     leftX = rect.x();
@@ -61,9 +167,9 @@ void TextDisplay::Render(const QFont& font, const QRgb& color, const QString& te
   if (alignmentFlags & Qt::AlignTop) {
     topY = rect.y();
   } else if (alignmentFlags & Qt::AlignVCenter) {
-    topY = rect.y() + 0.5f * rect.height() - 0.5f * textureHeight;
+    topY = rect.y() + 0.5f * rect.height() - 0.5f * textHeight;
   } else if (alignmentFlags & Qt::AlignBottom) {
-    topY = rect.y() + rect.height() - textureHeight;
+    topY = rect.y() + rect.height() - textHeight;
   } else {
     LOG(ERROR) << "Missing vertical alignment for text rendering.";
     topY = rect.y();
@@ -72,72 +178,80 @@ void TextDisplay::Render(const QFont& font, const QRgb& color, const QString& te
   leftX = std::round(leftX);
   topY = std::round(topY);
   
-  bounds = QRect(leftX, topY, textureWidth, textureHeight);
-  
-  int elementSizeInBytes = 3 * sizeof(float);
-  f->glBindBuffer(GL_ARRAY_BUFFER, bufferObject);
-  float* data = static_cast<float*>(f->glMapBufferRange(GL_ARRAY_BUFFER, 0, elementSizeInBytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
-  data[0] = leftX;
-  data[1] = topY;
-  data[2] = 0.f;
-  f->glUnmapBuffer(GL_ARRAY_BUFFER);
+  bounds = QRect(leftX, topY, textWidth, textHeight);
   
-  program->SetPositionAttribute(
-      3,
-      GetGLType<float>::value,
-      3 * sizeof(float),
-      0,
-      f);
-  
-  f->glDrawArrays(GL_POINTS, 0, 1);
-  
-  CHECK_OPENGL_NO_ERROR();
+  for (const GlyphQuad& quad : glyphQuads) {
+    renderer->AddQuad(QRectF(quad.rect).translated(leftX, topY), quad.atlasRect, color);
+  }
 }
 
-void TextDisplay::UpdateTexture(QOpenGLFunctions_3_2_Core* f) {
+bool TextDisplay::UpdateLayout(GlyphAtlas* atlas) {
+  atlasGeneration = atlas->GetGeneration();
+  glyphQuads.clear();
+  
   // Compute the text size.
-  // Note that we currently allocate a dummy image in order to get the correct font
-  // metrics for drawing to QImages via a QPainter on that image. Is there a more efficient way to
-  // get the correct font metrics?
-  QImage dummyImage(1, 1, QImage::Format_RGBA8888);
-  QPainter dummyPainter(&dummyImage);
-  dummyPainter.setFont(font);
-  QFontMetrics fontMetrics = dummyPainter.fontMetrics();
-  QRect constrainRect(0, 0, 0, 0);
-  QRect boundingRect = fontMetrics.boundingRect(constrainRect, alignmentFlags, text);
-  textureWidth = boundingRect.width();
-  textureHeight = boundingRect.height();
-  dummyPainter.end();
-  
-  // Render the text into an image with that size.
-  QImage textImage(textureWidth, textureHeight, QImage::Format_RGBA8888);
-  textImage.fill(qRgba(0, 0, 0, 0));
-  QPainter painter(&textImage);
-  painter.setPen(qRgba(255, 255, 255, 255));
-  painter.setFont(font);
-  painter.drawText(textImage.rect(), alignmentFlags, text);
-  painter.end();
-  
-  // Upload the rendered image to a texture.
-  if (!textureInitialized) {
-    f->glGenTextures(1, &textureId);
-    f->glBindTexture(GL_TEXTURE_2D, textureId);
+  QFontMetricsF fontMetrics(font);
+  QRect boundingRect = fontMetrics.boundingRect(QRectF(0, 0, 0, 0), alignmentFlags, text).toAlignedRect();
+  textWidth = boundingRect.width();
+  textHeight = boundingRect.height();
+  
+  // Lay out the text, with the lines aligned horizontally within the text's bounds.
+  QString layoutText = text;
+  layoutText.replace(QLatin1Char('\n'), QChar::LineSeparator);
+  QTextLayout layout(layoutText, font);
+  QTextOption textOption;
+  textOption.setWrapMode(QTextOption::NoWrap);
+  layout.setTextOption(textOption);
+  
+  layout.beginLayout();
+  float lineY = 0;
+  while (true) {
+    QTextLine line = layout.createLine();
+    if (!line.isValid()) {
+      break;
+    }
     
-    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    float lineX = 0;
+    if (alignmentFlags & Qt::AlignHCenter) {
+      lineX = 0.5f * (textWidth - line.naturalTextWidth());
+    } else if (alignmentFlags & Qt::AlignRight) {
+      lineX = textWidth - line.naturalTextWidth();
+    }
+    line.setPosition(QPointF(lineX, lineY));
+    lineY += line.height();
+  }
+  layout.endLayout();
+  
+  // Look up the glyphs in the atlas. The glyph positions are rounded to full pixels, since the
+  // glyphs in the atlas are rasterized at integer positions.
+  for (const QGlyphRun& glyphRun : layout.glyphRuns()) {
+    QRawFont rawFont = glyphRun.rawFont();
+    QVector<quint32> glyphIndexes = glyphRun.glyphIndexes();
+    QVector<QPointF> positions = glyphRun.positions();
+    for (int i = 0; i < glyphIndexes.size(); ++ i) {
+      const GlyphAtlas::Glyph* glyph = atlas->GetGlyph(rawFont, glyphIndexes[i]);
+      if (!glyph) {
+        return false;
+      }
+      if (glyph->atlasRect.isEmpty()) {
+        continue;
+      }
+      
+      QPoint position(std::round(positions[i].x()), std::round(positions[i].y()));
+      glyphQuads.push_back(GlyphQuad{QRect(position + glyph->offset, glyph->atlasRect.size()), glyph->atlasRect});
+    }
     
-    textureInitialized = true;
-  } else {
-    f->glBindTexture(GL_TEXTURE_2D, textureId);
+    // QRawFont does not render text decorations. Since strike-out is used for the names of defeated players,
+    // draw it as a solid rectangle.
+    if (glyphRun.strikeOut() && !positions.empty()) {
+      QRectF runRect = glyphRun.boundingRect();
+      float lineWidth = std::max<float>(1, std::round(fontMetrics.lineWidth()));
+      float lineTop = std::round(positions[0].y() - fontMetrics.strikeOutPos() - 0.5f * lineWidth);
+      glyphQuads.push_back(GlyphQuad{
+          QRect(std::round(runRect.x()), lineTop, std::round(runRect.width()), lineWidth),
+          atlas->GetSolidRect()});
+    }
   }
   
-  f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-  f->glTexImage2D(
-      GL_TEXTURE_2D,
-      0, GL_RGBA,
-      textImage.width(), textImage.height(),
-      0, GL_BGRA, GL_UNSIGNED_BYTE,
-      textImage.scanLine(0));
+  return true;
 }
@@ -4,40 +4,109 @@
 
 #pragma once
 
+#include <vector>
+
 #include <QFont>
 #include <QRect>
 #include <QRgb>
 #include <QString>
 
+#include "FreeAge/client/glyph_atlas.hpp"
 #include "FreeAge/client/opengl.hpp"
-#include "FreeAge/client/shader_ui.hpp"
+#include "FreeAge/client/shader_text.hpp"
 
-/// Helper class for text rendering, based on Qt's text rendering.
-/// It works by drawing the text to a CPU image first and then transferring this image to the GPU.
-/// Pro: Since this uses Qt's text renderer, it can probably deal with any kinds of obscure languages correctly.
-/// Con: Transferring the text images to the GPU is slow. This operation must be done every time the text changes.
-class TextDisplay {
+/// Batched text renderer: Collects the glyph quads of all texts that are rendered with TextDisplay::Render(),
+/// and draws them with a single draw call in Render(). The glyphs are taken from a shared GlyphAtlas.
+///
+/// Since the text is only drawn in Render(), UI elements that are rendered after a TextDisplay::Render() call
+/// but before the next TextRenderer::Render() call will be below the text.
+class TextRenderer {
  public:
-  /// Deallocates OpenGL resources, thus needs an active OpenGL context.
-  ~TextDisplay();
+  TextRenderer() = default;
+  ~TextRenderer();
+  
+  TextRenderer(const TextRenderer& other) = delete;
+  TextRenderer& operator= (const TextRenderer& other) = delete;
+  
+  /// Adds a quad with the given rectangle (in pixels) that shows the given rectangle of the glyph atlas.
+  void AddQuad(const QRectF& rect, const QRect& atlasRect, QRgb color);
+  
+  /// Draws all quads that were added since the last call and removes them.
+  /// Afterwards, clears the glyph atlas if this was requested with RequestAtlasClear().
+  void Render(TextShader* shader, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Requests the glyph atlas to be cleared once the quads that were added so far have been drawn.
+  /// The atlas must not be cleared directly while quads that refer to its glyphs are pending.
+  inline void RequestAtlasClear() { atlasClearRequested = true; }
+  
+  /// Deletes the OpenGL resources. Must be called with the OpenGL context current.
+  void Destroy();
+  
+  inline GlyphAtlas* GetAtlas() { return &atlas; }
+  
+ private:
+  struct Vertex {
+    float x;
+    float y;
+    float texX;
+    float texY;
+    u8 color[4];  // RGBA
+  };
+  
+  /// Clears the atlas if this was requested. Must only be called when no quads are pending.
+  void ClearAtlasIfRequested();
   
-  void Render(const QFont& font, const QRgb& color, const QString& text, const QRect& rect, int alignmentFlags, GLuint bufferObject, UIShader* uiShader, int widgetWidth, int widgetHeight, QOpenGLFunctions_3_2_Core* f);
+  
+  GlyphAtlas atlas;
+  bool atlasClearRequested = false;
+  
+  /// The vertices (two triangles per quad) that were added since the last call to Render().
+  std::vector<Vertex> vertices;
+  
+  GLuint vertexBuffer = 0;
+  usize vertexBufferSize = 0;
+};
+
+/// Helper class for text rendering, based on Qt's text layouting.
+/// The text is laid out with QTextLayout (thus, Qt deals with kerning, complex scripts, font fallback, etc.)
+/// whenever it changes. The resulting glyphs are rasterized only once into the shared GlyphAtlas of the
+/// TextRenderer. Thus, changing the text (for example, of a counter) only requires a few vertices to be
+/// written instead of rasterizing the whole text and uploading it to a texture.
+class TextDisplay {
+ public:
+  /// Adds the text to the given text renderer, which will draw it in its next TextRenderer::Render() call.
+  void Render(const QFont& font, const QRgb& color, const QString& text, const QRect& rect, int alignmentFlags, TextRenderer* renderer);
   
   /// Returns the bounds of the last rendered text.
   inline const QRect& GetBounds() const { return bounds; }
   
  private:
-  void UpdateTexture(QOpenGLFunctions_3_2_Core* f);
+  struct GlyphQuad {
+    /// Rectangle of the glyph relative to the top-left of the text (in pixels).
+    QRect rect;
+    
+    /// Rectangle of the glyph in the glyph atlas.
+    QRect atlasRect;
+  };
+  
+  /// Lays out the text and looks up its glyphs in the atlas. Returns false if the atlas is full.
+  bool UpdateLayout(GlyphAtlas* atlas);
   
   
   QString text;
   QFont font;
   int alignmentFlags = -1;
   
-  bool textureInitialized = false;
-  GLuint textureId;
-  int textureWidth;
-  int textureHeight;
+  /// Generation of the glyph atlas that the glyphQuads refer to.
+  u32 atlasGeneration = 0;
+  
+  /// Whether this display requested the atlas to be cleared because it was full (in the generation
+  /// before atlasGeneration). Used to detect texts that do not even fit into an empty atlas.
+  bool requestedAtlasClear = false;
+  
+  std::vector<GlyphQuad> glyphQuads;
+  int textWidth;
+  int textHeight;
   
   QRect bounds;
 };
@@ -4,8 +4,11 @@
 
 #include "FreeAge/client/texture.hpp"
 
+#include <atomic>
+
 #include <mango/image/image.hpp>
 
+#include "FreeAge/client/mod_manager.hpp"
 #include "FreeAge/client/opengl.hpp"
 
 
@@ -17,6 +20,12 @@ static void PrintGPUMemoryUsage() {
   LOG(1) << "Approx. GPU memory usage: " << static_cast<int>(debugUsedGPUMemory / (1024.f * 1024.f) + 0.5f) << " MB";
 }
 
+/// Returns a new value for Texture::uniqueId. Textures may be loaded by multiple threads.
+static u64 GenerateUniqueTextureId() {
+  static std::atomic<u64> nextUniqueId(1);
+  return nextUniqueId++;
+}
+
 
 Texture* TextureManager::GetOrLoad(const std::filesystem::path& path, Loader loader, int wrapMode, int magFilter, int minFilter) {
   TextureSettings settings(path.string(), wrapMode, magFilter, minFilter);
@@ -29,7 +38,7 @@ Texture* TextureManager::GetOrLoad(const std::filesystem::path& path, Loader loa
   // Load the texture.
   Texture* newTexture = new Texture();
   if (loader == Loader::QImage) {
-    QImage image(path.string().c_str());
+    QImage image = LoadImageFile(path);
     if (image.isNull()) {
       LOG(ERROR) << "Failed to load as QImage: " << path;
       return nullptr;
@@ -78,7 +87,7 @@ Texture::~Texture() {
     QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
     f->glDeleteTextures(1, &textureId);
     
-    debugUsedGPUMemory -= width * height * bytesPerPixel;
+    debugUsedGPUMemory -= width * height * layerCount * bytesPerPixel;
     // NOTE: We do not print the new memory usage here to prevent log spam on program exit.
     // PrintGPUMemoryUsage();
   }
@@ -93,6 +102,7 @@ void Texture::CreateEmpty(int width, int height, int wrapMode, int magFilter, in
   
   f->glGenTextures(1, &textureId);
   f->glBindTexture(GL_TEXTURE_2D, textureId);
+  uniqueId = GenerateUniqueTextureId();
   
   f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
   f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
@@ -115,6 +125,7 @@ void Texture::Load(const QImage& image, int wrapMode, int magFilter, int minFilt
   
   f->glGenTextures(1, &textureId);
   f->glBindTexture(GL_TEXTURE_2D, textureId);
+  uniqueId = GenerateUniqueTextureId();
   
   f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
   f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
@@ -150,7 +161,7 @@ void Texture::Load(const QImage& image, int wrapMode, int magFilter, int minFilt
 bool Texture::Load(const std::filesystem::path& path, int wrapMode, int magFilter, int minFilter) {
   QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
   
-  mango::Bitmap bitmap(path.string(), mango::Format(32, mango::Format::UNORM, mango::Format::BGRA, 8, 8, 8, 8));
+  mango::Bitmap bitmap = LoadBitmapFile(path, mango::Format(32, mango::Format::UNORM, mango::Format::BGRA, 8, 8, 8, 8));
   if (bitmap.width <= 0) {
     LOG(ERROR) << "Failed to load image: " << path.string();
     return false;
@@ -162,6 +173,7 @@ bool Texture::Load(const std::filesystem::path& path, int wrapMode, int magFilte
   
   f->glGenTextures(1, &textureId);
   f->glBindTexture(GL_TEXTURE_2D, textureId);
+  uniqueId = GenerateUniqueTextureId();
   
   f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
   f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
@@ -183,3 +195,145 @@ bool Texture::Load(const std::filesystem::path& path, int wrapMode, int magFilte
   CHECK_OPENGL_NO_ERROR();
   return true;
 }
+
+void Texture::CreateEmptyArray(int width, int height, int layerCount, bool singleChannel, int wrapMode, int magFilter, int minFilter) {
+  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+  
+  this->width = width;
+  this->height = height;
+  this->layerCount = layerCount;
+  this->wrapMode = wrapMode;
+  this->magFilter = magFilter;
+  this->minFilter = minFilter;
+  target = GL_TEXTURE_2D_ARRAY;
+  bytesPerPixel = singleChannel ? 1 : 4;
+  
+  textureId = CreateArrayTextureObject(layerCount, f);
+  ClearArrayLayers(textureId, 0, layerCount, f);
+  
+  debugUsedGPUMemory += width * height * layerCount * bytesPerPixel;
+  PrintGPUMemoryUsage();
+  CHECK_OPENGL_NO_ERROR();
+}
+
+void Texture::GrowArray(int newLayerCount) {
+  CHECK_EQ(target, GL_TEXTURE_2D_ARRAY);
+  if (newLayerCount <= layerCount) {
+    return;
+  }
+  
+  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+  
+  GLuint newTextureId = CreateArrayTextureObject(newLayerCount, f);
+  
+  // Copy the existing layers into the new texture object.
+  GLuint framebuffer = 0;
+  f->glGenFramebuffers(1, &framebuffer);
+  f->glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  f->glBindTexture(GL_TEXTURE_2D_ARRAY, newTextureId);
+  for (int layer = 0; layer < layerCount; ++ layer) {
+    f->glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureId, 0, layer);
+    f->glReadBuffer(GL_COLOR_ATTACHMENT0);
+    f->glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, 0, 0, width, height);
+  }
+  f->glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  f->glDeleteFramebuffers(1, &framebuffer);
+  
+  ClearArrayLayers(newTextureId, layerCount, newLayerCount, f);
+  
+  f->glDeleteTextures(1, &textureId);
+  textureId = newTextureId;
+  
+  debugUsedGPUMemory += width * height * (newLayerCount - layerCount) * bytesPerPixel;
+  PrintGPUMemoryUsage();
+  layerCount = newLayerCount;
+  CHECK_OPENGL_NO_ERROR();
+}
+
+void Texture::LoadArrayLayerRegion(const QImage& image, int x, int y, int layer) {
+  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+  
+  CHECK_EQ(target, GL_TEXTURE_2D_ARRAY);
+  f->glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+  
+  // QImage scan lines are aligned to multiples of 4 bytes. Ensure that OpenGL reads this correctly.
+  f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  
+  if (image.format() == QImage::Format_ARGB32 && bytesPerPixel == 4) {
+    f->glTexSubImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        0, x, y, layer,
+        image.width(), image.height(), 1,
+        GL_BGRA, GL_UNSIGNED_BYTE,
+        image.scanLine(0));
+  } else if (image.format() == QImage::Format_Grayscale8 && bytesPerPixel == 1) {
+    f->glTexSubImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        0, x, y, layer,
+        image.width(), image.height(), 1,
+        GL_RED, GL_UNSIGNED_BYTE,
+        image.scanLine(0));
+  } else {
+    LOG(FATAL) << "Unsupported QImage format.";
+  }
+  
+  CHECK_OPENGL_NO_ERROR();
+}
+
+void Texture::CopyToArrayLayerRegion(const Texture& source, int x, int y, int layer) {
+  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+  
+  CHECK_EQ(target, GL_TEXTURE_2D_ARRAY);
+  CHECK_EQ(source.GetTarget(), GL_TEXTURE_2D);
+  
+  GLuint framebuffer = 0;
+  f->glGenFramebuffers(1, &framebuffer);
+  f->glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  f->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source.GetId(), 0);
+  f->glReadBuffer(GL_COLOR_ATTACHMENT0);
+  
+  f->glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+  f->glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layer, 0, 0, source.GetWidth(), source.GetHeight());
+  
+  f->glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  f->glDeleteFramebuffers(1, &framebuffer);
+  CHECK_OPENGL_NO_ERROR();
+}
+
+GLuint Texture::CreateArrayTextureObject(int layerCount, QOpenGLFunctions_3_2_Core* f) {
+  GLuint newTextureId;
+  f->glGenTextures(1, &newTextureId);
+  f->glBindTexture(GL_TEXTURE_2D_ARRAY, newTextureId);
+  
+  f->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrapMode);
+  f->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrapMode);
+  f->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, magFilter);
+  f->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, minFilter);
+  
+  if (bytesPerPixel == 4) {
+    f->glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layerCount, 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+  } else {
+    f->glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, width, height, layerCount, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+  }
+  return newTextureId;
+}
+
+void Texture::ClearArrayLayers(GLuint arrayTextureId, int firstLayer, int endLayer, QOpenGLFunctions_3_2_Core* f) {
+  // The content of textures created with glTexImage3D() and nullptr data is undefined,
+  // so clear the layers by attaching them to a framebuffer.
+  GLuint framebuffer = 0;
+  f->glGenFramebuffers(1, &framebuffer);
+  f->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  
+  GLenum drawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+  f->glDrawBuffers(1, drawBuffers);
+  f->glClearColor(0, 0, 0, 0);
+  
+  for (int layer = firstLayer; layer < endLayer; ++ layer) {
+    f->glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, arrayTextureId, 0, layer);
+    f->glClear(GL_COLOR_BUFFER_BIT);
+  }
+  
+  f->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  f->glDeleteFramebuffers(1, &framebuffer);
+}
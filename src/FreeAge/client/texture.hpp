@@ -6,10 +6,13 @@
 
 #include <filesystem>
 #include <unordered_map>
+#include <vector>
 
 #include <QImage>
 #include <QOpenGLFunctions_3_2_Core>
 
+#include "FreeAge/common/free_age.hpp"
+
 class Texture;
 
 
@@ -82,6 +85,14 @@ class TextureManager {
 /// load it via the TextureManager instead.
 class Texture {
  public:
+  /// A range of consecutive vertices in the sprite vertex buffer (see StreamingVertexBuffer)
+  /// that is to be drawn with this texture being active.
+  struct DrawCall {
+    /// Offset of the first vertex in the buffer, in bytes.
+    usize offset;
+    u32 vertexCount;
+  };
+  
   /// Creates an invalid texture.
   Texture() = default;
   
@@ -99,35 +110,99 @@ class Texture {
   /// The file is assumed to have 8 bits per color channel, with 4 channels in total.
   bool Load(const std::filesystem::path& path, int wrapMode, int magFilter, int minFilter);
   
+  /// Creates an empty GL_TEXTURE_2D_ARRAY texture with the given layer size and number of layers.
+  /// All texels are initialized to zero. If singleChannel is true, the texture has a single
+  /// 8-bit channel, otherwise it has 4 channels with 8 bits each.
+  void CreateEmptyArray(int width, int height, int layerCount, bool singleChannel, int wrapMode, int magFilter, int minFilter);
+  
+  /// Grows an array texture that was created with CreateEmptyArray() to the given number of layers.
+  /// The content of the existing layers is kept, the new layers are initialized to zero.
+  /// Note that this changes the OpenGL texture Id.
+  void GrowArray(int newLayerCount);
+  
+  /// Uploads the given image into the given region of a layer of an array texture.
+  /// The image format must match the texture format (QImage::Format_ARGB32 for 4 channels,
+  /// QImage::Format_Grayscale8 for a single channel).
+  void LoadArrayLayerRegion(const QImage& image, int x, int y, int layer);
+  
+  /// Copies the complete content of the given (non-array) texture into the given region of a layer of this array texture.
+  void CopyToArrayLayerRegion(const Texture& source, int x, int y, int layer);
+  
   /// Returns the OpenGL texture Id.
   GLuint GetId() const { return textureId; }
   
+  /// Returns an Id that identifies the texture's content for caching (see UITextureAtlas).
+  /// In contrast to OpenGL texture Ids, these Ids are never re-used for a different texture,
+  /// even after the texture was deleted. Only set for GL_TEXTURE_2D textures.
+  u64 GetUniqueId() const { return uniqueId; }
+  
+  /// Returns the OpenGL texture target (GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY).
+  GLenum GetTarget() const { return target; }
+  
   int GetWidth() const { return width; }
   int GetHeight() const { return height; }
+  int GetLayerCount() const { return layerCount; }
   
   inline void AddReference() { ++ referenceCount; }
   /// Returns true if the reference count reaches zero.
   inline bool RemoveReference() { -- referenceCount; return referenceCount == 0; }
   inline int GetReferenceCount() const { return referenceCount; }
   
-  inline QByteArray& DrawCallBuffer() { return drawCallBuffer; }
+  inline std::vector<DrawCall>& DrawCalls() { return drawCalls; }
+  
+  /// Adds a vertex of the given size, which was written at the given offset, to the draw calls.
+  /// It is appended to the last draw call if it directly follows its vertices.
+  inline void AddDrawCallVertex(usize offset, int vertexSize) {
+    AddDrawCallVertices(offset, vertexSize, 1);
+  }
+  
+  /// Variant of AddDrawCallVertex() for vertexCount consecutive vertices.
+  inline void AddDrawCallVertices(usize offset, int vertexSize, u32 vertexCount) {
+    if (!drawCalls.empty() &&
+        drawCalls.back().offset + drawCalls.back().vertexCount * vertexSize == offset) {
+      drawCalls.back().vertexCount += vertexCount;
+    } else {
+      drawCalls.push_back({offset, vertexCount});
+    }
+  }
   
  private:
+  /// Creates a new OpenGL array texture object with the settings of this texture and the given number of layers.
+  GLuint CreateArrayTextureObject(int layerCount, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Sets all texels in the layers [firstLayer, endLayer) of the given array texture to zero.
+  void ClearArrayLayers(GLuint arrayTextureId, int firstLayer, int endLayer, QOpenGLFunctions_3_2_Core* f);
+  
+  
   /// OpenGL texture Id.
   GLuint textureId = -1;
   
+  /// See GetUniqueId().
+  u64 uniqueId = 0;
+  
+  /// OpenGL texture target.
+  GLenum target = GL_TEXTURE_2D;
+  
   /// Width of the texture in pixels.
   int width = -1;
   
   /// Height of the texture in pixels.
   int height;
   
+  /// Number of layers (only larger than one for array textures).
+  int layerCount = 1;
+  
+  /// Texture parameters (only stored for array textures, which may need to be re-created in GrowArray()).
+  int wrapMode;
+  int magFilter;
+  int minFilter;
+  
   /// Bytes per pixel (used for keeping track of the used GPU memory only).
   int bytesPerPixel;
   
   /// Reference count (only to be used if the Texture is loaded via the TextureManager).
   int referenceCount = 0;
   
-  /// Temporary helper buffer for accumulating vertex data to draw with this texture being active.
-  QByteArray drawCallBuffer;
+  /// Temporary list of vertex ranges to draw with this texture being active.
+  std::vector<DrawCall> drawCalls;
 };
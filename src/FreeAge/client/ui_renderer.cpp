@@ -0,0 +1,379 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/client/ui_renderer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+#include <QImage>
+#include <QOpenGLContext>
+
+#include "FreeAge/common/logging.hpp"
+#include "FreeAge/client/opengl.hpp"
+#include "FreeAge/client/shader_ui.hpp"
+#include "FreeAge/client/texture.hpp"
+#include "RectangleBinPack/MaxRectsBinPack.h"
+
+/// Size of the replicated border around each texture in the atlas.
+constexpr int kBorder = 1;
+
+/// Number of calls to UITextureAtlas::FinishRendering() without a request for a texture
+/// after which its region is reclaimed.
+constexpr u64 kMaxUnusedRenderCount = 1000;
+
+/// Interval (in calls to UITextureAtlas::FinishRendering()) in which unused regions are reclaimed.
+constexpr u64 kReclaimInterval = 100;
+
+UITextureAtlas::~UITextureAtlas() {
+  if (sharedTexture || !separateTextures.empty()) {
+    LOG(ERROR) << "UITextureAtlas object was destroyed without Destroy() being called first.";
+  }
+}
+
+const UITextureAtlas::Region* UITextureAtlas::GetRegion(const Texture& texture) {
+  auto it = entries.find(texture.GetUniqueId());
+  if (it != entries.end()) {
+    it->second.lastUseRenderCount = renderCount;
+    return &it->second.region;
+  }
+  
+  if (texture.GetTarget() != GL_TEXTURE_2D) {
+    LOG(ERROR) << "Only GL_TEXTURE_2D textures can be added to the UI texture atlas.";
+    return nullptr;
+  }
+  
+  Texture* atlasTexture;
+  int x, y, layer;
+  if (!Allocate(texture.GetWidth() + 2 * kBorder, texture.GetHeight() + 2 * kBorder, &atlasTexture, &x, &y, &layer)) {
+    return nullptr;
+  }
+  
+  // Copy the texture into the atlas. First, copy it with an offset of one pixel into each direction
+  // to create the border, then copy it to its final position (overwriting most of these copies).
+  atlasTexture->CopyToArrayLayerRegion(texture, x, y + kBorder, layer);
+  atlasTexture->CopyToArrayLayerRegion(texture, x + 2 * kBorder, y + kBorder, layer);
+  atlasTexture->CopyToArrayLayerRegion(texture, x + kBorder, y, layer);
+  atlasTexture->CopyToArrayLayerRegion(texture, x + kBorder, y + 2 * kBorder, layer);
+  atlasTexture->CopyToArrayLayerRegion(texture, x + kBorder, y + kBorder, layer);
+  
+  Entry& entry = entries[texture.GetUniqueId()];
+  entry.lastUseRenderCount = renderCount;
+  
+  float factorX = 1.f / atlasTexture->GetWidth();
+  float factorY = 1.f / atlasTexture->GetHeight();
+  entry.region.texture = atlasTexture;
+  entry.region.layer = layer;
+  entry.region.texLeft = factorX * (x + kBorder);
+  entry.region.texTop = factorY * (y + kBorder);
+  entry.region.texRight = factorX * (x + kBorder + texture.GetWidth());
+  entry.region.texBottom = factorY * (y + kBorder + texture.GetHeight());
+  return &entry.region;
+}
+
+const UITextureAtlas::Region* UITextureAtlas::GetSolidRegion() {
+  if (solidRegion.texture != nullptr) {
+    return &solidRegion;
+  }
+  
+  constexpr int kSolidSize = 4;
+  Texture* atlasTexture;
+  int x, y, layer;
+  if (!Allocate(kSolidSize, kSolidSize, &atlasTexture, &x, &y, &layer)) {
+    return nullptr;
+  }
+  
+  QImage image(kSolidSize, kSolidSize, QImage::Format_ARGB32);
+  image.fill(qRgba(255, 255, 255, 255));
+  atlasTexture->LoadArrayLayerRegion(image, x, y, layer);
+  
+  // Only use the center of the area, such that linear filtering does not pick up any pixels outside of it.
+  float factorX = 1.f / atlasTexture->GetWidth();
+  float factorY = 1.f / atlasTexture->GetHeight();
+  solidRegion.texture = atlasTexture;
+  solidRegion.layer = layer;
+  solidRegion.texLeft = factorX * (x + 0.5f * kSolidSize);
+  solidRegion.texTop = factorY * (y + 0.5f * kSolidSize);
+  solidRegion.texRight = solidRegion.texLeft;
+  solidRegion.texBottom = solidRegion.texTop;
+  return &solidRegion;
+}
+
+void UITextureAtlas::FinishRendering() {
+  ++ renderCount;
+  if (renderCount % kReclaimInterval != 0) {
+    return;
+  }
+  
+  for (auto it = entries.begin(); it != entries.end(); ) {
+    if (renderCount - it->second.lastUseRenderCount > kMaxUnusedRenderCount) {
+      Release(it->second.region);
+      it = entries.erase(it);
+    } else {
+      ++ it;
+    }
+  }
+}
+
+void UITextureAtlas::Destroy() {
+  entries.clear();
+  solidRegion = Region();
+  sharedTexture.reset();
+  layers.clear();
+  separateTextures.clear();
+}
+
+bool UITextureAtlas::Allocate(int width, int height, Texture** texture, int* x, int* y, int* layer) {
+  int size = GetLayerSize();
+  if (width > size || height > size) {
+    // The texture does not fit into a layer of the shared texture.
+    // Create a separate texture for it.
+    std::shared_ptr<Texture> separateTexture(new Texture());
+    separateTexture->CreateEmptyArray(width, height, 1, /*singleChannel*/ false, GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+    separateTextures.push_back(separateTexture);
+    
+    *texture = separateTexture.get();
+    *x = 0;
+    *y = 0;
+    *layer = 0;
+    return true;
+  }
+  
+  // Try to fit the texture into one of the existing layers.
+  for (usize layerIndex = 0; layerIndex < layers.size(); ++ layerIndex) {
+    Layer& existingLayer = layers[layerIndex];
+    rbp::Rect rect = existingLayer.packer->Insert(width, height, rbp::MaxRectsBinPack::RectBestShortSideFit);
+    if (rect.height > 0) {
+      ++ existingLayer.allocationCount;
+      *texture = sharedTexture.get();
+      *x = rect.x;
+      *y = rect.y;
+      *layer = layerIndex;
+      return true;
+    }
+  }
+  
+  // Add a new layer.
+  GLint maxLayers = 0;
+  QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+  f->glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+  if (static_cast<int>(layers.size()) >= maxLayers) {
+    LOG(ERROR) << "Exceeded the maximum number of array texture layers (" << maxLayers << ")";
+    return false;
+  }
+  
+  if (!sharedTexture) {
+    sharedTexture.reset(new Texture());
+    sharedTexture->CreateEmptyArray(size, size, 1, /*singleChannel*/ false, GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR);
+  } else {
+    sharedTexture->GrowArray(layers.size() + 1);
+  }
+  
+  layers.emplace_back();
+  Layer& newLayer = layers.back();
+  newLayer.packer.reset(new rbp::MaxRectsBinPack(size, size, /*allowFlip*/ false));
+  newLayer.allocationCount = 1;
+  rbp::Rect rect = newLayer.packer->Insert(width, height, rbp::MaxRectsBinPack::RectBestShortSideFit);
+  if (rect.height <= 0) {
+    LOG(ERROR) << "Internal error: Failed to insert a texture into an empty texture layer.";
+    return false;
+  }
+  
+  *texture = sharedTexture.get();
+  *x = rect.x;
+  *y = rect.y;
+  *layer = layers.size() - 1;
+  return true;
+}
+
+void UITextureAtlas::Release(const Region& region) {
+  if (region.texture == sharedTexture.get()) {
+    Layer& layer = layers[static_cast<int>(region.layer)];
+    -- layer.allocationCount;
+    if (layer.allocationCount == 0) {
+      // Make the complete layer available again.
+      int size = GetLayerSize();
+      layer.packer.reset(new rbp::MaxRectsBinPack(size, size, /*allowFlip*/ false));
+    }
+  } else {
+    for (auto it = separateTextures.begin(); it != separateTextures.end(); ++ it) {
+      if (it->get() == region.texture) {
+        separateTextures.erase(it);
+        return;
+      }
+    }
+    LOG(ERROR) << "UITextureAtlas::Release() called for a region that could not be found.";
+  }
+}
+
+int UITextureAtlas::GetLayerSize() {
+  if (layerSize < 0) {
+    // The UI textures are few, thus use smaller layers than for the sprites.
+    // Most UI textures fit into a layer of this size.
+    constexpr int kPreferredLayerSize = 2048;
+    
+    GLint maxTextureSize = 0;
+    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+    f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    layerSize = std::min<int>(kPreferredLayerSize, maxTextureSize);
+  }
+  return layerSize;
+}
+
+
+UIRenderer::~UIRenderer() {
+  if (vertexBuffer != 0) {
+    LOG(ERROR) << "UIRenderer object was destroyed without Destroy() being called first.";
+  }
+}
+
+void UIRenderer::SetClipRect(const QRectF& rect) {
+  haveClipRect = true;
+  clipRect = rect;
+}
+
+void UIRenderer::ResetClipRect() {
+  haveClipRect = false;
+}
+
+void UIRenderer::AddQuad(float x, float y, float width, float height, const Texture& texture, QRgb modulationColor, float z) {
+  const UITextureAtlas::Region* region = atlas.GetRegion(texture);
+  if (region) {
+    AddRegionQuad(x, y, width, height, *region, modulationColor, z);
+  }
+}
+
+void UIRenderer::AddSolidQuad(float x, float y, float width, float height, QRgb color, float z) {
+  const UITextureAtlas::Region* region = atlas.GetSolidRegion();
+  if (region) {
+    AddRegionQuad(x, y, width, height, *region, color, z);
+  }
+}
+
+void UIRenderer::AddRegionQuad(float x, float y, float width, float height, const UITextureAtlas::Region& region, QRgb color, float z) {
+  float left = x;
+  float top = y;
+  float right = x + width;
+  float bottom = y + height;
+  float texLeft = region.texLeft;
+  float texTop = region.texTop;
+  float texRight = region.texRight;
+  float texBottom = region.texBottom;
+  
+  if (haveClipRect) {
+    float clippedLeft = std::max<float>(left, clipRect.left());
+    float clippedTop = std::max<float>(top, clipRect.top());
+    float clippedRight = std::min<float>(right, clipRect.right());
+    float clippedBottom = std::min<float>(bottom, clipRect.bottom());
+    if (clippedLeft >= clippedRight || clippedTop >= clippedBottom) {
+      return;
+    }
+    
+    // Adjust the texture coordinates proportionally.
+    float texFactorX = (region.texRight - region.texLeft) / width;
+    float texFactorY = (region.texBottom - region.texTop) / height;
+    texLeft = region.texLeft + texFactorX * (clippedLeft - left);
+    texRight = region.texLeft + texFactorX * (clippedRight - left);
+    texTop = region.texTop + texFactorY * (clippedTop - top);
+    texBottom = region.texTop + texFactorY * (clippedBottom - top);
+    
+    left = clippedLeft;
+    top = clippedTop;
+    right = clippedRight;
+    bottom = clippedBottom;
+  }
+  
+  if (drawCalls.empty() || drawCalls.back().texture != region.texture) {
+    drawCalls.push_back(DrawCall{region.texture, static_cast<u32>(vertices.size()), 0});
+  }
+  drawCalls.back().vertexCount += 6;
+  
+  Vertex vertex;
+  vertex.z = z;
+  vertex.layer = region.layer;
+  vertex.color[0] = qRed(color);
+  vertex.color[1] = qGreen(color);
+  vertex.color[2] = qBlue(color);
+  vertex.color[3] = qAlpha(color);
+  auto addVertex = [&](float vx, float vy, float texX, float texY) {
+    vertex.x = vx;
+    vertex.y = vy;
+    vertex.texX = texX;
+    vertex.texY = texY;
+    vertices.push_back(vertex);
+  };
+  
+  addVertex(left, top, texLeft, texTop);
+  addVertex(right, top, texRight, texTop);
+  addVertex(left, bottom, texLeft, texBottom);
+  
+  addVertex(right, top, texRight, texTop);
+  addVertex(right, bottom, texRight, texBottom);
+  addVertex(left, bottom, texLeft, texBottom);
+}
+
+void UIRenderer::Render(UIShader* shader, QOpenGLFunctions_3_2_Core* f) {
+  lastDrawCallCount = 0;
+  if (vertices.empty()) {
+    atlas.FinishRendering();
+    return;
+  }
+  
+  ShaderProgram* program = shader->GetProgram();
+  program->UseProgram(f);
+  f->glUniform1i(shader->GetTextureLocation(), 0);  // use GL_TEXTURE0
+  
+  if (vertexBuffer == 0) {
+    f->glGenBuffers(1, &vertexBuffer);
+  }
+  f->glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  usize size = vertices.size() * sizeof(Vertex);
+  if (size > vertexBufferSize) {
+    vertexBufferSize = 2 * size;
+  }
+  // Re-specifying the buffer orphans its previous contents, which may still be in use by the GPU.
+  f->glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, nullptr, GL_STREAM_DRAW);
+  f->glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices.data());
+  
+  program->SetPositionAttribute(
+      3,
+      GetGLType<float>::value,
+      sizeof(Vertex),
+      offsetof(Vertex, x),
+      f);
+  program->SetTexCoordAttribute(
+      3,
+      GetGLType<float>::value,
+      sizeof(Vertex),
+      offsetof(Vertex, texX),
+      f);
+  program->SetColorAttribute(
+      4,
+      GetGLType<u8>::value,
+      sizeof(Vertex),
+      offsetof(Vertex, color),
+      f);
+  
+  for (const DrawCall& drawCall : drawCalls) {
+    f->glBindTexture(GL_TEXTURE_2D_ARRAY, drawCall.texture->GetId());
+    f->glDrawArrays(GL_TRIANGLES, drawCall.firstVertex, drawCall.vertexCount);
+  }
+  CHECK_OPENGL_NO_ERROR();
+  
+  lastDrawCallCount = drawCalls.size();
+  vertices.clear();
+  drawCalls.clear();
+  atlas.FinishRendering();
+}
+
+void UIRenderer::Destroy() {
+  atlas.Destroy();
+  
+  if (vertexBuffer != 0) {
+    QOpenGLFunctions_3_2_Core* f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+    f->glDeleteBuffers(1, &vertexBuffer);
+    vertexBuffer = 0;
+    vertexBufferSize = 0;
+  }
+}
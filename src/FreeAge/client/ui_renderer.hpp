@@ -0,0 +1,209 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QOpenGLFunctions_3_2_Core>
+#include <QRectF>
+#include <QRgb>
+
+#include "FreeAge/common/free_age.hpp"
+
+namespace rbp {
+  class MaxRectsBinPack;
+}
+class Texture;
+class UIShader;
+
+/// Packs the textures of UI elements into a few large GL_TEXTURE_2D_ARRAY textures, such that
+/// UI elements with different textures can be drawn with a single draw call.
+///
+/// Textures are copied into the atlas (on the GPU) the first time that they are requested.
+/// Each copy gets a border of one pixel which replicates the texture's edge pixels, such that
+/// linear filtering at the edges behaves like GL_CLAMP_TO_EDGE for the original texture.
+/// Textures which are larger than a texture layer get a separate single-layer array texture.
+///
+/// Textures are identified by their unique Id (see Texture::GetUniqueId()), thus a texture that
+/// is deleted and replaced by another one (possibly at the same address or with the same OpenGL
+/// texture Id) is not confused with it. The regions of textures that were not requested for a long
+/// time are reclaimed (see FinishRendering()).
+///
+/// All functions must be called with an OpenGL context being current.
+class UITextureAtlas {
+ public:
+  /// The region of a texture in the atlas.
+  struct Region {
+    /// The array texture that the region is in.
+    Texture* texture = nullptr;
+    
+    /// The texture array layer that the region is in.
+    float layer = 0;
+    
+    /// Texture coordinates of the region's corners.
+    float texLeft = 0;
+    float texTop = 0;
+    float texRight = 0;
+    float texBottom = 0;
+  };
+  
+  UITextureAtlas() = default;
+  ~UITextureAtlas();
+  
+  UITextureAtlas(const UITextureAtlas& other) = delete;
+  UITextureAtlas& operator= (const UITextureAtlas& other) = delete;
+  
+  /// Returns the region of the given texture in the atlas, copying the texture into the atlas if it is not in it yet.
+  /// Returns nullptr if the texture could not be added.
+  /// Changes to the texture's content after it was added are not reflected in the atlas.
+  const Region* GetRegion(const Texture& texture);
+  
+  /// Returns a region whose pixels are opaque white. This may be used to draw single-color rectangles.
+  const Region* GetSolidRegion();
+  
+  /// Must be called after all quads that use the atlas' regions were drawn. Counts the calls, and
+  /// periodically reclaims the regions of textures that were not requested by GetRegion() within
+  /// the last kMaxUnusedRenderCount calls. Since the packers cannot free single rectangles, the space
+  /// of a texture layer becomes available again once all of its regions were reclaimed.
+  void FinishRendering();
+  
+  /// Deletes all textures.
+  void Destroy();
+  
+  inline usize GetNumTextures() const { return entries.size(); }
+  
+ private:
+  struct Entry {
+    Region region;
+    
+    /// Value of renderCount when the region was last requested.
+    u64 lastUseRenderCount;
+  };
+  
+  struct Layer {
+    std::shared_ptr<rbp::MaxRectsBinPack> packer;
+    
+    /// Number of regions in the layer.
+    int allocationCount;
+  };
+  
+  /// Allocates a region of the given size (including the border) in a texture.
+  /// Returns true on success, false otherwise.
+  bool Allocate(int width, int height, Texture** texture, int* x, int* y, int* layer);
+  
+  /// Frees a region that was allocated with Allocate().
+  void Release(const Region& region);
+  
+  /// Returns the size of the (square) texture array layers.
+  int GetLayerSize();
+  
+  
+  /// Maps Texture::GetUniqueId() -> entry of the texture.
+  std::unordered_map<u64, Entry> entries;
+  
+  Region solidRegion;
+  
+  /// Shared array texture and the rectangle packers for each of its layers.
+  std::shared_ptr<Texture> sharedTexture;
+  std::vector<Layer> layers;
+  
+  /// Single-layer textures for textures that are too large for the shared texture.
+  std::vector<std::shared_ptr<Texture>> separateTextures;
+  
+  /// Cached result of GetLayerSize().
+  int layerSize = -1;
+  
+  /// Number of calls to FinishRendering().
+  u64 renderCount = 0;
+};
+
+/// Batched renderer for user interface (UI) elements.
+///
+/// Instead of drawing each UI element with its own draw call, the UI elements are added as
+/// quads with AddQuad() and AddSolidQuad(). The quads of all elements are collected in a single
+/// vertex stream and drawn in Render(). Since the UI textures are packed into a UITextureAtlas,
+/// this usually requires only a single draw call, regardless of the number of UI elements.
+///
+/// The quads are drawn in the order in which they were added, such that later quads are on top
+/// of earlier ones. Consecutive quads whose regions are in the same atlas texture are drawn with
+/// the same draw call.
+///
+/// The quad coordinates are transformed by the view matrix of the shader that is passed to Render().
+/// Thus, the same renderer can be used for elements in screen space (pixels) and in projected
+/// coordinates (for example, health bars).
+class UIRenderer {
+ public:
+  UIRenderer() = default;
+  ~UIRenderer();
+  
+  UIRenderer(const UIRenderer& other) = delete;
+  UIRenderer& operator= (const UIRenderer& other) = delete;
+  
+  /// Clips all quads that are added afterwards to the given rectangle, until ResetClipRect() is called.
+  /// Since the quads are axis-aligned, this is done on the CPU when adding the quads, thus clipping
+  /// does not split up the draw calls.
+  void SetClipRect(const QRectF& rect);
+  void ResetClipRect();
+  
+  /// Adds a quad showing the given texture, multiplied by the given modulation color.
+  void AddQuad(float x, float y, float width, float height, const Texture& texture, QRgb modulationColor, float z = 0);
+  
+  /// Adds a quad with the given color.
+  void AddSolidQuad(float x, float y, float width, float height, QRgb color, float z = 0);
+  
+  /// Adds a quad showing the given region of the atlas, multiplied by the given color.
+  void AddRegionQuad(float x, float y, float width, float height, const UITextureAtlas::Region& region, QRgb color, float z = 0);
+  
+  /// Draws all quads that were added since the last call and removes them.
+  void Render(UIShader* shader, QOpenGLFunctions_3_2_Core* f);
+  
+  /// Deletes the OpenGL resources. Must be called with the OpenGL context current.
+  void Destroy();
+  
+  inline UITextureAtlas* GetAtlas() { return &atlas; }
+  
+  /// Returns the number of draw calls that were used by the last call to Render().
+  inline int GetLastDrawCallCount() const { return lastDrawCallCount; }
+  
+  struct Vertex {
+    float x;
+    float y;
+    float z;
+    float texX;
+    float texY;
+    float layer;
+    u8 color[4];  // RGBA
+  };
+  
+  /// Returns the vertices that were added since the last call to Render().
+  inline const std::vector<Vertex>& GetPendingVertices() const { return vertices; }
+  
+  /// Returns the number of draw calls that the next call to Render() will use.
+  inline usize GetPendingDrawCallCount() const { return drawCalls.size(); }
+  
+ private:
+  /// A range of consecutive vertices that is drawn with the same texture.
+  struct DrawCall {
+    Texture* texture;
+    u32 firstVertex;
+    u32 vertexCount;
+  };
+  
+  UITextureAtlas atlas;
+  
+  /// The vertices (two triangles per quad) that were added since the last call to Render().
+  std::vector<Vertex> vertices;
+  std::vector<DrawCall> drawCalls;
+  
+  bool haveClipRect = false;
+  QRectF clipRect;
+  
+  GLuint vertexBuffer = 0;
+  usize vertexBufferSize = 0;
+  
+  int lastDrawCallCount = 0;
+};
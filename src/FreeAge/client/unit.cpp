@@ -139,7 +139,7 @@ bool ClientUnitType::Load(UnitType type, const std::filesystem::path& graphicsSu
       bool fileExists = false;
       for (int fallbackNumber = 0; fallbackNumber < kMaxNumBaseNames; ++ fallbackNumber) {
         std::string filename = makeSpriteFilename(spriteBaseName[fallbackNumber], animationFilenameComponent, variant);
-        if (std::filesystem::exists(GetModdedPath(graphicsSubPath / filename))) {
+        if (GameFileExists(GetModdedPath(graphicsSubPath / filename))) {
           animationVariants.push_back(filename);
           fileExists = true;
           break;
@@ -183,6 +183,13 @@ bool ClientUnitType::Load(UnitType type, const std::filesystem::path& graphicsSu
     }
   }
   
+  maxSpriteExtent = 0;
+  for (const auto& animationVariants : animations) {
+    for (const SpriteAndTextures* animation : animationVariants) {
+      maxSpriteExtent = std::max(maxSpriteExtent, animation->sprite.ComputeMaxExtent());
+    }
+  }
+  
   return true;
 }
 
@@ -209,6 +216,7 @@ ClientUnit::ClientUnit(int playerIndex, UnitType type, const QPointF& mapCoord,
       direction(rand() % kNumFacingDirections),
       currentAnimation(UnitAnimation::Idle),
       currentAnimationVariant(0),
+      animationVariantRandomState(rand() | 1),
       lastAnimationStartTime(-1),
       movementSegment(-1, mapCoord, QPointF(0, 0), UnitAction::Idle) {}
 
@@ -238,33 +246,17 @@ QRectF ClientUnit::GetRectInProjectedCoords(Map* map, double serverTime, bool sh
       layer.imageHeight + (isGraphic ? -2 : 0));
 }
 
-void ClientUnit::Render(
-    Map* map,
-    QRgb outlineOrModulationColor,
-    SpriteShader* spriteShader,
-    float* viewMatrix,
-    float zoom,
-    int widgetWidth,
-    int widgetHeight,
-    double serverTime,
-    bool shadow,
-    bool outline) {
+int ClientUnit::UpdateAnimationFrame(double serverTime) {
   const ClientUnitType& unitType = GetClientUnitType();
-  SpriteAndTextures& animationSpriteAndTexture = *unitType.GetAnimations(currentAnimation)[currentAnimationVariant];
-  Texture& texture = shadow ? animationSpriteAndTexture.shadowTexture : animationSpriteAndTexture.graphicTexture;
-  const Sprite& sprite = animationSpriteAndTexture.sprite;
-  
-  QPointF centerProjectedCoord = GetCenterProjectedCoord(map);
-  
-  // Update the animation.
-  int framesPerDirection = sprite.NumFrames() / kNumFacingDirections;
   
   if (lastAnimationStartTime < 0) {
     // Initialize lastAnimationStartTime.
     lastAnimationStartTime = serverTime;
   }
+  int framesPerDirection;
   int frame;
   while (true) {
+    framesPerDirection = GetCurrentSpriteAndTextures().sprite.NumFrames() / kNumFacingDirections;
     double animationTime = (idleBlockedStartTime > 0) ? idleBlockedStartTime : serverTime;
     frame = std::max(0, static_cast<int>(animationFramesPerSecond * (animationTime - lastAnimationStartTime) + 0.5f));
     if (frame < framesPerDirection) {
@@ -277,26 +269,39 @@ void ClientUnit::Render(
     if (currentAnimationVariant == 1) {
       currentAnimationVariant = 0;
     } else {
-      currentAnimationVariant = rand() % unitType.GetAnimations(currentAnimation).size();
+      // Advance the unit's xorshift random number generator.
+      animationVariantRandomState ^= animationVariantRandomState << 13;
+      animationVariantRandomState ^= animationVariantRandomState >> 17;
+      animationVariantRandomState ^= animationVariantRandomState << 5;
+      currentAnimationVariant = animationVariantRandomState % unitType.GetAnimations(currentAnimation).size();
     }
   }
-  int frameIndex = GetDirection(serverTime) * framesPerDirection + frame;
+  return GetDirection(serverTime) * framesPerDirection + frame;
+}
+
+void ClientUnit::Render(
+    const QPointF& centerProjectedCoord,
+    int frameIndex,
+    QRgb outlineOrModulationColor,
+    SpriteShader* spriteShader,
+    bool shadow,
+    bool outline,
+    SpriteVertexArena* arena) {
+  SpriteAndTextures& animationSpriteAndTexture = GetCurrentSpriteAndTextures();
+  Texture& texture = shadow ? animationSpriteAndTexture.shadowTexture() : animationSpriteAndTexture.graphicTexture();
   
   DrawSprite(
-      sprite,
+      animationSpriteAndTexture.sprite,
       texture,
       spriteShader,
       centerProjectedCoord,
-      viewMatrix,
-      zoom,
-      widgetWidth,
-      widgetHeight,
       frameIndex,
       shadow,
       outline,
       outlineOrModulationColor,
       playerIndex,
-      1.f);
+      1.f,
+      arena);
 }
 
 void ClientUnit::SetCurrentAnimation(UnitAnimation animation, double serverTime) {
@@ -324,10 +329,13 @@ void ClientUnit::SetCurrentAnimation(UnitAnimation animation, double serverTime)
   currentAnimationVariant = rand() % unitType.GetAnimations(currentAnimation).size();
 }
 
+SpriteAndTextures& ClientUnit::GetCurrentSpriteAndTextures() {
+  return *GetClientUnitType().GetAnimations(currentAnimation)[currentAnimationVariant];
+}
+
 Texture& ClientUnit::GetTexture(bool shadow) {
-  const ClientUnitType& unitType = GetClientUnitType();
-  SpriteAndTextures& animationSpriteAndTexture = *unitType.GetAnimations(currentAnimation)[currentAnimationVariant];
-  return shadow ? animationSpriteAndTexture.shadowTexture : animationSpriteAndTexture.graphicTexture;
+  SpriteAndTextures& animationSpriteAndTexture = GetCurrentSpriteAndTextures();
+  return shadow ? animationSpriteAndTexture.shadowTexture() : animationSpriteAndTexture.graphicTexture();
 }
 
 static int ComputeFacingDirection(const QPointF& movement) {
@@ -372,7 +380,7 @@ void ClientUnit::SetMovementSegment(double serverTime, const QPointF& startPoint
   movementSegment = MovementSegment(serverTime, startPoint, speed, action);
 }
 
-void ClientUnit::UpdateGameState(double serverTime, Map* map, Match* match) {
+bool ClientUnit::UpdateGameState(double serverTime, Map* map, Match* match) {
   // Update the unit's movment according to the movement segment.
   UpdateMapCoord(serverTime, map, match);
   
@@ -409,9 +417,14 @@ void ClientUnit::UpdateGameState(double serverTime, Map* map, Match* match) {
   if (movementSegment.action != UnitAction::Idle) {
     idleBlockedStartTime = -1;
   }
+  
+  bool moved = mapCoordChanged;
+  mapCoordChanged = false;
+  return moved;
 }
 
 void ClientUnit::UpdateMapCoord(double serverTime, Map* map, Match* match) {
+  QPointF oldMapCoord = mapCoord;
   int oldTileX = static_cast<int>(mapCoord.x());
   int oldTileY = static_cast<int>(mapCoord.y());
   
@@ -424,6 +437,9 @@ void ClientUnit::UpdateMapCoord(double serverTime, Map* map, Match* match) {
   } else {
     mapCoord = movementSegment.startPoint + (serverTime - movementSegment.serverTime) * movementSegment.speed;
   }
+  if (mapCoord != oldMapCoord) {
+    mapCoordChanged = true;
+  }
   
   int newTileX = static_cast<int>(mapCoord.x());
   int newTileY = static_cast<int>(mapCoord.y());
@@ -431,14 +447,7 @@ void ClientUnit::UpdateMapCoord(double serverTime, Map* map, Match* match) {
   if (match->GetPlayerIndex() == playerIndex &&
       (oldTileX != newTileX ||
        oldTileY != newTileY)) {
-    // TODO: This could be sped up by pre-computing only the *difference* that needs to be applied
-    //       for a unit's line-of-sight when moving from one tile to an adjacent tile.
-    //       Even without this pre-computation, iterating over the viewCount values only once
-    //       should be faster (i.e., combine the two map->UpdateFieldOfView() calls below into
-    //       one that takes both the old and the new coordinates).
-    float lineOfSight = GetUnitLineOfSight(type);
-    map->UpdateFieldOfView(oldTileX + 0.5f, oldTileY + 0.5f, lineOfSight, -1);
-    map->UpdateFieldOfView(newTileX + 0.5f, newTileY + 0.5f, lineOfSight, 1);
+    map->MoveFieldOfView(oldTileX + 0.5f, oldTileY + 0.5f, newTileX + 0.5f, newTileY + 0.5f, GetUnitLineOfSight(type));
   }
 }
 
@@ -44,6 +44,9 @@ class ClientUnitType {
   
   int GetHealthBarHeightAboveCenter() const;
   
+  /// Returns the maximum extent of all animation sprites of this unit type, see Sprite::ComputeMaxExtent().
+  inline int GetMaxSpriteExtent() const { return maxSpriteExtent; }
+  
   inline const std::vector<SpriteAndTextures*>& GetAnimations(UnitAnimation type) const { return animations[static_cast<int>(type)]; }
   
   inline const Texture* GetIconTexture() const { return iconTexture; }
@@ -64,6 +67,9 @@ class ClientUnitType {
   /// This can be used to determine a reasonable height for the unit's health bar.
   int maxCenterY;
   
+  /// The maximum extent of any animation sprite of this unit type.
+  int maxSpriteExtent;
+  
   Texture* iconTexture = nullptr;
 };
 
@@ -88,17 +94,19 @@ class ClientUnit : public ClientObject {
       bool shadow,
       bool outline);
   
+  /// Updates the unit's animation (which may switch to another variant of the current animation)
+  /// to the given server time, and returns the index of the frame to display in the current sprite.
+  int UpdateAnimationFrame(double serverTime);
+  
+  /// Renders the given frame (as returned by UpdateAnimationFrame()) of the unit's current sprite.
   void Render(
-      Map* map,
+      const QPointF& centerProjectedCoord,
+      int frameIndex,
       QRgb outlineOrModulationColor,
       SpriteShader* spriteShader,
-      float* viewMatrix,
-      float zoom,
-      int widgetWidth,
-      int widgetHeight,
-      double serverTime,
       bool shadow,
-      bool outline);
+      bool outline,
+      SpriteVertexArena* arena = nullptr);
   
   inline UnitType GetType() const { return type; }
   inline void SetType(UnitType newType) { type = newType; }
@@ -114,6 +122,8 @@ class ClientUnit : public ClientObject {
   inline UnitAnimation GetCurrentAnimation() const { return currentAnimation; }
   void SetCurrentAnimation(UnitAnimation animation, double serverTime);
   
+  /// Returns the sprite of the current animation variant.
+  SpriteAndTextures& GetCurrentSpriteAndTextures();
   Texture& GetTexture(bool shadow);
   
   inline const QPointF& GetMapCoord() const { return mapCoord; }
@@ -128,8 +138,10 @@ class ClientUnit : public ClientObject {
   inline ResourceType GetCarriedResourceType() const { return carriedResourceType; }
   inline int GetCarriedResourceAmount() const { return carriedResourceAmount; }
   
-  /// Updates the unit's state to the given server time.
-  void UpdateGameState(double serverTime, Map* map, Match* match);
+  /// Updates the unit's state to the given server time. Returns true if the unit's map coordinate
+  /// changed since the last call to this function (including changes by SetMovementSegment()),
+  /// which means that its entry in the map's spatial index needs to be updated.
+  bool UpdateGameState(double serverTime, Map* map, Match* match);
   
  private:
   void UpdateMapCoord(double serverTime, Map* map, Match* match);
@@ -141,6 +153,9 @@ class ClientUnit : public ClientObject {
   /// Current position of the unit sprite's center on the map.
   QPointF mapCoord;
   
+  /// Whether mapCoord changed since the last call to UpdateGameState().
+  bool mapCoordChanged = false;
+  
   /// Directions are from 0 to kNumFacingDirections - 1.
   /// Direction 0 is to the right, increasing the direction successively rotates the unit in clockwise direction.
   int direction;
@@ -154,6 +169,11 @@ class ClientUnit : public ClientObject {
   
   UnitAnimation currentAnimation;
   int currentAnimationVariant;
+  
+  /// State of the random number generator for choosing animation variants in UpdateAnimationFrame().
+  /// Each unit has its own state (instead of using rand()), since UpdateAnimationFrame() is called
+  /// for many units in parallel.
+  u32 animationVariantRandomState;
   double lastAnimationStartTime;
   double idleBlockedStartTime = -1;
   
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <array>
+
 #include <QRect>
 #include <QSize>
 #include <QString>
@@ -48,27 +50,68 @@ inline bool IsTree(BuildingType type) {
          type <= BuildingType::LastTree;
 }
 
-QSize GetBuildingSize(BuildingType type);
-QRect GetBuildingOccupancy(BuildingType type);
 QString GetBuildingName(BuildingType type);
-double GetBuildingConstructionTime(BuildingType type);
-
-/// TODO: This needs to consider the player's civilization and researched technologies
-ResourceAmount GetBuildingCost(BuildingType type);
 
 /// Returns whether the given building type acts as a drop-off point for the given resource type.
 bool IsDropOffPointForResource(BuildingType building, ResourceType resource);
 
-/// TODO: This needs to consider the player's civilization and researched technologies
-u32 GetBuildingMaxHP(BuildingType type);
-u32 GetBuildingMeleeArmor(BuildingType type);
+/// Gameplay properties of a building type.
+/// For the types which are only used for loading sprites, all stats are zero.
+/// TODO: Some of these need to consider the player's civilization, age, and researched technologies
+struct BuildingStats {
+  /// Size in map tiles.
+  QSize size;
+  
+  /// Construction time in seconds.
+  double constructionTime;
+  
+  ResourceAmount cost;
+  
+  u32 maxHP;
+  u32 meleeArmor;
+  
+  /// The max number of buildings of this type that a player can build, or -1 if unlimited.
+  /// TODO: use infinity instead of -1 ?
+  int maxInstances;
+  
+  int providedPopulationSpace;
+  
+  /// Line of sight radius in map tiles.
+  float lineOfSight;
+};
+
+/// The stats of all building types, indexed by BuildingType.
+/// This is initialized with the built-in defaults (see GetDefaultBuildingStats()) and may be
+/// changed by LoadStatsDatabase() at program start, before any other thread accesses it.
+/// Use GetBuildingStats() for reading.
+extern std::array<BuildingStats, static_cast<int>(BuildingType::NumBuildings)> buildingStatsTable;
+
+inline const BuildingStats& GetBuildingStats(BuildingType type) {
+  return buildingStatsTable[static_cast<int>(type)];
+}
+
+/// Returns the built-in stats of the given building type.
+const BuildingStats& GetDefaultBuildingStats(BuildingType type);
+
+inline const QSize& GetBuildingSize(BuildingType type) { return GetBuildingStats(type).size; }
+
+inline QRect GetBuildingOccupancy(BuildingType type) {
+  const QSize& size = GetBuildingSize(type);
+  if (type == BuildingType::TownCenter) {
+    // The town center only occupies one quarter of its tiles.
+    return QRect(0, size.height() / 2, size.width() / 2, size.height() / 2);
+  }
+  return QRect(0, 0, size.width(), size.height());
+}
+
+inline double GetBuildingConstructionTime(BuildingType type) { return GetBuildingStats(type).constructionTime; }
+inline const ResourceAmount& GetBuildingCost(BuildingType type) { return GetBuildingStats(type).cost; }
+inline u32 GetBuildingMaxHP(BuildingType type) { return GetBuildingStats(type).maxHP; }
+inline u32 GetBuildingMeleeArmor(BuildingType type) { return GetBuildingStats(type).meleeArmor; }
 
 /// Returns the max number of the given building type that the player can build.
 /// Returns -1 if unlimited.
-/// TODO: This needs to consider the player's age.
-/// TODO: use infinity instead of -1 ?
-int GetBuildingMaxInstances(BuildingType type);
-
-int GetBuildingProvidedPopulationSpace(BuildingType type);
+inline int GetBuildingMaxInstances(BuildingType type) { return GetBuildingStats(type).maxInstances; }
 
-float GetBuildingLineOfSight(BuildingType type);
+inline int GetBuildingProvidedPopulationSpace(BuildingType type) { return GetBuildingStats(type).providedPopulationSpace; }
+inline float GetBuildingLineOfSight(BuildingType type) { return GetBuildingStats(type).lineOfSight; }
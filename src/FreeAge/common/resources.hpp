@@ -36,10 +36,10 @@ inline QString GetResourceName(ResourceType type) {
 }
 
 struct ResourceAmount {
-  inline ResourceAmount()
+  constexpr ResourceAmount()
       : resources{0, 0, 0, 0} {}
   
-  inline ResourceAmount(u32 wood, u32 food, u32 gold, u32 stone)
+  constexpr ResourceAmount(u32 wood, u32 food, u32 gold, u32 stone)
       : resources{wood, food, gold, stone} {}
   
   /// Returns true if with this resource amount, one can afford to buy something that
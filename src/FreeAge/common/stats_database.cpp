@@ -0,0 +1,212 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/common/stats_database.hpp"
+
+#include <yaml-cpp/yaml.h>
+
+#include "FreeAge/common/building_types.hpp"
+#include "FreeAge/common/logging.hpp"
+#include "FreeAge/common/unit_types.hpp"
+
+/// Names of the unit types in the stats file, indexed by UnitType.
+static const char* kUnitTypeNames[] = {
+    "FemaleVillager",
+    "FemaleVillagerBuilder",
+    "FemaleVillagerForager",
+    "FemaleVillagerLumberjack",
+    "FemaleVillagerGoldMiner",
+    "FemaleVillagerStoneMiner",
+    "MaleVillager",
+    "MaleVillagerBuilder",
+    "MaleVillagerForager",
+    "MaleVillagerLumberjack",
+    "MaleVillagerGoldMiner",
+    "MaleVillagerStoneMiner",
+    "Militia",
+    "Scout"};
+static_assert(sizeof(kUnitTypeNames) / sizeof(kUnitTypeNames[0]) == static_cast<int>(UnitType::NumUnits), "kUnitTypeNames must contain an entry for each UnitType");
+
+/// Names of the building types in the stats file, indexed by BuildingType.
+static const char* kBuildingTypeNames[] = {
+    "TownCenter",
+    "TownCenterBack",
+    "TownCenterCenter",
+    "TownCenterFront",
+    "TownCenterMain",
+    "House",
+    "Mill",
+    "MiningCamp",
+    "LumberCamp",
+    "Dock",
+    "Barracks",
+    "Outpost",
+    "PalisadeWall",
+    "PalisadeGate",
+    "TreeOak",
+    "ForageBush",
+    "GoldMine",
+    "StoneMine"};
+static_assert(sizeof(kBuildingTypeNames) / sizeof(kBuildingTypeNames[0]) == static_cast<int>(BuildingType::NumBuildings), "kBuildingTypeNames must contain an entry for each BuildingType");
+
+/// Name which applies unit stats to all villager types.
+static const char* kAllVillagersName = "Villager";
+
+static ResourceAmount ParseResourceAmount(const YAML::Node& node, const ResourceAmount& defaultAmount) {
+  ResourceAmount amount = defaultAmount;
+  for (const auto& item : node) {
+    std::string key = item.first.as<std::string>();
+    if (key == "wood") {
+      amount.wood() = item.second.as<u32>();
+    } else if (key == "food") {
+      amount.food() = item.second.as<u32>();
+    } else if (key == "gold") {
+      amount.gold() = item.second.as<u32>();
+    } else if (key == "stone") {
+      amount.stone() = item.second.as<u32>();
+    } else {
+      LOG(WARNING) << "Ignoring unknown resource type in stats database: " << key;
+    }
+  }
+  return amount;
+}
+
+static void ParseUnitStats(const YAML::Node& node, UnitStats* stats) {
+  for (const auto& item : node) {
+    std::string key = item.first.as<std::string>();
+    const YAML::Node& value = item.second;
+    if (key == "radius") {
+      stats->radius = value.as<float>();
+    } else if (key == "moveSpeed") {
+      stats->moveSpeed = value.as<float>();
+    } else if (key == "cost") {
+      stats->cost = ParseResourceAmount(value, stats->cost);
+    } else if (key == "productionTime") {
+      stats->productionTime = value.as<float>();
+    } else if (key == "attackFrames") {
+      stats->attackFrames = value.as<int>();
+    } else if (key == "maxHP") {
+      stats->maxHP = value.as<u32>();
+    } else if (key == "meleeAttack") {
+      stats->meleeAttack = value.as<u32>();
+    } else if (key == "meleeArmor") {
+      stats->meleeArmor = value.as<u32>();
+    } else if (key == "lineOfSight") {
+      stats->lineOfSight = value.as<float>();
+    } else {
+      LOG(WARNING) << "Ignoring unknown unit stat in stats database: " << key;
+    }
+  }
+}
+
+static void ParseBuildingStats(const YAML::Node& node, BuildingStats* stats) {
+  for (const auto& item : node) {
+    std::string key = item.first.as<std::string>();
+    const YAML::Node& value = item.second;
+    if (key == "size") {
+      if (!value.IsSequence() || value.size() != 2) {
+        throw YAML::Exception(value.Mark(), "The building size must be given as [width, height]");
+      }
+      stats->size = QSize(value[0].as<int>(), value[1].as<int>());
+    } else if (key == "constructionTime") {
+      stats->constructionTime = value.as<double>();
+    } else if (key == "cost") {
+      stats->cost = ParseResourceAmount(value, stats->cost);
+    } else if (key == "maxHP") {
+      stats->maxHP = value.as<u32>();
+    } else if (key == "meleeArmor") {
+      stats->meleeArmor = value.as<u32>();
+    } else if (key == "maxInstances") {
+      stats->maxInstances = value.as<int>();
+    } else if (key == "providedPopulationSpace") {
+      stats->providedPopulationSpace = value.as<int>();
+    } else if (key == "lineOfSight") {
+      stats->lineOfSight = value.as<float>();
+    } else {
+      LOG(WARNING) << "Ignoring unknown building stat in stats database: " << key;
+    }
+  }
+}
+
+/// Returns the index of the given name in the names array, or -1 if it is not contained.
+template <int N>
+static int FindTypeIndex(const char* (&names)[N], const std::string& name) {
+  for (int i = 0; i < N; ++ i) {
+    if (name == names[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool LoadStatsDatabase(const std::filesystem::path& path) {
+  // Parse into copies of the tables first, such that they remain unchanged in case of errors.
+  auto newUnitStats = unitStatsTable;
+  auto newBuildingStats = buildingStatsTable;
+  
+  try {
+    YAML::Node fileNode = YAML::LoadFile(path.string());
+    if (!fileNode.IsMap()) {
+      LOG(ERROR) << "Cannot parse stats database: " << path << ": The root node is not a map.";
+      return false;
+    }
+    
+    YAML::Node unitsNode = fileNode["units"];
+    if (unitsNode.IsDefined()) {
+      // Apply the stats for all villagers first, such that they can be overridden for specific villager types.
+      YAML::Node allVillagersNode = unitsNode[kAllVillagersName];
+      if (allVillagersNode.IsDefined()) {
+        for (int type = static_cast<int>(UnitType::FirstVillager); type <= static_cast<int>(UnitType::LastVillager); ++ type) {
+          ParseUnitStats(allVillagersNode, &newUnitStats[type]);
+        }
+      }
+      
+      for (const auto& item : unitsNode) {
+        std::string name = item.first.as<std::string>();
+        if (name == kAllVillagersName) {
+          continue;
+        }
+        int type = FindTypeIndex(kUnitTypeNames, name);
+        if (type < 0) {
+          LOG(WARNING) << "Ignoring unknown unit type in stats database: " << name;
+          continue;
+        }
+        ParseUnitStats(item.second, &newUnitStats[type]);
+      }
+    }
+    
+    YAML::Node buildingsNode = fileNode["buildings"];
+    if (buildingsNode.IsDefined()) {
+      for (const auto& item : buildingsNode) {
+        std::string name = item.first.as<std::string>();
+        int type = FindTypeIndex(kBuildingTypeNames, name);
+        if (type < 0) {
+          LOG(WARNING) << "Ignoring unknown building type in stats database: " << name;
+          continue;
+        }
+        ParseBuildingStats(item.second, &newBuildingStats[type]);
+      }
+    }
+  } catch (const YAML::BadFile& badFileException) {
+    LOG(ERROR) << "Cannot read stats database: " << path << " (YAML::BadFile exception)";
+    return false;
+  } catch (const YAML::Exception& exception) {
+    LOG(ERROR) << "Cannot parse stats database: " << path << ": " << exception.what();
+    return false;
+  }
+  
+  unitStatsTable = newUnitStats;
+  buildingStatsTable = newBuildingStats;
+  LOG(INFO) << "Loaded stats database: " << path;
+  return true;
+}
+
+void ResetStatsDatabase() {
+  for (int type = 0; type < static_cast<int>(UnitType::NumUnits); ++ type) {
+    unitStatsTable[type] = GetDefaultUnitStats(static_cast<UnitType>(type));
+  }
+  for (int type = 0; type < static_cast<int>(BuildingType::NumBuildings); ++ type) {
+    buildingStatsTable[type] = GetDefaultBuildingStats(static_cast<BuildingType>(type));
+  }
+}
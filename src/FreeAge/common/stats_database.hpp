@@ -0,0 +1,33 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <filesystem>
+
+/// Overrides unit and building stats (see UnitStats and BuildingStats) with the values
+/// given in a YAML file. This allows to rebalance the game without recompiling it.
+/// Stats which are not given in the file keep their built-in values. The file format is:
+///
+/// units:
+///   Villager:            # applies to all villager types
+///     maxHP: 25
+///   Militia:
+///     meleeAttack: 4
+///     cost: {wood: 0, food: 60, gold: 20, stone: 0}
+/// buildings:
+///   House:
+///     size: [2, 2]
+///     providedPopulationSpace: 5
+///
+/// The types are named like the UnitType and BuildingType enum values, and the stats like
+/// the members of UnitStats and BuildingStats.
+///
+/// The stats tables are not synchronized, so this must be called at program start,
+/// before other threads are started. The client and the server must use the same file.
+/// Returns true on success. On failure, the current stats remain unchanged.
+bool LoadStatsDatabase(const std::filesystem::path& path);
+
+/// Resets all unit and building stats to their built-in values.
+void ResetStatsDatabase();
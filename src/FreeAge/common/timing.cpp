@@ -30,9 +30,12 @@
 #include "FreeAge/common/timing.hpp"
 
 #include <algorithm>
+#include <fstream>
+#include <iomanip>
 #include <limits>
 #include <map>
 #include <math.h>
+#include <sstream>
 
 #include "FreeAge/common/logging.hpp"
 
@@ -82,9 +85,14 @@ void Timer::Start() {
 }
 
 double Timer::Stop(bool add_to_statistics) {
-  double seconds = GetTimeSinceStart();
+  CHECK(timing_) << "Stop() called on a stopped timer";
+  std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+  double seconds = 1e-9 * std::chrono::duration<double, std::nano>(end_time - start_time_).count();
   if (add_to_statistics && handle_ != std::numeric_limits<usize>::max()) {
     Timing::addTime(handle_, seconds);
+    if (Timing::isTraceEnabled()) {
+      Timing::addTraceEvent(handle_, start_time_, end_time);
+    }
   }
   timing_ = false;
   return seconds;
@@ -122,6 +130,26 @@ struct TimerMapValue {
     }
   }
   
+  /// Combines the statistics of two sets of samples, see:
+  /// https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Parallel_algorithm
+  void Merge(const TimerMapValue& other) {
+    if (other.count == 0) {
+      return;
+    } else if (count == 0) {
+      *this = other;
+      return;
+    }
+    
+    usize newCount = count + other.count;
+    double delta = other.mean - mean;
+    mean += delta * other.count / newCount;
+    M2 += other.M2 + delta * delta * count * other.count / newCount;
+    count = newCount;
+    
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+  }
+  
   double GetVariance() const {
     if (count < 2) {
       return 0;
@@ -141,28 +169,172 @@ struct TimerMapValue {
   double mean;
 };
 
+/// The statistics of one handle on one thread. They are only written by their
+/// thread (thus, no atomic read-modify-write operations are required), but may be
+/// read by other threads at any time when merging the statistics of all threads.
+struct ThreadTimerValue {
+  ThreadTimerValue()
+      : generation(0) {
+    Store(TimerMapValue());
+  }
+  
+  void AddValue(double x, u32 currentGeneration) {
+    TimerMapValue value;
+    if (generation.load(std::memory_order_relaxed) == currentGeneration) {
+      value = Load();
+    }
+    value.AddValue(x);
+    Store(value);
+    generation.store(currentGeneration, std::memory_order_release);
+  }
+  
+  TimerMapValue Load() const {
+    TimerMapValue value;
+    value.count = count.load(std::memory_order_relaxed);
+    value.min = min.load(std::memory_order_relaxed);
+    value.max = max.load(std::memory_order_relaxed);
+    value.M2 = M2.load(std::memory_order_relaxed);
+    value.mean = mean.load(std::memory_order_relaxed);
+    return value;
+  }
+  
+  void Store(const TimerMapValue& value) {
+    count.store(value.count, std::memory_order_relaxed);
+    min.store(value.min, std::memory_order_relaxed);
+    max.store(value.max, std::memory_order_relaxed);
+    M2.store(value.M2, std::memory_order_relaxed);
+    mean.store(value.mean, std::memory_order_relaxed);
+  }
+  
+  /// The reset generation (see Timing::getGeneration()) that the values belong to.
+  std::atomic<u32> generation;
+  
+  std::atomic<usize> count;
+  std::atomic<double> min;
+  std::atomic<double> max;
+  std::atomic<double> M2;
+  std::atomic<double> mean;
+};
+
+struct TraceEvent {
+  usize handle;
+  
+  /// Begin and end time in nanoseconds, relative to Timing::m_traceStartTime.
+  i64 beginNs;
+  i64 endNs;
+};
+
+/// The statistics and trace events of one thread.
+struct ThreadTimingData {
+  ThreadTimingData() {
+    for (std::atomic<ThreadTimerValue*>& block : blocks) {
+      block.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  
+  ~ThreadTimingData() {
+    for (std::atomic<ThreadTimerValue*>& block : blocks) {
+      delete[] block.load(std::memory_order_relaxed);
+    }
+    delete[] traceEvents.load(std::memory_order_relaxed);
+  }
+  
+  /// Returns the statistics for the given handle, allocating them if necessary.
+  /// Must only be called by the owning thread.
+  ThreadTimerValue* GetValue(usize handle) {
+    std::atomic<ThreadTimerValue*>& blockPtr = blocks[handle / kBlockSize];
+    ThreadTimerValue* block = blockPtr.load(std::memory_order_relaxed);
+    if (!block) {
+      block = new ThreadTimerValue[kBlockSize];
+      blockPtr.store(block, std::memory_order_release);
+    }
+    return &block[handle % kBlockSize];
+  }
+  
+  /// Returns the statistics for the given handle, or nullptr if the thread did not record any for it.
+  /// May be called by any thread.
+  const ThreadTimerValue* FindValue(usize handle) const {
+    const ThreadTimerValue* block = blocks[handle / kBlockSize].load(std::memory_order_acquire);
+    return block ? &block[handle % kBlockSize] : nullptr;
+  }
+  
+  /// The statistics are allocated in blocks of kBlockSize handles, such that the blocks
+  /// never move once they are allocated (and can thus be read by other threads).
+  static constexpr usize kBlockSize = 64;
+  std::atomic<ThreadTimerValue*> blocks[Timing::kMaxHandles / kBlockSize];
+  
+  /// Ring buffer of Timing::kTraceEventsPerThread trace events, allocated when the first event is recorded.
+  std::atomic<TraceEvent*> traceEvents{nullptr};
+  
+  /// Total number of trace events that were recorded. The last event is at index
+  /// (numTraceEvents - 1) % Timing::kTraceEventsPerThread.
+  std::atomic<u64> numTraceEvents{0};
+  
+  /// The thread's index and name, used in the exported trace.
+  int index;
+  std::string name;
+};
+
 
 std::mutex Timing::m_mutex;
+std::atomic<bool> Timing::m_traceEnabled(false);
 
 Timing& Timing::instance() {
   static Timing t;
   return t;
 }
 
-Timing::Timing() :
-    m_maxTagLength(0) {}
+Timing::Timing()
+    : m_numHandles(0),
+      m_maxTagLength(0),
+      m_resetCount(0),
+      m_handleResetCounts(new std::atomic<u32>[kMaxHandles]),
+      m_traceStartTime(std::chrono::steady_clock::now()) {
+  for (usize handle = 0; handle < kMaxHandles; ++ handle) {
+    m_handleResetCounts[handle].store(0, std::memory_order_relaxed);
+  }
+}
 
 Timing::~Timing() {}
 
+ThreadTimingData* Timing::getThreadData() {
+  static thread_local ThreadTimingData* threadData = nullptr;
+  if (!threadData) {
+    // The data is owned by the Timing instance rather than by the thread, such that
+    // the statistics of threads that exited remain available.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    instance().m_threads.emplace_back(new ThreadTimingData());
+    threadData = instance().m_threads.back().get();
+    threadData->index = instance().m_threads.size() - 1;
+  }
+  return threadData;
+}
+
+TimerMapValue Timing::getMergedValue(usize handle) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  CHECK_LT(handle, instance().m_numHandles) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_numHandles;
+  
+  u32 generation = getGeneration(handle);
+  TimerMapValue result;
+  for (const auto& thread : instance().m_threads) {
+    const ThreadTimerValue* value = thread->FindValue(handle);
+    if (value && value->generation.load(std::memory_order_acquire) == generation) {
+      result.Merge(value->Load());
+    }
+  }
+  return result;
+}
+
 usize Timing::getHandle(std::string const& tag) {
   // Search for an existing tag.
   std::unique_lock<std::mutex> lock(m_mutex);
   map_t::iterator i = instance().m_tagMap.find(tag);
   if (i == instance().m_tagMap.end()) {
     // If it is not there, create a tag.
-    usize handle = instance().m_timers.size();
+    CHECK_LT(instance().m_numHandles, kMaxHandles) << "Exceeded the maximum number of timer handles";
+    usize handle = instance().m_numHandles;
+    ++ instance().m_numHandles;
     instance().m_tagMap[tag] = handle;
-    instance().m_timers.push_back(TimerMapValue());
     // Track the maximum tag length to help printing a table of timing values later.
     instance().m_maxTagLength = std::max(instance().m_maxTagLength, tag.size());
     return handle;
@@ -171,11 +343,32 @@ usize Timing::getHandle(std::string const& tag) {
   }
 }
 
+usize Timing::getHandle(const char* tag) {
+  // Timers are mostly constructed with string literals. Cache their handles per thread,
+  // such that constructing a Timer does not need to take the mutex and hash the tag.
+  // Since the same pointer might be re-used for a different string, the tag is verified.
+  struct CachedHandle {
+    usize handle;
+    std::string tag;
+  };
+  static thread_local std::unordered_map<const char*, CachedHandle> cache;
+  
+  auto it = cache.find(tag);
+  if (it != cache.end() && it->second.tag == tag) {
+    return it->second.handle;
+  }
+  
+  usize handle = getHandle(std::string(tag));
+  cache[tag] = CachedHandle{handle, tag};
+  return handle;
+}
+
 std::string Timing::getTag(usize handle) {
   std::string tag;
   bool found = false;
   
   // Perform a linear search for the tag
+  std::unique_lock<std::mutex> lock(m_mutex);
   map_t::iterator i = instance().m_tagMap.begin();
   for ( ; i != instance().m_tagMap.end(); i++) {
     if (i->second == handle){
@@ -190,13 +383,110 @@ std::string Timing::getTag(usize handle) {
 }
 
 void Timing::addTime(usize handle, double seconds) {
+  u32 generation = getGeneration(handle);
+  getThreadData()->GetValue(handle)->AddValue(seconds, generation);
+}
+
+void Timing::addTraceEvent(usize handle, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+  if (!isTraceEnabled()) {
+    return;
+  }
+  
+  ThreadTimingData* data = getThreadData();
+  TraceEvent* events = data->traceEvents.load(std::memory_order_relaxed);
+  if (!events) {
+    events = new TraceEvent[kTraceEventsPerThread];
+    data->traceEvents.store(events, std::memory_order_release);
+  }
+  
+  u64 eventIndex = data->numTraceEvents.load(std::memory_order_relaxed);
+  TraceEvent& event = events[eventIndex % kTraceEventsPerThread];
+  event.handle = handle;
+  event.beginNs = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - instance().m_traceStartTime).count();
+  event.endNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - instance().m_traceStartTime).count();
+  data->numTraceEvents.store(eventIndex + 1, std::memory_order_release);
+}
+
+void Timing::setTraceEnabled(bool enabled) {
+  m_traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Timing::setThreadName(const std::string& name) {
+  ThreadTimingData* data = getThreadData();
   std::unique_lock<std::mutex> lock(m_mutex);
-  instance().m_timers[handle].AddValue(seconds);
+  data->name = name;
+}
+
+static std::string EscapeJSONString(const std::string& text) {
+  std::string result;
+  result.reserve(text.size());
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buffer[8];
+      snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      result += buffer;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+bool Timing::writeChromeTrace(const std::string& path) {
+  std::ofstream stream(path, std::ios::out);
+  if (!stream) {
+    LOG(ERROR) << "Failed to open the trace file for writing: " << path;
+    return false;
+  }
+  stream << std::fixed << std::setprecision(3);
+  
+  std::unique_lock<std::mutex> lock(m_mutex);
+  Timing& timing = instance();
+  
+  std::vector<std::string> escapedTags(timing.m_numHandles);
+  for (const auto& item : timing.m_tagMap) {
+    escapedTags[item.second] = EscapeJSONString(item.first);
+  }
+  
+  // The timestamps are in microseconds. Since timers may nest, all events use the
+  // "complete event" type ("X"), which has a begin time and a duration.
+  stream << "{\"traceEvents\":[";
+  bool firstEvent = true;
+  for (const auto& thread : timing.m_threads) {
+    std::string threadName = thread->name.empty() ? ("Thread " + std::to_string(thread->index)) : thread->name;
+    stream << (firstEvent ? "\n" : ",\n")
+           << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->index
+           << ",\"args\":{\"name\":\"" << EscapeJSONString(threadName) << "\"}}";
+    firstEvent = false;
+    
+    const TraceEvent* events = thread->traceEvents.load(std::memory_order_acquire);
+    if (!events) {
+      continue;
+    }
+    u64 numEvents = thread->numTraceEvents.load(std::memory_order_acquire);
+    u64 firstIndex = (numEvents > kTraceEventsPerThread) ? (numEvents - kTraceEventsPerThread) : 0;
+    for (u64 eventIndex = firstIndex; eventIndex < numEvents; ++ eventIndex) {
+      const TraceEvent& event = events[eventIndex % kTraceEventsPerThread];
+      stream << ",\n{\"name\":\"" << escapedTags[event.handle]
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->index
+             << ",\"ts\":" << (1e-3 * event.beginNs)
+             << ",\"dur\":" << (1e-3 * (event.endNs - event.beginNs)) << "}";
+    }
+  }
+  stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  
+  if (!stream) {
+    LOG(ERROR) << "Failed to write the trace file: " << path;
+    return false;
+  }
+  return true;
 }
 
 double Timing::getTotalSeconds(usize handle) {
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  return instance().m_timers[handle].GetTotal();
+  return getMergedValue(handle).GetTotal();
 }
 
 double Timing::getTotalSeconds(std::string const& tag) {
@@ -204,8 +494,7 @@ double Timing::getTotalSeconds(std::string const& tag) {
 }
 
 double Timing::getMeanSeconds(usize handle) {
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  return instance().m_timers[handle].mean;
+  return getMergedValue(handle).mean;
 }
 
 double Timing::getMeanSeconds(std::string const& tag) {
@@ -213,8 +502,7 @@ double Timing::getMeanSeconds(std::string const& tag) {
 }
 
 usize Timing::getNumSamples(usize handle) {
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  return instance().m_timers[handle].count;
+  return getMergedValue(handle).count;
 }
 
 usize Timing::getNumSamples(std::string const& tag) {
@@ -222,8 +510,7 @@ usize Timing::getNumSamples(std::string const& tag) {
 }
 
 double Timing::getVarianceSeconds(usize handle) {
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  return instance().m_timers[handle].GetVariance();
+  return getMergedValue(handle).GetVariance();
 }
 
 double Timing::getVarianceSeconds(std::string const& tag) {
@@ -231,8 +518,7 @@ double Timing::getVarianceSeconds(std::string const& tag) {
 }
 
 double Timing::getMinSeconds(usize handle) {
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  return instance().m_timers[handle].min;
+  return getMergedValue(handle).min;
 }
 
 double Timing::getMinSeconds(std::string const& tag) {
@@ -240,8 +526,7 @@ double Timing::getMinSeconds(std::string const& tag) {
 }
 
 double Timing::getMaxSeconds(usize handle) {
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  return instance().m_timers[handle].max;
+  return getMergedValue(handle).max;
 }
 
 double Timing::getMaxSeconds(std::string const& tag) {
@@ -249,8 +534,7 @@ double Timing::getMaxSeconds(std::string const& tag) {
 }
 
 double Timing::getHz(usize handle) {
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  return 1.0 / instance().m_timers[handle].mean;
+  return 1.0 / getMergedValue(handle).mean;
 }
 
 double Timing::getHz(std::string const& tag) {
@@ -258,16 +542,15 @@ double Timing::getHz(std::string const& tag) {
 }
 
 void Timing::reset() {
-  std::unique_lock<std::mutex> lock(m_mutex);
-  instance().m_timers.clear();
-  instance().m_tagMap.clear();
-  instance().m_maxTagLength = 0;
+  // The per-thread statistics cannot be cleared from this thread without locking.
+  // Instead, they are invalidated by changing the reset generation. The handles stay
+  // valid, but handles without samples are not printed.
+  ++ instance().m_resetCount;
 }
 
 void Timing::reset(usize handle) {
-  std::unique_lock<std::mutex> lock(m_mutex);
-  CHECK_LT(handle, instance().m_timers.size()) << "Handle is out of range: " << handle << ", number of timers: " << instance().m_timers.size();
-  instance().m_timers[handle] = TimerMapValue();
+  CHECK_LT(handle, kMaxHandles) << "Handle is out of range: " << handle;
+  ++ instance().m_handleResetCounts[handle];
 }
 
 void Timing::reset(std::string const& tag) {
@@ -29,8 +29,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cstdio>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -109,12 +111,42 @@ typedef DisabledTimer ConditionalTimer;
 enum SortType {kSortByTotal, kSortByMean, kSortByStd, kSortByMin, kSortByMax, kSortByNumSamples};
 
 struct TimerMapValue;
+struct ThreadTimingData;
 
+/// Collects the statistics of all Timers, and optionally a trace of their begin
+/// and end times.
+///
+/// Recording a sample (addTime(), addTraceEvent()) does not take any locks:
+/// each thread writes to its own accumulators and its own trace ring buffer,
+/// which are only merged when the statistics are queried or the trace is
+/// exported. Only the first sample of a thread and the creation of new handles
+/// take a mutex. Thus, it is fine to use Timers in hot loops and on several
+/// threads at the same time, as long as the Timers are given a handle or a
+/// constant tag (tags given as const char* are cached per thread).
 class Timing {
  public:
   static void addTime(usize handle, double seconds);
   
+  /// Records a trace event for the given handle if tracing is enabled.
+  static void addTraceEvent(usize handle, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+  
+  /// Enables or disables recording trace events. While tracing is enabled, each
+  /// thread keeps the last kTraceEventsPerThread timer events in a ring buffer.
+  static void setTraceEnabled(bool enabled);
+  static inline bool isTraceEnabled() { return m_traceEnabled.load(std::memory_order_relaxed); }
+  
+  /// Sets the name of the calling thread for the exported trace.
+  static void setThreadName(const std::string& name);
+  
+  /// Writes the recorded trace events of all threads in the Chrome trace event
+  /// JSON format, which can be opened with chrome://tracing or https://ui.perfetto.dev.
+  /// The events of threads that are stopping timers at the same time may be
+  /// incomplete; to get a consistent trace, call this while the traced threads
+  /// are idle, or after disabling tracing.
+  static bool writeChromeTrace(const std::string& path);
+  
   static usize getHandle(const std::string& tag);
+  static usize getHandle(const char* tag);
   static std::string getTag(usize handle);
   static double getTotalSeconds(usize handle);
   static double getTotalSeconds(const std::string& tag);
@@ -139,23 +171,54 @@ class Timing {
   static std::string print(const SortType sort);
   static std::string secondsToTimeString(double seconds, bool long_format = false);
   
+  /// Maximum number of handles.
+  static constexpr usize kMaxHandles = 4096;
+  
+  /// Size of the per-thread trace ring buffers.
+  static constexpr usize kTraceEventsPerThread = 1 << 16;
+  
  private:
   template <typename TMap, typename Accessor>
   static void print(const TMap& map, const Accessor& accessor, std::ostream& out);
   
   static Timing& instance();
   
+  /// Returns the data of the calling thread, creating it if it does not exist yet.
+  static ThreadTimingData* getThreadData();
+  
+  /// Merges the statistics of all threads for the given handle.
+  static TimerMapValue getMergedValue(usize handle);
+  
+  /// Returns the current reset generation of the given handle. Per-thread
+  /// statistics with a different generation are outdated.
+  static inline u32 getGeneration(usize handle) {
+    return instance().m_resetCount.load(std::memory_order_relaxed) +
+           instance().m_handleResetCounts[handle].load(std::memory_order_relaxed);
+  }
+  
   // Singleton design pattern
   Timing();
   ~Timing();
   
   typedef std::unordered_map<std::string, usize> map_t;
-  typedef std::vector<TimerMapValue> list_t;
   
   // Static members
-  list_t m_timers;
   map_t m_tagMap;
+  usize m_numHandles;
   usize m_maxTagLength;
-    
+  
+  /// Data of all threads that recorded samples, including threads that exited already.
+  std::vector<std::unique_ptr<ThreadTimingData>> m_threads;
+  
+  /// Counters which are incremented by reset() and reset(handle).
+  std::atomic<u32> m_resetCount;
+  std::unique_ptr<std::atomic<u32>[]> m_handleResetCounts;
+  
+  /// Reference time for the timestamps of the exported trace.
+  std::chrono::steady_clock::time_point m_traceStartTime;
+  
+  static std::atomic<bool> m_traceEnabled;
+  
+  /// Protects m_tagMap, m_numHandles, m_maxTagLength, and m_threads.
   static std::mutex m_mutex;
 };
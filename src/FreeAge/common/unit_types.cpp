@@ -8,24 +8,36 @@
 
 #include "FreeAge/common/logging.hpp"
 
-float GetUnitRadius(UnitType type) {
-  // TODO: Load this from some data file
-  
-  if (IsVillager(type)) {
-    return 0.15;
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return 0.15;
-  case UnitType::Scout:
-    return 0.3;
-  default:
-    LOG(ERROR) << "GetUnitRadius() called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return 0;
+static constexpr UnitStats VillagerStats(int attackFrames) {
+  // TODO: Production time set too short on purpose for testing
+  return {0.15f, 1.f, ResourceAmount(0, 50, 0, 0), 10, attackFrames, 25, 3, 0, 4};
+}
+
+/// The built-in unit stats, indexed by UnitType.
+/// TODO: The attack frames could be extracted from the attack sprites.
+static constexpr std::array<UnitStats, static_cast<int>(UnitType::NumUnits)> kDefaultUnitStats = {{
+  // radius, moveSpeed, cost, productionTime, attackFrames, maxHP, meleeAttack, meleeArmor, lineOfSight
+  /* FemaleVillager */            VillagerStats(45),
+  /* FemaleVillagerBuilder */     VillagerStats(45),
+  /* FemaleVillagerForager */     VillagerStats(45),
+  /* FemaleVillagerLumberjack */  VillagerStats(45),
+  /* FemaleVillagerGoldMiner */   VillagerStats(45),
+  /* FemaleVillagerStoneMiner */  VillagerStats(45),
+  /* MaleVillager */              VillagerStats(60),
+  /* MaleVillagerBuilder */       VillagerStats(60),
+  /* MaleVillagerForager */       VillagerStats(60),
+  /* MaleVillagerLumberjack */    VillagerStats(60),
+  /* MaleVillagerGoldMiner */     VillagerStats(60),
+  /* MaleVillagerStoneMiner */    VillagerStats(60),
+  /* Militia */                   {0.15f, 1.f, ResourceAmount(0, 60, 20, 0), 8, 30, 40, 4, 0, 4},  // TODO: Production time set too short on purpose for testing
+  /* Scout */                     {0.3f, 2.f, ResourceAmount(0, 80, 0, 0), 4, 30, 45, 3, 0, 4},  // TODO: Production time set too short on purpose for testing
+}};
+static_assert(kDefaultUnitStats.back().maxHP > 0, "kDefaultUnitStats must contain an entry for each UnitType");
+
+std::array<UnitStats, static_cast<int>(UnitType::NumUnits)> unitStatsTable = kDefaultUnitStats;
+
+const UnitStats& GetDefaultUnitStats(UnitType type) {
+  return kDefaultUnitStats[static_cast<int>(type)];
 }
 
 QString GetUnitName(UnitType type) {
@@ -61,145 +73,3 @@ QString GetUnitName(UnitType type) {
   return 0;
 }
 
-ResourceAmount GetUnitCost(UnitType type) {
-  // TODO: Load this from some data file
-  
-  if (IsVillager(type)) {
-    return ResourceAmount(0, 50, 0, 0);
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return ResourceAmount(0, 60, 20, 0);
-  case UnitType::Scout:
-    return ResourceAmount(0, 80, 0, 0);
-  default:
-    LOG(ERROR) << "GetUnitName() called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return ResourceAmount(0, 0, 0, 0);
-}
-
-float GetUnitProductionTime(UnitType type) {
-  // TODO: Load this from some data file
-  
-  if (IsVillager(type)) {
-    return 10;  // TODO: Set too short on purpose for testing
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return 8;  // TODO: Set too short on purpose for testing
-  case UnitType::Scout:
-    return 4;  // TODO: Set too short on purpose for testing
-  default:
-    LOG(ERROR) << "GetUnitProductionTime() called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return -1;
-}
-
-int GetUnitAttackFrames(UnitType type) {
-  // TODO: Load this from some data file
-  // TODO: These could be extracted from the attack sprites.
-  
-  if (IsFemaleVillager(type)) {
-    return 45;
-  } else if (IsMaleVillager(type)) {
-    return 60;
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return 30;
-  case UnitType::Scout:
-    return 30;
-  default:
-    LOG(ERROR) << "GetUnitAttackFrames() called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return 0;
-}
-
-u32 GetUnitMaxHP(UnitType type) {
-  // TODO: Load this from some data file
-  
-  if (IsVillager(type)) {
-    return 25;
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return 40;
-  case UnitType::Scout:
-    return 45;
-  default:
-    LOG(ERROR) << "Function called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return 0;
-}
-
-u32 GetUnitMeleeAttack(UnitType type) {
-  // TODO: Load this from some data file
-  
-  if (IsVillager(type)) {
-    return 3;
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return 4;
-  case UnitType::Scout:
-    return 3;
-  default:
-    LOG(ERROR) << "Function called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return 0;
-}
-
-u32 GetUnitMeleeArmor(UnitType type) {
-  // TODO: Load this from some data file
-  
-  if (IsVillager(type)) {
-    return 0;
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return 0;
-  case UnitType::Scout:
-    return 0;
-  default:
-    LOG(ERROR) << "Function called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return 0;
-}
-
-float GetUnitLineOfSight(UnitType type) {
-  // TODO: Load this from some data file
-  
-  if (IsVillager(type)) {
-    return 4;
-  }
-  
-  switch (type) {
-  case UnitType::Militia:
-    return 4;
-  case UnitType::Scout:
-    return 4;
-  default:
-    LOG(ERROR) << "Function called on unsupported type: " << static_cast<int>(type);
-    break;
-  }
-  
-  return 0;
-}
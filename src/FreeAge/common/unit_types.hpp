@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <array>
+
 #include <QString>
 
 #include "FreeAge/common/resources.hpp"
@@ -69,21 +71,55 @@ inline ResourceType GetResourceTypeOfVillagerType(UnitType type) {
   return ResourceType::NumTypes;
 }
 
-float GetUnitRadius(UnitType type);
 QString GetUnitName(UnitType type);
 
-/// TODO: This needs to consider the player's civilization and researched technologies
-ResourceAmount GetUnitCost(UnitType type);
+/// Gameplay properties of a unit type.
+/// TODO: Some of these need to consider the player's civilization and researched technologies
+struct UnitStats {
+  /// Radius of the unit's collision circle, in map tiles.
+  float radius;
+  
+  /// Movement speed in map tiles per second.
+  float moveSpeed;
+  
+  ResourceAmount cost;
+  
+  /// Production time in seconds.
+  float productionTime;
+  
+  /// Number of frames of the attack animation.
+  int attackFrames;
+  
+  u32 maxHP;
+  u32 meleeAttack;
+  u32 meleeArmor;
+  
+  /// Line of sight radius in map tiles.
+  float lineOfSight;
+};
 
-/// Returns the production time for the unit in seconds.
-/// TODO: This needs to consider the player's civilization and researched technologies
-float GetUnitProductionTime(UnitType type);
+/// The stats of all unit types, indexed by UnitType.
+/// This is initialized with the built-in defaults (see GetDefaultUnitStats()) and may be
+/// changed by LoadStatsDatabase() at program start, before any other thread accesses it.
+/// Use GetUnitStats() for reading.
+extern std::array<UnitStats, static_cast<int>(UnitType::NumUnits)> unitStatsTable;
+
+inline const UnitStats& GetUnitStats(UnitType type) {
+  return unitStatsTable[static_cast<int>(type)];
+}
+
+/// Returns the built-in stats of the given unit type.
+const UnitStats& GetDefaultUnitStats(UnitType type);
 
-int GetUnitAttackFrames(UnitType type);
+inline float GetUnitRadius(UnitType type) { return GetUnitStats(type).radius; }
+inline float GetUnitMoveSpeed(UnitType type) { return GetUnitStats(type).moveSpeed; }
+inline const ResourceAmount& GetUnitCost(UnitType type) { return GetUnitStats(type).cost; }
 
-/// TODO: This needs to consider the player's civilization and researched technologies
-u32 GetUnitMaxHP(UnitType type);
-u32 GetUnitMeleeAttack(UnitType type);
-u32 GetUnitMeleeArmor(UnitType type);
+/// Returns the production time for the unit in seconds.
+inline float GetUnitProductionTime(UnitType type) { return GetUnitStats(type).productionTime; }
 
-float GetUnitLineOfSight(UnitType type);
+inline int GetUnitAttackFrames(UnitType type) { return GetUnitStats(type).attackFrames; }
+inline u32 GetUnitMaxHP(UnitType type) { return GetUnitStats(type).maxHP; }
+inline u32 GetUnitMeleeAttack(UnitType type) { return GetUnitStats(type).meleeAttack; }
+inline u32 GetUnitMeleeArmor(UnitType type) { return GetUnitStats(type).meleeArmor; }
+inline float GetUnitLineOfSight(UnitType type) { return GetUnitStats(type).lineOfSight; }
@@ -0,0 +1,94 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/common/worker_pool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(int numThreads)
+    : nextTaskIndex(0) {
+  if (numThreads <= 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  
+  threads.reserve(numThreads - 1);
+  for (int i = 0; i < numThreads - 1; ++ i) {
+    threads.emplace_back(&WorkerPool::WorkerMain, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    quitRequested = true;
+  }
+  jobStartedCondition.notify_all();
+  
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void WorkerPool::ParallelFor(int numTasks, const std::function<void(int)>& func) {
+  if (numTasks <= 0) {
+    return;
+  }
+  if (threads.empty() || numTasks == 1) {
+    for (int taskIndex = 0; taskIndex < numTasks; ++ taskIndex) {
+      func(taskIndex);
+    }
+    return;
+  }
+  
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobFunc = &func;
+    jobNumTasks = numTasks;
+    nextTaskIndex = 0;
+    numBusyWorkers = threads.size();
+    ++ jobCounter;
+  }
+  jobStartedCondition.notify_all();
+  
+  RunTasks();
+  
+  // Wait for the workers, since they may still be processing their last task,
+  // and since they must not see the next job's state before finishing this one.
+  std::unique_lock<std::mutex> lock(mutex);
+  jobFinishedCondition.wait(lock, [&]() { return numBusyWorkers == 0; });
+  jobFunc = nullptr;
+}
+
+void WorkerPool::WorkerMain() {
+  u64 lastJobCounter = 0;
+  
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobStartedCondition.wait(lock, [&]() { return quitRequested || jobCounter != lastJobCounter; });
+      if (quitRequested) {
+        return;
+      }
+      lastJobCounter = jobCounter;
+    }
+    
+    RunTasks();
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    -- numBusyWorkers;
+    if (numBusyWorkers == 0) {
+      jobFinishedCondition.notify_one();
+    }
+  }
+}
+
+void WorkerPool::RunTasks() {
+  while (true) {
+    int taskIndex = nextTaskIndex++;
+    if (taskIndex >= jobNumTasks) {
+      return;
+    }
+    (*jobFunc)(taskIndex);
+  }
+}
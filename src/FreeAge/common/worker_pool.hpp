@@ -0,0 +1,71 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FreeAge/common/free_age.hpp"
+
+/// A fixed set of worker threads for running data-parallel jobs, for example for
+/// preparing the render data of many objects in each frame. In contrast to starting
+/// new threads for each job, the threads are kept alive (and wait on a condition
+/// variable while idle), such that the per-job overhead is small.
+///
+/// The thread that calls ParallelFor() takes part in processing the job's tasks.
+class WorkerPool {
+ public:
+  /// Creates a pool that runs jobs with the given number of threads (including the calling thread).
+  /// If numThreads is zero or negative, the number of hardware threads is used.
+  explicit WorkerPool(int numThreads = 0);
+  
+  /// Waits for the worker threads to exit. Must not be called while a job is running.
+  ~WorkerPool();
+  
+  WorkerPool(const WorkerPool& other) = delete;
+  WorkerPool& operator= (const WorkerPool& other) = delete;
+  
+  /// Calls func(taskIndex) for all taskIndex in [0, numTasks), distributing the calls
+  /// over the threads, and returns once all calls have finished. The order in which
+  /// the tasks are processed is unspecified. Must not be called by multiple threads
+  /// concurrently, and must not be called from within a task.
+  void ParallelFor(int numTasks, const std::function<void(int)>& func);
+  
+  /// Returns the number of threads that process the tasks (including the calling thread).
+  inline int GetNumThreads() const { return threads.size() + 1; }
+  
+ private:
+  void WorkerMain();
+  
+  /// Processes tasks of the current job until there are no unclaimed tasks left.
+  void RunTasks();
+  
+  std::vector<std::thread> threads;
+  
+  std::mutex mutex;
+  
+  /// Notified when a new job is started or when the threads shall exit.
+  std::condition_variable jobStartedCondition;
+  
+  /// Notified when the last worker thread finished its part of the current job.
+  std::condition_variable jobFinishedCondition;
+  
+  /// Incremented for each job. Allows the worker threads to distinguish new jobs from spurious wake-ups.
+  u64 jobCounter = 0;
+  
+  /// Number of worker threads that have not finished their part of the current job yet.
+  int numBusyWorkers = 0;
+  
+  bool quitRequested = false;
+  
+  // The current job.
+  const std::function<void(int)>* jobFunc = nullptr;
+  int jobNumTasks = 0;
+  std::atomic<int> nextTaskIndex;
+};
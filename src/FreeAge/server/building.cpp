@@ -10,6 +10,7 @@
 ServerBuilding::ServerBuilding(int playerIndex, BuildingType type, const QPoint& baseTile, float buildPercentage)
     : ServerObject(ObjectType::Building, playerIndex),
       productionPercentage(0),
+      productionStartStep(0),
       type(type),
       baseTile(baseTile),
       buildPercentage(buildPercentage) {
@@ -43,6 +43,9 @@ class ServerBuilding : public ServerObject {
   inline float GetProductionPercentage() const { return productionPercentage; }
   inline void SetProductionPercentage(float percentage) { productionPercentage = percentage; }
   
+  inline u64 GetProductionStartStep() const { return productionStartStep; }
+  inline void SetProductionStartStep(u64 stepIndex) { productionStartStep = stepIndex; }
+  
   inline BuildingType GetType() const { return type; }
   inline const QPoint& GetBaseTile() const { return baseTile; }
   
@@ -57,8 +60,13 @@ class ServerBuilding : public ServerObject {
   std::vector<UnitType> productionQueue;
   
   /// The progress on the production of the first item in the productionQueue, in percent.
+  /// This is only updated in the game steps in which the building is simulated, see Game::ScheduleObject().
   float productionPercentage;
   
+  /// The index of the game step in which the production of the first item in the productionQueue started.
+  /// Only valid while productionPercentage is non-zero.
+  u64 productionStartStep;
+  
   BuildingType type;
   
   /// The "base tile" is the minimum map tile coordinate on which the building
@@ -0,0 +1,343 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/server/crowd_steering.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FreeAge/common/util.hpp"
+#include "FreeAge/server/map.hpp"
+#include "FreeAge/server/unit.hpp"
+#include "FreeAge/server/unit_grid.hpp"
+
+/// Tolerance for treating two lines as parallel in the linear programs below.
+constexpr float kParallelEpsilon = 1e-5f;
+
+static inline float Det(float ax, float ay, float bx, float by) {
+  return ax * by - ay * bx;
+}
+
+/// The linear programs below follow the reference implementation of ORCA (the RVO2 library).
+/// They find the velocity within the half-planes given by lines (all of which are to the left
+/// of the lines' directions) and within a circle of the given radius (the maximum speed) that
+/// is closest to the optimal velocity. If directionOpt is true, the optimal velocity is instead
+/// a unit direction, and the velocity that goes furthest in this direction is returned.
+
+/// Solves the linear program on line lineIndex, subject to the lines before it.
+/// Returns false if there is no solution.
+template <typename LineT>
+static bool LinearProgram1(const std::vector<LineT>& lines, usize lineIndex, float radius, float optX, float optY, bool directionOpt, float* resultX, float* resultY) {
+  const LineT& line = lines[lineIndex];
+  float dotProduct = line.pointX * line.directionX + line.pointY * line.directionY;
+  float discriminant = dotProduct * dotProduct + radius * radius - (line.pointX * line.pointX + line.pointY * line.pointY);
+  if (discriminant < 0) {
+    // The max speed circle fully invalidates the line.
+    return false;
+  }
+  
+  float sqrtDiscriminant = sqrtf(discriminant);
+  float tLeft = -dotProduct - sqrtDiscriminant;
+  float tRight = -dotProduct + sqrtDiscriminant;
+  
+  for (usize i = 0; i < lineIndex; ++ i) {
+    float denominator = Det(line.directionX, line.directionY, lines[i].directionX, lines[i].directionY);
+    float numerator = Det(lines[i].directionX, lines[i].directionY, line.pointX - lines[i].pointX, line.pointY - lines[i].pointY);
+    
+    if (std::fabs(denominator) <= kParallelEpsilon) {
+      // The lines are (almost) parallel.
+      if (numerator < 0) {
+        return false;
+      }
+      continue;
+    }
+    
+    float t = numerator / denominator;
+    if (denominator >= 0) {
+      tRight = std::min(tRight, t);
+    } else {
+      tLeft = std::max(tLeft, t);
+    }
+    if (tLeft > tRight) {
+      return false;
+    }
+  }
+  
+  float t;
+  if (directionOpt) {
+    t = (optX * line.directionX + optY * line.directionY > 0) ? tRight : tLeft;
+  } else {
+    t = std::max(tLeft, std::min(tRight, line.directionX * (optX - line.pointX) + line.directionY * (optY - line.pointY)));
+  }
+  *resultX = line.pointX + t * line.directionX;
+  *resultY = line.pointY + t * line.directionY;
+  return true;
+}
+
+/// Solves the linear program for all lines. Returns the number of lines if successful,
+/// or otherwise the index of the line on which it failed.
+template <typename LineT>
+static usize LinearProgram2(const std::vector<LineT>& lines, float radius, float optX, float optY, bool directionOpt, float* resultX, float* resultY) {
+  float optSquaredLength = optX * optX + optY * optY;
+  if (directionOpt) {
+    *resultX = optX * radius;
+    *resultY = optY * radius;
+  } else if (optSquaredLength > radius * radius) {
+    float factor = radius / sqrtf(optSquaredLength);
+    *resultX = optX * factor;
+    *resultY = optY * factor;
+  } else {
+    *resultX = optX;
+    *resultY = optY;
+  }
+  
+  for (usize i = 0; i < lines.size(); ++ i) {
+    if (Det(lines[i].directionX, lines[i].directionY, lines[i].pointX - *resultX, lines[i].pointY - *resultY) > 0) {
+      // The result does not satisfy constraint i. Compute a new optimal result.
+      float previousX = *resultX;
+      float previousY = *resultY;
+      if (!LinearProgram1(lines, i, radius, optX, optY, directionOpt, resultX, resultY)) {
+        *resultX = previousX;
+        *resultY = previousY;
+        return i;
+      }
+    }
+  }
+  
+  return lines.size();
+}
+
+/// If LinearProgram2() failed since the constraints cannot all be satisfied, this finds the
+/// velocity that minimizes the maximum violation of the constraints, starting from the line
+/// on which LinearProgram2() failed.
+template <typename LineT>
+static void LinearProgram3(const std::vector<LineT>& lines, usize beginLine, float radius, std::vector<LineT>* projectedLines, float* resultX, float* resultY) {
+  float distance = 0;
+  
+  for (usize i = beginLine; i < lines.size(); ++ i) {
+    if (Det(lines[i].directionX, lines[i].directionY, lines[i].pointX - *resultX, lines[i].pointY - *resultY) <= distance) {
+      // The result satisfies this constraint within the current maximum violation.
+      continue;
+    }
+    
+    projectedLines->clear();
+    for (usize j = 0; j < i; ++ j) {
+      LineT line;
+      float determinant = Det(lines[i].directionX, lines[i].directionY, lines[j].directionX, lines[j].directionY);
+      if (std::fabs(determinant) <= kParallelEpsilon) {
+        if (lines[i].directionX * lines[j].directionX + lines[i].directionY * lines[j].directionY > 0) {
+          // The lines point in the same direction.
+          continue;
+        }
+        // The lines point in opposite directions.
+        line.pointX = 0.5f * (lines[i].pointX + lines[j].pointX);
+        line.pointY = 0.5f * (lines[i].pointY + lines[j].pointY);
+      } else {
+        float t = Det(lines[j].directionX, lines[j].directionY, lines[i].pointX - lines[j].pointX, lines[i].pointY - lines[j].pointY) / determinant;
+        line.pointX = lines[i].pointX + t * lines[i].directionX;
+        line.pointY = lines[i].pointY + t * lines[i].directionY;
+      }
+      
+      float directionX = lines[j].directionX - lines[i].directionX;
+      float directionY = lines[j].directionY - lines[i].directionY;
+      float length = std::max(1e-6f, sqrtf(directionX * directionX + directionY * directionY));
+      line.directionX = directionX / length;
+      line.directionY = directionY / length;
+      projectedLines->push_back(line);
+    }
+    
+    float previousX = *resultX;
+    float previousY = *resultY;
+    if (LinearProgram2(*projectedLines, radius, -lines[i].directionY, lines[i].directionX, true, resultX, resultY) < projectedLines->size()) {
+      // This should in principle not happen, since the result is by definition already in
+      // the feasible region of this linear program. If it fails, it is due to small
+      // floating-point errors, and the current result is kept.
+      *resultX = previousX;
+      *resultY = previousY;
+    }
+    
+    distance = Det(lines[i].directionX, lines[i].directionY, lines[i].pointX - *resultX, lines[i].pointY - *resultY);
+  }
+}
+
+/// Returns whether the unit moves in this step. Units that attack or work on a task
+/// (e.g., gathering) keep their movement direction, but do not move.
+static bool IsMoving(ServerUnit* unit) {
+  return unit->GetMovementDirection() != QPointF(0, 0) &&
+         unit->GetCurrentAction() != UnitAction::Attack &&
+         unit->GetCurrentAction() != UnitAction::Task;
+}
+
+void CrowdSteering::ComputeVelocities(const std::vector<u32>& objectIds, const ServerMap& map, float stepLengthInSeconds) {
+  // Find the moving units, sorted by ID. If there are none, there is nothing to compute.
+  movingUnits.clear();
+  for (u32 objectId : objectIds) {
+    auto it = map.GetObjects().find(objectId);
+    if (it != map.GetObjects().end() && it->second->isUnit() && IsMoving(AsUnit(it->second))) {
+      movingUnits.emplace_back(objectId, AsUnit(it->second));
+    }
+  }
+  if (movingUnits.empty()) {
+    return;
+  }
+  std::sort(movingUnits.begin(), movingUnits.end());
+  
+  // Find the neighbor candidates of each moving unit. The unit's target is not avoided,
+  // since the unit wants to reach it.
+  constexpr float kSquaredNeighborDistance = kNeighborDistance * kNeighborDistance;
+  candidateStart.resize(movingUnits.size() + 1);
+  candidateIds.clear();
+  candidatePositionsX.clear();
+  candidatePositionsY.clear();
+  candidateVelocitiesX.clear();
+  candidateVelocitiesY.clear();
+  candidateRadii.clear();
+  candidateIsMoving.clear();
+  for (usize i = 0; i < movingUnits.size(); ++ i) {
+    ServerUnit* unit = movingUnits[i].second;
+    const QPointF& mapCoord = unit->GetMapCoord();
+    u32 targetId = unit->GetTargetObjectId();
+    
+    candidateStart[i] = candidateIds.size();
+    map.GetUnitGrid().ForEachUnitInCells(mapCoord.x() - kNeighborDistance, mapCoord.y() - kNeighborDistance, mapCoord.x() + kNeighborDistance, mapCoord.y() + kNeighborDistance, [&](const UnitGrid::Entry& entry) {
+      ServerUnit* other = entry.unit;
+      if (other == unit ||
+          entry.id == targetId ||
+          SquaredDistance(other->GetMapCoord(), mapCoord) >= kSquaredNeighborDistance) {
+        return;
+      }
+      
+      bool moving = IsMoving(other);
+      candidateIds.push_back(entry.id);
+      candidatePositionsX.push_back(other->GetMapCoord().x());
+      candidatePositionsY.push_back(other->GetMapCoord().y());
+      candidateVelocitiesX.push_back(moving ? (other->GetMoveSpeed() * other->GetMovementDirection().x()) : 0.f);
+      candidateVelocitiesY.push_back(moving ? (other->GetMoveSpeed() * other->GetMovementDirection().y()) : 0.f);
+      candidateRadii.push_back(GetUnitRadius(other->GetType()) + kRadiusMargin);
+      candidateIsMoving.push_back(moving);
+    });
+  }
+  candidateStart.back() = candidateIds.size();
+  
+  newVelocitiesX.resize(movingUnits.size());
+  newVelocitiesY.resize(movingUnits.size());
+  for (usize i = 0; i < movingUnits.size(); ++ i) {
+    ComputeVelocity(i, stepLengthInSeconds);
+  }
+}
+
+bool CrowdSteering::GetVelocity(u32 unitId, QPointF* velocity) const {
+  auto it = std::lower_bound(movingUnits.begin(), movingUnits.end(), std::make_pair(unitId, static_cast<ServerUnit*>(nullptr)));
+  if (it == movingUnits.end() || it->first != unitId) {
+    return false;
+  }
+  usize index = it - movingUnits.begin();
+  *velocity = QPointF(newVelocitiesX[index], newVelocitiesY[index]);
+  return true;
+}
+
+void CrowdSteering::ComputeVelocity(usize movingUnitIndex, float stepLengthInSeconds) {
+  ServerUnit* unit = movingUnits[movingUnitIndex].second;
+  float positionX = unit->GetMapCoord().x();
+  float positionY = unit->GetMapCoord().y();
+  float velocityX = unit->GetMoveSpeed() * unit->GetMovementDirection().x();
+  float velocityY = unit->GetMoveSpeed() * unit->GetMovementDirection().y();
+  float radius = GetUnitRadius(unit->GetType()) + kRadiusMargin;
+  
+  // Find the closest neighbors among the candidates. Since the order of the neighbors is unique,
+  // the result does not depend on the order of the candidates (i.e., of the units in the grid).
+  neighbors.clear();
+  for (u32 index = candidateStart[movingUnitIndex], end = candidateStart[movingUnitIndex + 1]; index < end; ++ index) {
+    float offsetX = candidatePositionsX[index] - positionX;
+    float offsetY = candidatePositionsY[index] - positionY;
+    neighbors.push_back({offsetX * offsetX + offsetY * offsetY, candidateIds[index], index});
+  }
+  if (neighbors.size() > static_cast<usize>(kMaxNeighbors)) {
+    std::nth_element(neighbors.begin(), neighbors.begin() + kMaxNeighbors, neighbors.end());
+    neighbors.resize(kMaxNeighbors);
+  }
+  std::sort(neighbors.begin(), neighbors.end());
+  
+  // Create the ORCA half-plane for each neighbor.
+  constexpr float kInvTimeHorizon = 1.f / kTimeHorizon;
+  float invStepLength = 1.f / stepLengthInSeconds;
+  lines.clear();
+  for (const auto& neighbor : neighbors) {
+    u32 index = neighbor.candidateIndex;
+    float relativePositionX = candidatePositionsX[index] - positionX;
+    float relativePositionY = candidatePositionsY[index] - positionY;
+    float relativeVelocityX = velocityX - candidateVelocitiesX[index];
+    float relativeVelocityY = velocityY - candidateVelocitiesY[index];
+    float squaredDistance = neighbor.squaredDistance;
+    float combinedRadius = radius + candidateRadii[index];
+    float squaredCombinedRadius = combinedRadius * combinedRadius;
+    
+    Line line;
+    float uX;
+    float uY;
+    if (squaredDistance > squaredCombinedRadius) {
+      // No collision. Vector from the cutoff center to the relative velocity:
+      float wX = relativeVelocityX - kInvTimeHorizon * relativePositionX;
+      float wY = relativeVelocityY - kInvTimeHorizon * relativePositionY;
+      float wSquaredLength = wX * wX + wY * wY;
+      float dotProduct = wX * relativePositionX + wY * relativePositionY;
+      
+      if (dotProduct < 0 && dotProduct * dotProduct > squaredCombinedRadius * wSquaredLength) {
+        // Project on the cut-off circle.
+        float wLength = sqrtf(wSquaredLength);
+        float unitWX = wX / wLength;
+        float unitWY = wY / wLength;
+        line.directionX = unitWY;
+        line.directionY = -unitWX;
+        uX = (combinedRadius * kInvTimeHorizon - wLength) * unitWX;
+        uY = (combinedRadius * kInvTimeHorizon - wLength) * unitWY;
+      } else {
+        // Project on the legs.
+        float leg = sqrtf(squaredDistance - squaredCombinedRadius);
+        if (Det(relativePositionX, relativePositionY, wX, wY) > 0) {
+          // Project on the left leg.
+          line.directionX = (relativePositionX * leg - relativePositionY * combinedRadius) / squaredDistance;
+          line.directionY = (relativePositionX * combinedRadius + relativePositionY * leg) / squaredDistance;
+        } else {
+          // Project on the right leg.
+          line.directionX = -(relativePositionX * leg + relativePositionY * combinedRadius) / squaredDistance;
+          line.directionY = -(-relativePositionX * combinedRadius + relativePositionY * leg) / squaredDistance;
+        }
+        float legDotProduct = relativeVelocityX * line.directionX + relativeVelocityY * line.directionY;
+        uX = legDotProduct * line.directionX - relativeVelocityX;
+        uY = legDotProduct * line.directionY - relativeVelocityY;
+      }
+    } else {
+      // The units overlap. Project on the cut-off circle of the step length, such that
+      // they get separated within the next step.
+      float wX = relativeVelocityX - invStepLength * relativePositionX;
+      float wY = relativeVelocityY - invStepLength * relativePositionY;
+      float wLength = std::max(1e-6f, sqrtf(wX * wX + wY * wY));
+      float unitWX = wX / wLength;
+      float unitWY = wY / wLength;
+      line.directionX = unitWY;
+      line.directionY = -unitWX;
+      uX = (combinedRadius * invStepLength - wLength) * unitWX;
+      uY = (combinedRadius * invStepLength - wLength) * unitWY;
+    }
+    
+    // Moving units share the responsibility for avoiding each other, while units
+    // that stand still must be avoided completely.
+    float responsibility = (candidateIsMoving[index] && squaredDistance > squaredCombinedRadius) ? 0.5f : 1.f;
+    line.pointX = velocityX + responsibility * uX;
+    line.pointY = velocityY + responsibility * uY;
+    lines.push_back(line);
+  }
+  
+  float maxSpeed = unit->GetMoveSpeed();
+  float newVelocityX;
+  float newVelocityY;
+  usize failedLine = LinearProgram2(lines, maxSpeed, velocityX, velocityY, false, &newVelocityX, &newVelocityY);
+  if (failedLine < lines.size()) {
+    LinearProgram3(lines, failedLine, maxSpeed, &projectedLines, &newVelocityX, &newVelocityY);
+  }
+  
+  newVelocitiesX[movingUnitIndex] = newVelocityX;
+  newVelocitiesY[movingUnitIndex] = newVelocityY;
+}
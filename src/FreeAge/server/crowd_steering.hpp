@@ -0,0 +1,110 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <QPointF>
+
+#include "FreeAge/common/free_age.hpp"
+
+class ServerMap;
+class ServerUnit;
+
+/// Computes velocities for the moving units that avoid collisions with all nearby units,
+/// using Optimal Reciprocal Collision Avoidance (ORCA) as described in:
+/// van den Berg, Guy, Lin, and Manocha, "Reciprocal n-Body Collision Avoidance", 2011.
+///
+/// For each moving unit, each neighbor within kNeighborDistance defines a half-plane of
+/// velocities that avoid colliding with it within kTimeHorizon seconds. Moving neighbors
+/// take half of the responsibility for avoiding each other, while units that stand still
+/// are avoided completely. The velocity within all half-planes (and the unit's maximum
+/// speed) that is closest to the unit's preferred velocity is then found with a small
+/// 2D linear program. Only units are considered; occupied map tiles are left to the path
+/// planning and to the collision test when moving.
+///
+/// The velocities are computed in one batch from the state at the start of a game step,
+/// such that the result does not depend on the order in which the units are simulated.
+/// Only the moving units are visited, and their neighbor candidates are looked up in the
+/// map's UnitGrid, so units that stand still far away from any moving unit do not cost
+/// anything. The candidates are stored as structure-of-arrays, which does not allocate
+/// memory once the vectors have grown to their final size.
+class CrowdSteering {
+ public:
+  /// Computes the velocities of the moving units among the objects with the given IDs on the
+  /// given map. IDs of objects that are not on the map are ignored. Units are considered to be
+  /// moving if they have a movement direction and are not attacking or working. Since the
+  /// game keeps all moving units active, the IDs of the active objects can be passed in.
+  void ComputeVelocities(const std::vector<u32>& objectIds, const ServerMap& map, float stepLengthInSeconds);
+  
+  /// Returns the velocity that was computed for the unit with the given ID by the last
+  /// call to ComputeVelocities(). Returns false if the unit was not moving at that time.
+  bool GetVelocity(u32 unitId, QPointF* velocity) const;
+  
+ private:
+  /// Time (in seconds) within which collisions are avoided. Larger values make the
+  /// units react to others earlier, but also restrict their velocities more.
+  static constexpr float kTimeHorizon = 2;
+  
+  /// Distance (in tiles) between unit centers up to which units are considered as neighbors.
+  static constexpr float kNeighborDistance = 3;
+  
+  /// Margin (in tiles) that is added to the unit radii. This keeps small gaps between the
+  /// units, such that the collision test when moving does not fail due to rounding.
+  static constexpr float kRadiusMargin = 0.02f;
+  
+  /// Maximum number of (closest) neighbors that are considered for each unit.
+  static constexpr int kMaxNeighbors = 10;
+  
+  /// A line that bounds a half-plane of allowed velocities, which lies to the left of the direction.
+  struct Line {
+    float pointX;
+    float pointY;
+    float directionX;
+    float directionY;
+  };
+  
+  /// A neighbor of the unit for which ComputeVelocity() is called. Neighbors are ordered by
+  /// distance, and by ID for the same distance, such that the order is unique.
+  struct Neighbor {
+    inline bool operator< (const Neighbor& other) const {
+      return (squaredDistance != other.squaredDistance) ? (squaredDistance < other.squaredDistance) : (id < other.id);
+    }
+    
+    float squaredDistance;
+    u32 id;
+    u32 candidateIndex;
+  };
+  
+  /// Computes the velocity for the moving unit with the given index in movingUnits.
+  void ComputeVelocity(usize movingUnitIndex, float stepLengthInSeconds);
+  
+  
+  /// (unit ID, unit) for all moving units, sorted by ID, for GetVelocity().
+  std::vector<std::pair<u32, ServerUnit*>> movingUnits;
+  
+  /// The neighbor candidates of movingUnits[i] have the indices [candidateStart[i], candidateStart[i + 1])
+  /// in the candidate arrays below. These are the units within kNeighborDistance, except for the unit
+  /// itself and its target. A unit which is close to several moving units is stored once for each of them,
+  /// which is cheaper than finding the distinct units.
+  std::vector<u32> candidateStart;
+  std::vector<u32> candidateIds;
+  std::vector<float> candidatePositionsX;
+  std::vector<float> candidatePositionsY;
+  std::vector<float> candidateVelocitiesX;
+  std::vector<float> candidateVelocitiesY;
+  std::vector<float> candidateRadii;
+  std::vector<u8> candidateIsMoving;
+  
+  /// Computed velocities, indexed like movingUnits.
+  std::vector<float> newVelocitiesX;
+  std::vector<float> newVelocitiesY;
+  
+  /// Scratch memory for ComputeVelocity().
+  std::vector<Neighbor> neighbors;
+  std::vector<Line> lines;
+  std::vector<Line> projectedLines;
+};
@@ -4,6 +4,8 @@
 
 #include "FreeAge/server/game.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include <QApplication>
@@ -27,14 +29,27 @@ void PlayerInGame::RemoveFromGame() {
   isConnected = false;
 }
 
+QJsonObject MovementStatistics::ToJSONObject() const {
+  QJsonObject object;
+  object["pathPlans"] = static_cast<double>(pathPlans);
+  object["steeredMoves"] = static_cast<double>(steeredMoves);
+  object["blockedMoves"] = static_cast<double>(blockedMoves);
+  return object;
+}
+
+
+/// The rate at which the game is simulated.
+constexpr float kTargetFPS = 30;
+constexpr float kSimulationTimeInterval = 1 / kTargetFPS;
+
+/// Idle military units scan for enemies in their line of sight every kTargetScanInterval game steps.
+/// The scans of the different units are distributed evenly over the steps.
+constexpr int kTargetScanInterval = 8;
 
 Game::Game(ServerSettings* settings)
     : settings(settings) {}
 
 void Game::RunGameLoop(std::vector<std::shared_ptr<PlayerInGame>>* playersInGame) {
-  constexpr float kTargetFPS = 30;
-  constexpr float kSimulationTimeInterval = 1 / kTargetFPS;
-  
   accumulatedMessages.resize(playersInGame->size());
   for (usize playerIndex = 0; playerIndex < playersInGame->size(); ++ playerIndex) {
     accumulatedMessages[playerIndex].reserve(1024);
@@ -60,6 +75,7 @@ void Game::RunGameLoop(std::vector<std::shared_ptr<PlayerInGame>>* playersInGame
       bool removePlayer = false;
       if (player->unparsedBuffer.size() > prevSize ||
           (firstLoopIteration && !player->unparsedBuffer.isEmpty())) {
+        ScopedStepPhase parsingPhase(StepPhase::MessageParsing, &profiler);
         ParseMessagesResult parseResult = TryParseClientMessages(player.get(), *playersInGame);
         removePlayer = parseResult == ParseMessagesResult::PlayerLeftOrShouldBeDisconnected;
       }
@@ -90,6 +106,21 @@ void Game::RunGameLoop(std::vector<std::shared_ptr<PlayerInGame>>* playersInGame
         lastSimulationTime += kSimulationTimeInterval;
       }
       
+      // Write the profiling statistics periodically if requested.
+      if (!settings->metricsPath.isEmpty() &&
+          serverTime >= lastMetricsWriteTime + settings->metricsInterval) {
+        QJsonObject additionalFields;
+        additionalFields["pathCache"] = pathCache.ToJSONObject();
+        additionalFields["movement"] = movementStatistics.ToJSONObject();
+        additionalFields["scheduling"] = scheduler.ToJSONObject();
+        profiler.WriteJSON(settings->metricsPath, serverTime, additionalFields);
+        profiler.ResetWindow();
+        pathCache.ResetStatistics();
+        movementStatistics = MovementStatistics();
+        scheduler.ResetStatistics();
+        lastMetricsWriteTime = serverTime;
+      }
+      
       // If the next game step is due far enough in the future, sleep a bit to avoid "busy waiting" and reduce the CPU load.
       // However, we must not sleep for the whole time, since we should keep handling client messages
       // and processing Qt events in the meantime.
@@ -238,6 +269,7 @@ void Game::HandleMoveToMapCoordMessage(const QByteArray& msg, PlayerInGame* play
     
     ServerUnit* unit = AsUnit(it->second);
     unit->SetMoveToTarget(targetMapCoord);
+    scheduler.Wake(id);
   }
 }
 
@@ -324,6 +356,7 @@ void Game::HandleProduceUnitMessage(const QByteArray& msg, PlayerInGame* player)
   
   // Add the unit to the production queue.
   productionBuilding->QueueUnit(unitType);
+  scheduler.Wake(buildingId);
   accumulatedMessages[player->index] += CreateQueueUnitMessage(buildingId, static_cast<u16>(unitType));
 }
 
@@ -372,15 +405,13 @@ void Game::HandlePlaceBuildingFoundationMessage(const QByteArray& msg, PlayerInG
   
   // 1) Check whether any map tile at this location is occupied.
   // TODO: We should also check against foundations set by the same player.
-  for (int y = baseTile.y(); y < baseTile.y() + foundationSize.height(); ++ y) {
-    for (int x = baseTile.x(); x < baseTile.x() + foundationSize.width(); ++ x) {
-      if (map->occupiedForBuildingsAt(x, y)) {
-        // TODO: Once map visibility is implemented, players must be allowed to place foundations over other players'
-        //       buildings that they don't see. Otherwise, "foundation scanning" will be possible (as in the original game).
-        LOG(WARNING) << "Received a PlaceBuildingFoundation message for an occupied space";
-        return;
-      }
-    }
+  if (map->GetOccupancyForBuildings().IsAnyOccupiedInRect(
+          baseTile.x(), baseTile.y(),
+          baseTile.x() + foundationSize.width() - 1, baseTile.y() + foundationSize.height() - 1)) {
+    // TODO: Once map visibility is implemented, players must be allowed to place foundations over other players'
+    //       buildings that they don't see. Otherwise, "foundation scanning" will be possible (as in the original game).
+    LOG(WARNING) << "Received a PlaceBuildingFoundation message for an occupied space";
+    return;
   }
   
   // 2) Check whether the maximum elevation difference within the building space does not exceed 2.
@@ -415,6 +446,7 @@ void Game::HandlePlaceBuildingFoundationMessage(const QByteArray& msg, PlayerInG
   ServerBuilding* newBuildingFoundation = map->AddBuilding(player->index, type, baseTile, /*buildPercentage*/ 0, &newBuildingId, /*addOccupancy*/ false);
   
   player->stats.BuildingAdded(type, false);
+  scheduler.Wake(newBuildingId);
 
   QByteArray addObjectMsg = CreateAddObjectMessage(newBuildingId, newBuildingFoundation);
   accumulatedMessages[player->index] += addObjectMsg;
@@ -488,6 +520,7 @@ void Game::HandleDequeueProductionQueueItemMessage(const QByteArray& msg, Player
   
   // Remove the item from the queue.
   UnitType removedType = building->RemoveItemFromQueue(queueIndex);
+  scheduler.Wake(objectId);
   
   // Refund the resources for the item.
   player->resources.Add(GetUnitCost(removedType));
@@ -619,7 +652,10 @@ void Game::StartGame() {
   
   // Generate the map.
   map.reset(new ServerMap(settings->mapSize, settings->mapSize));
+  pathCache.Clear();
   map->GenerateRandomMap(playersInGame->size(), /*seed*/ 0);  // TODO: Choose seed
+  scheduler.Clear();
+  scheduler.WakeAll(map->GetObjects());
   
   LOG(INFO) << "Server: Preparing game start ...";
   
@@ -677,27 +713,20 @@ void Game::StartGame() {
     player->socket->write(mapUncoverMsg);
   }
   
-  // Send creation messages for the initial map objects and update stats
+  // Send creation messages for the initial map objects
   const auto& objects = map->GetObjects();
   for (const auto& item : objects) {
-    ServerObject* object = item.second;
-    
-    QByteArray addObjectMsg = CreateAddObjectMessage(item.first, object);
+    QByteArray addObjectMsg = CreateAddObjectMessage(item.first, item.second);
     for (auto& player : *playersInGame) {
       player->socket->write(addObjectMsg);
     }
-    
-    if (object->isBuilding()) {
-      ServerBuilding* building = AsBuilding(object);
-      GetPlayerStats(building->GetPlayerIndex())->BuildingAdded(building->GetType(), true);
-    } else if (object->isUnit()) {
-      GetPlayerStats(object->GetPlayerIndex())->UnitAdded(AsUnit(object)->GetType());
-    }
   }
   for (auto& player : *playersInGame) {
     player->socket->flush();
   }
   
+  AddInitialObjectsToStats();
+  
   LOG(INFO) << "Server: Game start prepared";
   gaiaStats.log();
   for (auto& player : *playersInGame) {
@@ -705,38 +734,108 @@ void Game::StartGame() {
   }
 }
 
+void Game::AddInitialObjectsToStats() {
+  for (const auto& item : map->GetObjects()) {
+    ServerObject* object = item.second;
+    if (object->isBuilding()) {
+      ServerBuilding* building = AsBuilding(object);
+      GetPlayerStats(building->GetPlayerIndex())->BuildingAdded(building->GetType(), true);
+    } else if (object->isUnit()) {
+      GetPlayerStats(object->GetPlayerIndex())->UnitAdded(AsUnit(object)->GetType());
+    }
+  }
+}
+
+void Game::StartHeadlessGame(std::vector<std::shared_ptr<PlayerInGame>>* playersInGame, const std::shared_ptr<ServerMap>& map) {
+  this->playersInGame = playersInGame;
+  this->map = map;
+  pathCache.Clear();
+  scheduler.Clear();
+  scheduler.WakeAll(map->GetObjects());
+  
+  accumulatedMessages.resize(playersInGame->size());
+  gameBeginServerTime = 0;
+  lastSimulationTime = 0;
+  
+  AddInitialObjectsToStats();
+}
+
+void Game::SimulateHeadlessStep() {
+  for (auto& player : *playersInGame) {
+    if (player->isConnected && !player->unparsedBuffer.isEmpty()) {
+      ScopedStepPhase parsingPhase(StepPhase::MessageParsing, &profiler);
+      TryParseClientMessages(player.get(), *playersInGame);
+    }
+  }
+  
+  SimulateGameStep(lastSimulationTime + kSimulationTimeInterval, kSimulationTimeInterval);
+  lastSimulationTime += kSimulationTimeInterval;
+}
+
 void Game::SimulateGameStep(double gameStepServerTime, float stepLengthInSeconds) {
+  Timer stepTimer("SimulateGameStep()");
+  
   // Reset all players to "not housed".
   for (auto& player : *playersInGame) {
     player->isHoused = false;
   }
   
-  // Iterate over all game objects to update their state.
-  auto end = map->GetObjects().end();
-  for (auto it = map->GetObjects().begin(); it != end; ++ it) {
-    const u32& objectId = it->first;
+  // Determine the game objects that are active in this step. Sleeping objects are skipped, since
+  // simulating them would not change anything (see ScheduleObject()). Objects that are added
+  // during the step (e.g., produced units) are simulated from the next step on.
+  profiler.PushPhase(StepPhase::UnitSimulation);
+  if (!settings->useActiveSetScheduling) {
+    scheduler.WakeAll(map->GetObjects());
+  }
+  const std::vector<u32>& activeObjects = scheduler.BeginStep(gameStepIndex);
+  
+  // Let the moving units steer around each other. This is computed for all units at once, before any
+  // of them moves, such that the result does not depend on the order in which the units are simulated.
+  // Since all moving units are active, only the active objects need to be passed in.
+  if (settings->useCrowdSteering) {
+    profiler.SwitchPhase(StepPhase::CrowdSteering);
+    crowdSteering.ComputeVelocities(activeObjects, *map, stepLengthInSeconds);
+  }
+  
+  // Update the state of the active objects in the order of their IDs.
+  profiler.SwitchPhase(StepPhase::UnitSimulation);
+  for (u32 objectId : activeObjects) {
+    auto it = map->GetObjects().find(objectId);
+    if (it == map->GetObjects().end()) {
+      continue;
+    }
     ServerObject* object = it->second;
     
     if (object->isUnit()) {
+      profiler.SwitchPhase(StepPhase::UnitSimulation);
       ServerUnit* unit = AsUnit(object);
       SimulateGameStepForUnit(objectId, unit, gameStepServerTime, stepLengthInSeconds);
     } else if (object->isBuilding()) {
+      profiler.SwitchPhase(StepPhase::BuildingSimulation);
       ServerBuilding* building = AsBuilding(object);
       SimulateGameStepForBuilding(objectId, building, stepLengthInSeconds);
     }
+    
+    if (settings->useActiveSetScheduling) {
+      ScheduleObject(objectId, object, stepLengthInSeconds);
+    }
   }
   
+  // Apply the damage of this step's attacks.
+  profiler.SwitchPhase(StepPhase::Combat);
+  ApplyPendingMeleeHits();
+  
   // Handle delayed object deletion.
+  profiler.SwitchPhase(StepPhase::ObjectDeletion);
   for (u32 id : objectDeleteList) {
-    auto it = map->GetObjects().find(id);
-    if (it != map->GetObjects().end()) {
-      delete it->second;
-      map->GetObjects().erase(it);
+    if (map->GetObjects().count(id) > 0) {
+      map->DeleteObject(id);
     }
   }
   objectDeleteList.clear();
   
   // Check whether we need to send "housed" messages to clients.
+  profiler.SwitchPhase(StepPhase::MessageSerialization);
   for (usize playerIndex = 0; playerIndex < playersInGame->size(); ++ playerIndex) {
     auto& player = (*playersInGame)[playerIndex];
     if (!player->isConnected) {
@@ -769,13 +868,41 @@ void Game::SimulateGameStep(double gameStepServerTime, float stepLengthInSeconds
     }
     
     if (!accumulatedMessages[playerIndex].isEmpty()) {
-      player->socket->write(
-          CreateGameStepTimeMessage(gameStepServerTime) +
-          accumulatedMessages[playerIndex]);
+      QByteArray stepMessages = CreateGameStepTimeMessage(gameStepServerTime) + accumulatedMessages[playerIndex];
       accumulatedMessages[playerIndex].clear();
-      player->socket->flush();
+      
+      // Players without a socket are simulated headlessly (see StartHeadlessGame()).
+      // Their messages are created as usual, but not sent.
+      if (player->socket) {
+        ScopedStepPhase socketWritesPhase(StepPhase::SocketWrites, &profiler);
+        player->socket->write(stepMessages);
+        player->socket->flush();
+      }
     }
   }
+  
+  profiler.PopPhase();
+  profiler.EndStep();
+  ++ gameStepIndex;
+}
+
+/// Returns the progress on the production of a unit, in percent, after the given number of game steps.
+/// The progress is computed from the step count instead of being summed up step by step, such that
+/// the building does not need to be simulated in the game steps in between.
+static float GetProductionPercentage(u64 productionSteps, float timeStepPercentage) {
+  return productionSteps * timeStepPercentage;
+}
+
+/// Returns the number of game steps after which GetProductionPercentage() reaches 100 percent.
+static u64 GetProductionStepCount(float timeStepPercentage) {
+  u64 productionSteps = std::max<u64>(1, static_cast<u64>(std::ceil(100 / timeStepPercentage)));
+  while (productionSteps > 1 && GetProductionPercentage(productionSteps - 1, timeStepPercentage) >= 100) {
+    -- productionSteps;
+  }
+  while (GetProductionPercentage(productionSteps, timeStepPercentage) < 100) {
+    ++ productionSteps;
+  }
+  return productionSteps;
 }
 
 static bool DoesUnitTouchBuildingArea(ServerUnit* unit, const QPointF& unitMapCoord, ServerBuilding* building, float errorMargin) {
@@ -804,12 +931,10 @@ static bool IsFoundationFree(ServerBuilding* foundation, ServerMap* map) {
   // Check whether map tiles are occupied
   const QPoint& baseTile = foundation->GetBaseTile();
   QSize foundationSize = GetBuildingSize(foundation->GetType());
-  for (int y = baseTile.y(); y < baseTile.y() + foundationSize.height(); ++ y) {
-    for (int x = baseTile.x(); x < baseTile.x() + foundationSize.width(); ++ x) {
-      if (map->occupiedForBuildingsAt(x, y)) {
-        return false;
-      }
-    }
+  if (map->GetOccupancyForBuildings().IsAnyOccupiedInRect(
+          baseTile.x(), baseTile.y(),
+          baseTile.x() + foundationSize.width() - 1, baseTile.y() + foundationSize.height() - 1)) {
+    return false;
   }
   
   // Check whether units are on top of the foundation
@@ -859,6 +984,54 @@ static bool TryEvadeUnit(ServerUnit* unit, float moveDistance, const QPointF& ne
   return true;
 }
 
+bool Game::TryMoveWithSteeringVelocity(u32 unitId, ServerUnit* unit, float stepLengthInSeconds, bool* unitMovementChanged) {
+  QPointF velocity;
+  if (!settings->useCrowdSteering ||
+      !crowdSteering.GetVelocity(unitId, &velocity)) {
+    return false;
+  }
+  
+  // If the steering does not change the velocity noticeably, use the regular movement.
+  float moveSpeed = unit->GetMoveSpeed();
+  constexpr float kMinVelocityChange = 0.02f;
+  if (SquaredDistance(velocity, moveSpeed * unit->GetMovementDirection()) < (kMinVelocityChange * moveSpeed) * (kMinVelocityChange * moveSpeed)) {
+    return false;
+  }
+  
+  // If the unit should (almost) stop to let others pass, wait in place.
+  constexpr float kMinSpeedFactor = 0.1f;
+  if (SquaredLength(velocity) < (kMinSpeedFactor * moveSpeed) * (kMinSpeedFactor * moveSpeed)) {
+    ++ movementStatistics.blockedMoves;
+    if (unit->GetCurrentAction() != UnitAction::Idle) {
+      unit->PauseMovement();
+      *unitMovementChanged = true;
+    }
+    return true;
+  }
+  
+  // The steering only avoids other units, so the regular movement is used if the steered
+  // movement would run into occupied space (or into a unit that started to move after the
+  // velocities were computed).
+  QPointF steeredMapCoord = unit->GetMapCoord() + stepLengthInSeconds * velocity;
+  if (map->DoesUnitCollide(unit, steeredMapCoord)) {
+    return false;
+  }
+  
+  map->MoveUnit(unit, steeredMapCoord);
+  ++ movementStatistics.steeredMoves;
+  
+  // Change our movement direction in order to still face the next path goal.
+  QPointF direction = unit->GetNextPathTarget() - unit->GetMapCoord();
+  direction = direction / std::max(1e-4f, Length(direction));
+  unit->SetMovementDirection(direction);
+  
+  if (unit->GetCurrentAction() != UnitAction::Moving) {
+    unit->SetCurrentAction(UnitAction::Moving);
+  }
+  *unitMovementChanged = true;
+  return true;
+}
+
 void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStepServerTime, float stepLengthInSeconds) {
   bool unitMovementChanged = false;
   
@@ -866,18 +1039,9 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
   if (unit->GetCurrentAction() == UnitAction::Attack) {
     bool stayInPlace = false;
     
-    auto targetIt = map->GetObjects().find(unit->GetTargetObjectId());
-    u32 targetId;
-    ServerObject* target;
-    if (targetIt == map->GetObjects().end()) {
-      targetId = kInvalidObjectId;
-      target = nullptr;
-    } else {
-      targetId = targetIt->first;
-      target = targetIt->second;
-    }
-    
-    if (SimulateMeleeAttack(unitId, unit, targetId, target, gameStepServerTime, stepLengthInSeconds, &unitMovementChanged, &stayInPlace)) {
+    // Note that the target object does not need to be looked up here, since this is only
+    // required when the hit is applied (in ApplyPendingMeleeHits()).
+    if (SimulateMeleeAttack(unit, unit->GetTargetObjectId(), gameStepServerTime, stepLengthInSeconds, &unitMovementChanged, &stayInPlace)) {
       // The attack is still in progress.
       return;
     }
@@ -890,9 +1054,19 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
     }
   }
   
+  // Let idle military units attack enemies in their line of sight.
+  if (!IsVillager(unit->GetType()) &&
+      unit->GetCurrentAction() == UnitAction::Idle &&
+      unit->GetTargetObjectId() == kInvalidObjectId &&
+      !unit->HasMoveToTarget()) {
+    TryAutoAttack(unit, unitId);
+  }
+  
   // If the unit's goal has been updated, plan a path towards the goal.
   if (unit->HasMoveToTarget() && !unit->HasPath()) {
-    PlanUnitPath(unit, map.get());
+    ScopedStepPhase pathfindingPhase(StepPhase::Pathfinding, &profiler);
+    PlanUnitPath(unit, map.get(), settings->useAnyAnglePathPlanning ? PathPlanner::AnyAngle : PathPlanner::Grid, &pathCache);
+    ++ movementStatistics.pathPlans;
     unitMovementChanged = true;
   } else if (unit->HasMoveToTarget() && unit->GetTargetObjectId() != kInvalidObjectId) {
     // Check whether we target a moving object. If yes and the target has moved too much,
@@ -900,6 +1074,12 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
     auto targetIt = map->GetObjects().find(unit->GetTargetObjectId());
     if (targetIt == map->GetObjects().end()) {
       unit->RemoveTarget();
+      if (!IsVillager(unit->GetType())) {
+        // The target was destroyed. Stop and look for the next enemy right away.
+        unit->StopMovement();
+        unit->RequestTargetScan();
+        unitMovementChanged = true;
+      }
     } else if (targetIt->second->isUnit()) {
       ServerUnit* targetUnit = AsUnit(targetIt->second);
       
@@ -907,7 +1087,9 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
       if (SquaredDistance(targetUnit->GetMapCoord(), unit->GetMoveToTargetMapCoord()) > kReplanThresholdDistance) {
         // Since we keep the target here, there is no need to use SetUnitTargets() since the unit's type will never change.
         unit->SetTarget(unit->GetTargetObjectId(), targetUnit, false);
-        PlanUnitPath(unit, map.get());
+        ScopedStepPhase pathfindingPhase(StepPhase::Pathfinding, &profiler);
+        PlanUnitPath(unit, map.get(), settings->useAnyAnglePathPlanning ? PathPlanner::AnyAngle : PathPlanner::Grid, &pathCache);
+        ++ movementStatistics.pathPlans;
         unitMovementChanged = true;
       }
     }
@@ -942,7 +1124,7 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
             } else if (interaction == InteractionType::DropOffResource) {
               SimulateResourceDropOff(unitId, unit, &unitMovementChanged);
             } else if (interaction == InteractionType::Attack) {
-              SimulateMeleeAttack(unitId, unit, targetIt->first, targetBuilding, gameStepServerTime, stepLengthInSeconds, &unitMovementChanged, &stayInPlace);
+              SimulateMeleeAttack(unit, targetIt->first, gameStepServerTime, stepLengthInSeconds, &unitMovementChanged, &stayInPlace);
             }
           }
         } else if (targetObject->isUnit()) {
@@ -951,7 +1133,7 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
             InteractionType interaction = GetInteractionType(unit, targetUnit);
             
             if (interaction == InteractionType::Attack) {
-              SimulateMeleeAttack(unitId, unit, targetIt->first, targetUnit, gameStepServerTime, stepLengthInSeconds, &unitMovementChanged, &stayInPlace);
+              SimulateMeleeAttack(unit, targetIt->first, gameStepServerTime, stepLengthInSeconds, &unitMovementChanged, &stayInPlace);
             }
           }
         }
@@ -969,7 +1151,7 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
       if (squaredDistanceToGoal <= moveDistance * moveDistance || directionDotToGoal <= 0) {
         // The goal was reached.
         if (!map->DoesUnitCollide(unit, unit->GetNextPathTarget())) {
-          unit->SetMapCoord(unit->GetNextPathTarget());
+          map->MoveUnit(unit, unit->GetNextPathTarget());
         }
         
         // Continue with the next part of the path if any, or stop if the path was completed.
@@ -986,7 +1168,7 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
         }
         
         unitMovementChanged = true;
-      } else {
+      } else if (!TryMoveWithSteeringVelocity(unitId, unit, stepLengthInSeconds, &unitMovementChanged)) {
         // Move the unit if the path is free.
         ServerUnit* collidingUnit;
         if (map->DoesUnitCollide(unit, newMapCoord, &collidingUnit)) {
@@ -1002,7 +1184,7 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
                   SquaredDistance(unit->GetNextPathTarget(), unit->GetMapCoord())) {
                 // Use the evade step.
                 // Change our movement direction in order to still face the next path goal.
-                unit->SetMapCoord(evadeMapCoord);
+                map->MoveUnit(unit, evadeMapCoord);
                 
                 QPointF direction = unit->GetNextPathTarget() - unit->GetMapCoord();
                 direction = direction / std::max(1e-4f, Length(direction));
@@ -1018,12 +1200,15 @@ void Game::SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStep
             }
           }
           
-          if (!evaded && unit->GetCurrentAction() != UnitAction::Idle) {
-            unit->PauseMovement();
-            unitMovementChanged = true;
+          if (!evaded) {
+            ++ movementStatistics.blockedMoves;
+            if (unit->GetCurrentAction() != UnitAction::Idle) {
+              unit->PauseMovement();
+              unitMovementChanged = true;
+            }
           }
         } else {
-          unit->SetMapCoord(newMapCoord);
+          map->MoveUnit(unit, newMapCoord);
           
           if (unit->GetCurrentAction() != UnitAction::Moving) {
             unitMovementChanged = true;
@@ -1064,6 +1249,8 @@ void Game::SimulateBuildingConstruction(float stepLengthInSeconds, ServerUnit* v
       // Add the foundation's occupancy to the map.
       // TODO: The foundation's occupancy may differ from the final building's occupancy, e.g., for town centers. Handle this case properly.
       map->AddBuildingOccupancy(targetBuilding);
+      // Only now that the other players know about the foundation, their units may attack it.
+      map->AddBuildingTarget(targetObjectId, targetBuilding);
       
       // Tell all clients that observe the foundation about it (except the client which
       // is constructing it, which already knows it).
@@ -1254,9 +1441,13 @@ void Game::SimulateGameStepForBuilding(u32 buildingId, ServerBuilding* building,
     }
     
     if (canProduce) {
+      if (previousPercentage == 0) {
+        building->SetProductionStartStep(gameStepIndex);
+      }
+      
       float productionTime = GetUnitProductionTime(unitInProduction);
       float timeStepPercentage = 100 * stepLengthInSeconds / productionTime;
-      float newPercentage = building->GetProductionPercentage() + timeStepPercentage;
+      float newPercentage = GetProductionPercentage(gameStepIndex - building->GetProductionStartStep() + 1, timeStepPercentage);
       
       bool completed = false;
       if (newPercentage >= 100) {
@@ -1289,7 +1480,47 @@ void Game::SimulateGameStepForBuilding(u32 buildingId, ServerBuilding* building,
   }
 }
 
-bool Game::SimulateMeleeAttack(u32 /*unitId*/, ServerUnit* unit, u32 targetId, ServerObject* target, double gameStepServerTime, float stepLengthInSeconds, bool* unitMovementChanged, bool* stayInPlace) {
+void Game::ScheduleObject(u32 objectId, ServerObject* object, float stepLengthInSeconds) {
+  if (object->isBuilding()) {
+    // Buildings only act while they produce something. While the production of a unit is in progress,
+    // the building only needs to be simulated again in the game step in which it finishes. Buildings that
+    // wait for population space to start the production stay active, since they set the player's isHoused flag
+    // in each step. Changes to the production queue wake the building up.
+    ServerBuilding* building = AsBuilding(object);
+    UnitType unitInProduction;
+    if (building->IsUnitQueued(&unitInProduction)) {
+      if (building->GetProductionPercentage() == 0) {
+        scheduler.KeepActive(objectId);
+      } else {
+        float timeStepPercentage = 100 * stepLengthInSeconds / GetUnitProductionTime(unitInProduction);
+        u64 finishStep = building->GetProductionStartStep() + GetProductionStepCount(timeStepPercentage) - 1;
+        scheduler.WakeAt(objectId, std::max(finishStep, gameStepIndex + 1));
+      }
+    }
+    return;
+  }
+  
+  // Units that neither attack nor move (or are about to move) do not act,
+  // see SimulateGameStepForUnit(), except for the target scans of idle military units.
+  ServerUnit* unit = AsUnit(object);
+  if (unit->GetCurrentAction() == UnitAction::Attack ||
+      unit->HasMoveToTarget() ||
+      unit->GetMovementDirection() != QPointF(0, 0)) {
+    scheduler.KeepActive(objectId);
+  } else if (!IsVillager(unit->GetType()) &&
+             unit->GetCurrentAction() == UnitAction::Idle &&
+             unit->GetTargetObjectId() == kInvalidObjectId) {
+    if (unit->IsTargetScanRequested()) {
+      scheduler.KeepActive(objectId);
+    } else {
+      // Wake the unit up at its next periodic scan in TryAutoAttack().
+      u64 nextStep = gameStepIndex + 1;
+      scheduler.WakeAt(objectId, nextStep + (kTargetScanInterval - (nextStep + objectId) % kTargetScanInterval) % kTargetScanInterval);
+    }
+  }
+}
+
+bool Game::SimulateMeleeAttack(ServerUnit* unit, u32 targetId, double gameStepServerTime, float stepLengthInSeconds, bool* unitMovementChanged, bool* stayInPlace) {
   if (unit->GetCurrentAction() != UnitAction::Attack) {
     *unitMovementChanged = true;
     unit->SetCurrentAction(UnitAction::Attack);
@@ -1305,39 +1536,8 @@ bool Game::SimulateMeleeAttack(u32 /*unitId*/, ServerUnit* unit, u32 targetId, S
   
   if (timeSinceActionStart >= attackDamageTime &&
       timeSinceActionStart - stepLengthInSeconds < attackDamageTime &&
-      target != nullptr) {
-    // Compute the attack damage.
-    int meleeArmor;
-    if (target->isUnit()) {
-      meleeArmor = GetUnitMeleeArmor(AsUnit(target)->GetType());
-    } else {
-      CHECK(target->isBuilding());
-      meleeArmor = GetBuildingMeleeArmor(AsBuilding(target)->GetType());
-    }
-    int meleeDamage = std::max(0, static_cast<int>(GetUnitMeleeAttack(unit->GetType())) - meleeArmor);
-    
-    // TODO: Pierce damage
-    // TODO: Damage bonuses
-    // TODO: Elevation multiplier 5/4 or 3/4
-    
-    int totalDamage = std::max(1, meleeDamage);
-    
-    // Do the attack damage.
-    float oldHP = target->GetHPInternalFloat();
-    float hp = target->GetHPInternalFloat() - totalDamage;
-    if (hp > 0.5f) {
-      target->SetHP(hp);
-      
-      // Notify all clients that see the target about its HP change
-      // TODO: Would it make sense to batch these together in case there are multiple updates to an object's HP in the same time step?
-      QByteArray msg = CreateHPUpdateMessage(targetId, target->GetHP());
-      for (auto& player : *playersInGame) {
-        accumulatedMessages[player->index] += msg;
-      }
-    } else if (oldHP > 0.5f) {
-      // Remove the target.
-      DeleteObject(targetId, false);
-    }
+      targetId != kInvalidObjectId) {
+    pendingMeleeHits.push_back({unit, targetId});
   }
   
   if (timeSinceActionStart >= fullAttackTime) {
@@ -1349,6 +1549,88 @@ bool Game::SimulateMeleeAttack(u32 /*unitId*/, ServerUnit* unit, u32 targetId, S
   return true;
 }
 
+void Game::TryAutoAttack(ServerUnit* unit, u32 unitId) {
+  if (!unit->IsTargetScanRequested() &&
+      (gameStepIndex + unitId) % kTargetScanInterval != 0) {
+    return;
+  }
+  unit->ClearTargetScanRequest();
+  
+  ScopedStepPhase combatPhase(StepPhase::Combat, &profiler);
+  ServerObject* target;
+  u32 targetId = map->GetTargetIndex().FindTarget(unit->GetPlayerIndex(), unit->GetMapCoord(), GetUnitLineOfSight(unit->GetType()), &target);
+  if (targetId != kInvalidObjectId) {
+    // Since this is an attack, the unit's type does not change, so there is no need to use SetUnitTargets().
+    unit->SetTarget(targetId, target, /*isManualTargeting*/ false);
+  }
+}
+
+void Game::ApplyPendingMeleeHits() {
+  if (pendingMeleeHits.empty()) {
+    return;
+  }
+  
+  // Group the hits by target, such that each target is looked up and updated only once.
+  std::sort(pendingMeleeHits.begin(), pendingMeleeHits.end(), [](const MeleeHit& a, const MeleeHit& b) {
+    return a.targetId < b.targetId;
+  });
+  
+  usize groupStart = 0;
+  while (groupStart < pendingMeleeHits.size()) {
+    u32 targetId = pendingMeleeHits[groupStart].targetId;
+    usize groupEnd = groupStart + 1;
+    while (groupEnd < pendingMeleeHits.size() && pendingMeleeHits[groupEnd].targetId == targetId) {
+      ++ groupEnd;
+    }
+    
+    auto targetIt = map->GetObjects().find(targetId);
+    if (targetIt != map->GetObjects().end() && targetIt->second->GetHPInternalFloat() > 0.5f) {
+      ServerObject* target = targetIt->second;
+      
+      int meleeArmor;
+      if (target->isUnit()) {
+        meleeArmor = GetUnitMeleeArmor(AsUnit(target)->GetType());
+      } else {
+        CHECK(target->isBuilding());
+        meleeArmor = GetBuildingMeleeArmor(AsBuilding(target)->GetType());
+      }
+      
+      // Compute the attack damage.
+      // TODO: Pierce damage
+      // TODO: Damage bonuses
+      // TODO: Elevation multiplier 5/4 or 3/4
+      int totalDamage = 0;
+      for (usize i = groupStart; i < groupEnd; ++ i) {
+        int meleeDamage = static_cast<int>(GetUnitMeleeAttack(pendingMeleeHits[i].attacker->GetType())) - meleeArmor;
+        totalDamage += std::max(1, meleeDamage);
+      }
+      
+      // Do the attack damage.
+      float hp = target->GetHPInternalFloat() - totalDamage;
+      if (hp > 0.5f) {
+        target->SetHP(hp);
+        
+        // Notify all clients that see the target about its HP change
+        QByteArray msg = CreateHPUpdateMessage(targetId, target->GetHP());
+        for (auto& player : *playersInGame) {
+          accumulatedMessages[player->index] += msg;
+        }
+      } else {
+        // Remove the target. The attackers look for a new target right away.
+        target->SetHP(0);
+        DeleteObject(targetId, false);
+        for (usize i = groupStart; i < groupEnd; ++ i) {
+          pendingMeleeHits[i].attacker->RequestTargetScan();
+        }
+      }
+    }
+    
+    groupStart = groupEnd;
+  }
+  
+  pendingMeleeHits.clear();
+}
+
 void Game::ProduceUnit(ServerBuilding* building, UnitType unitInProduction) {
   // Create the unit object.
   u32 newUnitId;
@@ -1426,7 +1708,7 @@ void Game::ProduceUnit(ServerBuilding* building, UnitType unitInProduction) {
   }
   
   if (foundFreeSpace) {
-    newUnit->SetMapCoord(freeSpace);
+    map->MoveUnit(newUnit, freeSpace);
   } else {
     // TODO: Garrison the unit in the building
   }
@@ -1438,6 +1720,7 @@ void Game::ProduceUnit(ServerBuilding* building, UnitType unitInProduction) {
   }
   
   GetPlayerStats(newUnit->GetPlayerIndex())->UnitAdded(unitInProduction);
+  scheduler.Wake(newUnitId);
 }
 
 void Game::SetUnitTargets(const std::vector<u32>& unitIds, int playerIndex, u32 targetId, ServerObject* targetObject, bool isManualTargeting) {
@@ -1454,6 +1737,7 @@ void Game::SetUnitTargets(const std::vector<u32>& unitIds, int playerIndex, u32
     UnitType oldUnitType = unit->GetType();
     
     unit->SetTarget(targetId, targetObject, isManualTargeting);
+    scheduler.Wake(id);
     
     if (oldUnitType != unit->GetType()) {
       GetPlayerStats(playerIndex)->UnitTransformed(oldUnitType, unit->GetType());
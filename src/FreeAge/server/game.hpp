@@ -15,8 +15,12 @@
 #include "FreeAge/common/messages.hpp"
 #include "FreeAge/common/player.hpp"
 #include "FreeAge/common/resources.hpp"
+#include "FreeAge/server/crowd_steering.hpp"
 #include "FreeAge/server/map.hpp"
+#include "FreeAge/server/object_scheduler.hpp"
+#include "FreeAge/server/path_cache.hpp"
 #include "FreeAge/server/settings.hpp"
+#include "FreeAge/server/step_profiler.hpp"
 
 class ServerBuilding;
 class ServerUnit;
@@ -72,12 +76,42 @@ struct PlayerInGame {
   bool wasHousedBefore = false;
 };
 
+/// Counts events of the unit movement, which are written with the profiling statistics.
+struct MovementStatistics {
+  QJsonObject ToJSONObject() const;
+  
+  
+  /// The number of paths that were planned for units (see PlanUnitPath()).
+  u64 pathPlans = 0;
+  
+  /// The number of unit movements that followed a velocity from CrowdSteering
+  /// which differed from the unit's preferred velocity.
+  u64 steeredMoves = 0;
+  
+  /// The number of times that a unit could not move since its way was blocked.
+  u64 blockedMoves = 0;
+};
+
 class Game {
  public:
   Game(ServerSettings* settings);
   
   void RunGameLoop(std::vector<std::shared_ptr<PlayerInGame>>* playersInGame);
   
+  /// Prepares running the game without network connections and without waiting for real
+  /// time to pass, for benchmarking. Uses the given map instead of generating one.
+  /// The sockets of the players must be null. Messages from the players can be appended to
+  /// their PlayerInGame::unparsedBuffer, they are handled in the next SimulateHeadlessStep().
+  void StartHeadlessGame(std::vector<std::shared_ptr<PlayerInGame>>* playersInGame, const std::shared_ptr<ServerMap>& map);
+  
+  /// Handles the players' pending messages and simulates one game step. For headless games only.
+  void SimulateHeadlessStep();
+  
+  inline StepProfiler* GetProfiler() { return &profiler; }
+  inline PathCache* GetPathCache() { return &pathCache; }
+  inline const MovementStatistics& GetMovementStatistics() const { return movementStatistics; }
+  inline ObjectScheduler* GetScheduler() { return &scheduler; }
+  
  private:
   enum class ParseMessagesResult {
     NoAction = 0,
@@ -106,14 +140,30 @@ class Game {
   inline double GetCurrentServerTime() { return SecondsDuration(Clock::now() - settings->serverStartTime).count(); }
   
   void StartGame();
+  void AddInitialObjectsToStats();
   void SimulateGameStep(double gameStepServerTime, float stepLengthInSeconds);
   void SimulateGameStepForUnit(u32 unitId, ServerUnit* unit, double gameStepServerTime, float stepLengthInSeconds);
+  /// Moves the unit with the velocity that crowdSteering computed for it, if this differs from the unit's
+  /// preferred velocity and does not collide. Returns false if the regular movement should be used instead.
+  bool TryMoveWithSteeringVelocity(u32 unitId, ServerUnit* unit, float stepLengthInSeconds, bool* unitMovementChanged);
   void SimulateBuildingConstruction(float stepLengthInSeconds, ServerUnit* villager, u32 targetObjectId, ServerBuilding* targetBuilding, bool* unitMovementChanged, bool* stayInPlace);
   void SimulateResourceGathering(float stepLengthInSeconds, u32 villagerId, ServerUnit* villager, ServerBuilding* targetBuilding, bool* unitMovementChanged, bool* stayInPlace);
   void SimulateResourceDropOff(u32 villagerId, ServerUnit* villager, bool* unitMovementChanged);
   void SimulateGameStepForBuilding(u32 buildingId, ServerBuilding* building, float stepLengthInSeconds);
+  /// After simulating the given object in the current game step, either keeps it active in the
+  /// scheduler, or lets it sleep if simulating it would not do anything until it is woken up.
+  void ScheduleObject(u32 objectId, ServerObject* object, float stepLengthInSeconds);
   /// Returns true if the attack is still in progress, false if it finished.
-  bool SimulateMeleeAttack(u32 unitId, ServerUnit* unit, u32 targetId, ServerObject* target, double gameStepServerTime, float stepLengthInSeconds, bool* unitMovementChanged, bool* stayInPlace);
+  /// The damage is not applied directly, but queued in pendingMeleeHits.
+  bool SimulateMeleeAttack(ServerUnit* unit, u32 targetId, double gameStepServerTime, float stepLengthInSeconds, bool* unitMovementChanged, bool* stayInPlace);
+  
+  /// If it is time for the given idle military unit to scan for enemies (see kTargetScanInterval),
+  /// makes it attack the closest enemy unit within its line of sight.
+  void TryAutoAttack(ServerUnit* unit, u32 unitId);
+  
+  /// Applies the damage of all hits in pendingMeleeHits, sending a single HP update per damaged
+  /// object, and deletes the objects that were killed.
+  void ApplyPendingMeleeHits();
   
   void ProduceUnit(ServerBuilding* building, UnitType unitInProduction);
   
@@ -149,6 +199,31 @@ class Game {
   /// elements could invalidate the iterator.
   std::vector<u32> objectDeleteList;
   
+  /// A melee attack hit which is applied at the end of the unit simulation of a game step.
+  struct MeleeHit {
+    /// The attacking unit. Since objects are deleted only at the end of a game step,
+    /// this remains valid until the hit is applied.
+    ServerUnit* attacker;
+    u32 targetId;
+  };
+  
+  /// The melee hits of the current game step.
+  std::vector<MeleeHit> pendingMeleeHits;
+  
+  /// Cache of the paths that units planned to buildings, see PlanUnitPath().
+  PathCache pathCache;
+  
+  /// Computes the velocities of the moving units at the start of each game step.
+  CrowdSteering crowdSteering;
+  
+  MovementStatistics movementStatistics;
+  
+  /// Determines the objects that are simulated in each game step.
+  ObjectScheduler scheduler;
+  
+  /// The number of game steps that were simulated so far.
+  u64 gameStepIndex = 0;
+  
   /// For each player, stores accumulated messages that will be sent out
   /// upon the next conclusion of a game simulation step. Accumulating
   /// messages helps to reduce the overhead that many individual messages
@@ -158,6 +233,12 @@ class Game {
   /// time in each message.
   std::vector<QByteArray> accumulatedMessages;
   
+  /// Measures the time spent in the phases of the game steps.
+  StepProfiler profiler;
+  
+  /// The server time at which the profiling statistics were last written to settings->metricsPath.
+  double lastMetricsWriteTime = 0;
+  
   bool shouldExit = false;
   
   ServerSettings* settings;  // not owned
@@ -16,6 +16,8 @@
 #include "FreeAge/common/free_age.hpp"
 #include "FreeAge/common/logging.hpp"
 #include "FreeAge/common/messages.hpp"
+#include "FreeAge/common/stats_database.hpp"
+#include "FreeAge/common/timing.hpp"
 #include "FreeAge/server/game.hpp"
 #include "FreeAge/server/match_setup.hpp"
 #include "FreeAge/server/settings.hpp"
@@ -46,10 +48,29 @@ int main(int argc, char** argv) {
   // Parse command line arguments.
   ServerSettings settings;
   settings.serverStartTime = Clock::now();
-  if (argc != 2) {
-    LOG(INFO) << "Usage: FreeAgeServer <host_token>";
+  if (argc < 2 || argc % 2 != 0) {
+    LOG(INFO) << "Usage: FreeAgeServer <host_token> [--metrics <json_path>] [--trace <json_path>] [--stats <yaml_path>]";
     return 1;
   }
+  std::string tracePath;
+  for (int i = 2; i < argc; i += 2) {
+    if (argv[i] == std::string("--metrics")) {
+      settings.metricsPath = QString::fromLocal8Bit(argv[i + 1]);
+    } else if (argv[i] == std::string("--trace")) {
+      tracePath = argv[i + 1];
+    } else if (argv[i] == std::string("--stats")) {
+      if (!LoadStatsDatabase(argv[i + 1])) {
+        return 1;
+      }
+    } else {
+      LOG(ERROR) << "Unknown argument: " << argv[i];
+      return 1;
+    }
+  }
+  if (!tracePath.empty()) {
+    Timing::setThreadName("Server main thread");
+    Timing::setTraceEnabled(true);
+  }
   if (argv[1] == std::string("--no-token")) {
     settings.hostToken = "aaaaaa";
   } else {
@@ -134,6 +155,11 @@ int main(int argc, char** argv) {
     delete player->socket;
   }
   
+  if (!tracePath.empty()) {
+    Timing::setTraceEnabled(false);
+    Timing::writeChromeTrace(tracePath);
+  }
+  
   LOG(INFO) << "Server: Exit";
   return 0;
 }
@@ -4,6 +4,7 @@
 
 #include "FreeAge/server/map.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
@@ -16,22 +17,22 @@
 #include "FreeAge/server/unit.hpp"
 
 ServerMap::ServerMap(int width, int height)
-    : width(width),
-      height(height) {
+    : occupiedForUnits(width, height),
+      occupiedForBuildings(width, height),
+      unitClearance(width * height, kMaxUnitClearance),
+      occupancyRegionsPerRow((width + kOccupancyRegionSize - 1) / kOccupancyRegionSize),
+      occupancyRegionVersions(occupancyRegionsPerRow * ((height + kOccupancyRegionSize - 1) / kOccupancyRegionSize), 0),
+      width(width),
+      height(height),
+      unitGrid(width, height),
+      targetIndex(width, height, &unitGrid) {
   maxElevation = 7;  // TODO: Make configurable
   elevation = new int[(width + 1) * (height + 1)];
   
-  occupiedForUnits = new bool[width * height];
-  occupiedForBuildings = new bool[width * height];
-  
-  // Initialize the elevation to zero everywhere, and the occupancy to free.
+  // Initialize the elevation to zero everywhere. The occupancy grids are initialized to free.
   for (int y = 0; y <= height; ++ y) {
     for (int x = 0; x <= width; ++ x) {
       elevationAt(x, y) = 0;
-      if (x < width && y < height) {
-        occupiedForUnitsAt(x, y) = false;
-        occupiedForBuildingsAt(x, y) = false;
-      }
     }
   }
 }
@@ -41,8 +42,6 @@ ServerMap::~ServerMap() {
     delete item.second;
   }
   delete[] elevation;
-  delete[] occupiedForUnits;
-  delete[] occupiedForBuildings;
 }
 
 
@@ -403,55 +402,63 @@ bool ServerMap::DoesUnitCollide(ServerUnit* unit, const QPointF& mapCoord, Serve
     return true;
   }
   
-  // Test collision with occupied space
-  float squaredRadius = radius * radius;
-  int minTileX = std::max<int>(0, mapCoord.x() - radius);
-  int minTileY = std::max<int>(0, mapCoord.y() - radius);
-  int maxTileX = std::min<int>(width - 1, mapCoord.x() + radius);
-  int maxTileY = std::min<int>(height - 1, mapCoord.y() + radius);
-  for (int tileY = minTileY; tileY <= maxTileY; ++ tileY) {
-    for (int tileX = minTileX; tileX <= maxTileX; ++ tileX) {
-      if (!occupiedForUnitsAt(tileX, tileY)) {
-        continue;
-      }
-      
-      // Compute the point within the tile that is closest to the unit
-      QPointF closestPointInTile(
-          std::max<float>(tileX, std::min<float>(tileX + 1, mapCoord.x())),
-          std::max<float>(tileY, std::min<float>(tileY + 1, mapCoord.y())));
-      
-      QPointF offset = mapCoord - closestPointInTile;
-      float squaredDistance = offset.x() * offset.x() + offset.y() * offset.y();
-      if (squaredDistance < squaredRadius) {
-        if (collidingUnit) {
-          *collidingUnit = nullptr;
+  // Test collision with occupied space.
+  // If the closest occupied tile has a distance of c tiles to the tile that contains
+  // mapCoord, there are at least (c - 1) free tiles between mapCoord and that tile,
+  // so the unit cannot collide with occupied space if its radius is at most (c - 1).
+  // This avoids testing individual tiles in the common case.
+  if (radius > unitClearanceAt(static_cast<int>(mapCoord.x()), static_cast<int>(mapCoord.y())) - 1) {
+    float squaredRadius = radius * radius;
+    int minTileX = std::max<int>(0, mapCoord.x() - radius);
+    int minTileY = std::max<int>(0, mapCoord.y() - radius);
+    int maxTileX = std::min<int>(width - 1, mapCoord.x() + radius);
+    int maxTileY = std::min<int>(height - 1, mapCoord.y() + radius);
+    for (int tileY = minTileY; tileY <= maxTileY; ++ tileY) {
+      for (int tileX = minTileX; tileX <= maxTileX; ++ tileX) {
+        if (!occupiedForUnitsAt(tileX, tileY)) {
+          continue;
+        }
+        
+        // Compute the point within the tile that is closest to the unit
+        QPointF closestPointInTile(
+            std::max<float>(tileX, std::min<float>(tileX + 1, mapCoord.x())),
+            std::max<float>(tileY, std::min<float>(tileY + 1, mapCoord.y())));
+        
+        QPointF offset = mapCoord - closestPointInTile;
+        float squaredDistance = offset.x() * offset.x() + offset.y() * offset.y();
+        if (squaredDistance < squaredRadius) {
+          if (collidingUnit) {
+            *collidingUnit = nullptr;
+          }
+          return true;
         }
-        return true;
       }
     }
   }
   
-  // Test collision with other units
-  // TODO: Use some spatial access structure to reduce the number of tests.
-  //       Probably store a list of units on each map tile.
-  for (const auto& item : objects) {
-    ServerObject* object = item.second;
-    if (object->isUnit() && object != unit) {
-      ServerUnit* otherUnit = AsUnit(object);
-      
-      float otherRadius = GetUnitRadius(otherUnit->GetType());
-      QPointF offset = otherUnit->GetMapCoord() - mapCoord;
-      float squaredDistance = offset.x() * offset.x() + offset.y() * offset.y();
-      if (squaredDistance < (radius + otherRadius) * (radius + otherRadius)) {
-        if (collidingUnit) {
-          *collidingUnit = otherUnit;
-        }
-        return true;
-      }
+  // Test collision with other units. Only the units in the grid cells within the largest
+  // possible collision distance need to be tested.
+  float maxDistance = radius + unitGrid.GetMaxUnitRadius();
+  u32 collidingUnitId = kInvalidObjectId;
+  ServerUnit* closestCollidingUnit = nullptr;
+  unitGrid.ForEachUnitInCells(mapCoord.x() - maxDistance, mapCoord.y() - maxDistance, mapCoord.x() + maxDistance, mapCoord.y() + maxDistance, [&](const UnitGrid::Entry& entry) {
+    if (entry.unit == unit || entry.id >= collidingUnitId) {
+      return;
     }
-  }
+    
+    float otherRadius = GetUnitRadius(entry.unit->GetType());
+    QPointF offset = entry.unit->GetMapCoord() - mapCoord;
+    float squaredDistance = offset.x() * offset.x() + offset.y() * offset.y();
+    if (squaredDistance < (radius + otherRadius) * (radius + otherRadius)) {
+      collidingUnitId = entry.id;
+      closestCollidingUnit = entry.unit;
+    }
+  });
   
-  return false;
+  if (collidingUnit) {
+    *collidingUnit = closestCollidingUnit;
+  }
+  return closestCollidingUnit != nullptr;
 }
 
 ServerBuilding* ServerMap::AddBuilding(int player, BuildingType type, const QPoint& baseTile, float buildPercentage, u32* id, bool addOccupancy) {
@@ -471,6 +478,7 @@ u32 ServerMap::AddBuilding(ServerBuilding* newBuilding, bool addOccupancy) {
   // Mark the occupied tiles as such
   if (addOccupancy) {
     AddBuildingOccupancy(newBuilding);
+    AddBuildingTarget(nextObjectID - 1, newBuilding);
   }
   
   return nextObjectID - 1;
@@ -484,6 +492,10 @@ void ServerMap::RemoveBuildingOccupancy(ServerBuilding* building) {
   SetBuildingOccupancy(building, false);
 }
 
+void ServerMap::AddBuildingTarget(u32 id, ServerBuilding* building) {
+  targetIndex.AddBuilding(id, building);
+}
+
 ServerUnit* ServerMap::AddUnit(int player, UnitType type, const QPointF& position, u32* id) {
   ServerUnit* newUnit = new ServerUnit(player, type, position);
   u32 newId = AddUnit(newUnit);
@@ -495,23 +507,81 @@ ServerUnit* ServerMap::AddUnit(int player, UnitType type, const QPointF& positio
 
 u32 ServerMap::AddUnit(ServerUnit* newUnit) {
   objects.insert(std::make_pair(nextObjectID, newUnit));
+  unitGrid.Add(nextObjectID, newUnit);
   ++ nextObjectID;
   return nextObjectID - 1;
 }
 
+void ServerMap::MoveUnit(ServerUnit* unit, const QPointF& mapCoord) {
+  QPointF oldMapCoord = unit->GetMapCoord();
+  unit->SetMapCoord(mapCoord);
+  unitGrid.Move(unit, oldMapCoord);
+}
+
+void ServerMap::DeleteObject(u32 objectId) {
+  auto it = objects.find(objectId);
+  if (it == objects.end()) {
+    LOG(ERROR) << "Attempting to delete an object that is not on the map: " << objectId;
+    return;
+  }
+  
+  if (it->second->isUnit()) {
+    unitGrid.Remove(AsUnit(it->second));
+  } else if (it->second->isBuilding()) {
+    targetIndex.RemoveBuilding(AsBuilding(it->second));
+  }
+  delete it->second;
+  objects.erase(it);
+}
+
 void ServerMap::SetBuildingOccupancy(ServerBuilding* building, bool occupied) {
   const QPoint& baseTile = building->GetBaseTile();
   QRect occupancyRect = GetBuildingOccupancy(building->GetType());
-  for (int y = baseTile.y() + occupancyRect.y(), endY = baseTile.y() + occupancyRect.y() + occupancyRect.height(); y < endY; ++ y) {
-    for (int x = baseTile.x() + occupancyRect.x(), endX = baseTile.x() + occupancyRect.x() + occupancyRect.width(); x < endX; ++ x) {
-      occupiedForUnitsAt(x, y) = occupied;
-    }
+  if (!occupancyRect.isEmpty()) {
+    int minX = baseTile.x() + occupancyRect.x();
+    int minY = baseTile.y() + occupancyRect.y();
+    int maxX = minX + occupancyRect.width() - 1;
+    int maxY = minY + occupancyRect.height() - 1;
+    occupiedForUnits.SetRect(minX, minY, maxX, maxY, occupied);
+    UpdateUnitClearance(minX, minY, maxX, maxY);
+    IncrementOccupancyRegionVersions(minX, minY, maxX, maxY);
   }
   
   QSize buildingSize = GetBuildingSize(building->GetType());
-  for (int y = baseTile.y(), endY = baseTile.y() + buildingSize.height(); y < endY; ++ y) {
-    for (int x = baseTile.x(), endX = baseTile.x() + buildingSize.width(); x < endX; ++ x) {
-      occupiedForBuildingsAt(x, y) = occupied;
+  occupiedForBuildings.SetRect(
+      baseTile.x(), baseTile.y(),
+      baseTile.x() + buildingSize.width() - 1, baseTile.y() + buildingSize.height() - 1,
+      occupied);
+}
+
+void ServerMap::UpdateUnitClearance(int minX, int minY, int maxX, int maxY) {
+  // Only tiles within kMaxUnitClearance of the changed rectangle may have a different clearance now.
+  int updateMinX = std::max(0, minX - kMaxUnitClearance);
+  int updateMinY = std::max(0, minY - kMaxUnitClearance);
+  int updateMaxX = std::min(width - 1, maxX + kMaxUnitClearance);
+  int updateMaxY = std::min(height - 1, maxY + kMaxUnitClearance);
+  
+  for (int y = updateMinY; y <= updateMaxY; ++ y) {
+    for (int x = updateMinX; x <= updateMaxX; ++ x) {
+      // Find the smallest square around the tile that contains an occupied tile.
+      int clearance = 0;
+      while (clearance < kMaxUnitClearance &&
+             !occupiedForUnits.IsAnyOccupiedInRect(x - clearance, y - clearance, x + clearance, y + clearance)) {
+        ++ clearance;
+      }
+      unitClearance[y * width + x] = clearance;
+    }
+  }
+}
+
+void ServerMap::IncrementOccupancyRegionVersions(int minX, int minY, int maxX, int maxY) {
+  int minRegionX = std::max(0, minX) / kOccupancyRegionSize;
+  int minRegionY = std::max(0, minY) / kOccupancyRegionSize;
+  int maxRegionX = std::min(width - 1, maxX) / kOccupancyRegionSize;
+  int maxRegionY = std::min(height - 1, maxY) / kOccupancyRegionSize;
+  for (int regionY = minRegionY; regionY <= maxRegionY; ++ regionY) {
+    for (int regionX = minRegionX; regionX <= maxRegionX; ++ regionX) {
+      ++ occupancyRegionVersions[regionY * occupancyRegionsPerRow + regionX];
     }
   }
 }
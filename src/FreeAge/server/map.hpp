@@ -5,6 +5,7 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
 
 #include <QByteArray>
 #include <QPoint>
@@ -12,6 +13,9 @@
 #include "FreeAge/common/building_types.hpp"
 #include "FreeAge/common/unit_types.hpp"
 #include "FreeAge/server/object.hpp"
+#include "FreeAge/server/occupancy_grid.hpp"
+#include "FreeAge/server/target_index.hpp"
+#include "FreeAge/server/unit_grid.hpp"
 
 class ServerBuilding;
 class ServerUnit;
@@ -32,24 +36,38 @@ class ServerMap {
   void PlaceElevation(int tileX, int tileY, int elevationValue);
   
   /// Adds a new building to the map and returns it. Optionally returns the new building's ID in id.
-  /// Optionally calls AddBuildingOccupancy() on the building.
+  /// Optionally calls AddBuildingOccupancy() and AddBuildingTarget() on the building.
   ServerBuilding* AddBuilding(int player, BuildingType type, const QPoint& baseTile, float buildPercentage, u32* id = nullptr, bool addOccupancy = true);
   /// Adds the given building to the map and returns the ID that it received.
-  /// Optionally calls AddBuildingOccupancy() on the building.
+  /// Optionally calls AddBuildingOccupancy() and AddBuildingTarget() on the building.
   u32 AddBuilding(ServerBuilding* newBuilding, bool addOccupancy = true);
   
   void AddBuildingOccupancy(ServerBuilding* building);
   void RemoveBuildingOccupancy(ServerBuilding* building);
   
+  /// Adds the building with the given ID to the target index, such that other players' units
+  /// may attack it. Building foundations are placed without occupancy and are only known to their
+  /// owner, so they must be added here once their construction starts.
+  void AddBuildingTarget(u32 id, ServerBuilding* building);
+  
   /// Adds a new unit to the map and returns it. Optionally returns the new unit's ID in id.
   ServerUnit* AddUnit(int player, UnitType type, const QPointF& position, u32* id = nullptr);
   /// Adds the given unit to the map and returns the ID that it received.
   u32 AddUnit(ServerUnit* newUnit);
   
+  /// Moves the given unit (which must have been added to the map) to the given mapCoord.
+  /// This must be used instead of ServerUnit::SetMapCoord() for units on the map, such
+  /// that the unit grid stays up to date.
+  void MoveUnit(ServerUnit* unit, const QPointF& mapCoord);
+  
+  /// Removes the object with the given ID from the map and deletes it.
+  /// This does not remove the occupancy of buildings, see RemoveBuildingOccupancy().
+  void DeleteObject(u32 objectId);
+  
   /// Tests whether the given unit could stand at the given mapCoord without
   /// colliding with other units or occupied space (buildings, etc.).
   /// If the function returns true and the unit would collide with another unit,
-  /// returns that unit in "collidingUnit".
+  /// returns that unit in "collidingUnit" (the one with the lowest ID if there are several).
   bool DoesUnitCollide(ServerUnit* unit, const QPointF& mapCoord, ServerUnit** collidingUnit = nullptr);
   
   /// Returns the elevation at the given tile corner.
@@ -57,21 +75,57 @@ class ServerMap {
   inline const int& elevationAt(int cornerX, int cornerY) const { return elevation[cornerY * (width + 1) + cornerX]; }
   
   /// Returns the occupancy state at the given tile.
-  inline bool& occupiedForUnitsAt(int tileX, int tileY) { return occupiedForUnits[tileY * width + tileX]; }
-  inline const bool& occupiedForUnitsAt(int tileX, int tileY) const { return occupiedForUnits[tileY * width + tileX]; }
-  
-  inline bool& occupiedForBuildingsAt(int tileX, int tileY) { return occupiedForBuildings[tileY * width + tileX]; }
-  inline const bool& occupiedForBuildingsAt(int tileX, int tileY) const { return occupiedForBuildings[tileY * width + tileX]; }
+  /// The occupancy is changed via AddBuildingOccupancy() and RemoveBuildingOccupancy().
+  inline bool occupiedForUnitsAt(int tileX, int tileY) const { return occupiedForUnits.IsOccupied(tileX, tileY); }
+  inline bool occupiedForBuildingsAt(int tileX, int tileY) const { return occupiedForBuildings.IsOccupied(tileX, tileY); }
+  
+  /// Returns the occupancy grids, which allow to test whole rows or rectangles of tiles at once.
+  inline const OccupancyGrid& GetOccupancyForUnits() const { return occupiedForUnits; }
+  inline const OccupancyGrid& GetOccupancyForBuildings() const { return occupiedForBuildings; }
+  
+  /// Returns the distance (in tiles, using the maximum norm) from the given tile to the
+  /// closest tile that is occupied for units, capped at kMaxUnitClearance. For example,
+  /// 0 means that the tile itself is occupied, and 1 means that a neighbor is occupied.
+  inline int unitClearanceAt(int tileX, int tileY) const { return unitClearance[tileY * width + tileX]; }
+  
+  /// Side length of the occupancy regions in tiles.
+  static constexpr int kOccupancyRegionSize = 8;
+  
+  /// Returns the index of the occupancy region that contains the given tile.
+  /// The map is divided into square regions of kOccupancyRegionSize x kOccupancyRegionSize tiles.
+  inline int GetOccupancyRegionIndex(int tileX, int tileY) const {
+    return (tileY / kOccupancyRegionSize) * occupancyRegionsPerRow + (tileX / kOccupancyRegionSize);
+  }
+  
+  /// Returns the version counter of the given occupancy region. It is incremented
+  /// each time the occupancy for units changes within the region, which allows to
+  /// detect whether a result that depends on the region's occupancy (e.g., a cached
+  /// path) is outdated.
+  inline u32 GetOccupancyRegionVersion(int regionIndex) const { return occupancyRegionVersions[regionIndex]; }
   
   inline std::unordered_map<u32, ServerObject*>& GetObjects() { return objects; }
   inline const std::unordered_map<u32, ServerObject*>& GetObjects() const { return objects; }
   
+  /// Returns the grid of the units on the map, which allows to find the units close to a point.
+  inline const UnitGrid& GetUnitGrid() const { return unitGrid; }
+  
+  /// Returns the index of the attackable objects on the map.
+  inline const TargetIndex& GetTargetIndex() const { return targetIndex; }
+  
   inline int GetWidth() const { return width; }
   inline int GetHeight() const { return height; }
   
  private:
   void SetBuildingOccupancy(ServerBuilding* building, bool occupied);
   
+  /// Recomputes unitClearance for all tiles whose value may depend on the
+  /// occupancy of the given tile rectangle (with inclusive bounds).
+  void UpdateUnitClearance(int minX, int minY, int maxX, int maxY);
+  
+  /// Increments the version counters of all occupancy regions that overlap
+  /// the given tile rectangle (with inclusive bounds).
+  void IncrementOccupancyRegionVersions(int minX, int minY, int maxX, int maxY);
+  
   bool SpawnBuildingClump(const QPoint& spawnLoc, int count, BuildingType type);
   
   
@@ -85,19 +139,33 @@ class ServerMap {
   /// An element (x, y) has index: [y * (width + 1) + x].
   int* elevation;
   
-  /// 2D array storing whether each tile is occupied for units (for example,
-  /// by a building). The array size is width * height.
-  /// An element (x, y) has index: [y * width + x].
+  /// Grid storing whether each tile is occupied for units (for example,
+  /// by a building).
   /// The difference to occupiedForBuildings is the town center: All of its space
   /// is occupied for buildings, but only the top quarter is occupied for units.
-  bool* occupiedForUnits;
+  OccupancyGrid occupiedForUnits;
   
-  /// 2D array storing whether each tile is occupied for buildings (for example,
-  /// by a building). The array size is width * height.
-  /// An element (x, y) has index: [y * width + x].
+  /// Grid storing whether each tile is occupied for buildings (for example,
+  /// by a building).
   /// The difference to occupiedForUnits is the town center: All of its space
   /// is occupied for buildings, but only the top quarter is occupied for units.
-  bool* occupiedForBuildings;
+  OccupancyGrid occupiedForBuildings;
+  
+  /// The maximum value stored in unitClearance. Larger values would make the clearance
+  /// test in DoesUnitCollide() succeed for larger units, but make updates more expensive.
+  static constexpr int kMaxUnitClearance = 4;
+  
+  /// 2D array storing the value of unitClearanceAt() for each tile. It is updated
+  /// incrementally whenever the occupancy for units changes.
+  /// An element (x, y) has index: [y * width + x].
+  std::vector<u8> unitClearance;
+  
+  /// Number of occupancy regions per row of regions, i.e., width / kOccupancyRegionSize rounded up.
+  int occupancyRegionsPerRow;
+  
+  /// Version counter for each occupancy region, see GetOccupancyRegionVersion().
+  /// An element for region (x, y) has index: [y * occupancyRegionsPerRow + x].
+  std::vector<u32> occupancyRegionVersions;
   
   /// Width of the map in tiles.
   int width;
@@ -110,4 +178,11 @@ class ServerMap {
   
   /// Map of object ID -> ServerObject*. The pointer is owned by the map.
   std::unordered_map<u32, ServerObject*> objects;
+  
+  /// Grid of the units in objects. It is updated by AddUnit(), MoveUnit(), and DeleteObject().
+  UnitGrid unitGrid;
+  
+  /// Index of the attackable objects. Its units are looked up in unitGrid, while its
+  /// buildings are updated by AddBuilding(), AddBuildingTarget(), and DeleteObject().
+  TargetIndex targetIndex;
 };
@@ -0,0 +1,63 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/server/object_scheduler.hpp"
+
+#include <algorithm>
+#include <functional>
+
+void ObjectScheduler::WakeAll(const std::unordered_map<u32, ServerObject*>& objects) {
+  wokenObjects.reserve(wokenObjects.size() + objects.size());
+  for (const auto& item : objects) {
+    wokenObjects.push_back(item.first);
+  }
+}
+
+void ObjectScheduler::WakeAt(u32 objectId, u64 stepIndex) {
+  scheduledWakeUps.emplace_back(stepIndex, objectId);
+  std::push_heap(scheduledWakeUps.begin(), scheduledWakeUps.end(), std::greater<std::pair<u64, u32>>());
+}
+
+const std::vector<u32>& ObjectScheduler::BeginStep(u64 stepIndex) {
+  while (!scheduledWakeUps.empty() && scheduledWakeUps.front().first <= stepIndex) {
+    wokenObjects.push_back(scheduledWakeUps.front().second);
+    std::pop_heap(scheduledWakeUps.begin(), scheduledWakeUps.end(), std::greater<std::pair<u64, u32>>());
+    scheduledWakeUps.pop_back();
+  }
+  
+  // The objects that were kept active are already sorted, so only the woken objects need
+  // to be sorted before merging both lists. An object may be in both lists, or several times
+  // in the woken list, so duplicates are removed afterwards.
+  std::sort(wokenObjects.begin(), wokenObjects.end());
+  activeObjects.resize(nextActiveObjects.size() + wokenObjects.size());
+  std::merge(nextActiveObjects.begin(), nextActiveObjects.end(), wokenObjects.begin(), wokenObjects.end(), activeObjects.begin());
+  activeObjects.erase(std::unique(activeObjects.begin(), activeObjects.end()), activeObjects.end());
+  
+  nextActiveObjects.clear();
+  wokenObjects.clear();
+  
+  ++ stepCount;
+  simulatedObjectCount += activeObjects.size();
+  return activeObjects;
+}
+
+void ObjectScheduler::Clear() {
+  activeObjects.clear();
+  nextActiveObjects.clear();
+  wokenObjects.clear();
+  scheduledWakeUps.clear();
+}
+
+void ObjectScheduler::ResetStatistics() {
+  stepCount = 0;
+  simulatedObjectCount = 0;
+}
+
+QJsonObject ObjectScheduler::ToJSONObject() const {
+  QJsonObject object;
+  object["steps"] = static_cast<double>(stepCount);
+  object["simulatedObjectsPerStep"] = (stepCount > 0) ? (simulatedObjectCount / static_cast<double>(stepCount)) : 0.;
+  object["scheduledWakeUps"] = static_cast<double>(scheduledWakeUps.size());
+  return object;
+}
@@ -0,0 +1,79 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <QJsonObject>
+
+#include "FreeAge/common/free_age.hpp"
+
+class ServerObject;
+
+/// Decides which objects are simulated in each game step, such that objects which would
+/// not do anything (idle units, buildings that do not produce anything, and the many trees,
+/// mines, and bushes of the gaia player) do not need to be visited.
+///
+/// Objects are either active or sleeping. Active objects are simulated in each game step.
+/// After simulating an object, the game either keeps it active (KeepActive()), or lets it
+/// sleep. Sleeping objects are only simulated again once they are woken up, either by an
+/// event that changes them (Wake(), e.g., for a command given to a unit), or at a game step
+/// that was scheduled when they went to sleep (WakeAt(), e.g., for buildings that finish producing
+/// a unit, or for idle military units that periodically scan for enemies). Waking up objects that do not need it is harmless, it only
+/// costs the time to simulate them.
+///
+/// The objects of each game step are simulated in the order of their IDs, such that the
+/// result does not depend on which objects are sleeping.
+class ObjectScheduler {
+ public:
+  /// Makes all given objects active, e.g., at the start of a game.
+  void WakeAll(const std::unordered_map<u32, ServerObject*>& objects);
+  
+  /// Makes the object with the given ID active. If this is called before BeginStep(),
+  /// the object is simulated in the upcoming game step, otherwise in the one after it.
+  inline void Wake(u32 objectId) { wokenObjects.push_back(objectId); }
+  
+  /// Schedules the object with the given ID to be woken up at the game step with the given index.
+  void WakeAt(u32 objectId, u64 stepIndex);
+  
+  /// Keeps the object with the given ID active for the next game step. This must be called
+  /// for each object returned by BeginStep() that should not go to sleep.
+  inline void KeepActive(u32 objectId) { nextActiveObjects.push_back(objectId); }
+  
+  /// Returns the IDs of the objects to simulate in the game step with the given index,
+  /// sorted in increasing order. These are the objects that were kept active in the last
+  /// step, and those which were woken up since then or are scheduled to be woken up at this
+  /// step. The returned IDs may include objects that were deleted in the meantime.
+  const std::vector<u32>& BeginStep(u64 stepIndex);
+  
+  /// Removes all objects and scheduled wake-ups.
+  void Clear();
+  
+  /// Resets the counts of steps and simulated objects.
+  void ResetStatistics();
+  
+  /// Returns the number of steps, the mean number of simulated objects per step,
+  /// and the number of scheduled wake-ups as a JSON object.
+  QJsonObject ToJSONObject() const;
+  
+ private:
+  /// IDs of the objects to simulate in the current step.
+  std::vector<u32> activeObjects;
+  
+  /// IDs of the objects that were kept active for the next step (in increasing order,
+  /// since the objects are simulated in this order).
+  std::vector<u32> nextActiveObjects;
+  
+  /// IDs of the objects that were woken up since the last call to BeginStep().
+  std::vector<u32> wokenObjects;
+  
+  /// Min-heap of the scheduled wake-ups as (step index, object ID).
+  std::vector<std::pair<u64, u32>> scheduledWakeUps;
+  
+  u64 stepCount = 0;
+  u64 simulatedObjectCount = 0;
+};
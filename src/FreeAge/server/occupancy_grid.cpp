@@ -0,0 +1,74 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/server/occupancy_grid.hpp"
+
+#include <algorithm>
+
+OccupancyGrid::OccupancyGrid(int width, int height)
+    : width(width),
+      height(height),
+      wordsPerRow((width + 63) / 64),
+      words(static_cast<usize>(wordsPerRow) * height, 0) {}
+
+void OccupancyGrid::SetRect(int minX, int minY, int maxX, int maxY, bool occupied) {
+  minX = std::max(0, minX);
+  minY = std::max(0, minY);
+  maxX = std::min(width - 1, maxX);
+  maxY = std::min(height - 1, maxY);
+  if (minX > maxX) {
+    return;
+  }
+  
+  int firstWord = minX >> 6;
+  int lastWord = maxX >> 6;
+  for (int y = minY; y <= maxY; ++ y) {
+    u64* row = &words[y * wordsPerRow];
+    for (int wordIndex = firstWord; wordIndex <= lastWord; ++ wordIndex) {
+      u64 mask = BitRangeMask(
+          (wordIndex == firstWord) ? (minX & 63) : 0,
+          (wordIndex == lastWord) ? (maxX & 63) : 63);
+      row[wordIndex] = occupied ? (row[wordIndex] | mask) : (row[wordIndex] & ~mask);
+    }
+  }
+}
+
+bool OccupancyGrid::IsAnyOccupiedInRowSpan(int y, int minX, int maxX) const {
+  if (y < 0 || y >= height) {
+    return false;
+  }
+  minX = std::max(0, minX);
+  maxX = std::min(width - 1, maxX);
+  if (minX > maxX) {
+    return false;
+  }
+  
+  const u64* row = &words[y * wordsPerRow];
+  int firstWord = minX >> 6;
+  int lastWord = maxX >> 6;
+  if (firstWord == lastWord) {
+    return row[firstWord] & BitRangeMask(minX & 63, maxX & 63);
+  }
+  
+  if (row[firstWord] & BitRangeMask(minX & 63, 63)) {
+    return true;
+  }
+  for (int wordIndex = firstWord + 1; wordIndex < lastWord; ++ wordIndex) {
+    if (row[wordIndex]) {
+      return true;
+    }
+  }
+  return row[lastWord] & BitRangeMask(0, maxX & 63);
+}
+
+bool OccupancyGrid::IsAnyOccupiedInRect(int minX, int minY, int maxX, int maxY) const {
+  minY = std::max(0, minY);
+  maxY = std::min(height - 1, maxY);
+  for (int y = minY; y <= maxY; ++ y) {
+    if (IsAnyOccupiedInRowSpan(y, minX, maxX)) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,67 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <vector>
+
+#include "FreeAge/common/free_age.hpp"
+
+/// 2D grid of occupancy flags that stores one bit per tile.
+///
+/// Each row is stored in whole 64-bit words, such that spans of tiles within a row
+/// can be tested (and set) with a few masked word operations instead of one access
+/// per tile. Compared to storing a bool per tile, this also reduces the memory
+/// requirements by a factor of 8.
+class OccupancyGrid {
+ public:
+  OccupancyGrid(int width, int height);
+  
+  /// Returns whether the given tile is occupied. The tile must be within the grid.
+  inline bool IsOccupied(int x, int y) const {
+    return (words[y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+  }
+  
+  /// Sets the occupancy of the given tile. The tile must be within the grid.
+  inline void SetOccupied(int x, int y, bool occupied) {
+    u64& word = words[y * wordsPerRow + (x >> 6)];
+    u64 bit = static_cast<u64>(1) << (x & 63);
+    word = occupied ? (word | bit) : (word & ~bit);
+  }
+  
+  /// Sets the occupancy of all tiles within the given rectangle (with inclusive bounds).
+  /// The rectangle is clipped to the grid.
+  void SetRect(int minX, int minY, int maxX, int maxY, bool occupied);
+  
+  /// Returns whether any tile in row y within [minX, maxX] is occupied.
+  /// The span is clipped to the grid; returns false for empty spans.
+  bool IsAnyOccupiedInRowSpan(int y, int minX, int maxX) const;
+  
+  /// Returns whether any tile within the given rectangle (with inclusive bounds) is occupied.
+  /// The rectangle is clipped to the grid; returns false for empty rectangles.
+  bool IsAnyOccupiedInRect(int minX, int minY, int maxX, int maxY) const;
+  
+  inline int GetWidth() const { return width; }
+  inline int GetHeight() const { return height; }
+  
+ private:
+  /// Returns the mask for the bits [firstBit, lastBit] (both within [0, 63]) of a word.
+  static inline u64 BitRangeMask(int firstBit, int lastBit) {
+    u64 upToLast = (lastBit == 63) ? ~static_cast<u64>(0) : ((static_cast<u64>(1) << (lastBit + 1)) - 1);
+    return upToLast & (~static_cast<u64>(0) << firstBit);
+  }
+  
+  
+  /// Width of the grid in tiles.
+  int width;
+  
+  /// Height of the grid in tiles.
+  int height;
+  
+  /// Number of 64-bit words per row, i.e., width / 64 rounded up.
+  int wordsPerRow;
+  
+  /// The occupancy bits. Tile (x, y) is stored in bit (x % 64) of word [y * wordsPerRow + x / 64].
+  std::vector<u64> words;
+};
@@ -0,0 +1,207 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/server/path_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FreeAge/server/map.hpp"
+#include "FreeAge/server/pathfinding.hpp"
+
+/// Packs two IDs (of which the first must fit into 24 bits) and a radius class into a key.
+static inline u64 MakeKey(int first, u32 second, int radiusClass) {
+  return (static_cast<u64>(first) << 40) | (static_cast<u64>(second) << 8) | static_cast<u64>(radiusClass);
+}
+
+static inline int ClampedTileX(float x, ServerMap* map) {
+  return std::max(0, std::min(map->GetWidth() - 1, static_cast<int>(x)));
+}
+
+static inline int ClampedTileY(float y, ServerMap* map) {
+  return std::max(0, std::min(map->GetHeight() - 1, static_cast<int>(y)));
+}
+
+static inline int GetRegionOfPoint(const QPointF& point, ServerMap* map) {
+  return map->GetOccupancyRegionIndex(ClampedTileX(point.x(), map), ClampedTileY(point.y(), map));
+}
+
+float PathCache::GetPlanningRadius(float unitRadius) {
+  return GetRadiusClass(unitRadius) * kRadiusClassSize;
+}
+
+int PathCache::GetRadiusClass(float unitRadius) {
+  // The small offset prevents radii that are (up to floating-point error) at a class boundary
+  // from being rounded up to the next class.
+  return std::max(1, std::min(255, static_cast<int>(std::ceil(unitRadius / kRadiusClassSize - 1e-3f))));
+}
+
+bool PathCache::Lookup(float unitRadius, const QPointF& startMapCoord, u32 goalObjectId, const QRect& goalRect, const QPointF& goalMapCoord, ServerMap* map, std::vector<QPointF>* reversePath) {
+  int radiusClass = GetRadiusClass(unitRadius);
+  int startRegion = GetRegionOfPoint(startMapCoord, map);
+  
+  // Look for a path to the goal that started in the same region. Since the path's start
+  // point generally differs from startMapCoord, try to connect to one of its first points.
+  auto it = entries.find(MakeKey(startRegion, goalObjectId, radiusClass));
+  if (it != entries.end()) {
+    if (IsValid(it->second, map)) {
+      const std::vector<QPointF>& path = it->second.path;
+      for (int i = std::min<int>(2, path.size() - 1); i >= 1; -- i) {
+        if (HasLineOfSight(unitRadius, startMapCoord, path[i], goalRect, map)) {
+          reversePath->assign(path.rbegin(), path.rend() - i);
+          ++ hitCount;
+          return true;
+        }
+      }
+    } else {
+      entries.erase(it);
+    }
+  }
+  
+  // Look for a path that started close to the goal and ended in the start region,
+  // and use it in reverse.
+  int minRegionX = ClampedTileX(goalRect.left() - kMaxReverseGoalDistance, map) / ServerMap::kOccupancyRegionSize;
+  int minRegionY = ClampedTileY(goalRect.top() - kMaxReverseGoalDistance, map) / ServerMap::kOccupancyRegionSize;
+  int maxRegionX = ClampedTileX(goalRect.right() + kMaxReverseGoalDistance, map) / ServerMap::kOccupancyRegionSize;
+  int maxRegionY = ClampedTileY(goalRect.bottom() + kMaxReverseGoalDistance, map) / ServerMap::kOccupancyRegionSize;
+  for (int regionY = minRegionY; regionY <= maxRegionY; ++ regionY) {
+    for (int regionX = minRegionX; regionX <= maxRegionX; ++ regionX) {
+      int candidateRegion = map->GetOccupancyRegionIndex(regionX * ServerMap::kOccupancyRegionSize, regionY * ServerMap::kOccupancyRegionSize);
+      auto reverseIt = reverseIndex.find(MakeKey(startRegion, candidateRegion, radiusClass));
+      if (reverseIt == reverseIndex.end()) {
+        continue;
+      }
+      auto candidateIt = entries.find(reverseIt->second);
+      if (candidateIt == entries.end() || !IsValid(candidateIt->second, map)) {
+        continue;
+      }
+      const std::vector<QPointF>& path = candidateIt->second.path;
+      
+      // The path's start becomes the last point before the goal, so it must be close
+      // to the goal and the goal must be reachable from it.
+      int pathStartX = static_cast<int>(path.front().x());
+      int pathStartY = static_cast<int>(path.front().y());
+      int goalDistance = std::max(
+          std::max(goalRect.left() - pathStartX, pathStartX - goalRect.right()),
+          std::max(goalRect.top() - pathStartY, pathStartY - goalRect.bottom()));
+      if (goalDistance > kMaxReverseGoalDistance ||
+          !HasLineOfSight(unitRadius, path.front(), goalMapCoord, goalRect, map)) {
+        continue;
+      }
+      
+      // The path's end point is within the building that the path led to,
+      // so try to connect to one of the points before it.
+      int pathSize = path.size();
+      for (int i = std::max(0, pathSize - 3); i <= pathSize - 2; ++ i) {
+        if (HasLineOfSight(unitRadius, startMapCoord, path[i], goalRect, map)) {
+          reversePath->resize(1);
+          reversePath->front() = goalMapCoord;
+          reversePath->insert(reversePath->end(), path.begin(), path.begin() + i + 1);
+          
+          // Insert the reversed path as a regular entry, such that the next unit that
+          // follows it does not need to search for it again.
+          std::vector<QPointF> forwardPath(reversePath->size() + 1);
+          forwardPath.front() = startMapCoord;
+          std::copy(reversePath->rbegin(), reversePath->rend(), forwardPath.begin() + 1);
+          InsertForwardPath(unitRadius, goalObjectId, std::move(forwardPath), map);
+          
+          ++ hitCount;
+          return true;
+        }
+      }
+    }
+  }
+  
+  ++ missCount;
+  return false;
+}
+
+void PathCache::Insert(float unitRadius, const QPointF& startMapCoord, u32 goalObjectId, const QRect& goalRect, const std::vector<QPointF>& reversePath, ServerMap* map) {
+  if (reversePath.empty() ||
+      !goalRect.contains(static_cast<int>(reversePath.front().x()), static_cast<int>(reversePath.front().y()), false)) {
+    return;
+  }
+  
+  std::vector<QPointF> forwardPath(reversePath.size() + 1);
+  forwardPath.front() = startMapCoord;
+  std::copy(reversePath.rbegin(), reversePath.rend(), forwardPath.begin() + 1);
+  InsertForwardPath(unitRadius, goalObjectId, std::move(forwardPath), map);
+}
+
+void PathCache::InsertForwardPath(float unitRadius, u32 goalObjectId, std::vector<QPointF>&& path, ServerMap* map) {
+  if (entries.size() >= kMaxEntries) {
+    for (auto it = entries.begin(); it != entries.end(); ) {
+      it = IsValid(it->second, map) ? std::next(it) : entries.erase(it);
+    }
+    if (entries.size() >= kMaxEntries) {
+      entries.clear();
+    }
+    for (auto it = reverseIndex.begin(); it != reverseIndex.end(); ) {
+      it = (entries.count(it->second) > 0) ? std::next(it) : reverseIndex.erase(it);
+    }
+  }
+  
+  int radiusClass = GetRadiusClass(unitRadius);
+  int startRegion = GetRegionOfPoint(path.front(), map);
+  int endRegion = GetRegionOfPoint(path.back(), map);
+  u64 key = MakeKey(startRegion, goalObjectId, radiusClass);
+  
+  Entry& entry = entries[key];
+  
+  // Determine the regions in which a change of the occupancy may affect the path.
+  // Line-of-sight tests consider the tiles next to the ones that a path segment passes
+  // through, enlarged by the unit radius, so the segments' bounding boxes are enlarged
+  // accordingly.
+  int margin = static_cast<int>(std::ceil(unitRadius)) + 1;
+  std::vector<int> regions;
+  for (usize i = 1; i < path.size(); ++ i) {
+    int minX = ClampedTileX(std::min(path[i - 1].x(), path[i].x()) - margin, map) / ServerMap::kOccupancyRegionSize;
+    int minY = ClampedTileY(std::min(path[i - 1].y(), path[i].y()) - margin, map) / ServerMap::kOccupancyRegionSize;
+    int maxX = ClampedTileX(std::max(path[i - 1].x(), path[i].x()) + margin, map) / ServerMap::kOccupancyRegionSize;
+    int maxY = ClampedTileY(std::max(path[i - 1].y(), path[i].y()) + margin, map) / ServerMap::kOccupancyRegionSize;
+    for (int regionY = minY; regionY <= maxY; ++ regionY) {
+      for (int regionX = minX; regionX <= maxX; ++ regionX) {
+        regions.push_back(map->GetOccupancyRegionIndex(regionX * ServerMap::kOccupancyRegionSize, regionY * ServerMap::kOccupancyRegionSize));
+      }
+    }
+  }
+  std::sort(regions.begin(), regions.end());
+  regions.erase(std::unique(regions.begin(), regions.end()), regions.end());
+  
+  entry.regionVersions.resize(regions.size());
+  for (usize i = 0; i < regions.size(); ++ i) {
+    entry.regionVersions[i] = std::make_pair(regions[i], map->GetOccupancyRegionVersion(regions[i]));
+  }
+  entry.path = std::move(path);
+  
+  reverseIndex[MakeKey(endRegion, startRegion, radiusClass)] = key;
+}
+
+bool PathCache::IsValid(const Entry& entry, ServerMap* map) const {
+  for (const auto& regionVersion : entry.regionVersions) {
+    if (map->GetOccupancyRegionVersion(regionVersion.first) != regionVersion.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PathCache::Clear() {
+  entries.clear();
+  reverseIndex.clear();
+}
+
+void PathCache::ResetStatistics() {
+  hitCount = 0;
+  missCount = 0;
+}
+
+QJsonObject PathCache::ToJSONObject() const {
+  QJsonObject object;
+  object["hits"] = static_cast<double>(hitCount);
+  object["misses"] = static_cast<double>(missCount);
+  object["hitRate"] = (hitCount + missCount > 0) ? (hitCount / static_cast<double>(hitCount + missCount)) : 0.;
+  object["entries"] = static_cast<double>(entries.size());
+  return object;
+}
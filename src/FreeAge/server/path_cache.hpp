@@ -0,0 +1,101 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <QJsonObject>
+#include <QPointF>
+#include <QRect>
+
+#include "FreeAge/common/free_age.hpp"
+
+class ServerMap;
+
+/// Caches planned unit paths to buildings, such that units that repeatedly walk the
+/// same route (e.g., villagers that go back and forth between a resource and a drop-off
+/// point) do not need to plan it again each time.
+///
+/// Entries are keyed by the occupancy region that the path starts in (see
+/// ServerMap::GetOccupancyRegionIndex()), the goal object, and the unit's radius class.
+/// Each entry remembers the versions of the occupancy regions that its path passes
+/// through, and is only used as long as none of these regions has changed. In addition,
+/// paths are used in reverse for the way back: a path from a resource to a drop-off
+/// point is also found when planning from that drop-off point back to the resource.
+///
+/// In order for paths to be shared by units with slightly different radii, paths for
+/// which the cache is used must be planned with GetPlanningRadius().
+class PathCache {
+ public:
+  /// Returns the radius that is used to plan (cached) paths for units with the given radius.
+  /// This rounds the radius up to the upper bound of its radius class.
+  static float GetPlanningRadius(float unitRadius);
+  
+  /// Looks up a path for a unit with the given (planning) radius that stands at startMapCoord
+  /// to the given goal building, which occupies goalRect. goalMapCoord is the unit's move-to
+  /// target. On a hit, returns true and the path in reverse order in reversePath (as returned
+  /// by FindPath()). Otherwise, returns false.
+  bool Lookup(float unitRadius, const QPointF& startMapCoord, u32 goalObjectId, const QRect& goalRect, const QPointF& goalMapCoord, ServerMap* map, std::vector<QPointF>* reversePath);
+  
+  /// Inserts a path that was planned by FindPath() with the arguments given to Lookup().
+  /// Paths that do not reach goalRect are not inserted.
+  void Insert(float unitRadius, const QPointF& startMapCoord, u32 goalObjectId, const QRect& goalRect, const std::vector<QPointF>& reversePath, ServerMap* map);
+  
+  /// Removes all entries.
+  void Clear();
+  
+  /// Resets the hit and miss counters.
+  void ResetStatistics();
+  
+  /// Returns the hit and miss counters and the number of entries as a JSON object.
+  QJsonObject ToJSONObject() const;
+  
+  inline u64 GetHitCount() const { return hitCount; }
+  inline u64 GetMissCount() const { return missCount; }
+  inline usize GetEntryCount() const { return entries.size(); }
+  
+ private:
+  struct Entry {
+    /// The path's points in forward order, starting with the point at which the
+    /// unit that it was planned for stood.
+    std::vector<QPointF> path;
+    
+    /// The occupancy regions that the path depends on, together with their versions
+    /// at the time the path was planned.
+    std::vector<std::pair<int, u32>> regionVersions;
+  };
+  
+  /// Side length of the radius classes, see GetPlanningRadius().
+  static constexpr float kRadiusClassSize = 0.1f;
+  
+  /// Maximum distance (in tiles) from a path's start to the goal rect for the path
+  /// to be used in reverse.
+  static constexpr int kMaxReverseGoalDistance = 3;
+  
+  /// Maximum number of entries. If more entries would be added, outdated entries are
+  /// removed, and if this is not sufficient, all entries are removed.
+  static constexpr usize kMaxEntries = 4096;
+  
+  static int GetRadiusClass(float unitRadius);
+  
+  /// Inserts the given path (in forward order) for the given goal.
+  void InsertForwardPath(float unitRadius, u32 goalObjectId, std::vector<QPointF>&& path, ServerMap* map);
+  
+  /// Returns whether none of the regions that the entry depends on has changed.
+  bool IsValid(const Entry& entry, ServerMap* map) const;
+  
+  
+  /// Map of key (start region, goal object ID, radius class) -> cached path.
+  std::unordered_map<u64, Entry> entries;
+  
+  /// Map of key (end region, start region, radius class) -> key in entries.
+  /// This is used to find paths that can be used in reverse.
+  std::unordered_map<u64, u64> reverseIndex;
+  
+  u64 hitCount = 0;
+  u64 missCount = 0;
+};
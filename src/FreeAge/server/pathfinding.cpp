@@ -4,7 +4,10 @@
 
 #include "FreeAge/server/pathfinding.hpp"
 
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <queue>
 
 #include <QImage>
@@ -15,12 +18,19 @@
 #include "FreeAge/common/util.hpp"
 #include "FreeAge/server/building.hpp"
 #include "FreeAge/server/map.hpp"
+#include "FreeAge/server/path_cache.hpp"
 #include "FreeAge/server/unit.hpp"
 
+constexpr bool kOutputPathfindingDebugMessages = false;
+
 /// Tests whether the unit could walk from p0 to p1 (or vice versa) without colliding
 /// with a building. Notice that this function does not check whether the start and
 /// end points themselves are (fully) free, it only checks the space between them.
-static bool IsPathFree(float unitRadius, const QPointF& p0, const QPointF& p1, const QRect& openRect, ServerMap* map) {
+///
+/// rowRanges is used as scratch memory to avoid allocations. It must have one element
+/// per map row, which must all be (std::numeric_limits<int>::max(), 0) on input,
+/// and this is also the case again after the function returns.
+static bool IsPathFree(float unitRadius, const QPointF& p0, const QPointF& p1, const QRect& openRect, ServerMap* map, std::vector<std::pair<int, int>>* rowRanges) {
   // Obtain the points to the right and left of p0 and p1.
   constexpr float kErrorEpsilon = 1e-3f;
   
@@ -38,7 +48,6 @@ static bool IsPathFree(float unitRadius, const QPointF& p0, const QPointF& p1, c
   // Rasterize the polygon defined by all the points into the map grid.
   int minRow = std::numeric_limits<int>::max();
   int maxRow = 0;
-  std::vector<std::pair<int, int>> rowRanges(map->GetHeight(), std::make_pair(std::numeric_limits<int>::max(), 0));
   
   auto rasterize = [&](int x, int y) {
     // For safety, clamp the coordinate to the map area.
@@ -48,7 +57,7 @@ static bool IsPathFree(float unitRadius, const QPointF& p0, const QPointF& p1, c
     minRow = std::min(minRow, y);
     maxRow = std::max(maxRow, y);
     
-    auto& rowRange = rowRanges[y];
+    auto& rowRange = (*rowRanges)[y];
     rowRange.first = std::min(rowRange.first, x);
     rowRange.second = std::max(rowRange.second, x);
   };
@@ -134,7 +143,7 @@ static bool IsPathFree(float unitRadius, const QPointF& p0, const QPointF& p1, c
     debugImage.fill(qRgb(255, 255, 255));
     
     for (int row = minRow; row <= maxRow; ++ row) {
-      auto& rowRange = rowRanges[row];
+      auto& rowRange = (*rowRanges)[row];
       for (int col = rowRange.first; col <= rowRange.second; ++ col) {
         if (map->occupiedForUnitsAt(col, row) && !openRect.contains(col, row, false)) {
           debugImage.setPixelColor(col, row, qRgb(255, 0, 0));
@@ -151,23 +160,31 @@ static bool IsPathFree(float unitRadius, const QPointF& p0, const QPointF& p1, c
     std::cin >> dummy;
   }
   
+  // Test each row span with the word-wise query of the occupancy grid. If the row
+  // intersects the open rect, the parts of the span to the left and right of it are tested.
+  // The row ranges are reset while testing them, such that they can be reused for the next call.
+  const OccupancyGrid& occupancy = map->GetOccupancyForUnits();
+  bool isFree = true;
   for (int row = minRow; row <= maxRow; ++ row) {
-    auto& rowRange = rowRanges[row];
-    for (int col = rowRange.first; col <= rowRange.second; ++ col) {
-      if (map->occupiedForUnitsAt(col, row) && !openRect.contains(col, row, false)) {
-        return false;
+    auto& rowRange = (*rowRanges)[row];
+    if (isFree) {
+      if (row >= openRect.top() && row <= openRect.bottom()) {
+        isFree =
+            !occupancy.IsAnyOccupiedInRowSpan(row, rowRange.first, std::min(rowRange.second, openRect.left() - 1)) &&
+            !occupancy.IsAnyOccupiedInRowSpan(row, std::max(rowRange.first, openRect.right() + 1), rowRange.second);
+      } else {
+        isFree = !occupancy.IsAnyOccupiedInRowSpan(row, rowRange.first, rowRange.second);
       }
     }
+    rowRange = std::make_pair(std::numeric_limits<int>::max(), 0);
   }
   
-  return true;
+  return isFree;
 }
 
-void PlanUnitPath(ServerUnit* unit, ServerMap* map) {
-  constexpr bool kOutputPathfindingDebugMessages = false;
-  
-  Timer pathPlanningTimer;
-  
+/// Plans a path with A* on the grid of tiles (allowing diagonal movements), and then
+/// smoothes the path by dropping corners where possible.
+static bool FindGridPath(float unitRadius, const QPointF& startMapCoord, const QRect& goalRect, const QPointF& goalMapCoord, ServerMap* map, std::vector<QPointF>* path, PathSearchStats* stats) {
   typedef float CostT;
   
   int mapWidth = map->GetWidth();
@@ -175,33 +192,8 @@ void PlanUnitPath(ServerUnit* unit, ServerMap* map) {
   
   // Determine the tile that the unit stands on. This will be the start tile.
   QPoint start(
-      std::max(0, std::min(mapWidth - 1, static_cast<int>(unit->GetMapCoord().x()))),
-      std::max(0, std::min(mapHeight - 1, static_cast<int>(unit->GetMapCoord().y()))));
-  
-  // Determine the goal tiles and treat them as open even if they are occupied.
-  // This is done for the tiles taken up by the unit's target.
-  // This allows us to plan a path "into" the target.
-  QRect goalRect;
-  if (unit->GetTargetObjectId() != kInvalidObjectId) {
-    auto targetIt = map->GetObjects().find(unit->GetTargetObjectId());
-    if (targetIt != map->GetObjects().end()) {
-      ServerObject* targetObject = targetIt->second;
-      if (targetObject->isBuilding()) {
-        ServerBuilding* targetBuilding = AsBuilding(targetObject);
-        
-        const QPoint& baseTile = targetBuilding->GetBaseTile();
-        QSize buildingSize = GetBuildingSize(targetBuilding->GetType());
-        goalRect = QRect(baseTile, buildingSize);
-      }
-    }
-  }
-  if (goalRect.isNull()) {
-    goalRect = QRect(
-        std::max(0, std::min(mapWidth - 1, static_cast<int>(unit->GetMoveToTargetMapCoord().x()))),
-        std::max(0, std::min(mapHeight - 1, static_cast<int>(unit->GetMoveToTargetMapCoord().y()))),
-        1,
-        1);
-  }
+      std::max(0, std::min(mapWidth - 1, static_cast<int>(startMapCoord.x()))),
+      std::max(0, std::min(mapHeight - 1, static_cast<int>(startMapCoord.y()))));
   
   // Use A* to plan a path from the start to the goal tile.
   // * Treat unit-occupied tiles as obstacles.
@@ -289,6 +281,8 @@ void PlanUnitPath(ServerUnit* unit, ServerMap* map) {
   
   int debugConsideredNodesCount = 0;
   
+  std::vector<std::pair<int, int>> rowRanges(mapHeight, std::make_pair(std::numeric_limits<int>::max(), 0));
+  
   // Set this to true to have a debug image written to /tmp/FreeAge_pathfinding_debug.png.
   // Legend:
   // * Black: Occupied tiles.
@@ -438,7 +432,7 @@ void PlanUnitPath(ServerUnit* unit, ServerMap* map) {
       if (kOutputPathfindingDebugMessages) {
         LOG(1) << "Pathfinding: Goal not reached and there is no better tile than the initial one. Stopping.";
       }
-      unit->StopMovement();
+      return false;
     }
   } else {
     if (kOutputPathfindingDebugMessages) {
@@ -449,7 +443,8 @@ void PlanUnitPath(ServerUnit* unit, ServerMap* map) {
   
   // Reconstruct the path, tracking back from "targetTile" using "cameFrom".
   // We leave out the start tile since the unit is already within that tile.
-  std::vector<QPointF> reversePath;
+  std::vector<QPointF>& reversePath = *path;
+  reversePath.clear();
   QPoint currentTile = targetTile;
   while (currentTile != start) {
     reversePath.push_back(QPointF(currentTile.x() + 0.5f, currentTile.y() + 0.5f));
@@ -481,9 +476,9 @@ void PlanUnitPath(ServerUnit* unit, ServerMap* map) {
   // TODO: If we can't reach the goal, maybe append a point here that makes the unit walk into the obstacle?
   if (reachedGoalTile.x() >= 0) {
     if (reversePath.empty()) {
-      reversePath.push_back(unit->GetMoveToTargetMapCoord());
+      reversePath.push_back(goalMapCoord);
     } else if (goalRect.width() == 1 && goalRect.height() == 1) {
-      reversePath[0] = unit->GetMoveToTargetMapCoord();
+      reversePath[0] = goalMapCoord;
     }
   }
   
@@ -492,20 +487,535 @@ void PlanUnitPath(ServerUnit* unit, ServerMap* map) {
   }
   
   // Smooth the planned path by attempting to drop corners.
-  float unitRadius = GetUnitRadius(unit->GetType());
   for (usize i = 1; i < reversePath.size(); ++ i) {
-    const QPointF& p0 = (i == reversePath.size() - 1) ? unit->GetMapCoord() : reversePath[i + 1];
+    const QPointF& p0 = (i == reversePath.size() - 1) ? startMapCoord : reversePath[i + 1];
     const QPointF& p1 = reversePath[i - 1];
     
-    if (IsPathFree(unitRadius, p0, p1, goalRect, map)) {
+    if (IsPathFree(unitRadius, p0, p1, goalRect, map, &rowRanges)) {
       reversePath.erase(reversePath.begin() + i);
       -- i;
     }
   }
   
+  if (stats) {
+    stats->expandedNodes = debugConsideredNodesCount;
+  }
+  return true;
+}
+
+/// Tests whether a line segment intersects tiles that are enlarged by a margin on all sides.
+/// The inverse of the segment's direction is precomputed, since a line of sight test
+/// usually tests the segment against several tiles.
+class SegmentTileIntersector {
+ public:
+  inline SegmentTileIntersector(const QPointF& p0, const QPointF& p1, float margin)
+      : margin(margin) {
+    origin[0] = p0.x();
+    origin[1] = p0.y();
+    for (int axis = 0; axis < 2; ++ axis) {
+      float direction = (axis == 0) ? (p1.x() - p0.x()) : (p1.y() - p0.y());
+      inverseDirection[axis] = (direction != 0) ? (1 / direction) : 0;
+    }
+  }
+  
+  /// Returns whether the segment intersects the given tile, enlarged by the margin.
+  inline bool Intersects(int tileX, int tileY) const {
+    // Clip the segment's parameter range [0, 1] against the slabs in x and y direction.
+    float tMin = 0;
+    float tMax = 1;
+    for (int axis = 0; axis < 2; ++ axis) {
+      float slabMin = ((axis == 0) ? tileX : tileY) - margin;
+      float slabMax = ((axis == 0) ? tileX : tileY) + 1 + margin;
+      
+      if (inverseDirection[axis] == 0) {
+        if (origin[axis] <= slabMin || origin[axis] >= slabMax) {
+          return false;
+        }
+        continue;
+      }
+      float t0 = (slabMin - origin[axis]) * inverseDirection[axis];
+      float t1 = (slabMax - origin[axis]) * inverseDirection[axis];
+      tMin = std::max(tMin, std::min(t0, t1));
+      tMax = std::min(tMax, std::max(t0, t1));
+      if (tMin >= tMax) {
+        return false;
+      }
+    }
+    return true;
+  }
+  
+ private:
+  float origin[2];
+  float inverseDirection[2];
+  float margin;
+};
+
+/// Tests whether the unit could walk from p0 to p1 (or vice versa) without colliding
+/// with occupied space, using the clearance that the map stores for each tile
+/// (see ServerMap::unitClearanceAt()).
+///
+/// The tiles that the line from p0 to p1 passes through are traversed. For tiles with
+/// a large enough clearance, the unit cannot collide with anything while it is within
+/// them. Otherwise, the line is tested against the occupied tiles in the 3x3 neighborhood,
+/// enlarged by the unit radius. If the previous tile's neighborhood was tested as well,
+/// only the tiles that are new in the current neighborhood are tested. Since this treats the
+/// occupied tiles' corners as square instead of round, it is slightly conservative. For units
+/// with a radius larger than one tile, this falls back to IsPathFree().
+static bool HasLineOfSight(float unitRadius, const QPointF& p0, const QPointF& p1, const QRect& openRect, ServerMap* map, std::vector<std::pair<int, int>>* rowRanges) {
+  if (unitRadius > 1) {
+    return IsPathFree(unitRadius, p0, p1, openRect, map, rowRanges);
+  }
+  
+  int x = static_cast<int>(p0.x());
+  int y = static_cast<int>(p0.y());
+  int endX = static_cast<int>(p1.x());
+  int endY = static_cast<int>(p1.y());
+  
+  // Traverse the tiles along the line as in:
+  // Amanatides and Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing", 1987.
+  QPointF direction = p1 - p0;
+  int stepX = (direction.x() > 0) ? 1 : -1;
+  int stepY = (direction.y() > 0) ? 1 : -1;
+  float tDeltaX = (direction.x() != 0) ? (1 / fabs(direction.x())) : std::numeric_limits<float>::infinity();
+  float tDeltaY = (direction.y() != 0) ? (1 / fabs(direction.y())) : std::numeric_limits<float>::infinity();
+  float tMaxX = tDeltaX * ((stepX > 0) ? (x + 1 - p0.x()) : (p0.x() - x));
+  float tMaxY = tDeltaY * ((stepY > 0) ? (y + 1 - p0.y()) : (p0.y() - y));
+  
+  SegmentTileIntersector intersector(p0, p1, unitRadius);
+  auto isBlockingTile = [&](int tileX, int tileY) {
+    return tileX >= 0 && tileY >= 0 && tileX < map->GetWidth() && tileY < map->GetHeight() &&
+           map->occupiedForUnitsAt(tileX, tileY) &&
+           !openRect.contains(tileX, tileY, false) &&
+           intersector.Intersects(tileX, tileY);
+  };
+  
+  // The step that led to the current tile: 0 for the first tile and for tiles whose predecessor's
+  // neighborhood was not tested, 1 for a step in x direction, and 2 for a step in y direction.
+  int previousStep = 0;
+  
+  int remainingTiles = std::abs(endX - x) + std::abs(endY - y) + 1;
+  while (remainingTiles > 0) {
+    if (unitRadius > map->unitClearanceAt(x, y) - 1) {
+      if (previousStep == 1) {
+        // Only the column in step direction is new.
+        for (int tileY = y - 1; tileY <= y + 1; ++ tileY) {
+          if (isBlockingTile(x + stepX, tileY)) {
+            return false;
+          }
+        }
+      } else if (previousStep == 2) {
+        // Only the row in step direction is new.
+        for (int tileX = x - 1; tileX <= x + 1; ++ tileX) {
+          if (isBlockingTile(tileX, y + stepY)) {
+            return false;
+          }
+        }
+      } else {
+        for (int tileY = y - 1; tileY <= y + 1; ++ tileY) {
+          for (int tileX = x - 1; tileX <= x + 1; ++ tileX) {
+            if (isBlockingTile(tileX, tileY)) {
+              return false;
+            }
+          }
+        }
+      }
+      previousStep = (tMaxX < tMaxY) ? 1 : 2;
+    } else {
+      previousStep = 0;
+    }
+    
+    if (tMaxX < tMaxY) {
+      tMaxX += tDeltaX;
+      x += stepX;
+    } else {
+      tMaxY += tDeltaY;
+      y += stepY;
+    }
+    -- remainingTiles;
+  }
+  
+  return true;
+}
+
+bool HasLineOfSight(float unitRadius, const QPointF& p0, const QPointF& p1, const QRect& openRect, ServerMap* map) {
+  std::vector<std::pair<int, int>> rowRanges;
+  if (unitRadius > 1) {
+    rowRanges.resize(map->GetHeight(), std::make_pair(std::numeric_limits<int>::max(), 0));
+  }
+  return HasLineOfSight(unitRadius, p0, p1, openRect, map, &rowRanges);
+}
+
+/// Plans a path with Lazy Theta*, as described in:
+/// Nash, Koenig, and Tovey, "Lazy Theta*: Any-Angle Path Planning and Path Length Analysis in 3D", 2010.
+///
+/// This is A* on the grid of tiles, with the difference that each tile's parent may be any
+/// tile that is visible from it rather than only one of its neighbors. When expanding a tile,
+/// its neighbors are optimistically assigned the tile's parent, and line of sight is only
+/// tested once these neighbors are expanded themselves. The resulting paths thus run at any
+/// angle and do not need to be smoothed afterwards.
+static bool FindAnyAnglePath(float unitRadius, const QPointF& startMapCoord, const QRect& goalRect, const QPointF& goalMapCoord, ServerMap* map, std::vector<QPointF>* path, PathSearchStats* stats) {
+  int mapWidth = map->GetWidth();
+  int mapHeight = map->GetHeight();
+  
+  // Determine the tile that the unit stands on. This will be the start tile.
+  QPoint start(
+      std::max(0, std::min(mapWidth - 1, static_cast<int>(startMapCoord.x()))),
+      std::max(0, std::min(mapHeight - 1, static_cast<int>(startMapCoord.y()))));
+  int startIndex = start.x() + mapWidth * start.y();
+  
+  // The path starts at the unit's exact location, all other path vertices are tile centers.
+  auto vertexPosition = [&](int index) {
+    return (index == startIndex) ? startMapCoord : QPointF((index % mapWidth) + 0.5f, (index / mapWidth) + 0.5f);
+  };
+  
+  // Returns the straight-line distance from the tile to the closest tile in the given rect.
+  auto distanceToRect = [](int x, int y, const QRect& rect) {
+    int xDiff = x - std::max(rect.x(), std::min(rect.x() + rect.width() - 1, x));
+    int yDiff = y - std::max(rect.y(), std::min(rect.y() + rect.height() - 1, y));
+    return std::sqrt(static_cast<float>(xDiff * xDiff + yDiff * yDiff));
+  };
+  
+  // The tiles that the search leads to. This is the goal rect, unless the goal is known to be
+  // unreachable (see below).
+  QRect searchGoalRect = goalRect;
+  
+  // The distance to the closest tile in searchGoalRect is a consistent heuristic for any-angle paths.
+  //
+  // The search weights it by kHeuristicWeight. Without weighting, all tiles close to the
+  // straight line towards the goal have almost the same priority, so the search expands a
+  // wide band of tiles around it (and tests line of sight for each of them). The weighting
+  // makes it prefer tiles that are closer to the goal, which reduces the number of expanded
+  // tiles to about a third, while the resulting paths are at most kHeuristicWeight times as
+  // long as the shortest ones (in practice, they are only about 0.2% longer).
+  constexpr float kHeuristicWeight = 1.1f;
+  auto heuristic = [&](int x, int y) {
+    return distanceToRect(x, y, searchGoalRect);
+  };
+  
+  // Treat tiles that are occupied by the unit's target (goalRect) as free,
+  // such that the algorithm can plan a path "into" the goal.
+  auto isTileFree = [&](int x, int y) {
+    return x >= 0 && y >= 0 && x < mapWidth && y < mapHeight &&
+           (!map->occupiedForUnitsAt(x, y) || goalRect.contains(x, y, false));
+  };
+  
+  // The offsets of the neighbors of a tile, and the index of each offset (dx, dy) in
+  // kNeighborOffsets at kNeighborIndices[dy + 1][dx + 1] (or 8 for the tile itself).
+  constexpr int kNeighborOffsets[8][2] = {{0, -1}, {-1, 0}, {1, 0}, {0, 1}, {-1, -1}, {1, -1}, {-1, 1}, {1, 1}};
+  constexpr int kNeighborIndices[3][3] = {{4, 0, 5}, {1, 8, 2}, {6, 3, 7}};
+  
+  // Returns a mask in which bit i is set if a unit can move from the given tile to its neighbor
+  // at kNeighborOffsets[i]. As for the grid-based search, diagonal movements require the two
+  // adjacent tiles to be free.
+  auto getMovableNeighbors = [&](int x, int y) {
+    bool top = isTileFree(x, y - 1);
+    bool left = isTileFree(x - 1, y);
+    bool right = isTileFree(x + 1, y);
+    bool bottom = isTileFree(x, y + 1);
+    return (top << 0) | (left << 1) | (right << 2) | (bottom << 3) |
+           ((top && left && isTileFree(x - 1, y - 1)) << 4) |
+           ((top && right && isTileFree(x + 1, y - 1)) << 5) |
+           ((bottom && left && isTileFree(x - 1, y + 1)) << 6) |
+           ((bottom && right && isTileFree(x + 1, y + 1)) << 7);
+  };
+  
+  struct Location {
+    int index;
+    float priority;
+    
+    inline Location(int index, float priority)
+        : index(index),
+          priority(priority) {}
+    
+    inline bool operator> (const Location& other) const {
+      return priority > other.priority;
+    }
+  };
+  
+  std::priority_queue<Location, std::vector<Location>, std::greater<Location>> priorityQueue;
+  
+  std::vector<float> costSoFar(mapWidth * mapHeight, std::numeric_limits<float>::infinity());
+  std::vector<int> parent(mapWidth * mapHeight, -1);
+  std::vector<u8> closed(mapWidth * mapHeight, 0);
+  std::vector<std::pair<int, int>> rowRanges(mapHeight, std::make_pair(std::numeric_limits<int>::max(), 0));
+  
+  // Visits the tiles that are connected to the given seed tiles by free tiles in breadth-first
+  // order, calling visit() for each of them, until maxTiles tiles were visited. The seed tiles
+  // and the tile with index openIndex are treated as free. Since diagonal movements require the
+  // two adjacent tiles to be free, it suffices to consider the direct neighbors. Returns false
+  // if the limit was reached before all connected tiles were visited.
+  std::vector<int> floodedTiles;
+  auto floodFill = [&](const QRect& seedRect, int openIndex, usize maxTiles, auto visit) {
+    // Use "closed" to mark the visited tiles, and reset it afterwards.
+    floodedTiles.clear();
+    for (int y = std::max(0, seedRect.y()), maxY = std::min(mapHeight - 1, seedRect.bottom()); y <= maxY; ++ y) {
+      for (int x = std::max(0, seedRect.x()), maxX = std::min(mapWidth - 1, seedRect.right()); x <= maxX; ++ x) {
+        closed[x + mapWidth * y] = 1;
+        floodedTiles.push_back(x + mapWidth * y);
+      }
+    }
+    bool visitedAll = true;
+    for (usize i = 0; i < floodedTiles.size(); ++ i) {
+      if (i == maxTiles) {
+        visitedAll = false;
+        break;
+      }
+      int index = floodedTiles[i];
+      visit(index);
+      int x = index % mapWidth;
+      int y = index / mapWidth;
+      for (int k = 0; k < 4; ++ k) {
+        int neighborX = x + kNeighborOffsets[k][0];
+        int neighborY = y + kNeighborOffsets[k][1];
+        if (neighborX < 0 || neighborY < 0 || neighborX >= mapWidth || neighborY >= mapHeight) {
+          continue;
+        }
+        int neighborIndex = neighborX + mapWidth * neighborY;
+        if ((isTileFree(neighborX, neighborY) || neighborIndex == openIndex) &&
+            !closed[neighborIndex]) {
+          closed[neighborIndex] = 1;
+          floodedTiles.push_back(neighborIndex);
+        }
+      }
+    }
+    for (int index : floodedTiles) {
+      closed[index] = 0;
+    }
+    return visitedAll;
+  };
+  
+  // If the goal lies in a small area that is enclosed by occupied tiles (for example, if the unit
+  // was commanded to move into a forest), the search would expand all reachable tiles and test line
+  // of sight for each of them before giving up. Thus, flood-fill the free tiles around the goal first.
+  // If this finds all of them without reaching the start, the goal is not reachable, and the reachable
+  // tile that is closest to it is determined with a flood fill from the start instead. The search then
+  // leads to this tile.
+  constexpr usize kMaxEnclosedGoalAreaTiles = 64;
+  bool isGoalReachable = false;
+  bool isGoalAreaEnclosed = floodFill(goalRect, startIndex, kMaxEnclosedGoalAreaTiles, [&](int index) {
+    isGoalReachable |= (index == startIndex);
+  });
+  if (isGoalAreaEnclosed && !isGoalReachable) {
+    int closestReachableIndex = startIndex;
+    float closestReachableDistance = distanceToRect(start.x(), start.y(), goalRect);
+    floodFill(QRect(start, QSize(1, 1)), -1, mapWidth * mapHeight, [&](int index) {
+      float distance = distanceToRect(index % mapWidth, index / mapWidth, goalRect);
+      if (distance < closestReachableDistance) {
+        closestReachableDistance = distance;
+        closestReachableIndex = index;
+      }
+    });
+    if (closestReachableIndex == startIndex) {
+      if (kOutputPathfindingDebugMessages) {
+        LOG(1) << "Pathfinding: Goal not reachable and there is no better tile than the initial one. Stopping.";
+      }
+      return false;
+    }
+    searchGoalRect = QRect(closestReachableIndex % mapWidth, closestReachableIndex / mapWidth, 1, 1);
+  } else {
+    isGoalReachable = true;
+  }
+  
+  costSoFar[startIndex] = 0;
+  parent[startIndex] = startIndex;
+  priorityQueue.emplace(startIndex, kHeuristicWeight * heuristic(start.x(), start.y()));
+  
+  // If the goal is not reached, we go to the reachable tile that is closest to it.
+  int closestTileIndex = startIndex;
+  float closestTileHeuristic = heuristic(start.x(), start.y());
+  
+  int numExpandedNodes = 0;
+  int reachedGoalIndex = -1;
+  while (!priorityQueue.empty()) {
+    int currentIndex = priorityQueue.top().index;
+    priorityQueue.pop();
+    if (closed[currentIndex]) {
+      // This is an outdated queue entry for a tile that was already expanded.
+      continue;
+    }
+    
+    int currentX = currentIndex % mapWidth;
+    int currentY = currentIndex / mapWidth;
+    int movableNeighbors = getMovableNeighbors(currentX, currentY);
+    
+    // Verify the optimistically assigned parent. If it is not visible, use the best
+    // expanded neighbor instead (which is reachable with a grid movement).
+    int currentParent = parent[currentIndex];
+    int parentXDiff = (currentParent % mapWidth) - currentX;
+    int parentYDiff = (currentParent / mapWidth) - currentY;
+    bool isParentNeighbor =
+        std::abs(parentXDiff) <= 1 && std::abs(parentYDiff) <= 1 &&
+        (movableNeighbors & (1 << kNeighborIndices[parentYDiff + 1][parentXDiff + 1]));
+    if (currentParent != currentIndex && !isParentNeighbor &&
+        !HasLineOfSight(unitRadius, vertexPosition(currentParent), vertexPosition(currentIndex), goalRect, map, &rowRanges)) {
+      costSoFar[currentIndex] = std::numeric_limits<float>::infinity();
+      for (int i = 0; i < 8; ++ i) {
+        if (!(movableNeighbors & (1 << i))) {
+          continue;
+        }
+        const int* offset = kNeighborOffsets[i];
+        int neighborIndex = (currentX + offset[0]) + mapWidth * (currentY + offset[1]);
+        if (!closed[neighborIndex]) {
+          continue;
+        }
+        float cost = costSoFar[neighborIndex] + Length(vertexPosition(currentIndex) - vertexPosition(neighborIndex));
+        if (cost < costSoFar[currentIndex]) {
+          costSoFar[currentIndex] = cost;
+          parent[currentIndex] = neighborIndex;
+        }
+      }
+    }
+    
+    closed[currentIndex] = 1;
+    ++ numExpandedNodes;
+    if (costSoFar[currentIndex] == std::numeric_limits<float>::infinity()) {
+      // No expanded neighbor can be moved to from here (this may happen next to an occupied start tile).
+      continue;
+    }
+    
+    if (searchGoalRect.contains(currentX, currentY, false)) {
+      reachedGoalIndex = currentIndex;
+      break;
+    }
+    
+    float currentHeuristic = heuristic(currentX, currentY);
+    if (currentHeuristic < closestTileHeuristic) {
+      closestTileHeuristic = currentHeuristic;
+      closestTileIndex = currentIndex;
+    }
+    
+    // Expand the neighbors, assuming that they are visible from the current tile's parent.
+    int parentIndex = parent[currentIndex];
+    QPointF parentPosition = vertexPosition(parentIndex);
+    for (int i = 0; i < 8; ++ i) {
+      if (!(movableNeighbors & (1 << i))) {
+        continue;
+      }
+      const int* offset = kNeighborOffsets[i];
+      int neighborX = currentX + offset[0];
+      int neighborY = currentY + offset[1];
+      int neighborIndex = neighborX + mapWidth * neighborY;
+      if (closed[neighborIndex]) {
+        continue;
+      }
+      
+      float newCost = costSoFar[parentIndex] + Length(QPointF(neighborX + 0.5f, neighborY + 0.5f) - parentPosition);
+      if (newCost < costSoFar[neighborIndex]) {
+        costSoFar[neighborIndex] = newCost;
+        parent[neighborIndex] = parentIndex;
+        priorityQueue.emplace(neighborIndex, newCost + kHeuristicWeight * heuristic(neighborX, neighborY));
+      }
+    }
+  }
+  
+  if (stats) {
+    stats->expandedNodes = numExpandedNodes;
+  }
+  if (kOutputPathfindingDebugMessages) {
+    LOG(1) << "Pathfinding: expanded " << numExpandedNodes << " nodes (max possible: " << (mapWidth * mapHeight) << ")";
+  }
+  
+  // Did we find a path to the goal or only to some other tile that is close to the goal?
+  int targetIndex;
+  if (reachedGoalIndex >= 0) {
+    targetIndex = reachedGoalIndex;
+  } else if (closestTileIndex != startIndex) {
+    if (kOutputPathfindingDebugMessages) {
+      LOG(1) << "Pathfinding: Goal not reached; going as close as possible";
+    }
+    targetIndex = closestTileIndex;
+  } else {
+    if (kOutputPathfindingDebugMessages) {
+      LOG(1) << "Pathfinding: Goal not reached and there is no better tile than the initial one. Stopping.";
+    }
+    return false;
+  }
+  
+  // Reconstruct the path, tracking back from the target using the parents.
+  // We leave out the start since the unit is already there.
+  std::vector<QPointF>& reversePath = *path;
+  reversePath.clear();
+  for (int index = targetIndex; index != startIndex; index = parent[index]) {
+    reversePath.push_back(vertexPosition(index));
+  }
+  
+  // Replace the last point with the exact goal location (if we can reach the goal)
+  if (reachedGoalIndex >= 0 && isGoalReachable) {
+    if (reversePath.empty()) {
+      reversePath.push_back(goalMapCoord);
+    } else if (goalRect.width() == 1 && goalRect.height() == 1) {
+      reversePath[0] = goalMapCoord;
+    }
+  }
+  
+  return true;
+}
+
+bool FindPath(PathPlanner planner, float unitRadius, const QPointF& startMapCoord, const QRect& goalRect, const QPointF& goalMapCoord, ServerMap* map, std::vector<QPointF>* path, PathSearchStats* stats) {
+  switch (planner) {
+  case PathPlanner::Grid: return FindGridPath(unitRadius, startMapCoord, goalRect, goalMapCoord, map, path, stats);
+  case PathPlanner::AnyAngle: return FindAnyAnglePath(unitRadius, startMapCoord, goalRect, goalMapCoord, map, path, stats);
+  }
+  return false;
+}
+
+void PlanUnitPath(ServerUnit* unit, ServerMap* map, PathPlanner planner, PathCache* cache) {
+  Timer pathPlanningTimer;
+  
+  int mapWidth = map->GetWidth();
+  int mapHeight = map->GetHeight();
+  
+  // Determine the goal tiles and treat them as open even if they are occupied.
+  // This is done for the tiles taken up by the unit's target.
+  // This allows us to plan a path "into" the target.
+  QRect goalRect;
+  bool isBuildingGoal = false;
+  if (unit->GetTargetObjectId() != kInvalidObjectId) {
+    auto targetIt = map->GetObjects().find(unit->GetTargetObjectId());
+    if (targetIt != map->GetObjects().end()) {
+      ServerObject* targetObject = targetIt->second;
+      if (targetObject->isBuilding()) {
+        ServerBuilding* targetBuilding = AsBuilding(targetObject);
+        
+        const QPoint& baseTile = targetBuilding->GetBaseTile();
+        QSize buildingSize = GetBuildingSize(targetBuilding->GetType());
+        goalRect = QRect(baseTile, buildingSize);
+        isBuildingGoal = true;
+      }
+    }
+  }
+  if (goalRect.isNull()) {
+    goalRect = QRect(
+        std::max(0, std::min(mapWidth - 1, static_cast<int>(unit->GetMoveToTargetMapCoord().x()))),
+        std::max(0, std::min(mapHeight - 1, static_cast<int>(unit->GetMoveToTargetMapCoord().y()))),
+        1,
+        1);
+  }
+  
+  // Paths to buildings are cached, since units often walk to the same buildings repeatedly
+  // (e.g., villagers that gather resources). Such paths are planned with the radius of the
+  // unit's radius class, such that they can be shared with similarly sized units.
+  bool useCache = cache && isBuildingGoal;
+  float unitRadius = GetUnitRadius(unit->GetType());
+  if (useCache) {
+    unitRadius = PathCache::GetPlanningRadius(unitRadius);
+  }
+  
+  std::vector<QPointF> reversePath;
+  if (!useCache ||
+      !cache->Lookup(unitRadius, unit->GetMapCoord(), unit->GetTargetObjectId(), goalRect, unit->GetMoveToTargetMapCoord(), map, &reversePath)) {
+    if (!FindPath(planner, unitRadius, unit->GetMapCoord(), goalRect, unit->GetMoveToTargetMapCoord(), map, &reversePath)) {
+      unit->StopMovement();
+      return;
+    }
+    if (useCache) {
+      cache->Insert(unitRadius, unit->GetMapCoord(), unit->GetTargetObjectId(), goalRect, reversePath, map);
+    }
+  }
+  
   if (kOutputPathfindingDebugMessages) {
-    LOG(1) << "Pathfinding: Smoothed path length is " << reversePath.size();
-    LOG(1) << "Pathfinding: Took " << pathPlanningTimer.Stop(false) << " s" << (kOutputDebugImage ? " (not accurate since kOutputDebugImage is true!)" : "");
+    LOG(1) << "Pathfinding: Path length is " << reversePath.size();
+    LOG(1) << "Pathfinding: Took " << pathPlanningTimer.Stop(false) << " s";
   }
   
   // Assign the path to the unit.
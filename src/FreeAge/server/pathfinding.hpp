@@ -4,7 +4,50 @@
 
 #pragma once
 
+#include <vector>
+
+#include <QPointF>
+#include <QRect>
+
+class PathCache;
 class ServerMap;
 class ServerUnit;
 
-void PlanUnitPath(ServerUnit* unit, ServerMap* map);
+/// The path planning algorithms that FindPath() supports.
+enum class PathPlanner {
+  /// A* on the grid of tiles, followed by smoothing the path by dropping corners.
+  /// It is used for the units if ServerSettings::useAnyAnglePathPlanning is not set.
+  Grid = 0,
+  
+  /// Lazy Theta*, which tests line of sight during the search and thus directly
+  /// returns paths that run at any angle. These paths are slightly shorter than those
+  /// of the Grid planner. Since the search expands fewer tiles, planning them is also
+  /// faster (see the pathfinding scenario of FreeAgeBench). This is used for the units
+  /// by default.
+  AnyAngle
+};
+
+/// Statistics about a path search.
+struct PathSearchStats {
+  /// The number of tiles that were expanded by the search.
+  int expandedNodes = 0;
+};
+
+/// Plans a path for a unit with the given radius that stands at startMapCoord.
+/// The path leads into goalRect, where it ends at goalMapCoord if goalRect is a single tile.
+/// Tiles within goalRect are treated as free, such that the path can lead "into" a target.
+/// If the goal is not reachable, the path leads to the reachable tile that is closest to it.
+///
+/// On success, returns true and the path's waypoints in reverse order in "path" (as expected
+/// by ServerUnit::SetPath()). Returns false if there is no reachable tile that is closer to
+/// the goal than the start.
+bool FindPath(PathPlanner planner, float unitRadius, const QPointF& startMapCoord, const QRect& goalRect, const QPointF& goalMapCoord, ServerMap* map, std::vector<QPointF>* path, PathSearchStats* stats = nullptr);
+
+/// Tests whether a unit with the given radius could walk on a straight line from p0
+/// to p1 without colliding with occupied space. Tiles within openRect are treated as free.
+bool HasLineOfSight(float unitRadius, const QPointF& p0, const QPointF& p1, const QRect& openRect, ServerMap* map);
+
+/// Plans a path to the unit's move-to target (or target object) with FindPath() using the
+/// given planner and assigns it to the unit. Stops the unit if no path was found.
+/// If a cache is given, it is used for paths to buildings.
+void PlanUnitPath(ServerUnit* unit, ServerMap* map, PathPlanner planner = PathPlanner::AnyAngle, PathCache* cache = nullptr);
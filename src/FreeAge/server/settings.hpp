@@ -5,6 +5,7 @@
 #pragma once
 
 #include <QByteArray>
+#include <QString>
 
 #include "FreeAge/common/free_age.hpp"
 
@@ -27,4 +28,23 @@ struct ServerSettings {
   
   /// The map size chosen by the host.
   u16 mapSize = kDefaultMapSize;
+  
+  /// If non-empty, the server periodically writes its game step profiling statistics
+  /// (see StepProfiler) as JSON to this file, such that they can be monitored externally.
+  QString metricsPath;
+  
+  /// Interval in seconds for writing to metricsPath.
+  double metricsInterval = 5;
+  
+  /// Whether moving units steer around each other with CrowdSteering. If false, units only
+  /// try to side-step a single unit that blocks their way.
+  bool useCrowdSteering = true;
+  
+  /// Whether only the active objects are simulated in each game step (see ObjectScheduler).
+  /// If false, all objects are simulated in each step, which gives the same results.
+  bool useActiveSetScheduling = true;
+  
+  /// Whether units plan their paths with PathPlanner::AnyAngle instead of PathPlanner::Grid.
+  /// If false, the paths are slightly longer, which may be used for comparison.
+  bool useAnyAnglePathPlanning = true;
 };
@@ -0,0 +1,181 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/server/step_profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#include "FreeAge/common/logging.hpp"
+
+const char* GetStepPhaseName(StepPhase phase) {
+  switch (phase) {
+  case StepPhase::MessageParsing: return "messageParsing";
+  case StepPhase::CrowdSteering: return "crowdSteering";
+  case StepPhase::UnitSimulation: return "unitSimulation";
+  case StepPhase::Pathfinding: return "pathfinding";
+  case StepPhase::Combat: return "combat";
+  case StepPhase::BuildingSimulation: return "buildingSimulation";
+  case StepPhase::ObjectDeletion: return "objectDeletion";
+  case StepPhase::MessageSerialization: return "messageSerialization";
+  case StepPhase::SocketWrites: return "socketWrites";
+  case StepPhase::NumPhases: break;
+  }
+  return "invalid";
+}
+
+
+DurationHistogram::DurationHistogram() {
+  Reset();
+}
+
+void DurationHistogram::Add(double seconds) {
+  double microseconds = 1e6 * seconds;
+  int bucket = (microseconds <= 1) ? 0 : static_cast<int>(kBucketsPerOctave * std::log2(microseconds));
+  ++ buckets[std::min(bucket, kNumBuckets - 1)];
+  
+  ++ count;
+  total += seconds;
+  max = std::max(max, seconds);
+}
+
+double DurationHistogram::GetPercentile(double percentile) const {
+  if (count == 0) {
+    return 0;
+  }
+  
+  u64 rank = std::max<u64>(1, std::ceil(percentile * count));
+  u64 accumulatedCount = 0;
+  for (int bucket = 0; bucket < kNumBuckets; ++ bucket) {
+    accumulatedCount += buckets[bucket];
+    if (accumulatedCount >= rank) {
+      // Do not report more than the maximum, which in particular makes the result for
+      // percentile 1 exact and handles durations beyond the last bucket.
+      return std::min(max, 1e-6 * std::exp2((bucket + 1) / static_cast<double>(kBucketsPerOctave)));
+    }
+  }
+  return max;
+}
+
+void DurationHistogram::Reset() {
+  buckets.fill(0);
+  count = 0;
+  total = 0;
+  max = 0;
+}
+
+
+StepProfiler::StepProfiler() {
+  currentStepPhaseTimes.fill(0);
+}
+
+void StepProfiler::PushPhase(StepPhase phase) {
+  // Failing to push would make the matching PopPhase() pop the enclosing phase instead.
+  CHECK_LT(phaseStackSize, kMaxPhaseDepth) << "Exceeded the maximum step phase depth";
+  
+  if (phaseStackSize > 0) {
+    AccumulateCurrentPhase();
+  } else {
+    phaseStartTime = Clock::now();
+  }
+  phaseStack[phaseStackSize] = phase;
+  ++ phaseStackSize;
+}
+
+void StepProfiler::PopPhase() {
+  CHECK_GT(phaseStackSize, 0) << "PopPhase() called without an active phase";
+  
+  AccumulateCurrentPhase();
+  -- phaseStackSize;
+}
+
+void StepProfiler::SwitchPhase(StepPhase phase) {
+  CHECK_GT(phaseStackSize, 0) << "SwitchPhase() called without an active phase";
+  if (phaseStack[phaseStackSize - 1] == phase) {
+    return;
+  }
+  
+  AccumulateCurrentPhase();
+  phaseStack[phaseStackSize - 1] = phase;
+}
+
+void StepProfiler::EndStep() {
+  if (phaseStackSize > 0) {
+    AccumulateCurrentPhase();
+  }
+  
+  double stepTime = 0;
+  for (int phase = 0; phase < kNumPhases; ++ phase) {
+    phaseHistograms[phase].Add(currentStepPhaseTimes[phase]);
+    stepTime += currentStepPhaseTimes[phase];
+    currentStepPhaseTimes[phase] = 0;
+  }
+  stepHistogram.Add(stepTime);
+  
+  ++ totalStepCount;
+}
+
+void StepProfiler::ResetWindow() {
+  stepHistogram.Reset();
+  for (DurationHistogram& histogram : phaseHistograms) {
+    histogram.Reset();
+  }
+}
+
+static QJsonObject HistogramToJSON(const DurationHistogram& histogram) {
+  QJsonObject object;
+  object["mean"] = (histogram.GetCount() > 0) ? (histogram.GetTotal() / histogram.GetCount()) : 0.;
+  object["p50"] = histogram.GetPercentile(0.5);
+  object["p99"] = histogram.GetPercentile(0.99);
+  object["max"] = histogram.GetMax();
+  object["total"] = histogram.GetTotal();
+  return object;
+}
+
+QJsonObject StepProfiler::ToJSONObject() const {
+  QJsonObject phases;
+  for (int phase = 0; phase < kNumPhases; ++ phase) {
+    phases[GetStepPhaseName(static_cast<StepPhase>(phase))] = HistogramToJSON(phaseHistograms[phase]);
+  }
+  
+  QJsonObject root;
+  root["totalSteps"] = static_cast<double>(totalStepCount);
+  root["windowSteps"] = static_cast<double>(stepHistogram.GetCount());
+  root["stepTime"] = HistogramToJSON(stepHistogram);
+  root["phaseTime"] = phases;
+  return root;
+}
+
+QByteArray StepProfiler::ToJSON(double serverTime, const QJsonObject& additionalFields) const {
+  QJsonObject root = ToJSONObject();
+  root["serverTime"] = serverTime;
+  for (auto it = additionalFields.constBegin(); it != additionalFields.constEnd(); ++ it) {
+    root.insert(it.key(), it.value());
+  }
+  return QJsonDocument(root).toJson();
+}
+
+bool StepProfiler::WriteJSON(const QString& path, double serverTime, const QJsonObject& additionalFields) const {
+  // QSaveFile writes to a temporary file first, such that readers never see a partially written file.
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly)) {
+    LOG(ERROR) << "Failed to open the metrics file for writing: " << path.toStdString();
+    return false;
+  }
+  file.write(ToJSON(serverTime, additionalFields));
+  if (!file.commit()) {
+    LOG(ERROR) << "Failed to write the metrics file: " << path.toStdString();
+    return false;
+  }
+  return true;
+}
+
+void StepProfiler::AccumulateCurrentPhase() {
+  TimePoint now = Clock::now();
+  currentStepPhaseTimes[static_cast<int>(phaseStack[phaseStackSize - 1])] += SecondsDuration(now - phaseStartTime).count();
+  phaseStartTime = now;
+}
@@ -0,0 +1,146 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <array>
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+
+#include "FreeAge/common/free_age.hpp"
+
+/// Phases of a server game step, for profiling.
+enum class StepPhase {
+  MessageParsing = 0,
+  CrowdSteering,
+  UnitSimulation,
+  Pathfinding,
+  Combat,
+  BuildingSimulation,
+  ObjectDeletion,
+  MessageSerialization,
+  SocketWrites,
+  
+  NumPhases
+};
+
+const char* GetStepPhaseName(StepPhase phase);
+
+/// Histogram of durations with logarithmically spaced buckets, which allows to
+/// compute approximate percentiles in constant memory and without allocations.
+/// The buckets start at one microsecond and subdivide each octave into
+/// kBucketsPerOctave buckets, so percentiles have a relative error of at most
+/// about 19%.
+class DurationHistogram {
+ public:
+  DurationHistogram();
+  
+  void Add(double seconds);
+  
+  /// Returns the upper bound (in seconds) of the bucket that contains the given
+  /// percentile (in [0, 1]) of the added durations, or 0 if the histogram is empty.
+  double GetPercentile(double percentile) const;
+  
+  void Reset();
+  
+  inline u64 GetCount() const { return count; }
+  inline double GetTotal() const { return total; }
+  inline double GetMax() const { return max; }
+  
+ private:
+  static constexpr int kBucketsPerOctave = 4;
+  static constexpr int kNumBuckets = 24 * kBucketsPerOctave;  // up to 2^24 microseconds (about 16 seconds)
+  
+  std::array<u32, kNumBuckets> buckets;
+  u64 count;
+  double total;
+  double max;
+};
+
+/// Measures the time that the server spends in the different phases of its game steps
+/// (see StepPhase), and keeps histograms of the step times and phase times.
+///
+/// The profiler is owned and used by the game loop thread only, thus it does not
+/// need any synchronization. Time is attributed to the innermost active phase only,
+/// such that for example pathfinding time is not counted as unit simulation time.
+/// Time that passes while no phase is active (e.g., sleeping) is not counted.
+///
+/// The statistics can be written to a JSON file with WriteJSON(). They cover the
+/// steps since the last call to ResetWindow().
+class StepProfiler {
+ public:
+  StepProfiler();
+  
+  /// Enters the given phase, remembering the current phase such that it can be
+  /// returned to with PopPhase(). At most kMaxPhaseDepth phases may be nested.
+  void PushPhase(StepPhase phase);
+  void PopPhase();
+  
+  /// Replaces the innermost phase with the given one. This does nothing (and in
+  /// particular does not query the clock) if the phase is already the innermost one.
+  /// Must only be called while a phase is active.
+  void SwitchPhase(StepPhase phase);
+  
+  /// Concludes a game step: the phase times that were accumulated since the last
+  /// call (including message parsing that happened between the steps) are added to
+  /// the histograms.
+  void EndStep();
+  
+  /// Clears the histograms (but not the total step count).
+  void ResetWindow();
+  
+  /// Returns the statistics as a JSON object.
+  QJsonObject ToJSONObject() const;
+  
+  /// Returns the statistics as JSON, including the given server time and the given
+  /// additional fields (e.g., statistics of other server components).
+  QByteArray ToJSON(double serverTime, const QJsonObject& additionalFields = QJsonObject()) const;
+  
+  /// Writes ToJSON() to the given file, replacing it atomically.
+  bool WriteJSON(const QString& path, double serverTime, const QJsonObject& additionalFields = QJsonObject()) const;
+  
+  inline const DurationHistogram& GetStepHistogram() const { return stepHistogram; }
+  inline const DurationHistogram& GetPhaseHistogram(StepPhase phase) const { return phaseHistograms[static_cast<int>(phase)]; }
+  inline u64 GetTotalStepCount() const { return totalStepCount; }
+  
+ private:
+  static constexpr int kNumPhases = static_cast<int>(StepPhase::NumPhases);
+  static constexpr int kMaxPhaseDepth = 4;
+  
+  /// Adds the time since phaseStartTime to the innermost phase and restarts phaseStartTime.
+  void AccumulateCurrentPhase();
+  
+  
+  /// Stack of active phases.
+  std::array<StepPhase, kMaxPhaseDepth> phaseStack;
+  int phaseStackSize = 0;
+  
+  TimePoint phaseStartTime;
+  
+  /// Time spent in each phase since the last EndStep().
+  std::array<double, kNumPhases> currentStepPhaseTimes;
+  
+  DurationHistogram stepHistogram;
+  std::array<DurationHistogram, kNumPhases> phaseHistograms;
+  
+  u64 totalStepCount = 0;
+};
+
+/// Helper which calls StepProfiler::PushPhase() on construction and StepProfiler::PopPhase() on destruction.
+class ScopedStepPhase {
+ public:
+  inline ScopedStepPhase(StepPhase phase, StepProfiler* profiler)
+      : profiler(profiler) {
+    profiler->PushPhase(phase);
+  }
+  
+  inline ~ScopedStepPhase() {
+    profiler->PopPhase();
+  }
+  
+ private:
+  StepProfiler* profiler;
+};
@@ -0,0 +1,120 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/server/target_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FreeAge/common/building_types.hpp"
+#include "FreeAge/common/util.hpp"
+#include "FreeAge/server/building.hpp"
+#include "FreeAge/server/unit.hpp"
+#include "FreeAge/server/unit_grid.hpp"
+
+TargetIndex::TargetIndex(int mapWidth, int mapHeight, const UnitGrid* units)
+    : cellsX(std::max(1, static_cast<int>(std::ceil(mapWidth / kCellSize)))),
+      cellsY(std::max(1, static_cast<int>(std::ceil(mapHeight / kCellSize)))),
+      units(units) {}
+
+void TargetIndex::AddBuilding(u32 id, ServerBuilding* building) {
+  int playerIndex = building->GetPlayerIndex();
+  if (playerIndex == kGaiaPlayerIndex) {
+    return;
+  }
+  if (playerIndex >= static_cast<int>(playerBuildingCells.size())) {
+    playerBuildingCells.resize(playerIndex + 1);
+  }
+  std::vector<std::vector<Entry>>& cells = playerBuildingCells[playerIndex];
+  if (cells.empty()) {
+    cells.resize(cellsX * cellsY);
+  }
+  
+  Entry entry = MakeEntry(id, building);
+  cells[GetCellIndex(QPointF(0.5f * (entry.minX + entry.maxX), 0.5f * (entry.minY + entry.maxY)))].push_back(entry);
+  maxBuildingExtent = std::max(maxBuildingExtent, 0.5f * std::max(entry.maxX - entry.minX, entry.maxY - entry.minY));
+}
+
+void TargetIndex::RemoveBuilding(ServerBuilding* building) {
+  int playerIndex = building->GetPlayerIndex();
+  if (playerIndex == kGaiaPlayerIndex ||
+      playerIndex >= static_cast<int>(playerBuildingCells.size()) ||
+      playerBuildingCells[playerIndex].empty()) {
+    return;
+  }
+  
+  Entry entry = MakeEntry(kInvalidObjectId, building);
+  std::vector<Entry>& cell = playerBuildingCells[playerIndex][GetCellIndex(QPointF(0.5f * (entry.minX + entry.maxX), 0.5f * (entry.minY + entry.maxY)))];
+  for (usize i = 0; i < cell.size(); ++ i) {
+    if (cell[i].building == building) {
+      cell[i] = cell.back();
+      cell.pop_back();
+      return;
+    }
+  }
+}
+
+u32 TargetIndex::FindTarget(int playerIndex, const QPointF& mapCoord, float radius, ServerObject** target) const {
+  u32 closestId = kInvalidObjectId;
+  float closestSquaredDistance = radius * radius;
+  
+  // There are no teams, thus all other players' objects are enemies (as in GetInteractionType()).
+  // Objects of the gaia player cannot be attacked.
+  units->ForEachUnitInCells(mapCoord.x() - radius, mapCoord.y() - radius, mapCoord.x() + radius, mapCoord.y() + radius, [&](const UnitGrid::Entry& entry) {
+    int unitPlayerIndex = entry.unit->GetPlayerIndex();
+    if (unitPlayerIndex == playerIndex || unitPlayerIndex == kGaiaPlayerIndex) {
+      return;
+    }
+    float squaredDistance = SquaredDistance(entry.unit->GetMapCoord(), mapCoord);
+    if (squaredDistance < closestSquaredDistance ||
+        (squaredDistance == closestSquaredDistance && entry.id < closestId)) {
+      closestSquaredDistance = squaredDistance;
+      closestId = entry.id;
+      *target = entry.unit;
+    }
+  });
+  if (closestId != kInvalidObjectId) {
+    return closestId;
+  }
+  
+  float searchRadius = radius + maxBuildingExtent;
+  int minCellX = std::max(0, static_cast<int>((mapCoord.x() - searchRadius) / kCellSize));
+  int minCellY = std::max(0, static_cast<int>((mapCoord.y() - searchRadius) / kCellSize));
+  int maxCellX = std::min(cellsX - 1, static_cast<int>((mapCoord.x() + searchRadius) / kCellSize));
+  int maxCellY = std::min(cellsY - 1, static_cast<int>((mapCoord.y() + searchRadius) / kCellSize));
+  for (int enemyIndex = 0; enemyIndex < static_cast<int>(playerBuildingCells.size()); ++ enemyIndex) {
+    if (enemyIndex == playerIndex || playerBuildingCells[enemyIndex].empty()) {
+      continue;
+    }
+    
+    for (int cellY = minCellY; cellY <= maxCellY; ++ cellY) {
+      for (int cellX = minCellX; cellX <= maxCellX; ++ cellX) {
+        for (const Entry& entry : playerBuildingCells[enemyIndex][cellX + cellsX * cellY]) {
+          float dx = std::max(0.f, std::max(entry.minX - static_cast<float>(mapCoord.x()), static_cast<float>(mapCoord.x()) - entry.maxX));
+          float dy = std::max(0.f, std::max(entry.minY - static_cast<float>(mapCoord.y()), static_cast<float>(mapCoord.y()) - entry.maxY));
+          float squaredDistance = dx * dx + dy * dy;
+          if (squaredDistance < closestSquaredDistance ||
+              (squaredDistance == closestSquaredDistance && entry.id < closestId)) {
+            closestSquaredDistance = squaredDistance;
+            closestId = entry.id;
+            *target = entry.building;
+          }
+        }
+      }
+    }
+  }
+  return closestId;
+}
+
+TargetIndex::Entry TargetIndex::MakeEntry(u32 id, ServerBuilding* building) {
+  Entry entry;
+  entry.id = id;
+  entry.building = building;
+  const QSize& size = GetBuildingSize(building->GetType());
+  entry.minX = building->GetBaseTile().x();
+  entry.minY = building->GetBaseTile().y();
+  entry.maxX = building->GetBaseTile().x() + size.width();
+  entry.maxY = building->GetBaseTile().y() + size.height();
+  return entry;
+}
@@ -0,0 +1,81 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <QPointF>
+
+#include "FreeAge/common/free_age.hpp"
+
+class ServerBuilding;
+class ServerObject;
+class UnitGrid;
+
+/// Spatial index of the attackable objects (units and buildings) of each player, used to
+/// find targets for units that automatically attack enemies in their line of sight.
+///
+/// The units are looked up in the map's UnitGrid. The buildings of each player are stored
+/// in a uniform grid of cells, which is updated when buildings are added or removed (see
+/// ServerMap::AddBuilding(), ServerMap::AddBuildingTarget(), and ServerMap::DeleteObject()).
+/// Since buildings do not move, the index never needs to be rebuilt.
+class TargetIndex {
+ public:
+  /// Creates an empty index for a map with the given size in tiles, which looks up the units in the given grid.
+  TargetIndex(int mapWidth, int mapHeight, const UnitGrid* units);
+  
+  /// Adds the given building. Buildings of the gaia player are not indexed.
+  void AddBuilding(u32 id, ServerBuilding* building);
+  
+  /// Removes the given building. Does nothing if the building is not in the index.
+  void RemoveBuilding(ServerBuilding* building);
+  
+  /// Returns the ID of the object that is closest to mapCoord within the given radius,
+  /// considering only objects which the given player can attack. Units are preferred:
+  /// a building is only returned if there is no such unit within the radius. The distance
+  /// to a building is measured to the closest point of its area. Objects with the same
+  /// distance are ordered by their IDs, such that the result does not depend on the order
+  /// of the objects. Returns kInvalidObjectId if there is no such object. If an object is
+  /// found, it is returned in target.
+  u32 FindTarget(int playerIndex, const QPointF& mapCoord, float radius, ServerObject** target) const;
+  
+ private:
+  /// Size of the grid cells in map tiles. This should be in the order of the units' line of sight.
+  static constexpr float kCellSize = 4;
+  
+  struct Entry {
+    /// The area of the building.
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+    
+    u32 id;
+    ServerBuilding* building;
+  };
+  
+  inline int GetCellIndex(const QPointF& mapCoord) const {
+    int cellX = std::max(0, std::min(cellsX - 1, static_cast<int>(mapCoord.x() / kCellSize)));
+    int cellY = std::max(0, std::min(cellsY - 1, static_cast<int>(mapCoord.y() / kCellSize)));
+    return cellX + cellsX * cellY;
+  }
+  
+  /// Returns the entry for the given building. Its grid cell is the one that contains the entry's center.
+  static Entry MakeEntry(u32 id, ServerBuilding* building);
+  
+  
+  int cellsX;
+  int cellsY;
+  
+  const UnitGrid* units;
+  
+  /// For each player, the buildings in each cell (indexed by GetCellIndex()).
+  /// The cells of a player are allocated when the first building of the player is added.
+  std::vector<std::vector<std::vector<Entry>>> playerBuildingCells;
+  
+  /// Maximum distance of any point of an indexed building's area from its center along either axis.
+  float maxBuildingExtent = 0;
+};
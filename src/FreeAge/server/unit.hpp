@@ -55,8 +55,13 @@ class ServerUnit : public ServerObject {
   inline float GetCarriedResourceAmountInternalFloat() const { return carriedResourceAmount; }
   inline void SetCarriedResourceAmount(float amount) { carriedResourceAmount = amount; }
   
-  // TODO: Load this from some database for each unit type
-  inline float GetMoveSpeed() const { return (type == UnitType::Scout) ? 2.f : 1.f; }
+  inline float GetMoveSpeed() const { return GetUnitMoveSpeed(type); }
+  
+  /// Makes the unit look for enemies to attack in its next game step (if it is idle),
+  /// rather than waiting for its next periodic scan. See Game::TryAutoAttack().
+  inline void RequestTargetScan() { targetScanRequested = true; }
+  inline bool IsTargetScanRequested() const { return targetScanRequested; }
+  inline void ClearTargetScanRequest() { targetScanRequested = false; }
   
  private:
   void SetTargetInternal(u32 targetObjectId, ServerObject* targetObject, bool isManualTargeting);
@@ -104,6 +109,9 @@ class ServerUnit : public ServerObject {
   
   // Type of resources carried (for villagers).
   ResourceType carriedResourceType = ResourceType::NumTypes;
+  
+  /// Whether the unit should look for enemies to attack in its next game step.
+  bool targetScanRequested = false;
 };
 
 /// Convenience function to cast a ServerUnit to a ServerObject.
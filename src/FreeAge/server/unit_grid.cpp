@@ -0,0 +1,50 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "FreeAge/server/unit_grid.hpp"
+
+#include <cmath>
+
+#include "FreeAge/common/logging.hpp"
+#include "FreeAge/server/unit.hpp"
+
+UnitGrid::UnitGrid(int mapWidth, int mapHeight)
+    : cellsX(std::max(1, static_cast<int>(std::ceil(mapWidth / kCellSize)))),
+      cellsY(std::max(1, static_cast<int>(std::ceil(mapHeight / kCellSize)))),
+      cells(cellsX * cellsY) {}
+
+void UnitGrid::Add(u32 id, ServerUnit* unit) {
+  cells[GetCellIndex(unit->GetMapCoord())].push_back({id, unit});
+  maxUnitRadius = std::max(maxUnitRadius, GetUnitRadius(unit->GetType()));
+}
+
+void UnitGrid::Remove(ServerUnit* unit) {
+  RemoveFromCell(GetCellIndex(unit->GetMapCoord()), unit);
+}
+
+void UnitGrid::Move(ServerUnit* unit, const QPointF& oldMapCoord) {
+  // The unit's type may have changed since it was added (e.g., for villagers), which may change its radius.
+  maxUnitRadius = std::max(maxUnitRadius, GetUnitRadius(unit->GetType()));
+  
+  int oldCellIndex = GetCellIndex(oldMapCoord);
+  int newCellIndex = GetCellIndex(unit->GetMapCoord());
+  if (oldCellIndex != newCellIndex) {
+    u32 id = RemoveFromCell(oldCellIndex, unit);
+    cells[newCellIndex].push_back({id, unit});
+  }
+}
+
+u32 UnitGrid::RemoveFromCell(int cellIndex, ServerUnit* unit) {
+  std::vector<Entry>& cell = cells[cellIndex];
+  for (usize i = 0; i < cell.size(); ++ i) {
+    if (cell[i].unit == unit) {
+      u32 id = cell[i].id;
+      cell[i] = cell.back();
+      cell.pop_back();
+      return id;
+    }
+  }
+  LOG(ERROR) << "The unit was not found in its grid cell";
+  return kInvalidObjectId;
+}
@@ -0,0 +1,82 @@
+// Copyright 2020 The FreeAge authors
+// This file is part of FreeAge, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <QPointF>
+
+#include "FreeAge/common/free_age.hpp"
+
+class ServerUnit;
+
+/// Uniform grid of the units on the map, which allows to find the units close to a point
+/// without visiting all objects. It is updated incrementally whenever a unit is added,
+/// moves, or is removed (see ServerMap::AddUnit(), ServerMap::MoveUnit(), and
+/// ServerMap::DeleteObject()), such that units that do not move do not cost anything.
+class UnitGrid {
+ public:
+  struct Entry {
+    u32 id;
+    ServerUnit* unit;
+  };
+  
+  /// Creates an empty grid for a map with the given size in tiles.
+  UnitGrid(int mapWidth, int mapHeight);
+  
+  /// Adds the unit at its current map coordinate.
+  void Add(u32 id, ServerUnit* unit);
+  
+  /// Removes the unit. Its map coordinate must not have changed since it was added or moved.
+  void Remove(ServerUnit* unit);
+  
+  /// Updates the grid for a unit that moved from oldMapCoord to its current map coordinate.
+  void Move(ServerUnit* unit, const QPointF& oldMapCoord);
+  
+  /// Calls callback(const Entry&) for all units in the grid cells that intersect the given
+  /// rectangle. This includes units outside of the rectangle, so the callback must test
+  /// the units' map coordinates if required. Within each cell, the units are in no particular
+  /// order, but the order only depends on the sequence of updates to the grid.
+  template <typename Callback>
+  void ForEachUnitInCells(float minX, float minY, float maxX, float maxY, Callback callback) const {
+    int minCellX = std::max(0, static_cast<int>(minX / kCellSize));
+    int minCellY = std::max(0, static_cast<int>(minY / kCellSize));
+    int maxCellX = std::min(cellsX - 1, static_cast<int>(maxX / kCellSize));
+    int maxCellY = std::min(cellsY - 1, static_cast<int>(maxY / kCellSize));
+    for (int cellY = minCellY; cellY <= maxCellY; ++ cellY) {
+      for (int cellX = minCellX; cellX <= maxCellX; ++ cellX) {
+        for (const Entry& entry : cells[cellX + cellsX * cellY]) {
+          callback(entry);
+        }
+      }
+    }
+  }
+  
+  /// Returns the largest radius of the units that were added to the grid.
+  inline float GetMaxUnitRadius() const { return maxUnitRadius; }
+  
+ private:
+  /// Size of the grid cells in map tiles.
+  static constexpr float kCellSize = 4;
+  
+  inline int GetCellIndex(const QPointF& mapCoord) const {
+    int cellX = std::max(0, std::min(cellsX - 1, static_cast<int>(mapCoord.x() / kCellSize)));
+    int cellY = std::max(0, std::min(cellsY - 1, static_cast<int>(mapCoord.y() / kCellSize)));
+    return cellX + cellsX * cellY;
+  }
+  
+  /// Removes the unit from the given cell and returns its ID.
+  u32 RemoveFromCell(int cellIndex, ServerUnit* unit);
+  
+  
+  int cellsX;
+  int cellsY;
+  
+  /// The units in each cell, indexed by GetCellIndex().
+  std::vector<std::vector<Entry>> cells;
+  
+  float maxUnitRadius = 0;
+};
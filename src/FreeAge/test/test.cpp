@@ -2,12 +2,50 @@
 // This file is part of FreeAge, licensed under the new BSD license.
 // See the COPYING file in the project root for the license text.
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
 #include <gtest/gtest.h>
 #include <QApplication>
+#include <QFont>
 
 #include "FreeAge/common/logging.hpp"
 #include "FreeAge/common/player.hpp"
+#include "FreeAge/common/stats_database.hpp"
+#include "FreeAge/common/timing.hpp"
+#include "FreeAge/common/util.hpp"
+#include "FreeAge/common/worker_pool.hpp"
+#include "FreeAge/client/asset_bundle.hpp"
+#include "FreeAge/client/glyph_atlas.hpp"
 #include "FreeAge/client/map.hpp"
+#include "FreeAge/client/mapped_file.hpp"
+#include "FreeAge/client/minimap.hpp"
+#include "FreeAge/client/spatial_index.hpp"
+#include "FreeAge/client/sprite.hpp"
+#include "FreeAge/client/sprite_atlas.hpp"
+#include "FreeAge/client/sprite_decode.hpp"
+#include "FreeAge/client/sprite_vertex_arena.hpp"
+#include "FreeAge/client/static_sprite_buffer.hpp"
+#include "FreeAge/client/texture.hpp"
+#include "FreeAge/client/ui_renderer.hpp"
+#include "FreeAge/server/building.hpp"
+#include "FreeAge/server/crowd_steering.hpp"
+#include "FreeAge/server/map.hpp"
+#include "FreeAge/server/object_scheduler.hpp"
+#include "FreeAge/server/occupancy_grid.hpp"
+#include "FreeAge/server/path_cache.hpp"
+#include "FreeAge/server/pathfinding.hpp"
+#include "FreeAge/server/step_profiler.hpp"
+#include "FreeAge/server/target_index.hpp"
+#include "FreeAge/server/unit.hpp"
+#include "RectangleBinPack/MaxRectsBinPack.h"
 
 int main(int argc, char** argv) {
   // Initialize loguru
@@ -81,6 +119,100 @@ TEST(Map, CoordinateConversion_HillyMap) {
   TestProjectedCoordToMapCoord(testMap);
 }
 
+/// Reference implementation of Map::UpdateFieldOfView() that tests each tile's distance to the center.
+static void UpdateFieldOfViewReference(std::vector<int>* viewCount, int width, int height, float centerMapCoordX, float centerMapCoordY, float radius, int change) {
+  float effectiveRadius = radius + 0.7f;
+  for (int y = 0; y < height; ++ y) {
+    for (int x = 0; x < width; ++ x) {
+      float dx = x - (centerMapCoordX - 0.5f);
+      float dy = y - (centerMapCoordY - 0.5f);
+      if (dx * dx + dy * dy <= effectiveRadius * effectiveRadius) {
+        int& value = (*viewCount)[y * width + x];
+        value = ((value == -1) ? 0 : value) + change;
+      }
+    }
+  }
+}
+
+TEST(Map, FieldOfViewMatchesReference) {
+  constexpr int kMapWidth = 50;
+  constexpr int kMapHeight = 40;
+  Map testMap(kMapWidth, kMapHeight);
+  std::vector<int> reference(kMapWidth * kMapHeight, -1);
+  
+  auto expectEqualViewCounts = [&]() {
+    for (int y = 0; y < kMapHeight; ++ y) {
+      for (int x = 0; x < kMapWidth; ++ x) {
+        ASSERT_EQ(reference[y * kMapWidth + x], testMap.viewCountAt(x, y)) << "at tile (" << x << ", " << y << ")";
+      }
+    }
+  };
+  
+  // Units (at tile centers) and buildings (at tile centers or corners), including some at the map borders.
+  testMap.UpdateFieldOfView(10.5f, 10.5f, 4, 1);
+  UpdateFieldOfViewReference(&reference, kMapWidth, kMapHeight, 10.5f, 10.5f, 4, 1);
+  testMap.UpdateFieldOfView(20.f, 15.f, 8, 1);
+  UpdateFieldOfViewReference(&reference, kMapWidth, kMapHeight, 20.f, 15.f, 8, 1);
+  testMap.UpdateFieldOfView(0.5f, 39.5f, 6, 1);
+  UpdateFieldOfViewReference(&reference, kMapWidth, kMapHeight, 0.5f, 39.5f, 6, 1);
+  testMap.UpdateFieldOfView(20.f, 15.f, 8, -1);
+  UpdateFieldOfViewReference(&reference, kMapWidth, kMapHeight, 20.f, 15.f, 8, -1);
+  expectEqualViewCounts();
+  
+  // Moving a field-of-view must be equivalent to removing and re-adding it.
+  int tileX = 10;
+  int tileY = 10;
+  const int moves[][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {5, -3}, {-30, 2}, {40, 25}};
+  for (const auto& move : moves) {
+    int newTileX = std::max(0, std::min(kMapWidth - 1, tileX + move[0]));
+    int newTileY = std::max(0, std::min(kMapHeight - 1, tileY + move[1]));
+    testMap.MoveFieldOfView(tileX + 0.5f, tileY + 0.5f, newTileX + 0.5f, newTileY + 0.5f, 4);
+    UpdateFieldOfViewReference(&reference, kMapWidth, kMapHeight, tileX + 0.5f, tileY + 0.5f, 4, -1);
+    UpdateFieldOfViewReference(&reference, kMapWidth, kMapHeight, newTileX + 0.5f, newTileY + 0.5f, 4, 1);
+    tileX = newTileX;
+    tileY = newTileY;
+    expectEqualViewCounts();
+  }
+}
+
+TEST(Minimap, IncrementalUpdate) {
+  constexpr int kMapWidth = 40;
+  constexpr int kMapHeight = 30;
+  Map testMap(kMapWidth, kMapHeight);
+  std::vector<QRgb> playerColors = {qRgb(255, 0, 0)};
+  
+  // The first update must compute the whole image.
+  Minimap minimap;
+  std::vector<QRect> changedRects;
+  minimap.UpdateImage(&testMap, playerColors, &changedRects);
+  ASSERT_EQ(1u, changedRects.size());
+  EXPECT_EQ(QRect(0, 0, kMapWidth, kMapHeight), changedRects[0]);
+  
+  // Without changes, nothing needs to be updated.
+  changedRects.clear();
+  minimap.UpdateImage(&testMap, playerColors, &changedRects);
+  EXPECT_TRUE(changedRects.empty());
+  
+  // Uncovering a part of the map must only update this part.
+  testMap.UpdateFieldOfView(10.5f, 10.5f, 3, 1);
+  minimap.UpdateImage(&testMap, playerColors, &changedRects);
+  ASSERT_FALSE(changedRects.empty());
+  QRect boundingRect;
+  for (const QRect& rect : changedRects) {
+    boundingRect |= rect;
+  }
+  EXPECT_TRUE(boundingRect.contains(QRect(8, 8, 5, 5)));
+  EXPECT_LT(boundingRect.width(), 10);
+  EXPECT_LT(boundingRect.height(), 10);
+  
+  // A change of the elevation requires a full update.
+  testMap.ElevationChanged(QRect(0, 0, kMapWidth + 1, kMapHeight + 1));
+  changedRects.clear();
+  minimap.UpdateImage(&testMap, playerColors, &changedRects);
+  ASSERT_EQ(1u, changedRects.size());
+  EXPECT_EQ(QRect(0, 0, kMapWidth, kMapHeight), changedRects[0]);
+}
+
 TEST(PlayerStats, Operations) {
 
   PlayerStats stats;
@@ -112,4 +244,1240 @@ TEST(PlayerStats, Operations) {
   EXPECT_EQ(stats.GetBuildingTypeCount(BuildingType::Barracks), 0);
   EXPECT_TRUE(stats.GetBuildingTypeExisted(BuildingType::Barracks));
 
-}
\ No newline at end of file
+}
+
+TEST(SpriteAtlas, PackRectsWithAutomaticSize) {
+  srand(0);
+  
+  std::vector<rbp::RectSize> rects(300);
+  for (rbp::RectSize& rect : rects) {
+    rect.width = 10 + rand() % 150;
+    rect.height = 10 + rand() % 200;
+  }
+  
+  constexpr int kMaxExtent = 4096;
+  int width;
+  int height;
+  std::vector<rbp::Rect> packedRects;
+  std::vector<int> packedRectIndices;
+  auto expectValidPacking = [&](const std::vector<rbp::RectSize>& rects, int maxExtent) {
+    ASSERT_EQ(rects.size(), packedRects.size());
+    ASSERT_EQ(rects.size(), packedRectIndices.size());
+    EXPECT_LE(width, maxExtent);
+    EXPECT_LE(height, maxExtent);
+    
+    rbp::DisjointRectCollection disjointRects;
+    std::vector<bool> indexUsed(rects.size(), false);
+    for (usize i = 0; i < packedRects.size(); ++ i) {
+      const rbp::Rect& packed = packedRects[i];
+      EXPECT_TRUE(disjointRects.Add(packed));
+      EXPECT_GE(packed.x, 0);
+      EXPECT_GE(packed.y, 0);
+      EXPECT_LE(packed.x + packed.width, width);
+      EXPECT_LE(packed.y + packed.height, height);
+      
+      int index = packedRectIndices[i];
+      ASSERT_GE(index, 0);
+      ASSERT_LT(index, static_cast<int>(rects.size()));
+      EXPECT_FALSE(indexUsed[index]);
+      indexUsed[index] = true;
+      EXPECT_EQ(rects[index].width, packed.width);
+      EXPECT_EQ(rects[index].height, packed.height);
+    }
+  };
+  
+  ASSERT_TRUE(PackRectsWithAutomaticSize(rects, kMaxExtent, /*finalPackWithMaxRects*/ false, &width, &height, &packedRects, &packedRectIndices));
+  expectValidPacking(rects, kMaxExtent);
+  int skylineHeight = height;
+  
+  // The final packing with MaxRects keeps the width and does not increase the height.
+  ASSERT_TRUE(PackRectsWithAutomaticSize(rects, kMaxExtent, /*finalPackWithMaxRects*/ true, &width, &height, &packedRects, &packedRectIndices));
+  expectValidPacking(rects, kMaxExtent);
+  EXPECT_LE(height, skylineHeight);
+  
+  // Packing must fail if the rects do not fit into the maximum extent.
+  EXPECT_FALSE(PackRectsWithAutomaticSize(rects, width / 2, /*finalPackWithMaxRects*/ false, &width, &height, &packedRects, &packedRectIndices));
+  
+  // Three squares need a wider area than estimated from their total area, since only
+  // one fits into each row at that width. They fit into the maximum extent with two per row.
+  std::vector<rbp::RectSize> squares(3, rbp::RectSize{50, 50});
+  ASSERT_TRUE(PackRectsWithAutomaticSize(squares, 100, /*finalPackWithMaxRects*/ false, &width, &height, &packedRects, &packedRectIndices));
+  expectValidPacking(squares, 100);
+}
+
+/// Compares the atlas packing approaches on the frame sizes of real sprites.
+/// The frame sizes are read from the sprite atlas cache files in the directory
+/// given by the FREEAGE_ATLAS_CACHE_DIR environment variable. Run with:
+/// FreeAgeTest --gtest_also_run_disabled_tests --gtest_filter=SpriteAtlas.DISABLED_PackingBenchmark
+TEST(SpriteAtlas, DISABLED_PackingBenchmark) {
+  const char* cacheDir = getenv("FREEAGE_ATLAS_CACHE_DIR");
+  if (cacheDir == nullptr) {
+    LOG(WARNING) << "FREEAGE_ATLAS_CACHE_DIR is not set, skipping the benchmark.";
+    return;
+  }
+  
+  int numAtlases = 0;
+  double legacyArea = 0;
+  double skylineArea = 0;
+  double maxRectsArea = 0;
+  
+  for (const auto& entry : std::filesystem::directory_iterator(cacheDir)) {
+    std::string extension = entry.path().extension().string();
+    if (extension != ".graphic" && extension != ".shadow") {
+      continue;
+    }
+    std::vector<rbp::RectSize> rects;
+    if (!ReadSpriteAtlasCacheRectSizes(entry.path().string().c_str(), &rects) || rects.size() <= 1) {
+      continue;
+    }
+    ++ numAtlases;
+    
+    // The approach that was used previously: a binary search over square sizes with MaxRects.
+    Timer legacyTimer("PackingBenchmark - legacy binary search with MaxRects");
+    int textureSize = 2048;
+    int largestTooSmallSize = -1;
+    int smallestAcceptableSize = -1;
+    for (int attempt = 0; attempt < 8; ++ attempt) {
+      std::vector<rbp::RectSize> remainingRects = rects;
+      std::vector<rbp::Rect> packedRects;
+      std::vector<int> packedRectIndices;
+      rbp::MaxRectsBinPack packer(textureSize, textureSize, /*allowFlip*/ false);
+      packer.Insert(remainingRects, packedRects, packedRectIndices, rbp::MaxRectsBinPack::RectBottomLeftRule);
+      if (!remainingRects.empty()) {
+        largestTooSmallSize = textureSize;
+        textureSize = (smallestAcceptableSize >= 0) ? ((largestTooSmallSize + smallestAcceptableSize) / 2) : (2 * largestTooSmallSize);
+      } else {
+        smallestAcceptableSize = textureSize;
+        textureSize = (largestTooSmallSize + smallestAcceptableSize) / 2;
+      }
+    }
+    legacyTimer.Stop();
+    legacyArea += smallestAcceptableSize * static_cast<double>(smallestAcceptableSize);
+    
+    int width;
+    int height;
+    std::vector<rbp::Rect> packedRects;
+    std::vector<int> packedRectIndices;
+    Timer timer("PackingBenchmark - skyline");
+    EXPECT_TRUE(PackRectsWithAutomaticSize(rects, /*maxExtent*/ 65535, /*finalPackWithMaxRects*/ false, &width, &height, &packedRects, &packedRectIndices));
+    timer.Stop();
+    skylineArea += width * static_cast<double>(height);
+    
+    Timer maxRectsTimer("PackingBenchmark - skyline with final MaxRects packing");
+    EXPECT_TRUE(PackRectsWithAutomaticSize(rects, /*maxExtent*/ 65535, /*finalPackWithMaxRects*/ true, &width, &height, &packedRects, &packedRectIndices));
+    maxRectsTimer.Stop();
+    maxRectsArea += width * static_cast<double>(height);
+  }
+  
+  LOG(INFO) << "Number of atlases: " << numAtlases;
+  LOG(INFO) << "Total atlas area (megapixels): legacy: " << (legacyArea / 1e6)
+            << ", skyline: " << (skylineArea / 1e6)
+            << ", skyline with final MaxRects packing: " << (maxRectsArea / 1e6);
+  LOG(INFO) << Timing::print(kSortByTotal);
+}
+
+/// Creates a synthetic SMX graphic layer with random drawing commands and pixel data.
+/// The returned layer header and row edges include the given pixel border, as in LoadSMXLayer().
+static void CreateSyntheticSMXGraphicLayer(
+    int width, int height, int pixelBorder, bool usesEightToFiveCompression,
+    SMXLayerHeader* layerHeader, std::vector<SMPLayerRowEdge>* rowEdges, std::vector<u8>* commandArray, std::vector<u8>* pixelArray) {
+  layerHeader->width = width + 2 * pixelBorder;
+  layerHeader->height = height + 2 * pixelBorder;
+  rowEdges->resize(layerHeader->height);
+  commandArray->clear();
+  
+  int numPalettedPixels = 0;
+  for (int row = 0; row < layerHeader->height; ++ row) {
+    SMPLayerRowEdge& edge = (*rowEdges)[row];
+    if (row < pixelBorder || row >= height + pixelBorder || rand() % 10 == 0) {
+      edge.leftSpace = 0xFFFF;
+      edge.rightSpace = 0xFFFF;
+      continue;
+    }
+    edge.leftSpace = rand() % (width / 4);
+    edge.rightSpace = rand() % (width / 4);
+    
+    int remaining = width - edge.leftSpace - edge.rightSpace;
+    while (remaining > 0) {
+      int count = 1 + rand() % std::min(64, remaining);
+      int commandCode = rand() % 3;
+      commandArray->push_back(((count - 1) << 2) | commandCode);
+      if (commandCode != 0b00) {
+        numPalettedPixels += count;
+      }
+      remaining -= count;
+    }
+    commandArray->push_back(0b11);
+  }
+  
+  int pixelsPerBlock = usesEightToFiveCompression ? 2 : 4;
+  pixelArray->resize(5 * ((numPalettedPixels + pixelsPerBlock - 1) / pixelsPerBlock));
+  for (u8& value : *pixelArray) {
+    value = rand() % 256;
+  }
+}
+
+/// Decodes an SMX graphic layer pixel by pixel, as the sprite loader did before DecodeSMXGraphicLayer() was introduced.
+static void DecodeSMXGraphicLayerReference(
+    const SMXLayerHeader& layerHeader, const std::vector<SMPLayerRowEdge>& rowEdges, bool usesEightToFiveCompression, int pixelBorder,
+    const Palette& standardPalette, const std::vector<u8>& commandArray, const std::vector<u8>& pixelArray, std::vector<QRgb>* result) {
+  result->resize(layerHeader.width * layerHeader.height);
+  QRgb* out = result->data();
+  
+  const u8* commandPtr = commandArray.data();
+  const u8* pixelPtr = pixelArray.data();
+  int decompressionState = 0;
+  for (int row = 0; row < layerHeader.height; ++ row) {
+    const SMPLayerRowEdge& edge = rowEdges[row];
+    if (edge.leftSpace == 0xFFFF || edge.rightSpace == 0xFFFF) {
+      for (int col = 0; col < layerHeader.width; ++ col) {
+        *out++ = qRgba(0, 0, 0, 0);
+      }
+      continue;
+    }
+    
+    int col = 0;
+    for (; col < edge.leftSpace + pixelBorder; ++ col) {
+      *out++ = qRgba(0, 0, 0, 0);
+    }
+    
+    while (true) {
+      u8 command = *commandPtr++;
+      u8 commandCode = command & 0b11;
+      u8 count = (command >> 2) + 1;
+      if (commandCode == 0b00) {
+        for (int i = 0; i < count; ++ i) {
+          *out++ = qRgba(0, 0, 0, 0);
+        }
+        col += count;
+      } else if (commandCode == 0b01 || commandCode == 0b10) {
+        const Palette* palette = (commandCode == 0b01) ? &standardPalette : nullptr;
+        for (int i = 0; i < count; ++ i) {
+          *out++ = usesEightToFiveCompression ?
+                   DecompressNextPixel8To5(pixelPtr, decompressionState, palette, true) :
+                   DecompressNextPixel4Plus1(pixelPtr, decompressionState, palette, true);
+        }
+        col += count;
+      } else {
+        for (; col < layerHeader.width; ++ col) {
+          *out++ = qRgba(0, 0, 0, 0);
+        }
+        break;
+      }
+    }
+  }
+}
+
+TEST(SMXDecoder, MatchesReferenceDecoder) {
+  srand(0);
+  
+  Palette palette(1024);
+  for (QRgb& color : palette) {
+    color = qRgba(rand() % 256, rand() % 256, rand() % 256, rand() % 256);
+  }
+  
+  SMXDecoderISA bestISA = GetBestSMXDecoderISA();
+  for (int isa = 0; isa <= static_cast<int>(bestISA); ++ isa) {
+    SetSMXDecoderISA(static_cast<SMXDecoderISA>(isa));
+    SCOPED_TRACE(GetSMXDecoderISAName(GetSMXDecoderISA()));
+    
+    for (int eightToFive = 0; eightToFive < 2; ++ eightToFive) {
+      // Decode random pixel runs with DecompressSMXPixels(), in all combinations of palettes and alpha handling.
+      std::vector<u8> pixelArray(5 * 1000);
+      for (u8& value : pixelArray) {
+        value = rand() % 256;
+      }
+      for (int ignoreAlpha = 0; ignoreAlpha < 2; ++ ignoreAlpha) {
+        for (const Palette* runPalette : {static_cast<const Palette*>(&palette), static_cast<const Palette*>(nullptr)}) {
+          const u8* referencePtr = pixelArray.data();
+          int referenceState = 0;
+          const u8* pixelPtr = pixelArray.data();
+          int decompressionState = 0;
+          
+          int numPixels = (eightToFive ? 2 : 4) * 1000;
+          while (numPixels > 0) {
+            int count = std::min(numPixels, 1 + rand() % 64);
+            std::vector<QRgb> reference(count);
+            for (int i = 0; i < count; ++ i) {
+              reference[i] = eightToFive ?
+                             DecompressNextPixel8To5(referencePtr, referenceState, runPalette, ignoreAlpha) :
+                             DecompressNextPixel4Plus1(referencePtr, referenceState, runPalette, ignoreAlpha);
+            }
+            
+            std::vector<QRgb> decoded(count);
+            ASSERT_TRUE(DecompressSMXPixels(eightToFive, pixelPtr, pixelArray.data() + pixelArray.size(), decompressionState, count, runPalette, ignoreAlpha, decoded.data()));
+            ASSERT_EQ(reference, decoded);
+            ASSERT_EQ(referencePtr, pixelPtr);
+            ASSERT_EQ(referenceState, decompressionState);
+            numPixels -= count;
+          }
+          
+          // Reading beyond the end of the pixel array must fail.
+          EXPECT_FALSE(DecompressSMXPixels(eightToFive, pixelPtr, pixelArray.data() + pixelArray.size(), decompressionState, 1, runPalette, ignoreAlpha, nullptr));
+        }
+      }
+      
+      // Decode a whole synthetic layer into a destination with a larger stride, as for a texture atlas.
+      constexpr int kPixelBorder = 1;
+      SMXLayerHeader layerHeader;
+      std::vector<SMPLayerRowEdge> rowEdges;
+      std::vector<u8> commandArray;
+      CreateSyntheticSMXGraphicLayer(300, 200, kPixelBorder, eightToFive, &layerHeader, &rowEdges, &commandArray, &pixelArray);
+      
+      std::vector<QRgb> reference;
+      DecodeSMXGraphicLayerReference(layerHeader, rowEdges, eightToFive, kPixelBorder, palette, commandArray, pixelArray, &reference);
+      
+      constexpr int kAtlasPadding = 7;
+      const int destStride = layerHeader.width + kAtlasPadding;
+      std::vector<QRgb> atlas(destStride * layerHeader.height, qRgba(1, 2, 3, 4));
+      ASSERT_TRUE(DecodeSMXGraphicLayer(
+          layerHeader, rowEdges, eightToFive, kPixelBorder, palette,
+          commandArray.data(), commandArray.size(), pixelArray.data(), pixelArray.size(),
+          atlas.data(), destStride));
+      for (int y = 0; y < layerHeader.height; ++ y) {
+        for (int x = 0; x < destStride; ++ x) {
+          QRgb expected = (x < layerHeader.width) ? reference[x + y * layerHeader.width] : qRgba(1, 2, 3, 4);
+          ASSERT_EQ(expected, atlas[x + y * destStride]) << "x: " << x << ", y: " << y;
+        }
+      }
+    }
+  }
+  
+  SetSMXDecoderISA(bestISA);
+}
+
+/// Measures the SMX decoding throughput of the different instruction sets on synthetic data. Run with:
+/// FreeAgeTest --gtest_also_run_disabled_tests --gtest_filter=SMXDecoder.DISABLED_ThroughputBenchmark
+TEST(SMXDecoder, DISABLED_ThroughputBenchmark) {
+  srand(0);
+  
+  Palette palette(1024);
+  for (QRgb& color : palette) {
+    color = qRgba(rand() % 256, rand() % 256, rand() % 256, 255);
+  }
+  
+  constexpr int kNumIterations = 20;
+  constexpr int kPixelBorder = 1;
+  
+  SMXDecoderISA bestISA = GetBestSMXDecoderISA();
+  for (int eightToFive = 0; eightToFive < 2; ++ eightToFive) {
+    SMXLayerHeader layerHeader;
+    std::vector<SMPLayerRowEdge> rowEdges;
+    std::vector<u8> commandArray;
+    std::vector<u8> pixelArray;
+    CreateSyntheticSMXGraphicLayer(1024, 1024, kPixelBorder, eightToFive, &layerHeader, &rowEdges, &commandArray, &pixelArray);
+    std::vector<QRgb> dest(layerHeader.width * layerHeader.height);
+    
+    for (int isa = 0; isa <= static_cast<int>(bestISA); ++ isa) {
+      SetSMXDecoderISA(static_cast<SMXDecoderISA>(isa));
+      
+      TimePoint startTime = Clock::now();
+      for (int iteration = 0; iteration < kNumIterations; ++ iteration) {
+        EXPECT_TRUE(DecodeSMXGraphicLayer(
+            layerHeader, rowEdges, eightToFive, kPixelBorder, palette,
+            commandArray.data(), commandArray.size(), pixelArray.data(), pixelArray.size(),
+            dest.data(), layerHeader.width));
+      }
+      double seconds = SecondsDuration(Clock::now() - startTime).count();
+      
+      LOG(INFO) << (eightToFive ? "8to5" : "4plus1") << ", " << GetSMXDecoderISAName(static_cast<SMXDecoderISA>(isa)) << ": "
+                << (kNumIterations * dest.size() / seconds / 1e6) << " megapixels/s";
+    }
+  }
+  
+  SetSMXDecoderISA(bestISA);
+}
+
+TEST(MappedFile, BoundsCheckedReading) {
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "freeage_mapped_file_test.bin";
+  {
+    std::ofstream stream(path, std::ios::binary);
+    u32 header[2] = {0x12345678, 3};
+    stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+    stream.write("abc", 3);
+  }
+  
+  MappedFile file;
+  ASSERT_TRUE(file.Open(QString::fromStdString(path.string())));
+  ASSERT_EQ(11u, file.size());
+  
+  ByteReader reader(file.data(), file.size());
+  u32 magic;
+  u32 length;
+  EXPECT_TRUE(reader.Read(&magic));
+  EXPECT_EQ(0x12345678u, magic);
+  EXPECT_TRUE(reader.Read(&length));
+  EXPECT_EQ(3u, length);
+  
+  // Reading beyond the end must fail without changing the read position.
+  EXPECT_EQ(nullptr, reader.Take(length + 1));
+  EXPECT_FALSE(reader.Read(&magic));
+  EXPECT_EQ(8u, reader.Offset());
+  
+  const u8* text = reader.Take(length);
+  ASSERT_NE(nullptr, text);
+  EXPECT_EQ(0, memcmp(text, "abc", 3));
+  EXPECT_EQ(0u, reader.Remaining());
+  
+  EXPECT_TRUE(reader.Seek(4));
+  EXPECT_FALSE(reader.Seek(12));
+  EXPECT_EQ(4u, reader.Offset());
+  
+  file.Close();
+  std::filesystem::remove(path);
+}
+
+TEST(AssetBundle, WriteAndRead) {
+  std::filesystem::path dataDirPath = std::filesystem::temp_directory_path() / "freeage_asset_bundle_test";
+  std::filesystem::create_directories(dataDirPath / "graphics");
+  std::string compressibleContents(10000, 'x');
+  auto writeFile = [&](const std::filesystem::path& relativePath, const std::string& contents) {
+    std::ofstream stream(dataDirPath / relativePath, std::ios::binary);
+    stream.write(contents.data(), contents.size());
+  };
+  writeFile("graphics/a.smx", "some sprite");
+  writeFile("graphics/b.smx", "some sprite");  // duplicate of a.smx
+  writeFile("graphics/c.png", compressibleContents);
+  
+  std::filesystem::path bundlePath = dataDirPath / "test.fabundle";
+  std::vector<std::filesystem::path> relativePaths = {
+      std::filesystem::path("graphics") / "a.smx",
+      std::filesystem::path("graphics") / "b.smx",
+      std::filesystem::path("graphics") / "c.png"};
+  ASSERT_TRUE(WriteAssetBundle(bundlePath, dataDirPath, relativePaths, /*allowCompression*/ true));
+  
+  AssetBundle bundle;
+  ASSERT_TRUE(bundle.Open(bundlePath));
+  EXPECT_EQ(3u, bundle.GetNumFiles());
+  
+  QByteArray data;
+  ASSERT_TRUE(bundle.GetFile("graphics/a.smx", &data));
+  EXPECT_EQ(QByteArray("some sprite"), data);
+  ASSERT_TRUE(bundle.GetFile("graphics/b.smx", &data));
+  EXPECT_EQ(QByteArray("some sprite"), data);
+  ASSERT_TRUE(bundle.GetFile("graphics/c.png", &data));
+  EXPECT_EQ(QByteArray::fromStdString(compressibleContents), data);
+  EXPECT_FALSE(bundle.GetFile("graphics/d.png", &data));
+  
+  bundle.Close();
+  std::filesystem::remove_all(dataDirPath);
+}
+
+TEST(SpatialIndex, QueryReturnsObjectsNearRect) {
+  SpatialIndex index;
+  index.Initialize(QRectF(0, -1000, 4000, 2000));
+  
+  // Place objects on a regular grid with a spacing of 100.
+  for (int y = 0; y < 20; ++ y) {
+    for (int x = 0; x < 40; ++ x) {
+      index.Insert(y * 40 + x, nullptr, QPointF(100 * x, -1000 + 100 * y), /*extent*/ 10);
+    }
+  }
+  EXPECT_EQ(800u, index.GetNumObjects());
+  
+  auto queryIds = [&](const QRectF& rect) {
+    std::vector<SpatialIndex::Entry> result;
+    index.Query(rect, &result);
+    std::vector<u32> ids;
+    for (const auto& entry : result) {
+      ids.push_back(entry.first);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  };
+  auto contains = [](const std::vector<u32>& ids, u32 id) {
+    return std::binary_search(ids.begin(), ids.end(), id);
+  };
+  
+  // The result must contain all objects whose extent intersects the rect, and should not contain far-away objects.
+  std::vector<u32> ids = queryIds(QRectF(1005, -495, 90, 90));
+  EXPECT_TRUE(contains(ids, 5 * 40 + 10));
+  EXPECT_TRUE(contains(ids, 6 * 40 + 11));
+  EXPECT_FALSE(contains(ids, 15 * 40 + 30));
+  EXPECT_LT(ids.size(), 100u);
+  
+  // Move an object away and remove another one.
+  index.Move(5 * 40 + 10, QPointF(3000, 500), /*extent*/ 10);
+  index.Remove(6 * 40 + 11);
+  ids = queryIds(QRectF(1005, -495, 90, 90));
+  EXPECT_FALSE(contains(ids, 5 * 40 + 10));
+  EXPECT_FALSE(contains(ids, 6 * 40 + 11));
+  EXPECT_TRUE(contains(queryIds(QRectF(2995, 495, 10, 10)), 5 * 40 + 10));
+  EXPECT_EQ(799u, index.GetNumObjects());
+  
+  // Objects with a large extent must be found even if their anchor is far away from the rect.
+  index.Insert(10000, nullptr, QPointF(2000, 0), /*extent*/ 600);
+  EXPECT_TRUE(contains(queryIds(QRectF(2500, 500, 10, 10)), 10000));
+}
+
+TEST(StaticSpriteBuffer, AddUpdateAndRemoveObjects) {
+  constexpr int kVertexSize = 8;
+  Texture textureA;
+  Texture textureB;
+  StaticSpriteBuffer buffer;
+  
+  auto setObject = [&](u32 objectId, int frameIndex, int numShadowVertices, int numGraphicVertices) {
+    StaticSpriteBuffer::ObjectState state = {nullptr, frameIndex, 0xffffffff, 0.f, 0.f};
+    if (!buffer.NeedsUpdate(objectId, state)) {
+      return;
+    }
+    buffer.SetObject(objectId, state);
+    for (int i = 0; i < numShadowVertices; ++ i) {
+      memset(buffer.AddVertex(objectId, StaticSpriteBuffer::Pass::Shadow, &textureA, kVertexSize), objectId, kVertexSize);
+    }
+    for (int i = 0; i < numGraphicVertices; ++ i) {
+      memset(buffer.AddVertex(objectId, StaticSpriteBuffer::Pass::Graphic, (i % 2 == 0) ? &textureA : &textureB, kVertexSize), objectId, kVertexSize);
+    }
+  };
+  
+  for (u32 objectId = 1; objectId <= 10; ++ objectId) {
+    setObject(objectId, 0, 1, 2);
+  }
+  EXPECT_EQ(10u, buffer.GetNumObjects());
+  EXPECT_EQ(10u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Shadow));
+  EXPECT_EQ(20u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Graphic));
+  EXPECT_EQ(0u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::GraphicCausingOutlines));
+  
+  // Objects only need to be updated if their state changes.
+  EXPECT_FALSE(buffer.NeedsUpdate(3, {nullptr, 0, 0xffffffff, 0.f, 0.f}));
+  EXPECT_TRUE(buffer.NeedsUpdate(3, {nullptr, 1, 0xffffffff, 0.f, 0.f}));
+  EXPECT_TRUE(buffer.NeedsUpdate(11, {nullptr, 0, 0xffffffff, 0.f, 0.f}));
+  
+  // Re-writing an object with a different number of vertices replaces its previous vertices.
+  setObject(3, 1, 0, 1);
+  EXPECT_EQ(9u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Shadow));
+  EXPECT_EQ(19u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Graphic));
+  
+  buffer.RemoveObject(1);
+  buffer.RemoveObject(7);
+  buffer.RemoveObject(42);
+  EXPECT_EQ(8u, buffer.GetNumObjects());
+  EXPECT_EQ(7u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Shadow));
+  EXPECT_EQ(15u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Graphic));
+  
+  // The vertex references must have been kept consistent while vertices were moved around:
+  // removing all remaining objects must remove all vertices.
+  for (u32 objectId = 1; objectId <= 10; ++ objectId) {
+    buffer.RemoveObject(objectId);
+  }
+  EXPECT_EQ(0u, buffer.GetNumObjects());
+  EXPECT_EQ(0u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Shadow));
+  EXPECT_EQ(0u, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Graphic));
+}
+
+/// Compares the CPU time for keeping the sprite vertices of a synthetic map with 10k static objects
+/// in a StaticSpriteBuffer with re-writing all of these vertices in each frame. Run with:
+/// FreeAgeTest --gtest_also_run_disabled_tests --gtest_filter=StaticSpriteBuffer.DISABLED_SyntheticMapBenchmark
+TEST(StaticSpriteBuffer, DISABLED_SyntheticMapBenchmark) {
+  constexpr u32 kNumObjects = 10000;
+  constexpr int kNumFrames = 100;
+  constexpr int kVertexSize = 36;
+  Texture shadowTexture;
+  Texture graphicTexture;
+  StaticSpriteBuffer buffer;
+  
+  auto stateForFrame = [](u32 objectId, int frame) {
+    // 1% of the objects change their appearance in each frame (e.g., due to construction progress).
+    int frameIndex = ((objectId + frame) % 100 == 0) ? frame : 0;
+    return StaticSpriteBuffer::ObjectState{nullptr, frameIndex, 0xffffffff, 10.f * (objectId % 100), 10.f * (objectId / 100)};
+  };
+  auto writeObject = [&](u32 objectId, const StaticSpriteBuffer::ObjectState& state) {
+    buffer.SetObject(objectId, state);
+    memset(buffer.AddVertex(objectId, StaticSpriteBuffer::Pass::Shadow, &shadowTexture, kVertexSize), 0, kVertexSize);
+    memset(buffer.AddVertex(objectId, StaticSpriteBuffer::Pass::Graphic, &graphicTexture, kVertexSize), 0, kVertexSize);
+  };
+  
+  for (u32 objectId = 0; objectId < kNumObjects; ++ objectId) {
+    writeObject(objectId, stateForFrame(objectId, 0));
+  }
+  
+  std::vector<u8> streamedVertices(2 * kNumObjects * kVertexSize);
+  Timer streamingTimer("SyntheticMapBenchmark - re-write all vertices per frame");
+  for (int frame = 1; frame <= kNumFrames; ++ frame) {
+    for (u32 objectId = 0; objectId < kNumObjects; ++ objectId) {
+      StaticSpriteBuffer::ObjectState state = stateForFrame(objectId, frame);
+      memset(streamedVertices.data() + 2 * objectId * kVertexSize, state.frameIndex, 2 * kVertexSize);
+    }
+  }
+  streamingTimer.Stop();
+  
+  int numUpdatedObjects = 0;
+  Timer staticTimer("SyntheticMapBenchmark - StaticSpriteBuffer updates per frame");
+  for (int frame = 1; frame <= kNumFrames; ++ frame) {
+    for (u32 objectId = 0; objectId < kNumObjects; ++ objectId) {
+      StaticSpriteBuffer::ObjectState state = stateForFrame(objectId, frame);
+      if (buffer.NeedsUpdate(objectId, state)) {
+        writeObject(objectId, state);
+        ++ numUpdatedObjects;
+      }
+    }
+  }
+  staticTimer.Stop();
+  
+  EXPECT_EQ(kNumObjects, buffer.GetNumObjects());
+  EXPECT_EQ(kNumObjects, buffer.GetNumVertices(StaticSpriteBuffer::Pass::Graphic));
+  LOG(INFO) << "Objects with updated vertices per frame: " << (numUpdatedObjects / static_cast<double>(kNumFrames))
+            << " (of " << kNumObjects << ")";
+  LOG(INFO) << "Vertex bytes per frame: streaming: " << streamedVertices.size()
+            << ", StaticSpriteBuffer: " << (2 * kVertexSize * numUpdatedObjects / kNumFrames);
+  LOG(INFO) << Timing::print(kSortByTotal);
+}
+
+TEST(WorkerPool, ParallelForRunsEachTaskOnce) {
+  WorkerPool pool(4);
+  EXPECT_EQ(4, pool.GetNumThreads());
+  
+  constexpr int kNumTasks = 1000;
+  std::vector<std::atomic<int>> counts(kNumTasks);
+  for (int job = 0; job < 100; ++ job) {
+    pool.ParallelFor(kNumTasks, [&](int taskIndex) {
+      ++ counts[taskIndex];
+    });
+  }
+  for (int taskIndex = 0; taskIndex < kNumTasks; ++ taskIndex) {
+    EXPECT_EQ(100, counts[taskIndex].load());
+  }
+}
+
+/// Measures the CPU time for preparing the sprite vertices of 10k objects on a synthetic map (projecting
+/// their map coordinates, computing their screen rects, and writing their vertices) serially and with
+/// one SpriteVertexArena per chunk of objects on a WorkerPool. This does not require an OpenGL context. Run with:
+/// FreeAgeTest --gtest_also_run_disabled_tests --gtest_filter=SpriteVertexArena.DISABLED_FramePreparationBenchmark
+TEST(SpriteVertexArena, DISABLED_FramePreparationBenchmark) {
+  srand(0);
+  
+  constexpr int kMapSize = 200;
+  constexpr int kNumObjects = 10000;
+  constexpr int kNumFrames = 100;
+  constexpr int kChunksPerThread = 4;
+  constexpr int kVertexSize = 36;
+  
+  Map testMap(kMapSize, kMapSize);
+  for (int y = 0; y <= kMapSize; ++ y) {
+    for (int x = 0; x <= kMapSize; ++ x) {
+      testMap.elevationAt(x, y) = rand() % 3;
+    }
+  }
+  
+  std::vector<Sprite::Frame> frames(80);
+  for (Sprite::Frame& frame : frames) {
+    frame.graphic.imageWidth = 40 + rand() % 20;
+    frame.graphic.imageHeight = 60 + rand() % 20;
+    frame.graphic.centerX = frame.graphic.imageWidth / 2;
+    frame.graphic.centerY = frame.graphic.imageHeight - 10;
+    frame.graphic.atlasX = rand() % 1024;
+    frame.graphic.atlasY = rand() % 1024;
+    frame.graphic.rotated = false;
+  }
+  Sprite sprite;
+  sprite.SetFrames(std::move(frames));
+  
+  std::vector<QPointF> mapCoords(kNumObjects);
+  for (QPointF& mapCoord : mapCoords) {
+    mapCoord = QPointF(kMapSize * (rand() / (1.0 + RAND_MAX)), kMapSize * (rand() / (1.0 + RAND_MAX)));
+  }
+  
+  Texture textures[2];
+  QRectF viewRect(-1e6, -1e6, 2e6, 2e6);
+  auto prepareObjects = [&](int frame, usize begin, usize end, SpriteVertexArena* arena) {
+    for (usize i = begin; i < end; ++ i) {
+      QPointF centerProjectedCoord = testMap.MapCoordToProjectedCoord(mapCoords[i]);
+      int frameIndex = (frame + i) % sprite.NumFrames();
+      const Sprite::Frame::Layer& layer = sprite.frame(frameIndex).graphic;
+      QRectF rect(centerProjectedCoord.x() - layer.centerX, centerProjectedCoord.y() - layer.centerY, layer.imageWidth, layer.imageHeight);
+      if (rect.intersects(viewRect)) {
+        WriteSpriteVertex(
+            sprite, centerProjectedCoord, frameIndex, /*shadow*/ false, /*outline*/ false, qRgb(255, 255, 255), /*playerIndex*/ i % 8, 1.f,
+            arena->Allocate(&textures[i % 2], kVertexSize));
+      }
+    }
+  };
+  
+  SpriteVertexArena serialArena;
+  Timer serialTimer("FramePreparationBenchmark - serial");
+  for (int frame = 0; frame < kNumFrames; ++ frame) {
+    serialArena.Clear();
+    prepareObjects(frame, 0, kNumObjects, &serialArena);
+  }
+  serialTimer.Stop();
+  
+  WorkerPool pool;
+  int numChunks = kChunksPerThread * pool.GetNumThreads();
+  std::vector<SpriteVertexArena> arenas(numChunks);
+  Timer parallelTimer("FramePreparationBenchmark - parallel");
+  for (int frame = 0; frame < kNumFrames; ++ frame) {
+    pool.ParallelFor(numChunks, [&](int chunkIndex) {
+      arenas[chunkIndex].Clear();
+      prepareObjects(frame, (kNumObjects * chunkIndex) / numChunks, (kNumObjects * (chunkIndex + 1)) / numChunks, &arenas[chunkIndex]);
+    });
+  }
+  parallelTimer.Stop();
+  
+  usize numParallelVertices = 0;
+  for (const SpriteVertexArena& arena : arenas) {
+    numParallelVertices += arena.GetNumVertices();
+  }
+  EXPECT_EQ(serialArena.GetNumVertices(), numParallelVertices);
+  
+  LOG(INFO) << "Threads: " << pool.GetNumThreads() << ", chunks: " << numChunks;
+  LOG(INFO) << Timing::print(kSortByTotal);
+}
+
+TEST(GlyphAtlas, RasterizesEachGlyphOnce) {
+  QFont font;
+  font.setPixelSize(20);
+  QRawFont rawFont = QRawFont::fromFont(font);
+  if (!rawFont.isValid()) {
+    GTEST_SKIP() << "No font available";
+  }
+  QVector<quint32> glyphIndexes = rawFont.glyphIndexesForString(QStringLiteral("AB"));
+  ASSERT_EQ(2, glyphIndexes.size());
+  
+  GlyphAtlas atlas(256);
+  const GlyphAtlas::Glyph* glyphA = atlas.GetGlyph(rawFont, glyphIndexes[0]);
+  const GlyphAtlas::Glyph* glyphB = atlas.GetGlyph(rawFont, glyphIndexes[1]);
+  ASSERT_TRUE(glyphA != nullptr);
+  ASSERT_TRUE(glyphB != nullptr);
+  EXPECT_FALSE(glyphA->atlasRect.isEmpty());
+  EXPECT_FALSE(glyphB->atlasRect.isEmpty());
+  EXPECT_FALSE(glyphA->atlasRect.intersects(glyphB->atlasRect));
+  EXPECT_FALSE(glyphA->atlasRect.intersects(atlas.GetSolidRect()));
+  EXPECT_EQ(2u, atlas.GetNumGlyphs());
+  
+  // The glyph must have been rasterized into its rect.
+  int coverage = 0;
+  for (int y = glyphA->atlasRect.top(); y <= glyphA->atlasRect.bottom(); ++ y) {
+    for (int x = glyphA->atlasRect.left(); x <= glyphA->atlasRect.right(); ++ x) {
+      coverage += atlas.GetImage().constScanLine(y)[x];
+    }
+  }
+  EXPECT_GT(coverage, 0);
+  
+  // Requesting a glyph again must not rasterize it again.
+  QRect rectA = glyphA->atlasRect;
+  EXPECT_EQ(rectA, atlas.GetGlyph(rawFont, glyphIndexes[0])->atlasRect);
+  EXPECT_EQ(2u, atlas.GetNumGlyphs());
+  
+  u32 generation = atlas.GetGeneration();
+  atlas.Clear();
+  EXPECT_EQ(0u, atlas.GetNumGlyphs());
+  EXPECT_NE(generation, atlas.GetGeneration());
+}
+
+TEST(GlyphAtlas, Overflow) {
+  QFont font;
+  font.setPixelSize(40);
+  QRawFont rawFont = QRawFont::fromFont(font);
+  if (!rawFont.isValid()) {
+    GTEST_SKIP() << "No font available";
+  }
+  QVector<quint32> glyphIndexes = rawFont.glyphIndexesForString(QStringLiteral("ABCDEFGHIJKLMNOPQRSTUVWXYZ"));
+  
+  // Add glyphs to a small atlas until it is full.
+  GlyphAtlas atlas(64);
+  std::vector<QRect> addedRects;
+  int firstRejectedIndex = -1;
+  for (int i = 0; i < glyphIndexes.size(); ++ i) {
+    const GlyphAtlas::Glyph* glyph = atlas.GetGlyph(rawFont, glyphIndexes[i]);
+    if (!glyph) {
+      firstRejectedIndex = i;
+      break;
+    }
+    addedRects.push_back(glyph->atlasRect);
+  }
+  ASSERT_GE(firstRejectedIndex, 0) << "The atlas did not overflow";
+  EXPECT_EQ(addedRects.size(), atlas.GetNumGlyphs());
+  
+  // The glyphs that were added before must stay valid and within the atlas.
+  for (usize i = 0; i < addedRects.size(); ++ i) {
+    EXPECT_TRUE(QRect(0, 0, 64, 64).contains(addedRects[i]));
+    EXPECT_FALSE(addedRects[i].intersects(atlas.GetSolidRect()));
+    for (usize k = i + 1; k < addedRects.size(); ++ k) {
+      EXPECT_FALSE(addedRects[i].intersects(addedRects[k]));
+    }
+    const GlyphAtlas::Glyph* glyph = atlas.GetGlyph(rawFont, glyphIndexes[i]);
+    ASSERT_TRUE(glyph != nullptr);
+    EXPECT_EQ(addedRects[i], glyph->atlasRect);
+  }
+  EXPECT_TRUE(atlas.GetGlyph(rawFont, glyphIndexes[firstRejectedIndex]) == nullptr);
+  
+  // After clearing, the rejected glyph fits again.
+  atlas.Clear();
+  EXPECT_TRUE(atlas.GetGlyph(rawFont, glyphIndexes[firstRejectedIndex]) != nullptr);
+  EXPECT_EQ(1u, atlas.GetNumGlyphs());
+}
+
+TEST(UIRenderer, BatchingAndClipping) {
+  // The textures are only used to identify the regions, so they do not need to be created on the GPU.
+  Texture textureA;
+  Texture textureB;
+  UITextureAtlas::Region regionA;
+  regionA.texture = &textureA;
+  regionA.layer = 2;
+  regionA.texLeft = 0.25f;
+  regionA.texTop = 0.5f;
+  regionA.texRight = 0.75f;
+  regionA.texBottom = 1.f;
+  UITextureAtlas::Region regionB = regionA;
+  regionB.texture = &textureB;
+  
+  // Consecutive quads with regions in the same texture are drawn with a single draw call.
+  UIRenderer renderer;
+  renderer.AddRegionQuad(0, 0, 10, 10, regionA, qRgb(255, 255, 255));
+  renderer.AddRegionQuad(20, 0, 10, 10, regionA, qRgb(255, 255, 255));
+  EXPECT_EQ(1u, renderer.GetPendingDrawCallCount());
+  renderer.AddRegionQuad(40, 0, 10, 10, regionB, qRgb(255, 255, 255));
+  EXPECT_EQ(2u, renderer.GetPendingDrawCallCount());
+  renderer.AddRegionQuad(60, 0, 10, 10, regionA, qRgb(255, 255, 255));
+  EXPECT_EQ(3u, renderer.GetPendingDrawCallCount());
+  EXPECT_EQ(4u * 6u, renderer.GetPendingVertices().size());
+  
+  // Clipping must not split up the draw calls.
+  renderer.SetClipRect(QRectF(65, 2, 100, 4));
+  renderer.AddRegionQuad(60, 0, 10, 10, regionA, qRgb(255, 255, 255));
+  EXPECT_EQ(3u, renderer.GetPendingDrawCallCount());
+  ASSERT_EQ(5u * 6u, renderer.GetPendingVertices().size());
+  
+  // The texture coordinates of the clipped quad must be reduced proportionally.
+  float minX = std::numeric_limits<float>::max();
+  float maxX = std::numeric_limits<float>::lowest();
+  float minY = std::numeric_limits<float>::max();
+  float maxY = std::numeric_limits<float>::lowest();
+  for (usize i = 4 * 6; i < 5 * 6; ++ i) {
+    const UIRenderer::Vertex& vertex = renderer.GetPendingVertices()[i];
+    minX = std::min(minX, vertex.x);
+    maxX = std::max(maxX, vertex.x);
+    minY = std::min(minY, vertex.y);
+    maxY = std::max(maxY, vertex.y);
+    EXPECT_FLOAT_EQ(0.25f + 0.5f * (vertex.x - 60) / 10, vertex.texX);
+    EXPECT_FLOAT_EQ(0.5f + 0.5f * vertex.y / 10, vertex.texY);
+    EXPECT_EQ(2, vertex.layer);
+  }
+  EXPECT_EQ(65, minX);
+  EXPECT_EQ(70, maxX);
+  EXPECT_EQ(2, minY);
+  EXPECT_EQ(6, maxY);
+  
+  // Quads outside of the clip rect are dropped.
+  renderer.AddRegionQuad(0, 0, 10, 10, regionB, qRgb(255, 255, 255));
+  EXPECT_EQ(5u * 6u, renderer.GetPendingVertices().size());
+  EXPECT_EQ(3u, renderer.GetPendingDrawCallCount());
+}
+
+TEST(DurationHistogram, Percentiles) {
+  DurationHistogram histogram;
+  EXPECT_EQ(0, histogram.GetPercentile(0.5));
+  
+  // 99 durations of 1 ms and one of 100 ms.
+  for (int i = 0; i < 99; ++ i) {
+    histogram.Add(0.001);
+  }
+  histogram.Add(0.1);
+  EXPECT_EQ(100u, histogram.GetCount());
+  EXPECT_DOUBLE_EQ(0.1, histogram.GetMax());
+  
+  // The percentiles are bucket bounds, which are within 19% of the actual value.
+  EXPECT_GE(histogram.GetPercentile(0.5), 0.001);
+  EXPECT_LE(histogram.GetPercentile(0.5), 0.00119);
+  EXPECT_GE(histogram.GetPercentile(0.99), 0.001);
+  EXPECT_LE(histogram.GetPercentile(0.99), 0.00119);
+  EXPECT_DOUBLE_EQ(0.1, histogram.GetPercentile(1));
+  
+  histogram.Reset();
+  EXPECT_EQ(0u, histogram.GetCount());
+}
+
+TEST(Timing, MergesThreadsAndExportsTrace) {
+  Timing::setTraceEnabled(true);
+  
+  constexpr int kNumThreads = 4;
+  constexpr int kSamplesPerThread = 1000;
+  usize handle = Timing::getHandle("TimingTest - sample");
+  Timing::reset(handle);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kNumThreads; ++ thread) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < kSamplesPerThread; ++ i) {
+        Timer timer("TimingTest - sample");
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(static_cast<usize>(kNumThreads * kSamplesPerThread), Timing::getNumSamples(handle));
+  EXPECT_LE(Timing::getMinSeconds(handle), Timing::getMaxSeconds(handle));
+  
+  std::filesystem::path tracePath = std::filesystem::temp_directory_path() / "FreeAgeTest_trace.json";
+  ASSERT_TRUE(Timing::writeChromeTrace(tracePath.string()));
+  Timing::setTraceEnabled(false);
+  std::ifstream traceFile(tracePath);
+  std::string trace((std::istreambuf_iterator<char>(traceFile)), std::istreambuf_iterator<char>());
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"TimingTest - sample\",\"ph\":\"X\""));
+  std::filesystem::remove(tracePath);
+  
+  Timing::reset(handle);
+  EXPECT_EQ(0u, Timing::getNumSamples(handle));
+}
+
+TEST(StatsDatabase, LoadOverridesAndKeepsDefaults) {
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "FreeAgeTest_stats.yaml";
+  {
+    std::ofstream stream(path);
+    stream << "units:\n"
+              "  Villager:\n"
+              "    maxHP: 30\n"
+              "  MaleVillagerBuilder:\n"
+              "    maxHP: 35\n"
+              "  Militia:\n"
+              "    cost: {gold: 15}\n"
+              "buildings:\n"
+              "  House:\n"
+              "    size: [3, 2]\n";
+  }
+  
+  ASSERT_TRUE(LoadStatsDatabase(path));
+  EXPECT_EQ(30u, GetUnitMaxHP(UnitType::FemaleVillagerForager));
+  EXPECT_EQ(35u, GetUnitMaxHP(UnitType::MaleVillagerBuilder));
+  EXPECT_EQ(GetDefaultUnitStats(UnitType::FemaleVillager).radius, GetUnitRadius(UnitType::FemaleVillager));
+  EXPECT_EQ(ResourceAmount(0, 60, 15, 0), GetUnitCost(UnitType::Militia));
+  EXPECT_EQ(QSize(3, 2), GetBuildingSize(BuildingType::House));
+  EXPECT_EQ(GetDefaultBuildingStats(BuildingType::House).maxHP, GetBuildingMaxHP(BuildingType::House));
+  
+  // A file with errors must not change the stats.
+  {
+    std::ofstream stream(path);
+    stream << "units:\n"
+              "  Scout:\n"
+              "    maxHP: 100\n"
+              "  Militia:\n"
+              "    maxHP: not a number\n";
+  }
+  EXPECT_FALSE(LoadStatsDatabase(path));
+  EXPECT_EQ(GetDefaultUnitStats(UnitType::Scout).maxHP, GetUnitMaxHP(UnitType::Scout));
+  EXPECT_EQ(30u, GetUnitMaxHP(UnitType::FemaleVillager));
+  
+  ResetStatsDatabase();
+  EXPECT_EQ(GetDefaultUnitStats(UnitType::FemaleVillager).maxHP, GetUnitMaxHP(UnitType::FemaleVillager));
+  EXPECT_EQ(GetDefaultBuildingStats(BuildingType::House).size, GetBuildingSize(BuildingType::House));
+  std::filesystem::remove(path);
+}
+
+TEST(TargetIndex, FindsClosestEnemyUnitInRadius) {
+  ServerMap map(40, 40);
+  std::vector<ServerUnit*> units = {
+      map.AddUnit(0, UnitType::Militia, QPointF(10, 10)),
+      map.AddUnit(0, UnitType::Militia, QPointF(10.5f, 10)),  // same player as the querying unit
+      map.AddUnit(1, UnitType::Militia, QPointF(13, 10)),
+      map.AddUnit(1, UnitType::Militia, QPointF(7.5f, 11)),   // closest enemy, in a different grid cell
+      map.AddUnit(1, UnitType::Militia, QPointF(30, 30)),
+      map.AddUnit(kGaiaPlayerIndex, UnitType::Militia, QPointF(10, 10.5f))};
+  const TargetIndex& index = map.GetTargetIndex();
+  
+  ServerObject* target = nullptr;
+  EXPECT_EQ(3u, index.FindTarget(0, QPointF(10, 10), 4, &target));
+  EXPECT_EQ(units[3], target);
+  EXPECT_EQ(kInvalidObjectId, index.FindTarget(0, QPointF(10, 10), 2, &target));
+  EXPECT_EQ(1u, index.FindTarget(1, QPointF(13, 10), 3.5f, &target));
+  EXPECT_EQ(4u, index.FindTarget(0, QPointF(39, 39), 20, &target));
+  
+  // After moving a unit, the index reflects the new position.
+  map.MoveUnit(units[4], QPointF(10, 9));
+  EXPECT_EQ(4u, index.FindTarget(0, QPointF(10, 10), 4, &target));
+  
+  // Units with the same distance are ordered by their IDs, regardless of the order of the units in the grid.
+  for (int reversed = 0; reversed < 2; ++ reversed) {
+    map.MoveUnit(units[2], QPointF(30, 20));
+    map.MoveUnit(units[4], QPointF(30, 20));
+    map.MoveUnit(units[reversed ? 4 : 2], reversed ? QPointF(10, 9) : QPointF(10, 11));
+    map.MoveUnit(units[reversed ? 2 : 4], reversed ? QPointF(10, 11) : QPointF(10, 9));
+    EXPECT_EQ(2u, index.FindTarget(0, QPointF(10, 10), 4, &target));
+  }
+  
+  // Deleted units are not found anymore.
+  map.DeleteObject(2);
+  EXPECT_EQ(4u, index.FindTarget(0, QPointF(10, 10), 4, &target));
+}
+
+TEST(TargetIndex, FindsEnemyBuildingsIfThereAreNoEnemyUnits) {
+  ServerMap map(40, 40);
+  ServerUnit* enemyUnit = map.AddUnit(1, UnitType::Militia, QPointF(30, 30));
+  ServerBuilding* enemyHouse = map.AddBuilding(1, BuildingType::House, QPoint(12, 9), 100.f);
+  map.AddBuilding(0, BuildingType::House, QPoint(6, 9), 100.f);
+  map.AddBuilding(kGaiaPlayerIndex, BuildingType::TreeOak, QPoint(9, 12), 100.f);
+  const TargetIndex& index = map.GetTargetIndex();
+  
+  // The distance to the house is measured to its closest point, which is 2 tiles away,
+  // although its center is further away than the search radius.
+  ServerObject* target = nullptr;
+  EXPECT_EQ(1u, index.FindTarget(0, QPointF(10, 10), 2.5f, &target));
+  EXPECT_EQ(enemyHouse, target);
+  EXPECT_EQ(kInvalidObjectId, index.FindTarget(0, QPointF(10, 10), 1.5f, &target));
+  
+  // Enemy units are preferred over buildings, even if they are further away.
+  map.MoveUnit(enemyUnit, QPointF(10, 7.5f));
+  EXPECT_EQ(0u, index.FindTarget(0, QPointF(10, 10), 2.5f, &target));
+  
+  // Deleted buildings are not found anymore.
+  map.DeleteObject(0);
+  map.DeleteObject(1);
+  EXPECT_EQ(kInvalidObjectId, index.FindTarget(0, QPointF(10, 10), 2.5f, &target));
+}
+
+TEST(TargetIndex, IgnoresFoundationsUntilTheirConstructionStarts) {
+  ServerMap map(40, 40);
+  u32 foundationId;
+  ServerBuilding* foundation = map.AddBuilding(1, BuildingType::House, QPoint(12, 9), /*buildPercentage*/ 0, &foundationId, /*addOccupancy*/ false);
+  const TargetIndex& index = map.GetTargetIndex();
+  
+  // The foundation is only known to its owner, so it must not be attacked.
+  ServerObject* target = nullptr;
+  EXPECT_EQ(kInvalidObjectId, index.FindTarget(0, QPointF(10, 10), 2.5f, &target));
+  
+  // Deleting a foundation that was never indexed does not affect the index.
+  map.DeleteObject(foundationId);
+  EXPECT_EQ(kInvalidObjectId, index.FindTarget(0, QPointF(10, 10), 2.5f, &target));
+  
+  // Once the construction starts, the foundation can be attacked.
+  foundation = map.AddBuilding(1, BuildingType::House, QPoint(12, 9), /*buildPercentage*/ 0, &foundationId, /*addOccupancy*/ false);
+  map.AddBuildingOccupancy(foundation);
+  map.AddBuildingTarget(foundationId, foundation);
+  EXPECT_EQ(foundationId, index.FindTarget(0, QPointF(10, 10), 2.5f, &target));
+  EXPECT_EQ(foundation, target);
+  
+  map.DeleteObject(foundationId);
+  EXPECT_EQ(kInvalidObjectId, index.FindTarget(0, QPointF(10, 10), 2.5f, &target));
+}
+
+TEST(CrowdSteering, UnitsOnCollisionCourseEvadeEachOther) {
+  ServerMap map(40, 40);
+  std::vector<ServerUnit*> units = {
+      map.AddUnit(0, UnitType::Militia, QPointF(10, 10)),
+      map.AddUnit(1, UnitType::Militia, QPointF(11.5f, 10)),
+      map.AddUnit(0, UnitType::Militia, QPointF(30, 30)),  // far away from the others
+      map.AddUnit(0, UnitType::Militia, QPointF(10, 12))};  // standing still
+  units[0]->SetMovementDirection(QPointF(1, 0));
+  units[1]->SetMovementDirection(QPointF(-1, 0));
+  units[2]->SetMovementDirection(QPointF(0, 1));
+  
+  constexpr float kStepLength = 1 / 30.f;
+  CrowdSteering steering;
+  steering.ComputeVelocities({0, 1, 2, 3}, map, kStepLength);
+  
+  QPointF velocities[3];
+  for (int i = 0; i < 3; ++ i) {
+    ASSERT_TRUE(steering.GetVelocity(i, &velocities[i]));
+    EXPECT_LE(Length(velocities[i]), units[i]->GetMoveSpeed() + 1e-4f);
+  }
+  EXPECT_FALSE(steering.GetVelocity(3, &velocities[0]));
+  
+  // The units that walk towards each other both evade to the side, in opposite directions.
+  EXPECT_GT(std::abs(velocities[0].y()), 0.05f);
+  EXPECT_LT(velocities[0].y() * velocities[1].y(), 0);
+  // The velocities do not lead to a collision within a short time.
+  float combinedRadius = 2 * GetUnitRadius(UnitType::Militia);
+  for (float time = 0; time < 1; time += kStepLength) {
+    EXPECT_GE(Distance(units[0]->GetMapCoord() + time * velocities[0], units[1]->GetMapCoord() + time * velocities[1]), combinedRadius - 1e-3f);
+  }
+  // The unit without neighbors keeps its velocity.
+  EXPECT_NEAR(0, velocities[2].x(), 1e-5f);
+  EXPECT_NEAR(units[2]->GetMoveSpeed(), velocities[2].y(), 1e-5f);
+  
+  // The result does not depend on the order of the IDs or of the units in the grid. The units
+  // that stand still do not need to be passed in, and IDs of objects that do not exist are ignored.
+  map.MoveUnit(units[0], QPointF(30, 10));
+  map.MoveUnit(units[0], QPointF(10, 10));
+  steering.ComputeVelocities({99, 2, 1, 0}, map, kStepLength);
+  for (int i = 0; i < 3; ++ i) {
+    QPointF velocity;
+    ASSERT_TRUE(steering.GetVelocity(i, &velocity));
+    EXPECT_EQ(velocities[i], velocity);
+  }
+}
+
+TEST(ServerMap, DoesUnitCollideFindsTheCollidingUnitWithTheLowestId) {
+  ServerMap map(40, 40);
+  float radius = GetUnitRadius(UnitType::Militia);
+  ServerUnit* unit = map.AddUnit(0, UnitType::Militia, QPointF(10, 10));
+  ServerUnit* farUnit = map.AddUnit(1, UnitType::Militia, QPointF(30, 30));
+  ServerUnit* closeUnit = map.AddUnit(1, UnitType::Militia, QPointF(10 + 3 * radius, 10));
+  
+  ServerUnit* collidingUnit = nullptr;
+  EXPECT_FALSE(map.DoesUnitCollide(unit, QPointF(10, 10), &collidingUnit));
+  EXPECT_TRUE(map.DoesUnitCollide(unit, QPointF(10 + 2 * radius, 10), &collidingUnit));
+  EXPECT_EQ(closeUnit, collidingUnit);
+  
+  // After moving a unit into a different grid cell, it is tested at its new position.
+  map.MoveUnit(farUnit, QPointF(10 + 3 * radius, 10 + radius));
+  EXPECT_TRUE(map.DoesUnitCollide(unit, QPointF(10 + 2 * radius, 10 + 0.5f * radius), &collidingUnit));
+  EXPECT_EQ(farUnit, collidingUnit);
+  
+  // Deleted units do not collide anymore.
+  map.DeleteObject(1);
+  map.DeleteObject(2);
+  EXPECT_FALSE(map.DoesUnitCollide(unit, QPointF(10 + 2 * radius, 10 + 0.5f * radius), &collidingUnit));
+}
+
+TEST(ObjectScheduler, SimulatesActiveAndWokenObjectsInIdOrder) {
+  ServerUnit unit(0, UnitType::Militia, QPointF(10, 10));
+  std::unordered_map<u32, ServerObject*> objects = {{3, &unit}, {1, &unit}, {2, &unit}};
+  
+  ObjectScheduler scheduler;
+  scheduler.WakeAll(objects);
+  EXPECT_EQ(std::vector<u32>({1, 2, 3}), scheduler.BeginStep(0));
+  
+  // Object 2 stays active, object 1 goes to sleep until step 3, object 3 sleeps until woken.
+  scheduler.KeepActive(2);
+  scheduler.WakeAt(1, 3);
+  EXPECT_EQ(std::vector<u32>({2}), scheduler.BeginStep(1));
+  
+  scheduler.Wake(3);
+  scheduler.Wake(2);
+  EXPECT_EQ(std::vector<u32>({2, 3}), scheduler.BeginStep(2));
+  
+  scheduler.KeepActive(3);
+  EXPECT_EQ(std::vector<u32>({1, 3}), scheduler.BeginStep(3));
+  EXPECT_TRUE(scheduler.BeginStep(4).empty());
+}
+
+TEST(OccupancyGrid, SpanQueriesMatchPerTileTests) {
+  // Use a width that is not a multiple of 64 such that spans cross word boundaries and end in a partial word.
+  constexpr int kWidth = 150;
+  constexpr int kHeight = 20;
+  OccupancyGrid grid(kWidth, kHeight);
+  std::vector<bool> reference(kWidth * kHeight, false);
+  
+  srand(0);
+  for (int i = 0; i < 200; ++ i) {
+    int minX = rand() % kWidth;
+    int minY = rand() % kHeight;
+    int maxX = minX + rand() % 8;
+    int maxY = minY + rand() % 8;
+    bool occupied = (i % 3) != 0;
+    grid.SetRect(minX, minY, maxX, maxY, occupied);
+    for (int y = minY; y <= std::min(kHeight - 1, maxY); ++ y) {
+      for (int x = minX; x <= std::min(kWidth - 1, maxX); ++ x) {
+        reference[x + kWidth * y] = occupied;
+      }
+    }
+  }
+  
+  for (int y = 0; y < kHeight; ++ y) {
+    for (int x = 0; x < kWidth; ++ x) {
+      ASSERT_EQ(reference[x + kWidth * y], grid.IsOccupied(x, y));
+    }
+  }
+  
+  for (int i = 0; i < 1000; ++ i) {
+    int minX = rand() % kWidth - 10;
+    int minY = rand() % kHeight - 2;
+    int maxX = minX + rand() % 140;
+    int maxY = minY + rand() % 4;
+    
+    bool expected = false;
+    for (int y = std::max(0, minY); y <= std::min(kHeight - 1, maxY); ++ y) {
+      for (int x = std::max(0, minX); x <= std::min(kWidth - 1, maxX); ++ x) {
+        expected |= reference[x + kWidth * y];
+      }
+    }
+    ASSERT_EQ(expected, grid.IsAnyOccupiedInRect(minX, minY, maxX, maxY));
+  }
+  
+  EXPECT_FALSE(grid.IsAnyOccupiedInRowSpan(0, 10, 9));
+  EXPECT_FALSE(grid.IsAnyOccupiedInRowSpan(-1, 0, kWidth - 1));
+}
+
+TEST(Pathfinding, AnyAnglePathLeadsAroundObstacles) {
+  // Block the direct way from the start to the goal with a wall of trees.
+  ServerMap map(40, 40);
+  for (int y = 5; y < 30; ++ y) {
+    map.AddBuilding(kGaiaPlayerIndex, BuildingType::TreeOak, QPoint(20, y), 100);
+  }
+  // Enclose a tile with trees such that it cannot be reached.
+  for (int y = 33; y <= 37; ++ y) {
+    for (int x = 33; x <= 37; ++ x) {
+      if (x == 33 || x == 37 || y == 33 || y == 37) {
+        map.AddBuilding(kGaiaPlayerIndex, BuildingType::TreeOak, QPoint(x, y), 100);
+      }
+    }
+  }
+  
+  float unitRadius = GetUnitRadius(UnitType::FemaleVillager);
+  QPointF start(10.5f, 20.5f);
+  QPointF goal(30.5f, 20.5f);
+  QRect goalRect(30, 20, 1, 1);
+  
+  auto pathLength = [&](const std::vector<QPointF>& reversePath) {
+    float length = 0;
+    QPointF previousPoint = start;
+    for (auto it = reversePath.rbegin(); it != reversePath.rend(); ++ it) {
+      length += Distance(previousPoint, *it);
+      previousPoint = *it;
+    }
+    return length;
+  };
+  
+  std::vector<QPointF> gridPath;
+  ASSERT_TRUE(FindPath(PathPlanner::Grid, unitRadius, start, goalRect, goal, &map, &gridPath));
+  std::vector<QPointF> anyAnglePath;
+  ASSERT_TRUE(FindPath(PathPlanner::AnyAngle, unitRadius, start, goalRect, goal, &map, &anyAnglePath));
+  
+  ASSERT_FALSE(anyAnglePath.empty());
+  EXPECT_EQ(goal, anyAnglePath.front());
+  // The path must lead around the wall, i.e., pass above or below it.
+  EXPECT_TRUE(std::any_of(anyAnglePath.begin(), anyAnglePath.end(), [](const QPointF& p) { return p.y() < 5 || p.y() > 30; }));
+  // The path must not cut through the wall's end tiles.
+  QPointF previousPoint = start;
+  for (auto it = anyAnglePath.rbegin(); it != anyAnglePath.rend(); ++ it) {
+    for (int i = 0; i <= 100; ++ i) {
+      QPointF point = previousPoint + (i / 100.f) * (*it - previousPoint);
+      EXPECT_FALSE(map.occupiedForUnitsAt(point.x(), point.y()));
+    }
+    previousPoint = *it;
+  }
+  EXPECT_LE(pathLength(anyAnglePath), pathLength(gridPath) + 1e-3f);
+  
+  // If the goal cannot be reached, the path leads next to the enclosure.
+  ASSERT_TRUE(FindPath(PathPlanner::AnyAngle, unitRadius, start, QRect(35, 35, 1, 1), QPointF(35.5f, 35.5f), &map, &anyAnglePath));
+  ASSERT_FALSE(anyAnglePath.empty());
+  EXPECT_NEAR(3, Distance(anyAnglePath.front(), QPointF(35.5f, 35.5f)), 1e-3f);
+}
+
+TEST(Pathfinding, PathCacheReusesPathsUntilTheirRegionsChange) {
+  ServerMap map(40, 40);
+  for (int y = 5; y < 30; ++ y) {
+    map.AddBuilding(kGaiaPlayerIndex, BuildingType::TreeOak, QPoint(20, y), 100);
+  }
+  u32 houseId;
+  ServerBuilding* house = map.AddBuilding(0, BuildingType::House, QPoint(30, 20), 100, &houseId);
+  QRect houseRect(house->GetBaseTile(), GetBuildingSize(BuildingType::House));
+  QPointF houseCenter(houseRect.x() + 0.5f * houseRect.width(), houseRect.y() + 0.5f * houseRect.height());
+  u32 treeId;
+  map.AddBuilding(kGaiaPlayerIndex, BuildingType::TreeOak, QPoint(10, 18), 100, &treeId);
+  QRect treeRect(10, 18, 1, 1);
+  
+  PathCache cache;
+  float unitRadius = PathCache::GetPlanningRadius(GetUnitRadius(UnitType::FemaleVillager));
+  QPointF start(10.5f, 20.5f);
+  std::vector<QPointF> reversePath;
+  EXPECT_FALSE(cache.Lookup(unitRadius, start, houseId, houseRect, houseCenter, &map, &reversePath));
+  ASSERT_TRUE(FindPath(PathPlanner::AnyAngle, unitRadius, start, houseRect, houseCenter, &map, &reversePath));
+  cache.Insert(unitRadius, start, houseId, houseRect, reversePath, &map);
+  
+  // Another unit close to the first one's start gets the same path to the house.
+  std::vector<QPointF> cachedPath;
+  ASSERT_TRUE(cache.Lookup(unitRadius, QPointF(11.2f, 20.7f), houseId, houseRect, houseCenter, &map, &cachedPath));
+  ASSERT_FALSE(cachedPath.empty());
+  EXPECT_EQ(reversePath.front(), cachedPath.front());
+  
+  // The path is used in reverse to get from the house back to the tree.
+  ASSERT_TRUE(cache.Lookup(unitRadius, QPointF(29.3f, 21.f), treeId, treeRect, QPointF(10.5f, 18.5f), &map, &cachedPath));
+  EXPECT_EQ(QPointF(10.5f, 18.5f), cachedPath.front());
+  EXPECT_EQ(2u, cache.GetHitCount());
+  
+  // Changing the occupancy next to the path invalidates it.
+  map.AddBuilding(kGaiaPlayerIndex, BuildingType::TreeOak, QPoint(20, 2), 100);
+  map.AddBuilding(kGaiaPlayerIndex, BuildingType::TreeOak, QPoint(20, 32), 100);
+  EXPECT_FALSE(cache.Lookup(unitRadius, start, houseId, houseRect, houseCenter, &map, &cachedPath));
+  EXPECT_EQ(2u, cache.GetMissCount());
+}
@@ -0,0 +1,205 @@
+/** @file SkylineBinPack.cpp
+    @author Jukka Jylänki
+
+    @brief Implements different bin packer algorithms that use the SKYLINE data structure.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include <cassert>
+
+#include "SkylineBinPack.h"
+
+namespace rbp {
+
+using namespace std;
+
+SkylineBinPack::SkylineBinPack()
+:binWidth(0),
+binHeight(0),
+usedSurfaceArea(0),
+usedHeight(0)
+{
+}
+
+SkylineBinPack::SkylineBinPack(int width, int height)
+{
+    Init(width, height);
+}
+
+void SkylineBinPack::Init(int width, int height)
+{
+    binWidth = width;
+    binHeight = height;
+
+    usedSurfaceArea = 0;
+    usedHeight = 0;
+
+    skyLine.clear();
+    SkylineNode node;
+    node.x = 0;
+    node.y = 0;
+    node.width = binWidth;
+    skyLine.push_back(node);
+}
+
+Rect SkylineBinPack::Insert(int width, int height)
+{
+    int bestHeight;
+    int bestWidth;
+    int bestIndex;
+    Rect newNode = FindPositionForNewNodeBottomLeft(width, height, bestHeight, bestWidth, bestIndex);
+
+    if (bestIndex != -1)
+    {
+        AddSkylineLevel(bestIndex, newNode);
+        usedSurfaceArea += width * height;
+        usedHeight = max(usedHeight, newNode.y + newNode.height);
+    }
+    else
+        newNode = Rect{0, 0, 0, 0};
+
+    return newNode;
+}
+
+void SkylineBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst, std::vector<int> &dstOriginalIndices)
+{
+    dst.clear();
+    dstOriginalIndices.clear();
+
+    // Insert the rectangles sorted by decreasing height (and decreasing width for equal heights).
+    std::vector<int> order(rects.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        if (rects[a].height != rects[b].height)
+            return rects[a].height > rects[b].height;
+        return rects[a].width > rects[b].width;
+    });
+
+    std::vector<bool> packed(rects.size(), false);
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        const RectSize &size = rects[order[i]];
+        Rect newNode = Insert(size.width, size.height);
+        if (newNode.height == 0)
+            continue;
+
+        dst.push_back(newNode);
+        dstOriginalIndices.push_back(order[i]);
+        packed[order[i]] = true;
+    }
+
+    // Remove the rectangles that were packed successfully.
+    size_t outputIndex = 0;
+    for(size_t i = 0; i < rects.size(); ++i)
+    {
+        if (!packed[i])
+            rects[outputIndex++] = rects[i];
+    }
+    rects.resize(outputIndex);
+}
+
+bool SkylineBinPack::RectangleFits(int skylineNodeIndex, int width, int height, int &y) const
+{
+    int x = skyLine[skylineNodeIndex].x;
+    if (x + width > binWidth)
+        return false;
+    int widthLeft = width;
+    int i = skylineNodeIndex;
+    y = skyLine[skylineNodeIndex].y;
+    while(widthLeft > 0)
+    {
+        y = max(y, skyLine[i].y);
+        if (y + height > binHeight)
+            return false;
+        widthLeft -= skyLine[i].width;
+        ++i;
+        assert(i < (int)skyLine.size() || widthLeft <= 0);
+    }
+    return true;
+}
+
+Rect SkylineBinPack::FindPositionForNewNodeBottomLeft(int width, int height, int &bestHeight, int &bestWidth, int &bestIndex) const
+{
+    bestHeight = std::numeric_limits<int>::max();
+    bestIndex = -1;
+    // Used to break ties if there are nodes at the same level. Then pick the narrowest one.
+    bestWidth = std::numeric_limits<int>::max();
+    Rect newNode = Rect{0, 0, 0, 0};
+    for(size_t i = 0; i < skyLine.size(); ++i)
+    {
+        int y;
+        if (RectangleFits(i, width, height, y))
+        {
+            if (y + height < bestHeight || (y + height == bestHeight && skyLine[i].width < bestWidth))
+            {
+                bestHeight = y + height;
+                bestIndex = i;
+                bestWidth = skyLine[i].width;
+                newNode.x = skyLine[i].x;
+                newNode.y = y;
+                newNode.width = width;
+                newNode.height = height;
+            }
+        }
+    }
+
+    return newNode;
+}
+
+void SkylineBinPack::AddSkylineLevel(int skylineNodeIndex, const Rect &rect)
+{
+    SkylineNode newNode;
+    newNode.x = rect.x;
+    newNode.y = rect.y + rect.height;
+    newNode.width = rect.width;
+    skyLine.insert(skyLine.begin() + skylineNodeIndex, newNode);
+
+    assert(newNode.x + newNode.width <= binWidth);
+    assert(newNode.y <= binHeight);
+
+    for(size_t i = skylineNodeIndex+1; i < skyLine.size(); ++i)
+    {
+        assert(skyLine[i-1].x <= skyLine[i].x);
+
+        if (skyLine[i].x < skyLine[i-1].x + skyLine[i-1].width)
+        {
+            int shrink = skyLine[i-1].x + skyLine[i-1].width - skyLine[i].x;
+
+            skyLine[i].x += shrink;
+            skyLine[i].width -= shrink;
+
+            if (skyLine[i].width <= 0)
+            {
+                skyLine.erase(skyLine.begin() + i);
+                --i;
+            }
+            else
+                break;
+        }
+        else
+            break;
+    }
+    MergeSkylines();
+}
+
+void SkylineBinPack::MergeSkylines()
+{
+    for(size_t i = 0; i + 1 < skyLine.size(); ++i)
+        if (skyLine[i].y == skyLine[i+1].y)
+        {
+            skyLine[i].width += skyLine[i+1].width;
+            skyLine.erase(skyLine.begin() + (i+1));
+            --i;
+        }
+}
+
+float SkylineBinPack::Occupancy() const
+{
+    return (float)usedSurfaceArea / (binWidth * binHeight);
+}
+
+}
@@ -0,0 +1,84 @@
+/** @file SkylineBinPack.h
+    @author Jukka Jylänki
+
+    @brief Implements different bin packer algorithms that use the SKYLINE data structure.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#pragma once
+
+#include <vector>
+
+#include "Rect.h"
+
+namespace rbp {
+
+/** Implements bin packing algorithms that use the SKYLINE data structure to store the bin contents.
+    Compared to MaxRectsBinPack, this is much faster (roughly linear in the number of rectangles
+    for batch insertion), at the cost of a somewhat less dense packing. */
+class SkylineBinPack
+{
+public:
+    /// Instantiates a bin of size (0,0). Call Init to create a new bin.
+    SkylineBinPack();
+
+    /// Instantiates a bin of the given size.
+    SkylineBinPack(int binWidth, int binHeight);
+
+    /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
+    /// you need to restart with a new bin.
+    void Init(int binWidth, int binHeight);
+
+    /// Inserts a single rectangle into the bin using the bottom-left rule. The rectangle is never rotated.
+    /// @return The packed rectangle, or a rectangle with height 0 if it did not fit.
+    Rect Insert(int width, int height);
+
+    /// Inserts the given list of rectangles in an offline/batch mode. The rectangles are inserted
+    /// in order of decreasing height, which gives a good packing for the skyline data structure.
+    /// Rectangles which were packed successfully are removed from rects, so if rects is empty
+    /// afterwards, all rectangles were packed.
+    /// @param dst [out] This list will contain the packed rectangles.
+    /// @param dstOriginalIndices [out] For each item in dst, the corresponding item in this list gives its original index in the rects vector.
+    void Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst, std::vector<int> &dstOriginalIndices);
+
+    /// Returns the maximum y-coordinate (exclusive) that is covered by the packed rectangles.
+    int UsedHeight() const { return usedHeight; }
+
+    /// Computes the ratio of used surface area to the total bin area.
+    float Occupancy() const;
+
+private:
+    /// Represents a single level (a horizontal line) of the skyline/horizon/envelope.
+    struct SkylineNode
+    {
+        /// The starting x-coordinate (leftmost).
+        int x;
+
+        /// The y-coordinate of the skyline level line.
+        int y;
+
+        /// The line width. The ending coordinate (inclusive) will be x+width-1.
+        int width;
+    };
+
+    int binWidth;
+    int binHeight;
+
+    unsigned long usedSurfaceArea;
+    int usedHeight;
+
+    std::vector<SkylineNode> skyLine;
+
+    /// Returns whether a rectangle of the given size fits on top of the skyline, starting at the given node.
+    /// If yes, returns the y-coordinate at which it would be placed in y.
+    bool RectangleFits(int skylineNodeIndex, int width, int height, int &y) const;
+
+    Rect FindPositionForNewNodeBottomLeft(int width, int height, int &bestHeight, int &bestWidth, int &bestIndex) const;
+
+    void AddSkylineLevel(int skylineNodeIndex, const Rect &rect);
+
+    /// Merges all skyline nodes that are at the same level.
+    void MergeSkylines();
+};
+
+}